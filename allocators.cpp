@@ -0,0 +1,155 @@
+#include "allocators.h"
+
+#include <cstring>
+
+//--------------------------------------------------------------------------------------
+// LinearArena
+//--------------------------------------------------------------------------------------
+LinearArena::LinearArena()
+{
+	_pBase = nullptr;
+	_capacity = 0;
+	_offset = 0;
+	_peak = 0;
+	_backingTag = MEMTAG_GENERAL;
+	memset(_tagBytes, 0, sizeof(_tagBytes));
+}
+
+LinearArena::~LinearArena()
+{
+	Shutdown();
+}
+
+bool LinearArena::Init(size_t capacity, MemoryTag backingTag)
+{
+	Shutdown();
+
+	_pBase = static_cast<uint8_t*>(MemoryTracker::Allocate(capacity, 64, backingTag));
+
+	if (_pBase == nullptr)
+		return false;
+
+	_capacity = capacity;
+	_backingTag = backingTag;
+
+	return true;
+}
+
+void LinearArena::Shutdown()
+{
+	if (_pBase == nullptr)
+		return;
+
+	Reset();
+	MemoryTracker::Free(_pBase, _capacity, _backingTag);
+
+	_pBase = nullptr;
+	_capacity = 0;
+	_peak = 0;
+}
+
+void* LinearArena::Alloc(size_t bytes, size_t alignment, MemoryTag tag)
+{
+	if (_pBase == nullptr)
+		return nullptr;
+
+	// The address is aligned rather than the offset, the base is only 64 byte aligned
+	uintptr_t base = reinterpret_cast<uintptr_t>(_pBase);
+	size_t aligned = (size_t)(((base + _offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+
+	if (aligned + bytes > _capacity)
+		return nullptr;
+
+	_offset = aligned + bytes;
+
+	if (_offset > _peak)
+		_peak = _offset;
+
+	_tagBytes[tag] += bytes;
+	MemoryTracker::Track(tag, bytes);
+
+	return _pBase + aligned;
+}
+
+ArenaMarker LinearArena::GetMarker() const
+{
+	ArenaMarker marker;
+	marker.offset = _offset;
+	memcpy(marker.tagBytes, _tagBytes, sizeof(_tagBytes));
+
+	return marker;
+}
+
+void LinearArena::Rewind(const ArenaMarker& marker)
+{
+	if (marker.offset > _offset)
+		return;
+
+	for (int i = 0; i < MEMTAG_COUNT; i++)
+	{
+		MemoryTracker::Untrack((MemoryTag)i, _tagBytes[i] - marker.tagBytes[i]);
+		_tagBytes[i] = marker.tagBytes[i];
+	}
+
+	_offset = marker.offset;
+}
+
+void LinearArena::Reset()
+{
+	for (int i = 0; i < MEMTAG_COUNT; i++)
+	{
+		MemoryTracker::Untrack((MemoryTag)i, _tagBytes[i]);
+		_tagBytes[i] = 0;
+	}
+
+	_offset = 0;
+}
+
+//--------------------------------------------------------------------------------------
+// FrameArena
+//--------------------------------------------------------------------------------------
+FrameArena::FrameArena()
+{
+	_frameIndex = 0;
+}
+
+bool FrameArena::Init(size_t capacityPerFrame)
+{
+	if (!_arenas[0].Init(capacityPerFrame, MEMTAG_FRAME))
+		return false;
+
+	if (!_arenas[1].Init(capacityPerFrame, MEMTAG_FRAME))
+	{
+		_arenas[0].Shutdown();
+		return false;
+	}
+
+	_frameIndex = 0;
+
+	return true;
+}
+
+void FrameArena::Shutdown()
+{
+	_arenas[0].Shutdown();
+	_arenas[1].Shutdown();
+}
+
+void FrameArena::BeginFrame()
+{
+	_frameIndex++;
+	Current().Reset();
+}
+
+//--------------------------------------------------------------------------------------
+// ScratchArena
+//--------------------------------------------------------------------------------------
+LinearArena& ScratchArena::Get()
+{
+	static thread_local LinearArena arena;
+
+	if (!arena.IsInitialised())
+		arena.Init(DefaultCapacity, MEMTAG_SCRATCH);
+
+	return arena;
+}
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include "memorytracker.h"
+
+// Saved arena position, see LinearArena::GetMarker / Rewind
+struct ArenaMarker
+{
+	size_t offset;
+	size_t tagBytes[MEMTAG_COUNT];
+};
+
+//--------------------------------------------------------------------------------------
+// Linear (bump) arena. One heap block is taken up front, allocations just move an offset
+// forward and everything is released at once with Reset() or Rewind().
+//--------------------------------------------------------------------------------------
+class LinearArena
+{
+private:
+	uint8_t*  _pBase;
+	size_t    _capacity;
+	size_t    _offset;
+	size_t    _peak;
+	MemoryTag _backingTag;
+	size_t    _tagBytes[MEMTAG_COUNT];
+
+public:
+	LinearArena();
+	~LinearArena();
+
+	LinearArena(const LinearArena&) = delete;
+	LinearArena& operator=(const LinearArena&) = delete;
+
+	bool Init(size_t capacity, MemoryTag backingTag);
+	void Shutdown();
+
+	// Returns nullptr when the arena is full, it never falls back to the heap. Any power
+	// of two alignment works, including ones above the 64 the block itself has.
+	void* Alloc(size_t bytes, size_t alignment = 16, MemoryTag tag = MEMTAG_FRAME);
+
+	template<typename T>
+	T* AllocArray(size_t count, MemoryTag tag = MEMTAG_FRAME)
+	{
+		void* ptr = Alloc(sizeof(T) * count, alignof(T) > 16 ? alignof(T) : 16, tag);
+
+		if (ptr == nullptr)
+			return nullptr;
+
+		T* items = static_cast<T*>(ptr);
+
+		for (size_t i = 0; i < count; i++)
+			new (&items[i]) T();
+
+		return items;
+	}
+
+	ArenaMarker GetMarker() const;
+	void Rewind(const ArenaMarker& marker);
+	void Reset();
+
+	bool IsInitialised() const { return _pBase != nullptr; }
+	size_t GetUsed() const { return _offset; }
+	size_t GetPeak() const { return _peak; }
+	size_t GetCapacity() const { return _capacity; }
+	size_t GetTagBytes(MemoryTag tag) const { return _tagBytes[tag]; }
+};
+
+//--------------------------------------------------------------------------------------
+// Double buffered per-frame arena. Memory handed out in frame N stays valid through frame
+// N + 1 so it can be read by work still in flight while the next frame is being built.
+//--------------------------------------------------------------------------------------
+class FrameArena
+{
+private:
+	LinearArena _arenas[2];
+	uint32_t    _frameIndex;
+
+public:
+	FrameArena();
+
+	bool Init(size_t capacityPerFrame);
+	void Shutdown();
+
+	// Flips to the other half and resets it, call once at the top of each frame
+	void BeginFrame();
+
+	void* Alloc(size_t bytes, size_t alignment = 16, MemoryTag tag = MEMTAG_FRAME) { return Current().Alloc(bytes, alignment, tag); }
+
+	template<typename T>
+	T* AllocArray(size_t count, MemoryTag tag = MEMTAG_FRAME) { return Current().AllocArray<T>(count, tag); }
+
+	LinearArena& Current() { return _arenas[_frameIndex & 1]; }
+	const LinearArena& Current() const { return _arenas[_frameIndex & 1]; }
+	uint32_t GetFrameIndex() const { return _frameIndex; }
+};
+
+//--------------------------------------------------------------------------------------
+// Thread-local scratch arenas for short lived temporaries. Use a ScratchScope so that
+// everything allocated inside it is handed back when the scope ends.
+//--------------------------------------------------------------------------------------
+class ScratchArena
+{
+public:
+	static const size_t DefaultCapacity = 4 * 1024 * 1024;
+
+	// Returns the calling thread's arena, creating it on first use
+	static LinearArena& Get();
+};
+
+class ScratchScope
+{
+private:
+	LinearArena& _arena;
+	ArenaMarker  _marker;
+
+public:
+	ScratchScope() : _arena(ScratchArena::Get()), _marker(_arena.GetMarker()) {}
+	~ScratchScope() { _arena.Rewind(_marker); }
+
+	ScratchScope(const ScratchScope&) = delete;
+	ScratchScope& operator=(const ScratchScope&) = delete;
+
+	void* Alloc(size_t bytes, size_t alignment = 16) { return _arena.Alloc(bytes, alignment, MEMTAG_SCRATCH); }
+
+	template<typename T>
+	T* AllocArray(size_t count) { return _arena.AllocArray<T>(count, MEMTAG_SCRATCH); }
+};
+
+//--------------------------------------------------------------------------------------
+// Fixed-size pool for objects of one type. Free slots are chained through the slot
+// memory itself so Alloc and Free are O(1) and never touch the heap after Init.
+//--------------------------------------------------------------------------------------
+template<typename T>
+class PoolAllocator
+{
+private:
+	union Slot
+	{
+		Slot* pNext;
+		alignas(T) uint8_t storage[sizeof(T)];
+	};
+
+	Slot*     _pSlots;
+	Slot*     _pFreeList;
+	size_t    _capacity;
+	size_t    _liveCount;
+	MemoryTag _tag;
+
+public:
+	PoolAllocator() : _pSlots(nullptr), _pFreeList(nullptr), _capacity(0), _liveCount(0), _tag(MEMTAG_GENERAL) {}
+	~PoolAllocator() { Shutdown(); }
+
+	PoolAllocator(const PoolAllocator&) = delete;
+	PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+	bool Init(size_t capacity, MemoryTag tag)
+	{
+		Shutdown();
+
+		_pSlots = static_cast<Slot*>(MemoryTracker::Allocate(sizeof(Slot) * capacity, alignof(Slot), tag));
+
+		if (_pSlots == nullptr)
+			return false;
+
+		_capacity = capacity;
+		_tag = tag;
+
+		for (size_t i = 0; i < capacity; i++)
+			_pSlots[i].pNext = (i + 1 < capacity) ? &_pSlots[i + 1] : nullptr;
+
+		_pFreeList = capacity > 0 ? &_pSlots[0] : nullptr;
+
+		return true;
+	}
+
+	void Shutdown()
+	{
+		if (_pSlots == nullptr)
+			return;
+
+		MemoryTracker::Untrack(_tag, sizeof(T) * _liveCount);
+		MemoryTracker::Free(_pSlots, sizeof(Slot) * _capacity, _tag);
+
+		_pSlots = nullptr;
+		_pFreeList = nullptr;
+		_capacity = 0;
+		_liveCount = 0;
+	}
+
+	// Returns nullptr once every slot is in use
+	template<typename... Args>
+	T* New(Args&&... args)
+	{
+		if (_pFreeList == nullptr)
+			return nullptr;
+
+		Slot* slot = _pFreeList;
+		_pFreeList = slot->pNext;
+		_liveCount++;
+
+		MemoryTracker::Track(_tag, sizeof(T));
+
+		return new (slot->storage) T(static_cast<Args&&>(args)...);
+	}
+
+	void Delete(T* object)
+	{
+		if (object == nullptr)
+			return;
+
+		object->~T();
+
+		Slot* slot = reinterpret_cast<Slot*>(object);
+		slot->pNext = _pFreeList;
+		_pFreeList = slot;
+		_liveCount--;
+
+		MemoryTracker::Untrack(_tag, sizeof(T));
+	}
+
+	bool Owns(const T* object) const
+	{
+		const Slot* slot = reinterpret_cast<const Slot*>(object);
+		return slot >= _pSlots && slot < _pSlots + _capacity;
+	}
+
+	size_t GetCapacity() const { return _capacity; }
+	size_t GetLiveCount() const { return _liveCount; }
+};
@@ -0,0 +1,800 @@
+#include "animation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <emmintrin.h>
+#include "jobsystem.h"
+
+BoneTransform::BoneTransform()
+{
+	rotation[0] = rotation[1] = rotation[2] = 0.0f;
+	rotation[3] = 1.0f;
+	scale = Vec3(1.0f, 1.0f, 1.0f);
+}
+
+// Scale, then rotation, then translation, for row vectors like XMMatrixAffineTransformation
+static Mat4 BoneMatrix(const BoneTransform& bone)
+{
+	float x = bone.rotation[0], y = bone.rotation[1], z = bone.rotation[2], w = bone.rotation[3];
+
+	Mat4 r;
+	r.m[0][0] = (1.0f - 2.0f * (y * y + z * z)) * bone.scale.x;
+	r.m[0][1] = 2.0f * (x * y + z * w) * bone.scale.x;
+	r.m[0][2] = 2.0f * (x * z - y * w) * bone.scale.x;
+	r.m[0][3] = 0.0f;
+	r.m[1][0] = 2.0f * (x * y - z * w) * bone.scale.y;
+	r.m[1][1] = (1.0f - 2.0f * (x * x + z * z)) * bone.scale.y;
+	r.m[1][2] = 2.0f * (y * z + x * w) * bone.scale.y;
+	r.m[1][3] = 0.0f;
+	r.m[2][0] = 2.0f * (x * z + y * w) * bone.scale.z;
+	r.m[2][1] = 2.0f * (y * z - x * w) * bone.scale.z;
+	r.m[2][2] = (1.0f - 2.0f * (x * x + y * y)) * bone.scale.z;
+	r.m[2][3] = 0.0f;
+	r.m[3][0] = bone.translation.x;
+	r.m[3][1] = bone.translation.y;
+	r.m[3][2] = bone.translation.z;
+	r.m[3][3] = 1.0f;
+
+	return r;
+}
+
+void Skeleton::ComputeInverseBind()
+{
+	uint32_t boneCount = GetBoneCount();
+	std::vector<Mat4> model(boneCount);
+	inverseBind.resize(boneCount);
+
+	for (uint32_t i = 0; i < boneCount; i++)
+	{
+		Mat4 local = BoneMatrix(bindPose[i]);
+		model[i] = parents[i] == NoParentBone ? local : Multiply(local, model[parents[i]]);
+		inverseBind[i] = Inverse(model[i]);
+	}
+}
+
+// The bones that pad the count to a group of 4 are identity, so the SIMD loops never see
+// garbage. Everything below the count is written by the caller.
+static void ClearPose(Pose& pose, uint32_t boneCount)
+{
+	for (uint32_t i = boneCount; i < ((boneCount + 3) & ~3u); i++)
+	{
+		for (uint32_t c = 0; c < POSE_CHANNEL_COUNT; c++)
+			pose.values[c][i] = (c == POSE_ROTATION_W || c >= POSE_SCALE_X) ? 1.0f : 0.0f;
+	}
+
+	pose.boneCount = boneCount;
+}
+
+void Pose::SetBindPose(const Skeleton& skeleton)
+{
+	ClearPose(*this, skeleton.GetBoneCount());
+
+	for (uint32_t i = 0; i < boneCount; i++)
+	{
+		const BoneTransform& bone = skeleton.bindPose[i];
+
+		for (int c = 0; c < 4; c++)
+			values[POSE_ROTATION_X + c][i] = bone.rotation[c];
+
+		values[POSE_TRANSLATION_X][i] = bone.translation.x;
+		values[POSE_TRANSLATION_Y][i] = bone.translation.y;
+		values[POSE_TRANSLATION_Z][i] = bone.translation.z;
+		values[POSE_SCALE_X][i] = bone.scale.x;
+		values[POSE_SCALE_Y][i] = bone.scale.y;
+		values[POSE_SCALE_Z][i] = bone.scale.z;
+	}
+}
+
+void Pose::GetBone(uint32_t bone, BoneTransform& transform) const
+{
+	for (int c = 0; c < 4; c++)
+		transform.rotation[c] = values[POSE_ROTATION_X + c][bone];
+
+	transform.translation = Vec3(values[POSE_TRANSLATION_X][bone], values[POSE_TRANSLATION_Y][bone], values[POSE_TRANSLATION_Z][bone]);
+	transform.scale = Vec3(values[POSE_SCALE_X][bone], values[POSE_SCALE_Y][bone], values[POSE_SCALE_Z][bone]);
+}
+
+//--------------------------------------------------------------------------------------
+// Quantization
+//--------------------------------------------------------------------------------------
+enum TrackKind
+{
+	TRACK_ROTATION,
+	TRACK_TRANSLATION,
+	TRACK_SCALE,
+	TRACK_KIND_COUNT,
+};
+
+static const float SmallestThreeRange = 0.70710678f;  // no other component can be larger than 1/sqrt(2)
+
+// Key frame numbers use the low bits, rotations keep the index of the dropped component
+// in the top two
+static const uint16_t KeyFrameMask = 0x3FFF;
+static const uint32_t KeyIndexShift = 14;
+
+// The largest component is dropped and rebuilt from the other three. q and -q are the
+// same rotation so it is kept positive.
+static uint32_t EncodeRotation(const float rotation[4], uint16_t words[3])
+{
+	float q[4];
+	float lengthSq = rotation[0] * rotation[0] + rotation[1] * rotation[1] + rotation[2] * rotation[2] + rotation[3] * rotation[3];
+	float invLength = lengthSq > 0.0f ? 1.0f / sqrtf(lengthSq) : 0.0f;
+	uint32_t largest = 0;
+
+	for (uint32_t c = 0; c < 4; c++)
+	{
+		q[c] = rotation[c] * invLength;
+
+		if (fabsf(q[c]) > fabsf(q[largest]))
+			largest = c;
+	}
+
+	float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+	uint32_t w = 0;
+
+	for (uint32_t c = 0; c < 4; c++)
+	{
+		if (c == largest)
+			continue;
+
+		float unit = (q[c] * sign / SmallestThreeRange) * 0.5f + 0.5f;
+		words[w++] = (uint16_t)std::min(std::max((int)(unit * 65535.0f + 0.5f), 0), 65535);
+	}
+
+	return largest;
+}
+
+static void DecodeRotation(const uint16_t words[3], uint32_t largest, float q[4])
+{
+	float sumSq = 0.0f;
+	uint32_t w = 0;
+
+	for (uint32_t c = 0; c < 4; c++)
+	{
+		if (c == largest)
+			continue;
+
+		q[c] = (words[w++] * (2.0f / 65535.0f) - 1.0f) * SmallestThreeRange;
+		sumSq += q[c] * q[c];
+	}
+
+	q[largest] = sqrtf(std::max(1.0f - sumSq, 0.0f));
+}
+
+static void EncodeRange(const float value[3], const float rangeMin[3], const float rangeScale[3], uint16_t words[3])
+{
+	for (int c = 0; c < 3; c++)
+	{
+		float unit = rangeScale[c] > 0.0f ? (value[c] - rangeMin[c]) / rangeScale[c] : 0.0f;
+		words[c] = (uint16_t)std::min(std::max((int)(unit + 0.5f), 0), 65535);
+	}
+}
+
+static void DecodeRange(const uint16_t words[3], const float rangeMin[3], const float rangeScale[3], float value[3])
+{
+	for (int c = 0; c < 3; c++)
+		value[c] = rangeMin[c] + words[c] * rangeScale[c];
+}
+
+static void GetRawValue(const BoneTransform& bone, uint32_t kind, float value[4])
+{
+	if (kind == TRACK_ROTATION)
+	{
+		memcpy(value, bone.rotation, sizeof(bone.rotation));
+		return;
+	}
+
+	const Vec3& v = kind == TRACK_TRANSLATION ? bone.translation : bone.scale;
+	value[0] = v.x;
+	value[1] = v.y;
+	value[2] = v.z;
+	value[3] = 0.0f;
+}
+
+// Angle between rotations for rotations, largest distance otherwise
+static float TrackError(uint32_t kind, const float a[4], const float b[4])
+{
+	if (kind == TRACK_ROTATION)
+	{
+		// From the chord between the quaternions, acos of their dot product has no precision
+		// left at the angles that matter here. Either sign is the same rotation.
+		float difference = 0.0f, sum = 0.0f;
+
+		for (int c = 0; c < 4; c++)
+		{
+			difference += (a[c] - b[c]) * (a[c] - b[c]);
+			sum += (a[c] + b[c]) * (a[c] + b[c]);
+		}
+
+		return 4.0f * asinf(std::min(sqrtf(std::min(difference, sum)) * 0.5f, 1.0f));
+	}
+
+	if (kind == TRACK_TRANSLATION)
+		return Length(Vec3(a[0] - b[0], a[1] - b[1], a[2] - b[2]));
+
+	return std::max(std::max(fabsf(a[0] - b[0]), fabsf(a[1] - b[1])), fabsf(a[2] - b[2]));
+}
+
+// What sampling does between two keys
+static void Interpolate(uint32_t kind, const float a[4], const float b[4], float t, float result[4])
+{
+	if (kind != TRACK_ROTATION)
+	{
+		for (int c = 0; c < 3; c++)
+			result[c] = a[c] + (b[c] - a[c]) * t;
+
+		result[3] = 0.0f;
+		return;
+	}
+
+	float sign = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3] < 0.0f ? -1.0f : 1.0f;
+	float lengthSq = 0.0f;
+
+	for (int c = 0; c < 4; c++)
+	{
+		result[c] = a[c] + (b[c] * sign - a[c]) * t;
+		lengthSq += result[c] * result[c];
+	}
+
+	float invLength = 1.0f / sqrtf(lengthSq);
+
+	for (int c = 0; c < 4; c++)
+		result[c] *= invLength;
+}
+
+//--------------------------------------------------------------------------------------
+// CompressedClip
+//--------------------------------------------------------------------------------------
+CompressedClip::CompressedClip()
+{
+	_boneCount = 0;
+	_frameCount = 0;
+	_sampleRate = 30.0f;
+}
+
+void CompressedClip::CompressTrack(const RawClip& clip, uint32_t bone, uint32_t kind, float maxError)
+{
+	Track& track = _tracks[bone * TRACK_KIND_COUNT + kind];
+	uint32_t frames = clip.frameCount;
+
+	std::vector<float> raw(frames * 4);
+	std::vector<float> decoded(frames * 4);
+	std::vector<uint16_t> words(frames * 3);
+	std::vector<uint16_t> largest(frames, 0);
+
+	for (uint32_t f = 0; f < frames; f++)
+		GetRawValue(clip.keys[f * clip.boneCount + bone], kind, &raw[f * 4]);
+
+	memset(track.rangeMin, 0, sizeof(track.rangeMin));
+	memset(track.rangeScale, 0, sizeof(track.rangeScale));
+
+	if (kind != TRACK_ROTATION)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			float low = raw[c], high = raw[c];
+
+			for (uint32_t f = 1; f < frames; f++)
+			{
+				low = std::min(low, raw[f * 4 + c]);
+				high = std::max(high, raw[f * 4 + c]);
+			}
+
+			track.rangeMin[c] = low;
+			track.rangeScale[c] = (high - low) / 65535.0f;
+		}
+	}
+
+	// Error is measured against what the player will decode, not the raw values
+	for (uint32_t f = 0; f < frames; f++)
+	{
+		if (kind == TRACK_ROTATION)
+		{
+			largest[f] = (uint16_t)EncodeRotation(&raw[f * 4], &words[f * 3]);
+			DecodeRotation(&words[f * 3], largest[f], &decoded[f * 4]);
+		}
+		else
+		{
+			EncodeRange(&raw[f * 4], track.rangeMin, track.rangeScale, &words[f * 3]);
+			DecodeRange(&words[f * 3], track.rangeMin, track.rangeScale, &decoded[f * 4]);
+			decoded[f * 4 + 3] = 0.0f;
+		}
+	}
+
+	std::vector<uint32_t> keys(1, 0);
+
+	// Constant within the error, one key holds the whole track
+	bool constant = true;
+
+	for (uint32_t f = 1; f < frames && constant; f++)
+		constant = TrackError(kind, &decoded[0], &raw[f * 4]) <= maxError;
+
+	// Otherwise each segment is stretched until interpolating across it misses a frame
+	for (uint32_t start = 0; !constant && start + 1 < frames;)
+	{
+		uint32_t end = start + 1;
+
+		for (uint32_t candidate = start + 2; candidate < frames; candidate++)
+		{
+			bool fits = true;
+
+			for (uint32_t f = start + 1; f < candidate && fits; f++)
+			{
+				float value[4];
+				Interpolate(kind, &decoded[start * 4], &decoded[candidate * 4], (float)(f - start) / (candidate - start), value);
+				fits = TrackError(kind, value, &raw[f * 4]) <= maxError;
+			}
+
+			if (!fits)
+				break;
+
+			end = candidate;
+		}
+
+		keys.push_back(end);
+		start = end;
+	}
+
+	track.firstKey = (uint32_t)_keyFrames.size();
+	track.keyCount = (uint32_t)keys.size();
+
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		_keyFrames.push_back((uint16_t)(keys[i] | (largest[keys[i]] << KeyIndexShift)));
+		_keyValues.insert(_keyValues.end(), &words[keys[i] * 3], &words[keys[i] * 3] + 3);
+	}
+}
+
+// Distance from each bone to the furthest joint below it, plus its own length so the
+// ends of chains still count for the mesh around them
+static void ComputeReach(const Skeleton& skeleton, std::vector<float>& reach)
+{
+	uint32_t boneCount = skeleton.GetBoneCount();
+	std::vector<Vec3> positions(boneCount);
+	reach.assign(boneCount, 0.0f);
+
+	for (uint32_t i = 0; i < boneCount; i++)
+	{
+		Mat4 bind = Inverse(skeleton.inverseBind[i]);
+		positions[i] = Vec3(bind.m[3][0], bind.m[3][1], bind.m[3][2]);
+	}
+
+	for (uint32_t i = 0; i < boneCount; i++)
+	{
+		reach[i] = std::max(reach[i], Length(skeleton.bindPose[i].translation));
+
+		for (uint16_t parent = skeleton.parents[i]; parent != NoParentBone; parent = skeleton.parents[parent])
+			reach[parent] = std::max(reach[parent], Length(positions[i] - positions[parent]) + reach[i]);
+	}
+}
+
+bool CompressedClip::Compress(const RawClip& clip, const ClipCompressionSettings& settings, const Skeleton* pSkeleton)
+{
+	if (clip.boneCount == 0 || clip.boneCount > MaxSkinBones || clip.frameCount == 0 || clip.frameCount > KeyFrameMask + 1u ||
+		clip.keys.size() != (size_t)clip.boneCount * clip.frameCount ||
+		(pSkeleton && (pSkeleton->GetBoneCount() != clip.boneCount || pSkeleton->inverseBind.size() != clip.boneCount)))
+		return false;
+
+	std::vector<float> reach;
+
+	if (pSkeleton)
+		ComputeReach(*pSkeleton, reach);
+
+	_boneCount = clip.boneCount;
+	_frameCount = clip.frameCount;
+	_sampleRate = clip.sampleRate;
+	_tracks.resize(_boneCount * TRACK_KIND_COUNT);
+	_keyFrames.clear();
+	_keyValues.clear();
+
+	float errors[TRACK_KIND_COUNT] = { settings.rotationError, settings.translationError, settings.scaleError };
+
+	for (uint32_t bone = 0; bone < _boneCount; bone++)
+	{
+		if (pSkeleton)
+			errors[TRACK_ROTATION] = reach[bone] > 0.0f ? settings.positionError / reach[bone] : settings.rotationError;
+
+		for (uint32_t kind = 0; kind < TRACK_KIND_COUNT; kind++)
+			CompressTrack(clip, bone, kind, errors[kind]);
+	}
+
+	return true;
+}
+
+size_t CompressedClip::GetMemorySize() const
+{
+	return sizeof(*this) + _tracks.size() * sizeof(Track) + _keyFrames.size() * sizeof(uint16_t) + _keyValues.size() * sizeof(uint16_t);
+}
+
+// Normalised lerp of four bones, b is flipped where it is on the other side of the sphere
+static void NlerpRotations(const Pose& a, const Pose& b, uint32_t bone, __m128 t, Pose& result)
+{
+	__m128 ax = _mm_load_ps(&a.values[POSE_ROTATION_X][bone]);
+	__m128 ay = _mm_load_ps(&a.values[POSE_ROTATION_Y][bone]);
+	__m128 az = _mm_load_ps(&a.values[POSE_ROTATION_Z][bone]);
+	__m128 aw = _mm_load_ps(&a.values[POSE_ROTATION_W][bone]);
+	__m128 bx = _mm_load_ps(&b.values[POSE_ROTATION_X][bone]);
+	__m128 by = _mm_load_ps(&b.values[POSE_ROTATION_Y][bone]);
+	__m128 bz = _mm_load_ps(&b.values[POSE_ROTATION_Z][bone]);
+	__m128 bw = _mm_load_ps(&b.values[POSE_ROTATION_W][bone]);
+
+	__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+	__m128 flip = _mm_and_ps(dot, _mm_set1_ps(-0.0f));
+	bx = _mm_xor_ps(bx, flip);
+	by = _mm_xor_ps(by, flip);
+	bz = _mm_xor_ps(bz, flip);
+	bw = _mm_xor_ps(bw, flip);
+
+	__m128 x = _mm_add_ps(ax, _mm_mul_ps(_mm_sub_ps(bx, ax), t));
+	__m128 y = _mm_add_ps(ay, _mm_mul_ps(_mm_sub_ps(by, ay), t));
+	__m128 z = _mm_add_ps(az, _mm_mul_ps(_mm_sub_ps(bz, az), t));
+	__m128 w = _mm_add_ps(aw, _mm_mul_ps(_mm_sub_ps(bw, aw), t));
+
+	__m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+	__m128 invLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lengthSq));
+
+	_mm_store_ps(&result.values[POSE_ROTATION_X][bone], _mm_mul_ps(x, invLength));
+	_mm_store_ps(&result.values[POSE_ROTATION_Y][bone], _mm_mul_ps(y, invLength));
+	_mm_store_ps(&result.values[POSE_ROTATION_Z][bone], _mm_mul_ps(z, invLength));
+	_mm_store_ps(&result.values[POSE_ROTATION_W][bone], _mm_mul_ps(w, invLength));
+}
+
+static void LerpChannels(const Pose& a, const Pose& b, uint32_t firstChannel, uint32_t bone, __m128 t, Pose& result)
+{
+	for (uint32_t c = firstChannel; c < firstChannel + 3; c++)
+	{
+		__m128 va = _mm_load_ps(&a.values[c][bone]);
+		__m128 vb = _mm_load_ps(&b.values[c][bone]);
+		_mm_store_ps(&result.values[c][bone], _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), t)));
+	}
+}
+
+void CompressedClip::Sample(float time, bool loop, Pose& pose) const
+{
+	// Keys on both sides of the time go into two poses, then all bones are interpolated
+	// four at a time
+	Pose next;
+	alignas(16) float alphas[TRACK_KIND_COUNT][MaxSkinBones];
+
+	ClearPose(pose, _boneCount);
+	ClearPose(next, _boneCount);
+
+	for (uint32_t kind = 0; kind < TRACK_KIND_COUNT; kind++)
+	{
+		for (uint32_t bone = _boneCount; bone < ((_boneCount + 3) & ~3u); bone++)
+			alphas[kind][bone] = 0.0f;
+	}
+
+	float lastFrame = (float)(_frameCount - 1);
+	float frame = time * _sampleRate;
+
+	if (loop && lastFrame > 0.0f)
+	{
+		frame = fmodf(frame, lastFrame);
+		frame = frame < 0.0f ? frame + lastFrame : frame;
+	}
+	else
+	{
+		frame = std::min(std::max(frame, 0.0f), lastFrame);
+	}
+
+	uint16_t whole = (uint16_t)frame;
+
+	for (uint32_t bone = 0; bone < _boneCount; bone++)
+	{
+		for (uint32_t kind = 0; kind < TRACK_KIND_COUNT; kind++)
+		{
+			const Track& track = _tracks[bone * TRACK_KIND_COUNT + kind];
+			const uint16_t* pFrames = &_keyFrames[track.firstKey];
+
+			// Last key at or before the frame, constant tracks have just the one
+			uint32_t key = 0;
+
+			if (track.keyCount > 1)
+			{
+				key = (uint32_t)(std::upper_bound(pFrames, pFrames + track.keyCount, whole,
+					[](uint16_t value, uint16_t keyFrame) { return value < (keyFrame & KeyFrameMask); }) - pFrames) - 1;
+			}
+
+			uint32_t nextKey = std::min(key + 1, track.keyCount - 1);
+			uint32_t keyFrame = pFrames[key] & KeyFrameMask;
+			alphas[kind][bone] = nextKey != key ? (frame - keyFrame) / ((pFrames[nextKey] & KeyFrameMask) - keyFrame) : 0.0f;
+
+			const uint16_t* pWords = &_keyValues[(track.firstKey + key) * 3];
+			const uint16_t* pNextWords = &_keyValues[(track.firstKey + nextKey) * 3];
+			float a[4], b[4];
+
+			if (kind == TRACK_ROTATION)
+			{
+				DecodeRotation(pWords, pFrames[key] >> KeyIndexShift, a);
+
+				if (nextKey != key)
+					DecodeRotation(pNextWords, pFrames[nextKey] >> KeyIndexShift, b);
+				else
+					memcpy(b, a, sizeof(a));
+
+				for (int c = 0; c < 4; c++)
+				{
+					pose.values[POSE_ROTATION_X + c][bone] = a[c];
+					next.values[POSE_ROTATION_X + c][bone] = b[c];
+				}
+			}
+			else
+			{
+				DecodeRange(pWords, track.rangeMin, track.rangeScale, a);
+
+				if (nextKey != key)
+					DecodeRange(pNextWords, track.rangeMin, track.rangeScale, b);
+				else
+					memcpy(b, a, sizeof(a));
+
+				uint32_t channel = kind == TRACK_TRANSLATION ? POSE_TRANSLATION_X : POSE_SCALE_X;
+
+				for (int c = 0; c < 3; c++)
+				{
+					pose.values[channel + c][bone] = a[c];
+					next.values[channel + c][bone] = b[c];
+				}
+			}
+		}
+	}
+
+	for (uint32_t bone = 0; bone < _boneCount; bone += 4)
+	{
+		NlerpRotations(pose, next, bone, _mm_load_ps(&alphas[TRACK_ROTATION][bone]), pose);
+		LerpChannels(pose, next, POSE_TRANSLATION_X, bone, _mm_load_ps(&alphas[TRACK_TRANSLATION][bone]), pose);
+		LerpChannels(pose, next, POSE_SCALE_X, bone, _mm_load_ps(&alphas[TRACK_SCALE][bone]), pose);
+	}
+}
+
+void BlendPoses(const Pose& a, const Pose& b, float weight, Pose& result)
+{
+	__m128 t = _mm_set1_ps(weight);
+
+	for (uint32_t bone = 0; bone < a.boneCount; bone += 4)
+	{
+		NlerpRotations(a, b, bone, t, result);
+		LerpChannels(a, b, POSE_TRANSLATION_X, bone, t, result);
+		LerpChannels(a, b, POSE_SCALE_X, bone, t, result);
+	}
+
+	result.boneCount = a.boneCount;
+}
+
+//--------------------------------------------------------------------------------------
+// Skinning matrices
+//--------------------------------------------------------------------------------------
+// Row vector times matrix: each row of a picks a combination of the rows of b
+static void MultiplyRows(const __m128 a[4], const __m128 b[4], __m128 result[4])
+{
+	for (int r = 0; r < 4; r++)
+	{
+		__m128 x = _mm_shuffle_ps(a[r], a[r], _MM_SHUFFLE(0, 0, 0, 0));
+		__m128 y = _mm_shuffle_ps(a[r], a[r], _MM_SHUFFLE(1, 1, 1, 1));
+		__m128 z = _mm_shuffle_ps(a[r], a[r], _MM_SHUFFLE(2, 2, 2, 2));
+		__m128 w = _mm_shuffle_ps(a[r], a[r], _MM_SHUFFLE(3, 3, 3, 3));
+		result[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, b[0]), _mm_mul_ps(y, b[1])), _mm_add_ps(_mm_mul_ps(z, b[2]), _mm_mul_ps(w, b[3])));
+	}
+}
+
+void ComputeSkinMatrices(const Skeleton& skeleton, const Pose& pose, SkinMatrix* pMatrices)
+{
+	uint32_t boneCount = std::min(skeleton.GetBoneCount(), pose.boneCount);
+	__m128 model[MaxSkinBones][4];
+
+	// Local matrices of four bones at a time, the same terms as BoneMatrix, then turned
+	// from one row of four bones into four rows of one bone
+	for (uint32_t bone = 0; bone < boneCount; bone += 4)
+	{
+		__m128 x = _mm_load_ps(&pose.values[POSE_ROTATION_X][bone]);
+		__m128 y = _mm_load_ps(&pose.values[POSE_ROTATION_Y][bone]);
+		__m128 z = _mm_load_ps(&pose.values[POSE_ROTATION_Z][bone]);
+		__m128 w = _mm_load_ps(&pose.values[POSE_ROTATION_W][bone]);
+		__m128 sx = _mm_load_ps(&pose.values[POSE_SCALE_X][bone]);
+		__m128 sy = _mm_load_ps(&pose.values[POSE_SCALE_Y][bone]);
+		__m128 sz = _mm_load_ps(&pose.values[POSE_SCALE_Z][bone]);
+
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 two = _mm_set1_ps(2.0f);
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 xw = _mm_mul_ps(x, w), yw = _mm_mul_ps(y, w), zw = _mm_mul_ps(z, w);
+
+		__m128 rows[4][4];
+		rows[0][0] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+		rows[0][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, zw)), sx);
+		rows[0][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, yw)), sx);
+		rows[1][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, zw)), sy);
+		rows[1][1] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+		rows[1][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, xw)), sy);
+		rows[2][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, yw)), sz);
+		rows[2][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, xw)), sz);
+		rows[2][2] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+		rows[3][0] = _mm_load_ps(&pose.values[POSE_TRANSLATION_X][bone]);
+		rows[3][1] = _mm_load_ps(&pose.values[POSE_TRANSLATION_Y][bone]);
+		rows[3][2] = _mm_load_ps(&pose.values[POSE_TRANSLATION_Z][bone]);
+
+		for (int r = 0; r < 4; r++)
+		{
+			rows[r][3] = r == 3 ? one : _mm_setzero_ps();
+			_MM_TRANSPOSE4_PS(rows[r][0], rows[r][1], rows[r][2], rows[r][3]);
+
+			for (uint32_t lane = 0; lane < 4 && bone + lane < MaxSkinBones; lane++)
+				model[bone + lane][r] = rows[r][lane];
+		}
+	}
+
+	// Parents are done before their children, so one pass puts everything in model space
+	for (uint32_t bone = 0; bone < boneCount; bone++)
+	{
+		uint16_t parent = skeleton.parents[bone];
+
+		if (parent != NoParentBone)
+		{
+			__m128 local[4] = { model[bone][0], model[bone][1], model[bone][2], model[bone][3] };
+			MultiplyRows(local, model[parent], model[bone]);
+		}
+
+		__m128 inverseBind[4], skin[4];
+
+		for (int r = 0; r < 4; r++)
+			inverseBind[r] = _mm_loadu_ps(skeleton.inverseBind[bone].m[r]);
+
+		MultiplyRows(inverseBind, model[bone], skin);
+
+		// Columns become rows, the last one is always 0 0 0 1
+		_MM_TRANSPOSE4_PS(skin[0], skin[1], skin[2], skin[3]);
+		_mm_storeu_ps(pMatrices[bone].rows[0], skin[0]);
+		_mm_storeu_ps(pMatrices[bone].rows[1], skin[1]);
+		_mm_storeu_ps(pMatrices[bone].rows[2], skin[2]);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// CPU skinning
+//--------------------------------------------------------------------------------------
+struct SkinJob
+{
+	const SkinnedVertex* pVertices;
+	const SkinMatrix*    pMatrices;
+	SkinnedVertexOutput* pOutput;
+};
+
+static void SkinRange(void* pData, uint32_t begin, uint32_t end)
+{
+	const SkinJob& job = *static_cast<const SkinJob*>(pData);
+	const __m128 weightScale = _mm_set1_ps(1.0f / 255.0f);
+
+	for (uint32_t i = begin; i < end; i++)
+	{
+		const SkinnedVertex& vertex = job.pVertices[i];
+		__m128 rows[3] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+
+		// Weighted sum of the four matrices, unused influences have zero weight
+		for (int k = 0; k < 4; k++)
+		{
+			__m128 weight = _mm_mul_ps(_mm_set1_ps((float)vertex.weights[k]), weightScale);
+			const SkinMatrix& matrix = job.pMatrices[vertex.bones[k]];
+
+			for (int r = 0; r < 3; r++)
+				rows[r] = _mm_add_ps(rows[r], _mm_mul_ps(_mm_loadu_ps(matrix.rows[r]), weight));
+		}
+
+		__m128 position = _mm_setr_ps(vertex.position[0], vertex.position[1], vertex.position[2], 1.0f);
+		__m128 normal = _mm_setr_ps(vertex.normal[0], vertex.normal[1], vertex.normal[2], 0.0f);
+
+		// Six dot products, summed across by transposing
+		__m128 px = _mm_mul_ps(rows[0], position);
+		__m128 py = _mm_mul_ps(rows[1], position);
+		__m128 pz = _mm_mul_ps(rows[2], position);
+		__m128 nx = _mm_mul_ps(rows[0], normal);
+		__m128 ny = _mm_mul_ps(rows[1], normal);
+		__m128 nz = _mm_mul_ps(rows[2], normal);
+		__m128 zero = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(px, py, pz, nx);
+		__m128 zero2 = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(ny, nz, zero, zero2);
+
+		alignas(16) float first[4], second[4];
+		_mm_store_ps(first, _mm_add_ps(_mm_add_ps(px, py), _mm_add_ps(pz, nx)));
+		_mm_store_ps(second, _mm_add_ps(_mm_add_ps(ny, nz), _mm_add_ps(zero, zero2)));
+
+		// Scale can stretch the normal
+		float normalLengthSq = first[3] * first[3] + second[0] * second[0] + second[1] * second[1];
+		float invLength = normalLengthSq > 0.0f ? 1.0f / sqrtf(normalLengthSq) : 0.0f;
+
+		SkinnedVertexOutput& output = job.pOutput[i];
+		output.position[0] = first[0];
+		output.position[1] = first[1];
+		output.position[2] = first[2];
+		output.normal[0] = first[3] * invLength;
+		output.normal[1] = second[0] * invLength;
+		output.normal[2] = second[1] * invLength;
+		output.texCoord[0] = vertex.texCoord[0];
+		output.texCoord[1] = vertex.texCoord[1];
+	}
+}
+
+void SkinVertices(const SkinnedVertex* pVertices, uint32_t vertexCount, const SkinMatrix* pMatrices,
+				  SkinnedVertexOutput* pOutput, JobSystem* pJobSystem)
+{
+	SkinJob job = { pVertices, pMatrices, pOutput };
+
+	if (pJobSystem)
+		pJobSystem->ParallelFor(vertexCount, 1024, &SkinRange, &job);
+	else
+		SkinRange(&job, 0, vertexCount);
+}
+
+//--------------------------------------------------------------------------------------
+// AnimationSystem
+//--------------------------------------------------------------------------------------
+AnimationInstance::AnimationInstance()
+{
+	pClips[0] = pClips[1] = nullptr;
+	times[0] = times[1] = 0.0f;
+	blend = 0.0f;
+}
+
+AnimationSystem::AnimationSystem()
+{
+	_pSkeleton = nullptr;
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+void AnimationSystem::Init(const Skeleton* pSkeleton, uint32_t instanceCount)
+{
+	_pSkeleton = pSkeleton;
+	_instances.assign(instanceCount, AnimationInstance());
+	_skinMatrices.resize((size_t)instanceCount * pSkeleton->GetBoneCount());
+}
+
+void AnimationSystem::UpdateInstances(void* pData, uint32_t begin, uint32_t end)
+{
+	AnimationSystem* pSystem = static_cast<AnimationSystem*>(pData);
+	const Skeleton& skeleton = *pSystem->_pSkeleton;
+	Pose pose, other;
+
+	for (uint32_t i = begin; i < end; i++)
+	{
+		const AnimationInstance& instance = pSystem->_instances[i];
+
+		if (instance.pClips[0])
+			instance.pClips[0]->Sample(instance.times[0], true, pose);
+		else
+			pose.SetBindPose(skeleton);
+
+		if (instance.pClips[1] && instance.blend > 0.0f)
+		{
+			instance.pClips[1]->Sample(instance.times[1], true, other);
+			BlendPoses(pose, other, instance.blend, pose);
+		}
+
+		ComputeSkinMatrices(skeleton, pose, &pSystem->_skinMatrices[(size_t)i * skeleton.GetBoneCount()]);
+	}
+}
+
+void AnimationSystem::Update(JobSystem* pJobSystem)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	uint32_t count = (uint32_t)_instances.size();
+
+	if (pJobSystem)
+		pJobSystem->ParallelFor(count, 16, &AnimationSystem::UpdateInstances, this);
+	else
+		UpdateInstances(this, 0, count);
+
+	_stats.instances = count;
+	_stats.sampledBones = 0;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const AnimationInstance& instance = _instances[i];
+		uint32_t clips = (instance.pClips[0] ? 1 : 0) + (instance.pClips[1] && instance.blend > 0.0f ? 1 : 0);
+		_stats.sampledBones += clips * _pSkeleton->GetBoneCount();
+	}
+
+	_stats.updateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "cpumath.h"
+
+class JobSystem;
+
+// Bones per skeleton, the size of the skinning constant buffer. A multiple of 4 so poses
+// are always whole SSE groups.
+const uint32_t MaxSkinBones = 64;
+const uint16_t NoParentBone = 0xFFFF;
+
+struct BoneTransform
+{
+	float rotation[4];  // quaternion x, y, z, w
+	Vec3  translation;
+	Vec3  scale;
+
+	BoneTransform();
+};
+
+//--------------------------------------------------------------------------------------
+// Bone hierarchy. Parents come before their children so model space transforms can be
+// built in one pass from the first bone to the last.
+//--------------------------------------------------------------------------------------
+struct Skeleton
+{
+	std::vector<uint16_t>      parents;      // NoParentBone for roots
+	std::vector<BoneTransform> bindPose;     // local to the parent
+	std::vector<Mat4>          inverseBind;  // model space to bone space in the bind pose
+
+	uint32_t GetBoneCount() const { return (uint32_t)parents.size(); }
+
+	// Fills inverseBind from bindPose
+	void ComputeInverseBind();
+};
+
+enum PoseChannel
+{
+	POSE_ROTATION_X,
+	POSE_ROTATION_Y,
+	POSE_ROTATION_Z,
+	POSE_ROTATION_W,
+	POSE_TRANSLATION_X,
+	POSE_TRANSLATION_Y,
+	POSE_TRANSLATION_Z,
+	POSE_SCALE_X,
+	POSE_SCALE_Y,
+	POSE_SCALE_Z,
+	POSE_CHANNEL_COUNT,
+};
+
+// Local transforms of every bone as a structure of arrays, so sampling and blending work
+// on four bones at a time. Fixed size, poses live on the stack of the job using them.
+struct Pose
+{
+	alignas(16) float values[POSE_CHANNEL_COUNT][MaxSkinBones];
+	uint32_t boneCount;
+
+	void SetBindPose(const Skeleton& skeleton);
+	void GetBone(uint32_t bone, BoneTransform& transform) const;
+};
+
+// Rotation, translation and scale of a bone in model space, transposed and without the
+// constant last column. Matches row_major float3x4 in HLSL, so skinning is three dot
+// products per position on either side.
+struct SkinMatrix
+{
+	float rows[3][4];
+};
+
+// Vertex of a skinned mesh. Weights are UNORM and add up to 255.
+struct SkinnedVertex
+{
+	float   position[3];
+	float   normal[3];
+	float   texCoord[2];
+	uint8_t bones[4];
+	uint8_t weights[4];
+};
+
+// What CPU skinning writes, the layout of the unskinned vertices so the normal vertex
+// shader can draw them
+struct SkinnedVertexOutput
+{
+	float position[3];
+	float normal[3];
+	float texCoord[2];
+};
+
+// An uncompressed clip, as it comes out of an exporter: every bone at every frame
+struct RawClip
+{
+	uint32_t                   boneCount;
+	uint32_t                   frameCount;
+	float                      sampleRate;  // frames per second
+	std::vector<BoneTransform> keys;        // keys[frame * boneCount + bone]
+
+	RawClip() : boneCount(0), frameCount(0), sampleRate(30.0f) {}
+
+	float GetDuration() const { return frameCount > 1 ? (frameCount - 1) / sampleRate : 0.0f; }
+};
+
+struct ClipCompressionSettings
+{
+	float rotationError;     // radians, when no skeleton is given
+	float positionError;     // how far a rotation error may move the bone's furthest child
+	float translationError;  // in the units of the skeleton
+	float scaleError;
+
+	ClipCompressionSettings() : rotationError(0.0005f), positionError(0.0003f), translationError(0.0005f), scaleError(0.0005f) {}
+};
+
+//--------------------------------------------------------------------------------------
+// Animation clip compressed per track. Rotations are stored as the smallest three
+// components of the quaternion, translations and scales within the range of the track,
+// all in 16 bits per component. Keys are then removed wherever linear
+// interpolation between the keys that are left stays within the error bounds, so
+// constant tracks shrink to one key and slow motion to a few. Every key is 8 bytes.
+// Given the skeleton, a bone may turn further off the clip the shorter its reach is,
+// which is what lets the ends of chains drop most of their keys.
+//--------------------------------------------------------------------------------------
+class CompressedClip
+{
+private:
+	struct Track
+	{
+		uint32_t firstKey;     // into _keyFrames, _keyValues holds 3 words per key
+		uint32_t keyCount;
+		float    rangeMin[3];  // translation and scale only
+		float    rangeScale[3];
+	};
+
+	uint32_t              _boneCount;
+	uint32_t              _frameCount;
+	float                 _sampleRate;
+	std::vector<Track>    _tracks;     // rotation, translation and scale of every bone
+	std::vector<uint16_t> _keyFrames;
+	std::vector<uint16_t> _keyValues;
+
+private:
+	void CompressTrack(const RawClip& clip, uint32_t bone, uint32_t kind, float maxError);
+
+public:
+	CompressedClip();
+
+	// Clips have at most MaxSkinBones bones and 16384 frames. pSkeleton may be null.
+	bool Compress(const RawClip& clip, const ClipCompressionSettings& settings, const Skeleton* pSkeleton = nullptr);
+
+	// Local transforms of every bone at time seconds, looping or holding the last frame
+	void Sample(float time, bool loop, Pose& pose) const;
+
+	uint32_t GetBoneCount() const { return _boneCount; }
+	float GetDuration() const { return _frameCount > 1 ? (_frameCount - 1) / _sampleRate : 0.0f; }
+	uint32_t GetKeyCount() const { return (uint32_t)_keyFrames.size(); }
+	size_t GetMemorySize() const;
+};
+
+// Normalised lerp of the rotations and lerp of the rest, weight 0 gives a
+void BlendPoses(const Pose& a, const Pose& b, float weight, Pose& result);
+
+// Model space transform of every bone times its inverse bind matrix
+void ComputeSkinMatrices(const Skeleton& skeleton, const Pose& pose, SkinMatrix* pMatrices);
+
+// CPU fallback for hardware without the skinning shader. pJobSystem may be null.
+void SkinVertices(const SkinnedVertex* pVertices, uint32_t vertexCount, const SkinMatrix* pMatrices,
+				  SkinnedVertexOutput* pOutput, JobSystem* pJobSystem);
+
+// One animated character: two clips and the weight of the second
+struct AnimationInstance
+{
+	const CompressedClip* pClips[2];
+	float                 times[2];
+	float                 blend;
+
+	AnimationInstance();
+};
+
+struct AnimationStats
+{
+	uint32_t instances;
+	uint32_t sampledBones;
+	double   updateMs;
+};
+
+//--------------------------------------------------------------------------------------
+// Characters sharing a skeleton. Update spreads them over the job system; each one is
+// sampled, blended and turned into skinning matrices entirely on the stack of its job.
+//--------------------------------------------------------------------------------------
+class AnimationSystem
+{
+private:
+	const Skeleton*                _pSkeleton;
+	std::vector<AnimationInstance> _instances;
+	std::vector<SkinMatrix>        _skinMatrices;  // bone count per instance
+	AnimationStats                 _stats;
+
+private:
+	static void UpdateInstances(void* pData, uint32_t begin, uint32_t end);
+
+public:
+	AnimationSystem();
+
+	void Init(const Skeleton* pSkeleton, uint32_t instanceCount);
+
+	void Update(JobSystem* pJobSystem);
+
+	uint32_t GetInstanceCount() const { return (uint32_t)_instances.size(); }
+	AnimationInstance& GetInstance(uint32_t instance) { return _instances[instance]; }
+	const SkinMatrix* GetSkinMatrices(uint32_t instance) const { return &_skinMatrices[instance * _pSkeleton->GetBoneCount()]; }
+	const AnimationStats& GetStats() const { return _stats; }
+};
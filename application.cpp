@@ -1,4 +1,5 @@
 #include "Application.h"
+#include "scenecompiler.h"
 
 
 LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
@@ -35,17 +36,106 @@ Application::Application()
 	_pSwapChain = nullptr;
 	_pRenderTargetView = nullptr;
 	_pVertexShader = nullptr;
-	_pPixelShader = nullptr;
+	for (UINT i = 0; i < MaterialPermutationCount; i++)
+		_pPixelShaders[i] = nullptr;
 	_pVertexLayout = nullptr;
-	_pVertexBuffer = nullptr;
-	_pIndexBuffer = nullptr;
 	_pConstantBuffer = nullptr;
 
-	_pVertexBufferTri = nullptr;
-	_pIndexBufferTri = nullptr;
+	_pLightBuffer = nullptr;
+	_pClusterBuffer = nullptr;
+	_pLightIndexBuffer = nullptr;
+	_pClusterConstantBuffer = nullptr;
+	_pLightSRV = nullptr;
+	_pClusterSRV = nullptr;
+	_pLightIndexSRV = nullptr;
+
+	_pShadowMap = nullptr;
+	_pShadowCache = nullptr;
+	for (UINT i = 0; i < MaxShadowCascades; i++)
+	{
+		_pShadowMapDSV[i] = nullptr;
+		_pShadowCacheDSV[i] = nullptr;
+	}
+	_pShadowMapSRV = nullptr;
+	_pShadowSampler = nullptr;
+	_pShadowRasterizer = nullptr;
+	_pShadowConstantBuffer = nullptr;
+	ZeroMemory(&_shadowMapTarget, sizeof(_shadowMapTarget));
+
+	_pVSBlob = nullptr;
+	for (UINT i = 0; i < MaterialPermutationCount; i++)
+		_pPSBlobs[i] = nullptr;
+	_startupBegin.QuadPart = 0;
+	_startupReported = false;
+	for (UINT i = 0; i < 3; i++)
+		_pSceneRasterizers[i] = nullptr;
 
 	keyState = 0;
 	shiftCamera = false;
+
+	_rgBackBuffer = InvalidRenderGraphResource;
+	_rgSceneDepth = InvalidRenderGraphResource;
+	_rgShadowMap = InvalidRenderGraphResource;
+
+	_pParticleVSBlob = nullptr;
+	_pParticlePSBlob = nullptr;
+	_pParticleVS = nullptr;
+	_pParticlePS = nullptr;
+	_pParticleLayout = nullptr;
+	_pParticleInstanceBuffer = nullptr;
+	_pParticleBlendState = nullptr;
+	_pParticleDepthState = nullptr;
+	_particleTime = 0.0f;
+
+	_pSkinnedVSBlob = nullptr;
+	_pSkinnedVS = nullptr;
+	_pSkinnedLayout = nullptr;
+	_pTentacleVertexBuffer = nullptr;
+	_pTentacleIndexBuffer = nullptr;
+	_pSkinConstantBuffer = nullptr;
+	_cpuSkinning = false;
+
+	_pDebugVSBlob = nullptr;
+	_pDebugPSBlob = nullptr;
+	_lastFrameTime.QuadPart = 0;
+	_drawCalls = 0;
+	_lastDrawCalls = 0;
+	_overlayKeyDown = false;
+
+	_lightmap.width = 0;
+	_lightmap.height = 0;
+	_lightmap.range = 0.0f;
+	_pLightmapSRV = nullptr;
+	_pDefaultLightmapUVs = nullptr;
+
+	_renderWidth = 0;
+	_renderHeight = 0;
+	_rgSceneColor = InvalidRenderGraphResource;
+	_pUpscaleVSBlob = nullptr;
+	_pUpscalePSBlob = nullptr;
+	_pUpscaleVS = nullptr;
+	_pUpscalePS = nullptr;
+	_pUpscaleConstantBuffer = nullptr;
+	_pSamplerClamp = nullptr;
+	_pResolutionTrace = nullptr;
+
+	_depthPrepass = false;
+	_prepassKeyDown = false;
+	_pPrepassTestState = nullptr;
+	_measureOverdraw = false;
+	for (UINT i = 0; i < OverdrawQueryCount; i++)
+		_pOverdrawQueries[i] = nullptr;
+	ZeroMemory(_overdrawPending, sizeof(_overdrawPending));
+	_overdrawFrame = 0;
+	ZeroMemory(&_overdrawStats, sizeof(_overdrawStats));
+
+	_playerEntity = SceneInvalidIndex;
+	_playerBody = CollisionInvalidBody;
+	ZeroMemory(&_scenePatchTime, sizeof(_scenePatchTime));
+
+	_heapCallsLastFrame = 0;
+	_pVisibleEntities = nullptr;
+	_visibleEntityCount = 0;
 }
 
 Application::~Application()
@@ -55,6 +145,8 @@ Application::~Application()
 
 HRESULT Application::Initialise(HINSTANCE hInstance, int nCmdShow)
 {
+	QueryPerformanceCounter(&_startupBegin);
+
 	//makes the window
     if (FAILED(InitWindow(hInstance, nCmdShow)))
 	{
@@ -66,16 +158,55 @@ HRESULT Application::Initialise(HINSTANCE hInstance, int nCmdShow)
     _WindowWidth = rc.right - rc.left;
     _WindowHeight = rc.bottom - rc.top;
 
-    if (FAILED(InitDevice()))
+	_jobSystem.Init();
+	_clusteredLighting.Init(ClusterConfig());
+	_shadowMaps.Init(ShadowSettings());
+
+	// -serialstartup runs the same tasks one after the other for comparison
+	bool serialStartup = wcsstr(GetCommandLineW(), L"-serialstartup") != nullptr;
+
+	// -cpuskinning takes the fallback path for skinned meshes
+	_cpuSkinning = wcsstr(GetCommandLineW(), L"-cpuskinning") != nullptr;
+
+	// -overlay starts with the debug overlay up, F1 toggles it
+	_debugDraw.Init(16384, 32768);
+	_debugDraw.SetEnabled(wcsstr(GetCommandLineW(), L"-overlay") != nullptr);
+
+	// -fixedres draws at full size for comparison, -dynrestrace records what the
+	// controller saw so tools/resolutionbench can replay it
+	if (wcsstr(GetCommandLineW(), L"-fixedres") != nullptr)
+		_dynamicResolution.SetFixedScale(_dynamicResolution.GetSettings().maxScale);
+
+	if (wcsstr(GetCommandLineW(), L"-dynrestrace") != nullptr && fopen_s(&_pResolutionTrace, "dynrestrace.txt", "w") == 0)
+		fprintf(_pResolutionTrace, "# frame ms, scale it was drawn at\n");
+
+	// -prepass starts with the depth pre-pass on, F2 toggles it. -overdraw puts the main
+	// pass's shaded fragments per pixel on the overlay.
+	_depthPrepass = wcsstr(GetCommandLineW(), L"-prepass") != nullptr;
+	_measureOverdraw = wcsstr(GetCommandLineW(), L"-overdraw") != nullptr;
+
+	_renderWidth = ScaleDimension(_WindowWidth, _dynamicResolution.GetScale());
+	_renderHeight = ScaleDimension(_WindowHeight, _dynamicResolution.GetScale());
+
+    if (FAILED(RunStartup(serialStartup)))
     {
         Cleanup();
 
         return E_FAIL;
     }
 
+	// Debug CRT builds count every heap call from here on, see Update
+	MemoryTracker::InstallHeapHook();
+
+	if (!_frameArena.Init(4 * 1024 * 1024))
+	{
+		Cleanup();
+
+		return E_OUTOFMEMORY;
+	}
+
 	// Initialize the world matrix
 	XMStoreFloat4x4(&_world, XMMatrixIdentity());
-	XMStoreFloat4x4(&_world2, XMMatrixIdentity());
 
 	eyex = 0.0f;
 	eyey = 0.0f;
@@ -103,498 +234,1776 @@ HRESULT Application::Initialise(HINSTANCE hInstance, int nCmdShow)
     // Initialize the projection matrix
 	XMStoreFloat4x4(&_projection, XMMatrixPerspectiveFovLH(XM_PIDIV2, _WindowWidth / (FLOAT) _WindowHeight, 0.01f, 100.0f));
 
+	// Scene light, the materials carry their own colours
+	lightDirection = XMFLOAT3(0.0f, 1.0f, 0.0f);
+	diffuseLight = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
+	ambientLight = XMFLOAT4(0.2f, 0.2f, 0.2f, 1.0f);
+	specularLight = XMFLOAT4(0.4f, 0.4f, 0.4f, 1.0f);
+
+	// Cluster bounds have to follow the projection
+	_clusteredLighting.SetProjection(XM_PIDIV2, (float)_WindowWidth, (float)_WindowHeight, 0.01f, 100.0f);
+	InitLights();
+
 	return S_OK;
 }
 
-HRESULT Application::InitShadersAndInputLayout()
+HRESULT Application::RunStartup(bool serial)
 {
-	HRESULT hr;
+	_startupGraph.Reset();
 
-    // Compile the vertex shader
-    ID3DBlob* pVSBlob = nullptr;
-    hr = CompileShaderFromFile(L"DX11 Framework.fx", "VS", "vs_4_0", &pVSBlob);
+	// CPU side, no device needed
+	UINT compileVS = _startupGraph.AddTask("CompileVS", &StartupTask<&Application::CompileVertexShader>, this);
+	UINT compilePS[MaterialPermutationCount];
 
-    if (FAILED(hr))
-    {
-        MessageBox(nullptr,
-                   L"The FX file cannot be compiled.  Please run this executable from the directory that contains the FX file.", L"Error", MB_OK);
-        return hr;
-    }
-
-	// Create the vertex shader
-	hr = _pd3dDevice->CreateVertexShader(pVSBlob->GetBufferPointer(), pVSBlob->GetBufferSize(), nullptr, &_pVertexShader);
+	for (UINT i = 0; i < MaterialPermutationCount; i++)
+	{
+		ShaderCompileJob& job = _shaderCompileJobs[i];
+		job.pApp = this;
+		job.permutation = i;
+		sprintf_s(job.name, "CompilePS %u", MaterialPermutations[i]);
 
-	if (FAILED(hr))
-	{	
-		pVSBlob->Release();
-        return hr;
+		compilePS[i] = _startupGraph.AddTask(job.name, &Application::StartupCompilePixelShader, &job);
 	}
 
-	// Compile the pixel shader
-	ID3DBlob* pPSBlob = nullptr;
-    hr = CompileShaderFromFile(L"DX11 Framework.fx", "PS", "ps_4_0", &pPSBlob);
+	UINT compileParticles = _startupGraph.AddTask("CompileParticles", &StartupTask<&Application::CompileParticleShaders>, this);
+	UINT compileSkinned = _startupGraph.AddTask("CompileSkinned", &StartupTask<&Application::CompileSkinnedShader>, this);
+	UINT compileDebug = _startupGraph.AddTask("CompileDebug", &StartupTask<&Application::CompileDebugShaders>, this);
+	UINT compileUpscale = _startupGraph.AddTask("CompileUpscale", &StartupTask<&Application::CompileUpscaleShaders>, this);
 
-    if (FAILED(hr))
-    {
-        MessageBox(nullptr,
-                   L"The FX file cannot be compiled.  Please run this executable from the directory that contains the FX file.", L"Error", MB_OK);
-        return hr;
-    }
+	// Clip compression only needs the CPU
+	UINT buildTentacles = _startupGraph.AddTask("BuildTentacles", &StartupTask<&Application::BuildTentacles>, this);
 
-	// Create the pixel shader
-	hr = _pd3dDevice->CreatePixelShader(pPSBlob->GetBufferPointer(), pPSBlob->GetBufferSize(), nullptr, &_pPixelShader);
-	pPSBlob->Release();
+	// Textures and meshes are whatever the scene references
+	UINT loadScene = _startupGraph.AddTask("LoadScene", &StartupTask<&Application::LoadScene>, this);
 
-    if (FAILED(hr))
-        return hr;
+	UINT loadTextures = _startupGraph.AddTask("LoadTextures", &StartupTask<&Application::LoadTextureData>, this);
+	_startupGraph.AddDependency(loadTextures, loadScene);
 
-    // Define the input layout
-    D3D11_INPUT_ELEMENT_DESC layout[] =
-    {
-        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 }, //3 sets of 32 bit float data
-        { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 }, //Normalised vertexes
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0} //Texel Coordinate data
-	};
+	UINT loadLightmaps = _startupGraph.AddTask("LoadLightmaps", &StartupTask<&Application::LoadLightmaps>, this);
 
-	UINT numElements = ARRAYSIZE(layout);
+	// The swap chain belongs to the window so it is created on the thread that pumps it
+	UINT createDevice = _startupGraph.AddTask("CreateDevice", &StartupTask<&Application::InitDevice>, this, TASK_MAIN_THREAD);
 
-    // Create the input layout
-	hr = _pd3dDevice->CreateInputLayout(layout, numElements, pVSBlob->GetBufferPointer(),
-                                        pVSBlob->GetBufferSize(), &_pVertexLayout);
-	pVSBlob->Release();
+	// The device is free threaded, these run on whichever thread gets to them first
+	UINT createShaders = _startupGraph.AddTask("CreateShaders", &StartupTask<&Application::InitShadersAndInputLayout>, this);
+	_startupGraph.AddDependency(createShaders, createDevice);
+	_startupGraph.AddDependency(createShaders, compileVS);
+
+	for (UINT i = 0; i < MaterialPermutationCount; i++)
+		_startupGraph.AddDependency(createShaders, compilePS[i]);
+
+	UINT createCollision = _startupGraph.AddTask("CreateCollision", &StartupTask<&Application::InitCollision>, this);
+	_startupGraph.AddDependency(createCollision, loadScene);
+
+	// Meshes only fill the geometry pool's CPU copy, the buffers are made once it is complete
+	UINT createMeshes = _startupGraph.AddTask("CreateMeshes", &StartupTask<&Application::InitMeshes>, this);
+	_startupGraph.AddDependency(createMeshes, loadScene);
+
+	UINT createMaterials = _startupGraph.AddTask("CreateMaterials", &StartupTask<&Application::InitMaterials>, this);
+	_startupGraph.AddDependency(createMaterials, createDevice);
+	_startupGraph.AddDependency(createMaterials, loadTextures);
+
+	UINT createStates = _startupGraph.AddTask("CreateStates", &StartupTask<&Application::InitStates>, this);
+	_startupGraph.AddDependency(createStates, createDevice);
+
+	UINT createLights = _startupGraph.AddTask("CreateLightBuffers", &StartupTask<&Application::InitLightBuffers>, this);
+	_startupGraph.AddDependency(createLights, createDevice);
+
+	UINT createShadows = _startupGraph.AddTask("CreateShadowMaps", &StartupTask<&Application::InitShadowMaps>, this);
+	_startupGraph.AddDependency(createShadows, createDevice);
+
+	UINT createParticles = _startupGraph.AddTask("CreateParticles", &StartupTask<&Application::InitParticles>, this);
+	_startupGraph.AddDependency(createParticles, createDevice);
+	_startupGraph.AddDependency(createParticles, compileParticles);
+
+	UINT createTentacles = _startupGraph.AddTask("CreateTentacles", &StartupTask<&Application::InitTentacles>, this);
+	_startupGraph.AddDependency(createTentacles, createDevice);
+	_startupGraph.AddDependency(createTentacles, compileSkinned);
+	_startupGraph.AddDependency(createTentacles, buildTentacles);
+
+	UINT createDebugDraw = _startupGraph.AddTask("CreateDebugDraw", &StartupTask<&Application::InitDebugDraw>, this);
+	_startupGraph.AddDependency(createDebugDraw, createDevice);
+	_startupGraph.AddDependency(createDebugDraw, compileDebug);
+
+	UINT createLightmaps = _startupGraph.AddTask("CreateLightmaps", &StartupTask<&Application::InitLightmaps>, this);
+	_startupGraph.AddDependency(createLightmaps, createDevice);
+	_startupGraph.AddDependency(createLightmaps, loadScene);
+	_startupGraph.AddDependency(createLightmaps, loadLightmaps);
+	_startupGraph.AddDependency(createLightmaps, createMeshes);  // the pool isn't thread safe
+
+	UINT createGeometry = _startupGraph.AddTask("CreateGeometry", &StartupTask<&Application::FlushGeometry>, this);
+	_startupGraph.AddDependency(createGeometry, createDevice);
+	_startupGraph.AddDependency(createGeometry, createMeshes);
+	_startupGraph.AddDependency(createGeometry, createLightmaps);
+
+	UINT createUpscale = _startupGraph.AddTask("CreateUpscale", &StartupTask<&Application::InitUpscale>, this);
+	_startupGraph.AddDependency(createUpscale, createDevice);
+	_startupGraph.AddDependency(createUpscale, compileUpscale);
+
+	UINT createPrepass = _startupGraph.AddTask("CreateDepthPrepass", &StartupTask<&Application::InitDepthPrepass>, this);
+	_startupGraph.AddDependency(createPrepass, createDevice);
+
+	// Immediate context work is the only thing left for the main thread at the end
+	UINT bind = _startupGraph.AddTask("BindPipeline", &StartupTask<&Application::BindPipeline>, this, TASK_MAIN_THREAD);
+	_startupGraph.AddDependency(bind, createShaders);
+	_startupGraph.AddDependency(bind, createGeometry);
+	_startupGraph.AddDependency(bind, createMaterials);
+	_startupGraph.AddDependency(bind, createStates);
+	_startupGraph.AddDependency(bind, createLights);
+	_startupGraph.AddDependency(bind, createShadows);
+	_startupGraph.AddDependency(bind, createParticles);
+	_startupGraph.AddDependency(bind, createTentacles);
+	_startupGraph.AddDependency(bind, createDebugDraw);
+	_startupGraph.AddDependency(bind, createLightmaps);
+	_startupGraph.AddDependency(bind, createUpscale);
+	_startupGraph.AddDependency(bind, createPrepass);
+
+	HRESULT hr = _startupGraph.Run(&_jobSystem, serial);
 
 	if (FAILED(hr))
-        return hr;
+	{
+		char timeline[4096];
+		_startupGraph.FormatTimeline(timeline, sizeof(timeline));
+		OutputDebugStringA(timeline);
 
-    // Set the input layout
-    _pImmediateContext->IASetInputLayout(_pVertexLayout);
+		char message[256];
+		sprintf_s(message, "Startup failed in %s (hr 0x%08X).", _startupGraph.GetTaskName(_startupGraph.GetFailedTask()), (unsigned)hr);
+		MessageBoxA(nullptr, message, "Error", MB_OK);
+	}
 
 	return hr;
 }
 
-HRESULT Application::InitVertexBuffer()
+void Application::ReportStartup()
 {
-	HRESULT hr;
-
-    // Create vertex buffer
-    SimpleVertex vertices[] =
-    {
-		// Front Face
-        { XMFLOAT3( -1.0f, 1.0f, -1.0f ), XMFLOAT3(-2.0f, 2.0f, -2.0f), XMFLOAT2(0.0f, 0.0f) }, //0
-        { XMFLOAT3( 1.0f, 1.0f, -1.0f ), XMFLOAT3(2.0f, 2.0f, -2.0f), XMFLOAT2(1.0f, 0.0f) }, //1
-        { XMFLOAT3( -1.0f, -1.0f, -1.0f ), XMFLOAT3(-2.0f, -2.0f, -2.0f), XMFLOAT2(0.0f, 1.0f) }, //2
-        { XMFLOAT3( 1.0f, -1.0f, -1.0f ), XMFLOAT3(2.0f, -2.0f, -2.0f), XMFLOAT2(1.0f, 1.0f) }, //3
-
-		// Right Face
-		{ XMFLOAT3(1.0f, 1.0f, -1.0f), XMFLOAT3(2.0f, 2.0f, -2.0f), XMFLOAT2(0.0f, 0.0f) }, //4
-		{ XMFLOAT3(1.0f, 1.0f, 1.0f), XMFLOAT3(2.0f, 2.0f, 2.0f), XMFLOAT2(1.0f, 0.0f) }, //5
-		{ XMFLOAT3(1.0f, -1.0f, -1.0f), XMFLOAT3(2.0f, -2.0f, -2.0f), XMFLOAT2(0.0f, 1.0f) }, //6
-		{ XMFLOAT3(1.0f, -1.0f, 1.0f), XMFLOAT3(2.0f, -2.0f, 2.0f), XMFLOAT2(1.0f, 1.0f) }, //7
-
-		// Back Face
-		{ XMFLOAT3(1.0f, 1.0f, 1.0f), XMFLOAT3(2.0f, 2.0f, 2.0f), XMFLOAT2(0.0f, 0.0f) }, //8
-		{ XMFLOAT3(-1.0f, 1.0f, 1.0f), XMFLOAT3(2.0f, 2.0f, 2.0f), XMFLOAT2(1.0f, 0.0f) }, //9
-		{ XMFLOAT3(1.0f, -1.0f, 1.0f), XMFLOAT3(2.0f, -2.0f, 2.0f), XMFLOAT2(0.0f, 1.0f) }, //10
-		{ XMFLOAT3(-1.0f, -1.0f, 1.0f), XMFLOAT3(-2.0f, -2.0f, -2.0f), XMFLOAT2(1.0f, 1.0f) }, //11
-
-		// Left Face
-		{ XMFLOAT3(-1.0f, 1.0f, 1.0f), XMFLOAT3(2.0f, 2.0f, 2.0f), XMFLOAT2(0.0f, 0.0f) }, //12
-		{ XMFLOAT3(-1.0f, 1.0f, -1.0f), XMFLOAT3(-2.0f, 2.0f, -2.0f), XMFLOAT2(1.0f, 0.0f) }, //13
-		{ XMFLOAT3(-1.0f, -1.0f, 1.0f), XMFLOAT3(-2.0f, -2.0f, -2.0f), XMFLOAT2(0.0f, 1.0f) }, //14
-		{ XMFLOAT3(-1.0f, -1.0f, -1.0f), XMFLOAT3(-2.0f, -2.0f, -2.0f), XMFLOAT2(1.0f, 1.0f) }, //15
-
-		// Top Face
-		{ XMFLOAT3(-1.0f, 1.0f, 1.0f), XMFLOAT3(2.0f, 2.0f, 2.0f), XMFLOAT2(0.0f, 0.0f) }, //16
-		{ XMFLOAT3(1.0f, 1.0f, 1.0f), XMFLOAT3(2.0f, 2.0f, 2.0f), XMFLOAT2(1.0f, 0.0f) }, //17
-		{ XMFLOAT3(-1.0f, 1.0f, -1.0f), XMFLOAT3(-2.0f, 2.0f, -2.0f), XMFLOAT2(0.0f, 1.0f) }, //18
-		{ XMFLOAT3(1.0f, 1.0f, -1.0f), XMFLOAT3(2.0f, 2.0f, -2.0f), XMFLOAT2(1.0f, 1.0f) }, //19
-
-		// Bottom Face
-		{ XMFLOAT3(-1.0f, -1.0f, 1.0f), XMFLOAT3(-2.0f, -2.0f, -2.0f), XMFLOAT2(0.0f, 0.0f) }, //20
-		{ XMFLOAT3(1.0f, -1.0f, -1.0f), XMFLOAT3(2.0f, -2.0f, -2.0f), XMFLOAT2(1.0f, 0.0f) }, //21
-		{ XMFLOAT3(-1.0f, -1.0f, -1.0f), XMFLOAT3(-2.0f, -2.0f, -2.0f), XMFLOAT2(0.0f, 1.0f) }, //22
-		{ XMFLOAT3(1.0f, -1.0f, 1.0f), XMFLOAT3(2.0f, -2.0f, 2.0f), XMFLOAT2(1.0f, 1.0f) }, //23
-    };
+	LARGE_INTEGER now, frequency;
+	QueryPerformanceCounter(&now);
+	QueryPerformanceFrequency(&frequency);
 
-    D3D11_BUFFER_DESC bd;
-	ZeroMemory(&bd, sizeof(bd));
-    bd.Usage = D3D11_USAGE_DEFAULT;
-    bd.ByteWidth = sizeof(SimpleVertex) * 24;
-    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	bd.CPUAccessFlags = 0;
+	double firstFrameMs = (now.QuadPart - _startupBegin.QuadPart) * 1000.0 / frequency.QuadPart;
 
-    D3D11_SUBRESOURCE_DATA InitData;
-	ZeroMemory(&InitData, sizeof(InitData));
-    InitData.pSysMem = vertices;
+	char report[4096];
+	int length = sprintf_s(report, "Startup: %.2f ms to first frame, %u worker threads\n", firstFrameMs, _jobSystem.GetWorkerCount());
+	_startupGraph.FormatTimeline(report + length, sizeof(report) - length);
+	OutputDebugStringA(report);
 
-    hr = _pd3dDevice->CreateBuffer(&bd, &InitData, &_pVertexBuffer);
+	_startupReported = true;
+}
 
-    if (FAILED(hr))
-        return hr;
+HRESULT Application::StartupCompilePixelShader(void* pData)
+{
+	ShaderCompileJob* pJob = static_cast<ShaderCompileJob*>(pData);
+	return pJob->pApp->CompilePixelShader(pJob->permutation);
+}
 
-	return S_OK;
+HRESULT Application::CompileVertexShader()
+{
+	return CompileShaderFromFile(L"DX11 Framework.fx", "VS", "vs_4_0", &_pVSBlob);
 }
 
-//--
-HRESULT Application::InitVertexBufferTri()
+HRESULT Application::CompilePixelShader(UINT permutation)
 {
-	HRESULT hr;
+	// Each feature bit turns into a define of 0 or 1
+	D3D_SHADER_MACRO defines[MaterialFeatureCount + 1];
 
-	static SimpleVertex vertices[4] =
+	for (UINT i = 0; i < MaterialFeatureCount; i++)
 	{
-		// Top Face
-		{ XMFLOAT3(-2.0f, -2.0f, -2.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(0.0f, 0.0f) }, //0
-		{ XMFLOAT3(2.0f, -2.0f, -2.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(10.0f, 0.0f) }, //1
-		{ XMFLOAT3(-2.0f, -2.0f, 2.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(0.0f, 10.0f) }, //2
-		{ XMFLOAT3(2.0f, -2.0f, 2.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(10.0f, 10.0f) }, //3
-	};
+		defines[i].Name = MaterialFeatureDefines[i].define;
+		defines[i].Definition = (MaterialPermutations[permutation] & MaterialFeatureDefines[i].feature) ? "1" : "0";
+	}
 
-	D3D11_BUFFER_DESC bd;
-	ZeroMemory(&bd, sizeof(bd));
-	bd.Usage = D3D11_USAGE_DEFAULT;
-	bd.ByteWidth = sizeof(SimpleVertex) * 4;
-	bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	bd.CPUAccessFlags = 0;
+	defines[MaterialFeatureCount].Name = nullptr;
+	defines[MaterialFeatureCount].Definition = nullptr;
 
-	D3D11_SUBRESOURCE_DATA InitData;
-	ZeroMemory(&InitData, sizeof(InitData));
-	InitData.pSysMem = vertices;
+	return CompileShaderFromFile(L"DX11 Framework.fx", "PS", "ps_4_0", &_pPSBlobs[permutation], defines);
+}
 
-	hr = _pd3dDevice->CreateBuffer(&bd, &InitData, &_pVertexBufferTri);
+HRESULT Application::CompileParticleShaders()
+{
+	HRESULT hr = CompileShaderFromFile(L"DX11 Framework.fx", "VS_Particle", "vs_4_0", &_pParticleVSBlob);
 
 	if (FAILED(hr))
 		return hr;
 
-	return S_OK;
+	return CompileShaderFromFile(L"DX11 Framework.fx", "PS_Particle", "ps_4_0", &_pParticlePSBlob);
 }
 
-HRESULT Application::InitIndexBufferTri()
+HRESULT Application::CompileSkinnedShader()
 {
-	HRESULT hr;
-
-	WORD indices[] =
-	{
-		//floor
-		0, 1, 2,
-		2, 1, 3,
-	};
+	return CompileShaderFromFile(L"DX11 Framework.fx", "VS_Skinned", "vs_4_0", &_pSkinnedVSBlob);
+}
 
-	D3D11_BUFFER_DESC bd;
-	ZeroMemory(&bd, sizeof(bd));
+HRESULT Application::CompileDebugShaders()
+{
+	HRESULT hr = CompileShaderFromFile(L"DX11 Framework.fx", "VS_Debug", "vs_4_0", &_pDebugVSBlob);
 
-	bd.Usage = D3D11_USAGE_DEFAULT;
-	bd.ByteWidth = sizeof(WORD) * 6;
-	bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	bd.CPUAccessFlags = 0;
+	if (FAILED(hr))
+		return hr;
 
-	D3D11_SUBRESOURCE_DATA InitData;
-	ZeroMemory(&InitData, sizeof(InitData));
-	InitData.pSysMem = indices;
+	return CompileShaderFromFile(L"DX11 Framework.fx", "PS_Debug", "ps_4_0", &_pDebugPSBlob);
+}
 
-	hr = _pd3dDevice->CreateBuffer(&bd, &InitData, &_pIndexBufferTri);
+HRESULT Application::CompileUpscaleShaders()
+{
+	HRESULT hr = CompileShaderFromFile(L"DX11 Framework.fx", "VS_Upscale", "vs_4_0", &_pUpscaleVSBlob);
 
 	if (FAILED(hr))
 		return hr;
 
-	return S_OK;
+	return CompileShaderFromFile(L"DX11 Framework.fx", "PS_Upscale", "ps_4_0", &_pUpscalePSBlob);
 }
-//--
 
-HRESULT Application::InitIndexBuffer()
+static HRESULT ReadFileData(const char* path, std::vector<uint8_t>& data)
 {
-	HRESULT hr;
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
 
-    // Create index buffer
-    WORD indices[] =
-    {
-		//front
-        0, 1, 2,
-		2, 1, 3,
-		// right
-		4, 5, 6,
-		6, 5, 7,
-		//back
-		8, 9, 10,
-		10, 9, 11,
-		//left
-		12, 13, 14,
-		14, 13, 15,
-		//top
-		16, 17, 18,
-		18, 17, 19,
-		//bottom
-		20, 21, 22,
-		20, 23, 21,
-    };
+	if (file == INVALID_HANDLE_VALUE)
+		return HRESULT_FROM_WIN32(GetLastError());
 
-	D3D11_BUFFER_DESC bd;
-	ZeroMemory(&bd, sizeof(bd));
+	LARGE_INTEGER size;
+	HRESULT hr = S_OK;
 
-    bd.Usage = D3D11_USAGE_DEFAULT;
-    bd.ByteWidth = sizeof(WORD) * 36;     
-    bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	bd.CPUAccessFlags = 0;
+	if (!GetFileSizeEx(file, &size))
+	{
+		hr = HRESULT_FROM_WIN32(GetLastError());
+	}
+	else
+	{
+		data.resize((size_t)size.QuadPart);
 
-	D3D11_SUBRESOURCE_DATA InitData;
-	ZeroMemory(&InitData, sizeof(InitData));
-    InitData.pSysMem = indices;
-    hr = _pd3dDevice->CreateBuffer(&bd, &InitData, &_pIndexBuffer);
+		DWORD bytesRead = 0;
 
-    if (FAILED(hr))
-        return hr;
+		if (!ReadFile(file, data.data(), (DWORD)size.QuadPart, &bytesRead, nullptr))
+			hr = HRESULT_FROM_WIN32(GetLastError());
+		else if (bytesRead != size.QuadPart)
+			hr = E_FAIL;
+	}
 
-	return S_OK;
+	CloseHandle(file);
+
+	return hr;
 }
 
-HRESULT Application::InitWindow(HINSTANCE hInstance, int nCmdShow)
+HRESULT Application::LoadScene()
 {
-    // Register class
-    WNDCLASSEX wcex;
-    wcex.cbSize = sizeof(WNDCLASSEX);
-    wcex.style = CS_HREDRAW | CS_VREDRAW;
-    wcex.lpfnWndProc = WndProc;
-    wcex.cbClsExtra = 0;
-    wcex.cbWndExtra = 0;
-    wcex.hInstance = hInstance;
-    wcex.hIcon = LoadIcon(hInstance, (LPCTSTR)IDI_TUTORIAL1);
-    wcex.hCursor = LoadCursor(NULL, IDC_ARROW );
-    wcex.hbrBackground = (HBRUSH)(COLOR_WINDOW + 1);
-    wcex.lpszMenuName = nullptr;
-    wcex.lpszClassName = L"TutorialWindowClass";
-    wcex.hIconSm = LoadIcon(wcex.hInstance, (LPCTSTR)IDI_TUTORIAL1);
-    if (!RegisterClassEx(&wcex))
-        return E_FAIL;
+	// The compiled scene is mapped as it is, the text form is compiled here while authoring
+	if (!_scene.Load("scene.bin"))
+	{
+		std::vector<uint8_t> text;
+		HRESULT hr = ReadFileData("scene.txt", text);
 
-    // Create window
-    _hInst = hInstance;
-    RECT rc = {0, 0, 1920, 1080};
-    AdjustWindowRect(&rc, WS_OVERLAPPEDWINDOW, FALSE);
-    _hWnd = CreateWindow(L"TutorialWindowClass", L"DX11 Framework", WS_OVERLAPPEDWINDOW,
-                         CW_USEDEFAULT, CW_USEDEFAULT, rc.right - rc.left, rc.bottom - rc.top, nullptr, nullptr, hInstance,
-                         nullptr);
-    if (!_hWnd)
-		return E_FAIL;
+		if (FAILED(hr))
+			return hr;
 
-    ShowWindow(_hWnd, nCmdShow);
+		text.push_back(0);
 
-    return S_OK;
-}
+		std::vector<uint8_t> compiled;
+		char error[512];
 
-HRESULT Application::CompileShaderFromFile(WCHAR* szFileName, LPCSTR szEntryPoint, LPCSTR szShaderModel, ID3DBlob** ppBlobOut)
-{
-    HRESULT hr = S_OK;
+		if (!CompileScene((const char*)text.data(), compiled, error, sizeof(error)))
+		{
+			OutputDebugStringA("scene.txt: ");
+			OutputDebugStringA(error);
+			OutputDebugStringA("\n");
 
-    DWORD dwShaderFlags = D3DCOMPILE_ENABLE_STRICTNESS;
-#if defined(DEBUG) || defined(_DEBUG)
-    // Set the D3DCOMPILE_DEBUG flag to embed debug information in the shaders.
-    // Setting this flag improves the shader debugging experience, but still allows 
-    // the shaders to be optimized and to run exactly the way they will run in 
-    // the release configuration of this program.
-    dwShaderFlags |= D3DCOMPILE_DEBUG;
-#endif
+			return E_INVALIDARG;
+		}
 
-    ID3DBlob* pErrorBlob;
-    hr = D3DCompileFromFile(szFileName, nullptr, nullptr, szEntryPoint, szShaderModel, 
-        dwShaderFlags, 0, ppBlobOut, &pErrorBlob);
+		if (!_scene.LoadFromMemory(compiled.data(), compiled.size()))
+			return E_FAIL;
+	}
 
-    if (FAILED(hr))
-    {
-        if (pErrorBlob != nullptr)
-            OutputDebugStringA((char*)pErrorBlob->GetBufferPointer());
+	// The one entity gameplay moves itself
+	_playerEntity = _scene.FindEntity(HashSceneName("player"));
 
-        if (pErrorBlob) pErrorBlob->Release();
+	return S_OK;
+}
 
-        return hr;
-    }
+HRESULT Application::LoadTextureData()
+{
+	_textureData.resize(_scene.GetTextureCount());
 
-    if (pErrorBlob) pErrorBlob->Release();
+	for (UINT i = 0; i < _scene.GetTextureCount(); i++)
+	{
+		HRESULT hr = ReadFileData(_scene.GetTextures()[i].path.ptr, _textureData[i]);
 
-    return S_OK;
+		if (FAILED(hr))
+			return hr;
+	}
+
+	return S_OK;
 }
 
-HRESULT Application::InitDevice()
+HRESULT Application::InitShadersAndInputLayout()
 {
-    HRESULT hr = S_OK;
+	HRESULT hr;
 
-    UINT createDeviceFlags = 0;
+	// Create the vertex shader
+	hr = _device.CreateVertexShader(_pVSBlob->GetBufferPointer(), _pVSBlob->GetBufferSize(), &_pVertexShader, GPU_RESOURCE(GPURES_SHADER, "VS"));
 
-#ifdef _DEBUG
-    createDeviceFlags |= D3D11_CREATE_DEVICE_DEBUG;
-#endif
+	if (FAILED(hr))
+        return hr;
 
-    D3D_DRIVER_TYPE driverTypes[] =
-    {
-        D3D_DRIVER_TYPE_HARDWARE,
-        D3D_DRIVER_TYPE_WARP,
-        D3D_DRIVER_TYPE_REFERENCE,
-    };
+	// One pixel shader per material permutation
+	for (UINT permutation = 0; permutation < MaterialPermutationCount; permutation++)
+	{
+		ID3DBlob* pPSBlob = _pPSBlobs[permutation];
 
-    UINT numDriverTypes = ARRAYSIZE(driverTypes);
+		// Create the pixel shader
+		hr = _device.CreatePixelShader(pPSBlob->GetBufferPointer(), pPSBlob->GetBufferSize(), &_pPixelShaders[permutation], GPU_RESOURCE(GPURES_SHADER, "PS"));
+		pPSBlob->Release();
+		_pPSBlobs[permutation] = nullptr;
 
-    D3D_FEATURE_LEVEL featureLevels[] =
+		if (FAILED(hr))
+			return hr;
+	}
+
+    // Define the input layout
+    D3D11_INPUT_ELEMENT_DESC layout[] =
     {
-        D3D_FEATURE_LEVEL_11_0,
-        D3D_FEATURE_LEVEL_10_1,
-        D3D_FEATURE_LEVEL_10_0,
-    };
+        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 }, //3 sets of 32 bit float data
+        { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 }, //Normalised vertexes
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0}, //Texel Coordinate data
+		{ "TEXCOORD", 1, DXGI_FORMAT_R32G32_FLOAT, 1, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 } //Lightmap coordinates, own stream
+	};
 
-	UINT numFeatureLevels = ARRAYSIZE(featureLevels);
+	UINT numElements = ARRAYSIZE(layout);
 
-    DXGI_SWAP_CHAIN_DESC sd; //allows to render to a back buffer off screen and then swap with front screen
-    ZeroMemory(&sd, sizeof(sd));
-    sd.BufferCount = 1;
-    sd.BufferDesc.Width = _WindowWidth;
-    sd.BufferDesc.Height = _WindowHeight;
-    sd.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-    sd.BufferDesc.RefreshRate.Numerator = 60;
-    sd.BufferDesc.RefreshRate.Denominator = 1;
-    sd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-    sd.OutputWindow = _hWnd;
-    sd.SampleDesc.Count = 1;
-    sd.SampleDesc.Quality = 0;
-    sd.Windowed = TRUE;
+    // Create the input layout
+	hr = _device.CreateInputLayout(layout, numElements, _pVSBlob->GetBufferPointer(),
+                                        _pVSBlob->GetBufferSize(), &_pVertexLayout, GPU_RESOURCE(GPURES_SHADER, "SimpleVertex"));
+	_pVSBlob->Release();
+	_pVSBlob = nullptr;
 
-    for (UINT driverTypeIndex = 0; driverTypeIndex < numDriverTypes; driverTypeIndex++)
-    {
-        _driverType = driverTypes[driverTypeIndex];
-        hr = D3D11CreateDeviceAndSwapChain(nullptr, _driverType, nullptr, createDeviceFlags, featureLevels, numFeatureLevels,
-                                           D3D11_SDK_VERSION, &sd, &_pSwapChain, &_pd3dDevice, &_featureLevel, &_pImmediateContext);
-        if (SUCCEEDED(hr))
-            break;
-    }
+	return hr;
+}
 
-    if (FAILED(hr))
-        return hr;
+HRESULT Application::InitMaterials()
+{
+	HRESULT hr;
 
-    // Create a render target view
-    ID3D11Texture2D* pBackBuffer = nullptr;
-    hr = _pSwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (LPVOID*)&pBackBuffer);
+	// The files were read on a worker, only the uploads are left
+	_sceneTextures.assign(_scene.GetTextureCount(), nullptr);
 
-    if (FAILED(hr))
+	for (UINT i = 0; i < _scene.GetTextureCount(); i++)
+	{
+		hr = CreateDDSTextureFromMemory(_pd3dDevice, _textureData[i].data(), _textureData[i].size(), nullptr, &_sceneTextures[i]);
+
+		if (FAILED(hr))
+			return hr;
+
+		_device.TrackTextureView(_sceneTextures[i], GPU_RESOURCE(GPURES_TEXTURE, "SceneTexture"));
+	}
+
+	std::vector<std::vector<uint8_t>>().swap(_textureData);
+
+	if (!_materialPool.Init(_scene.GetMaterialCount(), MEMTAG_SCENE))
+		return E_OUTOFMEMORY;
+
+	_sceneMaterials.resize(_scene.GetMaterialCount());
+
+	for (UINT i = 0; i < _scene.GetMaterialCount(); i++)
+	{
+		_sceneMaterials[i] = _materialPool.New();
+
+		hr = CreateSceneMaterial(i);
+
+		if (FAILED(hr))
+			return hr;
+	}
+
+	return S_OK;
+}
+
+HRESULT Application::CreateSceneMaterial(UINT index)
+{
+	static_assert(SCENE_MATERIAL_TEXTURED == MATERIAL_TEXTURED && SCENE_MATERIAL_SPECULAR == MATERIAL_SPECULAR &&
+				  SCENE_MATERIAL_NORMALMAP == MATERIAL_NORMALMAP && SCENE_MATERIAL_ALPHATEST == MATERIAL_ALPHATEST,
+				  "Scene material features have to match MaterialFeature");
+
+	const SceneMaterial& source = _scene.GetMaterials()[index];
+	Material& material = *_sceneMaterials[index];
+
+	// Only feature sets with a compiled pixel shader can be drawn
+	if (!material.SetFeatures(source.features))
+		return E_INVALIDARG;
+
+	MaterialConstants& constants = material.GetConstants();
+	constants.DiffuseMtrl = XMFLOAT4(source.diffuse);
+	constants.AmbientMtrl = XMFLOAT4(source.ambient);
+	constants.SpecularMtrl = XMFLOAT4(source.specular);
+	constants.SpecularPower = source.specularPower;
+	constants.AlphaCutoff = source.alphaCutoff;
+
+	// In SceneCullMode order
+	static const D3D11_CULL_MODE cullModes[] = { D3D11_CULL_BACK, D3D11_CULL_NONE, D3D11_CULL_FRONT };
+	material.SetCullMode(source.cullMode < 3 ? cullModes[source.cullMode] : D3D11_CULL_BACK);
+
+	material.SetDiffuseTexture(source.diffuseTexture != SceneInvalidIndex ? _sceneTextures[source.diffuseTexture] : nullptr);
+	material.SetNormalTexture(source.normalTexture != SceneInvalidIndex ? _sceneTextures[source.normalTexture] : nullptr);
+
+	return material.Create(&_device);
+}
+
+// The renderer uploads the built in meshes as they are
+static_assert(sizeof(MeshVertex) == sizeof(SimpleVertex), "MeshVertex has to match SimpleVertex");
+
+HRESULT Application::InitLightBuffers()
+{
+	HRESULT hr;
+
+	const ClusterConfig& config = _clusteredLighting.GetConfig();
+
+	// Light data is rewritten every frame so all of these are dynamic
+	D3D11_BUFFER_DESC bd;
+	ZeroMemory(&bd, sizeof(bd));
+	bd.Usage = D3D11_USAGE_DYNAMIC;
+	bd.ByteWidth = sizeof(GpuLight) * config.maxLights;
+	bd.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+	hr = _device.CreateBuffer(&bd, nullptr, &_pLightBuffer, GPU_RESOURCE(GPURES_STRUCTURED, "Lights"));
+
+	if (FAILED(hr))
+		return hr;
+
+	bd.ByteWidth = sizeof(ClusterRange) * _clusteredLighting.GetClusterCount();
+	hr = _device.CreateBuffer(&bd, nullptr, &_pClusterBuffer, GPU_RESOURCE(GPURES_STRUCTURED, "Clusters"));
+
+	if (FAILED(hr))
+		return hr;
+
+	bd.ByteWidth = sizeof(UINT) * config.maxLightIndices;
+	hr = _device.CreateBuffer(&bd, nullptr, &_pLightIndexBuffer, GPU_RESOURCE(GPURES_STRUCTURED, "LightIndices"));
+
+	if (FAILED(hr))
+		return hr;
+
+	bd.ByteWidth = sizeof(ClusterShaderConstants);
+	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	hr = _device.CreateBuffer(&bd, nullptr, &_pClusterConstantBuffer, GPU_RESOURCE(GPURES_CONSTANTS, "ClusterConstants"));
+
+	if (FAILED(hr))
+		return hr;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+	ZeroMemory(&srvDesc, sizeof(srvDesc));
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+
+	srvDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	srvDesc.Buffer.NumElements = config.maxLights * 4;
+	hr = _device.CreateShaderResourceView(_pLightBuffer, &srvDesc, &_pLightSRV, GPU_RESOURCE(GPURES_VIEW, "Lights"));
+
+	if (FAILED(hr))
+		return hr;
+
+	srvDesc.Format = DXGI_FORMAT_R32G32_UINT;
+	srvDesc.Buffer.NumElements = _clusteredLighting.GetClusterCount();
+	hr = _device.CreateShaderResourceView(_pClusterBuffer, &srvDesc, &_pClusterSRV, GPU_RESOURCE(GPURES_VIEW, "Clusters"));
+
+	if (FAILED(hr))
+		return hr;
+
+	srvDesc.Format = DXGI_FORMAT_R32_UINT;
+	srvDesc.Buffer.NumElements = config.maxLightIndices;
+	hr = _device.CreateShaderResourceView(_pLightIndexBuffer, &srvDesc, &_pLightIndexSRV, GPU_RESOURCE(GPURES_VIEW, "LightIndices"));
+
+	if (FAILED(hr))
+		return hr;
+
+	return S_OK;
+}
+
+void Application::InitLights()
+{
+	_clusteredLighting.ClearLights();
+
+	for (UINT i = 0; i < _scene.GetLightCount(); i++)
+	{
+		const SceneLight& source = _scene.GetLights()[i];
+
+		// The directional light goes through the constant buffer, the rest are clustered
+		if (source.type == SCENE_LIGHT_DIRECTIONAL)
+		{
+			lightDirection = XMFLOAT3(-source.direction.x, -source.direction.y, -source.direction.z);
+			diffuseLight = XMFLOAT4(source.color.x * source.intensity, source.color.y * source.intensity, source.color.z * source.intensity, 1.0f);
+			continue;
+		}
+
+		Light light;
+		light.type = source.type == SCENE_LIGHT_SPOT ? LIGHT_SPOT : LIGHT_POINT;
+		light.position = source.position;
+		light.range = source.range;
+		light.color = source.color;
+		light.intensity = source.intensity;
+		light.direction = source.direction;
+		light.cosInner = source.cosInner;
+		light.cosOuter = source.cosOuter;
+
+		if (_clusteredLighting.AddLight(light) == ClusterInvalidLight)
+		{
+			OutputDebugStringA("Warning: more scene lights than ClusterConfig::maxLights, the rest are left out\n");
+			break;
+		}
+	}
+}
+
+void Application::UpdateLights(float t)
+{
+	// Bob the lights up and down so the cluster assignment changes every frame
+	UINT index = 0;
+
+	for (UINT i = 0; i < _scene.GetLightCount() && index < _clusteredLighting.GetLightCount(); i++)
+	{
+		const SceneLight& source = _scene.GetLights()[i];
+
+		if (source.type == SCENE_LIGHT_DIRECTIONAL)
+			continue;
+
+		Light& light = _clusteredLighting.GetLight(index);
+		light.position.y = source.position.y + 0.5f * sinf(t + index * 0.37f);
+		index++;
+	}
+}
+
+void Application::UploadLights()
+{
+	_clusteredLighting.Assign(Mat4::FromFloats(&_view._11), &_jobSystem);
+
+	// AddLight stops at the buffer size, every index in the cluster lists is uploaded
+	UINT lightCount = _clusteredLighting.GetLightCount();
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+
+	if (SUCCEEDED(_pImmediateContext->Map(_pLightBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+	{
+		memcpy(mapped.pData, _clusteredLighting.GetGpuLights(), sizeof(GpuLight) * lightCount);
+		_pImmediateContext->Unmap(_pLightBuffer, 0);
+	}
+
+	if (SUCCEEDED(_pImmediateContext->Map(_pClusterBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+	{
+		memcpy(mapped.pData, _clusteredLighting.GetClusters(), sizeof(ClusterRange) * _clusteredLighting.GetClusterCount());
+		_pImmediateContext->Unmap(_pClusterBuffer, 0);
+	}
+
+	if (SUCCEEDED(_pImmediateContext->Map(_pLightIndexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+	{
+		memcpy(mapped.pData, _clusteredLighting.GetLightIndices(), sizeof(UINT) * _clusteredLighting.GetLightIndexCount());
+		_pImmediateContext->Unmap(_pLightIndexBuffer, 0);
+	}
+
+	ClusterShaderConstants constants = _clusteredLighting.GetShaderConstants();
+
+	// Pixel positions are in the scaled target, the clusters only depend on the aspect
+	constants.screenWidth = (float)_renderWidth;
+	constants.screenHeight = (float)_renderHeight;
+
+	if (SUCCEEDED(_pImmediateContext->Map(_pClusterConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+	{
+		memcpy(mapped.pData, &constants, sizeof(constants));
+		_pImmediateContext->Unmap(_pClusterConstantBuffer, 0);
+	}
+}
+
+HRESULT Application::InitWindow(HINSTANCE hInstance, int nCmdShow)
+{
+    // Register class
+    WNDCLASSEX wcex;
+    wcex.cbSize = sizeof(WNDCLASSEX);
+    wcex.style = CS_HREDRAW | CS_VREDRAW;
+    wcex.lpfnWndProc = WndProc;
+    wcex.cbClsExtra = 0;
+    wcex.cbWndExtra = 0;
+    wcex.hInstance = hInstance;
+    wcex.hIcon = LoadIcon(hInstance, (LPCTSTR)IDI_TUTORIAL1);
+    wcex.hCursor = LoadCursor(NULL, IDC_ARROW );
+    wcex.hbrBackground = (HBRUSH)(COLOR_WINDOW + 1);
+    wcex.lpszMenuName = nullptr;
+    wcex.lpszClassName = L"TutorialWindowClass";
+    wcex.hIconSm = LoadIcon(wcex.hInstance, (LPCTSTR)IDI_TUTORIAL1);
+    if (!RegisterClassEx(&wcex))
+        return E_FAIL;
+
+    // Create window
+    _hInst = hInstance;
+    RECT rc = {0, 0, 1920, 1080};
+    AdjustWindowRect(&rc, WS_OVERLAPPEDWINDOW, FALSE);
+    _hWnd = CreateWindow(L"TutorialWindowClass", L"DX11 Framework", WS_OVERLAPPEDWINDOW,
+                         CW_USEDEFAULT, CW_USEDEFAULT, rc.right - rc.left, rc.bottom - rc.top, nullptr, nullptr, hInstance,
+                         nullptr);
+    if (!_hWnd)
+		return E_FAIL;
+
+    ShowWindow(_hWnd, nCmdShow);
+
+    return S_OK;
+}
+
+#if !defined(DEBUG) && !defined(_DEBUG)
+// Blobs cooked by tools/assetcooker from assets.txt, named after the entry point and the
+// defines set to 1. Only used when newer than the source, so edits still recompile.
+static bool LoadCookedShader(const WCHAR* szFileName, LPCSTR szEntryPoint, const D3D_SHADER_MACRO* pDefines, ID3DBlob** ppBlobOut)
+{
+    WCHAR path[MAX_PATH];
+    int length = swprintf_s(path, L"shaders\\%S", szEntryPoint);
+
+    for (const D3D_SHADER_MACRO* pDefine = pDefines; pDefine && pDefine->Name && length > 0; pDefine++)
+    {
+        if (strcmp(pDefine->Definition, "1") == 0)
+            length += swprintf_s(path + length, MAX_PATH - length, L"_%S", pDefine->Name);
+    }
+
+    if (length <= 0 || swprintf_s(path + length, MAX_PATH - length, L".cso") < 0)
+        return false;
+
+    WIN32_FILE_ATTRIBUTE_DATA cooked, source;
+
+    if (!GetFileAttributesExW(path, GetFileExInfoStandard, &cooked) ||
+        (GetFileAttributesExW(szFileName, GetFileExInfoStandard, &source) && CompareFileTime(&cooked.ftLastWriteTime, &source.ftLastWriteTime) < 0))
+        return false;
+
+    return SUCCEEDED(D3DReadFileToBlob(path, ppBlobOut));
+}
+#endif
+
+HRESULT Application::CompileShaderFromFile(WCHAR* szFileName, LPCSTR szEntryPoint, LPCSTR szShaderModel, ID3DBlob** ppBlobOut, const D3D_SHADER_MACRO* pDefines)
+{
+    HRESULT hr = S_OK;
+
+#if !defined(DEBUG) && !defined(_DEBUG)
+    if (LoadCookedShader(szFileName, szEntryPoint, pDefines, ppBlobOut))
+        return S_OK;
+#endif
+
+    DWORD dwShaderFlags = D3DCOMPILE_ENABLE_STRICTNESS;
+#if defined(DEBUG) || defined(_DEBUG)
+    // Set the D3DCOMPILE_DEBUG flag to embed debug information in the shaders.
+    // Setting this flag improves the shader debugging experience, but still allows 
+    // the shaders to be optimized and to run exactly the way they will run in 
+    // the release configuration of this program.
+    dwShaderFlags |= D3DCOMPILE_DEBUG;
+#endif
+
+    ID3DBlob* pErrorBlob;
+    hr = D3DCompileFromFile(szFileName, pDefines, nullptr, szEntryPoint, szShaderModel, 
+        dwShaderFlags, 0, ppBlobOut, &pErrorBlob);
+
+    if (FAILED(hr))
+    {
+        if (pErrorBlob != nullptr)
+            OutputDebugStringA((char*)pErrorBlob->GetBufferPointer());
+
+        if (pErrorBlob) pErrorBlob->Release();
+
+        return hr;
+    }
+
+    if (pErrorBlob) pErrorBlob->Release();
+
+    return S_OK;
+}
+
+HRESULT Application::InitDevice()
+{
+    HRESULT hr = S_OK;
+
+    UINT createDeviceFlags = 0;
+
+#ifdef _DEBUG
+    createDeviceFlags |= D3D11_CREATE_DEVICE_DEBUG;
+#endif
+
+    D3D_DRIVER_TYPE driverTypes[] =
+    {
+        D3D_DRIVER_TYPE_HARDWARE,
+        D3D_DRIVER_TYPE_WARP,
+        D3D_DRIVER_TYPE_REFERENCE,
+    };
+
+    UINT numDriverTypes = ARRAYSIZE(driverTypes);
+
+    D3D_FEATURE_LEVEL featureLevels[] =
+    {
+        D3D_FEATURE_LEVEL_11_0,
+        D3D_FEATURE_LEVEL_10_1,
+        D3D_FEATURE_LEVEL_10_0,
+    };
+
+	UINT numFeatureLevels = ARRAYSIZE(featureLevels);
+
+    DXGI_SWAP_CHAIN_DESC sd; //allows to render to a back buffer off screen and then swap with front screen
+    ZeroMemory(&sd, sizeof(sd));
+    sd.BufferCount = 1;
+    sd.BufferDesc.Width = _WindowWidth;
+    sd.BufferDesc.Height = _WindowHeight;
+    sd.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    sd.BufferDesc.RefreshRate.Numerator = 60;
+    sd.BufferDesc.RefreshRate.Denominator = 1;
+    sd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+    sd.OutputWindow = _hWnd;
+    sd.SampleDesc.Count = 1;
+    sd.SampleDesc.Quality = 0;
+    sd.Windowed = TRUE;
+
+    for (UINT driverTypeIndex = 0; driverTypeIndex < numDriverTypes; driverTypeIndex++)
+    {
+        _driverType = driverTypes[driverTypeIndex];
+        hr = D3D11CreateDeviceAndSwapChain(nullptr, _driverType, nullptr, createDeviceFlags, featureLevels, numFeatureLevels,
+                                           D3D11_SDK_VERSION, &sd, &_pSwapChain, &_pd3dDevice, &_featureLevel, &_pImmediateContext);
+        if (SUCCEEDED(hr))
+            break;
+    }
+
+    if (FAILED(hr))
+        return hr;
+
+	// Soft budgets, going over only alerts
+	_device.Init(_pd3dDevice, &_gpuResources);
+	_gpuResources.SetAlertCallback(&Application::OnGpuBudgetExceeded, this);
+	_gpuResources.SetBudget(GPURES_GEOMETRY, 64ull << 20);
+	_gpuResources.SetBudget(GPURES_CONSTANTS, 1ull << 20);
+	_gpuResources.SetBudget(GPURES_STRUCTURED, 32ull << 20);
+	_gpuResources.SetBudget(GPURES_TEXTURE, 256ull << 20);
+	_gpuResources.SetBudget(GPURES_RENDER_TARGET, 192ull << 20);
+
+    // Create a render target view
+    ID3D11Texture2D* pBackBuffer = nullptr;
+    hr = _pSwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (LPVOID*)&pBackBuffer);
+
+    if (FAILED(hr))
+        return hr;
+
+    hr = _device.CreateRenderTargetView(pBackBuffer, nullptr, &_pRenderTargetView, GPU_RESOURCE(GPURES_VIEW, "BackBuffer")); //render target view is a texture that you can render to
+    pBackBuffer->Release();
+
+    if (FAILED(hr))
         return hr;
 
-    hr = _pd3dDevice->CreateRenderTargetView(pBackBuffer, nullptr, &_pRenderTargetView); //render target view is a texture that you can render to
-    pBackBuffer->Release();
+	// Depth and any other intermediate targets are owned by the render graph
+	ZeroMemory(&_backBufferTarget, sizeof(_backBufferTarget));
+	_backBufferTarget.pRTV = _pRenderTargetView;
+
+	_renderGraphBackend.Init(_pd3dDevice, _pImmediateContext);
+	_trackedGraphBackend.Init(&_renderGraphBackend, &_gpuResources);
+
+    return S_OK;
+}
+
+HRESULT Application::InitMeshes()
+{
+	// Position etc. in stream 0, lightmap UVs in stream 1. The built in meshes have no
+	// lightmap, their UVs are zero and the lightmapped entities get copies of their own.
+	const uint32_t streamStrides[] = { sizeof(SimpleVertex), sizeof(float) * 2 };
+	_geometryPool.Init(streamStrides, 2, 4096, 16384);
+
+	// Split into meshlets, the indices hold them back to back so the culler's draw ranges
+	// index straight into the cube's part of the pool
+	BuildMeshlets(&BuiltinCube.pVertices[0].position.x, sizeof(MeshVertex), BuiltinCube.vertexCount, BuiltinCube.pIndices, BuiltinCube.indexCount, _cubeMeshlets);
+
+	std::vector<uint32_t> expanded;
+	_cubeMeshlets.ExpandIndices(expanded);
+
+	std::vector<WORD> indices(expanded.begin(), expanded.end());
+
+	_cubeGeometry = _geometryPool.Alloc(BuiltinCube.vertexCount, (uint32_t)indices.size());
+	_geometryPool.WriteVertices(_cubeGeometry, 0, BuiltinCube.pVertices);
+	_geometryPool.WriteVertices(_cubeGeometry, 1, nullptr);
+	_geometryPool.WriteIndices(_cubeGeometry, indices.data());
+
+	indices.assign(BuiltinFloor.pIndices, BuiltinFloor.pIndices + BuiltinFloor.indexCount);
+
+	_floorGeometry = _geometryPool.Alloc(BuiltinFloor.vertexCount, BuiltinFloor.indexCount);
+	_geometryPool.WriteVertices(_floorGeometry, 0, BuiltinFloor.pVertices);
+	_geometryPool.WriteVertices(_floorGeometry, 1, nullptr);
+	_geometryPool.WriteIndices(_floorGeometry, indices.data());
+
+	return BindSceneMeshes();
+}
+
+HRESULT Application::FlushGeometry()
+{
+	// Everything the startup tasks added goes up in one go, no context needed to create
+	return _geometryPool.Flush(_device, nullptr);
+}
+
+HRESULT Application::BindSceneMeshes()
+{
+	// Scenes name their meshes, these are the ones built in
+	_sceneMeshes.resize(_scene.GetMeshCount());
+
+	for (UINT i = 0; i < _scene.GetMeshCount(); i++)
+	{
+		const char* name = _scene.GetMeshes()[i].name.ptr;
+		SceneMeshBinding& binding = _sceneMeshes[i];
+
+		if (strcmp(name, "cube") == 0)
+		{
+			binding.geometry = _cubeGeometry;
+			binding.pMeshlets = &_cubeMeshlets;
+		}
+		else if (strcmp(name, "floor") == 0)
+		{
+			binding.geometry = _floorGeometry;
+			binding.pMeshlets = nullptr;
+		}
+		else
+		{
+			OutputDebugStringA("Scene mesh isn't built in: ");
+			OutputDebugStringA(name);
+			OutputDebugStringA("\n");
+
+			return E_INVALIDARG;
+		}
+	}
+
+	return S_OK;
+}
+
+HRESULT Application::InitCollision()
+{
+	// The same built in meshes the renderer binds by name, from their CPU copies
+	_collisionMeshes.resize(_scene.GetMeshCount());
+
+	for (UINT i = 0; i < _scene.GetMeshCount(); i++)
+	{
+		const BuiltinMesh* pMesh = FindBuiltinMesh(_scene.GetMeshes()[i].name.ptr);
+
+		if (pMesh == nullptr)
+			return E_INVALIDARG;
+
+		BuildCollisionMesh(&pMesh->pVertices[0].position.x, sizeof(MeshVertex), pMesh->vertexCount, pMesh->pIndices,
+						   pMesh->indexCount, _collisionMeshes[i]);
+	}
+
+	AddCollisionBodies();
+
+	return S_OK;
+}
+
+void Application::AddCollisionBodies()
+{
+	_collision.Clear();
+	_entityBodies.assign(_scene.GetEntityCount(), CollisionInvalidBody);
+
+	for (UINT i = 0; i < _scene.GetEntityCount(); i++)
+	{
+		const SceneEntity& entity = _scene.GetEntities()[i];
+
+		if (entity.flags & SCENE_ENTITY_HIDDEN)
+			continue;
+
+		uint32_t flags = (entity.flags & SCENE_ENTITY_STATIC) ? COLLISION_STATIC : 0;
+		_entityBodies[i] = _collision.AddBody(&_collisionMeshes[entity.mesh], _scene.GetWorldMatrices()[i], flags);
+	}
+
+	_playerBody = _playerEntity != SceneInvalidIndex ? _entityBodies[_playerEntity] : CollisionInvalidBody;
+
+	if (_playerBody != CollisionInvalidBody)
+	{
+		const Mat4& world = _scene.GetWorldMatrices()[_playerEntity];
+		_playerPosition = Vec3(world.m[3][0], world.m[3][1], world.m[3][2]);
+	}
+}
+
+HRESULT Application::InitStates()
+{
+	HRESULT hr;
+
+	// Create the constant buffer
+	D3D11_BUFFER_DESC bd;
+	ZeroMemory(&bd, sizeof(bd));
+	bd.Usage = D3D11_USAGE_DEFAULT;
+	bd.ByteWidth = sizeof(ConstantBuffer);
+	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	bd.CPUAccessFlags = 0;
+    hr = _device.CreateBuffer(&bd, nullptr, &_pConstantBuffer, GPU_RESOURCE(GPURES_CONSTANTS, "ConstantBuffer"));
+
+	if (FAILED(hr))
+		return hr;
+
+	D3D11_RASTERIZER_DESC wfdesc;
+	ZeroMemory(&wfdesc, sizeof(D3D11_RASTERIZER_DESC));
+
+	wfdesc.FillMode = D3D11_FILL_SOLID;
+	//wfdesc.FillMode = D3D11_FILL_WIREFRAME;
+
+	// Materials pick one, the built in meshes are closed and clockwise so most cull back
+	for (UINT i = 0; i < 3; i++)
+	{
+		wfdesc.CullMode = (D3D11_CULL_MODE)(D3D11_CULL_NONE + i);
+		hr = _device.CreateRasterizerState(&wfdesc, &_pSceneRasterizers[i], GPU_RESOURCE(GPURES_STATE, "SceneRasterizer"));
+
+		if (FAILED(hr))
+			return hr;
+	}
+
+	D3D11_SAMPLER_DESC sampDesc;
+	ZeroMemory(&sampDesc, sizeof(sampDesc));
+	sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+	sampDesc.MinLOD = 0;
+	sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+	return _device.CreateSamplerState(&sampDesc, &_pSamplerLinear, GPU_RESOURCE(GPURES_STATE, "LinearSampler"));
+}
+
+HRESULT Application::BindPipeline()
+{
+    // Setup the viewport
+    D3D11_VIEWPORT vp;
+    vp.Width = (FLOAT)_WindowWidth;
+    vp.Height = (FLOAT)_WindowHeight;
+    vp.MinDepth = 0.0f;
+    vp.MaxDepth = 1.0f;
+    vp.TopLeftX = 0;
+    vp.TopLeftY = 0;
+    _pImmediateContext->RSSetViewports(1, &vp);
+
+    // Set the input layout
+    _pImmediateContext->IASetInputLayout(_pVertexLayout);
+
+	// Every static mesh lives in the geometry pool
+	_geometryPool.Bind(_pImmediateContext);
+
+    // Set primitive topology
+    _pImmediateContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+	_pImmediateContext->RSSetState(GetSceneRasterizer(D3D11_CULL_BACK));
+
+	return S_OK;
+}
+
+HRESULT Application::InitShadowMaps()
+{
+	HRESULT hr;
+
+	const ShadowSettings& settings = _shadowMaps.GetSettings();
+
+	// One slice per cascade, typeless so the same memory can be a DSV and an SRV
+	D3D11_TEXTURE2D_DESC textureDesc;
+	ZeroMemory(&textureDesc, sizeof(textureDesc));
+	textureDesc.Width = settings.resolution;
+	textureDesc.Height = settings.resolution;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = settings.cascadeCount;
+	textureDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
+
+	hr = _device.CreateTexture2D(&textureDesc, nullptr, &_pShadowMap, GPU_RESOURCE(GPURES_RENDER_TARGET, "ShadowMap"));
+
+	if (FAILED(hr))
+		return hr;
+
+	// The cache is only ever rendered to and copied from
+	textureDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+	hr = _device.CreateTexture2D(&textureDesc, nullptr, &_pShadowCache, GPU_RESOURCE(GPURES_RENDER_TARGET, "ShadowCache"));
+
+	if (FAILED(hr))
+		return hr;
+
+	D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc;
+	ZeroMemory(&dsvDesc, sizeof(dsvDesc));
+	dsvDesc.Format = DXGI_FORMAT_D32_FLOAT;
+	dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
+	dsvDesc.Texture2DArray.ArraySize = 1;
+
+	for (UINT i = 0; i < settings.cascadeCount; i++)
+	{
+		dsvDesc.Texture2DArray.FirstArraySlice = i;
+
+		hr = _device.CreateDepthStencilView(_pShadowMap, &dsvDesc, &_pShadowMapDSV[i], GPU_RESOURCE(GPURES_VIEW, "ShadowMapCascade"));
+
+		if (FAILED(hr))
+			return hr;
+
+		hr = _device.CreateDepthStencilView(_pShadowCache, &dsvDesc, &_pShadowCacheDSV[i], GPU_RESOURCE(GPURES_VIEW, "ShadowCacheCascade"));
+
+		if (FAILED(hr))
+			return hr;
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+	ZeroMemory(&srvDesc, sizeof(srvDesc));
+	srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+	srvDesc.Texture2DArray.MipLevels = 1;
+	srvDesc.Texture2DArray.ArraySize = settings.cascadeCount;
+
+	hr = _device.CreateShaderResourceView(_pShadowMap, &srvDesc, &_pShadowMapSRV, GPU_RESOURCE(GPURES_VIEW, "ShadowMap"));
+
+	if (FAILED(hr))
+		return hr;
+
+	_shadowMapTarget.pTexture = _pShadowMap;
+	_shadowMapTarget.pSRV = _pShadowMapSRV;
+
+	// Hardware PCF, anything outside the map counts as lit
+	D3D11_SAMPLER_DESC sampDesc;
+	ZeroMemory(&sampDesc, sizeof(sampDesc));
+	sampDesc.Filter = D3D11_FILTER_COMPARISON_MIN_MAG_LINEAR_MIP_POINT;
+	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_BORDER;
+	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_BORDER;
+	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_BORDER;
+	sampDesc.BorderColor[0] = 1.0f;
+	sampDesc.BorderColor[1] = 1.0f;
+	sampDesc.BorderColor[2] = 1.0f;
+	sampDesc.BorderColor[3] = 1.0f;
+	sampDesc.ComparisonFunc = D3D11_COMPARISON_LESS_EQUAL;
+	sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+	hr = _device.CreateSamplerState(&sampDesc, &_pShadowSampler, GPU_RESOURCE(GPURES_STATE, "ShadowSampler"));
+
+	if (FAILED(hr))
+		return hr;
+
+	D3D11_RASTERIZER_DESC rasterDesc;
+	ZeroMemory(&rasterDesc, sizeof(rasterDesc));
+	rasterDesc.FillMode = D3D11_FILL_SOLID;
+	rasterDesc.CullMode = D3D11_CULL_NONE;
+	rasterDesc.DepthBias = 1000;
+	rasterDesc.SlopeScaledDepthBias = 2.0f;
+	rasterDesc.DepthClipEnable = TRUE;
+
+	hr = _device.CreateRasterizerState(&rasterDesc, &_pShadowRasterizer, GPU_RESOURCE(GPURES_STATE, "ShadowRasterizer"));
+
+	if (FAILED(hr))
+		return hr;
+
+	D3D11_BUFFER_DESC bd;
+	ZeroMemory(&bd, sizeof(bd));
+	bd.Usage = D3D11_USAGE_DEFAULT;
+	bd.ByteWidth = sizeof(ShadowConstants);
+	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+
+	return _device.CreateBuffer(&bd, nullptr, &_pShadowConstantBuffer, GPU_RESOURCE(GPURES_CONSTANTS, "ShadowConstants"));
+}
+
+HRESULT Application::InitParticles()
+{
+	HRESULT hr;
+
+	hr = _device.CreateVertexShader(_pParticleVSBlob->GetBufferPointer(), _pParticleVSBlob->GetBufferSize(), &_pParticleVS, GPU_RESOURCE(GPURES_SHADER, "VS_Particle"));
+
+	if (FAILED(hr))
+		return hr;
+
+	hr = _device.CreatePixelShader(_pParticlePSBlob->GetBufferPointer(), _pParticlePSBlob->GetBufferSize(), &_pParticlePS, GPU_RESOURCE(GPURES_SHADER, "PS_Particle"));
+	_pParticlePSBlob->Release();
+	_pParticlePSBlob = nullptr;
+
+	if (FAILED(hr))
+		return hr;
+
+	// Nothing per vertex, the corners come from SV_VertexID and everything else steps once
+	// per instance
+	D3D11_INPUT_ELEMENT_DESC layout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 }, // position and size
+		{ "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 }
+	};
+
+	hr = _device.CreateInputLayout(layout, ARRAYSIZE(layout), _pParticleVSBlob->GetBufferPointer(),
+										_pParticleVSBlob->GetBufferSize(), &_pParticleLayout, GPU_RESOURCE(GPURES_SHADER, "ParticleInstance"));
+	_pParticleVSBlob->Release();
+	_pParticleVSBlob = nullptr;
+
+	if (FAILED(hr))
+		return hr;
+
+	// Rewritten every frame with WRITE_DISCARD
+	D3D11_BUFFER_DESC bd;
+	ZeroMemory(&bd, sizeof(bd));
+	bd.Usage = D3D11_USAGE_DYNAMIC;
+	bd.ByteWidth = sizeof(ParticleInstance) * (DustCapacity + SparkCapacity);
+	bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	hr = _device.CreateBuffer(&bd, nullptr, &_pParticleInstanceBuffer, GPU_RESOURCE(GPURES_GEOMETRY, "ParticleInstances"));
+
+	if (FAILED(hr))
+		return hr;
+
+	// Premultiplied alpha: blended particles cover what is behind them, additive ones
+	// are written with zero alpha and only add
+	D3D11_BLEND_DESC blendDesc;
+	ZeroMemory(&blendDesc, sizeof(blendDesc));
+	blendDesc.RenderTarget[0].BlendEnable = TRUE;
+	blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
+	blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+	blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+	blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+	blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+	blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+	blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+	hr = _device.CreateBlendState(&blendDesc, &_pParticleBlendState, GPU_RESOURCE(GPURES_STATE, "ParticleBlend"));
+
+	if (FAILED(hr))
+		return hr;
+
+	// Tested against the scene but never written, particles don't hide each other
+	D3D11_DEPTH_STENCIL_DESC depthDesc;
+	ZeroMemory(&depthDesc, sizeof(depthDesc));
+	depthDesc.DepthEnable = TRUE;
+	depthDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+	depthDesc.DepthFunc = D3D11_COMPARISON_LESS;
+	hr = _device.CreateDepthStencilState(&depthDesc, &_pParticleDepthState, GPU_RESOURCE(GPURES_STATE, "ParticleDepth"));
+
+	if (FAILED(hr))
+		return hr;
+
+	// Dust hangs over the whole floor and drifts
+	ParticleEmitterDesc dust;
+	dust.position = Vec3(0.0f, 0.0f, 0.0f);
+	dust.positionJitter = Vec3(20.0f, 2.0f, 20.0f);
+	dust.velocityJitter = Vec3(0.3f, 0.1f, 0.3f);
+	dust.acceleration = Vec3(0.2f, 0.0f, 0.0f);
+	dust.drag = 0.5f;
+	dust.lifeMin = 4.0f;
+	dust.lifeMax = 8.0f;
+	dust.sizeStart = 0.02f;
+	dust.sizeEnd = 0.05f;
+	dust.colorStart[0] = 0.6f; dust.colorStart[1] = 0.55f; dust.colorStart[2] = 0.5f; dust.colorStart[3] = 0.5f;
+	dust.colorEnd[0] = 0.6f; dust.colorEnd[1] = 0.55f; dust.colorEnd[2] = 0.5f; dust.colorEnd[3] = 0.0f;
+	dust.rate = DustCapacity / 6.0f;
+	dust.groundHeight = -2.0f;
+	dust.sorted = true;
+	_dust.Init(dust, DustCapacity, 1);
+
+	// Sparks fountain up from the middle of the floor and bounce off it
+	ParticleEmitterDesc sparks;
+	sparks.position = Vec3(0.0f, -1.5f, 6.0f);
+	sparks.positionJitter = Vec3(0.1f, 0.1f, 0.1f);
+	sparks.velocity = Vec3(0.0f, 6.0f, 0.0f);
+	sparks.velocityJitter = Vec3(2.5f, 2.0f, 2.5f);
+	sparks.acceleration = Vec3(0.0f, -9.8f, 0.0f);
+	sparks.drag = 0.1f;
+	sparks.lifeMin = 1.0f;
+	sparks.lifeMax = 2.5f;
+	sparks.sizeStart = 0.03f;
+	sparks.sizeEnd = 0.01f;
+	sparks.colorStart[0] = 1.0f; sparks.colorStart[1] = 0.8f; sparks.colorStart[2] = 0.3f; sparks.colorStart[3] = 1.0f;
+	sparks.colorEnd[0] = 1.0f; sparks.colorEnd[1] = 0.2f; sparks.colorEnd[2] = 0.0f; sparks.colorEnd[3] = 0.0f;
+	sparks.rate = SparkCapacity / 2.0f;
+	sparks.groundHeight = -2.0f;
+	sparks.restitution = 0.4f;
+	sparks.additive = true;
+	_sparks.Init(sparks, SparkCapacity, 2);
+
+	return S_OK;
+}
+
+HRESULT Application::BuildTentacles()
+{
+	const UINT boneCount = 8;
+	const float boneLength = 0.4f;
+	const UINT rings = 25;
+	const UINT segments = 12;
+	const float height = boneCount * boneLength;
+	const float twoPi = 6.28318531f;
+
+	// A chain straight up from the root, every bone one length above its parent
+	_tentacleSkeleton.parents.resize(boneCount);
+	_tentacleSkeleton.bindPose.resize(boneCount);
+
+	for (UINT i = 0; i < boneCount; i++)
+	{
+		_tentacleSkeleton.parents[i] = i == 0 ? NoParentBone : (uint16_t)(i - 1);
+		_tentacleSkeleton.bindPose[i].translation = Vec3(0.0f, i == 0 ? 0.0f : boneLength, 0.0f);
+	}
+
+	_tentacleSkeleton.ComputeInverseBind();
+
+	// Tapering tube around the chain, the seam is duplicated for the texture coordinates
+	_tentacleVertices.resize(rings * (segments + 1));
+
+	for (UINT r = 0; r < rings; r++)
+	{
+		float v = (float)r / (rings - 1);
+		float y = v * height;
+		float radius = 0.25f + (0.05f - 0.25f) * v;
+
+		// Blend between the two nearest bone centres
+		float s = y / boneLength - 0.5f;
+		int bone = (int)floorf(s);
+		float weight = s - bone;
+
+		if (bone < 0)
+		{
+			bone = 0;
+			weight = 0.0f;
+		}
+		else if (bone >= (int)boneCount - 1)
+		{
+			bone = boneCount - 2;
+			weight = 1.0f;
+		}
+
+		uint8_t next = (uint8_t)(weight * 255.0f + 0.5f);
+
+		for (UINT k = 0; k <= segments; k++)
+		{
+			float angle = twoPi * k / segments;
+			SkinnedVertex& vertex = _tentacleVertices[r * (segments + 1) + k];
+
+			vertex.position[0] = radius * cosf(angle);
+			vertex.position[1] = y;
+			vertex.position[2] = radius * sinf(angle);
+			vertex.normal[0] = cosf(angle);
+			vertex.normal[1] = 0.0f;
+			vertex.normal[2] = sinf(angle);
+			vertex.texCoord[0] = (float)k / segments;
+			vertex.texCoord[1] = 1.0f - v;
+			vertex.bones[0] = (uint8_t)bone;
+			vertex.bones[1] = (uint8_t)(bone + 1);
+			vertex.bones[2] = 0;
+			vertex.bones[3] = 0;
+			vertex.weights[0] = (uint8_t)(255 - next);
+			vertex.weights[1] = next;
+			vertex.weights[2] = 0;
+			vertex.weights[3] = 0;
+		}
+	}
+
+	// Clockwise seen from outside
+	_tentacleIndices.clear();
+
+	for (UINT r = 0; r + 1 < rings; r++)
+	{
+		for (UINT k = 0; k < segments; k++)
+		{
+			WORD v00 = (WORD)(r * (segments + 1) + k);
+			WORD v01 = (WORD)(v00 + 1);
+			WORD v10 = (WORD)(v00 + segments + 1);
+			WORD v11 = (WORD)(v10 + 1);
+
+			WORD quad[6] = { v00, v10, v01, v01, v10, v11 };
+			_tentacleIndices.insert(_tentacleIndices.end(), quad, quad + 6);
+		}
+	}
+
+	// Two looping clips, a sway about Z and a slower curl about X, each bone a little
+	// behind its parent so a wave runs up the chain
+	const float durations[2] = { 3.0f, 4.0f };
+	const float amplitudes[2] = { 0.25f, 0.3f };
+
+	for (UINT c = 0; c < 2; c++)
+	{
+		RawClip clip;
+		clip.boneCount = boneCount;
+		clip.sampleRate = 30.0f;
+		clip.frameCount = (uint32_t)(durations[c] * clip.sampleRate) + 1;
+		clip.keys.resize(clip.frameCount * boneCount);
+
+		for (UINT f = 0; f < clip.frameCount; f++)
+		{
+			float phase = twoPi * f / (clip.frameCount - 1);
+
+			for (UINT i = 0; i < boneCount; i++)
+			{
+				BoneTransform& key = clip.keys[f * boneCount + i];
+				key = _tentacleSkeleton.bindPose[i];
+
+				float angle = amplitudes[c] * sinf(phase - 0.6f * i);
+				key.rotation[c == 0 ? 2 : 0] = sinf(0.5f * angle);
+				key.rotation[3] = cosf(0.5f * angle);
+			}
+		}
+
+		if (!_tentacleClips[c].Compress(clip, ClipCompressionSettings(), &_tentacleSkeleton))
+			return E_FAIL;
+	}
+
+	_animation.Init(&_tentacleSkeleton, TentacleCount);
+
+	for (UINT i = 0; i < TentacleCount; i++)
+	{
+		AnimationInstance& instance = _animation.GetInstance(i);
+		instance.pClips[0] = &_tentacleClips[0];
+		instance.pClips[1] = &_tentacleClips[1];
+	}
+
+	return S_OK;
+}
+
+HRESULT Application::InitTentacles()
+{
+	static_assert(sizeof(SkinnedVertexOutput) == sizeof(SimpleVertex), "CPU skinning writes SimpleVertex");
+
+	HRESULT hr;
+
+	hr = _device.CreateVertexShader(_pSkinnedVSBlob->GetBufferPointer(), _pSkinnedVSBlob->GetBufferSize(), &_pSkinnedVS, GPU_RESOURCE(GPURES_SHADER, "VS_Skinned"));
+
+	if (FAILED(hr))
+		return hr;
+
+	// The usual vertex followed by four bone indices and their weights
+	D3D11_INPUT_ELEMENT_DESC layout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "BLENDINDICES", 0, DXGI_FORMAT_R8G8B8A8_UINT, 0, 32, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "BLENDWEIGHT", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 36, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	};
+
+	hr = _device.CreateInputLayout(layout, ARRAYSIZE(layout), _pSkinnedVSBlob->GetBufferPointer(),
+										_pSkinnedVSBlob->GetBufferSize(), &_pSkinnedLayout, GPU_RESOURCE(GPURES_SHADER, "SkinnedVertex"));
+	_pSkinnedVSBlob->Release();
+	_pSkinnedVSBlob = nullptr;
+
+	if (FAILED(hr))
+		return hr;
+
+	D3D11_BUFFER_DESC bd;
+	ZeroMemory(&bd, sizeof(bd));
+	bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+
+	if (_cpuSkinning)
+	{
+		// Every tentacle's skinned vertices, rewritten each frame with WRITE_DISCARD
+		bd.Usage = D3D11_USAGE_DYNAMIC;
+		bd.ByteWidth = sizeof(SkinnedVertexOutput) * (UINT)_tentacleVertices.size() * TentacleCount;
+		bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		hr = _device.CreateBuffer(&bd, nullptr, &_pTentacleVertexBuffer, GPU_RESOURCE(GPURES_GEOMETRY, "TentacleVertices"));
+	}
+	else
+	{
+		// Bind pose only, shared by every tentacle
+		D3D11_SUBRESOURCE_DATA InitData;
+		ZeroMemory(&InitData, sizeof(InitData));
+		InitData.pSysMem = _tentacleVertices.data();
+
+		bd.Usage = D3D11_USAGE_IMMUTABLE;
+		bd.ByteWidth = sizeof(SkinnedVertex) * (UINT)_tentacleVertices.size();
+		hr = _device.CreateBuffer(&bd, &InitData, &_pTentacleVertexBuffer, GPU_RESOURCE(GPURES_GEOMETRY, "TentacleVertices"));
+	}
+
+	if (FAILED(hr))
+		return hr;
+
+	ZeroMemory(&bd, sizeof(bd));
+	bd.Usage = D3D11_USAGE_IMMUTABLE;
+	bd.ByteWidth = sizeof(WORD) * (UINT)_tentacleIndices.size();
+	bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+
+	D3D11_SUBRESOURCE_DATA InitData;
+	ZeroMemory(&InitData, sizeof(InitData));
+	InitData.pSysMem = _tentacleIndices.data();
+	hr = _device.CreateBuffer(&bd, &InitData, &_pTentacleIndexBuffer, GPU_RESOURCE(GPURES_GEOMETRY, "TentacleIndices"));
+
+	if (FAILED(hr))
+		return hr;
+
+	ZeroMemory(&bd, sizeof(bd));
+	bd.Usage = D3D11_USAGE_DEFAULT;
+	bd.ByteWidth = sizeof(SkinConstants);
+	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	hr = _device.CreateBuffer(&bd, nullptr, &_pSkinConstantBuffer, GPU_RESOURCE(GPURES_CONSTANTS, "SkinConstants"));
+
+	if (FAILED(hr))
+		return hr;
+
+	_tentacleMaterial.SetFeatures<MATERIAL_SPECULAR>();
+
+	MaterialConstants& constants = _tentacleMaterial.GetConstants();
+	constants.DiffuseMtrl = XMFLOAT4(0.55f, 0.2f, 0.45f, 1.0f);
+	constants.AmbientMtrl = XMFLOAT4(0.3f, 0.1f, 0.25f, 1.0f);
+	constants.SpecularMtrl = XMFLOAT4(0.8f, 0.8f, 0.8f, 1.0f);
+	constants.SpecularPower = 20.0f;
+	constants.AlphaCutoff = 0.0f;
+
+	return _tentacleMaterial.Create(&_device);
+}
+
+HRESULT Application::InitDebugDraw()
+{
+	// Created even when the overlay starts hidden so F1 can bring it up
+	HRESULT hr = _debugRenderer.Init(_device, _pDebugVSBlob, _pDebugPSBlob, _debugDraw.GetCapacity());
+
+	_pDebugVSBlob->Release();
+	_pDebugVSBlob = nullptr;
+	_pDebugPSBlob->Release();
+	_pDebugPSBlob = nullptr;
+
+	return hr;
+}
+
+HRESULT Application::InitUpscale()
+{
+	HRESULT hr;
+
+	hr = _device.CreateVertexShader(_pUpscaleVSBlob->GetBufferPointer(), _pUpscaleVSBlob->GetBufferSize(), &_pUpscaleVS, GPU_RESOURCE(GPURES_SHADER, "VS_Upscale"));
+	_pUpscaleVSBlob->Release();
+	_pUpscaleVSBlob = nullptr;
+
+	if (FAILED(hr))
+		return hr;
+
+	hr = _device.CreatePixelShader(_pUpscalePSBlob->GetBufferPointer(), _pUpscalePSBlob->GetBufferSize(), &_pUpscalePS, GPU_RESOURCE(GPURES_SHADER, "PS_Upscale"));
+	_pUpscalePSBlob->Release();
+	_pUpscalePSBlob = nullptr;
+
+	if (FAILED(hr))
+		return hr;
+
+	D3D11_BUFFER_DESC bd;
+	ZeroMemory(&bd, sizeof(bd));
+	bd.Usage = D3D11_USAGE_DEFAULT;
+	bd.ByteWidth = sizeof(UpscaleConstants);
+	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	hr = _device.CreateBuffer(&bd, nullptr, &_pUpscaleConstantBuffer, GPU_RESOURCE(GPURES_CONSTANTS, "UpscaleConstants"));
+
+	if (FAILED(hr))
+		return hr;
+
+	// The linear sampler wraps, which would blend the right edge with the left one
+	D3D11_SAMPLER_DESC sampDesc;
+	ZeroMemory(&sampDesc, sizeof(sampDesc));
+	sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+	sampDesc.MinLOD = 0;
+	sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+	return _device.CreateSamplerState(&sampDesc, &_pSamplerClamp, GPU_RESOURCE(GPURES_STATE, "ClampSampler"));
+}
+
+HRESULT Application::InitDepthPrepass()
+{
+	HRESULT hr;
+
+	// The main pass after a pre-pass only shades what is already nearest, the vertex
+	// shader is the same in both so the depths match exactly
+	D3D11_DEPTH_STENCIL_DESC depthDesc;
+	ZeroMemory(&depthDesc, sizeof(depthDesc));
+	depthDesc.DepthEnable = TRUE;
+	depthDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+	depthDesc.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
+
+	hr = _device.CreateDepthStencilState(&depthDesc, &_pPrepassTestState, GPU_RESOURCE(GPURES_STATE, "PrepassTest"));
+
+	if (FAILED(hr))
+		return hr;
+
+	D3D11_QUERY_DESC queryDesc;
+	ZeroMemory(&queryDesc, sizeof(queryDesc));
+	queryDesc.Query = D3D11_QUERY_PIPELINE_STATISTICS;
+
+	for (UINT i = 0; i < OverdrawQueryCount; i++)
+	{
+		hr = _device.CreateQuery(&queryDesc, &_pOverdrawQueries[i], GPU_RESOURCE(GPURES_STATE, "OverdrawQuery"));
+
+		if (FAILED(hr))
+			return hr;
+	}
+
+	return S_OK;
+}
+
+HRESULT Application::LoadLightmaps()
+{
+	// Baked by tools/lightbaker, without them everything keeps the constant ambient
+	std::vector<uint8_t> data;
+
+	if (FAILED(ReadFileData("lightmap.bin", data)) || FAILED(ReadFileData("lightmap.dds", _lightmapTextureData)))
+	{
+		_lightmapTextureData.clear();
+		return S_OK;
+	}
+
+	if (!ParseLightmap(data.data(), data.size(), _lightmap))
+	{
+		OutputDebugStringA("lightmap.bin: not a lightmap or from another version, rebake it\n");
+		_lightmapTextureData.clear();
+	}
+
+	return S_OK;
+}
 
-    if (FAILED(hr))
-        return hr;
+HRESULT Application::InitLightmaps()
+{
+	HRESULT hr;
 
-	//--
-	D3D11_TEXTURE2D_DESC depthStencilDesc;
-	depthStencilDesc.Width = _WindowWidth;
-	depthStencilDesc.Height = _WindowHeight;
-	depthStencilDesc.MipLevels = 1;
-	depthStencilDesc.ArraySize = 1;
-	depthStencilDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
-	depthStencilDesc.SampleDesc.Count = 1;
-	depthStencilDesc.SampleDesc.Quality = 0;
-	depthStencilDesc.Usage = D3D11_USAGE_DEFAULT;
-	depthStencilDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
-	depthStencilDesc.CPUAccessFlags = 0;
-	depthStencilDesc.MiscFlags = 0;
-
-	_pd3dDevice->CreateTexture2D(&depthStencilDesc, nullptr, &_depthStencilBuffer);
-	_pd3dDevice->CreateDepthStencilView(_depthStencilBuffer, nullptr, &_depthStencilView);
-
-    _pImmediateContext->OMSetRenderTargets(1, &_pRenderTargetView, _depthStencilView);
-	//--
+	// One zero UV read at stride 0 by every mesh without a lightmap
+	float defaultUV[2] = { 0.0f, 0.0f };
 
-    // Setup the viewport
-    D3D11_VIEWPORT vp;
-    vp.Width = (FLOAT)_WindowWidth;
-    vp.Height = (FLOAT)_WindowHeight;
-    vp.MinDepth = 0.0f;
-    vp.MaxDepth = 1.0f;
-    vp.TopLeftX = 0;
-    vp.TopLeftY = 0;
-    _pImmediateContext->RSSetViewports(1, &vp);
+	D3D11_BUFFER_DESC bd;
+	ZeroMemory(&bd, sizeof(bd));
+	bd.Usage = D3D11_USAGE_IMMUTABLE;
+	bd.ByteWidth = sizeof(defaultUV);
+	bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
 
-	InitShadersAndInputLayout();
+	D3D11_SUBRESOURCE_DATA InitData;
+	ZeroMemory(&InitData, sizeof(InitData));
+	InitData.pSysMem = defaultUV;
 
-	InitVertexBuffer();
-	InitIndexBuffer();
+	hr = _device.CreateBuffer(&bd, &InitData, &_pDefaultLightmapUVs, GPU_RESOURCE(GPURES_GEOMETRY, "DefaultLightmapUVs"));
 
-	InitVertexBufferTri();
-	InitIndexBufferTri();
+	if (FAILED(hr) || _lightmapTextureData.empty())
+		return hr;
 
-    // Set vertex buffer
-    UINT stride = sizeof(SimpleVertex);
-    UINT offset = 0;
-    _pImmediateContext->IASetVertexBuffers(0, 1, &_pVertexBuffer, &stride, &offset);
+	hr = CreateDDSTextureFromMemory(_pd3dDevice, _lightmapTextureData.data(), _lightmapTextureData.size(), nullptr, &_pLightmapSRV);
 
-    // Set index buffer
-    _pImmediateContext->IASetIndexBuffer(_pIndexBuffer, DXGI_FORMAT_R16_UINT, 0);
+	if (FAILED(hr))
+		return hr;
 
-    // Set primitive topology
-    _pImmediateContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	_device.TrackTextureView(_pLightmapSRV, GPU_RESOURCE(GPURES_TEXTURE, "Lightmap"));
+	std::vector<uint8_t>().swap(_lightmapTextureData);
 
-	// Create the constant buffer
-	D3D11_BUFFER_DESC bd;
-	ZeroMemory(&bd, sizeof(bd));
-	bd.Usage = D3D11_USAGE_DEFAULT;
-	bd.ByteWidth = sizeof(ConstantBuffer);
-	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-	bd.CPUAccessFlags = 0;
-    hr = _pd3dDevice->CreateBuffer(&bd, nullptr, &_pConstantBuffer);
+	// The builtin meshes copied into the pool with the baker's vertex split
+	GeometryAllocation missing;
+	ZeroMemory(&missing, sizeof(missing));
+	missing.vertexBlock = TlsfInvalidBlock;
+	missing.indexBlock = TlsfInvalidBlock;
 
+	_lightmapGeometry.assign(_lightmap.entities.size(), missing);
 
-	D3D11_RASTERIZER_DESC wfdesc;
-	ZeroMemory(&wfdesc, sizeof(D3D11_RASTERIZER_DESC));
+	for (size_t i = 0; i < _lightmap.entities.size(); i++)
+	{
+		const LightmapEntity& entity = _lightmap.entities[i];
 
-	wfdesc.FillMode = D3D11_FILL_SOLID;
-	//wfdesc.FillMode = D3D11_FILL_WIREFRAME;
+		UINT meshIndex = _scene.FindMesh(entity.meshHash);
+		const BuiltinMesh* pMesh = meshIndex != SceneInvalidIndex ? FindBuiltinMesh(_scene.GetMeshes()[meshIndex].name.ptr) : nullptr;
+		UINT vertexCount = (UINT)entity.remap.size();
 
-	wfdesc.CullMode = D3D11_CULL_NONE;
-	hr = _pd3dDevice->CreateRasterizerState(&wfdesc, &_wireFrame);
+		if (pMesh == nullptr || vertexCount > 0xFFFF)
+			continue;
 
-	_pImmediateContext->RSSetState(_wireFrame);
+		std::vector<SimpleVertex> vertices(vertexCount);
+		std::vector<WORD> indices(entity.indices.begin(), entity.indices.end());
+		bool valid = true;
 
+		for (UINT v = 0; v < vertexCount && valid; v++)
+		{
+			valid = entity.remap[v] < pMesh->vertexCount;
 
-    if (FAILED(hr))
-        return hr;
+			if (valid)
+				memcpy(&vertices[v], &pMesh->pVertices[entity.remap[v]], sizeof(SimpleVertex));
+		}
 
-	D3D11_SAMPLER_DESC sampDesc;
-	ZeroMemory(&sampDesc, sizeof(sampDesc));
-	sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
-	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
-	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
-	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
-	sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
-	sampDesc.MinLOD = 0;
-	sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+		// Baked against a different version of the mesh
+		if (!valid)
+			continue;
+
+		GeometryAllocation& geometry = _lightmapGeometry[i];
+		geometry = _geometryPool.Alloc(vertexCount, (uint32_t)indices.size());
+		_geometryPool.WriteVertices(geometry, 0, vertices.data());
+		_geometryPool.WriteVertices(geometry, 1, entity.uvs.data());
+		_geometryPool.WriteIndices(geometry, indices.data());
+	}
 
-	_pd3dDevice->CreateSamplerState(&sampDesc, &_pSamplerLinear);
+	BindEntityLightmaps();
 
-    return S_OK;
+	return S_OK;
+}
+
+void Application::BindEntityLightmaps()
+{
+	// By name, and only while the entity is still static and has the mesh it was baked with
+	_entityLightmaps.assign(_scene.GetEntityCount(), UINT_MAX);
+
+	for (UINT i = 0; i < (UINT)_lightmapGeometry.size(); i++)
+	{
+		const LightmapEntity& baked = _lightmap.entities[i];
+		UINT index = _scene.FindEntity(baked.nameHash);
+
+		if (_lightmapGeometry[i].vertexBlock == TlsfInvalidBlock || index == SceneInvalidIndex)
+			continue;
+
+		const SceneEntity& entity = _scene.GetEntities()[index];
+
+		if ((entity.flags & SCENE_ENTITY_STATIC) && _scene.GetMeshes()[entity.mesh].nameHash == baked.meshHash)
+			_entityLightmaps[index] = i;
+	}
 }
 
 void Application::Cleanup()
 {
     if (_pImmediateContext) _pImmediateContext->ClearState();
 
-    if (_pConstantBuffer) _pConstantBuffer->Release();
-    if (_pVertexBuffer) _pVertexBuffer->Release();
-    if (_pIndexBuffer) _pIndexBuffer->Release();
-	//--
-	if (_pVertexBufferTri) _pVertexBufferTri->Release();
-	if (_pIndexBufferTri) _pIndexBufferTri->Release();
-	//--
-    if (_pVertexLayout) _pVertexLayout->Release();
-    if (_pVertexShader) _pVertexShader->Release();
-    if (_pPixelShader) _pPixelShader->Release();
-    if (_pRenderTargetView) _pRenderTargetView->Release();
+	_renderGraph.ReleasePhysical(&_trackedGraphBackend);
+
+    _device.Release(_pConstantBuffer);
+	for (UINT i = 0; i < 3; i++)
+		_device.Release(_pSceneRasterizers[i]);
+	_device.Release(_pSamplerLinear);
+	_geometryPool.Release(_device);
+	_device.Release(_pLightSRV);
+	_device.Release(_pClusterSRV);
+	_device.Release(_pLightIndexSRV);
+	_device.Release(_pLightBuffer);
+	_device.Release(_pClusterBuffer);
+	_device.Release(_pLightIndexBuffer);
+	_device.Release(_pClusterConstantBuffer);
+	for (UINT i = 0; i < MaxShadowCascades; i++)
+	{
+		_device.Release(_pShadowMapDSV[i]);
+		_device.Release(_pShadowCacheDSV[i]);
+	}
+	_device.Release(_pShadowMapSRV);
+	_device.Release(_pShadowMap);
+	_device.Release(_pShadowCache);
+	_device.Release(_pShadowSampler);
+	_device.Release(_pShadowRasterizer);
+	_device.Release(_pShadowConstantBuffer);
+	_device.Release(_pParticleVS);
+	_device.Release(_pParticlePS);
+	_device.Release(_pParticleLayout);
+	_device.Release(_pParticleInstanceBuffer);
+	_device.Release(_pParticleBlendState);
+	_device.Release(_pParticleDepthState);
+	_device.Release(_pSkinnedVS);
+	_device.Release(_pSkinnedLayout);
+	_device.Release(_pTentacleVertexBuffer);
+	_device.Release(_pTentacleIndexBuffer);
+	_device.Release(_pSkinConstantBuffer);
+	_tentacleMaterial.Release();
+	_debugRenderer.Release(_device);
+	_lightmapGeometry.clear();
+	_device.Release(_pLightmapSRV);
+	_device.Release(_pDefaultLightmapUVs);
+	_device.Release(_pUpscaleVS);
+	_device.Release(_pUpscalePS);
+	_device.Release(_pUpscaleConstantBuffer);
+	_device.Release(_pSamplerClamp);
+	_device.Release(_pPrepassTestState);
+	for (UINT i = 0; i < OverdrawQueryCount; i++)
+		_device.Release(_pOverdrawQueries[i]);
+	if (_pResolutionTrace)
+	{
+		fclose(_pResolutionTrace);
+		_pResolutionTrace = nullptr;
+	}
+	// Only still around when startup failed half way
+	if (_pParticleVSBlob) _pParticleVSBlob->Release();
+	if (_pParticlePSBlob) _pParticlePSBlob->Release();
+	if (_pSkinnedVSBlob) _pSkinnedVSBlob->Release();
+	if (_pDebugVSBlob) _pDebugVSBlob->Release();
+	if (_pDebugPSBlob) _pDebugPSBlob->Release();
+	if (_pUpscaleVSBlob) _pUpscaleVSBlob->Release();
+	if (_pUpscalePSBlob) _pUpscalePSBlob->Release();
+	if (_pVSBlob) _pVSBlob->Release();
+	for (UINT i = 0; i < MaterialPermutationCount; i++)
+	{
+		if (_pPSBlobs[i]) _pPSBlobs[i]->Release();
+	}
+    _device.Release(_pVertexLayout);
+    _device.Release(_pVertexShader);
+	for (UINT i = 0; i < MaterialPermutationCount; i++)
+	{
+		_device.Release(_pPixelShaders[i]);
+	}
+	for (Material* pMaterial : _sceneMaterials)
+		_materialPool.Delete(pMaterial);
+
+	_sceneMaterials.clear();
+	_materialPool.Shutdown();
+	for (size_t i = 0; i < _sceneTextures.size(); i++)
+	{
+		_device.Release(_sceneTextures[i]);
+	}
+	_sceneTextures.clear();
+	_scene.Unload();
+    _device.Release(_pRenderTargetView);
+
+	ReportGpuLeaks();
+
     if (_pSwapChain) _pSwapChain->Release();
     if (_pImmediateContext) _pImmediateContext->Release();
     if (_pd3dDevice) _pd3dDevice->Release();
 
-	//--
-	if (_depthStencilView) _depthStencilView->Release();
-	if (_depthStencilBuffer) _depthStencilBuffer->Release();
-	//--
+	_frameArena.Shutdown();
+	_jobSystem.Shutdown();
+}
+
+void Application::ReportGpuLeaks()
+{
+	std::string report;
+
+	if (_gpuResources.BuildLeakReport(report) == 0)
+		return;
+
+	OutputDebugStringA(report.c_str());
+
+	// Also on disk, release builds have no debugger attached to see it
+	FILE* pFile = nullptr;
+	if (fopen_s(&pFile, "gpuleaks.txt", "w") == 0)
+	{
+		fputs(report.c_str(), pFile);
+		fclose(pFile);
+	}
+}
+
+void Application::OnGpuBudgetExceeded(GpuResourceCategory category, uint64_t liveBytes, uint64_t budget, void* pData)
+{
+	(void)pData;
+
+	char message[160];
+	sprintf_s(message, "Warning: %s GPU memory over budget, %llu KB of %llu KB\n", GpuResourceTracker::GetCategoryName(category),
+			  (unsigned long long)(liveBytes >> 10), (unsigned long long)(budget >> 10));
+	OutputDebugStringA(message);
 }
 
+// The camera is a small sphere, the cube is approximated by the sphere inside it
+static const float CameraRadius = 0.5f;
+static const float PlayerRadius = 1.0f;
+
 void Application::Update()
 {
+	LARGE_INTEGER frequency, updateBegin;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&updateBegin);
+
+	if (_lastFrameTime.QuadPart != 0)
+	{
+		float frameMs = (float)((updateBegin.QuadPart - _lastFrameTime.QuadPart) * 1000.0 / frequency.QuadPart);
+		_frameTimes.Push(frameMs);
+		UpdateResolution(frameMs);
+	}
+
+	_lastFrameTime = updateBegin;
+
+	_frameArena.BeginFrame();
+	_debugDraw.BeginFrame();
+
+	// F1 toggles the overlay on the key going down
+	bool overlayKey = (GetAsyncKeyState(VK_F1) & 0x8000) != 0;
+
+	if (overlayKey && !_overlayKeyDown)
+		_debugDraw.SetEnabled(!_debugDraw.IsEnabled());
+
+	_overlayKeyDown = overlayKey;
+
+	// F2 the same for the depth pre-pass
+	bool prepassKey = (GetAsyncKeyState(VK_F2) & 0x8000) != 0;
+
+	if (prepassKey && !_prepassKeyDown)
+		_depthPrepass = !_depthPrepass;
+
+	_prepassKeyDown = prepassKey;
+
+#ifdef _DEBUG
+	// Steady state frames should not reach the heap at all. The debug CRT hook counts
+	// every malloc and new, not just the calls made through the tracked allocators.
+	size_t heapCalls = MemoryTracker::GetAllHeapCallCount();
+
+	if (_frameArena.GetFrameIndex() > 2 && heapCalls != _heapCallsLastFrame)
+	{
+		char message[96];
+		sprintf_s(message, "Warning: %zu heap calls during frame %u\n", heapCalls - _heapCallsLastFrame, _frameArena.GetFrameIndex());
+		OutputDebugStringA(message);
+	}
+
+	_heapCallsLastFrame = heapCalls;
+#endif
+
     // Update our time
     static float t = 0.0f;
 
@@ -648,6 +2057,8 @@ void Application::Update()
 	moveY2 = moveY2 / (mover2 * 100);
 	moveZ2 = moveZ2 / (mover2 * 100);
 
+	Vec3 eyeBefore(eyex, eyey, eyez);
+	Vec3 eyeBefore2(eyex2, eyey2, eyez2);
 
 	if (GetAsyncKeyState(VK_UP))
 	{
@@ -779,122 +2190,682 @@ void Application::Update()
 		}
 	}
 
-	if (GetAsyncKeyState(VK_SPACE))
+	if (GetAsyncKeyState(VK_SPACE))
+	{
+		if (keyState == 2)
+		{
+			eyex2 = eyex2 + moveX2;
+			atx2 = atx2 + moveX2;
+			eyey2 = eyey2 + moveY2;
+			aty2 = aty2 + moveY2;
+			eyez2 = eyez2 + moveZ2;
+			atz2 = atz2 + moveZ2;
+		}
+	}
+
+	if (GetAsyncKeyState(VK_NUMPAD0))
+	{
+		keyState = 0;
+		if (eyey < -0.1f)
+		{
+			eyey = eyey + 1.5f;
+			eyex = eyex - (moveX / 10);
+			eyez = eyez - (moveZ / 10);
+			aty = aty + 0.05f;
+			atx = atx - (moveX / 10);
+			atz = atz - (moveZ / 10);
+		}
+	}
+	if (GetAsyncKeyState(VK_NUMPAD1))
+	{
+		keyState = 1;
+		if (eyey > -0.1f)
+		{
+			eyey = eyey - 1.5f;
+			eyex = eyex + (moveX / 10);
+			eyez = eyez + (moveZ / 10);
+			aty = aty - 0.05f;
+			atx = atx + (moveX / 10);
+			atz = atz + (moveZ / 10);
+		}
+	}
+
+	// Cameras slide along the scene instead of passing through it. The look-at point moves
+	// with the eye so the view direction is kept, the first camera ignores the cube that
+	// follows it around.
+	Vec3 eye = _collision.MoveSphere(eyeBefore, CameraRadius, Vec3(eyex, eyey, eyez) - eyeBefore, _playerBody);
+	atx += eye.x - eyex;
+	aty += eye.y - eyey;
+	atz += eye.z - eyez;
+	eyex = eye.x;
+	eyey = eye.y;
+	eyez = eye.z;
+
+	Vec3 eye2 = _collision.MoveSphere(eyeBefore2, CameraRadius, Vec3(eyex2, eyey2, eyez2) - eyeBefore2, CollisionInvalidBody);
+	atx2 += eye2.x - eyex2;
+	aty2 += eye2.y - eyey2;
+	atz2 += eye2.z - eyez2;
+	eyex2 = eye2.x;
+	eyey2 = eye2.y;
+	eyez2 = eye2.z;
+
+	if (GetAsyncKeyState(VK_NUMPAD2))
+	{
+		keyState = 2;
+	}
+	if (GetAsyncKeyState(VK_NUMPAD3))
+	{
+		keyState = 3;
+		eyex2 = eyex;
+		eyey2 = eyey;
+		eyez2 = eyez;
+	}
+
+	if (keyState == 3)
+	{
+		XMStoreFloat4x4(&_world, XMMatrixTranslation(eyex, eyey - 1.5f, eyez));
+	}
+	if (keyState == 0)
+	{
+		XMStoreFloat4x4(&_world, XMMatrixTranslation(eyex, eyey - 1.5f, eyez));
+	}
+	if (keyState == 1)
+	{
+		XMStoreFloat4x4(&_world, XMMatrixTranslation(eyex - (moveX * 200), eyey, eyez - (moveZ * 200)));
+	}
+
+	// The cube is swept from where it was to where the camera puts it, so it comes to rest
+	// on the floor instead of sinking into it
+	if (_playerBody != CollisionInvalidBody)
+	{
+		Vec3 target(_world._41, _world._42, _world._43);
+		_playerPosition = _collision.MoveSphere(_playerPosition, PlayerRadius, target - _playerPosition, _playerBody);
+
+		XMStoreFloat4x4(&_world, XMMatrixTranslation(_playerPosition.x, _playerPosition.y, _playerPosition.z));
+		_collision.UpdateBody(_playerBody, Mat4::FromFloats(&_world._11));
+	}
+
+	// The player cube follows the camera, everything else is placed by the scene
+	if (_playerEntity != SceneInvalidIndex)
+		_scene.SetWorldMatrix(_playerEntity, Mat4::FromFloats(&_world._11));
+
+	PollScenePatch();
+	UpdateLights(t);
+	UpdateParticles(t);
+	UpdateAnimation(t);
+
+	LARGE_INTEGER updateEnd;
+	QueryPerformanceCounter(&updateEnd);
+	UpdateOverlay((float)((updateEnd.QuadPart - updateBegin.QuadPart) * 1000.0 / frequency.QuadPart));
+}
+
+void Application::UpdateResolution(float frameMs)
+{
+	if (_pResolutionTrace)
+		fprintf(_pResolutionTrace, "%.3f %.4f\n", frameMs, _dynamicResolution.GetScale());
+
+	// Picked here so the cluster constants and every pass of the frame agree on it
+	float scale = _dynamicResolution.Update(frameMs);
+	_renderWidth = ScaleDimension(_WindowWidth, scale);
+	_renderHeight = ScaleDimension(_WindowHeight, scale);
+}
+
+void Application::UpdateOverlay(float updateMs)
+{
+	_updateTimes.Push(updateMs);
+
+	if (!_debugDraw.IsEnabled())
+		return;
+
+	// World space: the player's collision sphere bounds
+	Vec3 extent(PlayerRadius, PlayerRadius, PlayerRadius);
+	_debugDraw.Box(_playerPosition - extent, _playerPosition + extent, DebugColor(255, 255, 0));
+
+	const float x = 8.0f;
+	const float lineHeight = (float)DebugGlyphSize + 3.0f;
+	const float width = 480.0f;
+	const float graphHeight = 48.0f;
+	const float graphMs = 33.3f;
+	const uint32_t white = DebugColor(255, 255, 255);
+	const uint32_t grey = DebugColor(180, 180, 180);
+	float y = 8.0f;
+
+	// Everything below is one panel, the background goes first so it is drawn underneath
+	const UINT textLines = 13 + GPURES_COUNT;
+	_debugDraw.Rect(x - 4.0f, y - 4.0f, width + 8.0f, textLines * lineHeight + graphHeight + 12.0f, DebugColor(0, 0, 0, 170));
+
+	float frameMs = _frameTimes.GetAverage();
+	_debugDraw.Text(x, y, white, "Frame %5.2f ms (max %5.2f) %4.0f fps  draws %u", _frameTimes.GetLatest(), _frameTimes.GetMax(),
+					frameMs > 0.0f ? 1000.0f / frameMs : 0.0f, _lastDrawCalls);
+	y += lineHeight;
+	_debugDraw.Text(x, y, grey, "Update %5.2f ms (max %5.2f)", _updateTimes.GetLatest(), _updateTimes.GetMax());
+	y += lineHeight + 2.0f;
+
+	// Frame time in green with the update share in front, the line marks 60Hz
+	_debugDraw.Graph(x, y, width, graphHeight, _frameTimes, graphMs, DebugColor(80, 200, 80));
+	_debugDraw.Graph(x, y, width, graphHeight, _updateTimes, graphMs, DebugColor(80, 140, 255));
+	_debugDraw.Rect(x, y + graphHeight * (1.0f - 16.6f / graphMs), width, 1.0f, DebugColor(255, 80, 80));
+	y += graphHeight + 4.0f;
+
+	const RenderGraphStats& graphStats = _renderGraph.GetStats();
+	_debugDraw.Text(x, y, white, "Graph %u passes (%u culled) %u barriers %.1f/%.1f MB transient", graphStats.passCount,
+					graphStats.culledPassCount, graphStats.barrierCount, graphStats.aliasedBytes / (1024.0 * 1024.0),
+					graphStats.unaliasedBytes / (1024.0 * 1024.0));
+	y += lineHeight;
+
+	const ParticleStats& dustStats = _dust.GetStats();
+	const ParticleStats& sparkStats = _sparks.GetStats();
+	double particleMs = dustStats.updateMs + dustStats.sortMs + dustStats.writeMs + sparkStats.updateMs + sparkStats.sortMs + sparkStats.writeMs;
+	const ClusterStats& clusterStats = _clusteredLighting.GetStats();
+	const MeshletCullStats& cullStats = _meshletCuller.GetStats();
+
+	_debugDraw.Text(x, y, white, "CPU ms anim %.2f particles %.2f lights %.2f cull %.2f pairs %.2f", _animation.GetStats().updateMs,
+					particleMs, clusterStats.assignMs, cullStats.cullMs, _collision.GetBroadphase().GetStats().findPairsMs);
+	y += lineHeight;
+	_debugDraw.Text(x, y, grey, "Lights %u in %u clusters, meshlets %u/%u", clusterStats.lightCount, clusterStats.occupiedClusters,
+					cullStats.meshletsVisible, cullStats.meshletsTested);
+	y += lineHeight;
+	_debugDraw.Text(x, y, grey, "Particles dust %u sparks %u", dustStats.alive, sparkStats.alive);
+	y += lineHeight;
+
+	const ShadowStats& shadowStats = _shadowMaps.GetStats();
+	_debugDraw.Text(x, y, grey, "Shadows %u redrawn %u cached, %u static draws saved", shadowStats.cascadesUpdated,
+					shadowStats.cascadesReused, shadowStats.staticDrawsSaved);
+	y += lineHeight;
+
+	const DynamicResolutionStats& resolutionStats = _dynamicResolution.GetStats();
+	_debugDraw.Text(x, y, grey, "Resolution %ux%u (%.0f%%), %u changes, %u hitches ignored", _renderWidth, _renderHeight,
+					resolutionStats.scale * 100.0f, resolutionStats.changes, resolutionStats.spikes);
+	y += lineHeight;
+
+	GeometryPoolStats geometryStats = _geometryPool.GetStats();
+	_debugDraw.Text(x, y, grey, "Geometry %u/%u vertices %u/%u indices, %.0f%% fragmented, %u moves", geometryStats.vertices.used,
+					geometryStats.vertices.capacity, geometryStats.indices.used, geometryStats.indices.capacity,
+					geometryStats.vertices.fragmentation * 100.0f, geometryStats.moves);
+	y += lineHeight;
+
+	if (_measureOverdraw)
+		_debugDraw.Text(x, y, grey, "Overdraw %.2f shaded per pixel %s pre-pass, F2 toggles", _overdrawStats.perPixel,
+						_overdrawStats.prepass ? "with" : "without");
+	else
+		_debugDraw.Text(x, y, grey, "Depth pre-pass %s, F2 toggles, -overdraw to measure", _depthPrepass ? "on" : "off");
+	y += lineHeight;
+
+	_debugDraw.Text(x, y, white, "GPU memory");
+	y += lineHeight;
+
+	for (UINT i = 0; i < GPURES_COUNT; i++)
+	{
+		GpuResourceCategory category = (GpuResourceCategory)i;
+		GpuResourceCategoryStats stats = _gpuResources.GetStats(category);
+
+		_debugDraw.Text(x, y, stats.overBudget ? DebugColor(255, 80, 80) : grey, "  %-14s %5u %8.2f MB / %4.0f MB",
+						GpuResourceTracker::GetCategoryName(category), stats.liveCount, stats.liveBytes / (1024.0 * 1024.0),
+						stats.budget / (1024.0 * 1024.0));
+		y += lineHeight;
+	}
+
+	DebugDrawStats debugStats = _debugDraw.GetStats();
+	_debugDraw.Text(x, y, grey, "Debug draw %u/%u vertices, %u dropped", debugStats.lineVertices, debugStats.overlayVertices,
+					debugStats.dropped);
+}
+
+void Application::UpdateParticles(float t)
+{
+	// Long stalls (window drags, the debugger) would otherwise launch everything at once
+	float dt = t - _particleTime;
+	_particleTime = t;
+
+	if (dt < 0.0f)
+		dt = 0.0f;
+	if (dt > 0.1f)
+		dt = 0.1f;
+
+	_dust.Update(dt, &_jobSystem);
+	_sparks.Update(dt, &_jobSystem);
+
+	// Dust is blended so it has to go back to front; sparks only add
+	_dust.Sort(Mat4::FromFloats(&_view._11));
+}
+
+void Application::UpdateAnimation(float t)
+{
+	// Each tentacle drifts between the sway and the curl at its own pace
+	for (UINT i = 0; i < _animation.GetInstanceCount(); i++)
+	{
+		AnimationInstance& instance = _animation.GetInstance(i);
+		instance.times[0] = t + 0.37f * i;
+		instance.times[1] = t + 0.53f * i;
+		instance.blend = 0.5f + 0.5f * sinf(0.5f * t + (float)i);
+	}
+
+	_animation.Update(&_jobSystem);
+}
+
+void Application::PollScenePatch()
+{
+	// Looking at the file time is cheap but not free, a couple of times a second is plenty
+	if (_frameArena.GetFrameIndex() % 30 != 0)
+		return;
+
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+	if (!GetFileAttributesExA("scene.patch", GetFileExInfoStandard, &attributes) ||
+		CompareFileTime(&attributes.ftLastWriteTime, &_scenePatchTime) == 0)
+		return;
+
+	_scenePatchTime = attributes.ftLastWriteTime;
+
+	std::vector<uint8_t> patch;
+
+	if (FAILED(ReadFileData("scene.patch", patch)))
+		return;
+
+	// Compiled patches are applied as they are, anything else is taken to be text
+	if (patch.size() < sizeof(ScenePatchHeader) || reinterpret_cast<const ScenePatchHeader*>(patch.data())->magic != ScenePatchMagic)
+	{
+		patch.push_back(0);
+
+		std::vector<uint8_t> compiled;
+		char error[512];
+
+		if (!CompileScenePatch((const char*)patch.data(), compiled, error, sizeof(error)))
+		{
+			OutputDebugStringA("scene.patch: ");
+			OutputDebugStringA(error);
+			OutputDebugStringA("\n");
+			return;
+		}
+
+		patch.swap(compiled);
+	}
+
+	ScenePatchResult result;
+
+	if (!_scene.ApplyPatch(patch.data(), patch.size(), result))
+	{
+		OutputDebugStringA("scene.patch: can't be applied in place, recompile the scene and restart\n");
+		return;
+	}
+
+	for (UINT i = 0; result.materialsChanged && i < _scene.GetMaterialCount(); i++)
+		CreateSceneMaterial(i);
+
+	if (result.lightsChanged)
+		InitLights();
+
+	// Static casters or the sun may have moved
+	if (result.entitiesChanged || result.entitiesAdded || result.lightsChanged)
+		_shadowMaps.Invalidate();
+
+	if (result.entitiesChanged || result.entitiesAdded)
+	{
+		AddCollisionBodies();
+		BindEntityLightmaps();
+	}
+
+	char message[128];
+	sprintf_s(message, "scene.patch: %u entities changed, %u added, %u lights, %u materials\n", result.entitiesChanged,
+			  result.entitiesAdded, result.lightsChanged, result.materialsChanged);
+	OutputDebugStringA(message);
+}
+
+void Application::Draw()
+{
+	// Build this frame's graph, everything is declared up front so the compiler can
+	// order, cull and alias before any GPU work is issued
+	_renderGraph.Reset();
+	_drawCalls = 0;
+
+	// A few meshes a frame are compacted, the moved ranges go up before anything draws
+	_geometryPool.Defragment(4);
+	_geometryPool.Flush(_device, _pImmediateContext);
+
+	GatherVisibleEntities();
+
+	// Refit the cascades first, the pass needs to know which caches are still valid
+	_shadowMaps.Update(Mat4::FromFloats(&_view._11), XM_PIDIV2, _WindowWidth / (FLOAT)_WindowHeight, 0.01f,
+					   Vec3(-lightDirection.x, -lightDirection.y, -lightDirection.z));
+	UploadShadowConstants();
+
+	for (UINT i = 0; i < _shadowMaps.GetSettings().cascadeCount; i++)
+		_debugDraw.Frustum(_shadowMaps.GetCascade(i).viewProjection, DebugColor(255, 160, 0));
+
+	RenderGraphTextureDesc backBufferDesc = { _WindowWidth, _WindowHeight, DXGI_FORMAT_R8G8B8A8_UNORM, 4, RG_BIND_RENDER_TARGET };
+	_rgBackBuffer = _renderGraph.ImportTexture("BackBuffer", backBufferDesc, &_backBufferTarget, RG_STATE_PRESENT, RG_STATE_PRESENT);
+
+	// Sized for the largest scale, only the top left _renderWidth x _renderHeight is drawn
+	float maxScale = _dynamicResolution.GetSettings().maxScale;
+	UINT targetWidth = ScaleDimension(_WindowWidth, maxScale);
+	UINT targetHeight = ScaleDimension(_WindowHeight, maxScale);
+
+	RenderGraphTextureDesc colorDesc = { targetWidth, targetHeight, DXGI_FORMAT_R8G8B8A8_UNORM, 4, RG_BIND_RENDER_TARGET | RG_BIND_SHADER_RESOURCE };
+	_rgSceneColor = _renderGraph.CreateTexture("SceneColor", colorDesc);
+
+	RenderGraphTextureDesc depthDesc = { targetWidth, targetHeight, DXGI_FORMAT_D24_UNORM_S8_UINT, 4, RG_BIND_DEPTH_STENCIL };
+	_rgSceneDepth = _renderGraph.CreateTexture("SceneDepth", depthDesc);
+
+	UINT shadowResolution = _shadowMaps.GetSettings().resolution;
+	RenderGraphTextureDesc shadowDesc = { shadowResolution, shadowResolution, DXGI_FORMAT_D32_FLOAT, 4, RG_BIND_DEPTH_STENCIL | RG_BIND_SHADER_RESOURCE };
+	_rgShadowMap = _renderGraph.ImportTexture("ShadowMap", shadowDesc, &_shadowMapTarget, RG_STATE_SHADER_READ, RG_STATE_SHADER_READ);
+
+	UINT shadowPass = _renderGraph.AddPass("Shadows", &Application::ExecuteShadowPass, this);
+	_renderGraph.Write(shadowPass, _rgShadowMap, RG_STATE_DEPTH_WRITE);
+
+	// Declared first so it is ordered before the main pass, which writes depth after it
+	if (_depthPrepass)
+	{
+		UINT prepass = _renderGraph.AddPass("DepthPrepass", &Application::ExecuteDepthPrepass, this);
+		_renderGraph.Write(prepass, _rgSceneDepth, RG_STATE_DEPTH_WRITE);
+	}
+
+	UINT mainPass = _renderGraph.AddPass("Main", &Application::ExecuteMainPass, this);
+	_renderGraph.Read(mainPass, _rgShadowMap, RG_STATE_SHADER_READ);
+	_renderGraph.Write(mainPass, _rgSceneColor, RG_STATE_RENDER_TARGET);
+	_renderGraph.Write(mainPass, _rgSceneDepth, RG_STATE_DEPTH_WRITE);
+
+	UINT particlePass = _renderGraph.AddPass("Particles", &Application::ExecuteParticlePass, this);
+	_renderGraph.Read(particlePass, _rgSceneDepth, RG_STATE_DEPTH_READ);
+	_renderGraph.Write(particlePass, _rgSceneColor, RG_STATE_RENDER_TARGET);
+
+	UINT upscalePass = _renderGraph.AddPass("Upscale", &Application::ExecuteUpscalePass, this);
+	_renderGraph.Read(upscalePass, _rgSceneColor, RG_STATE_SHADER_READ);
+	_renderGraph.Write(upscalePass, _rgBackBuffer, RG_STATE_RENDER_TARGET);
+
+	// Only part of the graph while it is showing, drawn at full size after the upscale
+	if (_debugDraw.IsEnabled())
 	{
-		if (keyState == 2)
-		{
-			eyex2 = eyex2 + moveX2;
-			atx2 = atx2 + moveX2;
-			eyey2 = eyey2 + moveY2;
-			aty2 = aty2 + moveY2;
-			eyez2 = eyez2 + moveZ2;
-			atz2 = atz2 + moveZ2;
-		}
+		UINT debugPass = _renderGraph.AddPass("DebugOverlay", &Application::ExecuteDebugPass, this);
+		_renderGraph.Write(debugPass, _rgBackBuffer, RG_STATE_RENDER_TARGET);
 	}
 
-	if (GetAsyncKeyState(VK_NUMPAD0))
+	// A target that can't be created skips the frame, the next one tries again
+	if (!_renderGraph.Compile() || !_renderGraph.Execute(&_trackedGraphBackend))
+		OutputDebugStringA("Render graph failed, frame skipped\n");
+
+	_lastDrawCalls = _drawCalls;
+
+    //
+    // Present our back buffer to our front buffer
+    //
+    _pSwapChain->Present(0, 0);
+
+	if (!_startupReported)
+		ReportStartup();
+}
+
+void Application::GatherVisibleEntities()
+{
+	// Shared by the pre-pass and the main pass, gone when the frame after next begins
+	_pVisibleEntities = _frameArena.AllocArray<VisibleEntity>(_scene.GetEntityCount(), MEMTAG_RENDER);
+	_visibleEntityCount = 0;
+
+	if (_pVisibleEntities == nullptr)
 	{
-		keyState = 0;
-		if (eyey < -0.1f)
-		{
-			eyey = eyey + 1.5f;
-			eyex = eyex - (moveX / 10);
-			eyez = eyez - (moveZ / 10);
-			aty = aty + 0.05f;
-			atx = atx - (moveX / 10);
-			atz = atz - (moveZ / 10);
-		}
+		OutputDebugStringA("Warning: frame arena full, no entities drawn\n");
+		return;
 	}
-	if (GetAsyncKeyState(VK_NUMPAD1))
+
+	for (UINT i = 0; i < _scene.GetEntityCount(); i++)
 	{
-		keyState = 1;
-		if (eyey > -0.1f)
-		{
-			eyey = eyey - 1.5f;
-			eyex = eyex + (moveX / 10);
-			eyez = eyez + (moveZ / 10);
-			aty = aty - 0.05f;
-			atx = atx + (moveX / 10);
-			atz = atz + (moveZ / 10);
-		}
+		if (_scene.GetEntities()[i].flags & SCENE_ENTITY_HIDDEN)
+			continue;
+
+		XMFLOAT4X4 world(&_scene.GetWorldMatrices()[i].m[0][0]);
+
+		VisibleEntity& visible = _pVisibleEntities[_visibleEntityCount++];
+		visible.world = XMMatrixTranspose(XMLoadFloat4x4(&world));
+		visible.entity = i;
+		visible.lightmap = i < _entityLightmaps.size() ? _entityLightmaps[i] : UINT_MAX;
 	}
-	if (GetAsyncKeyState(VK_NUMPAD2))
+}
+
+void Application::UploadShadowConstants()
+{
+	const ShadowSettings& settings = _shadowMaps.GetSettings();
+
+	ShadowConstants constants;
+	ZeroMemory(&constants, sizeof(constants));
+
+	float splits[MaxShadowCascades] = { D3D11_FLOAT32_MAX, D3D11_FLOAT32_MAX, D3D11_FLOAT32_MAX, D3D11_FLOAT32_MAX };
+
+	for (UINT i = 0; i < settings.cascadeCount; i++)
 	{
-		keyState = 2;
+		const ShadowCascade& cascade = _shadowMaps.GetCascade(i);
+
+		Mat4 viewProjection = Transpose(cascade.viewProjection);
+		memcpy(&constants.CascadeViewProj[i], viewProjection.m, sizeof(viewProjection.m));
+		splits[i] = cascade.splitFar;
 	}
-	if (GetAsyncKeyState(VK_NUMPAD3))
+
+	constants.CascadeSplits = XMFLOAT4(splits[0], splits[1], splits[2], splits[3]);
+	constants.ShadowTexelSize = 1.0f / settings.resolution;
+	constants.CascadeCount = settings.cascadeCount;
+
+	_pImmediateContext->UpdateSubresource(_pShadowConstantBuffer, 0, nullptr, &constants, 0, 0);
+}
+
+void Application::ExecuteShadowPass(const RenderGraphPassContext& context, void* pData)
+{
+	static_cast<Application*>(pData)->DrawShadows(context);
+}
+
+void Application::ExecuteMainPass(const RenderGraphPassContext& context, void* pData)
+{
+	static_cast<Application*>(pData)->DrawScene(context);
+}
+
+void Application::ExecuteDepthPrepass(const RenderGraphPassContext& context, void* pData)
+{
+	static_cast<Application*>(pData)->DrawDepthPrepass(context);
+}
+
+void Application::ExecuteParticlePass(const RenderGraphPassContext& context, void* pData)
+{
+	static_cast<Application*>(pData)->DrawParticles(context);
+}
+
+void Application::ExecuteDebugPass(const RenderGraphPassContext& context, void* pData)
+{
+	static_cast<Application*>(pData)->DrawDebugOverlay(context);
+}
+
+void Application::ExecuteUpscalePass(const RenderGraphPassContext& context, void* pData)
+{
+	static_cast<Application*>(pData)->DrawUpscale(context);
+}
+
+void Application::DrawShadows(const RenderGraphPassContext& context)
+{
+	const ShadowSettings& settings = _shadowMaps.GetSettings();
+
+	D3D11_VIEWPORT vp;
+	vp.Width = (FLOAT)settings.resolution;
+	vp.Height = (FLOAT)settings.resolution;
+	vp.MinDepth = 0.0f;
+	vp.MaxDepth = 1.0f;
+	vp.TopLeftX = 0;
+	vp.TopLeftY = 0;
+	_pImmediateContext->RSSetViewports(1, &vp);
+	_pImmediateContext->RSSetState(_pShadowRasterizer);
+
+	// Depth only
+	_pImmediateContext->VSSetShader(_pVertexShader, nullptr, 0);
+	_pImmediateContext->VSSetConstantBuffers(0, 1, &_pConstantBuffer);
+	_pImmediateContext->PSSetShader(nullptr, nullptr, 0);
+
+	for (UINT i = 0; i < settings.cascadeCount; i++)
 	{
-		keyState = 3;
-		eyex2 = eyex;
-		eyey2 = eyey;
-		eyez2 = eyez;
+		const ShadowCascade& cascade = _shadowMaps.GetCascade(i);
+
+		if (cascade.staticDirty)
+		{
+			// Cached cascades keep their static casters in the cache slice for later frames
+			ID3D11DepthStencilView* pStaticDSV = cascade.cached ? _pShadowCacheDSV[i] : _pShadowMapDSV[i];
+
+			_pImmediateContext->OMSetRenderTargets(0, nullptr, pStaticDSV);
+			_pImmediateContext->ClearDepthStencilView(pStaticDSV, D3D11_CLEAR_DEPTH, 1.0f, 0);
+			DrawShadowCasters(cascade, false);
+		}
+
+		if (cascade.cached)
+		{
+			_pImmediateContext->OMSetRenderTargets(0, nullptr, nullptr);
+			_pImmediateContext->CopySubresourceRegion(_pShadowMap, i, 0, 0, 0, _pShadowCache, i, nullptr);
+		}
+
+		_pImmediateContext->OMSetRenderTargets(0, nullptr, _pShadowMapDSV[i]);
+		DrawShadowCasters(cascade, true);
 	}
 
-	if (keyState == 3)
+	_pImmediateContext->OMSetRenderTargets(0, nullptr, nullptr);
+	_pImmediateContext->RSSetState(GetSceneRasterizer(D3D11_CULL_BACK));
+
+	// Casters drawn into each cascade, for the cache stats
+	UINT staticCasters = 0;
+	UINT dynamicCasters = 0;
+
+	for (UINT i = 0; i < _scene.GetEntityCount(); i++)
 	{
-		XMStoreFloat4x4(&_world, XMMatrixTranslation(eyex, eyey - 1.5f, eyez));
+		UINT flags = _scene.GetEntities()[i].flags;
+
+		if (flags & (SCENE_ENTITY_HIDDEN | SCENE_ENTITY_NO_SHADOW))
+			continue;
+
+		if (flags & SCENE_ENTITY_STATIC)
+			staticCasters++;
+		else
+			dynamicCasters++;
 	}
-	if (keyState == 0)
+
+	_shadowMaps.RecordDraws(staticCasters, dynamicCasters);
+}
+
+void Application::DrawShadowCasters(const ShadowCascade& cascade, bool dynamicCasters)
+{
+	XMFLOAT4X4 view(&cascade.view.m[0][0]);
+	XMFLOAT4X4 projection(&cascade.projection.m[0][0]);
+
+	ConstantBuffer cb;
+	ZeroMemory(&cb, sizeof(cb));
+	cb.mView = XMMatrixTranspose(XMLoadFloat4x4(&view));
+	cb.mProjection = XMMatrixTranspose(XMLoadFloat4x4(&projection));
+
+	_geometryPool.Bind(_pImmediateContext);
+
+	for (UINT i = 0; i < _scene.GetEntityCount(); i++)
 	{
-		XMStoreFloat4x4(&_world, XMMatrixTranslation(eyex, eyey - 1.5f, eyez));
+		const SceneEntity& entity = _scene.GetEntities()[i];
+
+		if ((entity.flags & (SCENE_ENTITY_HIDDEN | SCENE_ENTITY_NO_SHADOW)) || ((entity.flags & SCENE_ENTITY_STATIC) != 0) == dynamicCasters)
+			continue;
+
+		const SceneMeshBinding& mesh = _sceneMeshes[entity.mesh];
+		XMFLOAT4X4 world(&_scene.GetWorldMatrices()[i].m[0][0]);
+
+		cb.mWorld = XMMatrixTranspose(XMLoadFloat4x4(&world));
+		_pImmediateContext->UpdateSubresource(_pConstantBuffer, 0, nullptr, &cb, 0, 0);
+
+		_pImmediateContext->DrawIndexed(mesh.geometry.indexCount, _geometryPool.GetFirstIndex(mesh.geometry), _geometryPool.GetBaseVertex(mesh.geometry));
+		_drawCalls++;
 	}
-	if (keyState == 1)
+}
+
+void Application::DrawDepthPrepass(const RenderGraphPassContext& context)
+{
+	D3D11RenderTarget* pDepth = static_cast<D3D11RenderTarget*>(context.GetPhysical(_rgSceneDepth));
+
+	// Depth only, no colour target and no pixel shader
+	_pImmediateContext->OMSetRenderTargets(0, nullptr, pDepth->pDSV);
+	_pImmediateContext->OMSetDepthStencilState(nullptr, 0);
+	_pImmediateContext->ClearDepthStencilView(pDepth->pDSV, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
+
+	D3D11_VIEWPORT vp;
+	vp.Width = (FLOAT)_renderWidth;
+	vp.Height = (FLOAT)_renderHeight;
+	vp.MinDepth = 0.0f;
+	vp.MaxDepth = 1.0f;
+	vp.TopLeftX = 0;
+	vp.TopLeftY = 0;
+	_pImmediateContext->RSSetViewports(1, &vp);
+
+	XMMATRIX view = XMLoadFloat4x4(&_view);
+	XMMATRIX projection = XMLoadFloat4x4(&_projection);
+
+	ConstantBuffer cb;
+	ZeroMemory(&cb, sizeof(cb));
+	cb.mView = XMMatrixTranspose(view);
+	cb.mProjection = XMMatrixTranspose(projection);
+
+	_pImmediateContext->VSSetShader(_pVertexShader, nullptr, 0);
+	_pImmediateContext->VSSetConstantBuffers(0, 1, &_pConstantBuffer);
+	_pImmediateContext->PSSetShader(nullptr, nullptr, 0);
+	_geometryPool.Bind(_pImmediateContext);
+
+	D3D11_CULL_MODE cullMode = D3D11_CULL_BACK;
+	_pImmediateContext->RSSetState(GetSceneRasterizer(cullMode));
+
+	for (UINT i = 0; i < _visibleEntityCount; i++)
 	{
-		XMStoreFloat4x4(&_world, XMMatrixTranslation(eyex - (moveX * 200), eyey, eyez - (moveZ * 200)));
-	}
-	XMStoreFloat4x4(&_world2, XMMatrixScaling(10.0f, 1.0f, 10.0f));
+		const VisibleEntity& visible = _pVisibleEntities[i];
+		const SceneEntity& entity = _scene.GetEntities()[visible.entity];
+		const Material& material = *_sceneMaterials[entity.material];
 
-	/*CreateDDSTextureFromFile(_pd3dDevice, L"Crate_COLOR.dds", nullptr, &_pTextureRV);*/
+		if (material.HasFeature(MATERIAL_ALPHATEST))
+			continue;
 
-	CreateDDSTextureFromFile(_pd3dDevice, L"asphalt.dds", nullptr, &_pTextureRV);
+		if (material.GetCullMode() != cullMode)
+		{
+			cullMode = material.GetCullMode();
+			_pImmediateContext->RSSetState(GetSceneRasterizer(cullMode));
+		}
 
-	_pImmediateContext->PSSetShaderResources(0, 1, &_pTextureRV);
+		cb.mWorld = visible.world;
+		_pImmediateContext->UpdateSubresource(_pConstantBuffer, 0, nullptr, &cb, 0, 0);
 
-	_pImmediateContext->PSSetSamplers(0, 1, &_pSamplerLinear);
+		// Whole meshes, the meshlets the main pass culls are off screen or facing away and
+		// would not have won the depth test. Lightmapped entities use their own copy so
+		// the triangles are the ones the main pass draws.
+		const GeometryAllocation& geometry = visible.lightmap != UINT_MAX ? _lightmapGeometry[visible.lightmap] : _sceneMeshes[entity.mesh].geometry;
+
+		_pImmediateContext->DrawIndexed(geometry.indexCount, _geometryPool.GetFirstIndex(geometry), _geometryPool.GetBaseVertex(geometry));
+		_drawCalls++;
+	}
 }
 
-void Application::Draw()
+void Application::DrawScene(const RenderGraphPassContext& context)
 {
+	D3D11RenderTarget* pColor = static_cast<D3D11RenderTarget*>(context.GetPhysical(_rgSceneColor));
+	D3D11RenderTarget* pDepth = static_cast<D3D11RenderTarget*>(context.GetPhysical(_rgSceneDepth));
+
+	_pImmediateContext->OMSetRenderTargets(1, &pColor->pRTV, pDepth->pDSV);
+
+	// The shadow pass leaves its own viewport behind. This one is the render size, the
+	// particles keep it and the upscale pass stretches it over the back buffer.
+	D3D11_VIEWPORT vp;
+	vp.Width = (FLOAT)_renderWidth;
+	vp.Height = (FLOAT)_renderHeight;
+	vp.MinDepth = 0.0f;
+	vp.MaxDepth = 1.0f;
+	vp.TopLeftX = 0;
+	vp.TopLeftY = 0;
+	_pImmediateContext->RSSetViewports(1, &vp);
+
     //
     // Clear the back buffer
     //
     float ClearColor[4] = {0.0f, 0.0f, 0.0f, 1.0f}; // red,green,blue,alpha
-    _pImmediateContext->ClearRenderTargetView(_pRenderTargetView, ClearColor);
-	_pImmediateContext->ClearDepthStencilView(_depthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
+    _pImmediateContext->ClearRenderTargetView(pColor->pRTV, ClearColor);
+
+	// The pre-pass has already cleared and filled it
+	if (!_depthPrepass)
+		_pImmediateContext->ClearDepthStencilView(pDepth->pDSV, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
 
 
 	XMMATRIX world = XMLoadFloat4x4(&_world);
 	XMMATRIX view = XMLoadFloat4x4(&_view);
 	XMMATRIX projection = XMLoadFloat4x4(&_projection);
-    
-	//--
-	//light direction
-	lightDirection = XMFLOAT3(0.0f, 1.0f, 0.0f);
-
-	//diffuse material properties
-	diffuseMaterial = XMFLOAT4(0.4f, 0.4f, 0.4f, 1.0f);
-
-	//diffuse light colour
-	diffuseLight = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
-
-	//ambient material
-	ambientMaterial = XMFLOAT4(0.6f, 0.6f, 0.6f, 1.0);
-
-	//ambient light
-	ambientLight = XMFLOAT4(0.2f, 0.2f, 0.2f, 1.0);
-	
-	//specular light
-	specularLight = XMFLOAT4(0.4f, 0.4f, 0.4f, 1.0f);
 
-	//specular material
-	specularMaterial = XMFLOAT4(0.9f, 0.9f, 0.9f, 1.0f);
-
-	//specular power
-	specularPower = FLOAT(5.0f);
-	//--
-
-	
-	
 	//
     // Update variables
     //
@@ -903,50 +2874,341 @@ void Application::Draw()
 	cb.mView = XMMatrixTranspose(view);
 	cb.mProjection = XMMatrixTranspose(projection);
 	//--
-	cb.DiffuseMtrl = diffuseMaterial;
 	cb.DiffuseLight = diffuseLight;
 	cb.LightVecW = lightDirection;
-
 	cb.AmbientLight = ambientLight;
-	cb.AmbientMaterial = ambientMaterial;
-
 	cb.SpecularLight = specularLight;
-	cb.SpecularMtrl = specularMaterial;
-	cb.SpecularPower = specularPower;
 	cb.EyePosW = XMFLOAT3(0.0f, 0.0f, -6.0f);
+	cb.Padding0 = 0.0f;
+	cb.Padding1 = 0.0f;
+	cb.LightmapParams = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
 	//--
 
 	//copies the constant buffer to shaders
 	_pImmediateContext->UpdateSubresource(_pConstantBuffer, 0, nullptr, &cb, 0, 0);
 
-	UINT stride = sizeof(SimpleVertex);
-	UINT offset = 0;
-	_pImmediateContext->IASetVertexBuffers(0, 1, &_pVertexBuffer, &stride, &offset);
-
-	_pImmediateContext->IASetIndexBuffer(_pIndexBuffer, DXGI_FORMAT_R16_UINT, 0);
+	UploadLights();
 
     //
-    // Renders a triangle
+    // Renders the scene
     //
 	_pImmediateContext->VSSetShader(_pVertexShader, nullptr, 0);
 	_pImmediateContext->VSSetConstantBuffers(0, 1, &_pConstantBuffer);
 	_pImmediateContext->PSSetConstantBuffers(0, 1, &_pConstantBuffer);
-	_pImmediateContext->PSSetShader(_pPixelShader, nullptr, 0);
-	_pImmediateContext->DrawIndexed(36, 0, 0);        
+	_pImmediateContext->PSSetConstantBuffers(1, 1, &_pClusterConstantBuffer);
+	_pImmediateContext->PSSetConstantBuffers(3, 1, &_pShadowConstantBuffer);
 
-	//--
-	_pImmediateContext->IASetVertexBuffers(0, 1, &_pVertexBufferTri, &stride, &offset);
+	ID3D11ShaderResourceView* lightViews[3] = { _pLightSRV, _pClusterSRV, _pLightIndexSRV };
+	_pImmediateContext->PSSetShaderResources(1, 3, lightViews);
+	_pImmediateContext->PSSetSamplers(0, 1, &_pSamplerLinear);
 
-	_pImmediateContext->IASetIndexBuffer(_pIndexBufferTri, DXGI_FORMAT_R16_UINT, 0);
+	D3D11RenderTarget* pShadowMap = static_cast<D3D11RenderTarget*>(context.GetPhysical(_rgShadowMap));
+	_pImmediateContext->PSSetShaderResources(5, 1, &pShadowMap->pSRV);
+	_pImmediateContext->PSSetSamplers(1, 1, &_pShadowSampler);
+	_pImmediateContext->PSSetShaderResources(7, 1, &_pLightmapSRV);
 
-	//object 2
-	world = XMLoadFloat4x4(&_world2);
-	cb.mWorld = XMMatrixTranspose(world);
-	_pImmediateContext->UpdateSubresource(_pConstantBuffer, 0, nullptr, &cb, 0, 0);
-	_pImmediateContext->DrawIndexed(18, 0, 0);
-    //
-    // Present our back buffer to our front buffer
-    //
-    _pSwapChain->Present(0, 0);
-	//--
+	Mat4 viewMatrix = Mat4::FromFloats(&_view._11);
+	Mat4 viewProjection = Multiply(viewMatrix, Mat4::FromFloats(&_projection._11));
+	Mat4 cameraWorld = Inverse(viewMatrix);
+	Vec3 eye(cameraWorld.m[3][0], cameraWorld.m[3][1], cameraWorld.m[3][2]);
+
+	// One bind for every mesh, lightmapped or not, draws only differ in their offsets
+	_geometryPool.Bind(_pImmediateContext);
+
+	// Only changed between draws when the material needs something else
+	D3D11_CULL_MODE cullMode = D3D11_CULL_BACK;
+	ID3D11DepthStencilState* pDepthState = nullptr;
+	_pImmediateContext->RSSetState(GetSceneRasterizer(cullMode));
+	_pImmediateContext->OMSetDepthStencilState(pDepthState, 0);
+
+	// Counts every pixel shader invocation from here to the end of the tentacles
+	UINT overdrawSlot = _overdrawFrame % OverdrawQueryCount;
+
+	if (_measureOverdraw)
+	{
+		ReadOverdrawQueries();
+		_pImmediateContext->Begin(_pOverdrawQueries[overdrawSlot]);
+	}
+
+	for (UINT i = 0; i < _visibleEntityCount; i++)
+	{
+		const VisibleEntity& visible = _pVisibleEntities[i];
+		const SceneEntity& entity = _scene.GetEntities()[visible.entity];
+		const SceneMeshBinding& mesh = _sceneMeshes[entity.mesh];
+		const Material& material = *_sceneMaterials[entity.material];
+		const Mat4& entityWorld = _scene.GetWorldMatrices()[visible.entity];
+		UINT lightmap = visible.lightmap;
+
+		cb.mWorld = visible.world;
+		cb.LightmapParams = XMFLOAT4(lightmap != UINT_MAX ? 1.0f : 0.0f, _lightmap.range, 0.0f, 0.0f);
+		_pImmediateContext->UpdateSubresource(_pConstantBuffer, 0, nullptr, &cb, 0, 0);
+
+		material.Bind(_pImmediateContext);
+
+		// Alpha tested pixels depend on the texture, the pre-pass leaves them to this pass
+		ID3D11DepthStencilState* pMaterialDepthState = _depthPrepass && !material.HasFeature(MATERIAL_ALPHATEST) ? _pPrepassTestState : nullptr;
+
+		if (material.GetCullMode() != cullMode)
+		{
+			cullMode = material.GetCullMode();
+			_pImmediateContext->RSSetState(GetSceneRasterizer(cullMode));
+		}
+
+		if (pMaterialDepthState != pDepthState)
+		{
+			pDepthState = pMaterialDepthState;
+			_pImmediateContext->OMSetDepthStencilState(pDepthState, 0);
+		}
+
+		_pImmediateContext->PSSetShader(_pPixelShaders[material.GetPermutation()], nullptr, 0);
+
+		// The baked copy has its own vertices and indices, so it is drawn whole without
+		// meshlet culling
+		if (lightmap != UINT_MAX)
+		{
+			const GeometryAllocation& geometry = _lightmapGeometry[lightmap];
+
+			_pImmediateContext->DrawIndexed(geometry.indexCount, _geometryPool.GetFirstIndex(geometry), _geometryPool.GetBaseVertex(geometry));
+			_drawCalls++;
+			continue;
+		}
+
+		UINT firstIndex = _geometryPool.GetFirstIndex(mesh.geometry);
+		INT baseVertex = _geometryPool.GetBaseVertex(mesh.geometry);
+
+		if (mesh.pMeshlets == nullptr)
+		{
+			_pImmediateContext->DrawIndexed(mesh.geometry.indexCount, firstIndex, baseVertex);
+			_drawCalls++;
+			continue;
+		}
+
+		// Only the meshlets that survive frustum culling get drawn, and the back face cone
+		// test only when the rasterizer drops back faces too
+		_meshletCuller.Cull(*mesh.pMeshlets, entityWorld, viewProjection, eye, &_jobSystem,
+							material.GetCullMode() == D3D11_CULL_BACK);
+
+		const std::vector<MeshletDraw>& draws = _meshletCuller.GetDraws();
+
+		for (size_t j = 0; j < draws.size(); j++)
+			_pImmediateContext->DrawIndexed(draws[j].indexCount, firstIndex + draws[j].firstIndex, baseVertex);
+
+		_drawCalls += (UINT)draws.size();
+	}
+
+	cb.LightmapParams = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+
+	// Not in the pre-pass, they test and write depth as before
+	_pImmediateContext->RSSetState(GetSceneRasterizer(_tentacleMaterial.GetCullMode()));
+	_pImmediateContext->OMSetDepthStencilState(nullptr, 0);
+
+	DrawTentacles(cb);
+
+	if (_measureOverdraw)
+	{
+		_pImmediateContext->End(_pOverdrawQueries[overdrawSlot]);
+		_overdrawPending[overdrawSlot].pixels = _renderWidth * _renderHeight;
+		_overdrawPending[overdrawSlot].prepass = _depthPrepass;
+		_overdrawFrame++;
+	}
+}
+
+void Application::ReadOverdrawQueries()
+{
+	// Only the query about to be reused, the others are younger. One that still isn't
+	// ready after OverdrawQueryCount frames is dropped rather than waited for.
+	OverdrawStats& pending = _overdrawPending[_overdrawFrame % OverdrawQueryCount];
+
+	if (pending.pixels == 0)
+		return;
+
+	D3D11_QUERY_DATA_PIPELINE_STATISTICS statistics;
+
+	if (_pImmediateContext->GetData(_pOverdrawQueries[_overdrawFrame % OverdrawQueryCount], &statistics, sizeof(statistics),
+									D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK)
+	{
+		_overdrawStats = pending;
+		_overdrawStats.shaded = statistics.PSInvocations;
+		_overdrawStats.perPixel = (float)((double)statistics.PSInvocations / pending.pixels);
+	}
+
+	pending.pixels = 0;
+}
+
+void Application::DrawTentacles(ConstantBuffer& cb)
+{
+	UINT vertexCount = (UINT)_tentacleVertices.size();
+	UINT indexCount = (UINT)_tentacleIndices.size();
+	UINT boneCount = _tentacleSkeleton.GetBoneCount();
+	UINT offset = 0;
+
+	// Not in the pool, they read the same zero lightmap UV for every vertex
+	UINT uvStride = 0;
+	_pImmediateContext->IASetVertexBuffers(1, 1, &_pDefaultLightmapUVs, &uvStride, &offset);
+
+	if (_cpuSkinning)
+	{
+		// All of them skinned straight into mapped memory, then drawn with the normal
+		// vertex shader
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		if (FAILED(_pImmediateContext->Map(_pTentacleVertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+			return;
+
+		SkinnedVertexOutput* pOutput = static_cast<SkinnedVertexOutput*>(mapped.pData);
+
+		for (UINT i = 0; i < TentacleCount; i++)
+			SkinVertices(_tentacleVertices.data(), vertexCount, _animation.GetSkinMatrices(i), pOutput + i * vertexCount, &_jobSystem);
+
+		_pImmediateContext->Unmap(_pTentacleVertexBuffer, 0);
+
+		UINT stride = sizeof(SimpleVertex);
+		_pImmediateContext->IASetVertexBuffers(0, 1, &_pTentacleVertexBuffer, &stride, &offset);
+	}
+	else
+	{
+		UINT stride = sizeof(SkinnedVertex);
+		_pImmediateContext->IASetVertexBuffers(0, 1, &_pTentacleVertexBuffer, &stride, &offset);
+		_pImmediateContext->IASetInputLayout(_pSkinnedLayout);
+		_pImmediateContext->VSSetShader(_pSkinnedVS, nullptr, 0);
+		_pImmediateContext->VSSetConstantBuffers(4, 1, &_pSkinConstantBuffer);
+	}
+
+	_pImmediateContext->IASetIndexBuffer(_pTentacleIndexBuffer, DXGI_FORMAT_R16_UINT, 0);
+
+	_tentacleMaterial.Bind(_pImmediateContext);
+	_pImmediateContext->PSSetShader(_pPixelShaders[_tentacleMaterial.GetPermutation()], nullptr, 0);
+
+	// A ring around the middle of the floor
+	for (UINT i = 0; i < TentacleCount; i++)
+	{
+		float angle = XM_2PI * i / TentacleCount;
+		XMMATRIX world = XMMatrixRotationY(-angle) * XMMatrixTranslation(5.0f * cosf(angle), -2.0f, 5.0f * sinf(angle));
+		cb.mWorld = XMMatrixTranspose(world);
+		_pImmediateContext->UpdateSubresource(_pConstantBuffer, 0, nullptr, &cb, 0, 0);
+
+		if (_cpuSkinning)
+		{
+			_pImmediateContext->DrawIndexed(indexCount, 0, i * vertexCount);
+			_drawCalls++;
+			continue;
+		}
+
+		SkinConstants skin;
+		memcpy(skin.Bones, _animation.GetSkinMatrices(i), sizeof(SkinMatrix) * boneCount);
+		_pImmediateContext->UpdateSubresource(_pSkinConstantBuffer, 0, nullptr, &skin, 0, 0);
+
+		_pImmediateContext->DrawIndexed(indexCount, 0, 0);
+		_drawCalls++;
+	}
+
+	_pImmediateContext->IASetInputLayout(_pVertexLayout);
+	_pImmediateContext->VSSetShader(_pVertexShader, nullptr, 0);
+}
+
+void Application::DrawParticles(const RenderGraphPassContext& context)
+{
+	UINT dustCount = _dust.GetCount();
+	UINT sparkCount = _sparks.GetCount();
+
+	if (dustCount + sparkCount == 0)
+		return;
+
+	D3D11RenderTarget* pColor = static_cast<D3D11RenderTarget*>(context.GetPhysical(_rgSceneColor));
+	D3D11RenderTarget* pDepth = static_cast<D3D11RenderTarget*>(context.GetPhysical(_rgSceneDepth));
+
+	// Depth is only tested, the barrier unbound it from the main pass
+	_pImmediateContext->OMSetRenderTargets(1, &pColor->pRTV, pDepth->pDSV);
+
+	// Both emitters go into one buffer, the job system fills it straight into mapped memory
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(_pImmediateContext->Map(_pParticleInstanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+		return;
+
+	ParticleInstance* pInstances = static_cast<ParticleInstance*>(mapped.pData);
+	_dust.WriteInstances(pInstances, &_jobSystem);
+	_sparks.WriteInstances(pInstances + dustCount, &_jobSystem);
+
+	_pImmediateContext->Unmap(_pParticleInstanceBuffer, 0);
+
+	UINT stride = sizeof(ParticleInstance);
+	UINT offset = 0;
+	_pImmediateContext->IASetVertexBuffers(0, 1, &_pParticleInstanceBuffer, &stride, &offset);
+	_pImmediateContext->IASetInputLayout(_pParticleLayout);
+	_pImmediateContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+
+	// View and projection are still in b0 from the main pass
+	_pImmediateContext->VSSetShader(_pParticleVS, nullptr, 0);
+	_pImmediateContext->PSSetShader(_pParticlePS, nullptr, 0);
+
+	float blendFactor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	_pImmediateContext->OMSetBlendState(_pParticleBlendState, blendFactor, 0xffffffff);
+	_pImmediateContext->OMSetDepthStencilState(_pParticleDepthState, 0);
+
+	// One quad of 4 strip vertices per instance
+	_pImmediateContext->DrawInstanced(4, dustCount, 0, 0);
+	_pImmediateContext->DrawInstanced(4, sparkCount, 0, dustCount);
+	_drawCalls += 2;
+
+	// Back to what the scene passes expect
+	_pImmediateContext->OMSetBlendState(nullptr, blendFactor, 0xffffffff);
+	_pImmediateContext->OMSetDepthStencilState(nullptr, 0);
+	_pImmediateContext->IASetInputLayout(_pVertexLayout);
+	_pImmediateContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+}
+
+void Application::DrawDebugOverlay(const RenderGraphPassContext& context)
+{
+	D3D11RenderTarget* pColor = static_cast<D3D11RenderTarget*>(context.GetPhysical(_rgBackBuffer));
+
+	// On top of everything, no depth
+	_pImmediateContext->OMSetRenderTargets(1, &pColor->pRTV, nullptr);
+
+	_debugRenderer.Render(_pImmediateContext, _debugDraw, Multiply(Mat4::FromFloats(&_view._11), Mat4::FromFloats(&_projection._11)),
+						  (float)_WindowWidth, (float)_WindowHeight);
+
+	// Back to what the scene passes expect
+	float blendFactor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	_pImmediateContext->OMSetBlendState(nullptr, blendFactor, 0xffffffff);
+	_pImmediateContext->IASetInputLayout(_pVertexLayout);
+	_pImmediateContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+}
+
+void Application::DrawUpscale(const RenderGraphPassContext& context)
+{
+	D3D11RenderTarget* pSource = static_cast<D3D11RenderTarget*>(context.GetPhysical(_rgSceneColor));
+	D3D11RenderTarget* pColor = static_cast<D3D11RenderTarget*>(context.GetPhysical(_rgBackBuffer));
+
+	_pImmediateContext->OMSetRenderTargets(1, &pColor->pRTV, nullptr);
+
+	D3D11_VIEWPORT vp;
+	vp.Width = (FLOAT)_WindowWidth;
+	vp.Height = (FLOAT)_WindowHeight;
+	vp.MinDepth = 0.0f;
+	vp.MaxDepth = 1.0f;
+	vp.TopLeftX = 0;
+	vp.TopLeftY = 0;
+	_pImmediateContext->RSSetViewports(1, &vp);
+
+	D3D11_TEXTURE2D_DESC sourceDesc;
+	pSource->pTexture->GetDesc(&sourceDesc);
+
+	UpscaleConstants constants;
+	constants.UVScale = XMFLOAT2((float)_renderWidth / sourceDesc.Width, (float)_renderHeight / sourceDesc.Height);
+	constants.UVClamp = XMFLOAT2((_renderWidth - 0.5f) / sourceDesc.Width, (_renderHeight - 0.5f) / sourceDesc.Height);
+	_pImmediateContext->UpdateSubresource(_pUpscaleConstantBuffer, 0, nullptr, &constants, 0, 0);
+
+	// One triangle from SV_VertexID, nothing to fetch
+	_pImmediateContext->IASetInputLayout(nullptr);
+	_pImmediateContext->VSSetShader(_pUpscaleVS, nullptr, 0);
+	_pImmediateContext->VSSetConstantBuffers(6, 1, &_pUpscaleConstantBuffer);
+	_pImmediateContext->PSSetShader(_pUpscalePS, nullptr, 0);
+	_pImmediateContext->PSSetConstantBuffers(6, 1, &_pUpscaleConstantBuffer);
+	_pImmediateContext->PSSetShaderResources(8, 1, &pSource->pSRV);
+	_pImmediateContext->PSSetSamplers(3, 1, &_pSamplerClamp);
+
+	_pImmediateContext->Draw(3, 0);
+	_drawCalls++;
+
+	// Back to what the scene passes expect
+	_pImmediateContext->IASetInputLayout(_pVertexLayout);
 }
@@ -8,6 +8,27 @@
 #include <directxcolors.h>
 #include "resource.h"
 #include "DDSTextureLoader.h"
+#include "allocators.h"
+#include "animation.h"
+#include "builtinmeshes.h"
+#include "collision.h"
+#include "debugdrawd3d11.h"
+#include "dynamicresolution.h"
+#include "geometrypool.h"
+#include "gpuresourcesd3d11.h"
+#include "jobsystem.h"
+#include "lightmapper.h"
+#include "meshlet.h"
+#include "clusteredlighting.h"
+#include "material.h"
+#include "particles.h"
+#include "rendergraph.h"
+#include "rendergraphd3d11.h"
+#include "scene.h"
+#include "shadowcascades.h"
+#include "taskgraph.h"
+#include <cstdio>
+#include <vector>
 
 
 using namespace DirectX;
@@ -24,15 +45,28 @@ struct ConstantBuffer
 	XMMATRIX mWorld;
 	XMMATRIX mView;
 	XMMATRIX mProjection;
-	XMFLOAT4 DiffuseMtrl;
 	XMFLOAT4 DiffuseLight;
-	XMFLOAT4 AmbientMaterial;
 	XMFLOAT4 AmbientLight;
-	XMFLOAT4 SpecularMtrl;
 	XMFLOAT4 SpecularLight;
-	FLOAT SpecularPower;
 	XMFLOAT3 EyePosW;
+	FLOAT Padding0;
 	XMFLOAT3 LightVecW;
+	FLOAT Padding1;
+	XMFLOAT4 LightmapParams;  // x 1 when the entity has a lightmap, y the encoded range
+};
+
+struct SkinConstants
+{
+	SkinMatrix Bones[MaxSkinBones];
+};
+
+struct ShadowConstants
+{
+	XMFLOAT4X4 CascadeViewProj[MaxShadowCascades];
+	XMFLOAT4 CascadeSplits;
+	FLOAT ShadowTexelSize;
+	UINT CascadeCount;
+	XMFLOAT2 Padding;
 };
 
 class Application
@@ -44,31 +78,33 @@ private:
 	D3D_FEATURE_LEVEL       _featureLevel;
 	ID3D11Device*           _pd3dDevice;
 	ID3D11DeviceContext*    _pImmediateContext;
+
+	// Every device object is created through _device so the tracker knows about it.
+	// Budgets only alert, the leak report is written at shutdown.
+	GpuResourceTracker      _gpuResources;
+	D3D11TrackedDevice      _device;
+
 	IDXGISwapChain*         _pSwapChain;
 	ID3D11RenderTargetView* _pRenderTargetView;
 	ID3D11VertexShader*     _pVertexShader;
-	ID3D11PixelShader*      _pPixelShader;
+	ID3D11PixelShader*      _pPixelShaders[MaterialPermutationCount];
 	ID3D11InputLayout*      _pVertexLayout;
-	ID3D11Buffer*           _pVertexBuffer;
-	ID3D11Buffer*           _pIndexBuffer;
 
-	ID3D11Buffer*           _pVertexBufferTri;
-	ID3D11Buffer*           _pIndexBufferTri;
+	// Static meshes share a few large buffers and draw with a base vertex, so nothing is
+	// rebound between them. Stream 1 holds the lightmap UVs, zero for unbaked meshes.
+	GeometryPool            _geometryPool;
+	GeometryAllocation      _cubeGeometry;
+	GeometryAllocation      _floorGeometry;
 
 	ID3D11Buffer*           _pConstantBuffer;
 	XMFLOAT4X4              _world;
-	XMFLOAT4X4              _world2;
 	XMFLOAT4X4              _view;
 	XMFLOAT4X4              _projection;
 
 	XMFLOAT3 lightDirection;
-	XMFLOAT4 diffuseMaterial;
 	XMFLOAT4 diffuseLight;
-	XMFLOAT4 ambientMaterial;
 	XMFLOAT4 ambientLight;
 	XMFLOAT4 specularLight;
-	XMFLOAT4 specularMaterial;
-	FLOAT specularPower;
 
 	XMVECTOR Eye;
 	float eyex;
@@ -93,29 +129,300 @@ private:
 	int keyState;
 	bool shiftCamera;
 
-	/*ID3D11Texture2D* texture;*/
-	ID3D11ShaderResourceView * _pTextureRV = nullptr;
 	ID3D11SamplerState * _pSamplerLinear = nullptr;
 
+	// Scene loaded from scene.bin, or compiled from scene.txt when there's no binary yet.
+	// Entities index these by the scene's mesh, material and texture indices.
+	struct SceneMeshBinding
+	{
+		GeometryAllocation geometry;
+		const MeshletMesh* pMeshlets;  // culled per meshlet when set
+	};
+
+	Scene                                  _scene;
+	UINT                                   _playerEntity;
+	std::vector<SceneMeshBinding>          _sceneMeshes;
+	PoolAllocator<Material>                _materialPool;
+	std::vector<Material*>                 _sceneMaterials;  // one per scene material, from _materialPool
+	std::vector<ID3D11ShaderResourceView*> _sceneTextures;
+	FILETIME                               _scenePatchTime;
+
+	HRESULT LoadScene();
+	HRESULT BindSceneMeshes();
+	HRESULT CreateSceneMaterial(UINT index);
+	void PollScenePatch();
+
+
+	// Startup task graph. File loading and shader compilation run on the workers while the
+	// main thread creates the device, the GPU objects are created from their results.
+	struct ShaderCompileJob
+	{
+		Application* pApp;
+		UINT         permutation;
+		char         name[24];
+	};
+
+	TaskGraph                         _startupGraph;
+	ShaderCompileJob                  _shaderCompileJobs[MaterialPermutationCount];
+	ID3DBlob*                         _pVSBlob;
+	ID3DBlob*                         _pPSBlobs[MaterialPermutationCount];
+	std::vector<std::vector<uint8_t>> _textureData;  // one file per scene texture
+	LARGE_INTEGER                     _startupBegin;
+	bool                              _startupReported;
 
 private:
 	HRESULT InitWindow(HINSTANCE hInstance, int nCmdShow);
+	HRESULT RunStartup(bool serial);
+	void ReportStartup();
 	HRESULT InitDevice();
 	void Cleanup();
-	HRESULT CompileShaderFromFile(WCHAR* szFileName, LPCSTR szEntryPoint, LPCSTR szShaderModel, ID3DBlob** ppBlobOut);
+	void ReportGpuLeaks();
+	static void OnGpuBudgetExceeded(GpuResourceCategory category, uint64_t liveBytes, uint64_t budget, void* pData);
+	HRESULT CompileShaderFromFile(WCHAR* szFileName, LPCSTR szEntryPoint, LPCSTR szShaderModel, ID3DBlob** ppBlobOut, const D3D_SHADER_MACRO* pDefines = nullptr);
+	HRESULT CompileVertexShader();
+	HRESULT CompilePixelShader(UINT permutation);
+	HRESULT LoadTextureData();
 	HRESULT InitShadersAndInputLayout();
-	HRESULT InitVertexBuffer();
-	HRESULT InitIndexBuffer();
+	HRESULT InitMaterials();
+	HRESULT InitMeshes();
+	HRESULT InitStates();
+	HRESULT BindPipeline();
+	HRESULT FlushGeometry();
+
+	template<HRESULT (Application::*Method)()>
+	static HRESULT StartupTask(void* pData)
+	{
+		return (static_cast<Application*>(pData)->*Method)();
+	}
+
+	static HRESULT StartupCompilePixelShader(void* pData);
 
 	//--
-	HRESULT InitVertexBufferTri();
-	HRESULT InitIndexBufferTri();
+	HRESULT InitLightBuffers();
+	void InitLights();
+	void UpdateLights(float t);
+	void UploadLights();
 
-	ID3D11DepthStencilView* _depthStencilView;
-	ID3D11Texture2D* _depthStencilBuffer;
 	//--
 
-	ID3D11RasterizerState* _wireFrame;
+	// Frame render graph, the back buffer is imported, scene colour and depth are transients
+	RenderGraph               _renderGraph;
+	D3D11RenderGraphBackend   _renderGraphBackend;
+	TrackedRenderGraphBackend _trackedGraphBackend;  // in front of _renderGraphBackend
+	D3D11RenderTarget         _backBufferTarget;
+	RenderGraphResource       _rgBackBuffer;
+	RenderGraphResource       _rgSceneDepth;
+
+	static void ExecuteShadowPass(const RenderGraphPassContext& context, void* pData);
+	static void ExecuteMainPass(const RenderGraphPassContext& context, void* pData);
+	void DrawShadows(const RenderGraphPassContext& context);
+	void DrawShadowCasters(const ShadowCascade& cascade, bool dynamicCasters);
+	void DrawScene(const RenderGraphPassContext& context);
+
+	// One per material cull mode, indexed by D3D11_CULL_MODE - D3D11_CULL_NONE
+	ID3D11RasterizerState* _pSceneRasterizers[3];
+
+	ID3D11RasterizerState* GetSceneRasterizer(D3D11_CULL_MODE cullMode) const { return _pSceneRasterizers[cullMode - D3D11_CULL_NONE]; }
+
+	// Clustered point/spot lights
+	JobSystem                 _jobSystem;
+	ClusteredLighting         _clusteredLighting;
+	ID3D11Buffer*             _pLightBuffer;
+	ID3D11Buffer*             _pClusterBuffer;
+	ID3D11Buffer*             _pLightIndexBuffer;
+	ID3D11Buffer*             _pClusterConstantBuffer;
+	ID3D11ShaderResourceView* _pLightSRV;
+	ID3D11ShaderResourceView* _pClusterSRV;
+	ID3D11ShaderResourceView* _pLightIndexSRV;
+
+	// Cube split into meshlets, culled on the CPU every frame
+	MeshletMesh               _cubeMeshlets;
+	MeshletCuller             _meshletCuller;
+
+	// Directional light shadows. Static casters of the far cascades live in the cache
+	// array and are copied into the final array before the dynamic casters go on top.
+	CascadedShadowMaps        _shadowMaps;
+	ID3D11Texture2D*          _pShadowMap;
+	ID3D11Texture2D*          _pShadowCache;
+	ID3D11DepthStencilView*   _pShadowMapDSV[MaxShadowCascades];
+	ID3D11DepthStencilView*   _pShadowCacheDSV[MaxShadowCascades];
+	ID3D11ShaderResourceView* _pShadowMapSRV;
+	ID3D11SamplerState*       _pShadowSampler;
+	ID3D11RasterizerState*    _pShadowRasterizer;
+	ID3D11Buffer*             _pShadowConstantBuffer;
+	D3D11RenderTarget         _shadowMapTarget;
+	RenderGraphResource       _rgShadowMap;
+
+	HRESULT InitShadowMaps();
+	void UploadShadowConstants();
+
+	// Scene collision. Entities are added once, the player cube is swept and moved every
+	// frame and the cameras slide along whatever they run into.
+	std::vector<CollisionMesh> _collisionMeshes;  // one per scene mesh
+	CollisionWorld             _collision;
+	std::vector<uint32_t>      _entityBodies;     // one per scene entity
+	uint32_t                   _playerBody;
+	Vec3                       _playerPosition;
+
+	HRESULT InitCollision();
+	void AddCollisionBodies();
+
+	// Particles. Both emitters share one dynamic instance buffer that is refilled every
+	// frame; dust is sorted and blended, sparks are additive so their order doesn't matter.
+	static const UINT DustCapacity = 200000;
+	static const UINT SparkCapacity = 100000;
+
+	ParticleSystem            _dust;
+	ParticleSystem            _sparks;
+	ID3DBlob*                 _pParticleVSBlob;
+	ID3DBlob*                 _pParticlePSBlob;
+	ID3D11VertexShader*       _pParticleVS;
+	ID3D11PixelShader*        _pParticlePS;
+	ID3D11InputLayout*        _pParticleLayout;
+	ID3D11Buffer*             _pParticleInstanceBuffer;
+	ID3D11BlendState*         _pParticleBlendState;
+	ID3D11DepthStencilState*  _pParticleDepthState;
+	float                     _particleTime;
+
+	HRESULT CompileParticleShaders();
+	HRESULT InitParticles();
+	void UpdateParticles(float t);
+	static void ExecuteParticlePass(const RenderGraphPassContext& context, void* pData);
+	void DrawParticles(const RenderGraphPassContext& context);
+
+	// Skinned tentacles around the floor, each blending two compressed clips. They are
+	// skinned in the vertex shader, or with -cpuskinning on the workers into a dynamic
+	// buffer that the normal vertex shader draws.
+	static const UINT TentacleCount = 8;
+
+	Skeleton                   _tentacleSkeleton;
+	CompressedClip             _tentacleClips[2];
+	AnimationSystem            _animation;
+	std::vector<SkinnedVertex> _tentacleVertices;
+	std::vector<WORD>          _tentacleIndices;
+	ID3DBlob*                  _pSkinnedVSBlob;
+	ID3D11VertexShader*        _pSkinnedVS;
+	ID3D11InputLayout*         _pSkinnedLayout;
+	ID3D11Buffer*              _pTentacleVertexBuffer;  // SkinnedVertex, or every tentacle's skinned output
+	ID3D11Buffer*              _pTentacleIndexBuffer;
+	ID3D11Buffer*              _pSkinConstantBuffer;
+	Material                   _tentacleMaterial;
+	bool                       _cpuSkinning;
+
+	HRESULT CompileSkinnedShader();
+	HRESULT BuildTentacles();
+	HRESULT InitTentacles();
+	void UpdateAnimation(float t);
+	void DrawTentacles(ConstantBuffer& cb);
+
+	// Debug overlay, F1 or -overlay. While it is off nothing is formatted, uploaded or
+	// drawn and the frame graph has no pass for it.
+	DebugDraw              _debugDraw;
+	D3D11DebugDrawRenderer _debugRenderer;
+	ID3DBlob*              _pDebugVSBlob;
+	ID3DBlob*              _pDebugPSBlob;
+	DebugGraphHistory      _frameTimes;      // ms between frames
+	DebugGraphHistory      _updateTimes;     // ms spent in Update()
+	LARGE_INTEGER          _lastFrameTime;
+	UINT                   _drawCalls;       // counted during Draw()
+	UINT                   _lastDrawCalls;
+	bool                   _overlayKeyDown;
+
+	HRESULT CompileDebugShaders();
+	HRESULT InitDebugDraw();
+	void UpdateOverlay(float updateMs);
+	static void ExecuteDebugPass(const RenderGraphPassContext& context, void* pData);
+	void DrawDebugOverlay(const RenderGraphPassContext& context);
+
+	// Baked ambient from tools/lightbaker, optional. Lightmapped entities draw their own
+	// copy of the mesh from the geometry pool, with the vertices split along the charts
+	// and the UVs in the second stream. Everything else keeps the constant ambient term.
+	// The skinned tentacles have their own buffers and read a single zero UV at stride 0.
+	Lightmap                        _lightmap;
+	std::vector<uint8_t>            _lightmapTextureData;
+	ID3D11ShaderResourceView*       _pLightmapSRV;
+	std::vector<GeometryAllocation> _lightmapGeometry;  // one per entity in _lightmap, no vertexBlock if it didn't match
+	std::vector<UINT>               _entityLightmaps;   // _lightmapGeometry index per scene entity, or UINT_MAX
+	ID3D11Buffer*                   _pDefaultLightmapUVs;
+
+	HRESULT LoadLightmaps();
+	HRESULT InitLightmaps();
+	void BindEntityLightmaps();
+
+	// Dynamic resolution. The scene passes draw into a target sized for the largest scale
+	// with the viewport at the current render size, and the upscale pass stretches that
+	// onto the back buffer, so the scale can change every frame without reallocating.
+	// -fixedres holds it at full size, -dynrestrace writes the frame times to
+	// dynrestrace.txt for tools/resolutionbench.
+	struct UpscaleConstants
+	{
+		XMFLOAT2 UVScale;
+		XMFLOAT2 UVClamp;
+	};
+
+	DynamicResolutionController _dynamicResolution;
+	UINT                        _renderWidth;
+	UINT                        _renderHeight;
+	RenderGraphResource         _rgSceneColor;
+	ID3DBlob*                   _pUpscaleVSBlob;
+	ID3DBlob*                   _pUpscalePSBlob;
+	ID3D11VertexShader*         _pUpscaleVS;
+	ID3D11PixelShader*          _pUpscalePS;
+	ID3D11Buffer*               _pUpscaleConstantBuffer;
+	ID3D11SamplerState*         _pSamplerClamp;
+	FILE*                       _pResolutionTrace;
+
+	HRESULT CompileUpscaleShaders();
+	HRESULT InitUpscale();
+	void UpdateResolution(float frameMs);
+	static void ExecuteUpscalePass(const RenderGraphPassContext& context, void* pData);
+	void DrawUpscale(const RenderGraphPassContext& context);
+
+	// Depth pre-pass, -prepass or F2. Opaque scene meshes go down depth only first, then
+	// the main pass tests LESS_EQUAL without writing so each pixel is shaded once. Alpha
+	// tested materials and the tentacles are only drawn by the main pass. -overdraw counts
+	// the main pass's pixel shader invocations with pipeline statistics queries, read a
+	// few frames late so the CPU never waits on them.
+	static const UINT OverdrawQueryCount = 3;
+
+	struct OverdrawStats
+	{
+		UINT64 shaded;     // pixel shader invocations in the main pass
+		UINT   pixels;     // at the render size of that frame
+		float  perPixel;
+		bool   prepass;    // whether that frame had the pre-pass
+	};
+
+	bool                     _depthPrepass;
+	bool                     _prepassKeyDown;
+	ID3D11DepthStencilState* _pPrepassTestState;
+	bool                     _measureOverdraw;
+	ID3D11Query*             _pOverdrawQueries[OverdrawQueryCount];
+	OverdrawStats            _overdrawPending[OverdrawQueryCount];  // pixels is 0 while nothing is in flight
+	UINT                     _overdrawFrame;
+	OverdrawStats            _overdrawStats;
+
+	HRESULT InitDepthPrepass();
+	static void ExecuteDepthPrepass(const RenderGraphPassContext& context, void* pData);
+	void DrawDepthPrepass(const RenderGraphPassContext& context);
+	void ReadOverdrawQueries();
+
+	// Transient per-frame memory, reset at the top of Update()
+	FrameArena _frameArena;
+	size_t _heapCallsLastFrame;
+
+	// Entities the pre-pass and the main pass draw this frame, with their constants ready
+	struct VisibleEntity
+	{
+		XMMATRIX world;     // transposed for the constant buffer
+		UINT     entity;
+		UINT     lightmap;  // _lightmapGeometry index, or UINT_MAX
+	};
+
+	VisibleEntity* _pVisibleEntities;  // in _frameArena
+	UINT           _visibleEntityCount;
+
+	void GatherVisibleEntities();
 
 	UINT _WindowHeight;
 	UINT _WindowWidth;
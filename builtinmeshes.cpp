@@ -0,0 +1,97 @@
+#include "builtinmeshes.h"
+
+#include <cstring>
+
+static const MeshVertex CubeVertices[24] =
+{
+	// Front Face
+	{ Vec3(-1.0f, 1.0f, -1.0f), Vec3(-2.0f, 2.0f, -2.0f), { 0.0f, 0.0f } }, //0
+	{ Vec3(1.0f, 1.0f, -1.0f), Vec3(2.0f, 2.0f, -2.0f), { 1.0f, 0.0f } }, //1
+	{ Vec3(-1.0f, -1.0f, -1.0f), Vec3(-2.0f, -2.0f, -2.0f), { 0.0f, 1.0f } }, //2
+	{ Vec3(1.0f, -1.0f, -1.0f), Vec3(2.0f, -2.0f, -2.0f), { 1.0f, 1.0f } }, //3
+
+	// Right Face
+	{ Vec3(1.0f, 1.0f, -1.0f), Vec3(2.0f, 2.0f, -2.0f), { 0.0f, 0.0f } }, //4
+	{ Vec3(1.0f, 1.0f, 1.0f), Vec3(2.0f, 2.0f, 2.0f), { 1.0f, 0.0f } }, //5
+	{ Vec3(1.0f, -1.0f, -1.0f), Vec3(2.0f, -2.0f, -2.0f), { 0.0f, 1.0f } }, //6
+	{ Vec3(1.0f, -1.0f, 1.0f), Vec3(2.0f, -2.0f, 2.0f), { 1.0f, 1.0f } }, //7
+
+	// Back Face
+	{ Vec3(1.0f, 1.0f, 1.0f), Vec3(2.0f, 2.0f, 2.0f), { 0.0f, 0.0f } }, //8
+	{ Vec3(-1.0f, 1.0f, 1.0f), Vec3(2.0f, 2.0f, 2.0f), { 1.0f, 0.0f } }, //9
+	{ Vec3(1.0f, -1.0f, 1.0f), Vec3(2.0f, -2.0f, 2.0f), { 0.0f, 1.0f } }, //10
+	{ Vec3(-1.0f, -1.0f, 1.0f), Vec3(-2.0f, -2.0f, -2.0f), { 1.0f, 1.0f } }, //11
+
+	// Left Face
+	{ Vec3(-1.0f, 1.0f, 1.0f), Vec3(2.0f, 2.0f, 2.0f), { 0.0f, 0.0f } }, //12
+	{ Vec3(-1.0f, 1.0f, -1.0f), Vec3(-2.0f, 2.0f, -2.0f), { 1.0f, 0.0f } }, //13
+	{ Vec3(-1.0f, -1.0f, 1.0f), Vec3(-2.0f, -2.0f, -2.0f), { 0.0f, 1.0f } }, //14
+	{ Vec3(-1.0f, -1.0f, -1.0f), Vec3(-2.0f, -2.0f, -2.0f), { 1.0f, 1.0f } }, //15
+
+	// Top Face
+	{ Vec3(-1.0f, 1.0f, 1.0f), Vec3(2.0f, 2.0f, 2.0f), { 0.0f, 0.0f } }, //16
+	{ Vec3(1.0f, 1.0f, 1.0f), Vec3(2.0f, 2.0f, 2.0f), { 1.0f, 0.0f } }, //17
+	{ Vec3(-1.0f, 1.0f, -1.0f), Vec3(-2.0f, 2.0f, -2.0f), { 0.0f, 1.0f } }, //18
+	{ Vec3(1.0f, 1.0f, -1.0f), Vec3(2.0f, 2.0f, -2.0f), { 1.0f, 1.0f } }, //19
+
+	// Bottom Face
+	{ Vec3(-1.0f, -1.0f, 1.0f), Vec3(-2.0f, -2.0f, -2.0f), { 0.0f, 0.0f } }, //20
+	{ Vec3(1.0f, -1.0f, -1.0f), Vec3(2.0f, -2.0f, -2.0f), { 1.0f, 0.0f } }, //21
+	{ Vec3(-1.0f, -1.0f, -1.0f), Vec3(-2.0f, -2.0f, -2.0f), { 0.0f, 1.0f } }, //22
+	{ Vec3(1.0f, -1.0f, 1.0f), Vec3(2.0f, -2.0f, 2.0f), { 1.0f, 1.0f } }, //23
+};
+
+// Clockwise front faces, the order the meshlet builder expects
+static const uint32_t CubeIndices[36] =
+{
+	//front
+	0, 1, 2,
+	2, 1, 3,
+	// right
+	4, 5, 6,
+	6, 5, 7,
+	//back
+	8, 9, 10,
+	10, 9, 11,
+	//left
+	12, 13, 14,
+	14, 13, 15,
+	//top
+	16, 17, 18,
+	18, 17, 19,
+	//bottom
+	20, 22, 21,
+	20, 21, 23,
+};
+
+static const MeshVertex FloorVertices[4] =
+{
+	// Top Face
+	{ Vec3(-2.0f, -2.0f, -2.0f), Vec3(0.0f, 1.0f, 0.0f), { 0.0f, 0.0f } }, //0
+	{ Vec3(2.0f, -2.0f, -2.0f), Vec3(0.0f, 1.0f, 0.0f), { 10.0f, 0.0f } }, //1
+	{ Vec3(-2.0f, -2.0f, 2.0f), Vec3(0.0f, 1.0f, 0.0f), { 0.0f, 10.0f } }, //2
+	{ Vec3(2.0f, -2.0f, 2.0f), Vec3(0.0f, 1.0f, 0.0f), { 10.0f, 10.0f } }, //3
+};
+
+// Clockwise seen from above like the cube's faces, it used to face down and only showed
+// because nothing was culled
+static const uint32_t FloorIndices[6] =
+{
+	//floor
+	0, 2, 1,
+	1, 2, 3,
+};
+
+const BuiltinMesh BuiltinCube = { "cube", CubeVertices, 24, CubeIndices, 36 };
+const BuiltinMesh BuiltinFloor = { "floor", FloorVertices, 4, FloorIndices, 6 };
+
+const BuiltinMesh* FindBuiltinMesh(const char* name)
+{
+	if (strcmp(name, BuiltinCube.name) == 0)
+		return &BuiltinCube;
+
+	if (strcmp(name, BuiltinFloor.name) == 0)
+		return &BuiltinFloor;
+
+	return nullptr;
+}
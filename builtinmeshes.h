@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include "cpumath.h"
+
+// Same layout as the renderer's SimpleVertex
+struct MeshVertex
+{
+	Vec3  position;
+	Vec3  normal;
+	float texCoord[2];
+};
+
+// Geometry that scenes refer to by name. Kept free of D3D so the tools can use it too.
+struct BuiltinMesh
+{
+	const char*       name;
+	const MeshVertex* pVertices;
+	uint32_t          vertexCount;
+	const uint32_t*   pIndices;     // clockwise front faces
+	uint32_t          indexCount;
+};
+
+extern const BuiltinMesh BuiltinCube;
+extern const BuiltinMesh BuiltinFloor;
+
+// nullptr for names that aren't built in
+const BuiltinMesh* FindBuiltinMesh(const char* name);
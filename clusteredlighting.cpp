@@ -0,0 +1,366 @@
+#include "clusteredlighting.h"
+
+#include <chrono>
+#include <xmmintrin.h>
+#include "allocators.h"
+#include "jobsystem.h"
+
+ClusteredLighting::ClusteredLighting()
+{
+	_near = 0.01f;
+	_far = 100.0f;
+	_screenWidth = 1.0f;
+	_screenHeight = 1.0f;
+	_lightIndexCount = 0;
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+void ClusteredLighting::Init(const ClusterConfig& config)
+{
+	_config = config;
+
+	uint32_t clusterCount = GetClusterCount();
+
+	_minX.resize(clusterCount);
+	_minY.resize(clusterCount);
+	_minZ.resize(clusterCount);
+	_maxX.resize(clusterCount);
+	_maxY.resize(clusterCount);
+	_maxZ.resize(clusterCount);
+	_sliceNear.resize(config.slices);
+	_sliceFar.resize(config.slices);
+
+	_clusters.resize(clusterCount);
+	_lightIndices.resize(config.maxLightIndices);
+	_sliceCounts.resize(config.slices);
+	_sliceOverflow.resize(config.slices);
+	_lightIndexCount = 0;
+}
+
+void ClusteredLighting::SetProjection(float fovY, float screenWidth, float screenHeight, float nearZ, float farZ)
+{
+	_near = nearZ;
+	_far = farZ;
+	_screenWidth = screenWidth;
+	_screenHeight = screenHeight;
+
+	float tanHalfFovY = tanf(fovY * 0.5f);
+	float tanHalfFovX = tanHalfFovY * (screenWidth / screenHeight);
+
+	BuildClusterBounds(tanHalfFovX, tanHalfFovY);
+}
+
+void ClusteredLighting::BuildClusterBounds(float tanHalfFovX, float tanHalfFovY)
+{
+	uint32_t tilesX = _config.tilesX;
+	uint32_t tilesY = _config.tilesY;
+	uint32_t slices = _config.slices;
+
+	for (uint32_t z = 0; z < slices; z++)
+	{
+		// Exponential slicing keeps clusters roughly cubic in view space
+		float z0 = _near * powf(_far / _near, (float)z / slices);
+		float z1 = _near * powf(_far / _near, (float)(z + 1) / slices);
+
+		_sliceNear[z] = z0;
+		_sliceFar[z] = z1;
+
+		for (uint32_t y = 0; y < tilesY; y++)
+		{
+			// Tile row 0 is the top of the screen
+			float ndcTop = 1.0f - 2.0f * y / tilesY;
+			float ndcBottom = 1.0f - 2.0f * (y + 1) / tilesY;
+
+			for (uint32_t x = 0; x < tilesX; x++)
+			{
+				float ndcLeft = -1.0f + 2.0f * x / tilesX;
+				float ndcRight = -1.0f + 2.0f * (x + 1) / tilesX;
+
+				float xs[4] = { ndcLeft * z0 * tanHalfFovX, ndcRight * z0 * tanHalfFovX, ndcLeft * z1 * tanHalfFovX, ndcRight * z1 * tanHalfFovX };
+				float ys[4] = { ndcBottom * z0 * tanHalfFovY, ndcTop * z0 * tanHalfFovY, ndcBottom * z1 * tanHalfFovY, ndcTop * z1 * tanHalfFovY };
+
+				uint32_t index = x + y * tilesX + z * tilesX * tilesY;
+
+				_minX[index] = fminf(fminf(xs[0], xs[1]), fminf(xs[2], xs[3]));
+				_maxX[index] = fmaxf(fmaxf(xs[0], xs[1]), fmaxf(xs[2], xs[3]));
+				_minY[index] = fminf(fminf(ys[0], ys[1]), fminf(ys[2], ys[3]));
+				_maxY[index] = fmaxf(fmaxf(ys[0], ys[1]), fmaxf(ys[2], ys[3]));
+				_minZ[index] = z0;
+				_maxZ[index] = z1;
+			}
+		}
+	}
+}
+
+uint32_t ClusteredLighting::AddLight(const Light& light)
+{
+	if (_lights.size() >= _config.maxLights)
+		return ClusterInvalidLight;
+
+	_lights.push_back(light);
+
+	return (uint32_t)_lights.size() - 1;
+}
+
+void ClusteredLighting::ClearLights()
+{
+	_lights.clear();
+}
+
+void ClusteredLighting::PrepareLights(const Mat4& view)
+{
+	size_t lightCount = _lights.size();
+
+	_sphereX.resize(lightCount);
+	_sphereY.resize(lightCount);
+	_sphereZ.resize(lightCount);
+	_sphereR.resize(lightCount);
+	_gpuLights.resize(lightCount);
+
+	for (size_t i = 0; i < lightCount; i++)
+	{
+		const Light& light = _lights[i];
+
+		Vec3 center = light.position;
+		float radius = light.range;
+
+		if (light.type == LIGHT_SPOT)
+		{
+			// Tightest sphere around the lit region, a spherical sector since the
+			// shader attenuates by distance. Wider than 45 degrees the rim circle
+			// bounds it, narrower the sphere through the apex and the rim does.
+			float cosAngle = light.cosOuter;
+
+			if (cosAngle < 0.70710678f)
+			{
+				float sinAngle = sqrtf(1.0f - cosAngle * cosAngle);
+				center = light.position + light.direction * (cosAngle * light.range);
+				radius = sinAngle * light.range;
+			}
+			else
+			{
+				radius = light.range / (2.0f * cosAngle);
+				center = light.position + light.direction * radius;
+			}
+		}
+
+		Vec3 centerV = TransformPoint(center, view);
+
+		_sphereX[i] = centerV.x;
+		_sphereY[i] = centerV.y;
+		_sphereZ[i] = centerV.z;
+		_sphereR[i] = radius;
+
+		GpuLight& gpu = _gpuLights[i];
+		gpu.positionRange[0] = light.position.x;
+		gpu.positionRange[1] = light.position.y;
+		gpu.positionRange[2] = light.position.z;
+		gpu.positionRange[3] = light.range;
+		gpu.colorIntensity[0] = light.color.x;
+		gpu.colorIntensity[1] = light.color.y;
+		gpu.colorIntensity[2] = light.color.z;
+		gpu.colorIntensity[3] = light.intensity;
+		gpu.directionCosOuter[0] = light.direction.x;
+		gpu.directionCosOuter[1] = light.direction.y;
+		gpu.directionCosOuter[2] = light.direction.z;
+		gpu.directionCosOuter[3] = light.cosOuter;
+		gpu.cosInnerType[0] = light.cosInner;
+		gpu.cosInnerType[1] = (float)light.type;
+		gpu.cosInnerType[2] = 0.0f;
+		gpu.cosInnerType[3] = 0.0f;
+	}
+}
+
+void ClusteredLighting::AssignSlice(uint32_t slice)
+{
+	uint32_t tilesPerSlice = _config.tilesX * _config.tilesY;
+	uint32_t sliceCapacity = _config.maxLightIndices / _config.slices;
+	uint32_t* pOut = _lightIndices.data() + (size_t)slice * sliceCapacity;
+	uint32_t used = 0;
+	bool overflow = false;
+
+	ScratchScope scratch;
+
+	// Gather the lights whose spheres reach into this depth slice, padded to a multiple
+	// of 4 with spheres that can never pass the overlap test
+	uint32_t lightCount = (uint32_t)_lights.size();
+	uint32_t padded = (lightCount + 3) & ~3u;
+	float* cx = scratch.AllocArray<float>(padded);
+	float* cy = scratch.AllocArray<float>(padded);
+	float* cz = scratch.AllocArray<float>(padded);
+	float* rr = scratch.AllocArray<float>(padded);
+	uint32_t* ids = scratch.AllocArray<uint32_t>(padded);
+
+	if (cx == nullptr || cy == nullptr || cz == nullptr || rr == nullptr || ids == nullptr)
+	{
+		for (uint32_t t = 0; t < tilesPerSlice; t++)
+		{
+			_clusters[slice * tilesPerSlice + t].offset = 0;
+			_clusters[slice * tilesPerSlice + t].count = 0;
+		}
+
+		_sliceCounts[slice] = 0;
+		_sliceOverflow[slice] = 1;
+		return;
+	}
+
+	float z0 = _sliceNear[slice];
+	float z1 = _sliceFar[slice];
+	uint32_t candidates = 0;
+
+	for (uint32_t i = 0; i < lightCount; i++)
+	{
+		if (_sphereZ[i] + _sphereR[i] < z0 || _sphereZ[i] - _sphereR[i] > z1)
+			continue;
+
+		cx[candidates] = _sphereX[i];
+		cy[candidates] = _sphereY[i];
+		cz[candidates] = _sphereZ[i];
+		rr[candidates] = _sphereR[i] * _sphereR[i];
+		ids[candidates] = i;
+		candidates++;
+	}
+
+	uint32_t groups = (candidates + 3) / 4;
+
+	for (uint32_t i = candidates; i < groups * 4; i++)
+	{
+		cx[i] = cy[i] = cz[i] = 1e30f;
+		rr[i] = 0.0f;
+		ids[i] = 0;
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+
+	for (uint32_t t = 0; t < tilesPerSlice; t++)
+	{
+		uint32_t cluster = slice * tilesPerSlice + t;
+		uint32_t offset = used;
+		uint32_t count = 0;
+
+		__m128 minX = _mm_set1_ps(_minX[cluster]);
+		__m128 minY = _mm_set1_ps(_minY[cluster]);
+		__m128 minZ = _mm_set1_ps(_minZ[cluster]);
+		__m128 maxX = _mm_set1_ps(_maxX[cluster]);
+		__m128 maxY = _mm_set1_ps(_maxY[cluster]);
+		__m128 maxZ = _mm_set1_ps(_maxZ[cluster]);
+
+		// Four lights at a time against one cluster: squared distance from the sphere
+		// centre to the box, compared against the squared radius
+		for (uint32_t g = 0; g < groups; g++)
+		{
+			__m128 x = _mm_load_ps(cx + g * 4);
+			__m128 y = _mm_load_ps(cy + g * 4);
+			__m128 z = _mm_load_ps(cz + g * 4);
+			__m128 r2 = _mm_load_ps(rr + g * 4);
+
+			__m128 dx = _mm_add_ps(_mm_max_ps(zero, _mm_sub_ps(minX, x)), _mm_max_ps(zero, _mm_sub_ps(x, maxX)));
+			__m128 dy = _mm_add_ps(_mm_max_ps(zero, _mm_sub_ps(minY, y)), _mm_max_ps(zero, _mm_sub_ps(y, maxY)));
+			__m128 dz = _mm_add_ps(_mm_max_ps(zero, _mm_sub_ps(minZ, z)), _mm_max_ps(zero, _mm_sub_ps(z, maxZ)));
+			__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+			int mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+
+			for (int lane = 0; mask != 0; lane++, mask >>= 1)
+			{
+				if ((mask & 1) == 0)
+					continue;
+
+				if (count >= _config.maxLightsPerCluster || used >= sliceCapacity)
+				{
+					overflow = true;
+					continue;
+				}
+
+				pOut[used++] = ids[g * 4 + lane];
+				count++;
+			}
+		}
+
+		_clusters[cluster].offset = offset;
+		_clusters[cluster].count = count;
+	}
+
+	_sliceCounts[slice] = used;
+	_sliceOverflow[slice] = overflow ? 1 : 0;
+}
+
+void ClusteredLighting::AssignSlices(void* pData, uint32_t begin, uint32_t end)
+{
+	ClusteredLighting* self = static_cast<ClusteredLighting*>(pData);
+
+	for (uint32_t slice = begin; slice < end; slice++)
+		self->AssignSlice(slice);
+}
+
+void ClusteredLighting::Assign(const Mat4& view, JobSystem* pJobs)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	PrepareLights(view);
+
+	if (pJobs != nullptr)
+		pJobs->ParallelFor(_config.slices, 1, &ClusteredLighting::AssignSlices, this);
+	else
+		AssignSlices(this, 0, _config.slices);
+
+	// Each slice wrote into its own fixed region of the index list, pack them together
+	// and turn the slice relative offsets into absolute ones
+	uint32_t tilesPerSlice = _config.tilesX * _config.tilesY;
+	uint32_t sliceCapacity = _config.maxLightIndices / _config.slices;
+	uint32_t base = 0;
+
+	memset(&_stats, 0, sizeof(_stats));
+
+	for (uint32_t slice = 0; slice < _config.slices; slice++)
+	{
+		uint32_t count = _sliceCounts[slice];
+		uint32_t regionStart = slice * sliceCapacity;
+
+		if (regionStart != base && count > 0)
+			memmove(_lightIndices.data() + base, _lightIndices.data() + regionStart, count * sizeof(uint32_t));
+
+		for (uint32_t t = 0; t < tilesPerSlice; t++)
+		{
+			ClusterRange& range = _clusters[slice * tilesPerSlice + t];
+			range.offset += base;
+
+			if (range.count > _stats.maxLightsInCluster)
+				_stats.maxLightsInCluster = range.count;
+
+			if (range.count > 0)
+				_stats.occupiedClusters++;
+		}
+
+		if (_sliceOverflow[slice])
+			_stats.overflowed = true;
+
+		base += count;
+	}
+
+	_lightIndexCount = base;
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	_stats.lightCount = (uint32_t)_lights.size();
+	_stats.lightIndexCount = _lightIndexCount;
+	_stats.assignMs = elapsed.count();
+}
+
+ClusterShaderConstants ClusteredLighting::GetShaderConstants() const
+{
+	// slice = floor(log(z) * scale + bias) inverts the exponential slicing
+	float logRatio = logf(_far / _near);
+
+	ClusterShaderConstants constants;
+	constants.tilesX = _config.tilesX;
+	constants.tilesY = _config.tilesY;
+	constants.slices = _config.slices;
+	constants.lightCount = (uint32_t)_lights.size();
+	constants.screenWidth = _screenWidth;
+	constants.screenHeight = _screenHeight;
+	constants.sliceScale = _config.slices / logRatio;
+	constants.sliceBias = -(_config.slices * logf(_near)) / logRatio;
+
+	return constants;
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "cpumath.h"
+
+class JobSystem;
+
+enum LightType
+{
+	LIGHT_POINT = 0,
+	LIGHT_SPOT = 1,
+};
+
+struct Light
+{
+	LightType type;
+	Vec3      position;   // world space
+	float     range;
+	Vec3      color;
+	float     intensity;
+	Vec3      direction;  // world space, spot lights only
+	float     cosInner;
+	float     cosOuter;
+};
+
+// Shader side layout of a light, matches the Buffer<float4> read in framework.fx
+struct GpuLight
+{
+	float positionRange[4];
+	float colorIntensity[4];
+	float directionCosOuter[4];
+	float cosInnerType[4];
+};
+
+struct ClusterRange
+{
+	uint32_t offset;
+	uint32_t count;
+};
+
+// Mirrors the ClusterConstants cbuffer in framework.fx
+struct ClusterShaderConstants
+{
+	uint32_t tilesX;
+	uint32_t tilesY;
+	uint32_t slices;
+	uint32_t lightCount;
+	float    screenWidth;
+	float    screenHeight;
+	float    sliceScale;
+	float    sliceBias;
+};
+
+const uint32_t ClusterInvalidLight = 0xFFFFFFFF;
+
+struct ClusterConfig
+{
+	uint32_t tilesX;
+	uint32_t tilesY;
+	uint32_t slices;
+	uint32_t maxLights;  // AddLight refuses any more, size the GPU light buffer from this
+	uint32_t maxLightsPerCluster;
+	uint32_t maxLightIndices;
+
+	ClusterConfig() : tilesX(16), tilesY(9), slices(24), maxLights(1024), maxLightsPerCluster(256), maxLightIndices(1024 * 1024) {}
+};
+
+struct ClusterStats
+{
+	uint32_t lightCount;
+	uint32_t lightIndexCount;
+	uint32_t maxLightsInCluster;
+	uint32_t occupiedClusters;
+	bool     overflowed;
+	double   assignMs;
+};
+
+//--------------------------------------------------------------------------------------
+// Clustered forward light assignment. The view frustum is split into tilesX * tilesY
+// screen tiles and exponentially spaced depth slices, each light's bounding sphere is
+// tested against the view space AABB of every cluster it could touch and the result is
+// a per-cluster (offset, count) range into one flat light index list.
+//--------------------------------------------------------------------------------------
+class ClusteredLighting
+{
+private:
+	ClusterConfig _config;
+	float _near;
+	float _far;
+	float _screenWidth;
+	float _screenHeight;
+
+	// View space cluster AABBs, SoA, indexed like the cluster grid
+	std::vector<float> _minX, _minY, _minZ;
+	std::vector<float> _maxX, _maxY, _maxZ;
+	std::vector<float> _sliceNear;
+	std::vector<float> _sliceFar;
+
+	std::vector<Light> _lights;
+
+	// View space bounding spheres of the lights for the current frame, SoA
+	std::vector<float> _sphereX, _sphereY, _sphereZ, _sphereR;
+
+	std::vector<GpuLight>     _gpuLights;
+	std::vector<ClusterRange> _clusters;
+	std::vector<uint32_t>     _lightIndices;
+	std::vector<uint32_t>     _sliceCounts;
+	std::vector<uint8_t>      _sliceOverflow;
+	uint32_t                  _lightIndexCount;
+
+	ClusterStats _stats;
+
+private:
+	void BuildClusterBounds(float tanHalfFovX, float tanHalfFovY);
+	void PrepareLights(const Mat4& view);
+	void AssignSlice(uint32_t slice);
+
+	static void AssignSlices(void* pData, uint32_t begin, uint32_t end);
+
+public:
+	ClusteredLighting();
+
+	void Init(const ClusterConfig& config);
+
+	// Must be called whenever the projection or the render target size changes
+	void SetProjection(float fovY, float screenWidth, float screenHeight, float nearZ, float farZ);
+
+	// Returns ClusterInvalidLight once maxLights have been added, so the index lists never
+	// point past what was uploaded
+	uint32_t AddLight(const Light& light);
+	void ClearLights();
+	Light& GetLight(uint32_t index) { return _lights[index]; }
+	uint32_t GetLightCount() const { return (uint32_t)_lights.size(); }
+
+	// Rebuilds the cluster light lists for the given view matrix
+	void Assign(const Mat4& view, JobSystem* pJobs);
+
+	const GpuLight* GetGpuLights() const { return _gpuLights.data(); }
+	const ClusterRange* GetClusters() const { return _clusters.data(); }
+	const uint32_t* GetLightIndices() const { return _lightIndices.data(); }
+	uint32_t GetLightIndexCount() const { return _lightIndexCount; }
+	uint32_t GetClusterCount() const { return _config.tilesX * _config.tilesY * _config.slices; }
+	const ClusterConfig& GetConfig() const { return _config; }
+
+	ClusterShaderConstants GetShaderConstants() const;
+	const ClusterStats& GetStats() const { return _stats; }
+};
@@ -0,0 +1,987 @@
+#include "collision.h"
+
+#include <chrono>
+#include <cstring>
+#include "jobsystem.h"
+
+// Bodies spanning more cells than this are tested against everything instead of hashed
+static const uint32_t MaxCellsPerBody = 64;
+
+// Cells mark static bodies in their entries so dynamic pairs can be skipped without
+// reading the other body
+static const uint32_t CellStaticBit = 0x80000000u;
+
+// Gap left between a sphere and what it slid along, so the next sweep starts clear of it
+static const float ContactSkin = 1.0e-3f;
+
+Aabb TransformAabb(const Aabb& box, const Mat4& world)
+{
+	Vec3 center = (box.min + box.max) * 0.5f;
+	Vec3 extent = (box.max - box.min) * 0.5f;
+
+	Vec3 worldCenter = TransformPoint(center, world);
+	Vec3 worldExtent(fabsf(world.m[0][0]) * extent.x + fabsf(world.m[1][0]) * extent.y + fabsf(world.m[2][0]) * extent.z,
+					 fabsf(world.m[0][1]) * extent.x + fabsf(world.m[1][1]) * extent.y + fabsf(world.m[2][1]) * extent.z,
+					 fabsf(world.m[0][2]) * extent.x + fabsf(world.m[1][2]) * extent.y + fabsf(world.m[2][2]) * extent.z);
+
+	Aabb result = { worldCenter - worldExtent, worldCenter + worldExtent };
+
+	return result;
+}
+
+void BuildCollisionMesh(const float* pPositions, size_t positionStride, uint32_t vertexCount,
+						const uint32_t* pIndices, uint32_t indexCount, CollisionMesh& mesh)
+{
+	mesh.positions.resize(vertexCount);
+	mesh.indices.assign(pIndices, pIndices + indexCount);
+
+	for (uint32_t i = 0; i < vertexCount; i++)
+	{
+		const float* p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(pPositions) + i * positionStride);
+		mesh.positions[i] = Vec3(p[0], p[1], p[2]);
+	}
+
+	mesh.bounds.min = vertexCount ? mesh.positions[0] : Vec3();
+	mesh.bounds.max = mesh.bounds.min;
+
+	for (uint32_t i = 1; i < vertexCount; i++)
+	{
+		mesh.bounds.min = Min(mesh.bounds.min, mesh.positions[i]);
+		mesh.bounds.max = Max(mesh.bounds.max, mesh.positions[i]);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// SpatialHash
+//--------------------------------------------------------------------------------------
+static inline uint32_t HashCell(int32_t x, int32_t y, int32_t z)
+{
+	return ((uint32_t)x * 73856093u) ^ ((uint32_t)y * 19349663u) ^ ((uint32_t)z * 83492791u);
+}
+
+static inline uint32_t CellSpan(const int32_t cellMin[3], const int32_t cellMax[3])
+{
+	uint64_t span = (uint64_t)(cellMax[0] - cellMin[0] + 1) * (uint64_t)(cellMax[1] - cellMin[1] + 1) * (uint64_t)(cellMax[2] - cellMin[2] + 1);
+
+	return span > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)span;
+}
+
+static inline bool InRange(int32_t x, int32_t y, int32_t z, const int32_t* pMin, const int32_t* pMax)
+{
+	return pMin && x >= pMin[0] && x <= pMax[0] && y >= pMin[1] && y <= pMax[1] && z >= pMin[2] && z <= pMax[2];
+}
+
+SpatialHash::SpatialHash(float cellSize)
+{
+	SetCellSize(cellSize);
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+void SpatialHash::SetCellSize(float cellSize)
+{
+	Clear();
+
+	_cellSize = cellSize;
+	_invCellSize = 1.0f / cellSize;
+}
+
+void SpatialHash::Clear()
+{
+	_proxies.clear();
+	_freeProxies.clear();
+	_dynamic.clear();
+	_oversized.clear();
+	_cells.clear();
+	_slots.clear();
+	_pairs.clear();
+}
+
+void SpatialHash::CellRange(const Aabb& bounds, int32_t cellMin[3], int32_t cellMax[3]) const
+{
+	cellMin[0] = (int32_t)floorf(bounds.min.x * _invCellSize);
+	cellMin[1] = (int32_t)floorf(bounds.min.y * _invCellSize);
+	cellMin[2] = (int32_t)floorf(bounds.min.z * _invCellSize);
+	cellMax[0] = (int32_t)floorf(bounds.max.x * _invCellSize);
+	cellMax[1] = (int32_t)floorf(bounds.max.y * _invCellSize);
+	cellMax[2] = (int32_t)floorf(bounds.max.z * _invCellSize);
+}
+
+uint32_t SpatialHash::FindCell(int32_t x, int32_t y, int32_t z) const
+{
+	if (_slots.empty())
+		return CollisionInvalidBody;
+
+	uint32_t mask = (uint32_t)_slots.size() - 1;
+
+	for (uint32_t slot = HashCell(x, y, z) & mask;; slot = (slot + 1) & mask)
+	{
+		uint32_t entry = _slots[slot];
+
+		if (entry == 0)
+			return CollisionInvalidBody;
+
+		const Cell& cell = _cells[entry - 1];
+
+		if (cell.x == x && cell.y == y && cell.z == z)
+			return entry - 1;
+	}
+}
+
+uint32_t SpatialHash::FindOrAddCell(int32_t x, int32_t y, int32_t z)
+{
+	uint32_t index = FindCell(x, y, z);
+
+	if (index != CollisionInvalidBody)
+		return index;
+
+	// Keep the table at most half full so probes stay short
+	if ((_cells.size() + 1) * 2 > _slots.size())
+		Rehash(_slots.empty() ? 1024 : _slots.size() * 2);
+
+	Cell cell;
+	cell.x = x;
+	cell.y = y;
+	cell.z = z;
+	_cells.push_back(cell);
+
+	uint32_t mask = (uint32_t)_slots.size() - 1;
+	uint32_t slot = HashCell(x, y, z) & mask;
+
+	while (_slots[slot] != 0)
+		slot = (slot + 1) & mask;
+
+	_slots[slot] = (uint32_t)_cells.size();
+
+	return (uint32_t)_cells.size() - 1;
+}
+
+void SpatialHash::Rehash(size_t slotCount)
+{
+	_slots.assign(slotCount, 0);
+
+	uint32_t mask = (uint32_t)slotCount - 1;
+
+	for (size_t i = 0; i < _cells.size(); i++)
+	{
+		uint32_t slot = HashCell(_cells[i].x, _cells[i].y, _cells[i].z) & mask;
+
+		while (_slots[slot] != 0)
+			slot = (slot + 1) & mask;
+
+		_slots[slot] = (uint32_t)i + 1;
+	}
+}
+
+void SpatialHash::InsertIntoCells(uint32_t body, const int32_t cellMin[3], const int32_t cellMax[3], const int32_t* pSkipMin, const int32_t* pSkipMax)
+{
+	uint32_t entry = _proxies[body].dynamicIndex == CollisionInvalidBody ? body | CellStaticBit : body;
+
+	for (int32_t z = cellMin[2]; z <= cellMax[2]; z++)
+	{
+		for (int32_t y = cellMin[1]; y <= cellMax[1]; y++)
+		{
+			for (int32_t x = cellMin[0]; x <= cellMax[0]; x++)
+			{
+				if (!InRange(x, y, z, pSkipMin, pSkipMax))
+					_cells[FindOrAddCell(x, y, z)].bodies.push_back(entry);
+			}
+		}
+	}
+}
+
+void SpatialHash::RemoveFromCells(uint32_t body, const int32_t cellMin[3], const int32_t cellMax[3], const int32_t* pSkipMin, const int32_t* pSkipMax)
+{
+	uint32_t entry = _proxies[body].dynamicIndex == CollisionInvalidBody ? body | CellStaticBit : body;
+
+	for (int32_t z = cellMin[2]; z <= cellMax[2]; z++)
+	{
+		for (int32_t y = cellMin[1]; y <= cellMax[1]; y++)
+		{
+			for (int32_t x = cellMin[0]; x <= cellMax[0]; x++)
+			{
+				if (InRange(x, y, z, pSkipMin, pSkipMax))
+					continue;
+
+				std::vector<uint32_t>& bodies = _cells[FindCell(x, y, z)].bodies;
+
+				for (size_t i = 0; i < bodies.size(); i++)
+				{
+					if (bodies[i] == entry)
+					{
+						bodies[i] = bodies.back();
+						bodies.pop_back();
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+void SpatialHash::SetOversized(uint32_t body, bool oversized)
+{
+	_proxies[body].oversized = oversized;
+
+	if (oversized)
+	{
+		_oversized.push_back(body);
+		return;
+	}
+
+	for (size_t i = 0; i < _oversized.size(); i++)
+	{
+		if (_oversized[i] == body)
+		{
+			_oversized[i] = _oversized.back();
+			_oversized.pop_back();
+			break;
+		}
+	}
+}
+
+uint32_t SpatialHash::Add(const Aabb& bounds, uint32_t flags)
+{
+	uint32_t body;
+
+	if (!_freeProxies.empty())
+	{
+		body = _freeProxies.back();
+		_freeProxies.pop_back();
+	}
+	else
+	{
+		body = (uint32_t)_proxies.size();
+		_proxies.push_back(Proxy());
+	}
+
+	Proxy& proxy = _proxies[body];
+	proxy.bounds = bounds;
+	proxy.flags = flags;
+	proxy.active = true;
+	proxy.oversized = false;
+	CellRange(bounds, proxy.cellMin, proxy.cellMax);
+
+	if (flags & COLLISION_STATIC)
+	{
+		proxy.dynamicIndex = CollisionInvalidBody;
+	}
+	else
+	{
+		proxy.dynamicIndex = (uint32_t)_dynamic.size();
+		_dynamic.push_back(body);
+	}
+
+	if (CellSpan(proxy.cellMin, proxy.cellMax) > MaxCellsPerBody)
+		SetOversized(body, true);
+	else
+		InsertIntoCells(body, proxy.cellMin, proxy.cellMax, nullptr, nullptr);
+
+	return body;
+}
+
+void SpatialHash::Update(uint32_t body, const Aabb& bounds)
+{
+	Proxy& proxy = _proxies[body];
+	proxy.bounds = bounds;
+	_stats.updates++;
+
+	int32_t cellMin[3], cellMax[3];
+	CellRange(bounds, cellMin, cellMax);
+
+	if (memcmp(cellMin, proxy.cellMin, sizeof(cellMin)) == 0 && memcmp(cellMax, proxy.cellMax, sizeof(cellMax)) == 0)
+		return;
+
+	_stats.cellChanges++;
+
+	bool oversized = CellSpan(cellMin, cellMax) > MaxCellsPerBody;
+
+	// Only the cells that were entered or left are touched
+	if (!proxy.oversized && !oversized)
+	{
+		RemoveFromCells(body, proxy.cellMin, proxy.cellMax, cellMin, cellMax);
+		InsertIntoCells(body, cellMin, cellMax, proxy.cellMin, proxy.cellMax);
+	}
+	else if (!proxy.oversized)
+	{
+		RemoveFromCells(body, proxy.cellMin, proxy.cellMax, nullptr, nullptr);
+		SetOversized(body, true);
+	}
+	else if (!oversized)
+	{
+		SetOversized(body, false);
+		InsertIntoCells(body, cellMin, cellMax, nullptr, nullptr);
+	}
+
+	memcpy(proxy.cellMin, cellMin, sizeof(cellMin));
+	memcpy(proxy.cellMax, cellMax, sizeof(cellMax));
+}
+
+void SpatialHash::Remove(uint32_t body)
+{
+	Proxy& proxy = _proxies[body];
+
+	if (proxy.oversized)
+		SetOversized(body, false);
+	else
+		RemoveFromCells(body, proxy.cellMin, proxy.cellMax, nullptr, nullptr);
+
+	if (proxy.dynamicIndex != CollisionInvalidBody)
+	{
+		uint32_t moved = _dynamic.back();
+		_dynamic[proxy.dynamicIndex] = moved;
+		_proxies[moved].dynamicIndex = proxy.dynamicIndex;
+		_dynamic.pop_back();
+	}
+
+	proxy.active = false;
+	_freeProxies.push_back(body);
+}
+
+void SpatialHash::FindCellPairs(uint32_t cell, std::vector<CollisionPair>& pairs) const
+{
+	const Cell& source = _cells[cell];
+	const std::vector<uint32_t>& bodies = source.bodies;
+
+	// Every body in the cell is read once and the pairs are tested out of cache
+	for (size_t i = 0; i < bodies.size(); i++)
+	{
+		const Proxy& proxy = _proxies[bodies[i] & ~CellStaticBit];
+
+		for (size_t j = i + 1; j < bodies.size(); j++)
+		{
+			if (bodies[i] & bodies[j] & CellStaticBit)
+				continue;
+
+			const Proxy& otherProxy = _proxies[bodies[j] & ~CellStaticBit];
+
+			// Only the first cell the two share reports them
+			if (source.x != (proxy.cellMin[0] > otherProxy.cellMin[0] ? proxy.cellMin[0] : otherProxy.cellMin[0]) ||
+				source.y != (proxy.cellMin[1] > otherProxy.cellMin[1] ? proxy.cellMin[1] : otherProxy.cellMin[1]) ||
+				source.z != (proxy.cellMin[2] > otherProxy.cellMin[2] ? proxy.cellMin[2] : otherProxy.cellMin[2]))
+				continue;
+
+			if (Overlaps(proxy.bounds, otherProxy.bounds))
+			{
+				// Dynamic body first
+				CollisionPair pair = { bodies[i], bodies[j] & ~CellStaticBit };
+
+				if (bodies[i] & CellStaticBit)
+				{
+					pair.a = bodies[j];
+					pair.b = bodies[i] & ~CellStaticBit;
+				}
+
+				pairs.push_back(pair);
+			}
+		}
+	}
+}
+
+void SpatialHash::FindOversizedPairs(uint32_t body, std::vector<CollisionPair>& pairs) const
+{
+	const Proxy& proxy = _proxies[body];
+
+	// Oversized dynamic bodies are rare enough to test against everything
+	if (proxy.oversized)
+	{
+		for (uint32_t other = 0; other < (uint32_t)_proxies.size(); other++)
+		{
+			const Proxy& otherProxy = _proxies[other];
+
+			if (other == body || !otherProxy.active)
+				continue;
+
+			if (otherProxy.oversized && otherProxy.dynamicIndex != CollisionInvalidBody && other < body)
+				continue;
+
+			if (Overlaps(proxy.bounds, otherProxy.bounds))
+			{
+				CollisionPair pair = { body, other };
+				pairs.push_back(pair);
+			}
+		}
+
+		return;
+	}
+
+	// Oversized dynamic bodies report their own pairs
+	for (size_t i = 0; i < _oversized.size(); i++)
+	{
+		const Proxy& otherProxy = _proxies[_oversized[i]];
+
+		if (otherProxy.dynamicIndex == CollisionInvalidBody && Overlaps(proxy.bounds, otherProxy.bounds))
+		{
+			CollisionPair pair = { body, _oversized[i] };
+			pairs.push_back(pair);
+		}
+	}
+}
+
+void SpatialHash::FindCellPairsRange(void* pData, uint32_t begin, uint32_t end)
+{
+	SpatialHash* pHash = static_cast<SpatialHash*>(pData);
+	std::vector<CollisionPair>& pairs = pHash->_threadPairs[JobSystem::GetThreadIndex()];
+
+	for (uint32_t i = begin; i < end; i++)
+		pHash->FindCellPairs(i, pairs);
+}
+
+void SpatialHash::FindOversizedPairsRange(void* pData, uint32_t begin, uint32_t end)
+{
+	SpatialHash* pHash = static_cast<SpatialHash*>(pData);
+	std::vector<CollisionPair>& pairs = pHash->_threadPairs[JobSystem::GetThreadIndex()];
+
+	for (uint32_t i = begin; i < end; i++)
+		pHash->FindOversizedPairs(pHash->_dynamic[i], pairs);
+}
+
+const std::vector<CollisionPair>& SpatialHash::FindPairs(JobSystem* pJobSystem)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	uint32_t dynamicCount = (uint32_t)_dynamic.size();
+	size_t threadCount = pJobSystem ? pJobSystem->GetThreadCount() : 1;
+
+	if (_threadPairs.size() < threadCount)
+		_threadPairs.resize(threadCount);
+
+	for (size_t i = 0; i < _threadPairs.size(); i++)
+		_threadPairs[i].clear();
+
+	uint32_t cellCount = (uint32_t)_cells.size();
+
+	// Bodies that share a cell, then bodies against the ones too big to hash
+	if (pJobSystem)
+	{
+		pJobSystem->ParallelFor(cellCount, 256, &SpatialHash::FindCellPairsRange, this);
+
+		if (!_oversized.empty())
+			pJobSystem->ParallelFor(dynamicCount, 256, &SpatialHash::FindOversizedPairsRange, this);
+	}
+	else
+	{
+		for (uint32_t i = 0; i < cellCount; i++)
+			FindCellPairs(i, _threadPairs[0]);
+
+		for (uint32_t i = 0; i < dynamicCount && !_oversized.empty(); i++)
+			FindOversizedPairs(_dynamic[i], _threadPairs[0]);
+	}
+
+	size_t pairCount = 0;
+
+	for (size_t i = 0; i < _threadPairs.size(); i++)
+		pairCount += _threadPairs[i].size();
+
+	_pairs.resize(pairCount);
+	pairCount = 0;
+
+	for (size_t i = 0; i < _threadPairs.size(); i++)
+	{
+		if (!_threadPairs[i].empty())
+			memcpy(&_pairs[pairCount], _threadPairs[i].data(), _threadPairs[i].size() * sizeof(CollisionPair));
+
+		pairCount += _threadPairs[i].size();
+	}
+
+	_stats.bodies = (uint32_t)(_proxies.size() - _freeProxies.size());
+	_stats.dynamicBodies = dynamicCount;
+	_stats.oversizedBodies = (uint32_t)_oversized.size();
+	_stats.cells = (uint32_t)_cells.size();
+	_stats.pairs = (uint32_t)_pairs.size();
+	_stats.findPairsMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	// Update counts cover the frame that led up to these pairs
+	_stats.updates = 0;
+	_stats.cellChanges = 0;
+
+	return _pairs;
+}
+
+void SpatialHash::Query(const Aabb& box, std::vector<uint32_t>& bodies) const
+{
+	bodies.clear();
+
+	int32_t cellMin[3], cellMax[3];
+	CellRange(box, cellMin, cellMax);
+
+	// Boxes covering more cells than there are bodies are cheaper to test directly
+	if (CellSpan(cellMin, cellMax) > _proxies.size())
+	{
+		for (uint32_t body = 0; body < (uint32_t)_proxies.size(); body++)
+		{
+			if (_proxies[body].active && Overlaps(box, _proxies[body].bounds))
+				bodies.push_back(body);
+		}
+
+		return;
+	}
+
+	for (int32_t z = cellMin[2]; z <= cellMax[2]; z++)
+	{
+		for (int32_t y = cellMin[1]; y <= cellMax[1]; y++)
+		{
+			for (int32_t x = cellMin[0]; x <= cellMax[0]; x++)
+			{
+				uint32_t cell = FindCell(x, y, z);
+
+				if (cell == CollisionInvalidBody)
+					continue;
+
+				const std::vector<uint32_t>& cellBodies = _cells[cell].bodies;
+
+				for (size_t i = 0; i < cellBodies.size(); i++)
+				{
+					uint32_t body = cellBodies[i] & ~CellStaticBit;
+					const Proxy& proxy = _proxies[body];
+
+					// Same first shared cell rule as FindPairs, so nothing comes back twice
+					if (x != (cellMin[0] > proxy.cellMin[0] ? cellMin[0] : proxy.cellMin[0]) ||
+						y != (cellMin[1] > proxy.cellMin[1] ? cellMin[1] : proxy.cellMin[1]) ||
+						z != (cellMin[2] > proxy.cellMin[2] ? cellMin[2] : proxy.cellMin[2]))
+						continue;
+
+					if (Overlaps(box, proxy.bounds))
+						bodies.push_back(body);
+				}
+			}
+		}
+	}
+
+	for (size_t i = 0; i < _oversized.size(); i++)
+	{
+		if (Overlaps(box, _proxies[_oversized[i]].bounds))
+			bodies.push_back(_oversized[i]);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Narrowphase
+//--------------------------------------------------------------------------------------
+Vec3 ClosestPointOnTriangle(const Vec3& p, const Vec3& a, const Vec3& b, const Vec3& c)
+{
+	// Voronoi regions of the vertices, then the edges, then the face
+	Vec3 ab = b - a;
+	Vec3 ac = c - a;
+	Vec3 ap = p - a;
+	float d1 = Dot(ab, ap);
+	float d2 = Dot(ac, ap);
+
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return a;
+
+	Vec3 bp = p - b;
+	float d3 = Dot(ab, bp);
+	float d4 = Dot(ac, bp);
+
+	if (d3 >= 0.0f && d4 <= d3)
+		return b;
+
+	float vc = d1 * d4 - d3 * d2;
+
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return a + ab * (d1 / (d1 - d3));
+
+	Vec3 cp = p - c;
+	float d5 = Dot(ab, cp);
+	float d6 = Dot(ac, cp);
+
+	if (d6 >= 0.0f && d5 <= d6)
+		return c;
+
+	float vb = d5 * d2 - d1 * d6;
+
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return a + ac * (d2 / (d2 - d6));
+
+	float va = d3 * d6 - d5 * d4;
+
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float denom = 1.0f / (va + vb + vc);
+
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+static bool PointInTriangle(const Vec3& p, const Vec3& a, const Vec3& b, const Vec3& c)
+{
+	Vec3 v0 = b - a;
+	Vec3 v1 = c - a;
+	Vec3 v2 = p - a;
+
+	float d00 = Dot(v0, v0);
+	float d01 = Dot(v0, v1);
+	float d11 = Dot(v1, v1);
+	float d20 = Dot(v2, v0);
+	float d21 = Dot(v2, v1);
+	float denom = d00 * d11 - d01 * d01;
+
+	if (denom <= 0.0f)
+		return false;
+
+	float v = (d11 * d20 - d01 * d21) / denom;
+	float w = (d00 * d21 - d01 * d20) / denom;
+
+	return v >= 0.0f && w >= 0.0f && v + w <= 1.0f;
+}
+
+// Lowest root of a t^2 + b t + c = 0 in [0, maxT]
+static bool LowestRoot(float a, float b, float c, float maxT, float& root)
+{
+	float discriminant = b * b - 4.0f * a * c;
+
+	if (a <= 1.0e-12f || discriminant < 0.0f)
+		return false;
+
+	float t = (-b - sqrtf(discriminant)) / (2.0f * a);
+
+	if (t < 0.0f || t > maxT)
+		return false;
+
+	root = t;
+
+	return true;
+}
+
+// Sphere against a point, the first time their distance drops to the radius
+static bool SweepSpherePoint(const Vec3& center, float radius, const Vec3& velocity, const Vec3& p, float& t)
+{
+	Vec3 d = center - p;
+	float b = 2.0f * Dot(velocity, d);
+	float c = Dot(d, d) - radius * radius;
+
+	if (c < 0.0f)
+	{
+		if (b >= 0.0f)
+			return false;
+
+		t = 0.0f;
+		return true;
+	}
+
+	return LowestRoot(Dot(velocity, velocity), b, c, t, t);
+}
+
+// Sphere against the segment p0 p1, the point on the segment comes back in contact
+static bool SweepSphereEdge(const Vec3& center, float radius, const Vec3& velocity, const Vec3& p0, const Vec3& p1, float& t, Vec3& contact)
+{
+	Vec3 edge = p1 - p0;
+	Vec3 d = center - p0;
+
+	float edgeSq = Dot(edge, edge);
+	float edgeDotV = Dot(edge, velocity);
+	float edgeDotD = Dot(edge, d);
+
+	if (edgeSq <= 1.0e-12f)
+		return false;
+
+	// Distance from the moving centre to the infinite line, scaled by edgeSq
+	float a = edgeSq * Dot(velocity, velocity) - edgeDotV * edgeDotV;
+	float b = 2.0f * (edgeSq * Dot(d, velocity) - edgeDotV * edgeDotD);
+	float c = edgeSq * (Dot(d, d) - radius * radius) - edgeDotD * edgeDotD;
+	float root;
+
+	if (c < 0.0f)
+	{
+		if (b >= 0.0f)
+			return false;
+
+		root = 0.0f;
+	}
+	else if (!LowestRoot(a, b, c, t, root))
+	{
+		return false;
+	}
+
+	// Past either end it's a vertex hit, which the vertex tests find
+	float f = (edgeDotD + edgeDotV * root) / edgeSq;
+
+	if (f < 0.0f || f > 1.0f)
+		return false;
+
+	t = root;
+	contact = p0 + edge * f;
+
+	return true;
+}
+
+bool SweepSphereTriangle(const Vec3& center, float radius, const Vec3& velocity,
+						 const Vec3& a, const Vec3& b, const Vec3& c, float& t, Vec3& normal, Vec3& point)
+{
+	Vec3 n = Cross(b - a, c - a);
+	float area = Length(n);
+
+	if (area <= 1.0e-12f)
+		return false;
+
+	n *= 1.0f / area;
+
+	// Collide with whichever side the sphere is on
+	float distance = Dot(center - a, n);
+
+	if (distance < 0.0f)
+	{
+		n = -n;
+		distance = -distance;
+	}
+
+	float approach = -Dot(velocity, n);
+
+	if (distance <= radius)
+	{
+		// Already touching the plane, inside the face means a hit straight away
+		Vec3 onPlane = center - n * distance;
+
+		if (approach > 0.0f && PointInTriangle(onPlane, a, b, c))
+		{
+			t = 0.0f;
+			normal = n;
+			point = onPlane;
+			return true;
+		}
+	}
+	else
+	{
+		if (approach <= 0.0f)
+			return false;
+
+		float planeT = (distance - radius) / approach;
+
+		if (planeT > 1.0f)
+			return false;
+
+		Vec3 contact = center + velocity * planeT - n * radius;
+
+		if (PointInTriangle(contact, a, b, c))
+		{
+			t = planeT;
+			normal = n;
+			point = contact;
+			return true;
+		}
+	}
+
+	// The face was missed, so the first contact is on an edge or a vertex
+	float bestT = 1.0f;
+	bool found = false;
+	const Vec3* corners[3] = { &a, &b, &c };
+
+	for (int i = 0; i < 3; i++)
+	{
+		float vertexT = bestT;
+
+		if (SweepSpherePoint(center, radius, velocity, *corners[i], vertexT) && vertexT <= bestT)
+		{
+			bestT = vertexT;
+			point = *corners[i];
+			found = true;
+		}
+
+		float edgeT = bestT;
+		Vec3 contact;
+
+		if (SweepSphereEdge(center, radius, velocity, *corners[i], *corners[(i + 1) % 3], edgeT, contact) && edgeT <= bestT)
+		{
+			bestT = edgeT;
+			point = contact;
+			found = true;
+		}
+	}
+
+	if (!found)
+		return false;
+
+	t = bestT;
+	normal = Normalize(center + velocity * bestT - point);
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// CollisionWorld
+//--------------------------------------------------------------------------------------
+CollisionWorld::CollisionWorld(float cellSize) : _broadphase(cellSize)
+{
+}
+
+void CollisionWorld::Clear()
+{
+	_broadphase.Clear();
+	_bodies.clear();
+	_triangles.clear();
+}
+
+uint32_t CollisionWorld::AddBody(const Aabb& bounds, uint32_t flags)
+{
+	uint32_t body = _broadphase.Add(bounds, flags);
+
+	if (body >= _bodies.size())
+		_bodies.resize(body + 1);
+
+	_bodies[body].pMesh = nullptr;
+	_bodies[body].firstTriangle = 0;
+
+	return body;
+}
+
+uint32_t CollisionWorld::AddBody(const CollisionMesh* pMesh, const Mat4& world, uint32_t flags)
+{
+	uint32_t body = AddBody(TransformAabb(pMesh->bounds, world), flags);
+
+	_bodies[body].pMesh = pMesh;
+	_bodies[body].firstTriangle = (uint32_t)_triangles.size();
+	_triangles.resize(_triangles.size() + pMesh->indices.size());
+
+	TransformTriangles(body, world);
+
+	return body;
+}
+
+void CollisionWorld::UpdateBody(uint32_t body, const Aabb& bounds)
+{
+	_broadphase.Update(body, bounds);
+}
+
+void CollisionWorld::UpdateBody(uint32_t body, const Mat4& world)
+{
+	TransformTriangles(body, world);
+	_broadphase.Update(body, TransformAabb(_bodies[body].pMesh->bounds, world));
+}
+
+void CollisionWorld::RemoveBody(uint32_t body)
+{
+	_broadphase.Remove(body);
+	_bodies[body].pMesh = nullptr;
+}
+
+void CollisionWorld::TransformTriangles(uint32_t body, const Mat4& world)
+{
+	const CollisionMesh& mesh = *_bodies[body].pMesh;
+	Vec3* pTriangles = &_triangles[_bodies[body].firstTriangle];
+
+	for (size_t i = 0; i < mesh.indices.size(); i++)
+		pTriangles[i] = TransformPoint(mesh.positions[mesh.indices[i]], world);
+}
+
+bool CollisionWorld::SweepSphere(const Vec3& center, float radius, const Vec3& velocity, uint32_t ignoreBody, SweepHit& hit) const
+{
+	Vec3 extent(radius, radius, radius);
+	Vec3 end = center + velocity;
+	Aabb swept = { Min(center, end) - extent, Max(center, end) + extent };
+
+	_broadphase.Query(swept, _candidates);
+
+	bool found = false;
+	hit.t = 1.0f;
+
+	for (size_t i = 0; i < _candidates.size(); i++)
+	{
+		uint32_t body = _candidates[i];
+		const CollisionMesh* pMesh = _bodies[body].pMesh;
+
+		if (body == ignoreBody || pMesh == nullptr)
+			continue;
+
+		const Vec3* pTriangles = &_triangles[_bodies[body].firstTriangle];
+
+		for (size_t j = 0; j < pMesh->indices.size(); j += 3)
+		{
+			float t;
+			Vec3 normal, point;
+
+			if (SweepSphereTriangle(center, radius, velocity, pTriangles[j], pTriangles[j + 1], pTriangles[j + 2], t, normal, point) && t <= hit.t)
+			{
+				hit.t = t;
+				hit.normal = normal;
+				hit.point = point;
+				hit.body = body;
+				found = true;
+			}
+		}
+	}
+
+	return found;
+}
+
+bool CollisionWorld::PushOut(Vec3& center, float radius, uint32_t ignoreBody) const
+{
+	Vec3 extent(radius, radius, radius);
+	Aabb box = { center - extent, center + extent };
+
+	_broadphase.Query(box, _candidates);
+
+	// Deepest overlap first, the caller repeats until nothing is left
+	float deepest = 0.0f;
+	Vec3 direction;
+
+	for (size_t i = 0; i < _candidates.size(); i++)
+	{
+		uint32_t body = _candidates[i];
+		const CollisionMesh* pMesh = _bodies[body].pMesh;
+
+		if (body == ignoreBody || pMesh == nullptr)
+			continue;
+
+		const Vec3* pTriangles = &_triangles[_bodies[body].firstTriangle];
+
+		for (size_t j = 0; j < pMesh->indices.size(); j += 3)
+		{
+			const Vec3& a = pTriangles[j];
+			const Vec3& b = pTriangles[j + 1];
+			const Vec3& c = pTriangles[j + 2];
+
+			Vec3 offset = center - ClosestPointOnTriangle(center, a, b, c);
+			float distance = Length(offset);
+
+			if (radius - distance <= deepest)
+				continue;
+
+			deepest = radius - distance;
+
+			// A centre right on the surface goes out along the face normal
+			direction = distance > 1.0e-6f ? offset * (1.0f / distance) : Normalize(Cross(b - a, c - a));
+		}
+	}
+
+	if (deepest <= 0.0f)
+		return false;
+
+	center += direction * (deepest + ContactSkin);
+
+	return true;
+}
+
+Vec3 CollisionWorld::MoveSphere(const Vec3& center, float radius, const Vec3& velocity, uint32_t ignoreBody, int maxIterations) const
+{
+	Vec3 position = center;
+
+	// Get out of anything the sphere starts inside, the deepest overlap first
+	for (int i = 0; i < maxIterations; i++)
+	{
+		if (!PushOut(position, radius, ignoreBody))
+			break;
+	}
+
+	Vec3 remaining = velocity;
+
+	for (int i = 0; i < maxIterations; i++)
+	{
+		if (Dot(remaining, remaining) < 1.0e-12f)
+			break;
+
+		SweepHit hit;
+
+		if (!SweepSphere(position, radius, remaining, ignoreBody, hit))
+		{
+			position += remaining;
+			break;
+		}
+
+		// Stop at the contact and slide what's left of the move along the surface
+		position += remaining * hit.t + hit.normal * ContactSkin;
+		remaining *= 1.0f - hit.t;
+		remaining -= hit.normal * Dot(remaining, hit.normal);
+	}
+
+	return position;
+}
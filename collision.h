@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "cpumath.h"
+
+class JobSystem;
+
+const uint32_t CollisionInvalidBody = 0xFFFFFFFF;
+
+struct Aabb
+{
+	Vec3 min;
+	Vec3 max;
+};
+
+inline bool Overlaps(const Aabb& a, const Aabb& b)
+{
+	return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+		   a.min.y <= b.max.y && a.max.y >= b.min.y &&
+		   a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+// Bounds of a box after it has been through a world matrix
+Aabb TransformAabb(const Aabb& box, const Mat4& world);
+
+// Object space triangles a body collides with
+struct CollisionMesh
+{
+	std::vector<Vec3>     positions;
+	std::vector<uint32_t> indices;
+	Aabb                  bounds;
+};
+
+// positionStride is in bytes so interleaved vertex data can be passed directly
+void BuildCollisionMesh(const float* pPositions, size_t positionStride, uint32_t vertexCount,
+						const uint32_t* pIndices, uint32_t indexCount, CollisionMesh& mesh);
+
+enum CollisionBodyFlags : uint32_t
+{
+	COLLISION_STATIC = 1 << 0,  // never moves, only paired with dynamic bodies
+};
+
+struct CollisionPair
+{
+	uint32_t a;  // always a dynamic body
+	uint32_t b;
+};
+
+struct BroadphaseStats
+{
+	uint32_t bodies;
+	uint32_t dynamicBodies;
+	uint32_t oversizedBodies;
+	uint32_t cells;
+	uint32_t updates;       // since the last FindPairs
+	uint32_t cellChanges;   // updates that had to move the body between cells
+	uint32_t pairs;
+	double   findPairsMs;
+};
+
+//--------------------------------------------------------------------------------------
+// Uniform grid of AABBs hashed by cell, for finding overlapping pairs without testing
+// every body against every other. A moving body only touches the cells it entered or
+// left, so bodies that stay in their cells cost a bounds copy. Bodies larger than a few
+// cells across, like floors, live in a separate list every body is tested against.
+//
+// FindPairs splits the cells over the job system and tests the bodies in each cell
+// against each other. A pair is only reported by the first cell both bodies share, so
+// no cross-thread de-duplication is needed.
+//--------------------------------------------------------------------------------------
+class SpatialHash
+{
+private:
+	struct Proxy
+	{
+		Aabb     bounds;
+		int32_t  cellMin[3];
+		int32_t  cellMax[3];
+		uint32_t flags;
+		uint32_t dynamicIndex;  // into _dynamic, CollisionInvalidBody for static bodies
+		bool     oversized;
+		bool     active;
+	};
+
+	struct Cell
+	{
+		int32_t               x, y, z;
+		std::vector<uint32_t> bodies;
+	};
+
+	float                 _cellSize;
+	float                 _invCellSize;
+	std::vector<Proxy>    _proxies;
+	std::vector<uint32_t> _freeProxies;
+	std::vector<uint32_t> _dynamic;
+	std::vector<uint32_t> _oversized;
+
+	// Open addressed table of cell index + 1, cells are kept once created so a body moving
+	// back and forth never reallocates
+	std::vector<Cell>     _cells;
+	std::vector<uint32_t> _slots;
+
+	std::vector<std::vector<CollisionPair>> _threadPairs;
+	std::vector<CollisionPair>              _pairs;
+	BroadphaseStats                         _stats;
+
+private:
+	void CellRange(const Aabb& bounds, int32_t cellMin[3], int32_t cellMax[3]) const;
+	uint32_t FindCell(int32_t x, int32_t y, int32_t z) const;
+	uint32_t FindOrAddCell(int32_t x, int32_t y, int32_t z);
+	void Rehash(size_t slotCount);
+	void InsertIntoCells(uint32_t body, const int32_t cellMin[3], const int32_t cellMax[3], const int32_t* pSkipMin, const int32_t* pSkipMax);
+	void RemoveFromCells(uint32_t body, const int32_t cellMin[3], const int32_t cellMax[3], const int32_t* pSkipMin, const int32_t* pSkipMax);
+	void SetOversized(uint32_t body, bool oversized);
+	void FindCellPairs(uint32_t cell, std::vector<CollisionPair>& pairs) const;
+	void FindOversizedPairs(uint32_t body, std::vector<CollisionPair>& pairs) const;
+	static void FindCellPairsRange(void* pData, uint32_t begin, uint32_t end);
+	static void FindOversizedPairsRange(void* pData, uint32_t begin, uint32_t end);
+
+public:
+	// A cell should be about the size of a typical dynamic body
+	explicit SpatialHash(float cellSize = 2.0f);
+
+	void SetCellSize(float cellSize);
+	void Clear();
+
+	uint32_t Add(const Aabb& bounds, uint32_t flags);
+	void Update(uint32_t body, const Aabb& bounds);
+	void Remove(uint32_t body);
+
+	// Pairs of overlapping bounds with at least one dynamic body, in no particular order
+	const std::vector<CollisionPair>& FindPairs(JobSystem* pJobSystem);
+
+	// Every body whose bounds overlap box, each once
+	void Query(const Aabb& box, std::vector<uint32_t>& bodies) const;
+
+	const Aabb& GetBounds(uint32_t body) const { return _proxies[body].bounds; }
+	uint32_t GetFlags(uint32_t body) const { return _proxies[body].flags; }
+	const BroadphaseStats& GetStats() const { return _stats; }
+};
+
+struct SweepHit
+{
+	float    t;       // fraction of the sweep travelled before contact
+	Vec3     normal;  // pointing away from what was hit
+	Vec3     point;
+	uint32_t body;
+};
+
+// Swept sphere against one triangle, either side. Starting out touching or inside the
+// triangle counts as a hit at t = 0 when moving further in.
+bool SweepSphereTriangle(const Vec3& center, float radius, const Vec3& velocity,
+						 const Vec3& a, const Vec3& b, const Vec3& c, float& t, Vec3& normal, Vec3& point);
+
+Vec3 ClosestPointOnTriangle(const Vec3& p, const Vec3& a, const Vec3& b, const Vec3& c);
+
+//--------------------------------------------------------------------------------------
+// Bodies with world space triangles on top of the broadphase. Spheres are swept against
+// the triangles of the bodies the broadphase finds along the way, so nothing tunnels
+// however fast it moves. Bodies added without a mesh only take part in FindPairs.
+// Sweeps share scratch space, so they are meant for one thread.
+//--------------------------------------------------------------------------------------
+class CollisionWorld
+{
+private:
+	struct Body
+	{
+		const CollisionMesh* pMesh;
+		uint32_t             firstTriangle;  // into _triangles, 3 vertices each
+	};
+
+	SpatialHash                   _broadphase;
+	std::vector<Body>             _bodies;
+	std::vector<Vec3>             _triangles;
+	mutable std::vector<uint32_t> _candidates;
+
+private:
+	void TransformTriangles(uint32_t body, const Mat4& world);
+	bool PushOut(Vec3& center, float radius, uint32_t ignoreBody) const;
+
+public:
+	explicit CollisionWorld(float cellSize = 2.0f);
+
+	// Removing bodies is cheap but their triangles are only reclaimed by Clear
+	void Clear();
+
+	uint32_t AddBody(const Aabb& bounds, uint32_t flags);
+	uint32_t AddBody(const CollisionMesh* pMesh, const Mat4& world, uint32_t flags);
+	void UpdateBody(uint32_t body, const Aabb& bounds);
+	void UpdateBody(uint32_t body, const Mat4& world);
+	void RemoveBody(uint32_t body);
+
+	// First contact of a sphere moving by velocity, ignoring one body (usually its own)
+	bool SweepSphere(const Vec3& center, float radius, const Vec3& velocity, uint32_t ignoreBody, SweepHit& hit) const;
+
+	// Moves a sphere by velocity, sliding along whatever it hits, and returns where it
+	// ends up. A sphere that starts inside something is pushed out first.
+	Vec3 MoveSphere(const Vec3& center, float radius, const Vec3& velocity, uint32_t ignoreBody, int maxIterations = 4) const;
+
+	SpatialHash& GetBroadphase() { return _broadphase; }
+	const SpatialHash& GetBroadphase() const { return _broadphase; }
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+
+//--------------------------------------------------------------------------------------
+// Small math types for the CPU-only systems that have to build without DirectXMath.
+// Mat4 uses the same row-major, row-vector layout as XMFLOAT4X4 so the two can be
+// copied into each other directly.
+//--------------------------------------------------------------------------------------
+struct Vec3
+{
+	float x, y, z;
+
+	Vec3() : x(0.0f), y(0.0f), z(0.0f) {}
+	Vec3(float x_, float y_, float z_) : x(x_), y(y_), z(z_) {}
+
+	Vec3 operator+(const Vec3& v) const { return Vec3(x + v.x, y + v.y, z + v.z); }
+	Vec3 operator-(const Vec3& v) const { return Vec3(x - v.x, y - v.y, z - v.z); }
+	Vec3 operator*(float s) const { return Vec3(x * s, y * s, z * s); }
+	Vec3 operator-() const { return Vec3(-x, -y, -z); }
+	Vec3& operator+=(const Vec3& v) { x += v.x; y += v.y; z += v.z; return *this; }
+	Vec3& operator-=(const Vec3& v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+	Vec3& operator*=(float s) { x *= s; y *= s; z *= s; return *this; }
+};
+
+inline float Dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3 Cross(const Vec3& a, const Vec3& b) { return Vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+inline float Length(const Vec3& v) { return sqrtf(Dot(v, v)); }
+inline Vec3 Min(const Vec3& a, const Vec3& b) { return Vec3(fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z)); }
+inline Vec3 Max(const Vec3& a, const Vec3& b) { return Vec3(fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z)); }
+
+inline Vec3 Normalize(const Vec3& v)
+{
+	float len = Length(v);
+	return len > 0.0f ? v * (1.0f / len) : v;
+}
+
+struct Mat4
+{
+	float m[4][4];
+
+	static Mat4 Identity()
+	{
+		Mat4 r;
+		memset(r.m, 0, sizeof(r.m));
+		r.m[0][0] = r.m[1][1] = r.m[2][2] = r.m[3][3] = 1.0f;
+		return r;
+	}
+
+	static Mat4 FromFloats(const float* values)
+	{
+		Mat4 r;
+		memcpy(r.m, values, sizeof(r.m));
+		return r;
+	}
+};
+
+inline Vec3 TransformPoint(const Vec3& p, const Mat4& mat)
+{
+	return Vec3(p.x * mat.m[0][0] + p.y * mat.m[1][0] + p.z * mat.m[2][0] + mat.m[3][0],
+				p.x * mat.m[0][1] + p.y * mat.m[1][1] + p.z * mat.m[2][1] + mat.m[3][1],
+				p.x * mat.m[0][2] + p.y * mat.m[1][2] + p.z * mat.m[2][2] + mat.m[3][2]);
+}
+
+inline Vec3 TransformDirection(const Vec3& d, const Mat4& mat)
+{
+	return Vec3(d.x * mat.m[0][0] + d.y * mat.m[1][0] + d.z * mat.m[2][0],
+				d.x * mat.m[0][1] + d.y * mat.m[1][1] + d.z * mat.m[2][1],
+				d.x * mat.m[0][2] + d.y * mat.m[1][2] + d.z * mat.m[2][2]);
+}
+
+inline Mat4 Multiply(const Mat4& a, const Mat4& b)
+{
+	Mat4 r;
+
+	for (int i = 0; i < 4; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+		}
+	}
+
+	return r;
+}
+
+inline Mat4 Transpose(const Mat4& mat)
+{
+	Mat4 r;
+
+	for (int i = 0; i < 4; i++)
+	{
+		for (int j = 0; j < 4; j++)
+			r.m[i][j] = mat.m[j][i];
+	}
+
+	return r;
+}
+
+// Left handed look-at, same convention as XMMatrixLookAtLH
+inline Mat4 LookAtLH(const Vec3& eye, const Vec3& target, const Vec3& up)
+{
+	Vec3 zAxis = Normalize(target - eye);
+	Vec3 xAxis = Normalize(Cross(up, zAxis));
+	Vec3 yAxis = Cross(zAxis, xAxis);
+
+	Mat4 r = Mat4::Identity();
+	r.m[0][0] = xAxis.x; r.m[0][1] = yAxis.x; r.m[0][2] = zAxis.x;
+	r.m[1][0] = xAxis.y; r.m[1][1] = yAxis.y; r.m[1][2] = zAxis.y;
+	r.m[2][0] = xAxis.z; r.m[2][1] = yAxis.z; r.m[2][2] = zAxis.z;
+	r.m[3][0] = -Dot(xAxis, eye);
+	r.m[3][1] = -Dot(yAxis, eye);
+	r.m[3][2] = -Dot(zAxis, eye);
+
+	return r;
+}
+
+// Left handed orthographic projection, same convention as XMMatrixOrthographicLH
+inline Mat4 OrthographicLH(float width, float height, float nearZ, float farZ)
+{
+	Mat4 r = Mat4::Identity();
+	r.m[0][0] = 2.0f / width;
+	r.m[1][1] = 2.0f / height;
+	r.m[2][2] = 1.0f / (farZ - nearZ);
+	r.m[3][2] = -nearZ / (farZ - nearZ);
+
+	return r;
+}
+
+// Left handed perspective projection, same convention as XMMatrixPerspectiveFovLH
+inline Mat4 PerspectiveFovLH(float fovY, float aspect, float nearZ, float farZ)
+{
+	float yScale = 1.0f / tanf(fovY * 0.5f);
+
+	Mat4 r;
+	memset(r.m, 0, sizeof(r.m));
+	r.m[0][0] = yScale / aspect;
+	r.m[1][1] = yScale;
+	r.m[2][2] = farZ / (farZ - nearZ);
+	r.m[2][3] = 1.0f;
+	r.m[3][2] = -nearZ * farZ / (farZ - nearZ);
+
+	return r;
+}
+
+// General 4x4 inverse, returns identity for singular matrices
+inline Mat4 Inverse(const Mat4& mat)
+{
+	const float* a = &mat.m[0][0];
+	float inv[16];
+
+	inv[0] = a[5] * a[10] * a[15] - a[5] * a[11] * a[14] - a[9] * a[6] * a[15] + a[9] * a[7] * a[14] + a[13] * a[6] * a[11] - a[13] * a[7] * a[10];
+	inv[4] = -a[4] * a[10] * a[15] + a[4] * a[11] * a[14] + a[8] * a[6] * a[15] - a[8] * a[7] * a[14] - a[12] * a[6] * a[11] + a[12] * a[7] * a[10];
+	inv[8] = a[4] * a[9] * a[15] - a[4] * a[11] * a[13] - a[8] * a[5] * a[15] + a[8] * a[7] * a[13] + a[12] * a[5] * a[11] - a[12] * a[7] * a[9];
+	inv[12] = -a[4] * a[9] * a[14] + a[4] * a[10] * a[13] + a[8] * a[5] * a[14] - a[8] * a[6] * a[13] - a[12] * a[5] * a[10] + a[12] * a[6] * a[9];
+	inv[1] = -a[1] * a[10] * a[15] + a[1] * a[11] * a[14] + a[9] * a[2] * a[15] - a[9] * a[3] * a[14] - a[13] * a[2] * a[11] + a[13] * a[3] * a[10];
+	inv[5] = a[0] * a[10] * a[15] - a[0] * a[11] * a[14] - a[8] * a[2] * a[15] + a[8] * a[3] * a[14] + a[12] * a[2] * a[11] - a[12] * a[3] * a[10];
+	inv[9] = -a[0] * a[9] * a[15] + a[0] * a[11] * a[13] + a[8] * a[1] * a[15] - a[8] * a[3] * a[13] - a[12] * a[1] * a[11] + a[12] * a[3] * a[9];
+	inv[13] = a[0] * a[9] * a[14] - a[0] * a[10] * a[13] - a[8] * a[1] * a[14] + a[8] * a[2] * a[13] + a[12] * a[1] * a[10] - a[12] * a[2] * a[9];
+	inv[2] = a[1] * a[6] * a[15] - a[1] * a[7] * a[14] - a[5] * a[2] * a[15] + a[5] * a[3] * a[14] + a[13] * a[2] * a[7] - a[13] * a[3] * a[6];
+	inv[6] = -a[0] * a[6] * a[15] + a[0] * a[7] * a[14] + a[4] * a[2] * a[15] - a[4] * a[3] * a[14] - a[12] * a[2] * a[7] + a[12] * a[3] * a[6];
+	inv[10] = a[0] * a[5] * a[15] - a[0] * a[7] * a[13] - a[4] * a[1] * a[15] + a[4] * a[3] * a[13] + a[12] * a[1] * a[7] - a[12] * a[3] * a[5];
+	inv[14] = -a[0] * a[5] * a[14] + a[0] * a[6] * a[13] + a[4] * a[1] * a[14] - a[4] * a[2] * a[13] - a[12] * a[1] * a[6] + a[12] * a[2] * a[5];
+	inv[3] = -a[1] * a[6] * a[11] + a[1] * a[7] * a[10] + a[5] * a[2] * a[11] - a[5] * a[3] * a[10] - a[9] * a[2] * a[7] + a[9] * a[3] * a[6];
+	inv[7] = a[0] * a[6] * a[11] - a[0] * a[7] * a[10] - a[4] * a[2] * a[11] + a[4] * a[3] * a[10] + a[8] * a[2] * a[7] - a[8] * a[3] * a[6];
+	inv[11] = -a[0] * a[5] * a[11] + a[0] * a[7] * a[9] + a[4] * a[1] * a[11] - a[4] * a[3] * a[9] - a[8] * a[1] * a[7] + a[8] * a[3] * a[5];
+	inv[15] = a[0] * a[5] * a[10] - a[0] * a[6] * a[9] - a[4] * a[1] * a[10] + a[4] * a[2] * a[9] + a[8] * a[1] * a[6] - a[8] * a[2] * a[5];
+
+	float det = a[0] * inv[0] + a[1] * inv[4] + a[2] * inv[8] + a[3] * inv[12];
+
+	if (fabsf(det) < 1.0e-12f)
+		return Mat4::Identity();
+
+	Mat4 r;
+	float invDet = 1.0f / det;
+
+	for (int i = 0; i < 16; i++)
+		(&r.m[0][0])[i] = inv[i] * invDet;
+
+	return r;
+}
@@ -0,0 +1,363 @@
+#include "debugdraw.h"
+
+#include <cstdio>
+
+// 8x8 glyphs for ASCII 32 to 126, one byte per row from the top, bit 0 is the left column
+static const uint8_t FontGlyphs[95][8] =
+{
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // space
+	{ 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 },  // !
+	{ 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // "
+	{ 0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00 },  // #
+	{ 0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00 },  // $
+	{ 0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00 },  // %
+	{ 0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00 },  // &
+	{ 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '
+	{ 0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00 },  // (
+	{ 0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00 },  // )
+	{ 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 },  // *
+	{ 0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00 },  // +
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06 },  // ,
+	{ 0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00 },  // -
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 },  // .
+	{ 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 },  // /
+	{ 0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00 },  // 0
+	{ 0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00 },  // 1
+	{ 0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00 },  // 2
+	{ 0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00 },  // 3
+	{ 0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00 },  // 4
+	{ 0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00 },  // 5
+	{ 0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00 },  // 6
+	{ 0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00 },  // 7
+	{ 0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00 },  // 8
+	{ 0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00 },  // 9
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00 },  // :
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06 },  // ;
+	{ 0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00 },  // <
+	{ 0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00 },  // =
+	{ 0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00 },  // >
+	{ 0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00 },  // ?
+	{ 0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00 },  // @
+	{ 0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00 },  // A
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00 },  // B
+	{ 0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00 },  // C
+	{ 0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00 },  // D
+	{ 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00 },  // E
+	{ 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00 },  // F
+	{ 0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00 },  // G
+	{ 0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00 },  // H
+	{ 0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },  // I
+	{ 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00 },  // J
+	{ 0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00 },  // K
+	{ 0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00 },  // L
+	{ 0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00 },  // M
+	{ 0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00 },  // N
+	{ 0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00 },  // O
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00 },  // P
+	{ 0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00 },  // Q
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00 },  // R
+	{ 0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00 },  // S
+	{ 0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },  // T
+	{ 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00 },  // U
+	{ 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },  // V
+	{ 0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00 },  // W
+	{ 0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00 },  // X
+	{ 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00 },  // Y
+	{ 0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00 },  // Z
+	{ 0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00 },  // [
+	{ 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00 },  // backslash
+	{ 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00 },  // ]
+	{ 0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 },  // ^
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF },  // _
+	{ 0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },  // `
+	{ 0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00 },  // a
+	{ 0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00 },  // b
+	{ 0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00 },  // c
+	{ 0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00 },  // d
+	{ 0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00 },  // e
+	{ 0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00 },  // f
+	{ 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F },  // g
+	{ 0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00 },  // h
+	{ 0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },  // i
+	{ 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E },  // j
+	{ 0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00 },  // k
+	{ 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },  // l
+	{ 0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00 },  // m
+	{ 0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00 },  // n
+	{ 0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00 },  // o
+	{ 0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F },  // p
+	{ 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78 },  // q
+	{ 0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00 },  // r
+	{ 0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00 },  // s
+	{ 0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00 },  // t
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00 },  // u
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },  // v
+	{ 0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00 },  // w
+	{ 0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00 },  // x
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F },  // y
+	{ 0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00 },  // z
+	{ 0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00 },  // {
+	{ 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 },  // |
+	{ 0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00 },  // }
+	{ 0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // ~
+};
+
+static const uint32_t SolidGlyph = 127;
+
+// Centre of the solid cell, so bilinear filtering never reaches a neighbour
+static const float SolidU = ((SolidGlyph % 16) * DebugGlyphSize + DebugGlyphSize * 0.5f) / DebugAtlasWidth;
+static const float SolidV = ((SolidGlyph / 16) * DebugGlyphSize + DebugGlyphSize * 0.5f) / DebugAtlasHeight;
+
+void BuildDebugFontAtlas(uint8_t* pPixels)
+{
+	for (uint32_t code = 0; code < 128; code++)
+	{
+		uint32_t originX = (code % 16) * DebugGlyphSize;
+		uint32_t originY = (code / 16) * DebugGlyphSize;
+
+		for (uint32_t row = 0; row < DebugGlyphSize; row++)
+		{
+			uint8_t bits = 0;
+
+			if (code == SolidGlyph)
+				bits = 0xFF;
+			else if (code >= 32 && code < 127)
+				bits = FontGlyphs[code - 32][row];
+
+			uint8_t* pRow = pPixels + (originY + row) * DebugAtlasWidth + originX;
+
+			for (uint32_t column = 0; column < DebugGlyphSize; column++)
+				pRow[column] = (bits >> column) & 1 ? 255 : 0;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// DebugGraphHistory
+//--------------------------------------------------------------------------------------
+void DebugGraphHistory::Push(float value)
+{
+	_values[_next] = value;
+	_next = (_next + 1) % DebugGraphLength;
+
+	if (_count < DebugGraphLength)
+		_count++;
+}
+
+float DebugGraphHistory::GetAverage() const
+{
+	if (_count == 0)
+		return 0.0f;
+
+	float sum = 0.0f;
+
+	for (uint32_t i = 0; i < _count; i++)
+		sum += Get(i);
+
+	return sum / _count;
+}
+
+float DebugGraphHistory::GetMax() const
+{
+	float result = 0.0f;
+
+	for (uint32_t i = 0; i < _count; i++)
+		result = fmaxf(result, Get(i));
+
+	return result;
+}
+
+//--------------------------------------------------------------------------------------
+// DebugDraw
+//--------------------------------------------------------------------------------------
+DebugDraw::DebugDraw()
+{
+	_lineCount = 0;
+	_overlayCount = 0;
+	_dropped = 0;
+	_enabled = false;
+}
+
+void DebugDraw::Init(uint32_t lineCapacity, uint32_t overlayCapacity)
+{
+	// Whole primitives only
+	_lineVertices.resize(lineCapacity & ~1u);
+	_overlayVertices.resize(overlayCapacity - overlayCapacity % 6);
+
+	BeginFrame();
+}
+
+void DebugDraw::BeginFrame()
+{
+	_lineCount = 0;
+	_overlayCount = 0;
+	_dropped = 0;
+}
+
+DebugDrawStats DebugDraw::GetStats() const
+{
+	DebugDrawStats stats;
+	stats.lineVertices = _lineCount;
+	stats.overlayVertices = _overlayCount;
+	stats.dropped = _dropped;
+
+	return stats;
+}
+
+void DebugDraw::AddLine(const Vec3& a, const Vec3& b, uint32_t color)
+{
+	if (_lineCount + 2 > _lineVertices.size())
+	{
+		_dropped++;
+		return;
+	}
+
+	DebugVertex* pVertex = &_lineVertices[_lineCount];
+	_lineCount += 2;
+
+	pVertex[0].position[0] = a.x;
+	pVertex[0].position[1] = a.y;
+	pVertex[0].position[2] = a.z;
+	pVertex[0].color = color;
+	pVertex[0].texCoord[0] = SolidU;
+	pVertex[0].texCoord[1] = SolidV;
+
+	pVertex[1].position[0] = b.x;
+	pVertex[1].position[1] = b.y;
+	pVertex[1].position[2] = b.z;
+	pVertex[1].color = color;
+	pVertex[1].texCoord[0] = SolidU;
+	pVertex[1].texCoord[1] = SolidV;
+}
+
+// Corners are numbered with bit 0 for x, bit 1 for y and bit 2 for z
+static const uint8_t BoxEdges[12][2] =
+{
+	{ 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+	{ 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+	{ 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 },
+};
+
+void DebugDraw::AddBox(const Vec3& min, const Vec3& max, uint32_t color)
+{
+	Vec3 corners[8];
+
+	for (uint32_t i = 0; i < 8; i++)
+		corners[i] = Vec3(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z);
+
+	for (uint32_t i = 0; i < 12; i++)
+		AddLine(corners[BoxEdges[i][0]], corners[BoxEdges[i][1]], color);
+}
+
+void DebugDraw::AddFrustum(const Mat4& viewProjection, uint32_t color)
+{
+	Mat4 inverse = Inverse(viewProjection);
+	Vec3 corners[8];
+
+	// Clip space corners back through the inverse, z runs from 0 to 1 in D3D
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		float x = i & 1 ? 1.0f : -1.0f;
+		float y = i & 2 ? 1.0f : -1.0f;
+		float z = i & 4 ? 1.0f : 0.0f;
+
+		Vec3 p = TransformPoint(Vec3(x, y, z), inverse);
+		float w = x * inverse.m[0][3] + y * inverse.m[1][3] + z * inverse.m[2][3] + inverse.m[3][3];
+
+		corners[i] = p * (1.0f / w);
+	}
+
+	for (uint32_t i = 0; i < 12; i++)
+		AddLine(corners[BoxEdges[i][0]], corners[BoxEdges[i][1]], color);
+}
+
+void DebugDraw::AddQuad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, uint32_t color)
+{
+	if (_overlayCount + 6 > _overlayVertices.size())
+	{
+		_dropped++;
+		return;
+	}
+
+	DebugVertex* pVertex = &_overlayVertices[_overlayCount];
+	_overlayCount += 6;
+
+	// Two clockwise triangles, y grows downwards
+	const float corners[6][4] =
+	{
+		{ x0, y0, u0, v0 }, { x1, y0, u1, v0 }, { x0, y1, u0, v1 },
+		{ x0, y1, u0, v1 }, { x1, y0, u1, v0 }, { x1, y1, u1, v1 },
+	};
+
+	for (uint32_t i = 0; i < 6; i++)
+	{
+		pVertex[i].position[0] = corners[i][0];
+		pVertex[i].position[1] = corners[i][1];
+		pVertex[i].position[2] = 0.0f;
+		pVertex[i].color = color;
+		pVertex[i].texCoord[0] = corners[i][2];
+		pVertex[i].texCoord[1] = corners[i][3];
+	}
+}
+
+void DebugDraw::AddRect(float x, float y, float width, float height, uint32_t color)
+{
+	AddQuad(x, y, x + width, y + height, SolidU, SolidV, SolidU, SolidV, color);
+}
+
+void DebugDraw::AddText(float x, float y, uint32_t color, const char* format, va_list args)
+{
+	char text[512];
+	vsnprintf(text, sizeof(text), format, args);
+
+	const float glyphU = (float)DebugGlyphSize / DebugAtlasWidth;
+	const float glyphV = (float)DebugGlyphSize / DebugAtlasHeight;
+	const float size = (float)DebugGlyphSize;
+
+	float penX = x;
+	float penY = y;
+
+	for (const char* p = text; *p; p++)
+	{
+		uint32_t code = (uint8_t)*p;
+
+		if (code == '\n')
+		{
+			penX = x;
+			penY += size;
+			continue;
+		}
+
+		// Spaces and anything outside the atlas only move the pen
+		if (code > 32 && code < 127)
+		{
+			float u = (code % 16) * glyphU;
+			float v = (code / 16) * glyphV;
+
+			AddQuad(penX, penY, penX + size, penY + size, u, v, u + glyphU, v + glyphV, color);
+		}
+
+		penX += size;
+	}
+}
+
+void DebugDraw::AddGraph(float x, float y, float width, float height, const DebugGraphHistory& history, float maxValue, uint32_t color)
+{
+	uint32_t count = history.GetCount();
+
+	if (count == 0 || maxValue <= 0.0f)
+		return;
+
+	// Slots for the whole history so bars don't stretch while it fills up
+	float barWidth = width / DebugGraphLength;
+	float left = x + width - count * barWidth;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		float value = fminf(history.Get(i) / maxValue, 1.0f);
+		float barHeight = fmaxf(value, 0.0f) * height;
+
+		if (barHeight > 0.0f)
+			AddRect(left + i * barWidth, y + height - barHeight, barWidth, barHeight, color);
+	}
+}
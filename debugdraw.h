@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdarg>
+#include <cstdint>
+#include <vector>
+#include "cpumath.h"
+
+// Colours are packed for R8G8B8A8_UNORM, red in the low byte
+inline uint32_t DebugColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255)
+{
+	return (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16) | ((uint32_t)a << 24);
+}
+
+// The font atlas is a 16x8 grid of 8x8 glyphs for the 128 ASCII codes, one byte of
+// coverage per texel. Code 127 is solid so untextured primitives can sample it too.
+const uint32_t DebugGlyphSize = 8;
+const uint32_t DebugAtlasWidth = 16 * DebugGlyphSize;
+const uint32_t DebugAtlasHeight = 8 * DebugGlyphSize;
+
+void BuildDebugFontAtlas(uint8_t* pPixels);
+
+struct DebugVertex
+{
+	float    position[3];  // world space for lines, pixels for the overlay
+	uint32_t color;
+	float    texCoord[2];
+};
+
+// Last values of a counter for plotting, fixed size so pushing never allocates
+const uint32_t DebugGraphLength = 128;
+
+class DebugGraphHistory
+{
+private:
+	float    _values[DebugGraphLength];
+	uint32_t _next;
+	uint32_t _count;
+
+public:
+	DebugGraphHistory() : _next(0), _count(0) {}
+
+	void Push(float value);
+
+	// Oldest first
+	float Get(uint32_t index) const { return _values[(_next + DebugGraphLength - _count + index) % DebugGraphLength]; }
+	uint32_t GetCount() const { return _count; }
+	float GetLatest() const { return _count ? Get(_count - 1) : 0.0f; }
+	float GetAverage() const;
+	float GetMax() const;
+};
+
+struct DebugDrawStats
+{
+	uint32_t lineVertices;
+	uint32_t overlayVertices;
+	uint32_t dropped;  // primitives that didn't fit this frame
+};
+
+//--------------------------------------------------------------------------------------
+// Immediate mode debug drawing. Lines, boxes and frustums in world space and text,
+// rectangles and graphs in screen pixels are appended to two fixed size vertex arrays
+// during the frame, the renderer copies both into one dynamic buffer and draws each with
+// a single call. Every call returns straight away while disabled, Text checks before
+// formatting, so leaving calls in costs a branch each.
+//--------------------------------------------------------------------------------------
+class DebugDraw
+{
+private:
+	std::vector<DebugVertex> _lineVertices;
+	std::vector<DebugVertex> _overlayVertices;
+	uint32_t                 _lineCount;     // vertices used this frame
+	uint32_t                 _overlayCount;
+	uint32_t                 _dropped;
+	bool                     _enabled;
+
+private:
+	void AddLine(const Vec3& a, const Vec3& b, uint32_t color);
+	void AddBox(const Vec3& min, const Vec3& max, uint32_t color);
+	void AddFrustum(const Mat4& viewProjection, uint32_t color);
+	void AddQuad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, uint32_t color);
+	void AddRect(float x, float y, float width, float height, uint32_t color);
+	void AddText(float x, float y, uint32_t color, const char* format, va_list args);
+	void AddGraph(float x, float y, float width, float height, const DebugGraphHistory& history, float maxValue, uint32_t color);
+
+public:
+	DebugDraw();
+
+	// Capacities in vertices, lines take 2 and overlay quads 6
+	void Init(uint32_t lineCapacity, uint32_t overlayCapacity);
+
+	void SetEnabled(bool enabled) { _enabled = enabled; }
+	bool IsEnabled() const { return _enabled; }
+
+	// Forgets last frame's primitives
+	void BeginFrame();
+
+	void Line(const Vec3& a, const Vec3& b, uint32_t color) { if (_enabled) AddLine(a, b, color); }
+	void Box(const Vec3& min, const Vec3& max, uint32_t color) { if (_enabled) AddBox(min, max, color); }
+
+	// The edges of whatever viewProjection maps to the D3D clip volume
+	void Frustum(const Mat4& viewProjection, uint32_t color) { if (_enabled) AddFrustum(viewProjection, color); }
+
+	// Screen space, in pixels from the top left
+	void Rect(float x, float y, float width, float height, uint32_t color)
+	{
+		if (_enabled)
+			AddRect(x, y, width, height, color);
+	}
+
+	// printf style, '\n' starts a new line. Glyphs are DebugGlyphSize pixels square.
+	void Text(float x, float y, uint32_t color, const char* format, ...)
+	{
+		if (!_enabled)
+			return;
+
+		va_list args;
+		va_start(args, format);
+		AddText(x, y, color, format, args);
+		va_end(args);
+	}
+
+	// Bars for the history from oldest to newest, scaled so maxValue fills the height
+	void Graph(float x, float y, float width, float height, const DebugGraphHistory& history, float maxValue, uint32_t color)
+	{
+		if (_enabled)
+			AddGraph(x, y, width, height, history, maxValue, color);
+	}
+
+	const DebugVertex* GetLineVertices() const { return _lineVertices.data(); }
+	const DebugVertex* GetOverlayVertices() const { return _overlayVertices.data(); }
+	uint32_t GetLineVertexCount() const { return _lineCount; }
+	uint32_t GetOverlayVertexCount() const { return _overlayCount; }
+	uint32_t GetCapacity() const { return (uint32_t)(_lineVertices.size() + _overlayVertices.size()); }
+	DebugDrawStats GetStats() const;
+};
@@ -0,0 +1,204 @@
+#include "debugdrawd3d11.h"
+
+// Mirrors the DebugConstants cbuffer in framework.fx
+struct DebugConstants
+{
+	float Transform[4][4];
+};
+
+D3D11DebugDrawRenderer::D3D11DebugDrawRenderer()
+{
+	_pVertexShader = nullptr;
+	_pPixelShader = nullptr;
+	_pLayout = nullptr;
+	_pVertexBuffer = nullptr;
+	_pConstantBuffer = nullptr;
+	_pFontTexture = nullptr;
+	_pFontSRV = nullptr;
+	_pSampler = nullptr;
+	_pBlendState = nullptr;
+	_capacity = 0;
+}
+
+HRESULT D3D11DebugDrawRenderer::Init(D3D11TrackedDevice& device, ID3DBlob* pVSBlob, ID3DBlob* pPSBlob, uint32_t capacity)
+{
+	HRESULT hr;
+
+	hr = device.CreateVertexShader(pVSBlob->GetBufferPointer(), pVSBlob->GetBufferSize(), &_pVertexShader, GPU_RESOURCE(GPURES_SHADER, "VS_Debug"));
+
+	if (FAILED(hr))
+		return hr;
+
+	hr = device.CreatePixelShader(pPSBlob->GetBufferPointer(), pPSBlob->GetBufferSize(), &_pPixelShader, GPU_RESOURCE(GPURES_SHADER, "PS_Debug"));
+
+	if (FAILED(hr))
+		return hr;
+
+	D3D11_INPUT_ELEMENT_DESC layout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	};
+
+	hr = device.CreateInputLayout(layout, ARRAYSIZE(layout), pVSBlob->GetBufferPointer(), pVSBlob->GetBufferSize(), &_pLayout,
+								  GPU_RESOURCE(GPURES_SHADER, "DebugVertex"));
+
+	if (FAILED(hr))
+		return hr;
+
+	// Rewritten every frame the overlay is on with WRITE_DISCARD
+	D3D11_BUFFER_DESC bd;
+	ZeroMemory(&bd, sizeof(bd));
+	bd.Usage = D3D11_USAGE_DYNAMIC;
+	bd.ByteWidth = sizeof(DebugVertex) * capacity;
+	bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	hr = device.CreateBuffer(&bd, nullptr, &_pVertexBuffer, GPU_RESOURCE(GPURES_GEOMETRY, "DebugVertices"));
+
+	if (FAILED(hr))
+		return hr;
+
+	_capacity = capacity;
+
+	ZeroMemory(&bd, sizeof(bd));
+	bd.Usage = D3D11_USAGE_DEFAULT;
+	bd.ByteWidth = sizeof(DebugConstants);
+	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	hr = device.CreateBuffer(&bd, nullptr, &_pConstantBuffer, GPU_RESOURCE(GPURES_CONSTANTS, "DebugConstants"));
+
+	if (FAILED(hr))
+		return hr;
+
+	uint8_t pixels[DebugAtlasWidth * DebugAtlasHeight];
+	BuildDebugFontAtlas(pixels);
+
+	D3D11_TEXTURE2D_DESC textureDesc;
+	ZeroMemory(&textureDesc, sizeof(textureDesc));
+	textureDesc.Width = DebugAtlasWidth;
+	textureDesc.Height = DebugAtlasHeight;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = DXGI_FORMAT_R8_UNORM;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+	D3D11_SUBRESOURCE_DATA InitData;
+	ZeroMemory(&InitData, sizeof(InitData));
+	InitData.pSysMem = pixels;
+	InitData.SysMemPitch = DebugAtlasWidth;
+	hr = device.CreateTexture2D(&textureDesc, &InitData, &_pFontTexture, GPU_RESOURCE(GPURES_TEXTURE, "DebugFont"));
+
+	if (FAILED(hr))
+		return hr;
+
+	hr = device.CreateShaderResourceView(_pFontTexture, nullptr, &_pFontSRV, GPU_RESOURCE(GPURES_VIEW, "DebugFont"));
+
+	if (FAILED(hr))
+		return hr;
+
+	// Glyphs are drawn at their native size, point sampling keeps them sharp
+	D3D11_SAMPLER_DESC sampDesc;
+	ZeroMemory(&sampDesc, sizeof(sampDesc));
+	sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
+	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+	sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+	hr = device.CreateSamplerState(&sampDesc, &_pSampler, GPU_RESOURCE(GPURES_STATE, "DebugSampler"));
+
+	if (FAILED(hr))
+		return hr;
+
+	D3D11_BLEND_DESC blendDesc;
+	ZeroMemory(&blendDesc, sizeof(blendDesc));
+	blendDesc.RenderTarget[0].BlendEnable = TRUE;
+	blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_SRC_ALPHA;
+	blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+	blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+	blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+	blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+	blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+	blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+
+	return device.CreateBlendState(&blendDesc, &_pBlendState, GPU_RESOURCE(GPURES_STATE, "DebugBlend"));
+}
+
+void D3D11DebugDrawRenderer::Release(D3D11TrackedDevice& device)
+{
+	device.Release(_pVertexShader);
+	device.Release(_pPixelShader);
+	device.Release(_pLayout);
+	device.Release(_pVertexBuffer);
+	device.Release(_pConstantBuffer);
+	device.Release(_pFontSRV);
+	device.Release(_pFontTexture);
+	device.Release(_pSampler);
+	device.Release(_pBlendState);
+}
+
+void D3D11DebugDrawRenderer::Render(ID3D11DeviceContext* pContext, const DebugDraw& debugDraw, const Mat4& viewProjection,
+									float width, float height)
+{
+	UINT lineCount = debugDraw.GetLineVertexCount();
+	UINT overlayCount = debugDraw.GetOverlayVertexCount();
+
+	if (lineCount + overlayCount == 0 || lineCount + overlayCount > _capacity)
+		return;
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(pContext->Map(_pVertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+		return;
+
+	DebugVertex* pVertices = static_cast<DebugVertex*>(mapped.pData);
+	memcpy(pVertices, debugDraw.GetLineVertices(), sizeof(DebugVertex) * lineCount);
+	memcpy(pVertices + lineCount, debugDraw.GetOverlayVertices(), sizeof(DebugVertex) * overlayCount);
+
+	pContext->Unmap(_pVertexBuffer, 0);
+
+	UINT stride = sizeof(DebugVertex);
+	UINT offset = 0;
+	pContext->IASetVertexBuffers(0, 1, &_pVertexBuffer, &stride, &offset);
+	pContext->IASetInputLayout(_pLayout);
+
+	pContext->VSSetShader(_pVertexShader, nullptr, 0);
+	pContext->VSSetConstantBuffers(5, 1, &_pConstantBuffer);
+	pContext->PSSetShader(_pPixelShader, nullptr, 0);
+	pContext->PSSetShaderResources(6, 1, &_pFontSRV);
+	pContext->PSSetSamplers(2, 1, &_pSampler);
+
+	float blendFactor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	pContext->OMSetBlendState(_pBlendState, blendFactor, 0xffffffff);
+
+	// Matrices go up transposed like everywhere else
+	DebugConstants constants;
+
+	if (lineCount > 0)
+	{
+		Mat4 transform = Transpose(viewProjection);
+		memcpy(constants.Transform, transform.m, sizeof(constants.Transform));
+		pContext->UpdateSubresource(_pConstantBuffer, 0, nullptr, &constants, 0, 0);
+
+		pContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+		pContext->Draw(lineCount, 0);
+	}
+
+	if (overlayCount > 0)
+	{
+		// Pixels from the top left to clip space
+		Mat4 pixelToClip = Mat4::Identity();
+		pixelToClip.m[0][0] = 2.0f / width;
+		pixelToClip.m[1][1] = -2.0f / height;
+		pixelToClip.m[3][0] = -1.0f;
+		pixelToClip.m[3][1] = 1.0f;
+
+		Mat4 transform = Transpose(pixelToClip);
+		memcpy(constants.Transform, transform.m, sizeof(constants.Transform));
+		pContext->UpdateSubresource(_pConstantBuffer, 0, nullptr, &constants, 0, 0);
+
+		pContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		pContext->Draw(overlayCount, lineCount);
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <windows.h>
+#include <d3d11_1.h>
+#include "debugdraw.h"
+#include "gpuresourcesd3d11.h"
+
+//--------------------------------------------------------------------------------------
+// Draws a DebugDraw frame: both vertex arrays go into one dynamic buffer with a single
+// map, then one line list call in world space and one triangle list call in pixels.
+// Expects a render target with no depth bound and leaves the input layout, topology,
+// vertex shader and blend state for the caller to restore.
+//--------------------------------------------------------------------------------------
+class D3D11DebugDrawRenderer
+{
+private:
+	ID3D11VertexShader*       _pVertexShader;
+	ID3D11PixelShader*        _pPixelShader;
+	ID3D11InputLayout*        _pLayout;
+	ID3D11Buffer*             _pVertexBuffer;
+	ID3D11Buffer*             _pConstantBuffer;
+	ID3D11Texture2D*          _pFontTexture;
+	ID3D11ShaderResourceView* _pFontSRV;
+	ID3D11SamplerState*       _pSampler;
+	ID3D11BlendState*         _pBlendState;
+	uint32_t                  _capacity;
+
+public:
+	D3D11DebugDrawRenderer();
+
+	// capacity is in vertices, the sum of the DebugDraw capacities
+	HRESULT Init(D3D11TrackedDevice& device, ID3DBlob* pVSBlob, ID3DBlob* pPSBlob, uint32_t capacity);
+	void Release(D3D11TrackedDevice& device);
+
+	// viewProjection places the lines, the overlay is in pixels of a width x height target
+	void Render(ID3D11DeviceContext* pContext, const DebugDraw& debugDraw, const Mat4& viewProjection, float width, float height);
+};
@@ -0,0 +1,139 @@
+#include "dynamicresolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+void InitDynamicResolutionSettings(DynamicResolutionSettings& settings)
+{
+	settings.targetMs = 1000.0f / 60.0f;
+	settings.headroom = 0.9f;
+	settings.minScale = 0.5f;
+	settings.maxScale = 1.0f;
+	settings.kp = 0.3f;
+	settings.ki = 0.2f;
+	settings.kd = 0.05f;
+	settings.smoothing = 0.25f;
+	settings.spikeRatio = 2.0f;
+	settings.deadband = 0.08f;
+	settings.maxError = 0.5f;
+	settings.maxStepDown = 0.25f;
+	settings.maxStepUp = 0.05f;
+	settings.raiseDelay = 30;
+	settings.scaleSteps = 32;
+}
+
+DynamicResolutionController::DynamicResolutionController()
+{
+	DynamicResolutionSettings settings;
+	InitDynamicResolutionSettings(settings);
+	Init(settings);
+}
+
+void DynamicResolutionController::Init(const DynamicResolutionSettings& settings)
+{
+	_settings = settings;
+	_settings.minScale = std::max(_settings.minScale, 0.01f);
+	_settings.maxScale = std::max(_settings.maxScale, _settings.minScale);
+	_settings.scaleSteps = std::max(_settings.scaleSteps, 1u);
+
+	Reset();
+}
+
+void DynamicResolutionController::Reset()
+{
+	_scale = _settings.maxScale;
+	_pixels = _scale * _scale;
+	_smoothedMs = 0.0f;
+	_lastError = 0.0f;
+	_previousError = 0.0f;
+	_framesUnder = 0;
+	_lastSpike = false;
+
+	memset(&_stats, 0, sizeof(_stats));
+	_stats.scale = _scale;
+}
+
+void DynamicResolutionController::SetFixedScale(float scale)
+{
+	_settings.minScale = _settings.maxScale = scale;
+	Reset();
+}
+
+float DynamicResolutionController::Snap(float scale) const
+{
+	float steps = (float)_settings.scaleSteps;
+	float snapped = floorf(scale * steps + 0.5f) / steps;
+
+	return std::min(std::max(snapped, _settings.minScale), _settings.maxScale);
+}
+
+float DynamicResolutionController::Update(float frameMs)
+{
+	const DynamicResolutionSettings& settings = _settings;
+
+	_stats.frames++;
+	_stats.framesOverBudget += frameMs > settings.targetMs ? 1 : 0;
+
+	// A lone hitch is left out of the average, only a second slow frame in a row counts
+	bool spike = _stats.frames > 1 && frameMs > _smoothedMs * settings.spikeRatio;
+
+	if (spike && !_lastSpike)
+	{
+		_stats.spikes++;
+		frameMs = _smoothedMs;
+	}
+
+	_lastSpike = spike;
+	_smoothedMs = _stats.frames == 1 ? frameMs : _smoothedMs + settings.smoothing * (frameMs - _smoothedMs);
+
+	// Relative so the gains work for any budget, clamped so one bad stretch can't empty the screen
+	float aimMs = settings.targetMs * settings.headroom;
+	float error = (aimMs - _smoothedMs) / aimMs;
+	error = std::min(std::max(error, -settings.maxError), settings.maxError);
+
+	// Raising waits for a run of frames with room to spare
+	if (error > 0.0f)
+		_framesUnder++;
+	else
+		_framesUnder = 0;
+
+	// Inside the deadband, or holding off a raise, the loop stands still and keeps its history
+	// so the proportional and derivative terms don't kick when it starts moving again
+	float output = 0.0f;
+
+	if (fabsf(error) >= settings.deadband && (error < 0.0f || _framesUnder >= settings.raiseDelay))
+	{
+		// Velocity form: the output is a change in pixel count, so there is no integral to
+		// wind up while the scale sits against a limit
+		output = settings.kp * (error - _lastError) + settings.ki * error + settings.kd * (error - 2.0f * _lastError + _previousError);
+		output = std::min(std::max(output, -settings.maxStepDown), settings.maxStepUp);
+
+		_previousError = _lastError;
+		_lastError = error;
+	}
+
+	float minPixels = settings.minScale * settings.minScale;
+	float maxPixels = settings.maxScale * settings.maxScale;
+	_pixels = std::min(std::max(_pixels * (1.0f + output), minPixels), maxPixels);
+
+	// The snapped scale only moves once the loop is well past the middle of the next step
+	float scale = sqrtf(_pixels);
+	float snapped = Snap(scale);
+
+	if (snapped != _scale && fabsf(scale - _scale) > 0.75f / settings.scaleSteps)
+	{
+		_stats.changes++;
+		_stats.raises += snapped > _scale ? 1 : 0;
+		_stats.drops += snapped < _scale ? 1 : 0;
+		_scale = snapped;
+	}
+
+	_stats.framesAtMin += _scale <= settings.minScale && error < 0.0f ? 1 : 0;
+	_stats.scale = _scale;
+	_stats.smoothedMs = _smoothedMs;
+	_stats.error = error;
+	_stats.output = output;
+
+	return _scale;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+
+struct DynamicResolutionSettings
+{
+	float    targetMs;        // frame budget
+	float    headroom;        // fraction of the budget aimed for so noise doesn't cross it
+	float    minScale;        // of the output size, per axis
+	float    maxScale;
+	float    kp;              // gains on the relative error of the smoothed frame time
+	float    ki;
+	float    kd;
+	float    smoothing;       // weight of the newest frame in the running average
+	float    spikeRatio;      // a frame this many times the average is a hitch, not load
+	float    deadband;        // relative errors smaller than this are left alone
+	float    maxError;        // one slow frame can't ask for more than this
+	float    maxStepDown;     // largest change in pixel count per frame
+	float    maxStepUp;
+	uint32_t raiseDelay;      // frames in a row under budget before the scale goes up
+	uint32_t scaleSteps;      // the scale snaps to 1 / scaleSteps so targets don't change every frame
+};
+
+void InitDynamicResolutionSettings(DynamicResolutionSettings& settings);
+
+struct DynamicResolutionStats
+{
+	float    scale;
+	float    smoothedMs;
+	float    error;           // relative, positive when under budget
+	float    output;          // last change asked of the pixel count
+	uint32_t frames;
+	uint32_t changes;         // frames the scale moved
+	uint32_t raises;
+	uint32_t drops;
+	uint32_t framesOverBudget;
+	uint32_t framesAtMin;
+	uint32_t spikes;          // lone hitches left out of the average
+};
+
+//--------------------------------------------------------------------------------------
+// Picks the render scale from measured frame times. GPU cost is taken to follow the
+// pixel count, so the PID loop works on the square of the scale: a frame at twice the
+// budget asks for half the pixels, not half the width. Drops happen at once while
+// raises need raiseDelay frames in a row with room to spare, a lone hitch is ignored,
+// and the result snaps to fixed steps with a deadband around the target, so a steady
+// load settles on one scale instead of hunting. Pure CPU, the bench replays recorded
+// traces through it.
+//--------------------------------------------------------------------------------------
+class DynamicResolutionController
+{
+private:
+	DynamicResolutionSettings _settings;
+	float                     _pixels;       // unsnapped scale squared, what the loop drives
+	float                     _scale;        // snapped, what the renderer uses
+	float                     _smoothedMs;
+	float                     _lastError;
+	float                     _previousError;
+	uint32_t                  _framesUnder;
+	bool                      _lastSpike;
+	DynamicResolutionStats    _stats;
+
+private:
+	float Snap(float scale) const;
+
+public:
+	DynamicResolutionController();
+
+	void Init(const DynamicResolutionSettings& settings);
+	void Reset();
+
+	// Feed the time of the frame just finished, returns the scale for the next one
+	float Update(float frameMs);
+
+	// Holds the scale still, for comparisons at a fixed resolution
+	void SetFixedScale(float scale);
+
+	float GetScale() const { return _scale; }
+	const DynamicResolutionSettings& GetSettings() const { return _settings; }
+	const DynamicResolutionStats& GetStats() const { return _stats; }
+};
+
+// Pixel size of the scaled target, rounded to whole pixels and never zero
+inline uint32_t ScaleDimension(uint32_t size, float scale)
+{
+	uint32_t scaled = (uint32_t)(size * scale + 0.5f);
+	return scaled > 0 ? scaled : 1;
+}
@@ -4,8 +4,39 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 //--------------------------------------------------------------------------------------
 
+//--------------------------------------------------------------------------------------
+// Material permutations, the defines are set per MaterialFeature by the application
+//--------------------------------------------------------------------------------------
+#ifndef TEXTURED
+#define TEXTURED 0
+#endif
+
+#ifndef SPECULAR
+#define SPECULAR 0
+#endif
+
+#ifndef NORMAL_MAP
+#define NORMAL_MAP 0
+#endif
+
+#ifndef ALPHA_TEST
+#define ALPHA_TEST 0
+#endif
+
 Texture2D txDiffuse : register ( t0 );
+Texture2D txNormal : register ( t4 );
+Texture2DArray ShadowMap : register ( t5 );
+
+// Baked ambient and AO of static geometry, see LightmapBaker. Scaled by LightmapParams.y.
+Texture2D txLightmap : register ( t7 );
 SamplerState samLinear : register ( s0 );
+SamplerComparisonState samShadow : register ( s1 );
+
+// Clustered lights, see ClusteredLighting. Each light is 4 float4s:
+// position/range, colour/intensity, direction/cos outer, cos inner/type
+Buffer<float4> Lights : register( t1 );
+Buffer<uint2> ClusterRanges : register( t2 );
+Buffer<uint> LightIndices : register( t3 );
 
 //--------------------------------------------------------------------------------------
 // Constant Buffer Variables
@@ -16,17 +47,57 @@ cbuffer ConstantBuffer : register( b0 )
 	matrix World;
 	matrix View;
 	matrix Projection;
-	float4 DiffuseMtrl;
 	float4 DiffuseLight;
-	float4 AmbientMtrl;
 	float4 AmbientLight;
-	float4 SpecularMtrl;
 	float4 SpecularLight;
-	float SpecularPower;
 	float3 EyePosW;
 	float3 LightVecW;
+	float4 LightmapParams;
 }
 
+cbuffer ClusterConstants : register( b1 )
+{
+	uint TilesX;
+	uint TilesY;
+	uint Slices;
+	uint LightCount;
+	float2 ScreenSize;
+	float SliceScale;
+	float SliceBias;
+}
+
+cbuffer MaterialConstants : register( b2 )
+{
+	float4 DiffuseMtrl;
+	float4 AmbientMtrl;
+	float4 SpecularMtrl;
+	float SpecularPower;
+	float AlphaCutoff;
+}
+
+cbuffer ShadowConstants : register( b3 )
+{
+	matrix CascadeViewProj[4];
+	float4 CascadeSplits;
+	float ShadowTexelSize;
+	uint CascadeCount;
+}
+
+// Bone transforms of the skinned mesh being drawn, see SkinMatrix
+cbuffer SkinConstants : register( b4 )
+{
+	row_major float3x4 Bones[64];
+}
+
+// World to clip for debug lines, pixels to clip for the overlay
+cbuffer DebugConstants : register( b5 )
+{
+	matrix DebugTransform;
+}
+
+Texture2D DebugFont : register( t6 );
+SamplerState DebugSampler : register( s2 );
+
 //--------------------------------------------------------------------------------------
 struct VS_OUTPUT
 {
@@ -36,22 +107,23 @@ struct VS_OUTPUT
 
 	float3 NormalW : NORMAL;
 	float4 PosW : POSITION;
+	float ViewZ : TEXCOORD1;
+	float2 LightmapTex : TEXCOORD2;
 
 };
 
 //--------------------------------------------------------------------------------------
 // Vertex Shader
 //--------------------------------------------------------------------------------------
-VS_OUTPUT VS( float4 Pos : POSITION, float3 NormalL : NORMAL, float2 Tex : TEXCOORD0) //direct correlation in order
+VS_OUTPUT VS( float4 Pos : POSITION, float3 NormalL : NORMAL, float2 Tex : TEXCOORD0, float2 LightmapTex : TEXCOORD1) //direct correlation in order
 {
-	float4 textureColour = txDiffuse.Sample(samLinear, Tex);
-
     VS_OUTPUT output = (VS_OUTPUT)0;
     output.Pos = mul( Pos, World );
 	
 	output.PosW = output.Pos;
 
 	output.Pos = mul( output.Pos, View );
+	output.ViewZ = output.Pos.z;
 	output.Pos = mul(output.Pos, Projection);
 
 	// leave in VS
@@ -60,38 +132,279 @@ VS_OUTPUT VS( float4 Pos : POSITION, float3 NormalL : NORMAL, float2 Tex : TEXCO
 	// end
 
 	output.Tex = Tex;
+	output.LightmapTex = LightmapTex;
 	//--
     return output;
 }
 
+//--------------------------------------------------------------------------------------
+// Skinned Vertex Shader
+//--------------------------------------------------------------------------------------
+VS_OUTPUT VS_Skinned( float4 Pos : POSITION, float3 NormalL : NORMAL, float2 Tex : TEXCOORD0, uint4 BoneIndices : BLENDINDICES, float4 BoneWeights : BLENDWEIGHT )
+{
+	// Blend the matrices once instead of transforming four times
+	float3x4 skin = Bones[BoneIndices.x] * BoneWeights.x;
+	skin += Bones[BoneIndices.y] * BoneWeights.y;
+	skin += Bones[BoneIndices.z] * BoneWeights.z;
+	skin += Bones[BoneIndices.w] * BoneWeights.w;
+
+	float4 posL = float4(mul(skin, float4(Pos.xyz, 1.0f)), 1.0f);
+	float3 normalL = mul(skin, float4(NormalL, 0.0f));
+
+	return VS(posL, normalL, Tex, float2(0.0f, 0.0f));
+}
+
+
+//--------------------------------------------------------------------------------------
+// Clustered point and spot lights
+//--------------------------------------------------------------------------------------
+void AccumulateClusterLights(float4 svPos, float viewZ, float3 posW, float3 normalW, float3 toEye, inout float3 diffuse, inout float3 specular)
+{
+	uint slice = (uint)max(floor(log(viewZ) * SliceScale + SliceBias), 0.0f);
+	slice = min(slice, Slices - 1);
+
+	uint2 tile = min(uint2(svPos.xy / ScreenSize * float2(TilesX, TilesY)), uint2(TilesX - 1, TilesY - 1));
+	uint2 range = ClusterRanges.Load(tile.x + tile.y * TilesX + slice * TilesX * TilesY);
+
+	for (uint i = 0; i < range.y; i++)
+	{
+		uint lightIndex = LightIndices.Load(range.x + i) * 4;
+
+		float4 posRange = Lights.Load(lightIndex);
+		float4 colorIntensity = Lights.Load(lightIndex + 1);
+
+		float3 lightVec = posRange.xyz - posW;
+		float dist = length(lightVec);
+		lightVec /= dist;
+
+		float falloff = saturate(1.0f - dist / posRange.w);
+		float attenuation = falloff * falloff * colorIntensity.w;
+
+		float4 cosInnerType = Lights.Load(lightIndex + 3);
+
+		if (cosInnerType.y > 0.5f)
+		{
+			float4 dirCosOuter = Lights.Load(lightIndex + 2);
+			attenuation *= smoothstep(dirCosOuter.w, cosInnerType.x, dot(-lightVec, dirCosOuter.xyz));
+		}
+
+		float diffuseAmount = max(dot(lightVec, normalW), 0.0f);
+
+		if (diffuseAmount > 0.0f)
+		{
+			diffuse += diffuseAmount * attenuation * colorIntensity.rgb;
+
+#if SPECULAR
+			float3 r = reflect(-lightVec, normalW);
+			specular += pow(max(dot(r, toEye), 0.0f), SpecularPower) * attenuation * colorIntensity.rgb;
+#endif
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Directional light shadows, 3x3 PCF in the cascade the pixel falls into
+//--------------------------------------------------------------------------------------
+float ShadowFactor(float3 posW, float viewZ)
+{
+	// Unused cascades have their split pushed out to infinity
+	uint cascade = (uint)dot((float4)(viewZ > CascadeSplits), 1.0f);
+
+	if (cascade >= CascadeCount)
+		return 1.0f;
+
+	float4 posL = mul(float4(posW, 1.0f), CascadeViewProj[cascade]);
+	float2 uv = posL.xy * float2(0.5f, -0.5f) + 0.5f;
+
+	float shadow = 0.0f;
+
+	[unroll]
+	for (int y = -1; y <= 1; y++)
+	{
+		[unroll]
+		for (int x = -1; x <= 1; x++)
+		{
+			float3 coord = float3(uv + float2(x, y) * ShadowTexelSize, cascade);
+			shadow += ShadowMap.SampleCmpLevelZero(samShadow, coord, posL.z);
+		}
+	}
+
+	return shadow / 9.0f;
+}
+
+#if NORMAL_MAP
+//--------------------------------------------------------------------------------------
+// Tangent space normal mapping without stored tangents, the frame is rebuilt from the
+// screen space derivatives of the position and UVs
+//--------------------------------------------------------------------------------------
+float3 PerturbNormal(float3 normalW, float3 posW, float2 tex)
+{
+	float3 dp1 = ddx(posW);
+	float3 dp2 = ddy(posW);
+	float2 duv1 = ddx(tex);
+	float2 duv2 = ddy(tex);
+
+	float3 dp2perp = cross(dp2, normalW);
+	float3 dp1perp = cross(normalW, dp1);
+	float3 tangent = dp2perp * duv1.x + dp1perp * duv2.x;
+	float3 bitangent = dp2perp * duv1.y + dp1perp * duv2.y;
+
+	float invMax = rsqrt(max(dot(tangent, tangent), dot(bitangent, bitangent)));
+	float3x3 tbn = float3x3(tangent * invMax, bitangent * invMax, normalW);
+
+	float3 normalT = txNormal.Sample(samLinear, tex).xyz * 2.0f - 1.0f;
+
+	return normalize(mul(normalT, tbn));
+}
+#endif
 
 //--------------------------------------------------------------------------------------
 // Pixel Shader
 //--------------------------------------------------------------------------------------
 float4 PS( VS_OUTPUT input ) : SV_Target
 {
+	float4 albedo = DiffuseMtrl;
+
+#if TEXTURED
+	albedo *= txDiffuse.Sample(samLinear, input.Tex);
+#endif
+
+#if ALPHA_TEST
+	clip(albedo.a - AlphaCutoff);
+#endif
+
 	float3 lightVec = normalize(LightVecW);
 	float3 normalW = normalize(input.NormalW);
 
+#if NORMAL_MAP
+	normalW = PerturbNormal(normalW, input.PosW.xyz, input.Tex);
+#endif
+
 	float3 toEye = normalize(EyePosW - input.PosW.xyz); // Move to PS
 
-	float3 r = reflect(-lightVec, normalW);
-	float specularAmount = pow(max(dot(r, toEye), 0.0f), SpecularPower);
 	float diffuseAmount = max(dot(lightVec, normalW), 0.0f);
+	float shadow = ShadowFactor(input.PosW.xyz, input.ViewZ);
 
-	if (diffuseAmount <= 0.0f)
-	{
-		specularAmount = 0.0f;
-	}
+	float3 clusterDiffuse = 0.0f;
+	float3 clusterSpecular = 0.0f;
+	AccumulateClusterLights(input.Pos, input.ViewZ, input.PosW.xyz, normalW, toEye, clusterDiffuse, clusterSpecular);
+
+	float3 ambientLight = AmbientLight.rgb;
+
+	if (LightmapParams.x > 0.0f)
+		ambientLight = txLightmap.Sample(samLinear, input.LightmapTex).rgb * LightmapParams.y;
 
-	float3 ambient = (AmbientMtrl * AmbientLight).rgb;
-	float3 diffuse = diffuseAmount * (DiffuseMtrl * DiffuseLight).rgb;
-	float3 specular = specularAmount * (SpecularMtrl * SpecularLight).rgb;
+	float3 ambient = AmbientMtrl.rgb * ambientLight;
+	float3 diffuse = (diffuseAmount * shadow * DiffuseLight.rgb + clusterDiffuse) * albedo.rgb;
 
 	float4 color;
 
-	color.rgb = ambient + diffuse + specular;
-	color.a = DiffuseMtrl.a;
+	color.rgb = ambient + diffuse;
+
+#if SPECULAR
+	float3 r = reflect(-lightVec, normalW);
+	float specularAmount = diffuseAmount > 0.0f ? pow(max(dot(r, toEye), 0.0f), SpecularPower) : 0.0f;
+
+	color.rgb += (specularAmount * shadow * SpecularLight.rgb + clusterSpecular) * SpecularMtrl.rgb;
+#endif
+
+	color.a = albedo.a;
 
     return color;
 }
+
+//--------------------------------------------------------------------------------------
+// Particles, a camera facing quad per instance built from SV_VertexID
+//--------------------------------------------------------------------------------------
+struct PARTICLE_OUTPUT
+{
+	float4 Pos : SV_POSITION;
+	float4 Color : COLOR0;
+	float2 Corner : TEXCOORD0;
+};
+
+PARTICLE_OUTPUT VS_Particle( uint VertexId : SV_VertexID, float4 PosSize : POSITION, float4 Color : COLOR )
+{
+	PARTICLE_OUTPUT output;
+
+	// Strip order (-1,-1) (-1,1) (1,-1) (1,1), offset in view space so it faces the camera
+	float2 corner = float2((VertexId & 2) ? 1.0f : -1.0f, (VertexId & 1) ? 1.0f : -1.0f);
+
+	float4 posV = mul(float4(PosSize.xyz, 1.0f), View);
+	posV.xy += corner * PosSize.w;
+
+	output.Pos = mul(posV, Projection);
+	output.Color = Color;
+	output.Corner = corner;
+
+	return output;
+}
+
+float4 PS_Particle( PARTICLE_OUTPUT input ) : SV_Target
+{
+	// Round soft edge, colour is premultiplied so alpha fades with it
+	float falloff = saturate(1.0f - dot(input.Corner, input.Corner));
+	return input.Color * (falloff * falloff);
+}
+
+//--------------------------------------------------------------------------------------
+// Debug lines and overlay, the font atlas holds coverage and a solid glyph for the rest
+//--------------------------------------------------------------------------------------
+struct DEBUG_OUTPUT
+{
+	float4 Pos : SV_POSITION;
+	float4 Color : COLOR0;
+	float2 Tex : TEXCOORD0;
+};
+
+DEBUG_OUTPUT VS_Debug( float3 Pos : POSITION, float4 Color : COLOR, float2 Tex : TEXCOORD0 )
+{
+	DEBUG_OUTPUT output;
+	output.Pos = mul(float4(Pos, 1.0f), DebugTransform);
+	output.Color = Color;
+	output.Tex = Tex;
+
+	return output;
+}
+
+float4 PS_Debug( DEBUG_OUTPUT input ) : SV_Target
+{
+	return float4(input.Color.rgb, input.Color.a * DebugFont.Sample(DebugSampler, input.Tex).r);
+}
+
+//--------------------------------------------------------------------------------------
+// Upscale. The scene is drawn into the top left of a target sized for the largest scale
+// and stretched over the back buffer by one triangle that covers the screen.
+//--------------------------------------------------------------------------------------
+cbuffer UpscaleConstants : register( b6 )
+{
+	float2 UpscaleUVScale;  // render size over target size
+	float2 UpscaleUVClamp;  // centre of the last texel drawn this frame
+}
+
+Texture2D SceneColor : register( t8 );
+SamplerState UpscaleSampler : register( s3 );
+
+struct UPSCALE_OUTPUT
+{
+	float4 Pos : SV_POSITION;
+	float2 Tex : TEXCOORD0;
+};
+
+UPSCALE_OUTPUT VS_Upscale( uint VertexId : SV_VertexID )
+{
+	UPSCALE_OUTPUT output;
+
+	// (0,0) (2,0) (0,2) across the screen, the clipper drops what lies outside it
+	float2 uv = float2((VertexId << 1) & 2, VertexId & 2);
+	output.Pos = float4(uv * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f), 0.0f, 1.0f);
+	output.Tex = uv * UpscaleUVScale;
+
+	return output;
+}
+
+float4 PS_Upscale( UPSCALE_OUTPUT input ) : SV_Target
+{
+	// Filtering at the edge would otherwise pull in stale pixels from outside the viewport
+	return SceneColor.Sample(UpscaleSampler, min(input.Tex, UpscaleUVClamp));
+}
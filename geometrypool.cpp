@@ -0,0 +1,282 @@
+#include "geometrypool.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const char* const StreamNames[GeometryPoolMaxStreams] = { "GeometryPoolStream0", "GeometryPoolStream1" };
+
+static const uint32_t EmptyRange = 0xFFFFFFFF;
+
+GeometryPool::GeometryPool()
+{
+	for (uint32_t i = 0; i < GeometryPoolMaxStreams; i++)
+	{
+		_streamStrides[i] = 0;
+		_pStreams[i] = nullptr;
+	}
+
+	_streamCount = 0;
+	_pIndexBuffer = nullptr;
+	_bufferVertexCapacity = 0;
+	_bufferIndexCapacity = 0;
+	_dirtyVertices.begin = EmptyRange;
+	_dirtyVertices.end = 0;
+	_dirtyIndices.begin = EmptyRange;
+	_dirtyIndices.end = 0;
+
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+void GeometryPool::Init(const uint32_t* pStreamStrides, uint32_t streamCount, uint32_t vertexCapacity, uint32_t indexCapacity)
+{
+	_streamCount = std::min(streamCount, GeometryPoolMaxStreams);
+
+	// Never empty, D3D won't create a zero sized buffer
+	vertexCapacity = std::max(vertexCapacity, 1u);
+	indexCapacity = std::max(indexCapacity, 1u);
+
+	for (uint32_t i = 0; i < _streamCount; i++)
+	{
+		_streamStrides[i] = pStreamStrides[i];
+		_streamData[i].assign((size_t)vertexCapacity * _streamStrides[i], 0);
+	}
+
+	_indexData.assign(indexCapacity, 0);
+	_vertexAllocator.Init(vertexCapacity);
+	_indexAllocator.Init(indexCapacity);
+}
+
+void GeometryPool::Release(D3D11TrackedDevice& device)
+{
+	for (uint32_t i = 0; i < GeometryPoolMaxStreams; i++)
+		device.Release(_pStreams[i]);
+
+	device.Release(_pIndexBuffer);
+	_bufferVertexCapacity = 0;
+	_bufferIndexCapacity = 0;
+}
+
+void GeometryPool::MarkVertices(uint32_t begin, uint32_t end)
+{
+	_dirtyVertices.begin = std::min(_dirtyVertices.begin, begin);
+	_dirtyVertices.end = std::max(_dirtyVertices.end, end);
+}
+
+void GeometryPool::MarkIndices(uint32_t begin, uint32_t end)
+{
+	_dirtyIndices.begin = std::min(_dirtyIndices.begin, begin);
+	_dirtyIndices.end = std::max(_dirtyIndices.end, end);
+}
+
+GeometryAllocation GeometryPool::Alloc(uint32_t vertexCount, uint32_t indexCount)
+{
+	GeometryAllocation allocation;
+	allocation.vertexBlock = _vertexAllocator.Alloc(vertexCount);
+	allocation.indexBlock = _indexAllocator.Alloc(indexCount);
+	allocation.vertexCount = vertexCount;
+	allocation.indexCount = indexCount;
+
+	// Full, or too fragmented for this one: double, the free space at the end takes it
+	if (allocation.vertexBlock == TlsfInvalidBlock && vertexCount > 0)
+	{
+		uint32_t capacity = std::max(_vertexAllocator.GetCapacity() * 2, _vertexAllocator.GetCapacity() + vertexCount);
+		_vertexAllocator.Grow(capacity);
+
+		for (uint32_t i = 0; i < _streamCount; i++)
+			_streamData[i].resize((size_t)capacity * _streamStrides[i], 0);
+
+		allocation.vertexBlock = _vertexAllocator.Alloc(vertexCount);
+	}
+
+	if (allocation.indexBlock == TlsfInvalidBlock && indexCount > 0)
+	{
+		uint32_t capacity = std::max(_indexAllocator.GetCapacity() * 2, _indexAllocator.GetCapacity() + indexCount);
+		_indexAllocator.Grow(capacity);
+		_indexData.resize(capacity, 0);
+
+		allocation.indexBlock = _indexAllocator.Alloc(indexCount);
+	}
+
+	return allocation;
+}
+
+void GeometryPool::Free(const GeometryAllocation& allocation)
+{
+	_vertexAllocator.Free(allocation.vertexBlock);
+	_indexAllocator.Free(allocation.indexBlock);
+}
+
+void GeometryPool::WriteVertices(const GeometryAllocation& allocation, uint32_t stream, const void* pVertices)
+{
+	if (stream >= _streamCount || allocation.vertexBlock == TlsfInvalidBlock)
+		return;
+
+	uint32_t first = _vertexAllocator.GetOffset(allocation.vertexBlock);
+	uint8_t* pDest = &_streamData[stream][(size_t)first * _streamStrides[stream]];
+	size_t bytes = (size_t)allocation.vertexCount * _streamStrides[stream];
+
+	if (pVertices != nullptr)
+		memcpy(pDest, pVertices, bytes);
+	else
+		memset(pDest, 0, bytes);
+
+	MarkVertices(first, first + allocation.vertexCount);
+}
+
+void GeometryPool::WriteIndices(const GeometryAllocation& allocation, const WORD* pIndices)
+{
+	if (allocation.indexBlock == TlsfInvalidBlock)
+		return;
+
+	uint32_t first = _indexAllocator.GetOffset(allocation.indexBlock);
+	memcpy(&_indexData[first], pIndices, sizeof(WORD) * allocation.indexCount);
+
+	MarkIndices(first, first + allocation.indexCount);
+}
+
+uint32_t GeometryPool::Defragment(uint32_t maxMoves)
+{
+	// Moves only ever go down, so memmove over the CPU copy in order is safe. Indices are
+	// relative to the base vertex and don't change when the vertices move.
+	_stats.moves = _vertexAllocator.Defragment(maxMoves, _moves);
+
+	for (size_t i = 0; i < _moves.size(); i++)
+	{
+		const TlsfMove& move = _moves[i];
+
+		for (uint32_t stream = 0; stream < _streamCount; stream++)
+		{
+			uint8_t* pData = _streamData[stream].data();
+			uint32_t stride = _streamStrides[stream];
+			memmove(pData + (size_t)move.to * stride, pData + (size_t)move.from * stride, (size_t)move.size * stride);
+		}
+
+		MarkVertices(move.to, move.from + move.size);
+	}
+
+	_stats.moves += _indexAllocator.Defragment(maxMoves, _moves);
+
+	for (size_t i = 0; i < _moves.size(); i++)
+	{
+		const TlsfMove& move = _moves[i];
+		memmove(&_indexData[move.to], &_indexData[move.from], sizeof(WORD) * move.size);
+		MarkIndices(move.to, move.from + move.size);
+	}
+
+	return _stats.moves;
+}
+
+HRESULT GeometryPool::CreateBuffers(D3D11TrackedDevice& device)
+{
+	bool recreate = _pIndexBuffer != nullptr;
+	Release(device);
+
+	uint32_t vertexCapacity = _vertexAllocator.GetCapacity();
+	uint32_t indexCapacity = _indexAllocator.GetCapacity();
+
+	D3D11_BUFFER_DESC bd;
+	ZeroMemory(&bd, sizeof(bd));
+	bd.Usage = D3D11_USAGE_DEFAULT;
+	bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+
+	D3D11_SUBRESOURCE_DATA InitData;
+	ZeroMemory(&InitData, sizeof(InitData));
+
+	HRESULT hr;
+
+	for (uint32_t i = 0; i < _streamCount; i++)
+	{
+		bd.ByteWidth = vertexCapacity * _streamStrides[i];
+		InitData.pSysMem = _streamData[i].data();
+
+		hr = device.CreateBuffer(&bd, &InitData, &_pStreams[i], GPU_RESOURCE(GPURES_GEOMETRY, StreamNames[i]));
+
+		if (FAILED(hr))
+			return hr;
+	}
+
+	bd.ByteWidth = indexCapacity * sizeof(WORD);
+	bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+	InitData.pSysMem = _indexData.data();
+
+	hr = device.CreateBuffer(&bd, &InitData, &_pIndexBuffer, GPU_RESOURCE(GPURES_GEOMETRY, "GeometryPoolIndices"));
+
+	if (FAILED(hr))
+		return hr;
+
+	_bufferVertexCapacity = vertexCapacity;
+	_bufferIndexCapacity = indexCapacity;
+	_stats.recreates += recreate ? 1 : 0;
+
+	return S_OK;
+}
+
+HRESULT GeometryPool::Flush(D3D11TrackedDevice& device, ID3D11DeviceContext* pContext)
+{
+	_stats.uploads = 0;
+
+	// Grown since the buffers were made, they are rebuilt from the CPU copy as a whole
+	if (_pIndexBuffer == nullptr || _bufferVertexCapacity != _vertexAllocator.GetCapacity() ||
+		_bufferIndexCapacity != _indexAllocator.GetCapacity())
+	{
+		HRESULT hr = CreateBuffers(device);
+
+		if (FAILED(hr))
+			return hr;
+	}
+	else if (pContext != nullptr)
+	{
+		D3D11_BOX box;
+		box.top = 0;
+		box.bottom = 1;
+		box.front = 0;
+		box.back = 1;
+
+		if (_dirtyVertices.begin < _dirtyVertices.end)
+		{
+			for (uint32_t i = 0; i < _streamCount; i++)
+			{
+				box.left = _dirtyVertices.begin * _streamStrides[i];
+				box.right = _dirtyVertices.end * _streamStrides[i];
+				pContext->UpdateSubresource(_pStreams[i], 0, &box, &_streamData[i][box.left], 0, 0);
+				_stats.uploads++;
+			}
+		}
+
+		if (_dirtyIndices.begin < _dirtyIndices.end)
+		{
+			box.left = _dirtyIndices.begin * sizeof(WORD);
+			box.right = _dirtyIndices.end * sizeof(WORD);
+			pContext->UpdateSubresource(_pIndexBuffer, 0, &box, &_indexData[_dirtyIndices.begin], 0, 0);
+			_stats.uploads++;
+		}
+	}
+	else
+	{
+		return S_OK;
+	}
+
+	_dirtyVertices.begin = EmptyRange;
+	_dirtyVertices.end = 0;
+	_dirtyIndices.begin = EmptyRange;
+	_dirtyIndices.end = 0;
+
+	return S_OK;
+}
+
+void GeometryPool::Bind(ID3D11DeviceContext* pContext) const
+{
+	UINT offsets[GeometryPoolMaxStreams] = {};
+
+	pContext->IASetVertexBuffers(0, _streamCount, _pStreams, _streamStrides, offsets);
+	pContext->IASetIndexBuffer(_pIndexBuffer, DXGI_FORMAT_R16_UINT, 0);
+}
+
+GeometryPoolStats GeometryPool::GetStats() const
+{
+	GeometryPoolStats stats = _stats;
+	stats.vertices = _vertexAllocator.GetStats();
+	stats.indices = _indexAllocator.GetStats();
+
+	return stats;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <windows.h>
+#include <d3d11_1.h>
+#include <vector>
+#include "gpuresourcesd3d11.h"
+#include "tlsf.h"
+
+const uint32_t GeometryPoolMaxStreams = 2;
+
+// One mesh in the pool. The blocks are handles, ask the pool for the offsets since
+// Defragment can move them.
+struct GeometryAllocation
+{
+	uint32_t vertexBlock;
+	uint32_t indexBlock;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+};
+
+struct GeometryPoolStats
+{
+	TlsfStats vertices;
+	TlsfStats indices;
+	uint32_t  uploads;     // UpdateSubresource calls by the last Flush
+	uint32_t  moves;       // blocks moved by the last Defragment
+	uint32_t  recreates;   // times the buffers were rebuilt to grow
+};
+
+//--------------------------------------------------------------------------------------
+// Static geometry in a few large buffers: every vertex stream and the 16 bit index buffer
+// are sub-allocated with a TlsfAllocator, so meshes are drawn with BaseVertexLocation
+// and StartIndexLocation and one Bind covers a whole pass. The streams are parallel, a
+// mesh's vertices sit at the same place in each. A CPU copy of everything is kept so
+// meshes can be added before the device exists, and growing or defragmenting is just an
+// upload of the ranges that changed on the next Flush.
+//--------------------------------------------------------------------------------------
+class GeometryPool
+{
+private:
+	struct DirtyRange
+	{
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	TlsfAllocator         _vertexAllocator;
+	TlsfAllocator         _indexAllocator;
+	std::vector<uint8_t>  _streamData[GeometryPoolMaxStreams];
+	std::vector<WORD>     _indexData;
+	uint32_t              _streamStrides[GeometryPoolMaxStreams];
+	uint32_t              _streamCount;
+	ID3D11Buffer*         _pStreams[GeometryPoolMaxStreams];
+	ID3D11Buffer*         _pIndexBuffer;
+	uint32_t              _bufferVertexCapacity;   // of the buffers, the allocators may have grown past them
+	uint32_t              _bufferIndexCapacity;
+	DirtyRange            _dirtyVertices;
+	DirtyRange            _dirtyIndices;
+	std::vector<TlsfMove> _moves;
+	GeometryPoolStats     _stats;
+
+private:
+	void MarkVertices(uint32_t begin, uint32_t end);
+	void MarkIndices(uint32_t begin, uint32_t end);
+	HRESULT CreateBuffers(D3D11TrackedDevice& device);
+
+public:
+	GeometryPool();
+
+	void Init(const uint32_t* pStreamStrides, uint32_t streamCount, uint32_t vertexCapacity, uint32_t indexCapacity);
+	void Release(D3D11TrackedDevice& device);
+
+	// Space for a mesh, the pool grows when it is full. Fill it with Write before Flush.
+	GeometryAllocation Alloc(uint32_t vertexCount, uint32_t indexCount);
+	void Free(const GeometryAllocation& allocation);
+
+	// Streams the pool was set up without, or given nullptr, are zeroed
+	void WriteVertices(const GeometryAllocation& allocation, uint32_t stream, const void* pVertices);
+	void WriteIndices(const GeometryAllocation& allocation, const WORD* pIndices);
+
+	// Compacts both buffers, moving at most maxMoves meshes. Draws pick the new offsets up
+	// straight away, the buffers catch up on the next Flush.
+	uint32_t Defragment(uint32_t maxMoves);
+
+	// Creates the buffers on first use or after growing, otherwise uploads what changed.
+	// The context is only needed when there is something to upload.
+	HRESULT Flush(D3D11TrackedDevice& device, ID3D11DeviceContext* pContext);
+
+	// Every stream from slot 0 and the index buffer
+	void Bind(ID3D11DeviceContext* pContext) const;
+
+	INT GetBaseVertex(const GeometryAllocation& allocation) const { return (INT)_vertexAllocator.GetOffset(allocation.vertexBlock); }
+	UINT GetFirstIndex(const GeometryAllocation& allocation) const { return _indexAllocator.GetOffset(allocation.indexBlock); }
+	ID3D11Buffer* GetStream(uint32_t stream) const { return _pStreams[stream]; }
+
+	GeometryPoolStats GetStats() const;
+};
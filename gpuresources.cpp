@@ -0,0 +1,243 @@
+#include "gpuresources.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+GpuResourceTracker::GpuResourceTracker()
+{
+	for (uint32_t i = 0; i < GPURES_COUNT; i++)
+		_stats[i] = GpuResourceCategoryStats();
+
+	_alertFunc = nullptr;
+	_pAlertData = nullptr;
+	_serial = 0;
+}
+
+void GpuResourceTracker::SetBudget(GpuResourceCategory category, uint64_t bytes, bool hard)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_stats[category].budget = bytes;
+	_stats[category].hardBudget = hard;
+	_stats[category].overBudget = bytes != 0 && _stats[category].liveBytes > bytes;
+}
+
+void GpuResourceTracker::SetAlertCallback(GpuBudgetAlertFunc func, void* pData)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_alertFunc = func;
+	_pAlertData = pData;
+}
+
+bool GpuResourceTracker::CanCreate(GpuResourceCategory category, uint64_t bytes) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	const GpuResourceCategoryStats& stats = _stats[category];
+
+	return !stats.hardBudget || stats.budget == 0 || stats.liveBytes + bytes <= stats.budget;
+}
+
+void GpuResourceTracker::Register(const void* handle, const GpuResourceSite& site, uint64_t bytes)
+{
+	if (handle == nullptr)
+		return;
+
+	GpuBudgetAlertFunc alertFunc = nullptr;
+	void* pAlertData = nullptr;
+	uint64_t liveBytes = 0;
+	uint64_t budget = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		auto existing = _records.find(handle);
+
+		// Identical state descriptions give back the live object with another reference,
+		// a second owner rather than a second object
+		if (existing != _records.end() && existing->second.site.category == GPURES_STATE && site.category == GPURES_STATE)
+		{
+			existing->second.references++;
+			return;
+		}
+
+		// Other handles are only reused once the API frees an object, a stale record
+		// means its release went around the tracker
+		if (existing != _records.end())
+		{
+			GpuResourceCategoryStats& old = _stats[existing->second.site.category];
+			old.liveCount--;
+			old.liveBytes -= existing->second.bytes;
+		}
+
+		Record& record = _records[handle];
+		record.site = site;
+		record.bytes = bytes;
+		record.serial = _serial++;
+		record.references = 1;
+
+		GpuResourceCategoryStats& stats = _stats[site.category];
+		stats.liveCount++;
+		stats.createdCount++;
+		stats.liveBytes += bytes;
+		stats.peakBytes = std::max(stats.peakBytes, stats.liveBytes);
+
+		if (stats.budget != 0 && stats.liveBytes > stats.budget && !stats.overBudget)
+		{
+			stats.overBudget = true;
+			alertFunc = _alertFunc;
+			pAlertData = _pAlertData;
+			liveBytes = stats.liveBytes;
+			budget = stats.budget;
+		}
+	}
+
+	// Outside the lock so the callback can query the tracker
+	if (alertFunc)
+		alertFunc(site.category, liveBytes, budget, pAlertData);
+}
+
+bool GpuResourceTracker::Unregister(const void* handle)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto it = _records.find(handle);
+
+	if (it == _records.end())
+		return false;
+
+	if (--it->second.references > 0)
+		return true;
+
+	GpuResourceCategoryStats& stats = _stats[it->second.site.category];
+	stats.liveCount--;
+	stats.liveBytes -= it->second.bytes;
+
+	if (stats.liveBytes <= stats.budget)
+		stats.overBudget = false;
+
+	_records.erase(it);
+
+	return true;
+}
+
+GpuResourceCategoryStats GpuResourceTracker::GetStats(GpuResourceCategory category) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	return _stats[category];
+}
+
+uint32_t GpuResourceTracker::GetLiveCount() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	return (uint32_t)_records.size();
+}
+
+uint64_t GpuResourceTracker::GetLiveBytes() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	uint64_t bytes = 0;
+
+	for (uint32_t i = 0; i < GPURES_COUNT; i++)
+		bytes += _stats[i].liveBytes;
+
+	return bytes;
+}
+
+uint32_t GpuResourceTracker::BuildLeakReport(std::string& report) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	report.clear();
+
+	if (_records.empty())
+		return 0;
+
+	std::vector<const Record*> live;
+	live.reserve(_records.size());
+
+	for (auto it = _records.begin(); it != _records.end(); ++it)
+		live.push_back(&it->second);
+
+	std::sort(live.begin(), live.end(), [](const Record* a, const Record* b) { return a->serial < b->serial; });
+
+	char line[512];
+
+	snprintf(line, sizeof(line), "%u GPU resources were never released:\n", (unsigned)live.size());
+	report += line;
+
+	for (size_t i = 0; i < live.size(); i++)
+	{
+		const GpuResourceSite& site = live[i]->site;
+
+		snprintf(line, sizeof(line), "  %s(%d): %s '%s', %llu bytes\n", site.file ? site.file : "?", site.line,
+				 GetCategoryName(site.category), site.name ? site.name : "", (unsigned long long)live[i]->bytes);
+		report += line;
+	}
+
+	for (uint32_t i = 0; i < GPURES_COUNT; i++)
+	{
+		if (_stats[i].liveCount == 0)
+			continue;
+
+		snprintf(line, sizeof(line), "  %s: %u objects, %llu bytes\n", GetCategoryName((GpuResourceCategory)i),
+				 _stats[i].liveCount, (unsigned long long)_stats[i].liveBytes);
+		report += line;
+	}
+
+	return (uint32_t)live.size();
+}
+
+const char* GpuResourceTracker::GetCategoryName(GpuResourceCategory category)
+{
+	switch (category)
+	{
+	case GPURES_GEOMETRY: return "Geometry";
+	case GPURES_CONSTANTS: return "Constants";
+	case GPURES_STRUCTURED: return "Structured";
+	case GPURES_TEXTURE: return "Texture";
+	case GPURES_RENDER_TARGET: return "RenderTarget";
+	case GPURES_VIEW: return "View";
+	case GPURES_SHADER: return "Shader";
+	case GPURES_STATE: return "State";
+	default: return "Unknown";
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// TrackedRenderGraphBackend
+//--------------------------------------------------------------------------------------
+void TrackedRenderGraphBackend::Init(RenderGraphBackend* pBackend, GpuResourceTracker* pTracker)
+{
+	_pBackend = pBackend;
+	_pTracker = pTracker;
+}
+
+void* TrackedRenderGraphBackend::CreateTexture(const RenderGraphTextureDesc& desc, const char* name)
+{
+	void* pTexture = _pBackend->CreateTexture(desc, name);
+
+	// The graph's own names are static strings, so they can be kept
+	if (pTexture)
+		_pTracker->Register(pTexture, GPU_RESOURCE(GPURES_RENDER_TARGET, name), desc.GetSizeInBytes());
+
+	return pTexture;
+}
+
+void TrackedRenderGraphBackend::DestroyTexture(void* pTexture)
+{
+	if (pTexture)
+		_pTracker->Unregister(pTexture);
+
+	_pBackend->DestroyTexture(pTexture);
+}
+
+void TrackedRenderGraphBackend::ApplyBarriers(const RenderGraphBarrier* pBarriers, uint32_t count)
+{
+	_pBackend->ApplyBarriers(pBarriers, count);
+}
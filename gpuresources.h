@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "rendergraph.h"
+
+// What a device object is used for. Budgets and the report are per category.
+enum GpuResourceCategory
+{
+	GPURES_GEOMETRY = 0,
+	GPURES_CONSTANTS,
+	GPURES_STRUCTURED,
+	GPURES_TEXTURE,
+	GPURES_RENDER_TARGET,
+	GPURES_VIEW,
+	GPURES_SHADER,
+	GPURES_STATE,
+	GPURES_COUNT
+};
+
+// Where a device object was created. Use GPU_RESOURCE so the file and line are filled in.
+struct GpuResourceSite
+{
+	GpuResourceCategory category;
+	const char*         name;
+	const char*         file;
+	int                 line;
+};
+
+#define GPU_RESOURCE(category, name) GpuResourceSite{ (category), (name), __FILE__, __LINE__ }
+
+struct GpuResourceCategoryStats
+{
+	uint32_t liveCount;
+	uint32_t createdCount;
+	uint64_t liveBytes;   // estimated
+	uint64_t peakBytes;
+	uint64_t budget;      // 0 for none
+	bool     hardBudget;
+	bool     overBudget;
+};
+
+// Called when a category goes over its budget, once until it drops back under
+typedef void (*GpuBudgetAlertFunc)(GpuResourceCategory category, uint64_t liveBytes, uint64_t budget, void* pData);
+
+//--------------------------------------------------------------------------------------
+// Accounting for device objects. Every object is registered with its handle when it is
+// created and unregistered when its owner releases it, so whatever is still registered
+// at shutdown leaked and the report says where it came from. Byte sizes are estimates
+// from the creation descriptions, the driver may pad them. Knows nothing about the API,
+// handles are only compared.
+//--------------------------------------------------------------------------------------
+class GpuResourceTracker
+{
+private:
+	struct Record
+	{
+		GpuResourceSite site;
+		uint64_t        bytes;
+		uint64_t        serial;
+		uint32_t        references;  // owners of a shared state object
+	};
+
+	mutable std::mutex                         _mutex;
+	std::unordered_map<const void*, Record>    _records;
+	GpuResourceCategoryStats                   _stats[GPURES_COUNT];
+	GpuBudgetAlertFunc                         _alertFunc;
+	void*                                      _pAlertData;
+	uint64_t                                   _serial;
+
+public:
+	GpuResourceTracker();
+
+	// Hard budgets make CanCreate fail, soft ones only alert
+	void SetBudget(GpuResourceCategory category, uint64_t bytes, bool hard = false);
+	void SetAlertCallback(GpuBudgetAlertFunc func, void* pData);
+
+	// False if a hard budget would be exceeded
+	bool CanCreate(GpuResourceCategory category, uint64_t bytes) const;
+
+	// The API hands out the same state object for identical descriptions, registering a
+	// live state handle again adds an owner instead of a second object
+	void Register(const void* handle, const GpuResourceSite& site, uint64_t bytes);
+
+	// False for handles that were never registered or are already gone. A shared state
+	// object stays live until its last owner unregisters it.
+	bool Unregister(const void* handle);
+
+	GpuResourceCategoryStats GetStats(GpuResourceCategory category) const;
+	uint32_t GetLiveCount() const;
+	uint64_t GetLiveBytes() const;
+
+	// Lists every live object in creation order with its site, returns how many there are
+	uint32_t BuildLeakReport(std::string& report) const;
+
+	static const char* GetCategoryName(GpuResourceCategory category);
+};
+
+//--------------------------------------------------------------------------------------
+// Puts the render graph's physical textures on the books, in front of any backend
+//--------------------------------------------------------------------------------------
+class TrackedRenderGraphBackend : public RenderGraphBackend
+{
+private:
+	RenderGraphBackend* _pBackend;
+	GpuResourceTracker* _pTracker;
+
+public:
+	TrackedRenderGraphBackend() : _pBackend(nullptr), _pTracker(nullptr) {}
+
+	void Init(RenderGraphBackend* pBackend, GpuResourceTracker* pTracker);
+
+	void* CreateTexture(const RenderGraphTextureDesc& desc, const char* name) override;
+	void DestroyTexture(void* pTexture) override;
+	void ApplyBarriers(const RenderGraphBarrier* pBarriers, uint32_t count) override;
+};
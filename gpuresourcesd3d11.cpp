@@ -0,0 +1,272 @@
+#include "gpuresourcesd3d11.h"
+
+// Bits per texel, block compressed formats are averaged over their 4x4 blocks
+static uint32_t GetFormatBits(DXGI_FORMAT format)
+{
+	switch (format)
+	{
+	case DXGI_FORMAT_R32G32B32A32_TYPELESS:
+	case DXGI_FORMAT_R32G32B32A32_FLOAT:
+	case DXGI_FORMAT_R32G32B32A32_UINT:
+		return 128;
+
+	case DXGI_FORMAT_R16G16B16A16_TYPELESS:
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+	case DXGI_FORMAT_R16G16B16A16_UNORM:
+	case DXGI_FORMAT_R32G32_TYPELESS:
+	case DXGI_FORMAT_R32G32_FLOAT:
+		return 64;
+
+	case DXGI_FORMAT_R16_TYPELESS:
+	case DXGI_FORMAT_R16_FLOAT:
+	case DXGI_FORMAT_R16_UNORM:
+	case DXGI_FORMAT_D16_UNORM:
+	case DXGI_FORMAT_R8G8_UNORM:
+		return 16;
+
+	case DXGI_FORMAT_R8_UNORM:
+	case DXGI_FORMAT_A8_UNORM:
+		return 8;
+
+	case DXGI_FORMAT_BC1_TYPELESS:
+	case DXGI_FORMAT_BC1_UNORM:
+	case DXGI_FORMAT_BC1_UNORM_SRGB:
+	case DXGI_FORMAT_BC4_TYPELESS:
+	case DXGI_FORMAT_BC4_UNORM:
+	case DXGI_FORMAT_BC4_SNORM:
+		return 4;
+
+	case DXGI_FORMAT_BC2_TYPELESS:
+	case DXGI_FORMAT_BC2_UNORM:
+	case DXGI_FORMAT_BC2_UNORM_SRGB:
+	case DXGI_FORMAT_BC3_TYPELESS:
+	case DXGI_FORMAT_BC3_UNORM:
+	case DXGI_FORMAT_BC3_UNORM_SRGB:
+	case DXGI_FORMAT_BC5_TYPELESS:
+	case DXGI_FORMAT_BC5_UNORM:
+	case DXGI_FORMAT_BC5_SNORM:
+	case DXGI_FORMAT_BC7_TYPELESS:
+	case DXGI_FORMAT_BC7_UNORM:
+	case DXGI_FORMAT_BC7_UNORM_SRGB:
+		return 8;
+
+	default:
+		// RGBA8, R16G16, depth and R32 are all 32 bits
+		return 32;
+	}
+}
+
+uint64_t EstimateTextureBytes(const D3D11_TEXTURE2D_DESC& desc)
+{
+	uint32_t bits = GetFormatBits(desc.Format);
+	bool blockCompressed = (desc.Format >= DXGI_FORMAT_BC1_TYPELESS && desc.Format <= DXGI_FORMAT_BC5_SNORM) ||
+						   (desc.Format >= DXGI_FORMAT_BC6H_TYPELESS && desc.Format <= DXGI_FORMAT_BC7_UNORM_SRGB);
+	uint32_t mipLevels = desc.MipLevels != 0 ? desc.MipLevels : 1;
+	uint64_t bytes = 0;
+
+	for (uint32_t mip = 0; mip < mipLevels; mip++)
+	{
+		uint64_t width = desc.Width >> mip;
+		uint64_t height = desc.Height >> mip;
+
+		if (width == 0) width = 1;
+		if (height == 0) height = 1;
+
+		// Block compressed mips never get smaller than one block
+		if (blockCompressed)
+		{
+			width = (width + 3) & ~3ull;
+			height = (height + 3) & ~3ull;
+		}
+
+		bytes += width * height * bits / 8;
+	}
+
+	uint32_t samples = desc.SampleDesc.Count != 0 ? desc.SampleDesc.Count : 1;
+
+	return bytes * desc.ArraySize * samples;
+}
+
+void D3D11TrackedDevice::Init(ID3D11Device* pDevice, GpuResourceTracker* pTracker)
+{
+	_pDevice = pDevice;
+	_pTracker = pTracker;
+}
+
+HRESULT D3D11TrackedDevice::CreateBuffer(const D3D11_BUFFER_DESC* pDesc, const D3D11_SUBRESOURCE_DATA* pInitialData,
+										 ID3D11Buffer** ppBuffer, const GpuResourceSite& site)
+{
+	if (!_pTracker->CanCreate(site.category, pDesc->ByteWidth))
+		return E_OUTOFMEMORY;
+
+	HRESULT hr = _pDevice->CreateBuffer(pDesc, pInitialData, ppBuffer);
+
+	if (SUCCEEDED(hr))
+		_pTracker->Register(*ppBuffer, site, pDesc->ByteWidth);
+
+	return hr;
+}
+
+HRESULT D3D11TrackedDevice::CreateTexture2D(const D3D11_TEXTURE2D_DESC* pDesc, const D3D11_SUBRESOURCE_DATA* pInitialData,
+											ID3D11Texture2D** ppTexture, const GpuResourceSite& site)
+{
+	uint64_t bytes = EstimateTextureBytes(*pDesc);
+
+	if (!_pTracker->CanCreate(site.category, bytes))
+		return E_OUTOFMEMORY;
+
+	HRESULT hr = _pDevice->CreateTexture2D(pDesc, pInitialData, ppTexture);
+
+	if (SUCCEEDED(hr))
+		_pTracker->Register(*ppTexture, site, bytes);
+
+	return hr;
+}
+
+// Views, shaders and states own next to no memory, they are only counted
+HRESULT D3D11TrackedDevice::CreateShaderResourceView(ID3D11Resource* pResource, const D3D11_SHADER_RESOURCE_VIEW_DESC* pDesc,
+													 ID3D11ShaderResourceView** ppView, const GpuResourceSite& site)
+{
+	HRESULT hr = _pDevice->CreateShaderResourceView(pResource, pDesc, ppView);
+
+	if (SUCCEEDED(hr))
+		_pTracker->Register(*ppView, site, 0);
+
+	return hr;
+}
+
+HRESULT D3D11TrackedDevice::CreateRenderTargetView(ID3D11Resource* pResource, const D3D11_RENDER_TARGET_VIEW_DESC* pDesc,
+												   ID3D11RenderTargetView** ppView, const GpuResourceSite& site)
+{
+	HRESULT hr = _pDevice->CreateRenderTargetView(pResource, pDesc, ppView);
+
+	if (SUCCEEDED(hr))
+		_pTracker->Register(*ppView, site, 0);
+
+	return hr;
+}
+
+HRESULT D3D11TrackedDevice::CreateDepthStencilView(ID3D11Resource* pResource, const D3D11_DEPTH_STENCIL_VIEW_DESC* pDesc,
+												   ID3D11DepthStencilView** ppView, const GpuResourceSite& site)
+{
+	HRESULT hr = _pDevice->CreateDepthStencilView(pResource, pDesc, ppView);
+
+	if (SUCCEEDED(hr))
+		_pTracker->Register(*ppView, site, 0);
+
+	return hr;
+}
+
+// Shaders are charged their bytecode, the driver's copy is about that size
+HRESULT D3D11TrackedDevice::CreateVertexShader(const void* pBytecode, SIZE_T length, ID3D11VertexShader** ppShader,
+											   const GpuResourceSite& site)
+{
+	HRESULT hr = _pDevice->CreateVertexShader(pBytecode, length, nullptr, ppShader);
+
+	if (SUCCEEDED(hr))
+		_pTracker->Register(*ppShader, site, length);
+
+	return hr;
+}
+
+HRESULT D3D11TrackedDevice::CreatePixelShader(const void* pBytecode, SIZE_T length, ID3D11PixelShader** ppShader,
+											  const GpuResourceSite& site)
+{
+	HRESULT hr = _pDevice->CreatePixelShader(pBytecode, length, nullptr, ppShader);
+
+	if (SUCCEEDED(hr))
+		_pTracker->Register(*ppShader, site, length);
+
+	return hr;
+}
+
+HRESULT D3D11TrackedDevice::CreateInputLayout(const D3D11_INPUT_ELEMENT_DESC* pElements, UINT count, const void* pBytecode,
+											  SIZE_T length, ID3D11InputLayout** ppLayout, const GpuResourceSite& site)
+{
+	HRESULT hr = _pDevice->CreateInputLayout(pElements, count, pBytecode, length, ppLayout);
+
+	if (SUCCEEDED(hr))
+		_pTracker->Register(*ppLayout, site, 0);
+
+	return hr;
+}
+
+// The device hands out the same object for identical state descriptions with an extra
+// reference, registering again just refreshes the record
+HRESULT D3D11TrackedDevice::CreateRasterizerState(const D3D11_RASTERIZER_DESC* pDesc, ID3D11RasterizerState** ppState,
+												  const GpuResourceSite& site)
+{
+	HRESULT hr = _pDevice->CreateRasterizerState(pDesc, ppState);
+
+	if (SUCCEEDED(hr))
+		_pTracker->Register(*ppState, site, 0);
+
+	return hr;
+}
+
+HRESULT D3D11TrackedDevice::CreateSamplerState(const D3D11_SAMPLER_DESC* pDesc, ID3D11SamplerState** ppState,
+											   const GpuResourceSite& site)
+{
+	HRESULT hr = _pDevice->CreateSamplerState(pDesc, ppState);
+
+	if (SUCCEEDED(hr))
+		_pTracker->Register(*ppState, site, 0);
+
+	return hr;
+}
+
+HRESULT D3D11TrackedDevice::CreateBlendState(const D3D11_BLEND_DESC* pDesc, ID3D11BlendState** ppState,
+											 const GpuResourceSite& site)
+{
+	HRESULT hr = _pDevice->CreateBlendState(pDesc, ppState);
+
+	if (SUCCEEDED(hr))
+		_pTracker->Register(*ppState, site, 0);
+
+	return hr;
+}
+
+HRESULT D3D11TrackedDevice::CreateDepthStencilState(const D3D11_DEPTH_STENCIL_DESC* pDesc, ID3D11DepthStencilState** ppState,
+													const GpuResourceSite& site)
+{
+	HRESULT hr = _pDevice->CreateDepthStencilState(pDesc, ppState);
+
+	if (SUCCEEDED(hr))
+		_pTracker->Register(*ppState, site, 0);
+
+	return hr;
+}
+
+HRESULT D3D11TrackedDevice::CreateQuery(const D3D11_QUERY_DESC* pDesc, ID3D11Query** ppQuery, const GpuResourceSite& site)
+{
+	HRESULT hr = _pDevice->CreateQuery(pDesc, ppQuery);
+
+	if (SUCCEEDED(hr))
+		_pTracker->Register(*ppQuery, site, 0);
+
+	return hr;
+}
+
+void D3D11TrackedDevice::TrackTextureView(ID3D11ShaderResourceView* pView, const GpuResourceSite& site)
+{
+	if (pView == nullptr)
+		return;
+
+	uint64_t bytes = 0;
+	ID3D11Resource* pResource = nullptr;
+	pView->GetResource(&pResource);
+
+	ID3D11Texture2D* pTexture = nullptr;
+	if (pResource && SUCCEEDED(pResource->QueryInterface(__uuidof(ID3D11Texture2D), (void**)&pTexture)))
+	{
+		D3D11_TEXTURE2D_DESC desc;
+		pTexture->GetDesc(&desc);
+		bytes = EstimateTextureBytes(desc);
+		pTexture->Release();
+	}
+
+	if (pResource) pResource->Release();
+
+	// The view holds the only reference to the texture, so it carries the texture's size
+	_pTracker->Register(pView, site, bytes);
+}
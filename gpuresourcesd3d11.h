@@ -0,0 +1,68 @@
+#pragma once
+
+#include <windows.h>
+#include <d3d11_1.h>
+#include "gpuresources.h"
+
+// Estimated size of a texture with all its mips and slices
+uint64_t EstimateTextureBytes(const D3D11_TEXTURE2D_DESC& desc);
+
+//--------------------------------------------------------------------------------------
+// Creates device objects and puts them on the tracker's books. Creation fails with
+// E_OUTOFMEMORY before reaching the device when a hard budget would be exceeded, and
+// Release() is the only way tracked objects should be let go of.
+//--------------------------------------------------------------------------------------
+class D3D11TrackedDevice
+{
+private:
+	ID3D11Device*       _pDevice;
+	GpuResourceTracker* _pTracker;
+
+public:
+	D3D11TrackedDevice() : _pDevice(nullptr), _pTracker(nullptr) {}
+
+	void Init(ID3D11Device* pDevice, GpuResourceTracker* pTracker);
+
+	HRESULT CreateBuffer(const D3D11_BUFFER_DESC* pDesc, const D3D11_SUBRESOURCE_DATA* pInitialData, ID3D11Buffer** ppBuffer,
+						 const GpuResourceSite& site);
+	HRESULT CreateTexture2D(const D3D11_TEXTURE2D_DESC* pDesc, const D3D11_SUBRESOURCE_DATA* pInitialData, ID3D11Texture2D** ppTexture,
+							const GpuResourceSite& site);
+
+	HRESULT CreateShaderResourceView(ID3D11Resource* pResource, const D3D11_SHADER_RESOURCE_VIEW_DESC* pDesc,
+									 ID3D11ShaderResourceView** ppView, const GpuResourceSite& site);
+	HRESULT CreateRenderTargetView(ID3D11Resource* pResource, const D3D11_RENDER_TARGET_VIEW_DESC* pDesc,
+								   ID3D11RenderTargetView** ppView, const GpuResourceSite& site);
+	HRESULT CreateDepthStencilView(ID3D11Resource* pResource, const D3D11_DEPTH_STENCIL_VIEW_DESC* pDesc,
+								   ID3D11DepthStencilView** ppView, const GpuResourceSite& site);
+
+	HRESULT CreateVertexShader(const void* pBytecode, SIZE_T length, ID3D11VertexShader** ppShader, const GpuResourceSite& site);
+	HRESULT CreatePixelShader(const void* pBytecode, SIZE_T length, ID3D11PixelShader** ppShader, const GpuResourceSite& site);
+	HRESULT CreateInputLayout(const D3D11_INPUT_ELEMENT_DESC* pElements, UINT count, const void* pBytecode, SIZE_T length,
+							  ID3D11InputLayout** ppLayout, const GpuResourceSite& site);
+
+	HRESULT CreateRasterizerState(const D3D11_RASTERIZER_DESC* pDesc, ID3D11RasterizerState** ppState, const GpuResourceSite& site);
+	HRESULT CreateSamplerState(const D3D11_SAMPLER_DESC* pDesc, ID3D11SamplerState** ppState, const GpuResourceSite& site);
+	HRESULT CreateBlendState(const D3D11_BLEND_DESC* pDesc, ID3D11BlendState** ppState, const GpuResourceSite& site);
+	HRESULT CreateDepthStencilState(const D3D11_DEPTH_STENCIL_DESC* pDesc, ID3D11DepthStencilState** ppState, const GpuResourceSite& site);
+	HRESULT CreateQuery(const D3D11_QUERY_DESC* pDesc, ID3D11Query** ppQuery, const GpuResourceSite& site);
+
+	// For views made elsewhere (the DDS loader), sized from the texture behind them
+	void TrackTextureView(ID3D11ShaderResourceView* pView, const GpuResourceSite& site);
+
+	// Releases the owner's reference and nulls the pointer, null pointers are ignored
+	template<class T>
+	void Release(T*& pObject)
+	{
+		if (pObject == nullptr)
+			return;
+
+		if (_pTracker)
+			_pTracker->Unregister(pObject);
+
+		pObject->Release();
+		pObject = nullptr;
+	}
+
+	ID3D11Device* GetDevice() const { return _pDevice; }
+	GpuResourceTracker* GetTracker() const { return _pTracker; }
+};
@@ -0,0 +1,183 @@
+#include "jobsystem.h"
+
+static thread_local uint32_t t_threadIndex = 0;
+
+JobSystem::JobSystem()
+{
+	_quit = false;
+	_func = nullptr;
+	_pData = nullptr;
+	_count = 0;
+	_grain = 1;
+	_chunkCount = 0;
+	_generation = 0;
+	_work = 0;
+	_chunksDone = 0;
+	_pendingGeneration = 0;
+}
+
+JobSystem::~JobSystem()
+{
+	Shutdown();
+}
+
+bool JobSystem::Init(uint32_t workerCount)
+{
+	Shutdown();
+
+	if (workerCount == 0)
+	{
+		uint32_t hardwareThreads = std::thread::hardware_concurrency();
+		workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+	}
+
+	_quit = false;
+	_workers.reserve(workerCount);
+
+	for (uint32_t i = 0; i < workerCount; i++)
+		_workers.emplace_back(&JobSystem::WorkerMain, this, i + 1);
+
+	return true;
+}
+
+void JobSystem::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+	}
+
+	_wake.notify_all();
+
+	for (size_t i = 0; i < _workers.size(); i++)
+		_workers[i].join();
+
+	_workers.clear();
+}
+
+uint32_t JobSystem::GetThreadIndex()
+{
+	return t_threadIndex;
+}
+
+bool JobSystem::RunChunk(uint32_t generation)
+{
+	uint64_t work = _work.load(std::memory_order_acquire);
+
+	for (;;)
+	{
+		if ((uint32_t)(work >> 32) != generation || (uint32_t)work >= _chunkCount.load(std::memory_order_relaxed))
+			return false;
+
+		if (_work.compare_exchange_weak(work, work + 1, std::memory_order_acq_rel))
+			break;
+	}
+
+	uint32_t chunk = (uint32_t)work;
+	uint32_t begin = chunk * _grain;
+	uint32_t end = begin + _grain < _count ? begin + _grain : _count;
+
+	_func(_pData, begin, end);
+
+	if (_chunksDone.fetch_add(1, std::memory_order_acq_rel) + 1 == _chunkCount.load(std::memory_order_relaxed))
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_done.notify_all();
+	}
+
+	return true;
+}
+
+void JobSystem::WorkerMain(uint32_t threadIndex)
+{
+	t_threadIndex = threadIndex;
+
+	uint32_t seenGeneration = 0;
+
+	for (;;)
+	{
+		uint32_t generation;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [&]() { return _quit || _generation != seenGeneration; });
+
+			if (_quit)
+				return;
+
+			generation = _generation;
+			seenGeneration = generation;
+		}
+
+		while (RunChunk(generation))
+		{
+		}
+	}
+}
+
+void JobSystem::ParallelFor(uint32_t count, uint32_t grain, JobRangeFunc func, void* pData)
+{
+	// A single chunk isn't worth waking anyone for
+	if (count != 0 && count <= grain)
+	{
+		func(pData, 0, count);
+		return;
+	}
+
+	Dispatch(count, grain, func, pData);
+	Wait();
+}
+
+void JobSystem::Dispatch(uint32_t count, uint32_t grain, JobRangeFunc func, void* pData)
+{
+	if (count == 0)
+		return;
+
+	if (grain == 0)
+		grain = 1;
+
+	// Nested submits run inline, as does everything when there are no workers
+	if (t_threadIndex != 0 || _workers.empty())
+	{
+		func(pData, 0, count);
+		return;
+	}
+
+	// Held until Wait so only one batch is ever in flight
+	_submitMutex.lock();
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_func = func;
+		_pData = pData;
+		_count = count;
+		_grain = grain;
+		_chunkCount = (count + grain - 1) / grain;
+		_chunksDone = 0;
+
+		_pendingGeneration = ++_generation;
+		_work.store((uint64_t)_pendingGeneration << 32, std::memory_order_release);
+	}
+
+	_wake.notify_all();
+}
+
+void JobSystem::Wait()
+{
+	// Inline batches finished inside Dispatch
+	if (t_threadIndex != 0 || _pendingGeneration == 0)
+		return;
+
+	while (RunChunk(_pendingGeneration))
+	{
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done.wait(lock, [&]() { return _chunksDone.load(std::memory_order_acquire) == _chunkCount.load(std::memory_order_relaxed); });
+	}
+
+	_pendingGeneration = 0;
+	_submitMutex.unlock();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef void (*JobRangeFunc)(void* pData, uint32_t begin, uint32_t end);
+
+//--------------------------------------------------------------------------------------
+// Fixed pool of worker threads that split index ranges between themselves and the
+// calling thread. Submitting work does not allocate, so it is safe to use every frame.
+//--------------------------------------------------------------------------------------
+class JobSystem
+{
+private:
+	std::vector<std::thread> _workers;
+	std::mutex               _mutex;
+	std::mutex               _submitMutex;
+	std::condition_variable  _wake;
+	std::condition_variable  _done;
+	bool                     _quit;
+
+	// Current batch. _work packs the batch generation in the high 32 bits and the next
+	// chunk to hand out in the low 32 bits so late workers can't steal from a newer batch.
+	JobRangeFunc             _func;
+	void*                    _pData;
+	uint32_t                 _count;
+	uint32_t                 _grain;
+	std::atomic<uint32_t>    _chunkCount;
+	uint32_t                 _generation;
+	std::atomic<uint64_t>    _work;
+	std::atomic<uint32_t>    _chunksDone;
+
+	// Batch started by Dispatch that the submitting thread still has to Wait on
+	uint32_t                 _pendingGeneration;
+
+private:
+	void WorkerMain(uint32_t threadIndex);
+	bool RunChunk(uint32_t generation);
+
+	template<typename F>
+	static void InvokeRange(void* pData, uint32_t begin, uint32_t end)
+	{
+		(*static_cast<F*>(pData))(begin, end);
+	}
+
+public:
+	JobSystem();
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// workerCount of 0 uses one worker per hardware thread minus the caller
+	bool Init(uint32_t workerCount = 0);
+	void Shutdown();
+
+	// Calls func over [0, count) in chunks of grain and returns once every chunk is done.
+	// Calls made from inside a job run inline on the calling worker.
+	void ParallelFor(uint32_t count, uint32_t grain, JobRangeFunc func, void* pData);
+
+	// Same as ParallelFor but returns as soon as the workers have been woken so the caller
+	// can do its own work in the meantime. Every Dispatch has to be followed by a Wait on
+	// the same thread before anything else is submitted.
+	void Dispatch(uint32_t count, uint32_t grain, JobRangeFunc func, void* pData);
+
+	// Helps with the chunks of the dispatched batch and returns once all of them are done
+	void Wait();
+
+	template<typename F>
+	void ParallelFor(uint32_t count, uint32_t grain, F& func)
+	{
+		ParallelFor(count, grain, &InvokeRange<F>, &func);
+	}
+
+	uint32_t GetWorkerCount() const { return (uint32_t)_workers.size(); }
+
+	// Number of threads that can run jobs, including the submitting thread
+	uint32_t GetThreadCount() const { return (uint32_t)_workers.size() + 1; }
+
+	// 0 on the submitting thread, 1..N on workers
+	static uint32_t GetThreadIndex();
+};
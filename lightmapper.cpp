@@ -0,0 +1,998 @@
+#include "lightmapper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+#include "jobsystem.h"
+
+static const float Pi = 3.14159265f;
+
+// The density shrinks by a fifth per attempt, running out means the charts alone don't fit
+static const uint32_t MaxPackAttempts = 32;
+
+void InitLightmapSettings(LightmapSettings& settings)
+{
+	settings.texelsPerUnit = 8.0f;
+	settings.maxSize = 2048;
+	settings.padding = 2;
+	settings.raysPerTexel = 128;
+	settings.bounces = 2;
+	settings.aoDistance = 2.0f;
+	settings.skyColor = Vec3(0.2f, 0.2f, 0.2f);
+	settings.range = 2.0f;
+	settings.denoisePasses = 3;
+	settings.seed = 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Sampling
+//--------------------------------------------------------------------------------------
+static uint32_t HashUint(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7FEB352D;
+	x ^= x >> 15;
+	x *= 0x846CA68B;
+	x ^= x >> 16;
+	return x;
+}
+
+static float UnitFloat(uint32_t bits)
+{
+	return (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+static float RadicalInverse(uint32_t bits)
+{
+	bits = (bits << 16) | (bits >> 16);
+	bits = ((bits & 0x55555555) << 1) | ((bits & 0xAAAAAAAA) >> 1);
+	bits = ((bits & 0x33333333) << 2) | ((bits & 0xCCCCCCCC) >> 2);
+	bits = ((bits & 0x0F0F0F0F) << 4) | ((bits & 0xF0F0F0F0) >> 4);
+	bits = ((bits & 0x00FF00FF) << 8) | ((bits & 0xFF00FF00) >> 8);
+	return UnitFloat(bits);
+}
+
+static float Fraction(float x)
+{
+	return x - floorf(x);
+}
+
+// Hammersley point i of count, shifted by a per texel offset so neighbours don't share
+// the same directions, mapped to the cosine weighted hemisphere around normal
+static Vec3 CosineDirection(const Vec3& normal, uint32_t i, uint32_t count, float shiftU, float shiftV)
+{
+	float u = Fraction((i + 0.5f) / count + shiftU);
+	float v = Fraction(RadicalInverse(i) + shiftV);
+
+	float r = sqrtf(u);
+	float phi = 2.0f * Pi * v;
+	float x = r * cosf(phi);
+	float y = r * sinf(phi);
+	float z = sqrtf(std::max(0.0f, 1.0f - u));
+
+	float sign = copysignf(1.0f, normal.z);
+	float a = -1.0f / (sign + normal.z);
+	float b = normal.x * normal.y * a;
+	Vec3 tangent(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+	Vec3 bitangent(b, sign + normal.y * normal.y * a, -normal.y);
+
+	return tangent * x + bitangent * y + normal * z;
+}
+
+//--------------------------------------------------------------------------------------
+// Charts
+//--------------------------------------------------------------------------------------
+static uint32_t FindRoot(std::vector<uint32_t>& parents, uint32_t i)
+{
+	while (parents[i] != i)
+	{
+		parents[i] = parents[parents[i]];
+		i = parents[i];
+	}
+
+	return i;
+}
+
+// 0 to 5, the axis the normal is closest to and its sign
+static uint32_t AxisBucket(const Vec3& normal)
+{
+	float ax = fabsf(normal.x), ay = fabsf(normal.y), az = fabsf(normal.z);
+
+	if (ax >= ay && ax >= az)
+		return normal.x >= 0.0f ? 0 : 1;
+
+	if (ay >= az)
+		return normal.y >= 0.0f ? 2 : 3;
+
+	return normal.z >= 0.0f ? 4 : 5;
+}
+
+static void ProjectToChart(const Vec3& position, uint32_t axis, float& u, float& v)
+{
+	const float* p = &position.x;
+	u = p[(axis + 1) % 3];
+	v = p[(axis + 2) % 3];
+}
+
+LightmapBaker::LightmapBaker() : _width(0), _height(0), _sceneSize(0.0f)
+{
+	memset(&_stats, 0, sizeof(_stats));
+	InitLightmapSettings(_settings);
+}
+
+void LightmapBaker::AddInstance(const LightmapInstance& desc)
+{
+	Instance instance;
+	instance.nameHash = desc.nameHash;
+	instance.meshHash = desc.meshHash;
+	instance.albedo = desc.albedo;
+	instance.indices.assign(desc.pIndices, desc.pIndices + desc.indexCount - desc.indexCount % 3);
+	instance.positions.resize(desc.vertexCount);
+	instance.firstTriangle = 0;
+
+	for (uint32_t i = 0; i < desc.vertexCount; i++)
+	{
+		const Vec3& position = *(const Vec3*)((const uint8_t*)desc.pPositions + (size_t)i * desc.vertexStride);
+		instance.positions[i] = TransformPoint(position, desc.world);
+	}
+
+	// D3D fronts are clockwise, the vertex normals win where they disagree
+	uint32_t triangleCount = (uint32_t)instance.indices.size() / 3;
+	instance.normals.resize(triangleCount);
+
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		const uint32_t* corners = &instance.indices[t * 3];
+		const Vec3& a = instance.positions[corners[0]];
+		Vec3 normal = Normalize(Cross(instance.positions[corners[2]] - a, instance.positions[corners[1]] - a));
+
+		if (desc.pNormals != nullptr)
+		{
+			Vec3 vertexNormal;
+
+			for (uint32_t c = 0; c < 3; c++)
+				vertexNormal += *(const Vec3*)((const uint8_t*)desc.pNormals + (size_t)corners[c] * desc.vertexStride);
+
+			if (Dot(normal, TransformDirection(vertexNormal, desc.world)) < 0.0f)
+				normal = -normal;
+		}
+
+		instance.normals[t] = normal;
+	}
+
+	_instances.push_back(instance);
+}
+
+void LightmapBaker::BuildCharts()
+{
+	_charts.clear();
+	_triangleCharts.clear();
+
+	uint32_t firstTriangle = 0;
+
+	for (uint32_t i = 0; i < (uint32_t)_instances.size(); i++)
+	{
+		Instance& instance = _instances[i];
+		uint32_t triangleCount = (uint32_t)instance.normals.size();
+
+		instance.firstTriangle = firstTriangle;
+		firstTriangle += triangleCount;
+
+		// Join triangles across shared edges when they face the same way
+		std::vector<uint32_t> parents(triangleCount);
+		std::vector<uint32_t> buckets(triangleCount);
+		std::iota(parents.begin(), parents.end(), 0);
+
+		std::unordered_map<uint64_t, uint32_t> edges;
+		edges.reserve(triangleCount * 3);
+
+		for (uint32_t t = 0; t < triangleCount; t++)
+		{
+			buckets[t] = AxisBucket(instance.normals[t]);
+
+			for (uint32_t e = 0; e < 3; e++)
+			{
+				uint32_t a = instance.indices[t * 3 + e];
+				uint32_t b = instance.indices[t * 3 + (e + 1) % 3];
+				uint64_t key = ((uint64_t)std::min(a, b) << 32) | std::max(a, b);
+
+				auto found = edges.emplace(key, t);
+
+				if (!found.second && buckets[found.first->second] == buckets[t])
+					parents[FindRoot(parents, t)] = FindRoot(parents, found.first->second);
+			}
+		}
+
+		std::unordered_map<uint32_t, uint32_t> rootCharts;
+
+		for (uint32_t t = 0; t < triangleCount; t++)
+		{
+			uint32_t root = FindRoot(parents, t);
+			auto found = rootCharts.emplace(root, (uint32_t)_charts.size());
+
+			if (found.second)
+			{
+				Chart chart;
+				memset(&chart, 0, sizeof(chart));
+				chart.instance = i;
+				chart.axis = buckets[t] / 2;
+				chart.minU = chart.minV = FLT_MAX;
+				chart.maxU = chart.maxV = -FLT_MAX;
+				_charts.push_back(chart);
+			}
+
+			Chart& chart = _charts[found.first->second];
+
+			for (uint32_t c = 0; c < 3; c++)
+			{
+				float u, v;
+				ProjectToChart(instance.positions[instance.indices[t * 3 + c]], chart.axis, u, v);
+				chart.minU = std::min(chart.minU, u);
+				chart.minV = std::min(chart.minV, v);
+				chart.maxU = std::max(chart.maxU, u);
+				chart.maxV = std::max(chart.maxV, v);
+			}
+
+			_triangleCharts.push_back(found.first->second);
+		}
+	}
+}
+
+// Shelves of charts sorted by height across a roughly square atlas
+bool LightmapBaker::PackCharts(float texelsPerUnit)
+{
+	uint32_t padding = _settings.padding;
+	uint64_t area = 0;
+	uint32_t widest = 0;
+
+	for (Chart& chart : _charts)
+	{
+		// One extra texel so the corners land on texel centres
+		chart.width = (uint32_t)ceilf((chart.maxU - chart.minU) * texelsPerUnit) + 1;
+		chart.height = (uint32_t)ceilf((chart.maxV - chart.minV) * texelsPerUnit) + 1;
+
+		area += (uint64_t)(chart.width + padding) * (chart.height + padding);
+		widest = std::max(widest, chart.width + padding);
+	}
+
+	uint32_t width = std::max(widest, (uint32_t)ceil(sqrt((double)area))) + padding;
+	width = (width + 3) & ~3u;
+
+	if (width > _settings.maxSize)
+		return false;
+
+	std::vector<uint32_t> order(_charts.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return _charts[a].height > _charts[b].height; });
+
+	uint32_t x = padding;
+	uint32_t y = padding;
+	uint32_t shelfHeight = 0;
+
+	for (uint32_t index : order)
+	{
+		Chart& chart = _charts[index];
+
+		if (x + chart.width + padding > width)
+		{
+			x = padding;
+			y += shelfHeight;
+			shelfHeight = 0;
+		}
+
+		chart.x = x;
+		chart.y = y;
+		x += chart.width + padding;
+		shelfHeight = std::max(shelfHeight, chart.height + padding);
+	}
+
+	uint32_t height = (y + shelfHeight + 3) & ~3u;
+
+	if (height > _settings.maxSize)
+		return false;
+
+	_width = width;
+	_height = height;
+
+	return true;
+}
+
+// Splits vertices where charts meet and gives every triangle its texel coordinates
+void LightmapBaker::BuildEntities(float texelsPerUnit, Lightmap& lightmap)
+{
+	lightmap.entities.resize(_instances.size());
+	_hitTriangles.resize(_triangleCharts.size());
+
+	for (uint32_t i = 0; i < (uint32_t)_instances.size(); i++)
+	{
+		const Instance& instance = _instances[i];
+		LightmapEntity& entity = lightmap.entities[i];
+
+		entity.nameHash = instance.nameHash;
+		entity.meshHash = instance.meshHash;
+		entity.remap.clear();
+		entity.uvs.clear();
+		entity.indices.resize(instance.indices.size());
+
+		std::unordered_map<uint64_t, uint32_t> vertices;
+
+		for (uint32_t t = 0; t < (uint32_t)instance.normals.size(); t++)
+		{
+			uint32_t triangle = instance.firstTriangle + t;
+			const Chart& chart = _charts[_triangleCharts[triangle]];
+			HitTriangle& hit = _hitTriangles[triangle];
+
+			hit.normal = instance.normals[t];
+			hit.instance = i;
+
+			for (uint32_t c = 0; c < 3; c++)
+			{
+				uint32_t source = instance.indices[t * 3 + c];
+
+				float u, v;
+				ProjectToChart(instance.positions[source], chart.axis, u, v);
+
+				hit.uvs[c * 2] = chart.x + (u - chart.minU) * texelsPerUnit + 0.5f;
+				hit.uvs[c * 2 + 1] = chart.y + (v - chart.minV) * texelsPerUnit + 0.5f;
+
+				uint64_t key = ((uint64_t)source << 32) | _triangleCharts[triangle];
+				auto found = vertices.emplace(key, (uint32_t)entity.remap.size());
+
+				if (found.second)
+				{
+					entity.remap.push_back(source);
+					entity.uvs.push_back(hit.uvs[c * 2] / _width);
+					entity.uvs.push_back(hit.uvs[c * 2 + 1] / _height);
+				}
+
+				entity.indices[t * 3 + c] = found.first->second;
+			}
+		}
+	}
+}
+
+// Texel centres inside a triangle take its position, the rest are filled by dilation
+void LightmapBaker::Rasterize()
+{
+	_texels.assign((size_t)_width * _height, Texel());
+
+	for (uint32_t triangle = 0; triangle < (uint32_t)_hitTriangles.size(); triangle++)
+	{
+		const HitTriangle& hit = _hitTriangles[triangle];
+		const Instance& instance = _instances[hit.instance];
+		const uint32_t* corners = &instance.indices[(triangle - instance.firstTriangle) * 3];
+		const float* uv = hit.uvs;
+
+		float area = (uv[2] - uv[0]) * (uv[5] - uv[1]) - (uv[3] - uv[1]) * (uv[4] - uv[0]);
+
+		if (fabsf(area) < 1.0e-8f)
+			continue;
+
+		int x0 = std::max(0, (int)floorf(std::min(uv[0], std::min(uv[2], uv[4]))));
+		int y0 = std::max(0, (int)floorf(std::min(uv[1], std::min(uv[3], uv[5]))));
+		int x1 = std::min((int)_width - 1, (int)ceilf(std::max(uv[0], std::max(uv[2], uv[4]))));
+		int y1 = std::min((int)_height - 1, (int)ceilf(std::max(uv[1], std::max(uv[3], uv[5]))));
+
+		for (int y = y0; y <= y1; y++)
+		{
+			for (int x = x0; x <= x1; x++)
+			{
+				float px = x + 0.5f;
+				float py = y + 0.5f;
+
+				float w0 = ((uv[2] - px) * (uv[5] - py) - (uv[3] - py) * (uv[4] - px)) / area;
+				float w1 = ((uv[4] - px) * (uv[1] - py) - (uv[5] - py) * (uv[0] - px)) / area;
+				float w2 = 1.0f - w0 - w1;
+
+				if (w0 < -1.0e-4f || w1 < -1.0e-4f || w2 < -1.0e-4f)
+					continue;
+
+				Texel& texel = _texels[(size_t)y * _width + x];
+				texel.position = instance.positions[corners[0]] * w0 + instance.positions[corners[1]] * w1 + instance.positions[corners[2]] * w2;
+				texel.normal = hit.normal;
+				texel.valid = true;
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Lighting
+//--------------------------------------------------------------------------------------
+
+// Same falloff and cone as the clustered lights in the shader so bounces match what is
+// drawn, without the 1/pi the shader leaves out as well
+Vec3 LightmapBaker::DirectLight(const Vec3& position, const Vec3& normal) const
+{
+	Vec3 result;
+	float bias = _sceneSize * 1.0e-4f + 1.0e-4f;
+	Vec3 origin = position + normal * bias;
+
+	for (const SceneLight& light : _lights)
+	{
+		Vec3 toLight;
+		float distance;
+		float attenuation = light.intensity;
+
+		if (light.type == SCENE_LIGHT_DIRECTIONAL)
+		{
+			toLight = -Normalize(light.direction);
+			distance = _sceneSize;
+		}
+		else
+		{
+			toLight = light.position - position;
+			distance = Length(toLight);
+
+			if (distance >= light.range || distance <= 0.0f)
+				continue;
+
+			toLight *= 1.0f / distance;
+
+			float falloff = 1.0f - distance / light.range;
+			attenuation *= falloff * falloff;
+
+			if (light.type == SCENE_LIGHT_SPOT)
+			{
+				float t = (Dot(-toLight, light.direction) - light.cosOuter) / std::max(light.cosInner - light.cosOuter, 1.0e-6f);
+				t = std::min(std::max(t, 0.0f), 1.0f);
+				attenuation *= t * t * (3.0f - 2.0f * t);
+			}
+		}
+
+		float amount = Dot(normal, toLight) * attenuation;
+
+		if (amount <= 0.0f || _bvh.Occluded(origin, toLight, distance - bias))
+			continue;
+
+		result += light.color * amount;
+	}
+
+	return result;
+}
+
+// One row of texels, rgb is the light bounced off whatever the rays hit and a is the
+// fraction of rays that travel further than aoDistance
+void LightmapBaker::Gather(uint32_t row, uint32_t pass, const std::vector<Vec3>& bounced, float* pOutput, uint64_t& rays) const
+{
+	uint32_t rayCount = _settings.raysPerTexel;
+	float bias = _sceneSize * 1.0e-4f + 1.0e-4f;
+
+	for (uint32_t x = 0; x < _width; x++)
+	{
+		size_t index = (size_t)row * _width + x;
+		const Texel& texel = _texels[index];
+		float* pTexel = pOutput + x * 4;
+
+		if (!texel.valid)
+		{
+			pTexel[0] = pTexel[1] = pTexel[2] = pTexel[3] = 0.0f;
+			continue;
+		}
+
+		uint32_t state = HashUint((uint32_t)index ^ HashUint(_settings.seed * 0x9E3779B9 + pass));
+		float shiftU = UnitFloat(state);
+		float shiftV = UnitFloat(HashUint(state));
+
+		Vec3 origin = texel.position + texel.normal * bias;
+		Vec3 indirect;
+		uint32_t open = 0;
+
+		for (uint32_t r = 0; r < rayCount; r++)
+		{
+			Vec3 direction = CosineDirection(texel.normal, r, rayCount, shiftU, shiftV);
+
+			if (bounced.empty())
+			{
+				open += _bvh.Occluded(origin, direction, _settings.aoDistance) ? 0 : 1;
+				continue;
+			}
+
+			RayHit hit;
+
+			if (!_bvh.Intersect(origin, direction, _sceneSize, hit))
+			{
+				open++;
+				continue;
+			}
+
+			if (hit.t >= _settings.aoDistance)
+				open++;
+
+			// The back of a surface is inside something and has no light of its own
+			const HitTriangle& triangle = _hitTriangles[hit.triangle];
+
+			if (Dot(direction, triangle.normal) >= 0.0f)
+				continue;
+
+			float w0 = 1.0f - hit.u - hit.v;
+			float u = triangle.uvs[0] * w0 + triangle.uvs[2] * hit.u + triangle.uvs[4] * hit.v;
+			float v = triangle.uvs[1] * w0 + triangle.uvs[3] * hit.u + triangle.uvs[5] * hit.v;
+			uint32_t tx = std::min((uint32_t)std::max(u, 0.0f), _width - 1);
+			uint32_t ty = std::min((uint32_t)std::max(v, 0.0f), _height - 1);
+
+			const Vec3& albedo = _instances[triangle.instance].albedo;
+			const Vec3& light = bounced[(size_t)ty * _width + tx];
+			indirect += Vec3(albedo.x * light.x, albedo.y * light.y, albedo.z * light.z);
+		}
+
+		// Cosine weighted, so the average of what is seen is the irradiance
+		float scale = 1.0f / rayCount;
+		pTexel[0] = indirect.x * scale;
+		pTexel[1] = indirect.y * scale;
+		pTexel[2] = indirect.z * scale;
+		pTexel[3] = open * scale;
+		rays += rayCount;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Filtering
+//--------------------------------------------------------------------------------------
+
+// Edge avoiding a-trous wavelet filter, the 5x5 B3 spline kernel spread further apart on
+// each pass with weights that drop across creases and gaps in the geometry
+void LightmapBaker::Denoise(std::vector<float>& texels, uint32_t passes) const
+{
+	static const float Kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+	std::vector<float> filtered(texels.size());
+	float texelSize = 1.0f / _settings.texelsPerUnit;
+
+	for (uint32_t pass = 0; pass < passes; pass++)
+	{
+		int step = 1 << pass;
+		float positionScale = 1.0f / (4.0f * step * step * texelSize * texelSize);
+
+		for (int y = 0; y < (int)_height; y++)
+		{
+			for (int x = 0; x < (int)_width; x++)
+			{
+				size_t index = (size_t)y * _width + x;
+				const Texel& centre = _texels[index];
+				float* pOut = &filtered[index * 4];
+
+				if (!centre.valid)
+				{
+					memcpy(pOut, &texels[index * 4], sizeof(float) * 4);
+					continue;
+				}
+
+				float sum[4] = {};
+				float weightSum = 0.0f;
+
+				for (int dy = -2; dy <= 2; dy++)
+				{
+					int sy = y + dy * step;
+
+					if (sy < 0 || sy >= (int)_height)
+						continue;
+
+					for (int dx = -2; dx <= 2; dx++)
+					{
+						int sx = x + dx * step;
+
+						if (sx < 0 || sx >= (int)_width)
+							continue;
+
+						size_t sample = (size_t)sy * _width + sx;
+						const Texel& texel = _texels[sample];
+
+						if (!texel.valid)
+							continue;
+
+						float facing = std::max(Dot(centre.normal, texel.normal), 0.0f);
+						facing *= facing;
+						facing *= facing;
+						facing *= facing;
+
+						Vec3 offset = texel.position - centre.position;
+						float weight = Kernel[abs(dx)] * Kernel[abs(dy)] * facing * expf(-Dot(offset, offset) * positionScale);
+
+						for (uint32_t c = 0; c < 4; c++)
+							sum[c] += texels[sample * 4 + c] * weight;
+
+						weightSum += weight;
+					}
+				}
+
+				for (uint32_t c = 0; c < 4; c++)
+					pOut[c] = weightSum > 0.0f ? sum[c] / weightSum : texels[index * 4 + c];
+			}
+		}
+
+		texels.swap(filtered);
+	}
+}
+
+// Grows the covered texels outwards so bilinear filtering and ray hits near a chart edge
+// never pick up the empty atlas
+void LightmapBaker::Dilate(float* pTexels, std::vector<bool>& valid, uint32_t channels, uint32_t iterations) const
+{
+	size_t floatCount = (size_t)_width * _height * channels;
+	std::vector<float> texels(pTexels, pTexels + floatCount);
+	std::vector<float> next;
+	std::vector<bool> nextValid;
+
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		next = texels;
+		nextValid = valid;
+
+		for (int y = 0; y < (int)_height; y++)
+		{
+			for (int x = 0; x < (int)_width; x++)
+			{
+				size_t index = (size_t)y * _width + x;
+
+				if (valid[index])
+					continue;
+
+				float sum[4] = {};
+				uint32_t count = 0;
+
+				for (int dy = -1; dy <= 1; dy++)
+				{
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						int sx = x + dx, sy = y + dy;
+
+						if (sx < 0 || sy < 0 || sx >= (int)_width || sy >= (int)_height || !valid[(size_t)sy * _width + sx])
+							continue;
+
+						for (uint32_t c = 0; c < channels; c++)
+							sum[c] += texels[((size_t)sy * _width + sx) * channels + c];
+
+						count++;
+					}
+				}
+
+				if (count == 0)
+					continue;
+
+				for (uint32_t c = 0; c < channels; c++)
+					next[index * channels + c] = sum[c] / count;
+
+				nextValid[index] = true;
+			}
+		}
+
+		texels.swap(next);
+		valid.swap(nextValid);
+	}
+
+	memcpy(pTexels, texels.data(), floatCount * sizeof(float));
+}
+
+//--------------------------------------------------------------------------------------
+// Bake
+//--------------------------------------------------------------------------------------
+bool LightmapBaker::Bake(const LightmapSettings& settings, JobSystem* pJobSystem, Lightmap& lightmap, char* error, size_t errorSize)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	auto Elapsed = [](Clock::time_point start) { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); };
+
+	auto bakeStart = Clock::now();
+	memset(&_stats, 0, sizeof(_stats));
+	_settings = settings;
+	_settings.raysPerTexel = std::max(_settings.raysPerTexel, 1u);
+
+	if (_instances.empty())
+	{
+		snprintf(error, errorSize, "nothing to bake");
+		return false;
+	}
+
+	// Unwrap
+	auto start = Clock::now();
+	BuildCharts();
+
+	float texelsPerUnit = settings.texelsPerUnit;
+	uint32_t attempt = 0;
+
+	while (!PackCharts(texelsPerUnit))
+	{
+		if (++attempt == MaxPackAttempts)
+		{
+			snprintf(error, errorSize, "%u charts don't fit in %ux%u", (uint32_t)_charts.size(), settings.maxSize, settings.maxSize);
+			return false;
+		}
+
+		texelsPerUnit *= 0.8f;
+	}
+
+	_settings.texelsPerUnit = texelsPerUnit;
+	BuildEntities(texelsPerUnit, lightmap);
+	Rasterize();
+
+	_stats.triangles = (uint32_t)_hitTriangles.size();
+	_stats.charts = (uint32_t)_charts.size();
+	_stats.unwrapMs = Elapsed(start);
+
+	// Every instance goes into one tree so anything can shadow anything
+	start = Clock::now();
+
+	std::vector<Vec3> positions;
+	positions.reserve(_hitTriangles.size() * 3);
+	Aabb bounds = { Vec3(FLT_MAX, FLT_MAX, FLT_MAX), Vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX) };
+
+	for (const Instance& instance : _instances)
+	{
+		for (uint32_t index : instance.indices)
+		{
+			positions.push_back(instance.positions[index]);
+			bounds.min = Min(bounds.min, instance.positions[index]);
+			bounds.max = Max(bounds.max, instance.positions[index]);
+		}
+	}
+
+	_sceneSize = Length(bounds.max - bounds.min) * 2.0f + 1.0f;
+	_bvh.Build(positions.data(), (uint32_t)(positions.size() / 3));
+	_stats.bvhMs = Elapsed(start);
+
+	size_t texelCount = (size_t)_width * _height;
+	std::vector<bool> valid(texelCount);
+
+	for (size_t i = 0; i < texelCount; i++)
+	{
+		valid[i] = _texels[i].valid;
+		_stats.texels += _texels[i].valid ? 1 : 0;
+	}
+
+	// Direct light only lights the bounces, it is dilated so hits on chart edges find it
+	start = Clock::now();
+
+	std::vector<Vec3> direct(texelCount);
+
+	auto directRows = [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t y = begin; y < end; y++)
+		{
+			for (uint32_t x = 0; x < _width; x++)
+			{
+				const Texel& texel = _texels[(size_t)y * _width + x];
+
+				if (texel.valid)
+					direct[(size_t)y * _width + x] = DirectLight(texel.position, texel.normal);
+			}
+		}
+	};
+
+
+	if (settings.bounces > 0)
+	{
+		if (pJobSystem)
+			pJobSystem->ParallelFor(_height, 1, directRows);
+		else
+			directRows(0, _height);
+
+		std::vector<bool> directValid = valid;
+		Dilate(&direct[0].x, directValid, 3, settings.padding + 1);
+	}
+
+	_stats.directMs = Elapsed(start);
+
+	// Each pass lights the hits with the direct light plus the previous pass's result
+	start = Clock::now();
+
+	std::vector<float> gathered(texelCount * 4);
+	std::vector<Vec3> bounced;
+	std::atomic<uint64_t> rayCount(0);
+	uint32_t passes = std::max(settings.bounces, 1u);
+
+	for (uint32_t pass = 0; pass < passes; pass++)
+	{
+		if (settings.bounces > 0)
+		{
+			bounced = direct;
+
+			if (pass > 0)
+			{
+				std::vector<bool> gatheredValid = valid;
+				Dilate(gathered.data(), gatheredValid, 4, settings.padding + 1);
+
+				for (size_t i = 0; i < texelCount; i++)
+					bounced[i] += Vec3(gathered[i * 4], gathered[i * 4 + 1], gathered[i * 4 + 2]);
+			}
+		}
+
+		auto gatherRows = [&](uint32_t begin, uint32_t end)
+		{
+			uint64_t rays = 0;
+
+			for (uint32_t y = begin; y < end; y++)
+				Gather(y, pass, bounced, &gathered[(size_t)y * _width * 4], rays);
+
+			rayCount += rays;
+		};
+
+		if (pJobSystem)
+			pJobSystem->ParallelFor(_height, 1, gatherRows);
+		else
+			gatherRows(0, _height);
+	}
+
+	_stats.rays = rayCount;
+	_stats.indirectMs = Elapsed(start);
+	_stats.raysPerSecond = _stats.indirectMs > 0.0 ? _stats.rays / (_stats.indirectMs * 0.001) : 0.0;
+
+	// Sky through the open directions on top of the bounced light
+	start = Clock::now();
+
+	for (size_t i = 0; i < texelCount; i++)
+	{
+		float* pTexel = &gathered[i * 4];
+		pTexel[0] += settings.skyColor.x * pTexel[3];
+		pTexel[1] += settings.skyColor.y * pTexel[3];
+		pTexel[2] += settings.skyColor.z * pTexel[3];
+	}
+
+	Denoise(gathered, settings.denoisePasses);
+	Dilate(gathered.data(), valid, 4, settings.padding + 1);
+	_stats.denoiseMs = Elapsed(start);
+
+	lightmap.width = _width;
+	lightmap.height = _height;
+	lightmap.range = settings.range;
+	lightmap.texels.swap(gathered);
+
+	_stats.totalMs = Elapsed(bakeStart);
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Files
+//--------------------------------------------------------------------------------------
+struct LightmapFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	float    range;
+	uint32_t entityCount;
+};
+
+// Followed by remap, uvs and indices
+struct LightmapFileEntity
+{
+	uint64_t nameHash;
+	uint64_t meshHash;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+};
+
+void EncodeLightmap(const Lightmap& lightmap, std::vector<uint8_t>& pixels)
+{
+	size_t texelCount = (size_t)lightmap.width * lightmap.height;
+	pixels.resize(texelCount * 4);
+
+	float scale = 255.0f / lightmap.range;
+
+	for (size_t i = 0; i < texelCount; i++)
+	{
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			float value = lightmap.texels[i * 4 + c] * (c < 3 ? scale : 255.0f);
+			pixels[i * 4 + c] = (uint8_t)(std::min(std::max(value, 0.0f), 255.0f) + 0.5f);
+		}
+	}
+}
+
+template<typename T>
+static void Append(std::vector<uint8_t>& output, const T* pData, size_t count)
+{
+	const uint8_t* pBytes = (const uint8_t*)pData;
+	output.insert(output.end(), pBytes, pBytes + count * sizeof(T));
+}
+
+void WriteLightmap(const Lightmap& lightmap, std::vector<uint8_t>& output)
+{
+	LightmapFileHeader header;
+	header.magic = LightmapMagic;
+	header.version = LightmapVersion;
+	header.width = lightmap.width;
+	header.height = lightmap.height;
+	header.range = lightmap.range;
+	header.entityCount = (uint32_t)lightmap.entities.size();
+
+	output.clear();
+	Append(output, &header, 1);
+
+	for (const LightmapEntity& entity : lightmap.entities)
+	{
+		LightmapFileEntity fileEntity;
+		fileEntity.nameHash = entity.nameHash;
+		fileEntity.meshHash = entity.meshHash;
+		fileEntity.vertexCount = (uint32_t)entity.remap.size();
+		fileEntity.indexCount = (uint32_t)entity.indices.size();
+
+		Append(output, &fileEntity, 1);
+		Append(output, entity.remap.data(), entity.remap.size());
+		Append(output, entity.uvs.data(), entity.uvs.size());
+		Append(output, entity.indices.data(), entity.indices.size());
+	}
+}
+
+template<typename T>
+static bool Read(const uint8_t*& pCursor, const uint8_t* pEnd, T* pData, size_t count)
+{
+	size_t bytes = count * sizeof(T);
+
+	if ((size_t)(pEnd - pCursor) < bytes)
+		return false;
+
+	memcpy(pData, pCursor, bytes);
+	pCursor += bytes;
+
+	return true;
+}
+
+bool ParseLightmap(const void* pData, size_t size, Lightmap& lightmap)
+{
+	const uint8_t* pCursor = (const uint8_t*)pData;
+	const uint8_t* pEnd = pCursor + size;
+
+	LightmapFileHeader header;
+
+	if (!Read(pCursor, pEnd, &header, 1) || header.magic != LightmapMagic || header.version != LightmapVersion)
+		return false;
+
+	lightmap.width = header.width;
+	lightmap.height = header.height;
+	lightmap.range = header.range;
+	lightmap.texels.clear();
+	lightmap.entities.clear();
+
+	for (uint32_t i = 0; i < header.entityCount; i++)
+	{
+		LightmapFileEntity fileEntity;
+
+		if (!Read(pCursor, pEnd, &fileEntity, 1))
+			return false;
+
+		// Checked before resizing so a corrupt count can't allocate gigabytes
+		size_t bytes = (size_t)fileEntity.vertexCount * (sizeof(uint32_t) + sizeof(float) * 2) + (size_t)fileEntity.indexCount * sizeof(uint32_t);
+
+		if ((size_t)(pEnd - pCursor) < bytes)
+			return false;
+
+		LightmapEntity entity;
+		entity.nameHash = fileEntity.nameHash;
+		entity.meshHash = fileEntity.meshHash;
+		entity.remap.resize(fileEntity.vertexCount);
+		entity.uvs.resize(fileEntity.vertexCount * 2);
+		entity.indices.resize(fileEntity.indexCount);
+
+		Read(pCursor, pEnd, entity.remap.data(), entity.remap.size());
+		Read(pCursor, pEnd, entity.uvs.data(), entity.uvs.size());
+		Read(pCursor, pEnd, entity.indices.data(), entity.indices.size());
+
+		for (uint32_t index : entity.indices)
+		{
+			if (index >= fileEntity.vertexCount)
+				return false;
+		}
+
+		lightmap.entities.push_back(std::move(entity));
+	}
+
+	return true;
+}
+
+const LightmapEntity* FindLightmapEntity(const Lightmap& lightmap, uint64_t nameHash)
+{
+	for (const LightmapEntity& entity : lightmap.entities)
+	{
+		if (entity.nameHash == nameHash)
+			return &entity;
+	}
+
+	return nullptr;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "cpumath.h"
+#include "raytrace.h"
+#include "scene.h"
+
+class JobSystem;
+
+const uint32_t LightmapMagic = 0x314D504C;  // "LPM1"
+const uint32_t LightmapVersion = 3;  // 2: the floor is wound the other way, 3: so is the cube's bottom
+
+// A static mesh placed in the world, everything is copied by AddInstance
+struct LightmapInstance
+{
+	uint64_t        nameHash;
+	uint64_t        meshHash;
+	const Vec3*     pPositions;  // object space
+	const Vec3*     pNormals;    // optional, only used to pick the front of each triangle
+	uint32_t        vertexStride;
+	uint32_t        vertexCount;
+	const uint32_t* pIndices;
+	uint32_t        indexCount;
+	Mat4            world;
+	Vec3            albedo;      // diffuse reflectance for bounced light
+};
+
+struct LightmapSettings
+{
+	float    texelsPerUnit;  // lowered in steps until the atlas fits in maxSize
+	uint32_t maxSize;
+	uint32_t padding;        // texels between charts
+	uint32_t raysPerTexel;
+	uint32_t bounces;        // 0 gives AO and sky only
+	float    aoDistance;
+	Vec3     skyColor;       // ambient from unoccluded directions, the old constant term
+	float    range;          // brightest value the 8 bit texture holds
+	uint32_t denoisePasses;
+	uint32_t seed;
+};
+
+void InitLightmapSettings(LightmapSettings& settings);
+
+// Where one instance lands in the atlas. The baked mesh has its own vertices since
+// charts split them: remap gives the source vertex of each.
+struct LightmapEntity
+{
+	uint64_t              nameHash;
+	uint64_t              meshHash;
+	std::vector<uint32_t> remap;
+	std::vector<float>    uvs;      // 2 per vertex, 0 to 1 across the atlas
+	std::vector<uint32_t> indices;
+};
+
+struct Lightmap
+{
+	uint32_t                    width;
+	uint32_t                    height;
+	float                       range;
+	std::vector<LightmapEntity> entities;
+	std::vector<float>          texels;  // rgb ambient and a AO per texel, not stored in the file
+};
+
+struct LightmapStats
+{
+	uint32_t triangles;
+	uint32_t charts;
+	uint32_t texels;       // covered by geometry
+	uint64_t rays;
+	double   unwrapMs;
+	double   bvhMs;
+	double   directMs;
+	double   indirectMs;
+	double   denoiseMs;
+	double   totalMs;
+	double   raysPerSecond;
+};
+
+//--------------------------------------------------------------------------------------
+// Offline ambient baker for static geometry. Instances are unwrapped into one atlas by
+// splitting them into charts of faces that share edges and face the same axis, each
+// planar projected at a fixed world space density. Every covered texel then gathers
+// cosine weighted rays through a TriangleBvh: the direct light from the scene lights on
+// whatever they hit feeds the bounces and the rays that stay open within aoDistance see
+// the sky. The result is what the pixel shader used to get from its constant ambient
+// term, so direct light is left to the shader. Rows are spread over the job system.
+//--------------------------------------------------------------------------------------
+class LightmapBaker
+{
+private:
+	struct Instance
+	{
+		uint64_t              nameHash;
+		uint64_t              meshHash;
+		std::vector<Vec3>     positions;  // world space
+		std::vector<Vec3>     normals;    // world space, per triangle
+		std::vector<uint32_t> indices;
+		Vec3                  albedo;
+		uint32_t              firstTriangle;
+	};
+
+	struct Chart
+	{
+		uint32_t instance;
+		uint32_t axis;
+		float    minU, minV;
+		float    maxU, maxV;
+		uint32_t x, y;           // placement in texels
+		uint32_t width, height;
+	};
+
+	// Everything a ray needs about the triangle it hit, indexed like the BVH triangles
+	struct HitTriangle
+	{
+		float    uvs[6];     // texel coordinates of the three corners
+		Vec3     normal;
+		uint32_t instance;
+	};
+
+	struct Texel
+	{
+		Vec3 position;
+		Vec3 normal;
+		bool valid;
+	};
+
+	std::vector<Instance>    _instances;
+	std::vector<SceneLight>  _lights;
+	std::vector<Chart>       _charts;
+	std::vector<uint32_t>    _triangleCharts;
+	std::vector<HitTriangle> _hitTriangles;
+	std::vector<Texel>       _texels;
+	TriangleBvh              _bvh;
+	LightmapSettings         _settings;
+	uint32_t                 _width;
+	uint32_t                 _height;
+	float                    _sceneSize;
+	LightmapStats            _stats;
+
+private:
+	void BuildCharts();
+	bool PackCharts(float texelsPerUnit);
+	void BuildEntities(float texelsPerUnit, Lightmap& lightmap);
+	void Rasterize();
+
+	Vec3 DirectLight(const Vec3& position, const Vec3& normal) const;
+	void Gather(uint32_t row, uint32_t pass, const std::vector<Vec3>& bounced, float* pOutput, uint64_t& rays) const;
+	void Denoise(std::vector<float>& texels, uint32_t passes) const;
+	void Dilate(float* pTexels, std::vector<bool>& valid, uint32_t channels, uint32_t iterations) const;
+
+public:
+	LightmapBaker();
+
+	void AddInstance(const LightmapInstance& instance);
+	void AddLight(const SceneLight& light) { _lights.push_back(light); }
+
+	// The job system may be null to bake on the calling thread
+	bool Bake(const LightmapSettings& settings, JobSystem* pJobSystem, Lightmap& lightmap, char* error, size_t errorSize);
+
+	const LightmapStats& GetStats() const { return _stats; }
+};
+
+// Linear RGBA8, rgb as a fraction of the range and AO in alpha
+void EncodeLightmap(const Lightmap& lightmap, std::vector<uint8_t>& pixels);
+
+// The file only holds the unwrap, the texels are written as a texture next to it
+void WriteLightmap(const Lightmap& lightmap, std::vector<uint8_t>& output);
+bool ParseLightmap(const void* pData, size_t size, Lightmap& lightmap);
+
+const LightmapEntity* FindLightmapEntity(const Lightmap& lightmap, uint64_t nameHash);
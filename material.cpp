@@ -0,0 +1,96 @@
+#include "material.h"
+
+Material::Material()
+{
+	_features = 0;
+	_permutation = MaterialPermutation<0>::Index;
+	_cullMode = D3D11_CULL_BACK;
+	_pConstantBuffer = nullptr;
+	_pDevice = nullptr;
+	_pDiffuseTexture = nullptr;
+	_pNormalTexture = nullptr;
+
+	_constants.DiffuseMtrl = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
+	_constants.AmbientMtrl = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
+	_constants.SpecularMtrl = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+	_constants.SpecularPower = 1.0f;
+	_constants.AlphaCutoff = 0.5f;
+	_constants.Padding = XMFLOAT2(0.0f, 0.0f);
+}
+
+Material::~Material()
+{
+	Release();
+}
+
+bool Material::SetFeatures(uint32_t features)
+{
+	int permutation = FindPermutation(features);
+
+	if (permutation < 0)
+		return false;
+
+	_features = features;
+	_permutation = (uint32_t)permutation;
+
+	return true;
+}
+
+void Material::SetDiffuseTexture(ID3D11ShaderResourceView* pTexture)
+{
+	if (pTexture) pTexture->AddRef();
+	if (_pDiffuseTexture) _pDiffuseTexture->Release();
+
+	_pDiffuseTexture = pTexture;
+}
+
+void Material::SetNormalTexture(ID3D11ShaderResourceView* pTexture)
+{
+	if (pTexture) pTexture->AddRef();
+	if (_pNormalTexture) _pNormalTexture->Release();
+
+	_pNormalTexture = pTexture;
+}
+
+HRESULT Material::Create(D3D11TrackedDevice* pDevice)
+{
+	if (_pConstantBuffer)
+		_pDevice->Release(_pConstantBuffer);
+
+	_pDevice = pDevice;
+
+	// Material constants never change after creation
+	D3D11_BUFFER_DESC bd;
+	ZeroMemory(&bd, sizeof(bd));
+	bd.Usage = D3D11_USAGE_IMMUTABLE;
+	bd.ByteWidth = sizeof(MaterialConstants);
+	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	bd.CPUAccessFlags = 0;
+
+	D3D11_SUBRESOURCE_DATA InitData;
+	ZeroMemory(&InitData, sizeof(InitData));
+	InitData.pSysMem = &_constants;
+
+	return pDevice->CreateBuffer(&bd, &InitData, &_pConstantBuffer, GPU_RESOURCE(GPURES_CONSTANTS, "MaterialConstants"));
+}
+
+void Material::Release()
+{
+	if (_pConstantBuffer) _pDevice->Release(_pConstantBuffer);
+	if (_pDiffuseTexture) _pDiffuseTexture->Release();
+	if (_pNormalTexture) _pNormalTexture->Release();
+
+	_pDiffuseTexture = nullptr;
+	_pNormalTexture = nullptr;
+}
+
+void Material::Bind(ID3D11DeviceContext* pContext) const
+{
+	pContext->PSSetConstantBuffers(2, 1, &_pConstantBuffer);
+
+	if (HasFeature(MATERIAL_TEXTURED))
+		pContext->PSSetShaderResources(0, 1, &_pDiffuseTexture);
+
+	if (HasFeature(MATERIAL_NORMALMAP))
+		pContext->PSSetShaderResources(4, 1, &_pNormalTexture);
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <d3d11_1.h>
+#include <directxmath.h>
+#include "gpuresourcesd3d11.h"
+
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// Material features. Each bit maps to a preprocessor define in framework.fx and every
+// combination that is used has to be listed in MaterialPermutations so it gets compiled.
+//--------------------------------------------------------------------------------------
+enum MaterialFeature : uint32_t
+{
+	MATERIAL_TEXTURED  = 1 << 0,
+	MATERIAL_SPECULAR  = 1 << 1,
+	MATERIAL_NORMALMAP = 1 << 2,
+	MATERIAL_ALPHATEST = 1 << 3,
+};
+
+const uint32_t MaterialFeatureCount = 4;
+
+struct MaterialFeatureDefine
+{
+	uint32_t    feature;
+	const char* define;
+};
+
+constexpr MaterialFeatureDefine MaterialFeatureDefines[MaterialFeatureCount] =
+{
+	{ MATERIAL_TEXTURED,  "TEXTURED" },
+	{ MATERIAL_SPECULAR,  "SPECULAR" },
+	{ MATERIAL_NORMALMAP, "NORMAL_MAP" },
+	{ MATERIAL_ALPHATEST, "ALPHA_TEST" },
+};
+
+// Normal maps and alpha testing both read textures through the diffuse UVs
+constexpr bool IsValidFeatureSet(uint32_t features)
+{
+	return (features >> MaterialFeatureCount) == 0 &&
+		((features & MATERIAL_NORMALMAP) == 0 || (features & MATERIAL_TEXTURED) != 0) &&
+		((features & MATERIAL_ALPHATEST) == 0 || (features & MATERIAL_TEXTURED) != 0);
+}
+
+// Every pixel shader permutation that is compiled at startup
+constexpr uint32_t MaterialPermutations[] =
+{
+	0,
+	MATERIAL_SPECULAR,
+	MATERIAL_TEXTURED,
+	MATERIAL_TEXTURED | MATERIAL_SPECULAR,
+	MATERIAL_TEXTURED | MATERIAL_ALPHATEST,
+	MATERIAL_TEXTURED | MATERIAL_SPECULAR | MATERIAL_NORMALMAP,
+	MATERIAL_TEXTURED | MATERIAL_SPECULAR | MATERIAL_NORMALMAP | MATERIAL_ALPHATEST,
+};
+
+const uint32_t MaterialPermutationCount = sizeof(MaterialPermutations) / sizeof(MaterialPermutations[0]);
+
+constexpr int FindPermutation(uint32_t features, uint32_t index = 0)
+{
+	return index >= MaterialPermutationCount ? -1 :
+		MaterialPermutations[index] == features ? (int)index : FindPermutation(features, index + 1);
+}
+
+constexpr bool AllPermutationsValid(uint32_t index = 0)
+{
+	return index >= MaterialPermutationCount ? true :
+		IsValidFeatureSet(MaterialPermutations[index]) &&
+		FindPermutation(MaterialPermutations[index]) == (int)index &&
+		AllPermutationsValid(index + 1);
+}
+
+static_assert(AllPermutationsValid(), "MaterialPermutations contains an invalid or duplicated feature set");
+
+// Compile time lookup of a permutation, fails to build for combinations that are invalid
+// or were never added to MaterialPermutations
+template<uint32_t Features>
+struct MaterialPermutation
+{
+	static_assert(IsValidFeatureSet(Features), "Invalid material feature combination");
+	static_assert(FindPermutation(Features) >= 0, "Material feature combination is not in MaterialPermutations");
+
+	static const uint32_t Index = (uint32_t)FindPermutation(Features);
+};
+
+// Mirrors the MaterialConstants cbuffer in framework.fx
+struct MaterialConstants
+{
+	XMFLOAT4 DiffuseMtrl;
+	XMFLOAT4 AmbientMtrl;
+	XMFLOAT4 SpecularMtrl;
+	FLOAT    SpecularPower;
+	FLOAT    AlphaCutoff;
+	XMFLOAT2 Padding;
+};
+
+//--------------------------------------------------------------------------------------
+// A material owns its constants on the GPU, they are written once when the material is
+// created instead of every frame.
+//--------------------------------------------------------------------------------------
+class Material
+{
+private:
+	uint32_t                  _features;
+	uint32_t                  _permutation;
+	D3D11_CULL_MODE           _cullMode;
+	MaterialConstants         _constants;
+	ID3D11Buffer*             _pConstantBuffer;
+	D3D11TrackedDevice*       _pDevice;          // that created the constants
+	ID3D11ShaderResourceView* _pDiffuseTexture;
+	ID3D11ShaderResourceView* _pNormalTexture;
+
+public:
+	Material();
+	~Material();
+
+	Material(const Material&) = delete;
+	Material& operator=(const Material&) = delete;
+
+	template<uint32_t Features>
+	void SetFeatures()
+	{
+		_features = Features;
+		_permutation = MaterialPermutation<Features>::Index;
+	}
+
+	// Data driven materials pick their features at run time, this fails for feature sets
+	// that aren't in MaterialPermutations
+	bool SetFeatures(uint32_t features);
+
+	MaterialConstants& GetConstants() { return _constants; }
+
+	// Back by default, the renderer keeps a rasterizer state per mode
+	void SetCullMode(D3D11_CULL_MODE cullMode) { _cullMode = cullMode; }
+
+	// Takes a reference on the views
+	void SetDiffuseTexture(ID3D11ShaderResourceView* pTexture);
+	void SetNormalTexture(ID3D11ShaderResourceView* pTexture);
+
+	HRESULT Create(D3D11TrackedDevice* pDevice);
+	void Release();
+
+	// Binds constants and textures, the caller binds the permutation's pixel shader
+	void Bind(ID3D11DeviceContext* pContext) const;
+
+	uint32_t GetFeatures() const { return _features; }
+	uint32_t GetPermutation() const { return _permutation; }
+	D3D11_CULL_MODE GetCullMode() const { return _cullMode; }
+	bool HasFeature(MaterialFeature feature) const { return (_features & feature) != 0; }
+};
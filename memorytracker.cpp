@@ -0,0 +1,123 @@
+#include "memorytracker.h"
+
+#include <cstdlib>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+#if defined(_WIN32) && defined(_DEBUG)
+#include <crtdbg.h>
+#endif
+
+std::atomic<size_t> MemoryTracker::_heapBytes[MEMTAG_COUNT];
+std::atomic<size_t> MemoryTracker::_liveBytes[MEMTAG_COUNT];
+std::atomic<size_t> MemoryTracker::_peakBytes[MEMTAG_COUNT];
+std::atomic<size_t> MemoryTracker::_heapCalls(0);
+
+#if defined(_WIN32) && defined(_DEBUG)
+static std::atomic<size_t> s_crtHeapCalls(0);
+static _CRT_ALLOC_HOOK s_pPreviousHook = nullptr;
+static bool s_heapHookInstalled = false;
+
+// Runs inside the CRT's allocator, so it only counts and must not allocate itself
+static int __cdecl CountHeapCall(int allocType, void* pUserData, size_t size, int blockType, long requestNumber,
+								 const unsigned char* pFilename, int lineNumber)
+{
+	// The CRT's own bookkeeping blocks aren't the program's
+	if (blockType != _CRT_BLOCK)
+		s_crtHeapCalls.fetch_add(1, std::memory_order_relaxed);
+
+	if (s_pPreviousHook != nullptr)
+		return s_pPreviousHook(allocType, pUserData, size, blockType, requestNumber, pFilename, lineNumber);
+
+	return TRUE;
+}
+#endif
+
+void* MemoryTracker::Allocate(size_t bytes, size_t alignment, MemoryTag tag)
+{
+	if (alignment < sizeof(void*))
+		alignment = sizeof(void*);
+
+#if defined(_WIN32)
+	void* ptr = _aligned_malloc(bytes, alignment);
+#else
+	// aligned_alloc wants the size to be a multiple of the alignment
+	size_t rounded = (bytes + alignment - 1) & ~(alignment - 1);
+	void* ptr = aligned_alloc(alignment, rounded);
+#endif
+
+	if (ptr == nullptr)
+		return nullptr;
+
+	_heapCalls.fetch_add(1, std::memory_order_relaxed);
+	_heapBytes[tag].fetch_add(bytes, std::memory_order_relaxed);
+
+	return ptr;
+}
+
+void MemoryTracker::Free(void* ptr, size_t bytes, MemoryTag tag)
+{
+	if (ptr == nullptr)
+		return;
+
+#if defined(_WIN32)
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+
+	_heapCalls.fetch_add(1, std::memory_order_relaxed);
+	_heapBytes[tag].fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void MemoryTracker::Track(MemoryTag tag, size_t bytes)
+{
+	size_t live = _liveBytes[tag].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+	size_t peak = _peakBytes[tag].load(std::memory_order_relaxed);
+
+	while (live > peak && !_peakBytes[tag].compare_exchange_weak(peak, live, std::memory_order_relaxed))
+	{
+	}
+}
+
+void MemoryTracker::Untrack(MemoryTag tag, size_t bytes)
+{
+	_liveBytes[tag].fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void MemoryTracker::InstallHeapHook()
+{
+#if defined(_WIN32) && defined(_DEBUG)
+	if (s_heapHookInstalled)
+		return;
+
+	s_pPreviousHook = _CrtSetAllocHook(CountHeapCall);
+	s_heapHookInstalled = true;
+#endif
+}
+
+size_t MemoryTracker::GetAllHeapCallCount()
+{
+#if defined(_WIN32) && defined(_DEBUG)
+	if (s_heapHookInstalled)
+		return s_crtHeapCalls.load(std::memory_order_relaxed);
+#endif
+
+	return GetHeapCallCount();
+}
+
+const char* MemoryTracker::GetTagName(MemoryTag tag)
+{
+	switch (tag)
+	{
+	case MEMTAG_GENERAL: return "General";
+	case MEMTAG_FRAME: return "Frame";
+	case MEMTAG_SCRATCH: return "Scratch";
+	case MEMTAG_SCENE: return "Scene";
+	case MEMTAG_RENDER: return "Render";
+	case MEMTAG_JOBS: return "Jobs";
+	default: return "Unknown";
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Tags used to attribute memory to the system that owns it
+enum MemoryTag
+{
+	MEMTAG_GENERAL = 0,
+	MEMTAG_FRAME,
+	MEMTAG_SCRATCH,
+	MEMTAG_SCENE,
+	MEMTAG_RENDER,
+	MEMTAG_JOBS,
+	MEMTAG_COUNT
+};
+
+//--------------------------------------------------------------------------------------
+// Global allocation accounting. Heap calls go through Allocate/Free so they can be
+// counted, arena and pool allocations are reported with Track/Untrack.
+//--------------------------------------------------------------------------------------
+class MemoryTracker
+{
+private:
+	static std::atomic<size_t> _heapBytes[MEMTAG_COUNT];
+	static std::atomic<size_t> _liveBytes[MEMTAG_COUNT];
+	static std::atomic<size_t> _peakBytes[MEMTAG_COUNT];
+	static std::atomic<size_t> _heapCalls;
+
+public:
+	static void* Allocate(size_t bytes, size_t alignment, MemoryTag tag);
+	static void Free(void* ptr, size_t bytes, MemoryTag tag);
+
+	static void Track(MemoryTag tag, size_t bytes);
+	static void Untrack(MemoryTag tag, size_t bytes);
+
+	static size_t GetHeapBytes(MemoryTag tag) { return _heapBytes[tag].load(std::memory_order_relaxed); }
+	static size_t GetLiveBytes(MemoryTag tag) { return _liveBytes[tag].load(std::memory_order_relaxed); }
+	static size_t GetPeakBytes(MemoryTag tag) { return _peakBytes[tag].load(std::memory_order_relaxed); }
+
+	// Number of heap allocations and frees made since startup
+	static size_t GetHeapCallCount() { return _heapCalls.load(std::memory_order_relaxed); }
+
+	// Counts every heap call the CRT sees, stray new and malloc included, not only the ones
+	// made through Allocate. Needs the debug CRT's allocation hook, without it the count
+	// falls back to GetHeapCallCount.
+	static void InstallHeapHook();
+	static size_t GetAllHeapCallCount();
+
+	static const char* GetTagName(MemoryTag tag);
+};
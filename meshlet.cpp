@@ -0,0 +1,441 @@
+#include "meshlet.h"
+
+#include <chrono>
+#include <cstring>
+#include <xmmintrin.h>
+#include "jobsystem.h"
+
+static inline Vec3 FetchPosition(const float* pPositions, size_t stride, uint32_t index)
+{
+	const float* p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(pPositions) + stride * index);
+	return Vec3(p[0], p[1], p[2]);
+}
+
+static void ComputeMeshletBounds(const float* pPositions, size_t stride, const MeshletMesh& mesh, Meshlet& meshlet)
+{
+	const uint32_t* pVertices = &mesh.vertices[meshlet.vertexOffset];
+	const uint8_t* pTriangles = &mesh.triangles[meshlet.triangleOffset];
+
+	// Sphere around the AABB centre
+	Vec3 minimum = FetchPosition(pPositions, stride, pVertices[0]);
+	Vec3 maximum = minimum;
+
+	for (uint32_t i = 1; i < meshlet.vertexCount; i++)
+	{
+		Vec3 p = FetchPosition(pPositions, stride, pVertices[i]);
+		minimum = Min(minimum, p);
+		maximum = Max(maximum, p);
+	}
+
+	meshlet.center = (minimum + maximum) * 0.5f;
+	meshlet.radius = 0.0f;
+
+	for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+		meshlet.radius = fmaxf(meshlet.radius, Length(FetchPosition(pPositions, stride, pVertices[i]) - meshlet.center));
+
+	// Normal cone, from the average face normal and the widest deviation from it
+	Vec3 normalSum;
+	Vec3 normals[DefaultMeshletTriangles * 2];
+	Vec3 corners[DefaultMeshletTriangles * 2];
+	uint32_t normalCount = 0;
+	uint32_t maxNormals = sizeof(normals) / sizeof(normals[0]);
+
+	for (uint32_t t = 0; t < meshlet.triangleCount && normalCount < maxNormals; t++)
+	{
+		Vec3 p0 = FetchPosition(pPositions, stride, pVertices[pTriangles[t * 3 + 0]]);
+		Vec3 p1 = FetchPosition(pPositions, stride, pVertices[pTriangles[t * 3 + 1]]);
+		Vec3 p2 = FetchPosition(pPositions, stride, pVertices[pTriangles[t * 3 + 2]]);
+
+		// Clockwise front faces in a left handed space, this points out of the surface
+		Vec3 normal = Cross(p1 - p0, p2 - p0);
+		float length = Length(normal);
+
+		if (length < 1.0e-12f)
+			continue;
+
+		normals[normalCount] = normal * (1.0f / length);
+		corners[normalCount] = p0;
+		normalSum += normals[normalCount];
+		normalCount++;
+	}
+
+	meshlet.coneApex = meshlet.center;
+	meshlet.coneAxis = Vec3();
+	meshlet.coneCutoff = 2.0f;
+
+	float axisLength = Length(normalSum);
+
+	if (normalCount == 0 || normalCount < meshlet.triangleCount || axisLength < 1.0e-6f)
+		return;
+
+	Vec3 axis = normalSum * (1.0f / axisLength);
+	float minDot = 1.0f;
+
+	for (uint32_t i = 0; i < normalCount; i++)
+		minDot = fminf(minDot, Dot(normals[i], axis));
+
+	// Too wide to ever be entirely back facing, culling would almost never hit
+	if (minDot <= 0.1f)
+		return;
+
+	// Move the apex back along the axis until it is behind every triangle's plane
+	float maxT = 0.0f;
+
+	for (uint32_t i = 0; i < normalCount; i++)
+	{
+		float t = Dot(meshlet.center - corners[i], normals[i]) / Dot(axis, normals[i]);
+		maxT = fmaxf(maxT, t);
+	}
+
+	meshlet.coneApex = meshlet.center - axis * maxT;
+	meshlet.coneAxis = axis;
+
+	// The back facing cone is the normal cone widened by 90 degrees and flipped,
+	// cos(a + 90) flipped is sin(a)
+	meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+}
+
+void BuildMeshlets(const float* pPositions, size_t positionStride, uint32_t vertexCount,
+				   const uint32_t* pIndices, uint32_t indexCount, MeshletMesh& mesh,
+				   uint32_t maxVertices, uint32_t maxTriangles)
+{
+	mesh.meshlets.clear();
+	mesh.vertices.clear();
+	mesh.triangles.clear();
+	mesh.indexCount = 0;
+
+	if (maxTriangles > DefaultMeshletTriangles * 2)
+		maxTriangles = DefaultMeshletTriangles * 2;
+
+	if (maxVertices > 256)
+		maxVertices = 256;
+
+	uint32_t triangleCount = indexCount / 3;
+
+	// Triangles around every vertex
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	std::vector<uint32_t> adjacency(triangleCount * 3);
+
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+		adjacencyOffsets[pIndices[i] + 1]++;
+
+	for (uint32_t v = 0; v < vertexCount; v++)
+		adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+
+	{
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+
+		for (uint32_t i = 0; i < triangleCount * 3; i++)
+			adjacency[fill[pIndices[i]]++] = i / 3;
+	}
+
+	std::vector<uint8_t> used(triangleCount, 0);
+	std::vector<int32_t> localIndex(vertexCount, -1);
+	std::vector<uint32_t> candidates;
+	uint32_t seed = 0;
+
+	for (;;)
+	{
+		while (seed < triangleCount && used[seed])
+			seed++;
+
+		if (seed == triangleCount)
+			break;
+
+		Meshlet meshlet = {};
+		meshlet.vertexOffset = (uint32_t)mesh.vertices.size();
+		meshlet.triangleOffset = (uint32_t)mesh.triangles.size();
+		meshlet.firstIndex = mesh.indexCount;
+
+		candidates.clear();
+		uint32_t next = seed;
+
+		for (;;)
+		{
+			used[next] = 1;
+
+			for (int c = 0; c < 3; c++)
+			{
+				uint32_t v = pIndices[next * 3 + c];
+
+				if (localIndex[v] < 0)
+				{
+					localIndex[v] = (int32_t)meshlet.vertexCount++;
+					mesh.vertices.push_back(v);
+
+					for (uint32_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; a++)
+					{
+						if (!used[adjacency[a]])
+							candidates.push_back(adjacency[a]);
+					}
+				}
+
+				mesh.triangles.push_back((uint8_t)localIndex[v]);
+			}
+
+			meshlet.triangleCount++;
+
+			if (meshlet.triangleCount == maxTriangles)
+				break;
+
+			// Neighbour that adds the fewest new vertices, earliest index on ties
+			uint32_t best = 0xFFFFFFFF;
+			uint32_t bestNew = 4;
+
+			for (size_t i = 0; i < candidates.size();)
+			{
+				uint32_t t = candidates[i];
+
+				if (used[t])
+				{
+					candidates[i] = candidates.back();
+					candidates.pop_back();
+					continue;
+				}
+
+				uint32_t newVertices = (localIndex[pIndices[t * 3 + 0]] < 0) + (localIndex[pIndices[t * 3 + 1]] < 0) +
+									   (localIndex[pIndices[t * 3 + 2]] < 0);
+
+				if (meshlet.vertexCount + newVertices <= maxVertices && (newVertices < bestNew || (newVertices == bestNew && t < best)))
+				{
+					best = t;
+					bestNew = newVertices;
+				}
+
+				i++;
+			}
+
+			if (best == 0xFFFFFFFF)
+				break;
+
+			next = best;
+		}
+
+		for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+			localIndex[mesh.vertices[meshlet.vertexOffset + i]] = -1;
+
+		mesh.indexCount += meshlet.triangleCount * 3;
+
+		ComputeMeshletBounds(pPositions, positionStride, mesh, meshlet);
+		mesh.meshlets.push_back(meshlet);
+	}
+}
+
+void MeshletMesh::ExpandIndices(std::vector<uint32_t>& indices) const
+{
+	indices.resize(indexCount);
+
+	for (size_t m = 0; m < meshlets.size(); m++)
+	{
+		const Meshlet& meshlet = meshlets[m];
+
+		for (uint32_t i = 0; i < meshlet.triangleCount * 3; i++)
+			indices[meshlet.firstIndex + i] = vertices[meshlet.vertexOffset + triangles[meshlet.triangleOffset + i]];
+	}
+}
+
+MeshletCuller::MeshletCuller()
+{
+	_pMesh = nullptr;
+	memset(&_stats, 0, sizeof(_stats));
+	memset(_planes, 0, sizeof(_planes));
+	_coneCull = true;
+}
+
+void MeshletCuller::Prepare(const MeshletMesh& mesh)
+{
+	size_t count = mesh.meshlets.size();
+	size_t padded = (count + 3) & ~(size_t)3;
+
+	if (_pMesh == &mesh && _visible.size() == padded)
+		return;
+
+	_pMesh = &mesh;
+
+	std::vector<float>* arrays[] = { &_centerX, &_centerY, &_centerZ, &_radius, &_apexX, &_apexY, &_apexZ,
+									 &_axisX, &_axisY, &_axisZ, &_cutoff };
+
+	for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++)
+		arrays[a]->assign(padded, 0.0f);
+
+	// Padding lanes never pass the cone test and are skipped when results are read
+	for (size_t i = 0; i < padded; i++)
+	{
+		if (i >= count)
+		{
+			_cutoff[i] = 2.0f;
+			continue;
+		}
+
+		const Meshlet& meshlet = mesh.meshlets[i];
+		_centerX[i] = meshlet.center.x;
+		_centerY[i] = meshlet.center.y;
+		_centerZ[i] = meshlet.center.z;
+		_radius[i] = meshlet.radius;
+		_apexX[i] = meshlet.coneApex.x;
+		_apexY[i] = meshlet.coneApex.y;
+		_apexZ[i] = meshlet.coneApex.z;
+		_axisX[i] = meshlet.coneAxis.x;
+		_axisY[i] = meshlet.coneAxis.y;
+		_axisZ[i] = meshlet.coneAxis.z;
+		_cutoff[i] = meshlet.coneCutoff;
+	}
+
+	_visible.assign(padded, 0);
+	_draws.reserve(count);
+}
+
+void MeshletCuller::CullGroups(void* pData, uint32_t begin, uint32_t end)
+{
+	MeshletCuller* pCuller = static_cast<MeshletCuller*>(pData);
+
+	__m128 eyeX = _mm_set1_ps(pCuller->_eye.x);
+	__m128 eyeY = _mm_set1_ps(pCuller->_eye.y);
+	__m128 eyeZ = _mm_set1_ps(pCuller->_eye.z);
+
+	for (uint32_t g = begin; g < end; g++)
+	{
+		uint32_t i = g * 4;
+
+		__m128 cx = _mm_loadu_ps(&pCuller->_centerX[i]);
+		__m128 cy = _mm_loadu_ps(&pCuller->_centerY[i]);
+		__m128 cz = _mm_loadu_ps(&pCuller->_centerZ[i]);
+		__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&pCuller->_radius[i]));
+
+		__m128 inside = _mm_cmpeq_ps(cx, cx);
+
+		for (int p = 0; p < 6; p++)
+		{
+			const float* plane = pCuller->_planes[p];
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane[0])), _mm_mul_ps(cy, _mm_set1_ps(plane[1]))),
+								  _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane[2])), _mm_set1_ps(plane[3])));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negRadius));
+		}
+
+		// Back facing when the camera sits inside the cone behind the apex
+		__m128 vx = _mm_sub_ps(_mm_loadu_ps(&pCuller->_apexX[i]), eyeX);
+		__m128 vy = _mm_sub_ps(_mm_loadu_ps(&pCuller->_apexY[i]), eyeY);
+		__m128 vz = _mm_sub_ps(_mm_loadu_ps(&pCuller->_apexZ[i]), eyeZ);
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_loadu_ps(&pCuller->_axisX[i])), _mm_mul_ps(vy, _mm_loadu_ps(&pCuller->_axisY[i]))),
+								_mm_mul_ps(vz, _mm_loadu_ps(&pCuller->_axisZ[i])));
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+		__m128 backFacing = _mm_cmpgt_ps(dot, _mm_mul_ps(_mm_loadu_ps(&pCuller->_cutoff[i]), length));
+
+		int insideMask = _mm_movemask_ps(inside);
+		int backMask = pCuller->_coneCull ? _mm_movemask_ps(backFacing) : 0;
+
+		for (int lane = 0; lane < 4; lane++)
+		{
+			uint8_t result = 0;
+
+			if (!(insideMask & (1 << lane)))
+				result = 1;
+			else if (backMask & (1 << lane))
+				result = 2;
+
+			pCuller->_visible[i + lane] = result;
+		}
+	}
+}
+
+void MeshletCuller::Cull(const MeshletMesh& mesh, const Mat4& world, const Mat4& viewProjection, const Vec3& eye, JobSystem* pJobSystem,
+						 bool coneCull)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	Prepare(mesh);
+
+	// Object space frustum planes straight out of the combined matrix, inward facing
+	Mat4 m = Multiply(world, viewProjection);
+
+	for (int p = 0; p < 6; p++)
+	{
+		int axis = p < 4 ? p / 2 : 2;
+		float sign = (p & 1) ? -1.0f : 1.0f;
+
+		for (int c = 0; c < 4; c++)
+		{
+			if (p == 4)
+				_planes[p][c] = m.m[c][2];                        // near
+			else if (p == 5)
+				_planes[p][c] = m.m[c][3] - m.m[c][2];            // far
+			else
+				_planes[p][c] = m.m[c][3] + sign * m.m[c][axis];  // left, right, bottom, top
+		}
+
+		float length = sqrtf(_planes[p][0] * _planes[p][0] + _planes[p][1] * _planes[p][1] + _planes[p][2] * _planes[p][2]);
+
+		if (length > 0.0f)
+		{
+			for (int c = 0; c < 4; c++)
+				_planes[p][c] /= length;
+		}
+	}
+
+	_eye = TransformPoint(eye, Inverse(world));
+	_coneCull = coneCull;
+
+	uint32_t groups = (uint32_t)(_visible.size() / 4);
+
+	if (pJobSystem)
+		pJobSystem->ParallelFor(groups, 64, &MeshletCuller::CullGroups, this);
+	else
+		CullGroups(this, 0, groups);
+
+	// Merge runs of visible meshlets into as few draws as possible
+	memset(&_stats, 0, sizeof(_stats));
+	_draws.clear();
+
+	for (size_t i = 0; i < mesh.meshlets.size(); i++)
+	{
+		const Meshlet& meshlet = mesh.meshlets[i];
+
+		_stats.meshletsTested++;
+		_stats.trianglesTested += meshlet.triangleCount;
+
+		if (_visible[i] != 0)
+		{
+			if (_visible[i] == 1)
+				_stats.frustumCulled++;
+			else
+				_stats.coneCulled++;
+
+			_stats.trianglesRejected += meshlet.triangleCount;
+			continue;
+		}
+
+		_stats.meshletsVisible++;
+
+		if (!_draws.empty() && _draws.back().firstIndex + _draws.back().indexCount == meshlet.firstIndex)
+		{
+			_draws.back().indexCount += meshlet.triangleCount * 3;
+		}
+		else
+		{
+			MeshletDraw draw = { meshlet.firstIndex, meshlet.triangleCount * 3 };
+			_draws.push_back(draw);
+		}
+	}
+
+	_stats.drawCount = (uint32_t)_draws.size();
+	_stats.cullMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void MeshletCuller::BuildCompactIndices(std::vector<uint32_t>& indices) const
+{
+	indices.clear();
+
+	if (_pMesh == nullptr)
+		return;
+
+	for (size_t m = 0; m < _pMesh->meshlets.size(); m++)
+	{
+		if (_visible[m] != 0)
+			continue;
+
+		const Meshlet& meshlet = _pMesh->meshlets[m];
+
+		for (uint32_t i = 0; i < meshlet.triangleCount * 3; i++)
+			indices.push_back(_pMesh->vertices[meshlet.vertexOffset + _pMesh->triangles[meshlet.triangleOffset + i]]);
+	}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "cpumath.h"
+
+class JobSystem;
+
+const uint32_t DefaultMeshletVertices = 64;
+const uint32_t DefaultMeshletTriangles = 124;
+
+struct Meshlet
+{
+	uint32_t vertexOffset;    // into MeshletMesh::vertices
+	uint32_t triangleOffset;  // into MeshletMesh::triangles, 3 local indices per triangle
+	uint32_t vertexCount;
+	uint32_t triangleCount;
+	uint32_t firstIndex;      // where the meshlet starts in the expanded index list
+
+	// Object space bounds. The cone is the set of view directions from which every
+	// triangle faces away, a cutoff above 1 means the meshlet can't be cone culled.
+	Vec3     center;
+	float    radius;
+	Vec3     coneApex;
+	Vec3     coneAxis;
+	float    coneCutoff;
+};
+
+//--------------------------------------------------------------------------------------
+// Mesh split into small clusters of triangles. Meshlets are grown greedily from a seed
+// triangle by adding the neighbour that needs the fewest new vertices, so they stay
+// spatially compact and their bounds stay tight.
+//--------------------------------------------------------------------------------------
+struct MeshletMesh
+{
+	std::vector<Meshlet>  meshlets;
+	std::vector<uint32_t> vertices;   // mesh vertex index of every meshlet vertex
+	std::vector<uint8_t>  triangles;  // meshlet local vertex indices
+	uint32_t              indexCount;
+
+	// Triangle lists of every meshlet back to back as mesh vertex indices. Draw ranges
+	// from the culler index into this.
+	void ExpandIndices(std::vector<uint32_t>& indices) const;
+};
+
+// positionStride is in bytes so interleaved vertex data can be passed directly. Triangles
+// are expected clockwise when seen from the front, as D3D draws them by default.
+void BuildMeshlets(const float* pPositions, size_t positionStride, uint32_t vertexCount,
+				   const uint32_t* pIndices, uint32_t indexCount, MeshletMesh& mesh,
+				   uint32_t maxVertices = DefaultMeshletVertices, uint32_t maxTriangles = DefaultMeshletTriangles);
+
+struct MeshletDraw
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+};
+
+struct MeshletCullStats
+{
+	uint32_t meshletsTested;
+	uint32_t meshletsVisible;
+	uint32_t frustumCulled;
+	uint32_t coneCulled;
+	uint32_t trianglesTested;
+	uint32_t trianglesRejected;
+	uint32_t drawCount;
+	double   cullMs;
+};
+
+//--------------------------------------------------------------------------------------
+// Frustum and normal cone culling of meshlets, four at a time with SSE and spread over
+// the job system. The camera is moved into object space so the tests stay exact for any
+// world matrix. Survivors come out as draw ranges into the expanded index list, with
+// neighbouring meshlets merged, or as a compacted index list.
+//--------------------------------------------------------------------------------------
+class MeshletCuller
+{
+private:
+	// Meshlet bounds in structure of arrays form, padded to a multiple of 4
+	const MeshletMesh*  _pMesh;
+	std::vector<float>  _centerX, _centerY, _centerZ, _radius;
+	std::vector<float>  _apexX, _apexY, _apexZ;
+	std::vector<float>  _axisX, _axisY, _axisZ, _cutoff;
+
+	std::vector<uint8_t>     _visible;   // 0 visible, 1 frustum culled, 2 cone culled
+	std::vector<MeshletDraw> _draws;
+	MeshletCullStats         _stats;
+
+	// Per-call state read by the jobs
+	float _planes[6][4];
+	Vec3  _eye;
+	bool  _coneCull;
+
+private:
+	void Prepare(const MeshletMesh& mesh);
+	static void CullGroups(void* pData, uint32_t begin, uint32_t end);
+
+public:
+	MeshletCuller();
+
+	// eye is the world space camera position. The normal cone test assumes back faces are
+	// culled, pass coneCull false for materials drawn two sided or with front faces culled.
+	void Cull(const MeshletMesh& mesh, const Mat4& world, const Mat4& viewProjection, const Vec3& eye, JobSystem* pJobSystem,
+			  bool coneCull = true);
+
+	// Indices of every surviving triangle, for renderers that want a single draw
+	void BuildCompactIndices(std::vector<uint32_t>& indices) const;
+
+	bool IsVisible(uint32_t meshlet) const { return _visible[meshlet] == 0; }
+	const std::vector<MeshletDraw>& GetDraws() const { return _draws; }
+	const MeshletCullStats& GetStats() const { return _stats; }
+};
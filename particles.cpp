@@ -0,0 +1,467 @@
+#include "particles.h"
+
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+#include <emmintrin.h>
+#include "jobsystem.h"
+
+ParticleEmitterDesc::ParticleEmitterDesc()
+{
+	drag = 0.0f;
+	lifeMin = 1.0f;
+	lifeMax = 1.0f;
+	sizeStart = 0.1f;
+	sizeEnd = 0.1f;
+
+	for (int i = 0; i < 4; i++)
+	{
+		colorStart[i] = 1.0f;
+		colorEnd[i] = 1.0f;
+	}
+
+	rate = 0.0f;
+	groundHeight = -FLT_MAX;
+	restitution = 0.0f;
+	additive = false;
+	sorted = false;
+}
+
+ParticleSystem::ParticleSystem()
+{
+	_capacity = 0;
+	_count = 0;
+	_emitDebt = 0.0f;
+	memset(_random, 0, sizeof(_random));
+	memset(&_stats, 0, sizeof(_stats));
+	_dt = 0.0f;
+	_pInstances = nullptr;
+}
+
+void ParticleSystem::Init(const ParticleEmitterDesc& desc, uint32_t capacity, uint32_t seed)
+{
+	_desc = desc;
+	_capacity = capacity;
+
+	// Emission starts its groups of 4 at any index, so one extra group past the rounding
+	uint32_t padded = ((capacity + 3) & ~3u) + 4;
+	_posX.assign(padded, 0.0f);
+	_posY.assign(padded, 0.0f);
+	_posZ.assign(padded, 0.0f);
+	_velX.assign(padded, 0.0f);
+	_velY.assign(padded, 0.0f);
+	_velZ.assign(padded, 0.0f);
+	_age.assign(padded, 0.0f);
+	_invLife.assign(padded, 1.0f);
+
+	uint32_t blockCount = (capacity + ParticleBlockSize - 1) / ParticleBlockSize;
+	_dead.resize(blockCount * ParticleBlockSize);
+	_deadCounts.assign(blockCount, 0);
+
+	_sortItems.clear();
+	_sortScratch.clear();
+
+	// Xorshift must not start at zero, and the lanes must differ
+	for (int i = 0; i < 4; i++)
+	{
+		uint32_t x = seed * 0x9E3779B9u + (uint32_t)i * 0x85EBCA6Bu;
+		x ^= x >> 16;
+		x *= 0x7FEB352Du;
+		x ^= x >> 15;
+		_random[i] = x ? x : 0x6D2B79F5u;
+	}
+
+	Clear();
+}
+
+void ParticleSystem::Clear()
+{
+	_count = 0;
+	_emitDebt = 0.0f;
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+//--------------------------------------------------------------------------------------
+// Emit
+//--------------------------------------------------------------------------------------
+static inline __m128i NextRandom(__m128i x)
+{
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+	return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+// Maps random bits to [-1, 1) through the mantissa of a float in [2, 4)
+static inline __m128 RandomSigned(__m128i x)
+{
+	__m128i bits = _mm_or_si128(_mm_srli_epi32(x, 9), _mm_set1_epi32(0x40000000));
+	return _mm_sub_ps(_mm_castsi128_ps(bits), _mm_set1_ps(3.0f));
+}
+
+void ParticleSystem::Emit(uint32_t count)
+{
+	if (count > _capacity - _count)
+		count = _capacity - _count;
+	if (count == 0)
+		return;
+
+	const __m128 posBase[3] = { _mm_set1_ps(_desc.position.x), _mm_set1_ps(_desc.position.y), _mm_set1_ps(_desc.position.z) };
+	const __m128 posJitter[3] = { _mm_set1_ps(_desc.positionJitter.x), _mm_set1_ps(_desc.positionJitter.y), _mm_set1_ps(_desc.positionJitter.z) };
+	const __m128 velBase[3] = { _mm_set1_ps(_desc.velocity.x), _mm_set1_ps(_desc.velocity.y), _mm_set1_ps(_desc.velocity.z) };
+	const __m128 velJitter[3] = { _mm_set1_ps(_desc.velocityJitter.x), _mm_set1_ps(_desc.velocityJitter.y), _mm_set1_ps(_desc.velocityJitter.z) };
+	const __m128 lifeMid = _mm_set1_ps((_desc.lifeMin + _desc.lifeMax) * 0.5f);
+	const __m128 lifeHalf = _mm_set1_ps((_desc.lifeMax - _desc.lifeMin) * 0.5f);
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	float* pos[3] = { _posX.data(), _posY.data(), _posZ.data() };
+	float* vel[3] = { _velX.data(), _velY.data(), _velZ.data() };
+	float* age = _age.data();
+	float* invLife = _invLife.data();
+
+	__m128i random = _mm_loadu_si128((const __m128i*)_random);
+
+	// Writes whole groups of 4; the lanes past the new count land in the padding or on
+	// slots that are not live yet, and are overwritten by the next emission
+	uint32_t end = _count + count;
+	for (uint32_t i = _count; i < end; i += 4)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			random = NextRandom(random);
+			_mm_storeu_ps(pos[axis] + i, _mm_add_ps(posBase[axis], _mm_mul_ps(RandomSigned(random), posJitter[axis])));
+			random = NextRandom(random);
+			_mm_storeu_ps(vel[axis] + i, _mm_add_ps(velBase[axis], _mm_mul_ps(RandomSigned(random), velJitter[axis])));
+		}
+
+		random = NextRandom(random);
+		__m128 life = _mm_add_ps(lifeMid, _mm_mul_ps(RandomSigned(random), lifeHalf));
+		_mm_storeu_ps(invLife + i, _mm_div_ps(one, life));
+		_mm_storeu_ps(age + i, _mm_setzero_ps());
+	}
+
+	_mm_storeu_si128((__m128i*)_random, random);
+
+	_count = end;
+	_stats.emitted += count;
+}
+
+//--------------------------------------------------------------------------------------
+// Update
+//--------------------------------------------------------------------------------------
+void ParticleSystem::UpdateBlocks(void* pData, uint32_t begin, uint32_t end)
+{
+	ParticleSystem* pSystem = (ParticleSystem*)pData;
+	const ParticleEmitterDesc& desc = pSystem->_desc;
+
+	const __m128 dt = _mm_set1_ps(pSystem->_dt);
+	const __m128 damping = _mm_set1_ps(fmaxf(1.0f - desc.drag * pSystem->_dt, 0.0f));
+	const __m128 accelX = _mm_set1_ps(desc.acceleration.x * pSystem->_dt);
+	const __m128 accelY = _mm_set1_ps(desc.acceleration.y * pSystem->_dt);
+	const __m128 accelZ = _mm_set1_ps(desc.acceleration.z * pSystem->_dt);
+	const __m128 ground = _mm_set1_ps(desc.groundHeight);
+	const __m128 bounce = _mm_set1_ps(-desc.restitution);
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	float* posX = pSystem->_posX.data();
+	float* posY = pSystem->_posY.data();
+	float* posZ = pSystem->_posZ.data();
+	float* velX = pSystem->_velX.data();
+	float* velY = pSystem->_velY.data();
+	float* velZ = pSystem->_velZ.data();
+	float* age = pSystem->_age.data();
+	const float* invLife = pSystem->_invLife.data();
+	uint32_t count = pSystem->_count;
+
+	for (uint32_t block = begin; block < end; block++)
+	{
+		uint32_t first = block * ParticleBlockSize;
+		uint32_t last = first + ParticleBlockSize < count ? first + ParticleBlockSize : count;
+		uint32_t* pDead = pSystem->_dead.data() + first;
+		uint32_t deadCount = 0;
+
+		for (uint32_t i = first; i < last; i += 4)
+		{
+			__m128 vx = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(velX + i), damping), accelX);
+			__m128 vy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(velY + i), damping), accelY);
+			__m128 vz = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(velZ + i), damping), accelZ);
+
+			__m128 px = _mm_add_ps(_mm_loadu_ps(posX + i), _mm_mul_ps(vx, dt));
+			__m128 py = _mm_add_ps(_mm_loadu_ps(posY + i), _mm_mul_ps(vy, dt));
+			__m128 pz = _mm_add_ps(_mm_loadu_ps(posZ + i), _mm_mul_ps(vz, dt));
+
+			// Below the ground: clamp to it and reflect the vertical velocity
+			__m128 below = _mm_cmplt_ps(py, ground);
+			py = _mm_max_ps(py, ground);
+			vy = _mm_or_ps(_mm_and_ps(below, _mm_mul_ps(vy, bounce)), _mm_andnot_ps(below, vy));
+
+			_mm_storeu_ps(velX + i, vx);
+			_mm_storeu_ps(velY + i, vy);
+			_mm_storeu_ps(velZ + i, vz);
+			_mm_storeu_ps(posX + i, px);
+			_mm_storeu_ps(posY + i, py);
+			_mm_storeu_ps(posZ + i, pz);
+
+			__m128 a = _mm_add_ps(_mm_loadu_ps(age + i), dt);
+			_mm_storeu_ps(age + i, a);
+
+			int mask = _mm_movemask_ps(_mm_cmpge_ps(_mm_mul_ps(a, _mm_loadu_ps(invLife + i)), one));
+			while (mask)
+			{
+				uint32_t lane = 0;
+				while (!(mask & (1 << lane)))
+					lane++;
+				mask &= ~(1 << lane);
+
+				if (i + lane < last)
+					pDead[deadCount++] = i + lane;
+			}
+		}
+
+		pSystem->_deadCounts[block] = deadCount;
+	}
+}
+
+void ParticleSystem::Kill()
+{
+	float* arrays[8] = { _posX.data(), _posY.data(), _posZ.data(), _velX.data(), _velY.data(), _velZ.data(), _age.data(), _invLife.data() };
+
+	// Highest indices first, so the particle moved into a hole is always one that has
+	// already been checked and is alive
+	uint32_t blockCount = (_count + ParticleBlockSize - 1) / ParticleBlockSize;
+	uint32_t killed = 0;
+
+	for (uint32_t block = blockCount; block-- > 0;)
+	{
+		const uint32_t* pDead = _dead.data() + block * ParticleBlockSize;
+
+		for (uint32_t d = _deadCounts[block]; d-- > 0;)
+		{
+			uint32_t index = pDead[d];
+			uint32_t lastIndex = --_count;
+
+			if (index != lastIndex)
+			{
+				for (int a = 0; a < 8; a++)
+					arrays[a][index] = arrays[a][lastIndex];
+			}
+
+			killed++;
+		}
+	}
+
+	_stats.killed += killed;
+}
+
+void ParticleSystem::Update(float dt, JobSystem* pJobSystem)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	_stats.emitted = 0;
+	_stats.killed = 0;
+
+	_emitDebt += _desc.rate * dt;
+	uint32_t emitCount = (uint32_t)_emitDebt;
+	_emitDebt -= (float)emitCount;
+	Emit(emitCount);
+
+	_dt = dt;
+	uint32_t blockCount = (_count + ParticleBlockSize - 1) / ParticleBlockSize;
+
+	if (pJobSystem)
+		pJobSystem->ParallelFor(blockCount, 1, &ParticleSystem::UpdateBlocks, this);
+	else
+		UpdateBlocks(this, 0, blockCount);
+
+	Kill();
+
+	_stats.alive = _count;
+	_stats.updateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+//--------------------------------------------------------------------------------------
+// Sort
+//--------------------------------------------------------------------------------------
+void ParticleSystem::Sort(const Mat4& view)
+{
+	if (!_desc.sorted)
+		return;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	_sortItems.resize(_count);
+	_sortScratch.resize(_count);
+
+	// View space depth is the dot product with the third column of the view matrix
+	const __m128 axisX = _mm_set1_ps(view.m[0][2]);
+	const __m128 axisY = _mm_set1_ps(view.m[1][2]);
+	const __m128 axisZ = _mm_set1_ps(view.m[2][2]);
+	const __m128 offset = _mm_set1_ps(view.m[3][2]);
+
+	for (uint32_t i = 0; i < _count; i += 4)
+	{
+		__m128 depth = _mm_add_ps(offset, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(_posX.data() + i), axisX),
+			_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(_posY.data() + i), axisY), _mm_mul_ps(_mm_loadu_ps(_posZ.data() + i), axisZ))));
+
+		// Float bits to an unsigned key that orders like the float, inverted so the
+		// farthest particle gets the smallest key
+		__m128i bits = _mm_castps_si128(depth);
+		__m128i sign = _mm_srai_epi32(bits, 31);
+		__m128i key = _mm_xor_si128(bits, _mm_or_si128(sign, _mm_set1_epi32((int)0x80000000)));
+		key = _mm_xor_si128(key, _mm_set1_epi32(-1));
+
+		uint32_t keys[4];
+		_mm_storeu_si128((__m128i*)keys, key);
+
+		uint32_t lanes = _count - i < 4 ? _count - i : 4;
+		for (uint32_t lane = 0; lane < lanes; lane++)
+			_sortItems[i + lane] = ((uint64_t)keys[lane] << 32) | (i + lane);
+	}
+
+	// LSD radix sort on the top 22 bits of the key, which keeps the sign, exponent and 13
+	// bits of mantissa: depth to within 1/8192 of itself, finer than blending can show
+	uint64_t* pSrc = _sortItems.data();
+	uint64_t* pDst = _sortScratch.data();
+
+	for (uint32_t shift = 42; shift < 64; shift += 11)
+	{
+		uint32_t histogram[2048];
+		memset(histogram, 0, sizeof(histogram));
+
+		for (uint32_t i = 0; i < _count; i++)
+			histogram[(pSrc[i] >> shift) & 2047]++;
+
+		uint32_t sum = 0;
+		for (uint32_t d = 0; d < 2048; d++)
+		{
+			uint32_t c = histogram[d];
+			histogram[d] = sum;
+			sum += c;
+		}
+
+		for (uint32_t i = 0; i < _count; i++)
+			pDst[histogram[(pSrc[i] >> shift) & 2047]++] = pSrc[i];
+
+		uint64_t* pTemp = pSrc;
+		pSrc = pDst;
+		pDst = pTemp;
+	}
+
+	// pSrc holds the sorted order after the last swap. The particles themselves are
+	// moved into that order so the instance write reads them in sequence; they barely move
+	// between frames, so the next sort and this copy mostly walk memory in order too.
+	const uint64_t* pOrder = pSrc;
+	float* arrays[8] = { _posX.data(), _posY.data(), _posZ.data(), _velX.data(), _velY.data(), _velZ.data(), _age.data(), _invLife.data() };
+	_permuteScratch.resize(_count);
+
+	for (int a = 0; a < 8; a++)
+	{
+		for (uint32_t i = 0; i < _count; i++)
+			_permuteScratch[i] = arrays[a][(uint32_t)pOrder[i]];
+		memcpy(arrays[a], _permuteScratch.data(), _count * sizeof(float));
+	}
+
+	_stats.sortMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+//--------------------------------------------------------------------------------------
+// Instances
+//--------------------------------------------------------------------------------------
+// Four channels in [0, 1] to RGBA8, red in the low byte
+static inline __m128i PackColors(__m128 r, __m128 g, __m128 b, __m128 a)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f);
+
+	__m128i ir = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(r, zero), one), scale));
+	__m128i ig = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(g, zero), one), scale));
+	__m128i ib = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(b, zero), one), scale));
+	__m128i ia = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(a, zero), one), scale));
+
+	return _mm_or_si128(_mm_or_si128(ir, _mm_slli_epi32(ig, 8)), _mm_or_si128(_mm_slli_epi32(ib, 16), _mm_slli_epi32(ia, 24)));
+}
+
+void ParticleSystem::WriteBlocks(void* pData, uint32_t begin, uint32_t end)
+{
+	ParticleSystem* pSystem = (ParticleSystem*)pData;
+	const ParticleEmitterDesc& desc = pSystem->_desc;
+
+	const float* posX = pSystem->_posX.data();
+	const float* posY = pSystem->_posY.data();
+	const float* posZ = pSystem->_posZ.data();
+	const float* age = pSystem->_age.data();
+	const float* invLife = pSystem->_invLife.data();
+	ParticleInstance* pInstances = pSystem->_pInstances;
+	uint32_t count = pSystem->_count;
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 sizeStart = _mm_set1_ps(desc.sizeStart);
+	const __m128 sizeDelta = _mm_set1_ps(desc.sizeEnd - desc.sizeStart);
+	__m128 colorStart[4], colorDelta[4];
+	for (int c = 0; c < 4; c++)
+	{
+		colorStart[c] = _mm_set1_ps(desc.colorStart[c]);
+		colorDelta[c] = _mm_set1_ps(desc.colorEnd[c] - desc.colorStart[c]);
+	}
+
+	for (uint32_t block = begin; block < end; block++)
+	{
+		uint32_t first = block * ParticleBlockSize;
+		uint32_t last = first + ParticleBlockSize < count ? first + ParticleBlockSize : count;
+
+		for (uint32_t i = first; i < last; i += 4)
+		{
+			uint32_t lanes = last - i < 4 ? last - i : 4;
+			__m128 x = _mm_loadu_ps(posX + i);
+			__m128 y = _mm_loadu_ps(posY + i);
+			__m128 z = _mm_loadu_ps(posZ + i);
+			__m128 t = _mm_min_ps(_mm_mul_ps(_mm_loadu_ps(age + i), _mm_loadu_ps(invLife + i)), one);
+
+			__m128 size = _mm_add_ps(sizeStart, _mm_mul_ps(sizeDelta, t));
+			__m128 alpha = _mm_add_ps(colorStart[3], _mm_mul_ps(colorDelta[3], t));
+			__m128 r = _mm_mul_ps(_mm_add_ps(colorStart[0], _mm_mul_ps(colorDelta[0], t)), alpha);
+			__m128 g = _mm_mul_ps(_mm_add_ps(colorStart[1], _mm_mul_ps(colorDelta[1], t)), alpha);
+			__m128 b = _mm_mul_ps(_mm_add_ps(colorStart[2], _mm_mul_ps(colorDelta[2], t)), alpha);
+
+			// Premultiplied; additive particles keep their colour but clear alpha so the
+			// ONE, INV_SRC_ALPHA blend leaves what is behind them untouched
+			if (desc.additive)
+				alpha = _mm_setzero_ps();
+
+			float values[4][4];
+			uint32_t colors[4];
+			_mm_storeu_ps(values[0], x);
+			_mm_storeu_ps(values[1], y);
+			_mm_storeu_ps(values[2], z);
+			_mm_storeu_ps(values[3], size);
+			_mm_storeu_si128((__m128i*)colors, PackColors(r, g, b, alpha));
+
+			for (uint32_t lane = 0; lane < lanes; lane++)
+			{
+				ParticleInstance& instance = pInstances[i + lane];
+				instance.position[0] = values[0][lane];
+				instance.position[1] = values[1][lane];
+				instance.position[2] = values[2][lane];
+				instance.size = values[3][lane];
+				instance.color = colors[lane];
+			}
+		}
+	}
+}
+
+void ParticleSystem::WriteInstances(ParticleInstance* pInstances, JobSystem* pJobSystem)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	_pInstances = pInstances;
+	uint32_t blockCount = (_count + ParticleBlockSize - 1) / ParticleBlockSize;
+
+	if (pJobSystem)
+		pJobSystem->ParallelFor(blockCount, 1, &ParticleSystem::WriteBlocks, this);
+	else
+		WriteBlocks(this, 0, blockCount);
+
+	_pInstances = nullptr;
+
+	_stats.writeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
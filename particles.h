@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "cpumath.h"
+
+class JobSystem;
+
+// Particles handed to one job, and the granularity of the kill lists
+const uint32_t ParticleBlockSize = 4096;
+
+struct ParticleEmitterDesc
+{
+	Vec3  position;
+	Vec3  positionJitter;   // half extents of the box particles start in
+	Vec3  velocity;
+	Vec3  velocityJitter;
+	Vec3  acceleration;     // gravity, wind
+	float drag;             // fraction of velocity lost per second
+	float lifeMin;
+	float lifeMax;
+	float sizeStart;
+	float sizeEnd;
+	float colorStart[4];
+	float colorEnd[4];
+	float rate;             // particles per second
+	float groundHeight;     // particles bounce off this plane
+	float restitution;
+	bool  additive;         // written with zero alpha so premultiplied blending adds them
+	bool  sorted;           // drawn back to front
+
+	ParticleEmitterDesc();
+};
+
+// Per-instance data of a billboard, matches the particle input layout
+struct ParticleInstance
+{
+	float    position[3];
+	float    size;
+	uint32_t color;  // premultiplied RGBA8
+};
+
+struct ParticleStats
+{
+	uint32_t alive;
+	uint32_t emitted;
+	uint32_t killed;
+	double   updateMs;
+	double   sortMs;
+	double   writeMs;
+};
+
+//--------------------------------------------------------------------------------------
+// One effect's particles, stored as a structure of arrays and simulated four at a time
+// with SSE. Emission appends new particles using a four lane random generator. Update
+// spreads blocks of particles over the job system; each block integrates, bounces off
+// the ground and lists the particles that died. The dead are then replaced by the last
+// live particles, so the arrays stay packed and killing costs one copy per death.
+//--------------------------------------------------------------------------------------
+class ParticleSystem
+{
+private:
+	ParticleEmitterDesc _desc;
+	uint32_t            _capacity;
+	uint32_t            _count;
+	float               _emitDebt;  // fractional particles carried to the next frame
+	uint32_t            _random[4];
+
+	// Padded past the capacity so the kernels always work on whole groups of 4
+	std::vector<float>  _posX, _posY, _posZ;
+	std::vector<float>  _velX, _velY, _velZ;
+	std::vector<float>  _age, _invLife;
+
+	std::vector<uint32_t> _dead;        // ParticleBlockSize slots per block
+	std::vector<uint32_t> _deadCounts;  // per block
+
+	// Depth key in the high half, particle index in the low half
+	std::vector<uint64_t> _sortItems;
+	std::vector<uint64_t> _sortScratch;
+	std::vector<float>    _permuteScratch;
+
+	ParticleStats _stats;
+
+	// Per-call state read by the jobs
+	float             _dt;
+	ParticleInstance* _pInstances;
+
+private:
+	void Emit(uint32_t count);
+	void Kill();
+	static void UpdateBlocks(void* pData, uint32_t begin, uint32_t end);
+	static void WriteBlocks(void* pData, uint32_t begin, uint32_t end);
+
+public:
+	ParticleSystem();
+
+	void Init(const ParticleEmitterDesc& desc, uint32_t capacity, uint32_t seed = 1);
+	void Clear();
+
+	// Emits for dt at the emitter's rate, then integrates and kills. pJobSystem may be null.
+	void Update(float dt, JobSystem* pJobSystem);
+
+	// Reorders the particles back to front along the camera's view direction, only for
+	// sorted emitters. view is the world to view matrix.
+	void Sort(const Mat4& view);
+
+	// Fills instances for every live particle in their current order, so after Sort when
+	// the emitter is sorted
+	void WriteInstances(ParticleInstance* pInstances, JobSystem* pJobSystem);
+
+	ParticleEmitterDesc& GetDesc() { return _desc; }
+	uint32_t GetCount() const { return _count; }
+	uint32_t GetCapacity() const { return _capacity; }
+	const ParticleStats& GetStats() const { return _stats; }
+
+	const float* GetPositionsX() const { return _posX.data(); }
+	const float* GetPositionsY() const { return _posY.data(); }
+	const float* GetPositionsZ() const { return _posZ.data(); }
+	const float* GetVelocitiesX() const { return _velX.data(); }
+	const float* GetVelocitiesY() const { return _velY.data(); }
+	const float* GetVelocitiesZ() const { return _velZ.data(); }
+	const float* GetAges() const { return _age.data(); }
+	const float* GetInverseLifetimes() const { return _invLife.data(); }
+};
@@ -0,0 +1,475 @@
+#include "raytrace.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+#include <xmmintrin.h>
+
+static const uint32_t LeafTriangles = 4;
+static const uint32_t SahBins = 16;
+
+// Past this depth splits go down the middle so the traversal stack stays bounded
+static const uint32_t MaxSahDepth = 48;
+static const uint32_t TraversalStackSize = 256;
+
+static const int32_t EmptyChild = INT32_MIN;
+
+static float SurfaceArea(const Aabb& box)
+{
+	Vec3 d = box.max - box.min;
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static void Grow(Aabb& box, const Aabb& other)
+{
+	box.min = Min(box.min, other.min);
+	box.max = Max(box.max, other.max);
+}
+
+static Aabb EmptyAabb()
+{
+	Aabb box;
+	box.min = Vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	box.max = Vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	return box;
+}
+
+// Division by a zero component would give NaNs in the slab test, a huge value works as infinity
+static float SafeReciprocal(float x)
+{
+	if (fabsf(x) < 1.0e-20f)
+		return x < 0.0f ? -1.0e30f : 1.0e30f;
+
+	return 1.0f / x;
+}
+
+TriangleBvh::TriangleBvh()
+{
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+void TriangleBvh::Clear()
+{
+	_nodes.clear();
+	_packets.clear();
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+void TriangleBvh::Build(const Vec3* pPositions, uint32_t triangleCount)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	Clear();
+
+	if (triangleCount == 0)
+		return;
+
+	std::vector<Aabb> bounds(triangleCount);
+	std::vector<Vec3> centroids(triangleCount);
+	std::vector<uint32_t> order(triangleCount);
+
+	for (uint32_t i = 0; i < triangleCount; i++)
+	{
+		const Vec3& a = pPositions[i * 3];
+		const Vec3& b = pPositions[i * 3 + 1];
+		const Vec3& c = pPositions[i * 3 + 2];
+
+		bounds[i].min = Min(a, Min(b, c));
+		bounds[i].max = Max(a, Max(b, c));
+		centroids[i] = (a + b + c) * (1.0f / 3.0f);
+		order[i] = i;
+	}
+
+	std::vector<BuildNode> build;
+	build.reserve(triangleCount * 2);
+
+	uint32_t root = BuildRecursive(build, order, bounds, centroids, 0, triangleCount, 1);
+
+	_nodes.reserve(build.size() / 2 + 1);
+	_packets.reserve(triangleCount / 2 + 1);
+	Collapse(build, root, order, pPositions);
+
+	_stats.triangles = triangleCount;
+	_stats.nodes = (uint32_t)_nodes.size();
+	_stats.leaves = (uint32_t)_packets.size();
+	_stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+uint32_t TriangleBvh::BuildRecursive(std::vector<BuildNode>& build, std::vector<uint32_t>& order, const std::vector<Aabb>& bounds,
+									 const std::vector<Vec3>& centroids, uint32_t first, uint32_t count, uint32_t depth)
+{
+	uint32_t index = (uint32_t)build.size();
+	build.push_back(BuildNode());
+
+	_stats.maxDepth = std::max(_stats.maxDepth, depth);
+
+	Aabb nodeBounds = EmptyAabb();
+	Aabb centroidBounds = EmptyAabb();
+
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		Grow(nodeBounds, bounds[order[i]]);
+		centroidBounds.min = Min(centroidBounds.min, centroids[order[i]]);
+		centroidBounds.max = Max(centroidBounds.max, centroids[order[i]]);
+	}
+
+	build[index].bounds = nodeBounds;
+
+	if (count <= LeafTriangles)
+	{
+		build[index].first = first;
+		build[index].count = count;
+		return index;
+	}
+
+	// Split across the longest axis of the centroids
+	Vec3 extent = centroidBounds.max - centroidBounds.min;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	float axisMin = (&centroidBounds.min.x)[axis];
+	float axisExtent = (&extent.x)[axis];
+	uint32_t mid = first;
+
+	if (axisExtent > 1.0e-12f && depth < MaxSahDepth)
+	{
+		uint32_t binCounts[SahBins] = {};
+		Aabb binBounds[SahBins];
+
+		for (uint32_t b = 0; b < SahBins; b++)
+			binBounds[b] = EmptyAabb();
+
+		float binScale = SahBins * 0.9999f / axisExtent;
+
+		for (uint32_t i = first; i < first + count; i++)
+		{
+			uint32_t bin = (uint32_t)(((&centroids[order[i]].x)[axis] - axisMin) * binScale);
+			binCounts[bin]++;
+			Grow(binBounds[bin], bounds[order[i]]);
+		}
+
+		// Area times count of everything right of each plane, then sweep from the left
+		float rightCost[SahBins];
+		Aabb sweep = EmptyAabb();
+		uint32_t sweepCount = 0;
+
+		for (uint32_t b = SahBins - 1; b > 0; b--)
+		{
+			Grow(sweep, binBounds[b]);
+			sweepCount += binCounts[b];
+			rightCost[b] = sweepCount ? SurfaceArea(sweep) * sweepCount : 0.0f;
+		}
+
+		float bestCost = FLT_MAX;
+		uint32_t bestPlane = 0;
+		sweep = EmptyAabb();
+		sweepCount = 0;
+
+		for (uint32_t b = 1; b < SahBins; b++)
+		{
+			Grow(sweep, binBounds[b - 1]);
+			sweepCount += binCounts[b - 1];
+
+			if (sweepCount == 0 || sweepCount == count)
+				continue;
+
+			float cost = SurfaceArea(sweep) * sweepCount + rightCost[b];
+
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestPlane = b;
+			}
+		}
+
+		if (bestPlane != 0)
+		{
+			uint32_t* pMid = std::partition(order.data() + first, order.data() + first + count, [&](uint32_t triangle)
+			{
+				return (uint32_t)(((&centroids[triangle].x)[axis] - axisMin) * binScale) < bestPlane;
+			});
+
+			mid = (uint32_t)(pMid - order.data());
+		}
+	}
+
+	// Everything on one side, or too deep: halve by centroid instead
+	if (mid == first || mid == first + count)
+	{
+		mid = first + count / 2;
+
+		std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count, [&](uint32_t a, uint32_t b)
+		{
+			return (&centroids[a].x)[axis] < (&centroids[b].x)[axis];
+		});
+	}
+
+	uint32_t left = BuildRecursive(build, order, bounds, centroids, first, mid - first, depth + 1);
+	uint32_t right = BuildRecursive(build, order, bounds, centroids, mid, first + count - mid, depth + 1);
+
+	build[index].first = first;
+	build[index].count = 0;
+	build[index].left = left;
+	build[index].right = right;
+
+	return index;
+}
+
+int32_t TriangleBvh::Collapse(const std::vector<BuildNode>& build, uint32_t buildNode, const std::vector<uint32_t>& order, const Vec3* pPositions)
+{
+	// Pull grandchildren up, largest first, until there are four or only leaves are left
+	uint32_t children[4];
+	uint32_t childCount = 0;
+
+	if (build[buildNode].count > 0)
+	{
+		children[childCount++] = buildNode;
+	}
+	else
+	{
+		children[childCount++] = build[buildNode].left;
+		children[childCount++] = build[buildNode].right;
+	}
+
+	while (childCount < 4)
+	{
+		int best = -1;
+		float bestArea = -1.0f;
+
+		for (uint32_t i = 0; i < childCount; i++)
+		{
+			const BuildNode& child = build[children[i]];
+
+			if (child.count == 0 && SurfaceArea(child.bounds) > bestArea)
+			{
+				bestArea = SurfaceArea(child.bounds);
+				best = (int)i;
+			}
+		}
+
+		if (best < 0)
+			break;
+
+		uint32_t expanded = children[best];
+		children[best] = build[expanded].left;
+		children[childCount++] = build[expanded].right;
+	}
+
+	// Recursion grows _nodes, so the node is only written through its index
+	uint32_t nodeIndex = (uint32_t)_nodes.size();
+	_nodes.push_back(Node());
+
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		// Empty lanes get a box at infinity that no ray reaches
+		Aabb box = EmptyAabb();
+		box.max = box.min;
+		int32_t link = EmptyChild;
+
+		if (i < childCount)
+		{
+			const BuildNode& child = build[children[i]];
+			box = child.bounds;
+			link = child.count > 0 ? AddPacket(child, order, pPositions) : Collapse(build, children[i], order, pPositions);
+		}
+
+		Node& node = _nodes[nodeIndex];
+		node.minX[i] = box.min.x;
+		node.minY[i] = box.min.y;
+		node.minZ[i] = box.min.z;
+		node.maxX[i] = box.max.x;
+		node.maxY[i] = box.max.y;
+		node.maxZ[i] = box.max.z;
+		node.children[i] = link;
+	}
+
+	return (int32_t)nodeIndex;
+}
+
+int32_t TriangleBvh::AddPacket(const BuildNode& leaf, const std::vector<uint32_t>& order, const Vec3* pPositions)
+{
+	Packet packet;
+	memset(&packet, 0, sizeof(packet));
+
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		packet.triangles[i] = RayInvalidTriangle;
+
+		if (i >= leaf.count)
+			continue;
+
+		uint32_t triangle = order[leaf.first + i];
+		const Vec3& a = pPositions[triangle * 3];
+		Vec3 e1 = pPositions[triangle * 3 + 1] - a;
+		Vec3 e2 = pPositions[triangle * 3 + 2] - a;
+
+		packet.v0x[i] = a.x;
+		packet.v0y[i] = a.y;
+		packet.v0z[i] = a.z;
+		packet.e1x[i] = e1.x;
+		packet.e1y[i] = e1.y;
+		packet.e1z[i] = e1.z;
+		packet.e2x[i] = e2.x;
+		packet.e2y[i] = e2.y;
+		packet.e2z[i] = e2.z;
+		packet.triangles[i] = triangle;
+	}
+
+	_packets.push_back(packet);
+
+	return ~(int32_t)(_packets.size() - 1);
+}
+
+template<bool AnyHit>
+bool TriangleBvh::Traverse(const Vec3& origin, const Vec3& direction, float tMax, RayHit* pHit) const
+{
+	if (_nodes.empty())
+		return false;
+
+	Vec3 inverse(SafeReciprocal(direction.x), SafeReciprocal(direction.y), SafeReciprocal(direction.z));
+
+	const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+	const __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+	const __m128 ix = _mm_set1_ps(inverse.x), iy = _mm_set1_ps(inverse.y), iz = _mm_set1_ps(inverse.z);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 detEpsilon = _mm_set1_ps(1.0e-12f);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+	float closest = tMax;
+	bool found = false;
+
+	int32_t stack[TraversalStackSize];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		int32_t index = stack[--stackSize];
+
+		if (index < 0)
+		{
+			// Moller-Trumbore on four triangles at once
+			const Packet& packet = _packets[~index];
+
+			__m128 e1x = _mm_loadu_ps(packet.e1x), e1y = _mm_loadu_ps(packet.e1y), e1z = _mm_loadu_ps(packet.e1z);
+			__m128 e2x = _mm_loadu_ps(packet.e2x), e2y = _mm_loadu_ps(packet.e2y), e2z = _mm_loadu_ps(packet.e2z);
+
+			__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+			__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+			__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+			__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			__m128 invDet = _mm_div_ps(one, det);
+
+			__m128 tx = _mm_sub_ps(ox, _mm_loadu_ps(packet.v0x));
+			__m128 ty = _mm_sub_ps(oy, _mm_loadu_ps(packet.v0y));
+			__m128 tz = _mm_sub_ps(oz, _mm_loadu_ps(packet.v0z));
+			__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+
+			__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+			__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+			__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+			__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+			__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+			// NaNs from degenerate lanes fail every comparison
+			__m128 hit = _mm_cmpgt_ps(_mm_and_ps(det, absMask), detEpsilon);
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+			hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+			hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, zero));
+			hit = _mm_and_ps(hit, _mm_cmple_ps(t, _mm_set1_ps(closest)));
+
+			int mask = _mm_movemask_ps(hit);
+
+			if (mask == 0)
+				continue;
+
+			if (AnyHit)
+				return true;
+
+			float ts[4], us[4], vs[4];
+			_mm_storeu_ps(ts, t);
+			_mm_storeu_ps(us, u);
+			_mm_storeu_ps(vs, v);
+
+			for (int i = 0; i < 4; i++)
+			{
+				if ((mask & (1 << i)) && ts[i] <= closest)
+				{
+					closest = ts[i];
+					pHit->t = ts[i];
+					pHit->u = us[i];
+					pHit->v = vs[i];
+					pHit->triangle = packet.triangles[i];
+					found = true;
+				}
+			}
+
+			continue;
+		}
+
+		// Slab test against all four child boxes
+		const Node& node = _nodes[index];
+
+		__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), ox), ix);
+		__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), ox), ix);
+		__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), oy), iy);
+		__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), oy), iy);
+		__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), oz), iz);
+		__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), oz), iz);
+
+		__m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), zero));
+		__m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(closest)));
+
+		int mask = _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+
+		if (mask == 0)
+			continue;
+
+		// Push the farthest first so the nearest child is visited next and shrinks closest early
+		float nearDistances[4];
+		_mm_storeu_ps(nearDistances, tNear);
+
+		int32_t hitChildren[4];
+		float hitDistances[4];
+		uint32_t hitCount = 0;
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (!(mask & (1 << i)) || node.children[i] == EmptyChild)
+				continue;
+
+			uint32_t slot = hitCount++;
+
+			while (slot > 0 && hitDistances[slot - 1] < nearDistances[i])
+			{
+				hitDistances[slot] = hitDistances[slot - 1];
+				hitChildren[slot] = hitChildren[slot - 1];
+				slot--;
+			}
+
+			hitDistances[slot] = nearDistances[i];
+			hitChildren[slot] = node.children[i];
+		}
+
+		for (uint32_t i = 0; i < hitCount; i++)
+			stack[stackSize++] = hitChildren[i];
+	}
+
+	return found;
+}
+
+bool TriangleBvh::Intersect(const Vec3& origin, const Vec3& direction, float tMax, RayHit& hit) const
+{
+	hit.t = tMax;
+	hit.u = 0.0f;
+	hit.v = 0.0f;
+	hit.triangle = RayInvalidTriangle;
+
+	return Traverse<false>(origin, direction, tMax, &hit);
+}
+
+bool TriangleBvh::Occluded(const Vec3& origin, const Vec3& direction, float tMax) const
+{
+	return Traverse<true>(origin, direction, tMax, nullptr);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "collision.h"
+
+const uint32_t RayInvalidTriangle = 0xFFFFFFFF;
+
+struct RayHit
+{
+	float    t;
+	float    u, v;      // barycentrics of the second and third vertex
+	uint32_t triangle;  // in the order the triangles were given to Build
+};
+
+struct BvhStats
+{
+	uint32_t triangles;
+	uint32_t nodes;
+	uint32_t leaves;
+	uint32_t maxDepth;
+	double   buildMs;
+};
+
+//--------------------------------------------------------------------------------------
+// Four wide BVH over static triangles for offline ray casting. It is built top down with
+// binned SAH into a binary tree that is then collapsed so every node holds the bounds of
+// up to four children side by side. One ray tests all four boxes at once with SSE, and
+// leaves are packets of up to four triangles tested together the same way. Queries only
+// read the tree, so any number of threads can trace at once.
+//--------------------------------------------------------------------------------------
+class TriangleBvh
+{
+private:
+	struct Node
+	{
+		float   minX[4], minY[4], minZ[4];
+		float   maxX[4], maxY[4], maxZ[4];
+		int32_t children[4];  // node index, ~packet index for leaves, EmptyChild when unused
+	};
+
+	// Edges and first vertex of four triangles, unused lanes are degenerate and never hit
+	struct Packet
+	{
+		float    v0x[4], v0y[4], v0z[4];
+		float    e1x[4], e1y[4], e1z[4];
+		float    e2x[4], e2y[4], e2z[4];
+		uint32_t triangles[4];
+	};
+
+	struct BuildNode
+	{
+		Aabb     bounds;
+		uint32_t first;   // into the triangle order for leaves
+		uint32_t count;   // 0 for inner nodes
+		uint32_t left;
+		uint32_t right;
+	};
+
+	std::vector<Node>     _nodes;
+	std::vector<Packet>   _packets;
+	BvhStats              _stats;
+
+private:
+	uint32_t BuildRecursive(std::vector<BuildNode>& build, std::vector<uint32_t>& order, const std::vector<Aabb>& bounds,
+							const std::vector<Vec3>& centroids, uint32_t first, uint32_t count, uint32_t depth);
+	int32_t Collapse(const std::vector<BuildNode>& build, uint32_t buildNode, const std::vector<uint32_t>& order, const Vec3* pPositions);
+	int32_t AddPacket(const BuildNode& leaf, const std::vector<uint32_t>& order, const Vec3* pPositions);
+
+	template<bool AnyHit>
+	bool Traverse(const Vec3& origin, const Vec3& direction, float tMax, RayHit* pHit) const;
+
+public:
+	TriangleBvh();
+
+	// Three positions per triangle
+	void Build(const Vec3* pPositions, uint32_t triangleCount);
+	void Clear();
+
+	// Closest hit along origin + direction * t for t in (0, tMax]. Both sides of a triangle count.
+	bool Intersect(const Vec3& origin, const Vec3& direction, float tMax, RayHit& hit) const;
+
+	// Whether anything at all is hit, stops at the first triangle found
+	bool Occluded(const Vec3& origin, const Vec3& direction, float tMax) const;
+
+	const BvhStats& GetStats() const { return _stats; }
+};
@@ -0,0 +1,645 @@
+#include "rendergraph.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const uint32_t NotUsed = 0xFFFFFFFF;
+
+// Cached textures that go this many frames without being used are destroyed
+static const uint32_t MaxUnusedFrames = 8;
+
+void* RenderGraphPassContext::GetPhysical(RenderGraphResource resource) const
+{
+	return _pGraph->GetPhysical(resource);
+}
+
+RenderGraph::RenderGraph()
+{
+	memset(&_stats, 0, sizeof(_stats));
+	_compiled = false;
+}
+
+void RenderGraph::Reset()
+{
+	_resources.clear();
+	_passes.clear();
+	_accesses.clear();
+	_order.clear();
+	_barriers.clear();
+	_finalBarriers.clear();
+	_edges.clear();
+	_slots.clear();
+	_compiled = false;
+}
+
+void RenderGraph::ReleasePhysical(RenderGraphBackend* pBackend)
+{
+	for (size_t i = 0; i < _cache.size(); i++)
+		pBackend->DestroyTexture(_cache[i].pTexture);
+
+	_cache.clear();
+}
+
+RenderGraphResource RenderGraph::CreateTexture(const char* name, const RenderGraphTextureDesc& desc)
+{
+	ResourceNode node;
+	node.name = name;
+	node.desc = desc;
+	node.imported = false;
+	node.pImported = nullptr;
+	node.initialState = RG_STATE_UNDEFINED;
+	node.finalState = RG_STATE_UNDEFINED;
+	node.readerCount = 0;
+	node.firstUse = NotUsed;
+	node.lastUse = NotUsed;
+	node.slot = NotUsed;
+
+	_resources.push_back(node);
+
+	return (RenderGraphResource)_resources.size() - 1;
+}
+
+RenderGraphResource RenderGraph::ImportTexture(const char* name, const RenderGraphTextureDesc& desc, void* pTexture,
+											   RenderGraphState initialState, RenderGraphState finalState)
+{
+	RenderGraphResource resource = CreateTexture(name, desc);
+
+	_resources[resource].imported = true;
+	_resources[resource].pImported = pTexture;
+	_resources[resource].initialState = initialState;
+	_resources[resource].finalState = finalState;
+
+	return resource;
+}
+
+uint32_t RenderGraph::AddPass(const char* name, RenderGraphExecuteFunc func, void* pData)
+{
+	PassNode node;
+	node.name = name;
+	node.func = func;
+	node.pData = pData;
+	node.sideEffect = false;
+	node.culled = false;
+	node.writerRefs = 0;
+	node.firstBarrier = 0;
+	node.barrierCount = 0;
+
+	_passes.push_back(node);
+
+	return (uint32_t)_passes.size() - 1;
+}
+
+void RenderGraph::AddAccess(uint32_t pass, RenderGraphResource resource, RenderGraphState state, bool write)
+{
+	ResourceAccess access;
+	access.pass = pass;
+	access.resource = resource;
+	access.state = state;
+	access.write = write;
+
+	_accesses.push_back(access);
+	_compiled = false;
+}
+
+void RenderGraph::Read(uint32_t pass, RenderGraphResource resource, RenderGraphState state)
+{
+	_resources[resource].readerCount++;
+	AddAccess(pass, resource, state, false);
+}
+
+void RenderGraph::Write(uint32_t pass, RenderGraphResource resource, RenderGraphState state)
+{
+	_passes[pass].writerRefs++;
+	AddAccess(pass, resource, state, true);
+}
+
+void RenderGraph::SetSideEffect(uint32_t pass)
+{
+	_passes[pass].sideEffect = true;
+}
+
+bool RenderGraph::SortPasses()
+{
+	// Walk each resource's accesses in declaration order: readers depend on the last
+	// write before them, writers depend on the previous writer and every reader since it.
+	// Reads declared before any write of the resource depend on its last writer.
+	_scratch.resize(_accesses.size());
+
+	for (uint32_t i = 0; i < (uint32_t)_accesses.size(); i++)
+		_scratch[i] = i;
+
+	std::sort(_scratch.begin(), _scratch.end(), [this](uint32_t a, uint32_t b)
+	{
+		const ResourceAccess& accessA = _accesses[a];
+		const ResourceAccess& accessB = _accesses[b];
+
+		if (accessA.resource != accessB.resource)
+			return accessA.resource < accessB.resource;
+
+		if (accessA.pass != accessB.pass)
+			return accessA.pass < accessB.pass;
+
+		return a < b;
+	});
+
+	_edges.clear();
+
+	size_t begin = 0;
+
+	while (begin < _scratch.size())
+	{
+		RenderGraphResource resource = _accesses[_scratch[begin]].resource;
+		size_t end = begin;
+
+		while (end < _scratch.size() && _accesses[_scratch[end]].resource == resource)
+			end++;
+
+		uint32_t lastWriter = NotUsed;
+		size_t readersBegin = begin;
+
+		for (size_t i = begin; i < end; i++)
+		{
+			const ResourceAccess& access = _accesses[_scratch[i]];
+
+			if (access.write)
+			{
+				// Reads before the first write are ordered after the last writer below
+				for (size_t r = readersBegin; r < i && lastWriter != NotUsed; r++)
+				{
+					const ResourceAccess& reader = _accesses[_scratch[r]];
+
+					if (!reader.write && reader.pass != access.pass)
+					{
+						Edge edge = { reader.pass, access.pass };
+						_edges.push_back(edge);
+					}
+				}
+
+				if (lastWriter != NotUsed && lastWriter != access.pass)
+				{
+					Edge edge = { lastWriter, access.pass };
+					_edges.push_back(edge);
+				}
+
+				lastWriter = access.pass;
+				readersBegin = i + 1;
+			}
+			else if (lastWriter != NotUsed && lastWriter != access.pass)
+			{
+				Edge edge = { lastWriter, access.pass };
+				_edges.push_back(edge);
+			}
+		}
+
+		// Reads with no earlier writer
+		for (size_t i = begin; i < end && lastWriter != NotUsed; i++)
+		{
+			const ResourceAccess& access = _accesses[_scratch[i]];
+
+			if (access.write)
+				break;
+
+			if (access.pass != lastWriter)
+			{
+				Edge edge = { lastWriter, access.pass };
+				_edges.push_back(edge);
+			}
+		}
+
+		begin = end;
+	}
+
+	// Kahn's algorithm, always taking the lowest numbered ready pass so the declaration
+	// order is kept wherever the dependencies allow it
+	uint32_t passCount = (uint32_t)_passes.size();
+
+	_scratch.assign(passCount, 0);
+
+	for (size_t i = 0; i < _edges.size(); i++)
+		_scratch[_edges[i].to]++;
+
+	_order.clear();
+
+	for (uint32_t emitted = 0; emitted < passCount; emitted++)
+	{
+		uint32_t next = NotUsed;
+
+		for (uint32_t p = 0; p < passCount; p++)
+		{
+			if (_scratch[p] == 0)
+			{
+				next = p;
+				break;
+			}
+		}
+
+		// Anything left has a cycle
+		if (next == NotUsed)
+			return false;
+
+		_scratch[next] = NotUsed;
+		_order.push_back(next);
+
+		for (size_t i = 0; i < _edges.size(); i++)
+		{
+			if (_edges[i].from == next)
+				_scratch[_edges[i].to]--;
+		}
+	}
+
+	return true;
+}
+
+void RenderGraph::CullPasses()
+{
+	// Passes that write nothing anybody reads are dropped, which can in turn leave the
+	// resources they read unread. Imported resources count as read by the outside world.
+	for (uint32_t p = 0; p < (uint32_t)_passes.size(); p++)
+	{
+		PassNode& pass = _passes[p];
+
+		if (pass.writerRefs == 0 && !pass.sideEffect)
+		{
+			pass.culled = true;
+
+			for (size_t a = 0; a < _accesses.size(); a++)
+			{
+				const ResourceAccess& access = _accesses[a];
+
+				if (access.pass == p && !access.write)
+					_resources[access.resource].readerCount--;
+			}
+		}
+	}
+
+	// Seeded only from here so a resource is queued once: each one popped takes a
+	// reference off its writers, twice would cull a writer whose other outputs are read.
+	// Later pushes happen as a count reaches zero, which only happens once per resource.
+	_scratch.clear();
+
+	for (uint32_t r = 0; r < (uint32_t)_resources.size(); r++)
+	{
+		if (_resources[r].readerCount == 0 && !_resources[r].imported)
+			_scratch.push_back(r);
+	}
+
+	while (!_scratch.empty())
+	{
+		RenderGraphResource resource = _scratch.back();
+		_scratch.pop_back();
+
+		if (_resources[resource].imported)
+			continue;
+
+		for (size_t a = 0; a < _accesses.size(); a++)
+		{
+			const ResourceAccess& access = _accesses[a];
+
+			if (access.resource != resource || !access.write)
+				continue;
+
+			PassNode& writer = _passes[access.pass];
+
+			if (writer.culled || writer.sideEffect || --writer.writerRefs > 0)
+				continue;
+
+			writer.culled = true;
+
+			for (size_t b = 0; b < _accesses.size(); b++)
+			{
+				const ResourceAccess& read = _accesses[b];
+
+				if (read.pass == access.pass && !read.write && --_resources[read.resource].readerCount == 0)
+					_scratch.push_back(read.resource);
+			}
+		}
+	}
+
+	// Drop culled passes from the execution order
+	size_t kept = 0;
+
+	for (size_t i = 0; i < _order.size(); i++)
+	{
+		if (!_passes[_order[i]].culled)
+			_order[kept++] = _order[i];
+	}
+
+	_order.resize(kept);
+}
+
+void RenderGraph::ComputeLifetimes()
+{
+	for (uint32_t position = 0; position < (uint32_t)_order.size(); position++)
+	{
+		uint32_t pass = _order[position];
+
+		for (size_t a = 0; a < _accesses.size(); a++)
+		{
+			if (_accesses[a].pass != pass)
+				continue;
+
+			ResourceNode& resource = _resources[_accesses[a].resource];
+
+			if (resource.firstUse == NotUsed)
+				resource.firstUse = position;
+
+			resource.lastUse = position;
+		}
+	}
+}
+
+void RenderGraph::AssignSlots()
+{
+	// Transients in order of first use, each takes the first compatible slot whose
+	// previous owner is already dead, otherwise it opens a new one
+	_scratch.clear();
+
+	for (uint32_t r = 0; r < (uint32_t)_resources.size(); r++)
+	{
+		if (!_resources[r].imported && _resources[r].firstUse != NotUsed)
+			_scratch.push_back(r);
+	}
+
+	std::sort(_scratch.begin(), _scratch.end(), [this](uint32_t a, uint32_t b)
+	{
+		if (_resources[a].firstUse != _resources[b].firstUse)
+			return _resources[a].firstUse < _resources[b].firstUse;
+
+		return a < b;
+	});
+
+	_slots.clear();
+
+	for (size_t i = 0; i < _scratch.size(); i++)
+	{
+		ResourceNode& resource = _resources[_scratch[i]];
+		uint32_t slot = NotUsed;
+
+		for (uint32_t s = 0; s < (uint32_t)_slots.size(); s++)
+		{
+			if (_slots[s].desc == resource.desc && _slots[s].lastUse < resource.firstUse)
+			{
+				slot = s;
+				break;
+			}
+		}
+
+		if (slot == NotUsed)
+		{
+			AliasSlot newSlot;
+			newSlot.desc = resource.desc;
+			newSlot.lastUse = resource.lastUse;
+			newSlot.cached = NotUsed;
+
+			_slots.push_back(newSlot);
+			slot = (uint32_t)_slots.size() - 1;
+
+			_stats.aliasedBytes += resource.desc.GetSizeInBytes();
+		}
+
+		_slots[slot].lastUse = resource.lastUse;
+		resource.slot = slot;
+
+		_stats.unaliasedBytes += resource.desc.GetSizeInBytes();
+		_stats.transientCount++;
+	}
+
+	_stats.physicalCount = (uint32_t)_slots.size();
+
+	for (uint32_t position = 0; position < (uint32_t)_order.size(); position++)
+	{
+		uint64_t live = 0;
+
+		for (size_t i = 0; i < _scratch.size(); i++)
+		{
+			const ResourceNode& resource = _resources[_scratch[i]];
+
+			if (resource.firstUse <= position && resource.lastUse >= position)
+				live += resource.desc.GetSizeInBytes();
+		}
+
+		if (live > _stats.peakLiveBytes)
+			_stats.peakLiveBytes = live;
+	}
+}
+
+void RenderGraph::BuildBarriers()
+{
+	// Current state of every resource, transients start undefined which also tells the
+	// backend that whatever an aliased texture held before can be discarded
+	_scratch.resize(_resources.size());
+
+	for (size_t r = 0; r < _resources.size(); r++)
+		_scratch[r] = _resources[r].imported ? _resources[r].initialState : RG_STATE_UNDEFINED;
+
+	_barriers.clear();
+
+	for (size_t position = 0; position < _order.size(); position++)
+	{
+		PassNode& pass = _passes[_order[position]];
+		pass.firstBarrier = (uint32_t)_barriers.size();
+
+		for (size_t a = 0; a < _accesses.size(); a++)
+		{
+			const ResourceAccess& access = _accesses[a];
+
+			if (access.pass != _order[position] || _scratch[access.resource] == (uint32_t)access.state)
+				continue;
+
+			RenderGraphBarrier barrier;
+			barrier.resource = access.resource;
+			barrier.pPhysical = nullptr;
+			barrier.before = (RenderGraphState)_scratch[access.resource];
+			barrier.after = access.state;
+
+			_barriers.push_back(barrier);
+			_scratch[access.resource] = access.state;
+		}
+
+		pass.barrierCount = (uint32_t)_barriers.size() - pass.firstBarrier;
+	}
+
+	_finalBarriers.clear();
+
+	for (uint32_t r = 0; r < (uint32_t)_resources.size(); r++)
+	{
+		const ResourceNode& resource = _resources[r];
+
+		if (!resource.imported || _scratch[r] == (uint32_t)resource.finalState)
+			continue;
+
+		RenderGraphBarrier barrier;
+		barrier.resource = r;
+		barrier.pPhysical = resource.pImported;
+		barrier.before = (RenderGraphState)_scratch[r];
+		barrier.after = resource.finalState;
+
+		_finalBarriers.push_back(barrier);
+	}
+
+	_stats.barrierCount = (uint32_t)(_barriers.size() + _finalBarriers.size());
+}
+
+bool RenderGraph::Compile()
+{
+	memset(&_stats, 0, sizeof(_stats));
+
+	for (size_t r = 0; r < _resources.size(); r++)
+	{
+		_resources[r].firstUse = NotUsed;
+		_resources[r].lastUse = NotUsed;
+		_resources[r].slot = NotUsed;
+	}
+
+	_compiled = false;
+
+	if (!SortPasses())
+		return false;
+
+	CullPasses();
+	ComputeLifetimes();
+	AssignSlots();
+	BuildBarriers();
+
+	_stats.passCount = (uint32_t)_passes.size();
+	_stats.culledPassCount = (uint32_t)(_passes.size() - _order.size());
+	_compiled = true;
+
+	return true;
+}
+
+bool RenderGraph::Execute(RenderGraphBackend* pBackend)
+{
+	if (!_compiled)
+		return false;
+
+	bool created = true;
+
+	// Match this frame's slots up with cached textures, creating any that are missing
+	for (size_t c = 0; c < _cache.size(); c++)
+		_cache[c].inUse = false;
+
+	for (size_t s = 0; s < _slots.size(); s++)
+	{
+		AliasSlot& slot = _slots[s];
+		slot.cached = NotUsed;
+
+		for (uint32_t c = 0; c < (uint32_t)_cache.size(); c++)
+		{
+			if (!_cache[c].inUse && _cache[c].desc == slot.desc)
+			{
+				slot.cached = c;
+				break;
+			}
+		}
+
+		if (slot.cached == NotUsed)
+		{
+			CachedTexture texture;
+			texture.desc = slot.desc;
+			texture.pTexture = pBackend->CreateTexture(slot.desc, "RenderGraphTransient");
+			texture.inUse = false;
+			texture.unusedFrames = 0;
+
+			// Never cached, the slot stays empty and the frame is skipped
+			if (texture.pTexture == nullptr)
+			{
+				created = false;
+				continue;
+			}
+
+			_cache.push_back(texture);
+			slot.cached = (uint32_t)_cache.size() - 1;
+		}
+
+		_cache[slot.cached].inUse = true;
+		_cache[slot.cached].unusedFrames = 0;
+	}
+
+	for (size_t c = 0; c < _cache.size();)
+	{
+		if (!_cache[c].inUse && ++_cache[c].unusedFrames > MaxUnusedFrames)
+		{
+			// Keep slot indices valid by moving the last entry into the hole
+			pBackend->DestroyTexture(_cache[c].pTexture);
+
+			uint32_t last = (uint32_t)_cache.size() - 1;
+
+			for (size_t s = 0; s < _slots.size(); s++)
+			{
+				if (_slots[s].cached == last)
+					_slots[s].cached = (uint32_t)c;
+			}
+
+			_cache[c] = _cache[last];
+			_cache.pop_back();
+			continue;
+		}
+
+		c++;
+	}
+
+	// The passes expect every texture to exist, skip them all rather than run some
+	if (!created)
+		return false;
+
+	for (size_t b = 0; b < _barriers.size(); b++)
+		_barriers[b].pPhysical = GetPhysical(_barriers[b].resource);
+
+	for (size_t position = 0; position < _order.size(); position++)
+	{
+		const PassNode& pass = _passes[_order[position]];
+
+		if (pass.barrierCount > 0)
+			pBackend->ApplyBarriers(&_barriers[pass.firstBarrier], pass.barrierCount);
+
+		if (pass.func != nullptr)
+			pass.func(RenderGraphPassContext(this, _order[position]), pass.pData);
+	}
+
+	if (!_finalBarriers.empty())
+		pBackend->ApplyBarriers(_finalBarriers.data(), (uint32_t)_finalBarriers.size());
+
+	return true;
+}
+
+void* RenderGraph::GetPhysical(RenderGraphResource resource) const
+{
+	const ResourceNode& node = _resources[resource];
+
+	if (node.imported)
+		return node.pImported;
+
+	if (node.slot == NotUsed || _slots[node.slot].cached == NotUsed)
+		return nullptr;
+
+	return _cache[_slots[node.slot].cached].pTexture;
+}
+
+//--------------------------------------------------------------------------------------
+// HeadlessRenderGraphBackend
+//--------------------------------------------------------------------------------------
+void* HeadlessRenderGraphBackend::CreateTexture(const RenderGraphTextureDesc& desc, const char* name)
+{
+	(void)desc;
+	(void)name;
+
+	_liveTextures++;
+	_createdTextures++;
+
+	// Any unique non-null value will do as a handle
+	return reinterpret_cast<void*>((uintptr_t)_createdTextures);
+}
+
+void HeadlessRenderGraphBackend::DestroyTexture(void* pTexture)
+{
+	if (pTexture != nullptr)
+		_liveTextures--;
+}
+
+void HeadlessRenderGraphBackend::ApplyBarriers(const RenderGraphBarrier* pBarriers, uint32_t count)
+{
+	(void)pBarriers;
+
+	_barrierCount += count;
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+typedef uint32_t RenderGraphResource;
+
+const RenderGraphResource InvalidRenderGraphResource = 0xFFFFFFFF;
+
+enum RenderGraphBind : uint32_t
+{
+	RG_BIND_RENDER_TARGET   = 1 << 0,
+	RG_BIND_DEPTH_STENCIL   = 1 << 1,
+	RG_BIND_SHADER_RESOURCE = 1 << 2,
+};
+
+enum RenderGraphState
+{
+	RG_STATE_UNDEFINED = 0,
+	RG_STATE_RENDER_TARGET,
+	RG_STATE_DEPTH_WRITE,
+	RG_STATE_DEPTH_READ,
+	RG_STATE_SHADER_READ,
+	RG_STATE_PRESENT,
+};
+
+// Format is passed straight through to the backend (a DXGI_FORMAT for D3D11)
+struct RenderGraphTextureDesc
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	uint32_t bytesPerPixel;
+	uint32_t bindFlags;
+
+	uint64_t GetSizeInBytes() const { return (uint64_t)width * height * bytesPerPixel; }
+
+	bool operator==(const RenderGraphTextureDesc& other) const
+	{
+		return width == other.width && height == other.height && format == other.format &&
+			bytesPerPixel == other.bytesPerPixel && bindFlags == other.bindFlags;
+	}
+};
+
+struct RenderGraphBarrier
+{
+	RenderGraphResource resource;
+	void*               pPhysical;
+	RenderGraphState    before;
+	RenderGraphState    after;
+};
+
+struct RenderGraphStats
+{
+	uint32_t passCount;
+	uint32_t culledPassCount;
+	uint32_t transientCount;
+	uint32_t physicalCount;
+	uint32_t barrierCount;
+	uint64_t unaliasedBytes;   // transient memory if nothing was shared
+	uint64_t aliasedBytes;     // transient memory after aliasing
+	uint64_t peakLiveBytes;    // largest amount of transient memory live during one pass
+};
+
+//--------------------------------------------------------------------------------------
+// The backend creates the physical textures and turns barriers into API calls. It is the
+// only part of the graph that knows which graphics API is in use.
+//--------------------------------------------------------------------------------------
+class RenderGraphBackend
+{
+public:
+	virtual ~RenderGraphBackend() {}
+
+	// Returns nullptr when the texture can't be created, with nothing left to destroy
+	virtual void* CreateTexture(const RenderGraphTextureDesc& desc, const char* name) = 0;
+	virtual void DestroyTexture(void* pTexture) = 0;
+	virtual void ApplyBarriers(const RenderGraphBarrier* pBarriers, uint32_t count) = 0;
+};
+
+class RenderGraph;
+
+// Handed to pass callbacks so they can find the physical textures behind their resources
+class RenderGraphPassContext
+{
+private:
+	const RenderGraph* _pGraph;
+	uint32_t           _pass;
+
+public:
+	RenderGraphPassContext(const RenderGraph* pGraph, uint32_t pass) : _pGraph(pGraph), _pass(pass) {}
+
+	void* GetPhysical(RenderGraphResource resource) const;
+	uint32_t GetPassIndex() const { return _pass; }
+};
+
+typedef void (*RenderGraphExecuteFunc)(const RenderGraphPassContext& context, void* pData);
+
+//--------------------------------------------------------------------------------------
+// Frame render graph. Passes are declared with the resources they read and write, then
+// Compile() orders them, culls passes whose results are never used, works out resource
+// lifetimes, shares physical textures between transients that are never live at the same
+// time and records the state transitions that Execute() hands to the backend.
+//
+// The graph is meant to be rebuilt every frame: Reset() keeps all allocations, and the
+// physical textures are cached across frames so steady state frames create nothing.
+//--------------------------------------------------------------------------------------
+class RenderGraph
+{
+private:
+	struct ResourceNode
+	{
+		const char*            name;
+		RenderGraphTextureDesc desc;
+		bool                   imported;
+		void*                  pImported;
+		RenderGraphState       initialState;
+		RenderGraphState       finalState;
+		uint32_t               readerCount;
+		uint32_t               firstUse;
+		uint32_t               lastUse;
+		uint32_t               slot;
+	};
+
+	struct ResourceAccess
+	{
+		uint32_t            pass;
+		RenderGraphResource resource;
+		RenderGraphState    state;
+		bool                write;
+	};
+
+	struct PassNode
+	{
+		const char*            name;
+		RenderGraphExecuteFunc func;
+		void*                  pData;
+		bool                   sideEffect;
+		bool                   culled;
+		uint32_t               writerRefs;
+		uint32_t               firstBarrier;
+		uint32_t               barrierCount;
+	};
+
+	// One per distinct texture needed this frame, several transients can share a slot
+	struct AliasSlot
+	{
+		RenderGraphTextureDesc desc;
+		uint32_t               lastUse;
+		uint32_t               cached;
+	};
+
+	// Physical textures kept alive across frames
+	struct CachedTexture
+	{
+		RenderGraphTextureDesc desc;
+		void*                  pTexture;
+		bool                   inUse;
+		uint32_t               unusedFrames;
+	};
+
+	struct Edge
+	{
+		uint32_t from;
+		uint32_t to;
+	};
+
+	std::vector<ResourceNode>       _resources;
+	std::vector<PassNode>           _passes;
+	std::vector<ResourceAccess>     _accesses;
+	std::vector<uint32_t>           _order;
+	std::vector<RenderGraphBarrier> _barriers;
+	std::vector<RenderGraphBarrier> _finalBarriers;
+	std::vector<Edge>               _edges;
+	std::vector<uint32_t>           _scratch;
+	std::vector<AliasSlot>          _slots;
+	std::vector<CachedTexture>      _cache;
+
+	RenderGraphStats _stats;
+	bool             _compiled;
+
+private:
+	bool SortPasses();
+	void CullPasses();
+	void ComputeLifetimes();
+	void AssignSlots();
+	void BuildBarriers();
+	void AddAccess(uint32_t pass, RenderGraphResource resource, RenderGraphState state, bool write);
+
+public:
+	RenderGraph();
+
+	// Clears all passes and resources but keeps the cached physical textures
+	void Reset();
+
+	// Destroys the cached physical textures through the backend
+	void ReleasePhysical(RenderGraphBackend* pBackend);
+
+	RenderGraphResource CreateTexture(const char* name, const RenderGraphTextureDesc& desc);
+	RenderGraphResource ImportTexture(const char* name, const RenderGraphTextureDesc& desc, void* pTexture,
+									  RenderGraphState initialState, RenderGraphState finalState);
+
+	uint32_t AddPass(const char* name, RenderGraphExecuteFunc func, void* pData);
+	void Read(uint32_t pass, RenderGraphResource resource, RenderGraphState state = RG_STATE_SHADER_READ);
+	void Write(uint32_t pass, RenderGraphResource resource, RenderGraphState state = RG_STATE_RENDER_TARGET);
+
+	// Passes with side effects (readbacks, queries) are never culled
+	void SetSideEffect(uint32_t pass);
+
+	bool Compile();
+
+	// Finds or creates the physical textures, then runs each surviving pass in order.
+	// Returns false without running any pass if a texture can't be created, the next
+	// call tries again.
+	bool Execute(RenderGraphBackend* pBackend);
+
+	void* GetPhysical(RenderGraphResource resource) const;
+	bool IsPassCulled(uint32_t pass) const { return _passes[pass].culled; }
+
+	// Transients that share a slot share memory
+	uint32_t GetAliasSlot(RenderGraphResource resource) const { return _resources[resource].slot; }
+
+	const std::vector<uint32_t>& GetPassOrder() const { return _order; }
+	const std::vector<RenderGraphBarrier>& GetBarriers() const { return _barriers; }
+	const RenderGraphStats& GetStats() const { return _stats; }
+};
+
+//--------------------------------------------------------------------------------------
+// Backend that creates no GPU objects, for running and inspecting graphs without a device
+//--------------------------------------------------------------------------------------
+class HeadlessRenderGraphBackend : public RenderGraphBackend
+{
+private:
+	uint32_t _liveTextures;
+	uint32_t _createdTextures;
+	uint32_t _barrierCount;
+
+public:
+	HeadlessRenderGraphBackend() : _liveTextures(0), _createdTextures(0), _barrierCount(0) {}
+
+	void* CreateTexture(const RenderGraphTextureDesc& desc, const char* name) override;
+	void DestroyTexture(void* pTexture) override;
+	void ApplyBarriers(const RenderGraphBarrier* pBarriers, uint32_t count) override;
+
+	uint32_t GetLiveTextures() const { return _liveTextures; }
+	uint32_t GetCreatedTextures() const { return _createdTextures; }
+	uint32_t GetBarrierCount() const { return _barrierCount; }
+};
@@ -0,0 +1,145 @@
+#include "rendergraphd3d11.h"
+
+D3D11RenderGraphBackend::D3D11RenderGraphBackend()
+{
+	_pDevice = nullptr;
+	_pContext = nullptr;
+}
+
+void D3D11RenderGraphBackend::Init(ID3D11Device* pDevice, ID3D11DeviceContext* pContext)
+{
+	_pDevice = pDevice;
+	_pContext = pContext;
+}
+
+void* D3D11RenderGraphBackend::CreateTexture(const RenderGraphTextureDesc& desc, const char* name)
+{
+	DXGI_FORMAT format = (DXGI_FORMAT)desc.format;
+	DXGI_FORMAT textureFormat = format;
+	DXGI_FORMAT srvFormat = format;
+
+	// Depth that is also sampled needs a typeless texture with typed views on top
+	if ((desc.bindFlags & RG_BIND_DEPTH_STENCIL) && (desc.bindFlags & RG_BIND_SHADER_RESOURCE))
+	{
+		if (format == DXGI_FORMAT_D24_UNORM_S8_UINT)
+		{
+			textureFormat = DXGI_FORMAT_R24G8_TYPELESS;
+			srvFormat = DXGI_FORMAT_R24_UNORM_X8_TYPELESS;
+		}
+		else if (format == DXGI_FORMAT_D32_FLOAT)
+		{
+			textureFormat = DXGI_FORMAT_R32_TYPELESS;
+			srvFormat = DXGI_FORMAT_R32_FLOAT;
+		}
+	}
+
+	D3D11_TEXTURE2D_DESC textureDesc;
+	ZeroMemory(&textureDesc, sizeof(textureDesc));
+	textureDesc.Width = desc.width;
+	textureDesc.Height = desc.height;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = textureFormat;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.SampleDesc.Quality = 0;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = 0;
+	textureDesc.CPUAccessFlags = 0;
+	textureDesc.MiscFlags = 0;
+
+	if (desc.bindFlags & RG_BIND_RENDER_TARGET) textureDesc.BindFlags |= D3D11_BIND_RENDER_TARGET;
+	if (desc.bindFlags & RG_BIND_DEPTH_STENCIL) textureDesc.BindFlags |= D3D11_BIND_DEPTH_STENCIL;
+	if (desc.bindFlags & RG_BIND_SHADER_RESOURCE) textureDesc.BindFlags |= D3D11_BIND_SHADER_RESOURCE;
+
+	D3D11RenderTarget* pTarget = new D3D11RenderTarget();
+	ZeroMemory(pTarget, sizeof(D3D11RenderTarget));
+
+	HRESULT hr = _pDevice->CreateTexture2D(&textureDesc, nullptr, &pTarget->pTexture);
+
+	if (SUCCEEDED(hr) && (desc.bindFlags & RG_BIND_RENDER_TARGET))
+		hr = _pDevice->CreateRenderTargetView(pTarget->pTexture, nullptr, &pTarget->pRTV);
+
+	if (SUCCEEDED(hr) && (desc.bindFlags & RG_BIND_DEPTH_STENCIL))
+	{
+		D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc;
+		ZeroMemory(&dsvDesc, sizeof(dsvDesc));
+		dsvDesc.Format = format;
+		dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+
+		hr = _pDevice->CreateDepthStencilView(pTarget->pTexture, &dsvDesc, &pTarget->pDSV);
+	}
+
+	if (SUCCEEDED(hr) && (desc.bindFlags & RG_BIND_SHADER_RESOURCE))
+	{
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+		ZeroMemory(&srvDesc, sizeof(srvDesc));
+		srvDesc.Format = srvFormat;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = 1;
+
+		hr = _pDevice->CreateShaderResourceView(pTarget->pTexture, &srvDesc, &pTarget->pSRV);
+	}
+
+	if (FAILED(hr))
+	{
+		OutputDebugStringA("Render graph failed to create texture ");
+		OutputDebugStringA(name);
+		OutputDebugStringA("\n");
+
+		// Nothing half built goes back to the graph, it would be cached and used every frame
+		DestroyTexture(pTarget);
+		return nullptr;
+	}
+
+	return pTarget;
+}
+
+void D3D11RenderGraphBackend::DestroyTexture(void* pTexture)
+{
+	D3D11RenderTarget* pTarget = static_cast<D3D11RenderTarget*>(pTexture);
+
+	if (pTarget == nullptr)
+		return;
+
+	if (pTarget->pSRV) pTarget->pSRV->Release();
+	if (pTarget->pDSV) pTarget->pDSV->Release();
+	if (pTarget->pRTV) pTarget->pRTV->Release();
+	if (pTarget->pTexture) pTarget->pTexture->Release();
+
+	delete pTarget;
+}
+
+void D3D11RenderGraphBackend::ApplyBarriers(const RenderGraphBarrier* pBarriers, uint32_t count)
+{
+	bool unbindShaderResources = false;
+	bool unbindTargets = false;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		switch (pBarriers[i].after)
+		{
+		case RG_STATE_RENDER_TARGET:
+		case RG_STATE_DEPTH_WRITE:
+			unbindShaderResources = true;
+			break;
+
+		case RG_STATE_SHADER_READ:
+		case RG_STATE_DEPTH_READ:
+			unbindTargets = true;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	// Slot 0 and 4 hold material textures, 5 and up are render graph inputs
+	if (unbindShaderResources)
+	{
+		ID3D11ShaderResourceView* nullViews[8] = { nullptr };
+		_pContext->PSSetShaderResources(5, 8, nullViews);
+	}
+
+	if (unbindTargets)
+		_pContext->OMSetRenderTargets(0, nullptr, nullptr);
+}
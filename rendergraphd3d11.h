@@ -0,0 +1,34 @@
+#pragma once
+
+#include <windows.h>
+#include <d3d11_1.h>
+#include "rendergraph.h"
+
+// Physical texture behind a render graph resource, any of the views can be null
+struct D3D11RenderTarget
+{
+	ID3D11Texture2D*          pTexture;
+	ID3D11RenderTargetView*   pRTV;
+	ID3D11DepthStencilView*   pDSV;
+	ID3D11ShaderResourceView* pSRV;
+};
+
+//--------------------------------------------------------------------------------------
+// D3D11 render graph backend. D3D11 tracks resource states itself, so barriers are only
+// used to unbind views that would otherwise be bound for reading and writing at once.
+//--------------------------------------------------------------------------------------
+class D3D11RenderGraphBackend : public RenderGraphBackend
+{
+private:
+	ID3D11Device*        _pDevice;
+	ID3D11DeviceContext* _pContext;
+
+public:
+	D3D11RenderGraphBackend();
+
+	void Init(ID3D11Device* pDevice, ID3D11DeviceContext* pContext);
+
+	void* CreateTexture(const RenderGraphTextureDesc& desc, const char* name) override;
+	void DestroyTexture(void* pTexture) override;
+	void ApplyBarriers(const RenderGraphBarrier* pBarriers, uint32_t count) override;
+};
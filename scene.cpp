@@ -0,0 +1,519 @@
+#include "scene.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+uint64_t HashSceneName(const char* name)
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	for (const unsigned char* p = (const unsigned char*)name; *p; p++)
+	{
+		hash ^= *p;
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+Mat4 ComposeSceneTransform(const SceneTransform& transform)
+{
+	float x = transform.rotation[0], y = transform.rotation[1], z = transform.rotation[2], w = transform.rotation[3];
+
+	Mat4 r = Mat4::Identity();
+	r.m[0][0] = (1.0f - 2.0f * (y * y + z * z)) * transform.scale.x;
+	r.m[0][1] = (2.0f * (x * y + z * w)) * transform.scale.x;
+	r.m[0][2] = (2.0f * (x * z - y * w)) * transform.scale.x;
+	r.m[1][0] = (2.0f * (x * y - z * w)) * transform.scale.y;
+	r.m[1][1] = (1.0f - 2.0f * (x * x + z * z)) * transform.scale.y;
+	r.m[1][2] = (2.0f * (y * z + x * w)) * transform.scale.y;
+	r.m[2][0] = (2.0f * (x * z + y * w)) * transform.scale.z;
+	r.m[2][1] = (2.0f * (y * z - x * w)) * transform.scale.z;
+	r.m[2][2] = (1.0f - 2.0f * (x * x + y * y)) * transform.scale.z;
+	r.m[3][0] = transform.position.x;
+	r.m[3][1] = transform.position.y;
+	r.m[3][2] = transform.position.z;
+
+	return r;
+}
+
+void SceneRotationFromEuler(float pitch, float yaw, float roll, float rotation[4])
+{
+	float sp = sinf(pitch * 0.5f), cp = cosf(pitch * 0.5f);
+	float sy = sinf(yaw * 0.5f), cy = cosf(yaw * 0.5f);
+	float sr = sinf(roll * 0.5f), cr = cosf(roll * 0.5f);
+
+	rotation[0] = cr * sp * cy + sr * cp * sy;
+	rotation[1] = cr * cp * sy - sr * sp * cy;
+	rotation[2] = sr * cp * cy - cr * sp * sy;
+	rotation[3] = cr * cp * cy + sr * sp * sy;
+}
+
+Scene::Scene()
+{
+	_pData = nullptr;
+	_size = 0;
+	_mapped = false;
+	_pHeader = nullptr;
+}
+
+Scene::~Scene()
+{
+	Unload();
+}
+
+bool Scene::Load(const char* path)
+{
+	Unload();
+
+	// Private writable mapping, fix-ups and patches only copy the pages they touch
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	HANDLE mapping = nullptr;
+
+	if (GetFileSizeEx(file, &size) && size.QuadPart >= (LONGLONG)sizeof(SceneHeader))
+		mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+
+	CloseHandle(file);
+
+	if (mapping == nullptr)
+		return false;
+
+	// The view keeps the mapping alive
+	_pData = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+	CloseHandle(mapping);
+
+	if (_pData == nullptr)
+		return false;
+
+	_size = (size_t)size.QuadPart;
+#else
+	int file = open(path, O_RDONLY);
+
+	if (file < 0)
+		return false;
+
+	struct stat info;
+	void* pView = MAP_FAILED;
+
+	if (fstat(file, &info) == 0 && info.st_size >= (off_t)sizeof(SceneHeader))
+		pView = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+
+	close(file);
+
+	if (pView == MAP_FAILED)
+		return false;
+
+	_pData = static_cast<uint8_t*>(pView);
+	_size = (size_t)info.st_size;
+#endif
+
+	_mapped = true;
+
+	if (!Fixup())
+	{
+		Unload();
+		return false;
+	}
+
+	return true;
+}
+
+bool Scene::LoadFromMemory(const void* pData, size_t size)
+{
+	Unload();
+
+	if (size < sizeof(SceneHeader))
+		return false;
+
+	_pData = static_cast<uint8_t*>(malloc(size));
+
+	if (_pData == nullptr)
+		return false;
+
+	memcpy(_pData, pData, size);
+	_size = size;
+
+	if (!Fixup())
+	{
+		Unload();
+		return false;
+	}
+
+	return true;
+}
+
+void Scene::Unload()
+{
+	if (_pData)
+	{
+		if (_mapped)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(_pData);
+#else
+			munmap(_pData, _size);
+#endif
+		}
+		else
+		{
+			free(_pData);
+		}
+	}
+
+	_pData = nullptr;
+	_size = 0;
+	_mapped = false;
+	_pHeader = nullptr;
+}
+
+bool Scene::Fixup()
+{
+	SceneHeader* pHeader = reinterpret_cast<SceneHeader*>(_pData);
+
+	if (pHeader->magic != SceneMagic || pHeader->version != SceneVersion || pHeader->fileSize != _size)
+		return false;
+
+	if (pHeader->relocations % 8 != 0 || pHeader->relocations > _size ||
+		(_size - pHeader->relocations) / 8 < pHeader->relocationCount)
+		return false;
+
+	const uint64_t* pRelocations = reinterpret_cast<const uint64_t*>(_pData + pHeader->relocations);
+
+	for (uint32_t i = 0; i < pHeader->relocationCount; i++)
+	{
+		uint64_t offset = pRelocations[i];
+
+		if (offset % 8 != 0 || offset > _size - 8)
+			return false;
+
+		uint64_t* pSlot = reinterpret_cast<uint64_t*>(_pData + offset);
+
+		if (*pSlot >= _size)
+			return false;
+
+		*pSlot = (uint64_t)(uintptr_t)(_pData + *pSlot);
+	}
+
+	// Every section has to have been relocated and has to fit in the file
+	struct Section
+	{
+		const void* ptr;
+		uint64_t    bytes;
+	};
+
+	Section sections[] =
+	{
+		{ pHeader->entities.ptr,    (uint64_t)pHeader->entityCapacity * sizeof(SceneEntity) },
+		{ pHeader->transforms.ptr,  (uint64_t)pHeader->entityCapacity * sizeof(SceneTransform) },
+		{ pHeader->worlds.ptr,      (uint64_t)pHeader->entityCapacity * sizeof(Mat4) },
+		{ pHeader->entityNames.ptr, (uint64_t)pHeader->entityCapacity * sizeof(SceneNameEntry) },
+		{ pHeader->lights.ptr,      (uint64_t)pHeader->lightCapacity * sizeof(SceneLight) },
+		{ pHeader->meshes.ptr,      (uint64_t)pHeader->meshCount * sizeof(SceneMesh) },
+		{ pHeader->materials.ptr,   (uint64_t)pHeader->materialCount * sizeof(SceneMaterial) },
+		{ pHeader->textures.ptr,    (uint64_t)pHeader->textureCount * sizeof(SceneTexture) },
+	};
+
+	for (size_t i = 0; i < sizeof(sections) / sizeof(sections[0]); i++)
+	{
+		const uint8_t* p = static_cast<const uint8_t*>(sections[i].ptr);
+
+		if (p < _pData || p > _pData + _size || sections[i].bytes > (uint64_t)(_pData + _size - p))
+			return false;
+	}
+
+	if (pHeader->entityCount > pHeader->entityCapacity || pHeader->sortedNameCount > pHeader->entityCount ||
+		pHeader->lightCount > pHeader->lightCapacity)
+		return false;
+
+	// Names are only trusted to point into the file, the last byte of the file is a terminator
+	if (_pData[_size - 1] != 0)
+		return false;
+
+	for (uint32_t i = 0; i < pHeader->meshCount; i++)
+	{
+		const uint8_t* p = reinterpret_cast<const uint8_t*>(pHeader->meshes.ptr[i].name.ptr);
+
+		if (p < _pData || p >= _pData + _size)
+			return false;
+	}
+
+	for (uint32_t i = 0; i < pHeader->textureCount; i++)
+	{
+		const uint8_t* p = reinterpret_cast<const uint8_t*>(pHeader->textures.ptr[i].path.ptr);
+
+		if (p < _pData || p >= _pData + _size)
+			return false;
+	}
+
+	// Indices stored in the data are used without checks once loaded, so a stale or
+	// damaged file has to fail here rather than read past the end of an array
+	for (uint32_t i = 0; i < pHeader->materialCount; i++)
+	{
+		const SceneMaterial& material = pHeader->materials.ptr[i];
+
+		if ((material.diffuseTexture != SceneInvalidIndex && material.diffuseTexture >= pHeader->textureCount) ||
+			(material.normalTexture != SceneInvalidIndex && material.normalTexture >= pHeader->textureCount))
+			return false;
+	}
+
+	for (uint32_t i = 0; i < pHeader->entityCount; i++)
+	{
+		const SceneEntity& entity = pHeader->entities.ptr[i];
+
+		if (entity.mesh >= pHeader->meshCount || entity.material >= pHeader->materialCount ||
+			pHeader->entityNames.ptr[i].index >= pHeader->entityCount)
+			return false;
+	}
+
+	_pHeader = pHeader;
+
+	return true;
+}
+
+uint32_t Scene::FindEntity(uint64_t nameHash) const
+{
+	const SceneNameEntry* pNames = _pHeader->entityNames.ptr;
+
+	// Binary search over the names the compiler sorted, then the few added since
+	uint32_t low = 0, high = _pHeader->sortedNameCount;
+
+	while (low < high)
+	{
+		uint32_t middle = low + (high - low) / 2;
+
+		if (pNames[middle].hash < nameHash)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	if (low < _pHeader->sortedNameCount && pNames[low].hash == nameHash)
+		return pNames[low].index;
+
+	for (uint32_t i = _pHeader->sortedNameCount; i < _pHeader->entityCount; i++)
+	{
+		if (pNames[i].hash == nameHash)
+			return pNames[i].index;
+	}
+
+	return SceneInvalidIndex;
+}
+
+uint32_t Scene::FindLight(uint64_t nameHash) const
+{
+	for (uint32_t i = 0; i < _pHeader->lightCount; i++)
+	{
+		if (_pHeader->lights.ptr[i].nameHash == nameHash)
+			return i;
+	}
+
+	return SceneInvalidIndex;
+}
+
+uint32_t Scene::FindMesh(uint64_t nameHash) const
+{
+	for (uint32_t i = 0; i < _pHeader->meshCount; i++)
+	{
+		if (_pHeader->meshes.ptr[i].nameHash == nameHash)
+			return i;
+	}
+
+	return SceneInvalidIndex;
+}
+
+uint32_t Scene::FindMaterial(uint64_t nameHash) const
+{
+	for (uint32_t i = 0; i < _pHeader->materialCount; i++)
+	{
+		if (_pHeader->materials.ptr[i].nameHash == nameHash)
+			return i;
+	}
+
+	return SceneInvalidIndex;
+}
+
+bool Scene::ApplyPatch(const void* pPatch, size_t size, ScenePatchResult& result)
+{
+	memset(&result, 0, sizeof(result));
+	result.needsReload = true;
+
+	if (_pHeader == nullptr || size < sizeof(ScenePatchHeader))
+		return false;
+
+	const ScenePatchHeader* pPatchHeader = static_cast<const ScenePatchHeader*>(pPatch);
+
+	if (pPatchHeader->magic != ScenePatchMagic || pPatchHeader->version != SceneVersion ||
+		(size - sizeof(ScenePatchHeader)) / sizeof(ScenePatchOp) < pPatchHeader->opCount)
+		return false;
+
+	const ScenePatchOp* pOps = reinterpret_cast<const ScenePatchOp*>(pPatchHeader + 1);
+
+	// Check everything before touching the scene so a patch never applies halfway
+	uint32_t newEntities = 0;
+	uint32_t newLights = 0;
+
+	for (uint32_t i = 0; i < pPatchHeader->opCount; i++)
+	{
+		const ScenePatchOp& op = pOps[i];
+
+		if ((op.fields & SCENE_PATCH_MESH) && FindMesh(op.meshHash) == SceneInvalidIndex)
+			return false;
+
+		if ((op.fields & SCENE_PATCH_MATERIAL_REF) && FindMaterial(op.materialHash) == SceneInvalidIndex)
+			return false;
+
+		switch (op.type)
+		{
+		case SCENE_PATCH_ENTITY:
+			if (FindEntity(op.nameHash) == SceneInvalidIndex)
+			{
+				// New entities need something to draw
+				if ((op.fields & (SCENE_PATCH_MESH | SCENE_PATCH_MATERIAL_REF)) != (SCENE_PATCH_MESH | SCENE_PATCH_MATERIAL_REF))
+					return false;
+
+				newEntities++;
+			}
+			break;
+
+		case SCENE_PATCH_REMOVE_ENTITY:
+			break;
+
+		case SCENE_PATCH_LIGHT:
+			if (FindLight(op.nameHash) == SceneInvalidIndex)
+				newLights++;
+			break;
+
+		case SCENE_PATCH_MATERIAL:
+			if (FindMaterial(op.nameHash) == SceneInvalidIndex)
+				return false;
+			break;
+
+		default:
+			return false;
+		}
+	}
+
+	if (newEntities > _pHeader->entityCapacity - _pHeader->entityCount ||
+		newLights > _pHeader->lightCapacity - _pHeader->lightCount)
+		return false;
+
+	result.needsReload = false;
+
+	for (uint32_t i = 0; i < pPatchHeader->opCount; i++)
+	{
+		const ScenePatchOp& op = pOps[i];
+
+		if (op.type == SCENE_PATCH_ENTITY)
+		{
+			uint32_t entity = FindEntity(op.nameHash);
+
+			if (entity == SceneInvalidIndex)
+			{
+				entity = _pHeader->entityCount++;
+
+				SceneNameEntry& name = _pHeader->entityNames.ptr[entity];
+				name.hash = op.nameHash;
+				name.index = entity;
+				name.padding = 0;
+
+				SceneTransform& transform = _pHeader->transforms.ptr[entity];
+				transform.position = Vec3();
+				transform.rotation[0] = transform.rotation[1] = transform.rotation[2] = 0.0f;
+				transform.rotation[3] = 1.0f;
+				transform.scale = Vec3(1.0f, 1.0f, 1.0f);
+
+				memset(&_pHeader->entities.ptr[entity], 0, sizeof(SceneEntity));
+				result.entitiesAdded++;
+			}
+			else
+			{
+				result.entitiesChanged++;
+			}
+
+			SceneEntity& target = _pHeader->entities.ptr[entity];
+			SceneTransform& transform = _pHeader->transforms.ptr[entity];
+
+			if (op.fields & SCENE_PATCH_POSITION)
+				transform.position = op.transform.position;
+
+			if (op.fields & SCENE_PATCH_ROTATION)
+				memcpy(transform.rotation, op.transform.rotation, sizeof(transform.rotation));
+
+			if (op.fields & SCENE_PATCH_SCALE)
+				transform.scale = op.transform.scale;
+
+			if (op.fields & SCENE_PATCH_MESH)
+				target.mesh = FindMesh(op.meshHash);
+
+			if (op.fields & SCENE_PATCH_MATERIAL_REF)
+				target.material = FindMaterial(op.materialHash);
+
+			if (op.fields & SCENE_PATCH_FLAGS)
+				target.flags = op.flags;
+
+			_pHeader->worlds.ptr[entity] = ComposeSceneTransform(transform);
+		}
+		else if (op.type == SCENE_PATCH_REMOVE_ENTITY)
+		{
+			uint32_t entity = FindEntity(op.nameHash);
+
+			if (entity != SceneInvalidIndex)
+			{
+				_pHeader->entities.ptr[entity].flags |= SCENE_ENTITY_HIDDEN;
+				result.entitiesChanged++;
+			}
+		}
+		else if (op.type == SCENE_PATCH_LIGHT)
+		{
+			uint32_t light = FindLight(op.nameHash);
+
+			if (light == SceneInvalidIndex)
+				light = _pHeader->lightCount++;
+
+			_pHeader->lights.ptr[light] = op.light;
+			_pHeader->lights.ptr[light].nameHash = op.nameHash;
+			result.lightsChanged++;
+		}
+		else
+		{
+			SceneMaterial& material = _pHeader->materials.ptr[FindMaterial(op.nameHash)];
+
+			if (op.fields & SCENE_PATCH_DIFFUSE)
+				memcpy(material.diffuse, op.diffuse, sizeof(material.diffuse));
+
+			if (op.fields & SCENE_PATCH_AMBIENT)
+				memcpy(material.ambient, op.ambient, sizeof(material.ambient));
+
+			if (op.fields & SCENE_PATCH_SPECULAR)
+				memcpy(material.specular, op.specular, sizeof(material.specular));
+
+			if (op.fields & SCENE_PATCH_POWER)
+				material.specularPower = op.specularPower;
+
+			if (op.fields & SCENE_PATCH_CUTOFF)
+				material.alphaCutoff = op.alphaCutoff;
+
+			if (op.fields & SCENE_PATCH_CULL)
+				material.cullMode = op.cullMode;
+
+			result.materialsChanged++;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "cpumath.h"
+
+const uint32_t SceneMagic = 0x314E4353;       // "SCN1"
+const uint32_t ScenePatchMagic = 0x504E4353;  // "SCNP"
+const uint32_t SceneVersion = 2;
+const uint32_t SceneInvalidIndex = 0xFFFFFFFF;
+
+// 64 bit FNV-1a, everything in a scene is referenced by the hash of its name
+uint64_t HashSceneName(const char* name);
+
+// Offset from the start of the file on disk, a pointer once the file has been fixed up.
+// Every ScenePtr in a file is listed in its relocation table.
+template<typename T>
+union ScenePtr
+{
+	uint64_t offset;
+	T*       ptr;
+};
+
+enum SceneEntityFlags : uint32_t
+{
+	SCENE_ENTITY_STATIC    = 1 << 0,  // never moves, cached shadow cascades can keep it
+	SCENE_ENTITY_HIDDEN    = 1 << 1,
+	SCENE_ENTITY_NO_SHADOW = 1 << 2,
+};
+
+// Same bits as MaterialFeature, the renderer checks they still match
+enum SceneMaterialFeature : uint32_t
+{
+	SCENE_MATERIAL_TEXTURED  = 1 << 0,
+	SCENE_MATERIAL_SPECULAR  = 1 << 1,
+	SCENE_MATERIAL_NORMALMAP = 1 << 2,
+	SCENE_MATERIAL_ALPHATEST = 1 << 3,
+};
+
+// Zero is the default so materials that don't say are culled
+enum SceneCullMode : uint32_t
+{
+	SCENE_CULL_BACK,
+	SCENE_CULL_NONE,   // two sided, foliage and the like
+	SCENE_CULL_FRONT,
+};
+
+enum SceneLightType : uint32_t
+{
+	SCENE_LIGHT_POINT,
+	SCENE_LIGHT_SPOT,
+	SCENE_LIGHT_DIRECTIONAL,
+};
+
+struct SceneTransform
+{
+	Vec3  position;
+	float rotation[4];  // quaternion, xyzw
+	Vec3  scale;
+};
+
+struct SceneEntity
+{
+	uint32_t mesh;
+	uint32_t material;
+	uint32_t flags;
+	uint32_t padding;
+};
+
+struct SceneNameEntry
+{
+	uint64_t hash;
+	uint32_t index;
+	uint32_t padding;
+};
+
+struct SceneLight
+{
+	uint64_t nameHash;
+	uint32_t type;
+	float    range;
+	Vec3     position;
+	float    intensity;
+	Vec3     color;
+	float    cosInner;
+	Vec3     direction;
+	float    cosOuter;
+};
+
+struct SceneMesh
+{
+	uint64_t             nameHash;
+	ScenePtr<const char> name;
+};
+
+struct SceneTexture
+{
+	uint64_t             nameHash;
+	ScenePtr<const char> path;
+};
+
+struct SceneMaterial
+{
+	uint64_t nameHash;
+	uint32_t features;
+	uint32_t diffuseTexture;  // SceneInvalidIndex when unused
+	uint32_t normalTexture;
+	float    alphaCutoff;
+	float    diffuse[4];
+	float    ambient[4];
+	float    specular[4];
+	float    specularPower;
+	uint32_t cullMode;        // SceneCullMode
+	float    padding[2];
+};
+
+//--------------------------------------------------------------------------------------
+// File layout. Everything the renderer iterates is a flat array sized for the capacity
+// so patches can add entities and lights in place. Entity names are a table sorted by
+// hash followed by names added at run time.
+//--------------------------------------------------------------------------------------
+struct SceneHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t fileSize;
+
+	uint32_t entityCount;
+	uint32_t entityCapacity;
+	uint32_t sortedNameCount;
+	uint32_t lightCount;
+	uint32_t lightCapacity;
+	uint32_t meshCount;
+	uint32_t materialCount;
+	uint32_t textureCount;
+	uint32_t relocationCount;
+	uint32_t padding;
+
+	ScenePtr<SceneEntity>    entities;
+	ScenePtr<SceneTransform> transforms;
+	ScenePtr<Mat4>           worlds;      // ready to upload, rebuilt when a transform is patched
+	ScenePtr<SceneNameEntry> entityNames;
+	ScenePtr<SceneLight>     lights;
+	ScenePtr<SceneMesh>      meshes;
+	ScenePtr<SceneMaterial>  materials;
+	ScenePtr<SceneTexture>   textures;
+	uint64_t                 relocations; // file offsets of every ScenePtr, not fixed up itself
+};
+
+enum ScenePatchOpType : uint32_t
+{
+	SCENE_PATCH_ENTITY,         // changes the fields in the mask, adds the entity when it's new
+	SCENE_PATCH_REMOVE_ENTITY,  // hides it, indices stay stable
+	SCENE_PATCH_LIGHT,          // replaces or adds a light
+	SCENE_PATCH_MATERIAL,       // changes the constants in the mask
+};
+
+enum ScenePatchField : uint32_t
+{
+	SCENE_PATCH_POSITION      = 1 << 0,
+	SCENE_PATCH_ROTATION      = 1 << 1,
+	SCENE_PATCH_SCALE         = 1 << 2,
+	SCENE_PATCH_MESH          = 1 << 3,
+	SCENE_PATCH_MATERIAL_REF  = 1 << 4,
+	SCENE_PATCH_FLAGS         = 1 << 5,
+	SCENE_PATCH_DIFFUSE       = 1 << 6,
+	SCENE_PATCH_AMBIENT       = 1 << 7,
+	SCENE_PATCH_SPECULAR      = 1 << 8,
+	SCENE_PATCH_POWER         = 1 << 9,
+	SCENE_PATCH_CUTOFF        = 1 << 10,
+	SCENE_PATCH_CULL          = 1 << 11,
+};
+
+struct ScenePatchHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t opCount;
+	uint32_t padding;
+};
+
+// Fixed size so a patch is a plain array after its header
+struct ScenePatchOp
+{
+	uint32_t       type;
+	uint32_t       fields;
+	uint64_t       nameHash;
+	uint64_t       meshHash;
+	uint64_t       materialHash;
+	uint32_t       flags;
+	uint32_t       padding;
+	SceneTransform transform;
+	SceneLight     light;
+	float          diffuse[4];
+	float          ambient[4];
+	float          specular[4];
+	float          specularPower;
+	float          alphaCutoff;
+	uint32_t       cullMode;
+	uint32_t       padding1;
+};
+
+struct ScenePatchResult
+{
+	uint32_t entitiesChanged;
+	uint32_t entitiesAdded;
+	uint32_t lightsChanged;
+	uint32_t materialsChanged;
+	bool     needsReload;  // the patch can't be applied in place, nothing was changed
+};
+
+// Scale, then rotation, then translation, for row vectors
+Mat4 ComposeSceneTransform(const SceneTransform& transform);
+
+// Quaternion of a rotation by roll about z, then pitch about x, then yaw about y, in radians
+void SceneRotationFromEuler(float pitch, float yaw, float roll, float rotation[4]);
+
+//--------------------------------------------------------------------------------------
+// A compiled scene. Load maps the file copy-on-write and patches the relocation table,
+// nothing is parsed or copied per entity, so load time only depends on the number of
+// resources. Patches are applied in place and either apply completely or not at all.
+//--------------------------------------------------------------------------------------
+class Scene
+{
+private:
+	uint8_t*     _pData;
+	size_t       _size;
+	bool         _mapped;
+	SceneHeader* _pHeader;
+
+private:
+	bool Fixup();
+
+public:
+	Scene();
+	~Scene();
+
+	Scene(const Scene&) = delete;
+	Scene& operator=(const Scene&) = delete;
+
+	bool Load(const char* path);
+	bool LoadFromMemory(const void* pData, size_t size);
+	void Unload();
+
+	bool ApplyPatch(const void* pPatch, size_t size, ScenePatchResult& result);
+
+	uint32_t FindEntity(uint64_t nameHash) const;
+	uint32_t FindLight(uint64_t nameHash) const;
+	uint32_t FindMesh(uint64_t nameHash) const;
+	uint32_t FindMaterial(uint64_t nameHash) const;
+
+	// Gameplay owned entities write their world matrix straight into the scene
+	void SetWorldMatrix(uint32_t entity, const Mat4& world) { _pHeader->worlds.ptr[entity] = world; }
+
+	bool IsLoaded() const { return _pHeader != nullptr; }
+	size_t GetSize() const { return _size; }
+	uint32_t GetEntityCount() const { return _pHeader->entityCount; }
+	const SceneEntity* GetEntities() const { return _pHeader->entities.ptr; }
+	const SceneTransform* GetTransforms() const { return _pHeader->transforms.ptr; }
+	const Mat4* GetWorldMatrices() const { return _pHeader->worlds.ptr; }
+	uint32_t GetLightCount() const { return _pHeader->lightCount; }
+	const SceneLight* GetLights() const { return _pHeader->lights.ptr; }
+	uint32_t GetMeshCount() const { return _pHeader->meshCount; }
+	const SceneMesh* GetMeshes() const { return _pHeader->meshes.ptr; }
+	uint32_t GetMaterialCount() const { return _pHeader->materialCount; }
+	const SceneMaterial* GetMaterials() const { return _pHeader->materials.ptr; }
+	uint32_t GetTextureCount() const { return _pHeader->textureCount; }
+	const SceneTexture* GetTextures() const { return _pHeader->textures.ptr; }
+};
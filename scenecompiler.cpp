@@ -0,0 +1,847 @@
+#include "scenecompiler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+static const float DegreesToRadians = 3.14159265f / 180.0f;
+
+// Splits the next line into tokens, quotes keep spaces in paths
+static bool ReadLine(const char*& p, int& line, std::vector<std::string>& tokens)
+{
+	tokens.clear();
+
+	if (*p == 0)
+		return false;
+
+	line++;
+
+	while (*p && *p != '\n')
+	{
+		if (*p == '#')
+		{
+			while (*p && *p != '\n')
+				p++;
+
+			break;
+		}
+
+		if (isspace((unsigned char)*p))
+		{
+			p++;
+			continue;
+		}
+
+		std::string token;
+
+		if (*p == '"')
+		{
+			for (p++; *p && *p != '"' && *p != '\n'; p++)
+				token += *p;
+
+			if (*p == '"')
+				p++;
+		}
+		else
+		{
+			for (; *p && !isspace((unsigned char)*p) && *p != '#'; p++)
+				token += *p;
+		}
+
+		tokens.push_back(token);
+	}
+
+	if (*p == '\n')
+		p++;
+
+	return true;
+}
+
+class TokenReader
+{
+private:
+	const std::vector<std::string>& _tokens;
+	size_t                          _next;
+	int                             _line;
+	char*                           _error;
+	size_t                          _errorSize;
+
+public:
+	TokenReader(const std::vector<std::string>& tokens, int line, char* error, size_t errorSize)
+		: _tokens(tokens), _next(0), _line(line), _error(error), _errorSize(errorSize) {}
+
+	bool Fail(const char* format, ...)
+	{
+		char message[256];
+
+		va_list args;
+		va_start(args, format);
+		vsnprintf(message, sizeof(message), format, args);
+		va_end(args);
+
+		if (_error && _errorSize)
+			snprintf(_error, _errorSize, "line %d: %s", _line, message);
+
+		return false;
+	}
+
+	bool Done() const { return _next >= _tokens.size(); }
+	int GetLine() const { return _line; }
+	const std::string& Next() { return _tokens[_next++]; }
+
+	bool PeekNumber() const
+	{
+		if (Done())
+			return false;
+
+		char* end;
+		strtof(_tokens[_next].c_str(), &end);
+
+		return *end == 0 && end != _tokens[_next].c_str();
+	}
+
+	bool Name(std::string& name, const char* what)
+	{
+		if (Done())
+			return Fail("missing %s", what);
+
+		name = Next();
+
+		return true;
+	}
+
+	bool Floats(float* pValues, int count, const char* what)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			if (!PeekNumber())
+				return Fail("%s needs %d numbers", what, count);
+
+			pValues[i] = strtof(Next().c_str(), nullptr);
+		}
+
+		return true;
+	}
+
+	bool Count(uint32_t& value, const char* what)
+	{
+		float number = 0.0f;
+
+		if (!Floats(&number, 1, what))
+			return false;
+
+		if (number < 0.0f || number > 16777216.0f)
+			return Fail("%s is out of range", what);
+
+		value = (uint32_t)number;
+
+		return true;
+	}
+};
+
+void InitSceneEntity(SceneDescEntity& entity)
+{
+	entity.name.clear();
+	entity.mesh.clear();
+	entity.material.clear();
+	entity.transform.position = Vec3();
+	entity.transform.rotation[0] = entity.transform.rotation[1] = entity.transform.rotation[2] = 0.0f;
+	entity.transform.rotation[3] = 1.0f;
+	entity.transform.scale = Vec3(1.0f, 1.0f, 1.0f);
+	entity.flags = 0;
+	entity.line = 0;
+}
+
+// Same defaults as Material
+void InitSceneMaterial(SceneDescMaterial& material)
+{
+	material.name.clear();
+	material.diffuseTexture.clear();
+	material.normalTexture.clear();
+	memset(&material.data, 0, sizeof(material.data));
+
+	for (int i = 0; i < 4; i++)
+	{
+		material.data.diffuse[i] = 1.0f;
+		material.data.ambient[i] = 1.0f;
+	}
+
+	material.data.specular[3] = 1.0f;
+	material.data.specularPower = 1.0f;
+	material.data.alphaCutoff = 0.5f;
+	material.data.diffuseTexture = SceneInvalidIndex;
+	material.data.normalTexture = SceneInvalidIndex;
+	material.line = 0;
+}
+
+void InitSceneLight(SceneDescLight& light)
+{
+	light.name.clear();
+	light.data = SceneLight();
+	light.data.type = SCENE_LIGHT_POINT;
+	light.data.range = 5.0f;
+	light.data.intensity = 1.0f;
+	light.data.color = Vec3(1.0f, 1.0f, 1.0f);
+	light.data.direction = Vec3(0.0f, -1.0f, 0.0f);
+	light.data.cosInner = cosf(20.0f * DegreesToRadians);
+	light.data.cosOuter = cosf(35.0f * DegreesToRadians);
+	light.line = 0;
+}
+
+static bool ParseEntity(TokenReader& reader, SceneDescEntity& entity, uint32_t& fields)
+{
+	fields = 0;
+
+	while (!reader.Done())
+	{
+		const std::string& key = reader.Next();
+
+		if (key == "mesh")
+		{
+			if (!reader.Name(entity.mesh, "mesh name"))
+				return false;
+
+			fields |= SCENE_PATCH_MESH;
+		}
+		else if (key == "material")
+		{
+			if (!reader.Name(entity.material, "material name"))
+				return false;
+
+			fields |= SCENE_PATCH_MATERIAL_REF;
+		}
+		else if (key == "position")
+		{
+			if (!reader.Floats(&entity.transform.position.x, 3, "position"))
+				return false;
+
+			fields |= SCENE_PATCH_POSITION;
+		}
+		else if (key == "rotation")
+		{
+			float angles[3];
+
+			if (!reader.Floats(angles, 3, "rotation"))
+				return false;
+
+			SceneRotationFromEuler(angles[0] * DegreesToRadians, angles[1] * DegreesToRadians, angles[2] * DegreesToRadians,
+								   entity.transform.rotation);
+			fields |= SCENE_PATCH_ROTATION;
+		}
+		else if (key == "scale")
+		{
+			if (!reader.Floats(&entity.transform.scale.x, 1, "scale"))
+				return false;
+
+			// One number scales uniformly
+			if (reader.PeekNumber())
+			{
+				if (!reader.Floats(&entity.transform.scale.y, 2, "scale"))
+					return false;
+			}
+			else
+			{
+				entity.transform.scale.y = entity.transform.scale.z = entity.transform.scale.x;
+			}
+
+			fields |= SCENE_PATCH_SCALE;
+		}
+		else if (key == "static" || key == "hidden" || key == "noshadow" || key == "dynamic" || key == "visible")
+		{
+			if (key == "static")
+				entity.flags |= SCENE_ENTITY_STATIC;
+			else if (key == "hidden")
+				entity.flags |= SCENE_ENTITY_HIDDEN;
+			else if (key == "noshadow")
+				entity.flags |= SCENE_ENTITY_NO_SHADOW;
+
+			fields |= SCENE_PATCH_FLAGS;
+		}
+		else
+		{
+			return reader.Fail("unknown entity field '%s'", key.c_str());
+		}
+	}
+
+	return true;
+}
+
+static bool ParseLight(TokenReader& reader, SceneDescLight& light)
+{
+	std::string type;
+
+	if (!reader.Name(type, "light type"))
+		return false;
+
+	if (type == "point")
+		light.data.type = SCENE_LIGHT_POINT;
+	else if (type == "spot")
+		light.data.type = SCENE_LIGHT_SPOT;
+	else if (type == "directional")
+		light.data.type = SCENE_LIGHT_DIRECTIONAL;
+	else
+		return reader.Fail("unknown light type '%s'", type.c_str());
+
+	while (!reader.Done())
+	{
+		const std::string& key = reader.Next();
+		bool ok;
+
+		if (key == "position")
+		{
+			ok = reader.Floats(&light.data.position.x, 3, "position");
+		}
+		else if (key == "direction")
+		{
+			ok = reader.Floats(&light.data.direction.x, 3, "direction");
+
+			if (ok && Length(light.data.direction) < 1.0e-6f)
+				return reader.Fail("direction can't be zero");
+
+			light.data.direction = Normalize(light.data.direction);
+		}
+		else if (key == "color")
+		{
+			ok = reader.Floats(&light.data.color.x, 3, "color");
+		}
+		else if (key == "intensity")
+		{
+			ok = reader.Floats(&light.data.intensity, 1, "intensity");
+		}
+		else if (key == "range")
+		{
+			ok = reader.Floats(&light.data.range, 1, "range");
+		}
+		else if (key == "inner" || key == "outer")
+		{
+			float degrees = 0.0f;
+			ok = reader.Floats(&degrees, 1, key.c_str());
+
+			if (key == "inner")
+				light.data.cosInner = cosf(degrees * DegreesToRadians);
+			else
+				light.data.cosOuter = cosf(degrees * DegreesToRadians);
+		}
+		else
+		{
+			return reader.Fail("unknown light field '%s'", key.c_str());
+		}
+
+		if (!ok)
+			return false;
+	}
+
+	return true;
+}
+
+static bool ParseCullMode(TokenReader& reader, uint32_t& cullMode)
+{
+	std::string mode;
+
+	if (!reader.Name(mode, "cull mode"))
+		return false;
+
+	if (mode == "back")
+		cullMode = SCENE_CULL_BACK;
+	else if (mode == "front")
+		cullMode = SCENE_CULL_FRONT;
+	else if (mode == "none")
+		cullMode = SCENE_CULL_NONE;
+	else
+		return reader.Fail("unknown cull mode '%s'", mode.c_str());
+
+	return true;
+}
+
+static bool ParseMaterial(TokenReader& reader, SceneDescMaterial& material, uint32_t& fields)
+{
+	fields = 0;
+
+	while (!reader.Done())
+	{
+		const std::string& key = reader.Next();
+		bool ok;
+
+		if (key == "texture")
+		{
+			ok = reader.Name(material.diffuseTexture, "texture name");
+			material.data.features |= SCENE_MATERIAL_TEXTURED;
+		}
+		else if (key == "normal")
+		{
+			ok = reader.Name(material.normalTexture, "texture name");
+			material.data.features |= SCENE_MATERIAL_NORMALMAP;
+		}
+		else if (key == "diffuse")
+		{
+			ok = reader.Floats(material.data.diffuse, 4, "diffuse");
+			fields |= SCENE_PATCH_DIFFUSE;
+		}
+		else if (key == "ambient")
+		{
+			ok = reader.Floats(material.data.ambient, 4, "ambient");
+			fields |= SCENE_PATCH_AMBIENT;
+		}
+		else if (key == "specular")
+		{
+			ok = reader.Floats(material.data.specular, 4, "specular");
+			material.data.features |= SCENE_MATERIAL_SPECULAR;
+			fields |= SCENE_PATCH_SPECULAR;
+		}
+		else if (key == "power")
+		{
+			ok = reader.Floats(&material.data.specularPower, 1, "power");
+			fields |= SCENE_PATCH_POWER;
+		}
+		else if (key == "cutoff")
+		{
+			ok = reader.Floats(&material.data.alphaCutoff, 1, "cutoff");
+			material.data.features |= SCENE_MATERIAL_ALPHATEST;
+			fields |= SCENE_PATCH_CUTOFF;
+		}
+		else if (key == "cull")
+		{
+			ok = ParseCullMode(reader, material.data.cullMode);
+			fields |= SCENE_PATCH_CULL;
+		}
+		else
+		{
+			return reader.Fail("unknown material field '%s'", key.c_str());
+		}
+
+		if (!ok)
+			return false;
+	}
+
+	return true;
+}
+
+bool ParseSceneText(const char* text, SceneDescription& scene, char* error, size_t errorSize)
+{
+	std::vector<std::string> tokens;
+	int line = 0;
+
+	while (ReadLine(text, line, tokens))
+	{
+		if (tokens.empty())
+			continue;
+
+		TokenReader reader(tokens, line, error, errorSize);
+		std::string keyword = reader.Next();
+
+		if (keyword == "reserve")
+		{
+			while (!reader.Done())
+			{
+				std::string what = reader.Next();
+
+				if (what == "entities")
+				{
+					if (!reader.Count(scene.entityReserve, "entities"))
+						return false;
+				}
+				else if (what == "lights")
+				{
+					if (!reader.Count(scene.lightReserve, "lights"))
+						return false;
+				}
+				else
+				{
+					return reader.Fail("can't reserve '%s'", what.c_str());
+				}
+			}
+		}
+		else if (keyword == "texture")
+		{
+			SceneDescTexture texture;
+			texture.line = line;
+
+			if (!reader.Name(texture.name, "texture name") || !reader.Name(texture.path, "texture path"))
+				return false;
+
+			if (!reader.Done())
+				return reader.Fail("unexpected '%s'", reader.Next().c_str());
+
+			scene.textures.push_back(texture);
+		}
+		else if (keyword == "mesh")
+		{
+			std::string name;
+
+			if (!reader.Name(name, "mesh name"))
+				return false;
+
+			scene.meshes.push_back(name);
+		}
+		else if (keyword == "material")
+		{
+			SceneDescMaterial material;
+			InitSceneMaterial(material);
+			material.line = line;
+			uint32_t fields;
+
+			if (!reader.Name(material.name, "material name") || !ParseMaterial(reader, material, fields))
+				return false;
+
+			scene.materials.push_back(material);
+		}
+		else if (keyword == "entity")
+		{
+			SceneDescEntity entity;
+			InitSceneEntity(entity);
+			entity.line = line;
+			uint32_t fields;
+
+			if (!reader.Name(entity.name, "entity name") || !ParseEntity(reader, entity, fields))
+				return false;
+
+			if (entity.mesh.empty() || entity.material.empty())
+				return reader.Fail("entity '%s' needs a mesh and a material", entity.name.c_str());
+
+			scene.entities.push_back(entity);
+		}
+		else if (keyword == "light")
+		{
+			SceneDescLight light;
+			InitSceneLight(light);
+			light.line = line;
+
+			if (!reader.Name(light.name, "light name") || !ParseLight(reader, light))
+				return false;
+
+			scene.lights.push_back(light);
+		}
+		else
+		{
+			return reader.Fail("unknown keyword '%s'", keyword.c_str());
+		}
+	}
+
+	return true;
+}
+
+static bool WriteError(char* error, size_t errorSize, int line, const char* kind, const char* name, const char* problem)
+{
+	if (error && errorSize)
+		snprintf(error, errorSize, "line %d: %s '%s' %s", line, kind, name, problem);
+
+	return false;
+}
+
+// Name hash to index, fails on duplicates so a hash always means one object
+static bool AddName(std::unordered_map<uint64_t, uint32_t>& names, const std::string& name, uint32_t index)
+{
+	return names.insert(std::make_pair(HashSceneName(name.c_str()), index)).second;
+}
+
+static uint32_t LookupName(const std::unordered_map<uint64_t, uint32_t>& names, const std::string& name)
+{
+	std::unordered_map<uint64_t, uint32_t>::const_iterator it = names.find(HashSceneName(name.c_str()));
+
+	return it == names.end() ? SceneInvalidIndex : it->second;
+}
+
+static size_t AlignSection(size_t offset)
+{
+	return (offset + 15) & ~(size_t)15;
+}
+
+bool WriteScene(const SceneDescription& scene, std::vector<uint8_t>& output, char* error, size_t errorSize)
+{
+	std::unordered_map<uint64_t, uint32_t> textureNames, materialNames, meshNames, lightNames;
+
+	for (size_t i = 0; i < scene.textures.size(); i++)
+	{
+		if (!AddName(textureNames, scene.textures[i].name, (uint32_t)i))
+			return WriteError(error, errorSize, scene.textures[i].line, "texture", scene.textures[i].name.c_str(), "is defined twice");
+	}
+
+	for (size_t i = 0; i < scene.meshes.size(); i++)
+	{
+		if (!AddName(meshNames, scene.meshes[i], (uint32_t)i))
+			return WriteError(error, errorSize, 0, "mesh", scene.meshes[i].c_str(), "is defined twice");
+	}
+
+	for (size_t i = 0; i < scene.materials.size(); i++)
+	{
+		if (!AddName(materialNames, scene.materials[i].name, (uint32_t)i))
+			return WriteError(error, errorSize, scene.materials[i].line, "material", scene.materials[i].name.c_str(), "is defined twice");
+	}
+
+	for (size_t i = 0; i < scene.lights.size(); i++)
+	{
+		if (!AddName(lightNames, scene.lights[i].name, (uint32_t)i))
+			return WriteError(error, errorSize, scene.lights[i].line, "light", scene.lights[i].name.c_str(), "is defined twice");
+	}
+
+	uint32_t entityCount = (uint32_t)scene.entities.size();
+	uint32_t entityCapacity = entityCount + scene.entityReserve;
+	uint32_t lightCount = (uint32_t)scene.lights.size();
+	uint32_t lightCapacity = lightCount + scene.lightReserve;
+	uint32_t meshCount = (uint32_t)scene.meshes.size();
+	uint32_t materialCount = (uint32_t)scene.materials.size();
+	uint32_t textureCount = (uint32_t)scene.textures.size();
+
+	// Lay the sections out back to back, strings last so the file ends in a terminator
+	size_t entitiesOffset = AlignSection(sizeof(SceneHeader));
+	size_t transformsOffset = AlignSection(entitiesOffset + (size_t)entityCapacity * sizeof(SceneEntity));
+	size_t worldsOffset = AlignSection(transformsOffset + (size_t)entityCapacity * sizeof(SceneTransform));
+	size_t namesOffset = AlignSection(worldsOffset + (size_t)entityCapacity * sizeof(Mat4));
+	size_t lightsOffset = AlignSection(namesOffset + (size_t)entityCapacity * sizeof(SceneNameEntry));
+	size_t meshesOffset = AlignSection(lightsOffset + (size_t)lightCapacity * sizeof(SceneLight));
+	size_t materialsOffset = AlignSection(meshesOffset + (size_t)meshCount * sizeof(SceneMesh));
+	size_t texturesOffset = AlignSection(materialsOffset + (size_t)materialCount * sizeof(SceneMaterial));
+	size_t relocationsOffset = AlignSection(texturesOffset + (size_t)textureCount * sizeof(SceneTexture));
+	uint32_t relocationCount = 8 + meshCount + textureCount;
+	size_t stringsOffset = relocationsOffset + (size_t)relocationCount * sizeof(uint64_t);
+
+	size_t stringBytes = 1;
+
+	for (size_t i = 0; i < scene.meshes.size(); i++)
+		stringBytes += scene.meshes[i].size() + 1;
+
+	for (size_t i = 0; i < scene.textures.size(); i++)
+		stringBytes += scene.textures[i].path.size() + 1;
+
+	output.assign(stringsOffset + stringBytes, 0);
+	uint8_t* pData = output.data();
+
+	SceneHeader* pHeader = reinterpret_cast<SceneHeader*>(pData);
+	pHeader->magic = SceneMagic;
+	pHeader->version = SceneVersion;
+	pHeader->fileSize = output.size();
+	pHeader->entityCount = entityCount;
+	pHeader->entityCapacity = entityCapacity;
+	pHeader->sortedNameCount = entityCount;
+	pHeader->lightCount = lightCount;
+	pHeader->lightCapacity = lightCapacity;
+	pHeader->meshCount = meshCount;
+	pHeader->materialCount = materialCount;
+	pHeader->textureCount = textureCount;
+	pHeader->relocationCount = relocationCount;
+	pHeader->entities.offset = entitiesOffset;
+	pHeader->transforms.offset = transformsOffset;
+	pHeader->worlds.offset = worldsOffset;
+	pHeader->entityNames.offset = namesOffset;
+	pHeader->lights.offset = lightsOffset;
+	pHeader->meshes.offset = meshesOffset;
+	pHeader->materials.offset = materialsOffset;
+	pHeader->textures.offset = texturesOffset;
+	pHeader->relocations = relocationsOffset;
+
+	uint64_t* pRelocations = reinterpret_cast<uint64_t*>(pData + relocationsOffset);
+	uint32_t relocation = 0;
+
+	pRelocations[relocation++] = offsetof(SceneHeader, entities);
+	pRelocations[relocation++] = offsetof(SceneHeader, transforms);
+	pRelocations[relocation++] = offsetof(SceneHeader, worlds);
+	pRelocations[relocation++] = offsetof(SceneHeader, entityNames);
+	pRelocations[relocation++] = offsetof(SceneHeader, lights);
+	pRelocations[relocation++] = offsetof(SceneHeader, meshes);
+	pRelocations[relocation++] = offsetof(SceneHeader, materials);
+	pRelocations[relocation++] = offsetof(SceneHeader, textures);
+
+	size_t stringOffset = stringsOffset + 1;
+
+	SceneMesh* pMeshes = reinterpret_cast<SceneMesh*>(pData + meshesOffset);
+
+	for (uint32_t i = 0; i < meshCount; i++)
+	{
+		pMeshes[i].nameHash = HashSceneName(scene.meshes[i].c_str());
+		pMeshes[i].name.offset = stringOffset;
+		pRelocations[relocation++] = meshesOffset + i * sizeof(SceneMesh) + offsetof(SceneMesh, name);
+
+		memcpy(pData + stringOffset, scene.meshes[i].c_str(), scene.meshes[i].size());
+		stringOffset += scene.meshes[i].size() + 1;
+	}
+
+	SceneTexture* pTextures = reinterpret_cast<SceneTexture*>(pData + texturesOffset);
+
+	for (uint32_t i = 0; i < textureCount; i++)
+	{
+		pTextures[i].nameHash = HashSceneName(scene.textures[i].name.c_str());
+		pTextures[i].path.offset = stringOffset;
+		pRelocations[relocation++] = texturesOffset + i * sizeof(SceneTexture) + offsetof(SceneTexture, path);
+
+		memcpy(pData + stringOffset, scene.textures[i].path.c_str(), scene.textures[i].path.size());
+		stringOffset += scene.textures[i].path.size() + 1;
+	}
+
+	SceneMaterial* pMaterials = reinterpret_cast<SceneMaterial*>(pData + materialsOffset);
+
+	for (uint32_t i = 0; i < materialCount; i++)
+	{
+		const SceneDescMaterial& material = scene.materials[i];
+
+		pMaterials[i] = material.data;
+		pMaterials[i].nameHash = HashSceneName(material.name.c_str());
+
+		if (!material.diffuseTexture.empty())
+		{
+			pMaterials[i].diffuseTexture = LookupName(textureNames, material.diffuseTexture);
+
+			if (pMaterials[i].diffuseTexture == SceneInvalidIndex)
+				return WriteError(error, errorSize, material.line, "texture", material.diffuseTexture.c_str(), "doesn't exist");
+		}
+
+		if (!material.normalTexture.empty())
+		{
+			pMaterials[i].normalTexture = LookupName(textureNames, material.normalTexture);
+
+			if (pMaterials[i].normalTexture == SceneInvalidIndex)
+				return WriteError(error, errorSize, material.line, "texture", material.normalTexture.c_str(), "doesn't exist");
+		}
+	}
+
+	SceneEntity* pEntities = reinterpret_cast<SceneEntity*>(pData + entitiesOffset);
+	SceneTransform* pTransforms = reinterpret_cast<SceneTransform*>(pData + transformsOffset);
+	Mat4* pWorlds = reinterpret_cast<Mat4*>(pData + worldsOffset);
+	SceneNameEntry* pNames = reinterpret_cast<SceneNameEntry*>(pData + namesOffset);
+
+	for (uint32_t i = 0; i < entityCount; i++)
+	{
+		const SceneDescEntity& entity = scene.entities[i];
+
+		pEntities[i].mesh = LookupName(meshNames, entity.mesh);
+		pEntities[i].material = LookupName(materialNames, entity.material);
+		pEntities[i].flags = entity.flags;
+
+		if (pEntities[i].mesh == SceneInvalidIndex)
+			return WriteError(error, errorSize, entity.line, "mesh", entity.mesh.c_str(), "doesn't exist");
+
+		if (pEntities[i].material == SceneInvalidIndex)
+			return WriteError(error, errorSize, entity.line, "material", entity.material.c_str(), "doesn't exist");
+
+		pTransforms[i] = entity.transform;
+		pWorlds[i] = ComposeSceneTransform(entity.transform);
+		pNames[i].hash = HashSceneName(entity.name.c_str());
+		pNames[i].index = i;
+	}
+
+	std::sort(pNames, pNames + entityCount, [](const SceneNameEntry& a, const SceneNameEntry& b) { return a.hash < b.hash; });
+
+	for (uint32_t i = 1; i < entityCount; i++)
+	{
+		if (pNames[i].hash == pNames[i - 1].hash)
+		{
+			const SceneDescEntity& entity = scene.entities[pNames[i].index];
+			return WriteError(error, errorSize, entity.line, "entity", entity.name.c_str(), "is defined twice");
+		}
+	}
+
+	SceneLight* pLights = reinterpret_cast<SceneLight*>(pData + lightsOffset);
+
+	for (uint32_t i = 0; i < lightCount; i++)
+	{
+		pLights[i] = scene.lights[i].data;
+		pLights[i].nameHash = HashSceneName(scene.lights[i].name.c_str());
+	}
+
+	return true;
+}
+
+bool CompileScene(const char* text, std::vector<uint8_t>& output, char* error, size_t errorSize)
+{
+	SceneDescription scene;
+
+	return ParseSceneText(text, scene, error, errorSize) && WriteScene(scene, output, error, errorSize);
+}
+
+bool CompileScenePatch(const char* text, std::vector<uint8_t>& output, char* error, size_t errorSize)
+{
+	std::vector<ScenePatchOp> ops;
+	std::vector<std::string> tokens;
+	int line = 0;
+
+	while (ReadLine(text, line, tokens))
+	{
+		if (tokens.empty())
+			continue;
+
+		TokenReader reader(tokens, line, error, errorSize);
+		std::string keyword = reader.Next();
+
+		ScenePatchOp op = {};
+
+		if (keyword == "entity")
+		{
+			SceneDescEntity entity;
+			InitSceneEntity(entity);
+
+			if (!reader.Name(entity.name, "entity name") || !ParseEntity(reader, entity, op.fields))
+				return false;
+
+			op.type = SCENE_PATCH_ENTITY;
+			op.nameHash = HashSceneName(entity.name.c_str());
+			op.meshHash = HashSceneName(entity.mesh.c_str());
+			op.materialHash = HashSceneName(entity.material.c_str());
+			op.flags = entity.flags;
+			op.transform = entity.transform;
+		}
+		else if (keyword == "remove")
+		{
+			std::string name;
+
+			if (!reader.Name(name, "entity name"))
+				return false;
+
+			op.type = SCENE_PATCH_REMOVE_ENTITY;
+			op.nameHash = HashSceneName(name.c_str());
+		}
+		else if (keyword == "light")
+		{
+			SceneDescLight light;
+			InitSceneLight(light);
+
+			if (!reader.Name(light.name, "light name") || !ParseLight(reader, light))
+				return false;
+
+			op.type = SCENE_PATCH_LIGHT;
+			op.nameHash = HashSceneName(light.name.c_str());
+			op.light = light.data;
+		}
+		else if (keyword == "material")
+		{
+			SceneDescMaterial material;
+			InitSceneMaterial(material);
+
+			if (!reader.Name(material.name, "material name") || !ParseMaterial(reader, material, op.fields))
+				return false;
+
+			if (!material.diffuseTexture.empty() || !material.normalTexture.empty())
+				return reader.Fail("texture changes need a full reload");
+
+			op.type = SCENE_PATCH_MATERIAL;
+			op.nameHash = HashSceneName(material.name.c_str());
+			memcpy(op.diffuse, material.data.diffuse, sizeof(op.diffuse));
+			memcpy(op.ambient, material.data.ambient, sizeof(op.ambient));
+			memcpy(op.specular, material.data.specular, sizeof(op.specular));
+			op.specularPower = material.data.specularPower;
+			op.alphaCutoff = material.data.alphaCutoff;
+			op.cullMode = material.data.cullMode;
+		}
+		else
+		{
+			return reader.Fail("'%s' can't be patched, recompile the scene", keyword.c_str());
+		}
+
+		ops.push_back(op);
+	}
+
+	ScenePatchHeader header = {};
+	header.magic = ScenePatchMagic;
+	header.version = SceneVersion;
+	header.opCount = (uint32_t)ops.size();
+
+	output.resize(sizeof(header) + ops.size() * sizeof(ScenePatchOp));
+	memcpy(output.data(), &header, sizeof(header));
+
+	if (!ops.empty())
+		memcpy(output.data() + sizeof(header), ops.data(), ops.size() * sizeof(ScenePatchOp));
+
+	return true;
+}
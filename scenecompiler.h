@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "scene.h"
+
+//--------------------------------------------------------------------------------------
+// Text form of a scene, one object per line, '#' starts a comment:
+//
+//   reserve entities 64 lights 64
+//   texture asphalt asphalt.dds
+//   mesh cube
+//   material floor texture asphalt diffuse 1 1 1 1 specular 0.3 0.3 0.3 1 power 10
+//   entity floor mesh floor material floor position 0 0 0 rotation 0 90 0 scale 10 1 10 static
+//   light lamp0 spot position 0 -1 0 direction 0 -1 0 color 1 0.5 0 range 3 inner 20 outer 35
+//   light sun directional direction 0 -1 0 color 1 1 1
+//
+// Rotations are pitch, yaw and roll in degrees. Material features follow from what is
+// given: texture, normal, specular and cutoff turn on the matching shader features.
+//
+// Patches use the same lines. An entity line only changes the fields it names and adds
+// the entity when the name is new, flag words replace all of its flags. "remove name"
+// hides an entity, light lines replace the whole light and material lines change
+// constants only, textures need a full reload.
+//--------------------------------------------------------------------------------------
+struct SceneDescTexture
+{
+	std::string name;
+	std::string path;
+	int         line;
+};
+
+struct SceneDescMaterial
+{
+	std::string   name;
+	std::string   diffuseTexture;
+	std::string   normalTexture;
+	SceneMaterial data;
+	int           line;
+};
+
+struct SceneDescEntity
+{
+	std::string    name;
+	std::string    mesh;
+	std::string    material;
+	SceneTransform transform;
+	uint32_t       flags;
+	int            line;
+};
+
+struct SceneDescLight
+{
+	std::string name;
+	SceneLight  data;
+	int         line;
+};
+
+struct SceneDescription
+{
+	std::vector<SceneDescTexture>  textures;
+	std::vector<SceneDescMaterial> materials;
+	std::vector<std::string>       meshes;
+	std::vector<SceneDescEntity>   entities;
+	std::vector<SceneDescLight>    lights;
+
+	// Free slots left in the file for entities and lights added by patches
+	uint32_t entityReserve;
+	uint32_t lightReserve;
+
+	SceneDescription() : entityReserve(64), lightReserve(64) {}
+};
+
+// Defaults for objects built in code rather than parsed
+void InitSceneEntity(SceneDescEntity& entity);
+void InitSceneMaterial(SceneDescMaterial& material);
+void InitSceneLight(SceneDescLight& light);
+
+bool ParseSceneText(const char* text, SceneDescription& scene, char* error, size_t errorSize);
+bool WriteScene(const SceneDescription& scene, std::vector<uint8_t>& output, char* error, size_t errorSize);
+bool CompileScene(const char* text, std::vector<uint8_t>& output, char* error, size_t errorSize);
+
+bool CompileScenePatch(const char* text, std::vector<uint8_t>& output, char* error, size_t errorSize);
@@ -0,0 +1,177 @@
+#include "shadowcascades.h"
+
+CascadedShadowMaps::CascadedShadowMaps()
+{
+	_cacheValid = false;
+	memset(&_stats, 0, sizeof(_stats));
+
+	for (uint32_t i = 0; i < MaxShadowCascades; i++)
+		_cascades[i] = ShadowCascade();
+}
+
+void CascadedShadowMaps::Init(const ShadowSettings& settings)
+{
+	_settings = settings;
+
+	if (_settings.cascadeCount > MaxShadowCascades)
+		_settings.cascadeCount = MaxShadowCascades;
+
+	for (uint32_t i = 0; i < MaxShadowCascades; i++)
+		_cascades[i] = ShadowCascade();
+
+	_cacheValid = false;
+}
+
+void CascadedShadowMaps::ComputeSplits(float nearZ, float farZ, uint32_t count, float lambda, float* pSplits)
+{
+	pSplits[0] = nearZ;
+
+	for (uint32_t i = 1; i < count; i++)
+	{
+		float fraction = (float)i / count;
+		float logSplit = nearZ * powf(farZ / nearZ, fraction);
+		float linearSplit = nearZ + (farZ - nearZ) * fraction;
+
+		pSplits[i] = lambda * logSplit + (1.0f - lambda) * linearSplit;
+	}
+
+	pSplits[count] = farZ;
+}
+
+void CascadedShadowMaps::ComputeSliceSphere(const Mat4& view, float fovY, float aspect, float splitNear, float splitFar,
+											Vec3& center, float& radius)
+{
+	// Camera basis and position straight out of the view matrix
+	Vec3 right(view.m[0][0], view.m[1][0], view.m[2][0]);
+	Vec3 up(view.m[0][1], view.m[1][1], view.m[2][1]);
+	Vec3 forward(view.m[0][2], view.m[1][2], view.m[2][2]);
+	Vec3 position = -(right * view.m[3][0] + up * view.m[3][1] + forward * view.m[3][2]);
+
+	float tanHalfFovY = tanf(fovY * 0.5f);
+	float distances[2] = { splitNear, splitFar };
+	Vec3 corners[8];
+
+	for (int d = 0; d < 2; d++)
+	{
+		Vec3 planeCenter = position + forward * distances[d];
+		float halfHeight = distances[d] * tanHalfFovY;
+		float halfWidth = halfHeight * aspect;
+
+		corners[d * 4 + 0] = planeCenter - right * halfWidth - up * halfHeight;
+		corners[d * 4 + 1] = planeCenter + right * halfWidth - up * halfHeight;
+		corners[d * 4 + 2] = planeCenter - right * halfWidth + up * halfHeight;
+		corners[d * 4 + 3] = planeCenter + right * halfWidth + up * halfHeight;
+	}
+
+	center = Vec3();
+
+	for (int i = 0; i < 8; i++)
+		center += corners[i];
+
+	center *= 1.0f / 8.0f;
+	radius = 0.0f;
+
+	for (int i = 0; i < 8; i++)
+		radius = fmaxf(radius, Length(corners[i] - center));
+
+	// Quantise so the texel size only changes when the slice really grows or shrinks
+	radius = ceilf(radius * 16.0f) / 16.0f;
+}
+
+void CascadedShadowMaps::FitCascade(ShadowCascade& cascade, const Vec3& center, float radius, const Vec3& lightDirection) const
+{
+	Vec3 up = fabsf(lightDirection.y) > 0.99f ? Vec3(0.0f, 0.0f, 1.0f) : Vec3(0.0f, 1.0f, 0.0f);
+
+	// A couple of texels of slack so snapping the centre can't uncover the sphere
+	float texelSize = 2.0f * radius / _settings.resolution;
+	radius += 2.0f * texelSize;
+	texelSize = 2.0f * radius / _settings.resolution;
+
+	// Snap the centre to whole texels in light space so the cascade doesn't shimmer as
+	// the camera moves
+	Mat4 lightRotation = LookAtLH(Vec3(), lightDirection, up);
+	Vec3 centerLS = TransformPoint(center, lightRotation);
+	centerLS.x = floorf(centerLS.x / texelSize) * texelSize;
+	centerLS.y = floorf(centerLS.y / texelSize) * texelSize;
+	Vec3 snapped = TransformDirection(centerLS, Transpose(lightRotation));
+
+	Vec3 eye = snapped - lightDirection * (radius + _settings.casterExtent);
+
+	cascade.view = LookAtLH(eye, snapped, up);
+	cascade.projection = OrthographicLH(2.0f * radius, 2.0f * radius, 0.0f, 2.0f * radius + _settings.casterExtent);
+	cascade.viewProjection = Multiply(cascade.view, cascade.projection);
+	cascade.center = snapped;
+	cascade.radius = radius;
+}
+
+void CascadedShadowMaps::Update(const Mat4& view, float fovY, float aspect, float nearZ, const Vec3& lightDirection)
+{
+	Vec3 direction = Normalize(lightDirection);
+
+	bool lightMoved = !_cacheValid || Dot(direction, _cachedLightDirection) < cosf(_settings.lightAngleThreshold);
+
+	if (lightMoved)
+	{
+		_cachedLightDirection = direction;
+		_cacheValid = true;
+	}
+
+	float splits[MaxShadowCascades + 1];
+	ComputeSplits(nearZ, _settings.shadowDistance, _settings.cascadeCount, _settings.splitLambda, splits);
+
+	_stats.cascadesUpdated = 0;
+	_stats.cascadesReused = 0;
+
+	for (uint32_t i = 0; i < _settings.cascadeCount; i++)
+	{
+		ShadowCascade& cascade = _cascades[i];
+
+		Vec3 center;
+		float radius;
+		ComputeSliceSphere(view, fovY, aspect, splits[i], splits[i + 1], center, radius);
+
+		cascade.splitNear = splits[i];
+		cascade.splitFar = splits[i + 1];
+		cascade.cached = i >= _settings.firstCachedCascade;
+
+		if (!cascade.cached)
+		{
+			FitCascade(cascade, center, radius, direction);
+			cascade.staticDirty = true;
+		}
+		else if (lightMoved || cascade.radius == 0.0f || Length(center - cascade.center) + radius > cascade.radius)
+		{
+			// The slice has left the padded sphere, refit with a fresh margin
+			FitCascade(cascade, center, radius * (1.0f + _settings.cacheMargin), direction);
+			cascade.staticDirty = true;
+		}
+		else
+		{
+			cascade.staticDirty = false;
+		}
+
+		if (cascade.staticDirty)
+			_stats.cascadesUpdated++;
+		else
+			_stats.cascadesReused++;
+	}
+}
+
+void CascadedShadowMaps::RecordDraws(uint32_t staticDrawCount, uint32_t dynamicDrawCount)
+{
+	_stats.staticDrawsIssued = 0;
+	_stats.staticDrawsSaved = 0;
+	_stats.dynamicDraws = 0;
+
+	for (uint32_t i = 0; i < _settings.cascadeCount; i++)
+	{
+		if (_cascades[i].staticDirty)
+			_stats.staticDrawsIssued += staticDrawCount;
+		else
+			_stats.staticDrawsSaved += staticDrawCount;
+
+		_stats.dynamicDraws += dynamicDrawCount;
+	}
+
+	_stats.totalStaticDrawsSaved += _stats.staticDrawsSaved;
+}
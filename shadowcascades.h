@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include "cpumath.h"
+
+const uint32_t MaxShadowCascades = 4;
+
+struct ShadowCascade
+{
+	Mat4  view;
+	Mat4  projection;
+	Mat4  viewProjection;
+	float splitNear;
+	float splitFar;
+
+	// Bounding sphere the projection was fitted to, cached cascades are fitted with extra
+	// margin so the camera can move inside it before the static casters need redrawing
+	Vec3  center;
+	float radius;
+
+	bool  cached;       // static casters are kept between frames
+	bool  staticDirty;  // static casters have to be redrawn this frame
+};
+
+struct ShadowSettings
+{
+	uint32_t cascadeCount;
+	uint32_t resolution;
+	uint32_t firstCachedCascade;  // cascades from this index on cache their static casters
+	float    shadowDistance;
+	float    splitLambda;         // 0 = linear splits, 1 = logarithmic
+	float    cacheMargin;         // extra radius given to cached cascades, fraction of radius
+	float    lightAngleThreshold; // radians the light can turn before caches are dropped
+	float    casterExtent;        // how far behind a cascade casters are still captured
+
+	ShadowSettings() : cascadeCount(4), resolution(2048), firstCachedCascade(2), shadowDistance(60.0f),
+		splitLambda(0.75f), cacheMargin(0.25f), lightAngleThreshold(0.01f), casterExtent(50.0f) {}
+};
+
+struct ShadowStats
+{
+	uint32_t cascadesUpdated;     // cascades whose static casters were redrawn this frame
+	uint32_t cascadesReused;      // cascades served from the static cache this frame
+	uint32_t staticDrawsIssued;
+	uint32_t staticDrawsSaved;
+	uint32_t dynamicDraws;
+	uint64_t totalStaticDrawsSaved;
+};
+
+//--------------------------------------------------------------------------------------
+// Cascaded shadow map fitting and cache bookkeeping for one directional light. Near
+// cascades are redrawn every frame, far cascades keep their static casters until the
+// light turns or the camera leaves the padded sphere the cascade was fitted to. Dynamic
+// casters are drawn on top of the cached depth every frame by the renderer.
+//--------------------------------------------------------------------------------------
+class CascadedShadowMaps
+{
+private:
+	ShadowSettings _settings;
+	ShadowCascade  _cascades[MaxShadowCascades];
+	Vec3           _cachedLightDirection;
+	bool           _cacheValid;
+	ShadowStats    _stats;
+
+private:
+	void FitCascade(ShadowCascade& cascade, const Vec3& center, float radius, const Vec3& lightDirection) const;
+
+public:
+	CascadedShadowMaps();
+
+	void Init(const ShadowSettings& settings);
+
+	// Practical split scheme, blends logarithmic and linear distribution by lambda
+	static void ComputeSplits(float nearZ, float farZ, uint32_t count, float lambda, float* pSplits);
+
+	// Bounding sphere of the part of the view frustum between splitNear and splitFar
+	static void ComputeSliceSphere(const Mat4& view, float fovY, float aspect, float splitNear, float splitFar,
+								   Vec3& center, float& radius);
+
+	// Refits the cascades for this frame. lightDirection is the direction the light travels.
+	void Update(const Mat4& view, float fovY, float aspect, float nearZ, const Vec3& lightDirection);
+
+	// Drops every cached cascade, e.g. after static geometry changed
+	void Invalidate() { _cacheValid = false; }
+
+	// Feeds the draw counts of this frame back into the stats
+	void RecordDraws(uint32_t staticDrawCount, uint32_t dynamicDrawCount);
+
+	const ShadowCascade& GetCascade(uint32_t index) const { return _cascades[index]; }
+	const ShadowSettings& GetSettings() const { return _settings; }
+	const ShadowStats& GetStats() const { return _stats; }
+};
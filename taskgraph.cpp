@@ -0,0 +1,247 @@
+#include "taskgraph.h"
+
+#include <cstdio>
+#include <cstring>
+
+TaskGraph::TaskGraph()
+{
+	Reset();
+}
+
+void TaskGraph::Reset()
+{
+	_taskCount = 0;
+	_readyAnyHead = 0;
+	_readyAnyTail = 0;
+	_readyMainHead = 0;
+	_readyMainTail = 0;
+	_finishedCount = 0;
+	_failedTask = InvalidTask;
+	_result = 0;
+	_serial = false;
+	_totalMs = 0.0;
+}
+
+uint32_t TaskGraph::AddTask(const char* name, TaskFunc func, void* pData, TaskAffinity affinity)
+{
+	if (_taskCount == MaxTasks)
+		return InvalidTask;
+
+	Task& task = _tasks[_taskCount];
+	task.name = name;
+	task.func = func;
+	task.pData = pData;
+	task.affinity = affinity;
+	task.dependencyCount = 0;
+	task.remaining = 0;
+
+	return _taskCount++;
+}
+
+bool TaskGraph::AddDependency(uint32_t task, uint32_t dependsOn)
+{
+	if (task >= _taskCount || dependsOn >= task)
+		return false;
+
+	Task& t = _tasks[task];
+
+	if (t.dependencyCount == MaxTaskDependencies)
+		return false;
+
+	t.dependencies[t.dependencyCount++] = dependsOn;
+
+	return true;
+}
+
+double TaskGraph::ElapsedMs() const
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - _start).count();
+}
+
+void TaskGraph::PushReady(uint32_t task)
+{
+	if (_tasks[task].affinity == TASK_MAIN_THREAD)
+		_readyMain[_readyMainTail++] = task;
+	else
+		_readyAny[_readyAnyTail++] = task;
+}
+
+void TaskGraph::RunTask(uint32_t task)
+{
+	TaskTiming& timing = _timings[task];
+	timing.threadIndex = JobSystem::GetThreadIndex();
+	timing.startMs = ElapsedMs();
+	timing.result = _tasks[task].func(_tasks[task].pData);
+	timing.endMs = ElapsedMs();
+	timing.ran = true;
+}
+
+void TaskGraph::Drain(bool mainThread)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	for (;;)
+	{
+		_changed.wait(lock, [&]()
+		{
+			return _failedTask != InvalidTask || _finishedCount == _taskCount || _readyAnyHead != _readyAnyTail ||
+				(mainThread && _readyMainHead != _readyMainTail);
+		});
+
+		if (_failedTask != InvalidTask || _finishedCount == _taskCount)
+			return;
+
+		// The main thread clears its own queue first, nobody else can
+		uint32_t task;
+
+		if (mainThread && _readyMainHead != _readyMainTail)
+			task = _readyMain[_readyMainHead++];
+		else
+			task = _readyAny[_readyAnyHead++];
+
+		lock.unlock();
+		RunTask(task);
+		lock.lock();
+
+		_finishedCount++;
+
+		if (_timings[task].result < 0)
+		{
+			if (_failedTask == InvalidTask)
+			{
+				_failedTask = task;
+				_result = _timings[task].result;
+			}
+		}
+		else
+		{
+			// Dependents are always later in the array
+			for (uint32_t i = task + 1; i < _taskCount; i++)
+			{
+				Task& dependent = _tasks[i];
+
+				for (uint32_t d = 0; d < dependent.dependencyCount; d++)
+				{
+					if (dependent.dependencies[d] == task && --dependent.remaining == 0)
+						PushReady(i);
+				}
+			}
+		}
+
+		_changed.notify_all();
+	}
+}
+
+void TaskGraph::DrainWorkers(void* pData, uint32_t, uint32_t)
+{
+	TaskGraph* pGraph = static_cast<TaskGraph*>(pData);
+
+	// With no workers the whole batch runs inline on the calling thread
+	pGraph->Drain(JobSystem::GetThreadIndex() == 0);
+}
+
+TaskResult TaskGraph::Run(JobSystem* pJobSystem, bool serial)
+{
+	_readyAnyHead = _readyAnyTail = 0;
+	_readyMainHead = _readyMainTail = 0;
+	_finishedCount = 0;
+	_failedTask = InvalidTask;
+	_result = 0;
+	_serial = serial;
+
+	memset(_timings, 0, sizeof(_timings));
+
+	_start = std::chrono::high_resolution_clock::now();
+
+	if (serial || pJobSystem == nullptr)
+	{
+		for (uint32_t i = 0; i < _taskCount; i++)
+		{
+			RunTask(i);
+			_finishedCount++;
+
+			if (_timings[i].result < 0)
+			{
+				_failedTask = i;
+				_result = _timings[i].result;
+				break;
+			}
+		}
+	}
+	else
+	{
+		for (uint32_t i = 0; i < _taskCount; i++)
+		{
+			_tasks[i].remaining = _tasks[i].dependencyCount;
+
+			if (_tasks[i].remaining == 0)
+				PushReady(i);
+		}
+
+		// One drain loop per worker, the calling thread runs its own next to them
+		pJobSystem->Dispatch(pJobSystem->GetWorkerCount(), 1, &TaskGraph::DrainWorkers, this);
+		Drain(true);
+		pJobSystem->Wait();
+	}
+
+	_totalMs = ElapsedMs();
+
+	return _result;
+}
+
+size_t TaskGraph::FormatTimeline(char* buffer, size_t size) const
+{
+	const int barWidth = 48;
+	size_t length = 0;
+
+	if (size == 0)
+		return 0;
+
+	buffer[0] = '\0';
+
+	int written = snprintf(buffer, size, "%s run, %u tasks, %.2f ms\n", _serial ? "Serial" : "Parallel", _taskCount, _totalMs);
+
+	if (written < 0)
+		return 0;
+
+	length = (size_t)written < size ? (size_t)written : size - 1;
+
+	for (uint32_t i = 0; i < _taskCount && length + 1 < size; i++)
+	{
+		const TaskTiming& timing = _timings[i];
+
+		char bar[barWidth + 1];
+		memset(bar, '.', barWidth);
+		bar[barWidth] = '\0';
+
+		if (timing.ran && _totalMs > 0.0)
+		{
+			int first = (int)(timing.startMs / _totalMs * barWidth);
+			int last = (int)(timing.endMs / _totalMs * barWidth);
+
+			if (first >= barWidth) first = barWidth - 1;
+			if (last >= barWidth) last = barWidth - 1;
+
+			for (int c = first; c <= last; c++)
+				bar[c] = '#';
+		}
+
+		if (timing.ran)
+		{
+			written = snprintf(buffer + length, size - length, "  %-20s T%-2u %8.2f %8.2f %8.2f ms  |%s|%s\n",
+							   _tasks[i].name, timing.threadIndex, timing.startMs, timing.endMs, timing.endMs - timing.startMs,
+							   bar, timing.result < 0 ? " FAILED" : "");
+		}
+		else
+		{
+			written = snprintf(buffer + length, size - length, "  %-20s not run\n", _tasks[i].name);
+		}
+
+		if (written < 0)
+			break;
+
+		length += (size_t)written < size - length ? (size_t)written : size - length - 1;
+	}
+
+	return length;
+}
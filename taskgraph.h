@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "jobsystem.h"
+
+// Task results follow HRESULT rules, negative is a failure, so HRESULT functions can be
+// used as tasks directly
+typedef long TaskResult;
+typedef TaskResult (*TaskFunc)(void* pData);
+
+const uint32_t MaxTasks = 64;
+const uint32_t MaxTaskDependencies = 16;
+const uint32_t InvalidTask = 0xFFFFFFFF;
+
+enum TaskAffinity
+{
+	TASK_ANY_THREAD,
+	TASK_MAIN_THREAD,   // only ever run by the thread that called Run, e.g. window owning calls
+};
+
+struct TaskTiming
+{
+	double     startMs;     // relative to the start of Run
+	double     endMs;
+	uint32_t   threadIndex; // JobSystem thread index, 0 is the thread that called Run
+	TaskResult result;
+	bool       ran;
+};
+
+//--------------------------------------------------------------------------------------
+// One-shot graph of tasks with dependencies, used for startup. Ready tasks are pulled by
+// the calling thread and every job system worker, the first failing task stops anything
+// new from being started and its result is returned from Run. Every task records when and
+// where it ran so the whole run can be printed as a timeline.
+//--------------------------------------------------------------------------------------
+class TaskGraph
+{
+private:
+	struct Task
+	{
+		const char*  name;
+		TaskFunc     func;
+		void*        pData;
+		TaskAffinity affinity;
+		uint32_t     dependencies[MaxTaskDependencies];
+		uint32_t     dependencyCount;
+		uint32_t     remaining;
+	};
+
+	Task       _tasks[MaxTasks];
+	TaskTiming _timings[MaxTasks];
+	uint32_t   _taskCount;
+
+	// Ready queues, every task is pushed at most once so plain arrays are enough
+	uint32_t   _readyAny[MaxTasks];
+	uint32_t   _readyAnyHead;
+	uint32_t   _readyAnyTail;
+	uint32_t   _readyMain[MaxTasks];
+	uint32_t   _readyMainHead;
+	uint32_t   _readyMainTail;
+
+	std::mutex              _mutex;
+	std::condition_variable _changed;
+	uint32_t                _finishedCount;
+	uint32_t                _failedTask;
+	TaskResult              _result;
+	bool                    _serial;
+	double                  _totalMs;
+
+	std::chrono::high_resolution_clock::time_point _start;
+
+private:
+	double ElapsedMs() const;
+	void PushReady(uint32_t task);
+	void RunTask(uint32_t task);
+	void Drain(bool mainThread);
+
+	static void DrainWorkers(void* pData, uint32_t begin, uint32_t end);
+
+public:
+	TaskGraph();
+
+	TaskGraph(const TaskGraph&) = delete;
+	TaskGraph& operator=(const TaskGraph&) = delete;
+
+	void Reset();
+
+	// name has to stay valid for as long as the graph is used. Returns InvalidTask when full.
+	uint32_t AddTask(const char* name, TaskFunc func, void* pData, TaskAffinity affinity = TASK_ANY_THREAD);
+
+	// Tasks can only depend on tasks added before them, which keeps the graph acyclic and
+	// makes the order they were added in a valid serial order
+	bool AddDependency(uint32_t task, uint32_t dependsOn);
+
+	// Runs every task and returns the first failure, or 0. serial runs the tasks one after
+	// the other in the order they were added, on the calling thread.
+	TaskResult Run(JobSystem* pJobSystem, bool serial = false);
+
+	// Writes one line per task with a bar showing when it ran. Returns the length written.
+	size_t FormatTimeline(char* buffer, size_t size) const;
+
+	uint32_t GetTaskCount() const { return _taskCount; }
+	const char* GetTaskName(uint32_t task) const { return _tasks[task].name; }
+	const TaskTiming& GetTiming(uint32_t task) const { return _timings[task]; }
+	uint32_t GetFailedTask() const { return _failedTask; }
+	double GetTotalMs() const { return _totalMs; }
+	bool WasSerial() const { return _serial; }
+};
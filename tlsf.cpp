@@ -0,0 +1,459 @@
+#include "tlsf.h"
+
+#if defined(_WIN32)
+#include <intrin.h>
+#endif
+
+static uint32_t HighestBit(uint32_t value)
+{
+#if defined(_WIN32)
+	unsigned long index;
+	_BitScanReverse(&index, value);
+	return index;
+#else
+	return 31 - __builtin_clz(value);
+#endif
+}
+
+static uint32_t LowestBit(uint32_t value)
+{
+#if defined(_WIN32)
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return index;
+#else
+	return __builtin_ctz(value);
+#endif
+}
+
+TlsfAllocator::TlsfAllocator()
+{
+	Init(0);
+}
+
+void TlsfAllocator::Init(uint32_t capacity)
+{
+	_blocks.clear();
+
+	for (uint32_t i = 0; i < FirstLevelCount; i++)
+	{
+		for (uint32_t j = 0; j < SecondLevelCount; j++)
+			_freeLists[i][j] = TlsfInvalidBlock;
+
+		_secondLevelMaps[i] = 0;
+	}
+
+	_firstLevelMap = 0;
+	_unusedNodes = TlsfInvalidBlock;
+	_firstBlock = TlsfInvalidBlock;
+	_lastBlock = TlsfInvalidBlock;
+	_capacity = 0;
+	_used = 0;
+	_usedBlocks = 0;
+
+	Grow(capacity);
+}
+
+// Sizes under SecondLevelCount get a class each, above that every power of two is split
+// into SecondLevelCount equal classes
+void TlsfAllocator::Mapping(uint32_t size, uint32_t& firstLevel, uint32_t& secondLevel)
+{
+	if (size < SecondLevelCount)
+	{
+		firstLevel = 0;
+		secondLevel = size;
+		return;
+	}
+
+	uint32_t bit = HighestBit(size);
+	firstLevel = bit - SecondLevelLog2 + 1;
+	secondLevel = (size >> (bit - SecondLevelLog2)) - SecondLevelCount;
+}
+
+uint32_t TlsfAllocator::NewNode()
+{
+	uint32_t node = _unusedNodes;
+
+	if (node != TlsfInvalidBlock)
+	{
+		_unusedNodes = _blocks[node].nextFree;
+	}
+	else
+	{
+		node = (uint32_t)_blocks.size();
+		_blocks.push_back(Block());
+	}
+
+	Block& block = _blocks[node];
+	block.offset = 0;
+	block.size = 0;
+	block.prevPhysical = TlsfInvalidBlock;
+	block.nextPhysical = TlsfInvalidBlock;
+	block.prevFree = TlsfInvalidBlock;
+	block.nextFree = TlsfInvalidBlock;
+	block.free = false;
+	block.live = true;
+
+	return node;
+}
+
+void TlsfAllocator::DeleteNode(uint32_t node)
+{
+	_blocks[node].live = false;
+	_blocks[node].nextFree = _unusedNodes;
+	_unusedNodes = node;
+}
+
+void TlsfAllocator::InsertFree(uint32_t block)
+{
+	uint32_t firstLevel, secondLevel;
+	Mapping(_blocks[block].size, firstLevel, secondLevel);
+
+	uint32_t head = _freeLists[firstLevel][secondLevel];
+
+	_blocks[block].free = true;
+	_blocks[block].prevFree = TlsfInvalidBlock;
+	_blocks[block].nextFree = head;
+
+	if (head != TlsfInvalidBlock)
+		_blocks[head].prevFree = block;
+
+	_freeLists[firstLevel][secondLevel] = block;
+	_secondLevelMaps[firstLevel] |= 1u << secondLevel;
+	_firstLevelMap |= 1u << firstLevel;
+}
+
+void TlsfAllocator::RemoveFree(uint32_t block)
+{
+	uint32_t firstLevel, secondLevel;
+	Mapping(_blocks[block].size, firstLevel, secondLevel);
+
+	uint32_t prev = _blocks[block].prevFree;
+	uint32_t next = _blocks[block].nextFree;
+
+	if (prev != TlsfInvalidBlock)
+		_blocks[prev].nextFree = next;
+	else
+		_freeLists[firstLevel][secondLevel] = next;
+
+	if (next != TlsfInvalidBlock)
+		_blocks[next].prevFree = prev;
+
+	if (_freeLists[firstLevel][secondLevel] == TlsfInvalidBlock)
+	{
+		_secondLevelMaps[firstLevel] &= ~(1u << secondLevel);
+
+		if (_secondLevelMaps[firstLevel] == 0)
+			_firstLevelMap &= ~(1u << firstLevel);
+	}
+
+	_blocks[block].free = false;
+}
+
+uint32_t TlsfAllocator::FindFree(uint32_t size) const
+{
+	uint32_t exactFirstLevel, exactSecondLevel;
+	Mapping(size, exactFirstLevel, exactSecondLevel);
+
+	// Up to the next class boundary so whatever heads the list found is big enough
+	uint64_t rounded = size;
+
+	if (size >= SecondLevelCount)
+		rounded += (1u << (HighestBit(size) - SecondLevelLog2)) - 1;
+
+	if (rounded <= 0xFFFFFFFFu)
+	{
+		uint32_t firstLevel, secondLevel;
+		Mapping((uint32_t)rounded, firstLevel, secondLevel);
+
+		uint32_t secondLevelMap = _secondLevelMaps[firstLevel] & (~0u << secondLevel);
+
+		if (secondLevelMap == 0)
+		{
+			uint32_t firstLevelMap = firstLevel + 1 < 32 ? _firstLevelMap & (~0u << (firstLevel + 1)) : 0;
+
+			if (firstLevelMap != 0)
+			{
+				firstLevel = LowestBit(firstLevelMap);
+				secondLevelMap = _secondLevelMaps[firstLevel];
+			}
+		}
+
+		if (secondLevelMap != 0)
+			return _freeLists[firstLevel][LowestBit(secondLevelMap)];
+	}
+
+	// Nothing in the larger classes, a block in the request's own class may still fit.
+	// This is what lets the last free block be taken whole.
+	for (uint32_t block = _freeLists[exactFirstLevel][exactSecondLevel]; block != TlsfInvalidBlock; block = _blocks[block].nextFree)
+	{
+		if (_blocks[block].size >= size)
+			return block;
+	}
+
+	return TlsfInvalidBlock;
+}
+
+// block takes over next, which directly follows it
+void TlsfAllocator::Merge(uint32_t block, uint32_t next)
+{
+	uint32_t after = _blocks[next].nextPhysical;
+
+	_blocks[block].size += _blocks[next].size;
+	_blocks[block].nextPhysical = after;
+
+	if (after != TlsfInvalidBlock)
+		_blocks[after].prevPhysical = block;
+	else
+		_lastBlock = block;
+
+	DeleteNode(next);
+}
+
+void TlsfAllocator::Grow(uint32_t capacity)
+{
+	if (capacity <= _capacity)
+		return;
+
+	uint32_t extra = capacity - _capacity;
+
+	if (_lastBlock != TlsfInvalidBlock && _blocks[_lastBlock].free)
+	{
+		RemoveFree(_lastBlock);
+		_blocks[_lastBlock].size += extra;
+		InsertFree(_lastBlock);
+	}
+	else
+	{
+		uint32_t block = NewNode();
+		_blocks[block].offset = _capacity;
+		_blocks[block].size = extra;
+		_blocks[block].prevPhysical = _lastBlock;
+
+		if (_lastBlock != TlsfInvalidBlock)
+			_blocks[_lastBlock].nextPhysical = block;
+		else
+			_firstBlock = block;
+
+		_lastBlock = block;
+		InsertFree(block);
+	}
+
+	_capacity = capacity;
+}
+
+uint32_t TlsfAllocator::Alloc(uint32_t size)
+{
+	if (size == 0)
+		return TlsfInvalidBlock;
+
+	uint32_t block = FindFree(size);
+
+	if (block == TlsfInvalidBlock)
+		return TlsfInvalidBlock;
+
+	RemoveFree(block);
+
+	// The rest goes back as its own free block, NewNode can move _blocks so no references
+	if (_blocks[block].size > size)
+	{
+		uint32_t rest = NewNode();
+		uint32_t next = _blocks[block].nextPhysical;
+
+		_blocks[rest].offset = _blocks[block].offset + size;
+		_blocks[rest].size = _blocks[block].size - size;
+		_blocks[rest].prevPhysical = block;
+		_blocks[rest].nextPhysical = next;
+
+		if (next != TlsfInvalidBlock)
+			_blocks[next].prevPhysical = rest;
+		else
+			_lastBlock = rest;
+
+		_blocks[block].nextPhysical = rest;
+		_blocks[block].size = size;
+
+		InsertFree(rest);
+	}
+
+	_used += size;
+	_usedBlocks++;
+
+	return block;
+}
+
+void TlsfAllocator::Free(uint32_t block)
+{
+	if (block == TlsfInvalidBlock)
+		return;
+
+	_used -= _blocks[block].size;
+	_usedBlocks--;
+
+	uint32_t next = _blocks[block].nextPhysical;
+
+	if (next != TlsfInvalidBlock && _blocks[next].free)
+	{
+		RemoveFree(next);
+		Merge(block, next);
+	}
+
+	uint32_t prev = _blocks[block].prevPhysical;
+
+	if (prev != TlsfInvalidBlock && _blocks[prev].free)
+	{
+		RemoveFree(prev);
+		Merge(prev, block);
+		block = prev;
+	}
+
+	InsertFree(block);
+}
+
+uint32_t TlsfAllocator::Defragment(uint32_t maxMoves, std::vector<TlsfMove>& moves)
+{
+	moves.clear();
+
+	uint32_t block = _firstBlock;
+
+	while (block != TlsfInvalidBlock && moves.size() < maxMoves)
+	{
+		if (!_blocks[block].free)
+		{
+			block = _blocks[block].nextPhysical;
+			continue;
+		}
+
+		// Free neighbours are always merged, so whatever follows a free block is used
+		uint32_t used = _blocks[block].nextPhysical;
+
+		if (used == TlsfInvalidBlock)
+			break;
+
+		RemoveFree(block);
+
+		TlsfMove move = { used, _blocks[used].offset, _blocks[block].offset, _blocks[used].size };
+		moves.push_back(move);
+
+		// Swap the two: the used block takes the free one's offset and the gap moves past it
+		uint32_t prev = _blocks[block].prevPhysical;
+		uint32_t after = _blocks[used].nextPhysical;
+
+		_blocks[used].offset = move.to;
+		_blocks[used].prevPhysical = prev;
+		_blocks[used].nextPhysical = block;
+		_blocks[block].offset = move.to + move.size;
+		_blocks[block].prevPhysical = used;
+		_blocks[block].nextPhysical = after;
+
+		if (prev != TlsfInvalidBlock)
+			_blocks[prev].nextPhysical = used;
+		else
+			_firstBlock = used;
+
+		if (after != TlsfInvalidBlock)
+			_blocks[after].prevPhysical = block;
+		else
+			_lastBlock = block;
+
+		if (after != TlsfInvalidBlock && _blocks[after].free)
+		{
+			RemoveFree(after);
+			Merge(block, after);
+		}
+
+		InsertFree(block);
+	}
+
+	return (uint32_t)moves.size();
+}
+
+TlsfStats TlsfAllocator::GetStats() const
+{
+	TlsfStats stats;
+	stats.capacity = _capacity;
+	stats.used = _used;
+	stats.usedBlocks = _usedBlocks;
+	stats.freeBlocks = 0;
+	stats.largestFree = 0;
+
+	for (uint32_t block = _firstBlock; block != TlsfInvalidBlock; block = _blocks[block].nextPhysical)
+	{
+		if (!_blocks[block].free)
+			continue;
+
+		stats.freeBlocks++;
+
+		if (_blocks[block].size > stats.largestFree)
+			stats.largestFree = _blocks[block].size;
+	}
+
+	uint32_t totalFree = _capacity - _used;
+	stats.fragmentation = totalFree > 0 ? 1.0f - (float)stats.largestFree / totalFree : 0.0f;
+
+	return stats;
+}
+
+bool TlsfAllocator::Validate() const
+{
+	// Physical order: contiguous from zero, linked both ways, no two free blocks together
+	uint32_t offset = 0;
+	uint32_t used = 0;
+	uint32_t usedBlocks = 0;
+	uint32_t freeBlocks = 0;
+	uint32_t prev = TlsfInvalidBlock;
+
+	for (uint32_t block = _firstBlock; block != TlsfInvalidBlock; block = _blocks[block].nextPhysical)
+	{
+		const Block& b = _blocks[block];
+
+		if (!b.live || b.size == 0 || b.offset != offset || b.prevPhysical != prev)
+			return false;
+
+		if (b.free && prev != TlsfInvalidBlock && _blocks[prev].free)
+			return false;
+
+		offset += b.size;
+		used += b.free ? 0 : b.size;
+		usedBlocks += b.free ? 0 : 1;
+		freeBlocks += b.free ? 1 : 0;
+		prev = block;
+	}
+
+	if (offset != _capacity || prev != _lastBlock || used != _used || usedBlocks != _usedBlocks)
+		return false;
+
+	// Size class lists: every free block in the list its size maps to, bitmaps set exactly
+	// for the lists that have something in them
+	uint32_t listed = 0;
+
+	for (uint32_t i = 0; i < FirstLevelCount; i++)
+	{
+		for (uint32_t j = 0; j < SecondLevelCount; j++)
+		{
+			bool empty = _freeLists[i][j] == TlsfInvalidBlock;
+
+			if (empty == ((_secondLevelMaps[i] >> j) & 1))
+				return false;
+
+			uint32_t prevFree = TlsfInvalidBlock;
+
+			for (uint32_t block = _freeLists[i][j]; block != TlsfInvalidBlock; block = _blocks[block].nextFree)
+			{
+				uint32_t firstLevel, secondLevel;
+				Mapping(_blocks[block].size, firstLevel, secondLevel);
+
+				if (!_blocks[block].live || !_blocks[block].free || _blocks[block].prevFree != prevFree || firstLevel != i || secondLevel != j)
+					return false;
+
+				prevFree = block;
+				listed++;
+			}
+		}
+
+		if ((_secondLevelMaps[i] == 0) == ((_firstLevelMap >> i) & 1))
+			return false;
+	}
+
+	return listed == freeBlocks;
+}
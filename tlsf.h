@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+const uint32_t TlsfInvalidBlock = 0xFFFFFFFF;
+
+// One used block slid down by Defragment, the caller copies size units from -> to.
+// The ranges may overlap, to is always lower.
+struct TlsfMove
+{
+	uint32_t block;
+	uint32_t from;
+	uint32_t to;
+	uint32_t size;
+};
+
+struct TlsfStats
+{
+	uint32_t capacity;
+	uint32_t used;
+	uint32_t usedBlocks;
+	uint32_t freeBlocks;
+	uint32_t largestFree;
+	float    fragmentation;  // 1 - largest free / total free, 0 when the free space is one range
+};
+
+//--------------------------------------------------------------------------------------
+// Two level segregated fit allocator over an abstract range of units, for carving up GPU
+// buffers that can't hold their own bookkeeping. Free blocks sit in lists by size class,
+// 16 linear classes per power of two, found through two bitmaps so Alloc and Free are
+// O(1). Requests are rounded up to the next class so any block in the chosen list fits,
+// the request's own class is only searched when nothing bigger is free. Blocks are
+// handles into a node array that stay valid while the block lives, including when
+// Defragment slides it to a lower offset.
+//--------------------------------------------------------------------------------------
+class TlsfAllocator
+{
+private:
+	static const uint32_t SecondLevelLog2 = 4;
+	static const uint32_t SecondLevelCount = 1 << SecondLevelLog2;
+	static const uint32_t FirstLevelCount = 32 - SecondLevelLog2 + 1;
+
+	struct Block
+	{
+		uint32_t offset;
+		uint32_t size;
+		uint32_t prevPhysical;  // neighbours by offset
+		uint32_t nextPhysical;
+		uint32_t prevFree;      // neighbours in the size class list, or the next unused node
+		uint32_t nextFree;
+		bool     free;
+		bool     live;          // false while the node is waiting to be reused
+	};
+
+	std::vector<Block> _blocks;
+	uint32_t           _freeLists[FirstLevelCount][SecondLevelCount];
+	uint32_t           _secondLevelMaps[FirstLevelCount];
+	uint32_t           _firstLevelMap;
+	uint32_t           _unusedNodes;
+	uint32_t           _firstBlock;
+	uint32_t           _lastBlock;
+	uint32_t           _capacity;
+	uint32_t           _used;
+	uint32_t           _usedBlocks;
+
+private:
+	static void Mapping(uint32_t size, uint32_t& firstLevel, uint32_t& secondLevel);
+
+	uint32_t NewNode();
+	void DeleteNode(uint32_t node);
+	void InsertFree(uint32_t block);
+	void RemoveFree(uint32_t block);
+	uint32_t FindFree(uint32_t size) const;
+	void Merge(uint32_t block, uint32_t next);
+
+public:
+	TlsfAllocator();
+
+	void Init(uint32_t capacity);
+
+	// Adds space at the end, existing blocks don't move
+	void Grow(uint32_t capacity);
+
+	// Returns TlsfInvalidBlock when no free block is big enough
+	uint32_t Alloc(uint32_t size);
+	void Free(uint32_t block);
+
+	// Slides used blocks down over the free space in front of them, lowest first, until the
+	// free space is one range at the end or maxMoves blocks have moved. Returns the moves.
+	uint32_t Defragment(uint32_t maxMoves, std::vector<TlsfMove>& moves);
+
+	uint32_t GetOffset(uint32_t block) const { return _blocks[block].offset; }
+	uint32_t GetSize(uint32_t block) const { return _blocks[block].size; }
+	uint32_t GetCapacity() const { return _capacity; }
+	uint32_t GetUsed() const { return _used; }
+
+	TlsfStats GetStats() const;
+
+	// Walks every list and checks they agree with each other, for the tests
+	bool Validate() const;
+};
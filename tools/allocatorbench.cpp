@@ -0,0 +1,555 @@
+//--------------------------------------------------------------------------------------
+// Allocator checks and benchmark. The checks cover LinearArena alignment, markers and
+// tag accounting, FrameArena keeping the previous frame's memory alive, ScratchScope
+// nesting and per thread arenas, and PoolAllocator slot reuse. A run of simulated frames
+// then has to make no heap calls at all, counted by wrapping malloc itself on glibc so
+// stray new and malloc show up too. The benchmark times each allocator against malloc.
+//
+//   g++ -std=c++17 -O2 -pthread allocatorbench.cpp ../allocators.cpp ../memorytracker.cpp
+//
+//   allocatorbench [allocations]     default 1000000, exit code 1 if a check fails
+//--------------------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "../allocators.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Milliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+//--------------------------------------------------------------------------------------
+// Every heap call in the process while s_countHeap is set. Only switched on while a
+// single thread runs, so the count needs no atomics and the benchmark pays nothing.
+//--------------------------------------------------------------------------------------
+static bool   s_countHeap = false;
+static size_t s_heapCalls = 0;
+
+#if defined(__GLIBC__)
+#define HEAP_CALLS_COUNTED 1
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+extern "C" void  __libc_free(void* ptr);
+
+static inline void CountHeapCall()
+{
+	if (s_countHeap)
+		s_heapCalls++;
+}
+
+extern "C" void* malloc(size_t size) noexcept
+{
+	CountHeapCall();
+	return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) noexcept
+{
+	CountHeapCall();
+	return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) noexcept
+{
+	CountHeapCall();
+	return __libc_realloc(ptr, size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size) noexcept
+{
+	CountHeapCall();
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** ptr, size_t alignment, size_t size) noexcept
+{
+	CountHeapCall();
+	*ptr = __libc_memalign(alignment, size);
+	return *ptr != nullptr ? 0 : ENOMEM;
+}
+
+extern "C" void free(void* ptr) noexcept
+{
+	if (ptr != nullptr)
+		CountHeapCall();
+
+	__libc_free(ptr);
+}
+#else
+#define HEAP_CALLS_COUNTED 0
+#endif
+
+static uint32_t s_random = 12345;
+
+static uint32_t RandomUint()
+{
+	s_random = s_random * 1664525u + 1013904223u;
+	return s_random >> 8;
+}
+
+static bool s_failed = false;
+
+static void Check(bool ok, const char* what)
+{
+	printf("  %-4s %s\n", ok ? "ok" : "FAIL", what);
+	s_failed |= !ok;
+}
+
+static bool IsAligned(const void* ptr, size_t alignment)
+{
+	return (reinterpret_cast<uintptr_t>(ptr) & (alignment - 1)) == 0;
+}
+
+// Counts constructions and destructions so the pool can be checked for both
+struct PoolObject
+{
+	static int s_live;
+
+	uint64_t id;
+	float    values[6];
+
+	PoolObject() : id(0) { s_live++; }
+	explicit PoolObject(uint64_t objectId) : id(objectId) { s_live++; }
+	~PoolObject() { s_live--; }
+};
+
+int PoolObject::s_live = 0;
+
+// What a frame of the renderer asks for: a visible list, per object constants, a sort
+// key scratch buffer and a few scene objects coming and going
+struct FrameObjectConstants
+{
+	alignas(16) float world[16];
+	float params[4];
+};
+
+static uint64_t SimulateFrame(FrameArena& frameArena, PoolAllocator<PoolObject>& pool, std::vector<PoolObject*>& objects, uint32_t objectCount)
+{
+	frameArena.BeginFrame();
+
+	uint32_t* visible = frameArena.AllocArray<uint32_t>(objectCount, MEMTAG_RENDER);
+	FrameObjectConstants* constants = frameArena.AllocArray<FrameObjectConstants>(objectCount, MEMTAG_RENDER);
+	uint64_t sum = 0;
+
+	if (visible == nullptr || constants == nullptr)
+		return 0;
+
+	for (uint32_t i = 0; i < objectCount; i++)
+	{
+		visible[i] = i;
+		constants[i].world[0] = (float)i;
+	}
+
+	{
+		ScratchScope scratch;
+		uint64_t* keys = scratch.AllocArray<uint64_t>(objectCount);
+
+		for (uint32_t i = 0; keys != nullptr && i < objectCount; i++)
+		{
+			keys[i] = ((uint64_t)RandomUint() << 32) | visible[i];
+			sum += keys[i] & 0xFFFF;
+		}
+	}
+
+	// A couple of objects replaced every frame
+	for (uint32_t i = 0; i < 2 && !objects.empty(); i++)
+	{
+		size_t index = RandomUint() % objects.size();
+		pool.Delete(objects[index]);
+		objects[index] = pool.New(sum + i);
+	}
+
+	return sum;
+}
+
+static void RunChecks()
+{
+	printf("checks\n");
+
+	// LinearArena hands out aligned, non overlapping memory and stops at the capacity
+	{
+		LinearArena arena;
+		arena.Init(64 * 1024, MEMTAG_GENERAL);
+
+		bool aligned = true;
+		uint8_t* previousEnd = nullptr;
+		bool ordered = true;
+
+		for (size_t alignment = 1; alignment <= 4096; alignment *= 2)
+		{
+			uint8_t* ptr = static_cast<uint8_t*>(arena.Alloc(3, alignment, MEMTAG_GENERAL));
+			aligned &= ptr != nullptr && IsAligned(ptr, alignment);
+			ordered &= previousEnd == nullptr || ptr >= previousEnd;
+			previousEnd = ptr + 3;
+		}
+
+		Check(aligned, "alignments from 1 to 4096, above the block's own 64");
+		Check(ordered, "allocations don't overlap");
+
+		arena.Reset();
+		Check(arena.Alloc(64 * 1024, 16, MEMTAG_GENERAL) != nullptr && arena.Alloc(1, 1, MEMTAG_GENERAL) == nullptr,
+			  "fills exactly, then returns nullptr");
+
+		size_t peak = arena.GetPeak();
+		arena.Reset();
+		Check(arena.GetUsed() == 0 && peak == 64 * 1024 && arena.GetPeak() == peak, "reset keeps the peak");
+	}
+
+	// Markers take the offset and the tag bytes back, including in the global tracker
+	{
+		LinearArena arena;
+		arena.Init(4096, MEMTAG_GENERAL);
+
+		size_t liveBefore = MemoryTracker::GetLiveBytes(MEMTAG_SCENE);
+		arena.Alloc(100, 16, MEMTAG_RENDER);
+		ArenaMarker marker = arena.GetMarker();
+		arena.Alloc(200, 16, MEMTAG_SCENE);
+		arena.Alloc(300, 16, MEMTAG_RENDER);
+
+		Check(arena.GetTagBytes(MEMTAG_SCENE) == 200 && arena.GetTagBytes(MEMTAG_RENDER) == 400 &&
+			  MemoryTracker::GetLiveBytes(MEMTAG_SCENE) == liveBefore + 200, "bytes counted per tag");
+
+		arena.Rewind(marker);
+		Check(arena.GetUsed() == marker.offset && arena.GetTagBytes(MEMTAG_SCENE) == 0 && arena.GetTagBytes(MEMTAG_RENDER) == 100 &&
+			  MemoryTracker::GetLiveBytes(MEMTAG_SCENE) == liveBefore, "rewind gives the bytes back");
+
+		arena.Shutdown();
+		Check(MemoryTracker::GetLiveBytes(MEMTAG_RENDER) == 0 && MemoryTracker::GetHeapBytes(MEMTAG_GENERAL) == 0,
+			  "shutdown leaves nothing tracked");
+	}
+
+	// The previous frame's memory survives one BeginFrame and is reused by the next
+	{
+		FrameArena frameArena;
+		frameArena.Init(4096);
+
+		frameArena.BeginFrame();
+		uint32_t* first = frameArena.AllocArray<uint32_t>(256);
+
+		for (uint32_t i = 0; i < 256; i++)
+			first[i] = i * 7;
+
+		frameArena.BeginFrame();
+		uint32_t* second = frameArena.AllocArray<uint32_t>(256);
+
+		for (uint32_t i = 0; i < 256; i++)
+			second[i] = 0xFFFFFFFF;
+
+		bool intact = true;
+
+		for (uint32_t i = 0; i < 256; i++)
+			intact &= first[i] == i * 7;
+
+		Check(intact && first != second, "frame N is intact while frame N + 1 is built");
+
+		frameArena.BeginFrame();
+		uint32_t* third = frameArena.AllocArray<uint32_t>(256);
+		Check(third == first, "frame N + 2 reuses frame N's half");
+
+		frameArena.Shutdown();
+		Check(MemoryTracker::GetHeapBytes(MEMTAG_FRAME) == 0 && MemoryTracker::GetLiveBytes(MEMTAG_FRAME) == 0, "frame arena shutdown");
+	}
+
+	// Scratch scopes nest and every thread has its own arena
+	{
+		LinearArena& arena = ScratchArena::Get();
+		size_t before = arena.GetUsed();
+
+		{
+			ScratchScope outer;
+			outer.Alloc(1000);
+			size_t afterOuter = arena.GetUsed();
+
+			{
+				ScratchScope inner;
+				inner.Alloc(5000);
+			}
+
+			Check(arena.GetUsed() == afterOuter, "inner scope gives its memory back");
+		}
+
+		Check(arena.GetUsed() == before, "outer scope gives its memory back");
+
+		LinearArena* pOther = nullptr;
+		std::thread thread([&]() { pOther = &ScratchArena::Get(); ScratchScope scope; scope.Alloc(64); });
+		thread.join();
+
+		Check(pOther != nullptr && pOther != &arena, "threads get their own scratch arena");
+	}
+
+	// Pools run constructors and destructors and reuse the last freed slot
+	{
+		PoolAllocator<PoolObject> pool;
+		pool.Init(8, MEMTAG_SCENE);
+
+		PoolObject* objects[8];
+
+		for (int i = 0; i < 8; i++)
+			objects[i] = pool.New((uint64_t)i);
+
+		bool constructed = PoolObject::s_live == 8 && pool.GetLiveCount() == 8;
+
+		for (int i = 0; i < 8; i++)
+			constructed &= objects[i] != nullptr && objects[i]->id == (uint64_t)i && pool.Owns(objects[i]) && IsAligned(objects[i], alignof(PoolObject));
+
+		Check(constructed, "constructs in place up to the capacity");
+		Check(pool.New() == nullptr, "returns nullptr when full");
+
+		pool.Delete(objects[3]);
+		Check(PoolObject::s_live == 7 && pool.New((uint64_t)99) == objects[3] && objects[3]->id == 99, "reuses the freed slot");
+
+		PoolObject outside;
+		Check(!pool.Owns(&outside), "doesn't own objects from elsewhere");
+		Check(MemoryTracker::GetLiveBytes(MEMTAG_SCENE) == 8 * sizeof(PoolObject), "live objects tracked");
+
+		for (int i = 0; i < 8; i++)
+			pool.Delete(objects[i]);
+
+		pool.Shutdown();
+		Check(PoolObject::s_live == 1 && MemoryTracker::GetLiveBytes(MEMTAG_SCENE) == 0 && MemoryTracker::GetHeapBytes(MEMTAG_SCENE) == 0,
+			  "everything destroyed and untracked");
+	}
+
+	// Steady state frames shouldn't touch the heap once everything is warmed up
+	{
+		FrameArena frameArena;
+		frameArena.Init(1024 * 1024);
+
+		PoolAllocator<PoolObject> pool;
+		pool.Init(1024, MEMTAG_SCENE);
+
+		std::vector<PoolObject*> objects;
+
+		for (uint32_t i = 0; i < 512; i++)
+			objects.push_back(pool.New((uint64_t)i));
+
+		// The first frames create the thread's scratch arena
+		uint64_t sum = 0;
+
+		for (uint32_t i = 0; i < 4; i++)
+			sum += SimulateFrame(frameArena, pool, objects, 2000);
+
+		// Make sure the counter sees an ordinary new and delete before trusting a zero
+		if (HEAP_CALLS_COUNTED)
+		{
+			s_heapCalls = 0;
+			s_countHeap = true;
+			PoolObject* volatile pObject = new PoolObject();
+			delete pObject;
+			s_countHeap = false;
+
+			Check(s_heapCalls == 2, "heap counter sees new and delete");
+		}
+
+		size_t trackedBefore = MemoryTracker::GetHeapCallCount();
+		s_heapCalls = 0;
+		s_countHeap = true;
+
+		for (uint32_t i = 0; i < 1000; i++)
+			sum += SimulateFrame(frameArena, pool, objects, 2000);
+
+		s_countHeap = false;
+		size_t tracked = MemoryTracker::GetHeapCallCount() - trackedBefore;
+
+		char what[128];
+
+		if (HEAP_CALLS_COUNTED)
+			snprintf(what, sizeof(what), "1000 frames, %zu heap calls, %zu through the tracker (sum %llu)", s_heapCalls, tracked,
+					 (unsigned long long)sum);
+		else
+			snprintf(what, sizeof(what), "1000 frames, %zu tracked heap calls, malloc not counted here", tracked);
+
+		Check(s_heapCalls == 0 && tracked == 0, what);
+
+		for (PoolObject* object : objects)
+			pool.Delete(object);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Benchmarks, each against the same pattern through malloc
+//--------------------------------------------------------------------------------------
+static volatile uint64_t s_sink = 0;
+
+static void RunBenchmark(uint32_t allocations)
+{
+	const uint32_t perFrame = 1000;
+	uint32_t frames = std::max(allocations / perFrame, 1u);
+
+	std::vector<uint32_t> sizes(perFrame);
+
+	for (uint32_t& size : sizes)
+		size = 16 + RandomUint() % 241;
+
+	printf("\n%u frames of %u allocations, 16 to 256 bytes\n", frames, perFrame);
+
+	// Frame arena against malloc and freeing everything at the end of the frame
+	{
+		FrameArena frameArena;
+		frameArena.Init(1024 * 1024);
+
+		Clock::time_point start = Clock::now();
+
+		for (uint32_t frame = 0; frame < frames; frame++)
+		{
+			frameArena.BeginFrame();
+
+			for (uint32_t i = 0; i < perFrame; i++)
+			{
+				uint8_t* ptr = static_cast<uint8_t*>(frameArena.Alloc(sizes[i]));
+				ptr[0] = (uint8_t)i;
+				s_sink += ptr[0];
+			}
+		}
+
+		double arenaMs = Milliseconds(start);
+
+		std::vector<void*> blocks(perFrame);
+		start = Clock::now();
+
+		for (uint32_t frame = 0; frame < frames; frame++)
+		{
+			for (uint32_t i = 0; i < perFrame; i++)
+			{
+				uint8_t* ptr = static_cast<uint8_t*>(malloc(sizes[i]));
+				ptr[0] = (uint8_t)i;
+				s_sink += ptr[0];
+				blocks[i] = ptr;
+			}
+
+			for (uint32_t i = 0; i < perFrame; i++)
+				free(blocks[i]);
+		}
+
+		double mallocMs = Milliseconds(start);
+		double count = (double)frames * perFrame;
+
+		printf("  %-24s %8.2f ns/alloc\n", "frame arena", arenaMs * 1e6 / count);
+		printf("  %-24s %8.2f ns/alloc  (%.1fx)\n", "malloc + free", mallocMs * 1e6 / count, mallocMs / std::max(arenaMs, 1e-6));
+	}
+
+	// Short lived temporaries inside a function
+	{
+		ScratchArena::Get();
+
+		Clock::time_point start = Clock::now();
+
+		for (uint32_t frame = 0; frame < frames; frame++)
+		{
+			for (uint32_t i = 0; i < perFrame; i += 4)
+			{
+				ScratchScope scratch;
+				uint32_t* values = scratch.AllocArray<uint32_t>(sizes[i] / 4);
+				values[0] = i;
+				s_sink += values[0];
+			}
+		}
+
+		double scratchMs = Milliseconds(start);
+		start = Clock::now();
+
+		for (uint32_t frame = 0; frame < frames; frame++)
+		{
+			for (uint32_t i = 0; i < perFrame; i += 4)
+			{
+				uint32_t* values = static_cast<uint32_t*>(calloc(sizes[i] / 4, sizeof(uint32_t)));
+				values[0] = i;
+				s_sink += values[0];
+				free(values);
+			}
+		}
+
+		double mallocMs = Milliseconds(start);
+		double count = (double)frames * (perFrame / 4);
+
+		printf("  %-24s %8.2f ns/scope\n", "scratch scope", scratchMs * 1e6 / count);
+		printf("  %-24s %8.2f ns/scope  (%.1fx)\n", "calloc + free", mallocMs * 1e6 / count, mallocMs / std::max(scratchMs, 1e-6));
+	}
+
+	// Objects churning in and out of a scene that stays around half full
+	{
+		const uint32_t capacity = 4096;
+
+		PoolAllocator<PoolObject> pool;
+		pool.Init(capacity, MEMTAG_SCENE);
+
+		std::vector<PoolObject*> live;
+		live.reserve(capacity);
+
+		s_random = 777;
+		Clock::time_point start = Clock::now();
+
+		for (uint32_t i = 0; i < allocations; i++)
+		{
+			if (live.size() < capacity / 2 || (live.size() < capacity && (RandomUint() & 1)))
+			{
+				live.push_back(pool.New((uint64_t)i));
+			}
+			else
+			{
+				size_t index = RandomUint() % live.size();
+				s_sink += live[index]->id;
+				pool.Delete(live[index]);
+				live[index] = live.back();
+				live.pop_back();
+			}
+		}
+
+		double poolMs = Milliseconds(start);
+
+		for (PoolObject* object : live)
+			pool.Delete(object);
+
+		live.clear();
+		s_random = 777;
+		start = Clock::now();
+
+		for (uint32_t i = 0; i < allocations; i++)
+		{
+			if (live.size() < capacity / 2 || (live.size() < capacity && (RandomUint() & 1)))
+			{
+				live.push_back(new PoolObject((uint64_t)i));
+			}
+			else
+			{
+				size_t index = RandomUint() % live.size();
+				s_sink += live[index]->id;
+				delete live[index];
+				live[index] = live.back();
+				live.pop_back();
+			}
+		}
+
+		double newMs = Milliseconds(start);
+
+		for (PoolObject* object : live)
+			delete object;
+
+		printf("  %-24s %8.2f ns/op\n", "pool allocator", poolMs * 1e6 / allocations);
+		printf("  %-24s %8.2f ns/op  (%.1fx)\n", "new + delete", newMs * 1e6 / allocations, newMs / std::max(poolMs, 1e-6));
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t allocations = argc > 1 ? (uint32_t)atoi(argv[1]) : 1000000;
+
+	RunChecks();
+	RunBenchmark(allocations);
+
+	printf("%s\n", s_failed ? "FAILED" : "all passed");
+
+	return s_failed ? 1 : 0;
+}
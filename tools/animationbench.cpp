@@ -0,0 +1,384 @@
+//--------------------------------------------------------------------------------------
+// Animation benchmark. Builds a 64 bone creature with a few procedural clips, compresses
+// them and reports the size against the raw keys and the worst model space error. Then
+// times sampling on one thread, sampling and blending many characters on every core, and
+// CPU skinning, which is checked against a scalar version.
+//
+//   g++ -std=c++17 -O2 animationbench.cpp ../animation.cpp ../jobsystem.cpp -lpthread
+//
+//   animationbench [characters] [vertices]
+//--------------------------------------------------------------------------------------
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../animation.h"
+#include "../jobsystem.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Milliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void AxisAngle(const Vec3& axis, float angle, float rotation[4])
+{
+	Vec3 unit = Normalize(axis);
+	float s = sinf(angle * 0.5f);
+	rotation[0] = unit.x * s;
+	rotation[1] = unit.y * s;
+	rotation[2] = unit.z * s;
+	rotation[3] = cosf(angle * 0.5f);
+}
+
+// A spine of 16 bones with four legs of 12 hanging off it, bones 0.1 long
+static void BuildSkeleton(Skeleton& skeleton)
+{
+	skeleton.parents.clear();
+	skeleton.bindPose.clear();
+
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		BoneTransform bone;
+		bone.translation = i == 0 ? Vec3(0.0f, 1.0f, 0.0f) : Vec3(0.0f, 0.0f, 0.1f);
+		skeleton.parents.push_back(i == 0 ? NoParentBone : (uint16_t)(i - 1));
+		skeleton.bindPose.push_back(bone);
+	}
+
+	const uint16_t hips[4] = { 3, 3, 12, 12 };
+
+	for (uint32_t leg = 0; leg < 4; leg++)
+	{
+		for (uint32_t i = 0; i < 12; i++)
+		{
+			BoneTransform bone;
+			bone.translation = i == 0 ? Vec3(leg & 1 ? 0.15f : -0.15f, 0.0f, 0.0f) : Vec3(0.0f, -0.08f, 0.0f);
+			skeleton.parents.push_back(i == 0 ? hips[leg] : (uint16_t)(skeleton.parents.size() - 1));
+			skeleton.bindPose.push_back(bone);
+		}
+	}
+
+	skeleton.ComputeInverseBind();
+}
+
+// Spine waves, legs swing with a phase per leg, the feet (last four bones of each leg)
+// are held still and the root moves forward. speed changes the character of the clip.
+static void BuildClip(const Skeleton& skeleton, float speed, float seconds, RawClip& clip)
+{
+	clip.boneCount = skeleton.GetBoneCount();
+	clip.sampleRate = 30.0f;
+	clip.frameCount = (uint32_t)(seconds * clip.sampleRate) + 1;
+	clip.keys.resize(clip.boneCount * clip.frameCount);
+
+	for (uint32_t f = 0; f < clip.frameCount; f++)
+	{
+		float t = f / clip.sampleRate;
+
+		for (uint32_t b = 0; b < clip.boneCount; b++)
+		{
+			BoneTransform bone = skeleton.bindPose[b];
+
+			if (b == 0)
+			{
+				bone.translation.z += t * speed;
+				bone.translation.y += 0.05f * sinf(t * speed * 6.0f);
+			}
+
+			if (b < 16)
+			{
+				AxisAngle(Vec3(0.0f, 1.0f, 0.0f), 0.15f * sinf(t * speed * 3.0f + b * 0.4f), bone.rotation);
+			}
+			else
+			{
+				uint32_t leg = (b - 16) / 12, joint = (b - 16) % 12;
+				float swing = joint < 8 ? 0.3f * sinf(t * speed * 6.0f + leg * 1.57f) / (1.0f + joint) : 0.0f;
+				AxisAngle(Vec3(1.0f, 0.0f, 0.0f), swing, bone.rotation);
+			}
+
+			clip.keys[f * clip.boneCount + b] = bone;
+		}
+	}
+}
+
+// Scalar sampling of the raw keys, what the compressed clip should match
+static void SampleRaw(const RawClip& clip, float time, Pose& pose)
+{
+	float lastFrame = (float)(clip.frameCount - 1);
+	float frame = fmodf(time * clip.sampleRate, lastFrame);
+	uint32_t f0 = (uint32_t)frame;
+	uint32_t f1 = f0 + 1 < clip.frameCount ? f0 + 1 : f0;
+	float t = frame - f0;
+
+	pose.boneCount = clip.boneCount;
+
+	for (uint32_t b = 0; b < clip.boneCount; b++)
+	{
+		const BoneTransform& a = clip.keys[f0 * clip.boneCount + b];
+		const BoneTransform& c = clip.keys[f1 * clip.boneCount + b];
+		float dot = a.rotation[0] * c.rotation[0] + a.rotation[1] * c.rotation[1] + a.rotation[2] * c.rotation[2] + a.rotation[3] * c.rotation[3];
+		float sign = dot < 0.0f ? -1.0f : 1.0f;
+		float q[4], lengthSq = 0.0f;
+
+		for (int k = 0; k < 4; k++)
+		{
+			q[k] = a.rotation[k] + (c.rotation[k] * sign - a.rotation[k]) * t;
+			lengthSq += q[k] * q[k];
+		}
+
+		for (int k = 0; k < 4; k++)
+			pose.values[POSE_ROTATION_X + k][b] = q[k] / sqrtf(lengthSq);
+
+		Vec3 translation = a.translation + (c.translation - a.translation) * t;
+		Vec3 scale = a.scale + (c.scale - a.scale) * t;
+		pose.values[POSE_TRANSLATION_X][b] = translation.x;
+		pose.values[POSE_TRANSLATION_Y][b] = translation.y;
+		pose.values[POSE_TRANSLATION_Z][b] = translation.z;
+		pose.values[POSE_SCALE_X][b] = scale.x;
+		pose.values[POSE_SCALE_Y][b] = scale.y;
+		pose.values[POSE_SCALE_Z][b] = scale.z;
+	}
+
+	for (uint32_t b = clip.boneCount; b < MaxSkinBones; b++)
+	{
+		for (int k = 0; k < POSE_CHANNEL_COUNT; k++)
+			pose.values[k][b] = (k == POSE_ROTATION_W || k >= POSE_SCALE_X) ? 1.0f : 0.0f;
+	}
+}
+
+static Vec3 ApplySkin(const SkinMatrix& m, const Vec3& p)
+{
+	return Vec3(m.rows[0][0] * p.x + m.rows[0][1] * p.y + m.rows[0][2] * p.z + m.rows[0][3],
+				m.rows[1][0] * p.x + m.rows[1][1] * p.y + m.rows[1][2] * p.z + m.rows[1][3],
+				m.rows[2][0] * p.x + m.rows[2][1] * p.y + m.rows[2][2] * p.z + m.rows[2][3]);
+}
+
+// Largest distance between where the bones end up with the raw and compressed clip
+static float ClipError(const Skeleton& skeleton, const RawClip& raw, const CompressedClip& compressed)
+{
+	std::vector<Vec3> bindPositions(skeleton.GetBoneCount());
+
+	for (uint32_t b = 0; b < skeleton.GetBoneCount(); b++)
+	{
+		Mat4 bind = Inverse(skeleton.inverseBind[b]);
+		bindPositions[b] = Vec3(bind.m[3][0], bind.m[3][1], bind.m[3][2]);
+	}
+
+	SkinMatrix expected[MaxSkinBones], actual[MaxSkinBones];
+	Pose pose;
+	float worst = 0.0f;
+
+	for (float time = 0.0f; time < raw.GetDuration(); time += 0.0123f)
+	{
+		SampleRaw(raw, time, pose);
+		ComputeSkinMatrices(skeleton, pose, expected);
+		compressed.Sample(time, true, pose);
+		ComputeSkinMatrices(skeleton, pose, actual);
+
+		for (uint32_t b = 0; b < skeleton.GetBoneCount(); b++)
+		{
+			Vec3 delta = ApplySkin(expected[b], bindPositions[b]) - ApplySkin(actual[b], bindPositions[b]);
+			worst = fmaxf(worst, Length(delta));
+		}
+	}
+
+	return worst;
+}
+
+// Influences of a vertex near a random bone, the rest of the weight on its parent
+static void BuildVertices(const Skeleton& skeleton, uint32_t count, std::vector<SkinnedVertex>& vertices)
+{
+	uint32_t random = 12345;
+	vertices.resize(count);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		SkinnedVertex& v = vertices[i];
+
+		for (int k = 0; k < 3; k++)
+		{
+			random = random * 1664525u + 1013904223u;
+			v.position[k] = (random >> 8) / 16777216.0f * 2.0f - 1.0f;
+			v.normal[k] = k == 1 ? 1.0f : 0.0f;
+		}
+
+		v.texCoord[0] = v.position[0];
+		v.texCoord[1] = v.position[2];
+
+		random = random * 1664525u + 1013904223u;
+		uint16_t bone = (uint16_t)((random >> 8) % skeleton.GetBoneCount());
+		uint16_t parent = skeleton.parents[bone] == NoParentBone ? bone : skeleton.parents[bone];
+		uint8_t weight = (uint8_t)(128 + (random >> 28) * 8);
+
+		v.bones[0] = (uint8_t)bone;
+		v.bones[1] = (uint8_t)parent;
+		v.bones[2] = 0;
+		v.bones[3] = 0;
+		v.weights[0] = weight;
+		v.weights[1] = (uint8_t)(255 - weight);
+		v.weights[2] = 0;
+		v.weights[3] = 0;
+	}
+}
+
+static bool CheckSkinning(const std::vector<SkinnedVertex>& vertices, const SkinMatrix* pMatrices, const std::vector<SkinnedVertexOutput>& output)
+{
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const SkinnedVertex& v = vertices[i];
+		Vec3 position, normal;
+
+		for (int k = 0; k < 4; k++)
+		{
+			const SkinMatrix& m = pMatrices[v.bones[k]];
+			float w = v.weights[k] / 255.0f;
+			Vec3 p(v.position[0], v.position[1], v.position[2]);
+			Vec3 n(v.normal[0], v.normal[1], v.normal[2]);
+
+			position += ApplySkin(m, p) * w;
+			normal += Vec3(m.rows[0][0] * n.x + m.rows[0][1] * n.y + m.rows[0][2] * n.z,
+						   m.rows[1][0] * n.x + m.rows[1][1] * n.y + m.rows[1][2] * n.z,
+						   m.rows[2][0] * n.x + m.rows[2][1] * n.y + m.rows[2][2] * n.z) * w;
+		}
+
+		normal = Normalize(normal);
+		const SkinnedVertexOutput& o = output[i];
+
+		if (Length(position - Vec3(o.position[0], o.position[1], o.position[2])) > 1e-4f ||
+			Length(normal - Vec3(o.normal[0], o.normal[1], o.normal[2])) > 1e-4f)
+		{
+			printf("FAILED skinning vertex %zu: (%f %f %f), expected (%f %f %f)\n", i, o.position[0], o.position[1], o.position[2],
+				   position.x, position.y, position.z);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t characters = argc > 1 ? (uint32_t)atoi(argv[1]) : 2000;
+	uint32_t vertexCount = argc > 2 ? (uint32_t)atoi(argv[2]) : 200000;
+
+	JobSystem jobSystem;
+	jobSystem.Init();
+
+	Skeleton skeleton;
+	BuildSkeleton(skeleton);
+
+	const float speeds[3] = { 1.0f, 2.0f, 4.0f };
+	const char* names[3] = { "walk", "trot", "run" };
+	RawClip raw[3];
+	CompressedClip clips[3];
+	ClipCompressionSettings settings;
+	size_t rawBytes = 0, compressedBytes = 0;
+
+	for (int i = 0; i < 3; i++)
+	{
+		BuildClip(skeleton, speeds[i], 4.0f, raw[i]);
+
+		auto start = Clock::now();
+		if (!clips[i].Compress(raw[i], settings, &skeleton))
+		{
+			printf("FAILED to compress %s\n", names[i]);
+			return 1;
+		}
+		double compressMs = Milliseconds(start);
+
+		size_t rawSize = raw[i].keys.size() * sizeof(float) * 10;
+		float error = ClipError(skeleton, raw[i], clips[i]);
+		rawBytes += rawSize;
+		compressedBytes += clips[i].GetMemorySize();
+
+		printf("%-5s %u bones x %u frames: %zu bytes raw, %zu compressed (%.1f:1), %u keys of %u, %.2f ms to compress, worst error %.3f mm\n",
+			   names[i], raw[i].boneCount, raw[i].frameCount, rawSize, clips[i].GetMemorySize(), (double)rawSize / clips[i].GetMemorySize(),
+			   clips[i].GetKeyCount(), raw[i].boneCount * raw[i].frameCount * 3, compressMs, error * 1000.0f);
+
+		if (error > 0.002f)
+		{
+			printf("FAILED %s: error above 2 mm\n", names[i]);
+			return 1;
+		}
+	}
+
+	printf("all clips: %.1f:1\n", (double)rawBytes / compressedBytes);
+
+	// Sampling alone, one thread
+	Pose pose;
+	uint32_t samples = 20000;
+	float sink = 0.0f;
+	auto sampleStart = Clock::now();
+
+	for (uint32_t i = 0; i < samples; i++)
+	{
+		clips[i % 3].Sample(i * 0.0137f, true, pose);
+		sink += pose.values[POSE_ROTATION_W][i % MaxSkinBones];
+	}
+
+	double sampleMs = Milliseconds(sampleStart);
+	printf("\nsample: %.0f bones/ms on 1 thread (%.2f us per 64 bone pose)\n", samples * 64.0 / sampleMs, sampleMs * 1000.0 / samples);
+
+	// Characters blending two clips each, sampled, blended and turned into skinning matrices
+	AnimationSystem animation;
+	animation.Init(&skeleton, characters);
+
+	for (uint32_t i = 0; i < characters; i++)
+	{
+		AnimationInstance& instance = animation.GetInstance(i);
+		instance.pClips[0] = &clips[i % 3];
+		instance.pClips[1] = &clips[(i + 1) % 3];
+		instance.blend = (i % 7) / 7.0f;
+	}
+
+	double serialMs = 0.0, parallelMs = 0.0;
+	uint64_t serialBones = 0, parallelBones = 0;
+	int frames = 40;
+
+	for (int frame = 0; frame < frames; frame++)
+	{
+		for (uint32_t i = 0; i < characters; i++)
+		{
+			AnimationInstance& instance = animation.GetInstance(i);
+			instance.times[0] = frame / 60.0f + i * 0.01f;
+			instance.times[1] = instance.times[0] * 1.3f;
+		}
+
+		bool parallel = (frame & 1) != 0;
+		animation.Update(parallel ? &jobSystem : nullptr);
+		(parallel ? parallelMs : serialMs) += animation.GetStats().updateMs;
+		(parallel ? parallelBones : serialBones) += animation.GetStats().sampledBones;
+	}
+
+	printf("%u characters: 1 thread %.2f ms, %.0f sampled bones/ms   %u threads %.2f ms, %.0f sampled bones/ms\n", characters,
+		   serialMs / (frames / 2), serialBones / serialMs, jobSystem.GetThreadCount(), parallelMs / (frames / 2), parallelBones / parallelMs);
+
+	// CPU skinning fallback
+	std::vector<SkinnedVertex> vertices;
+	std::vector<SkinnedVertexOutput> output(vertexCount);
+	BuildVertices(skeleton, vertexCount, vertices);
+
+	const SkinMatrix* pMatrices = animation.GetSkinMatrices(0);
+	SkinVertices(vertices.data(), vertexCount, pMatrices, output.data(), nullptr);
+
+	if (!CheckSkinning(vertices, pMatrices, output))
+		return 1;
+
+	auto skinStart = Clock::now();
+	for (int i = 0; i < 10; i++)
+		SkinVertices(vertices.data(), vertexCount, pMatrices, output.data(), nullptr);
+	double skinSerialMs = Milliseconds(skinStart) / 10;
+
+	skinStart = Clock::now();
+	for (int i = 0; i < 10; i++)
+		SkinVertices(vertices.data(), vertexCount, pMatrices, output.data(), &jobSystem);
+	double skinParallelMs = Milliseconds(skinStart) / 10;
+
+	printf("skinning %u vertices: 1 thread %.2f ms (%.0f vertices/ms)   %u threads %.2f ms\n", vertexCount, skinSerialMs,
+		   vertexCount / skinSerialMs, jobSystem.GetThreadCount(), skinParallelMs);
+
+	jobSystem.Shutdown();
+
+	return sink == 12345.0f ? 2 : 0;
+}
@@ -0,0 +1,904 @@
+//--------------------------------------------------------------------------------------
+// Incremental asset cooker. Reads a manifest of textures, scenes and shaders, builds the
+// graph source -> intermediate -> cooked and only rebuilds what changed, across all
+// cores. Results are kept in a local cache keyed by content, so switching back to an
+// older source or setting is a cache hit too. Prints the time of every step and the
+// cache hit rate.
+//
+//   g++ -std=c++17 -O2 -msse2 assetcooker.cpp cookgraph.cpp texturecompress.cpp textureimage.cpp
+//       ../scene.cpp ../scenecompiler.cpp ../jobsystem.cpp -lpthread
+//
+//   assetcooker [--manifest assets.txt] [--force] [--threads N] [--quiet]
+//   assetcooker bench [textures]     cold, warm and partial rebuilds of a generated set
+//
+// Manifest lines, paths relative to the manifest, '#' starts a comment:
+//
+//   cache .cookcache
+//   compiler fxc /nologo /Ges /T {profile} /E {entry} {defines} /Fo {output} {input}
+//   texture output.dds source.tga [bc1|bc3|bc5|bc7] [normal] [linear] [srgb] [box] [clamp] [nomips]
+//   scene scene.bin scene.txt
+//   shader shaders/PS_TEXTURED.cso framework.fx PS ps_4_0 TEXTURED=1 SPECULAR=0
+//
+// Shaders need the compiler line; {defines} expands to /D NAME=VALUE for each define.
+// Without it they are reported as skipped.
+//--------------------------------------------------------------------------------------
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <vector>
+#include "cookgraph.h"
+#include "textureimage.h"
+#include "../jobsystem.h"
+#include "../scenecompiler.h"
+
+namespace fs = std::filesystem;
+
+// Settings strings are "name key=value key=value"
+static bool GetSetting(const std::string& settings, const char* key, std::string& value)
+{
+	std::string pattern = std::string(" ") + key + "=";
+	size_t start = settings.find(pattern);
+
+	if (start == std::string::npos)
+		return false;
+
+	start += pattern.size();
+	size_t end = settings.find(' ', start);
+	value = settings.substr(start, end == std::string::npos ? std::string::npos : end - start);
+
+	return true;
+}
+
+static int GetSettingInt(const std::string& settings, const char* key)
+{
+	std::string value;
+	return GetSetting(settings, key, value) ? atoi(value.c_str()) : 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Textures: source image -> mip chain -> compressed DDS. The mip chain only depends on
+// the filter settings, so changing the block format reuses it.
+//--------------------------------------------------------------------------------------
+static bool CookMips(CookContext& context, void*)
+{
+	const std::vector<uint8_t>* pSource = context.GetInput(0);
+	Image source;
+
+	if (pSource == nullptr)
+		return context.Fail("can't read %s", context.GetInputName(0).c_str());
+
+	if (!LoadImageFromMemory(*pSource, source))
+		return context.Fail("%s: only TGA and uncompressed 32 bit DDS are supported", context.GetInputName(0).c_str());
+
+	const std::string& settings = context.GetSettings();
+	MipSettings mips;
+	mips.filter = GetSettingInt(settings, "box") ? MIPFILTER_BOX : MIPFILTER_KAISER;
+	mips.wrap = !GetSettingInt(settings, "clamp");
+	mips.srgb = !GetSettingInt(settings, "linear");
+	mips.normalMap = GetSettingInt(settings, "normal") != 0;
+	mips.maxLevels = (uint32_t)GetSettingInt(settings, "levels");
+
+	// Steps already run in parallel, nested jobs would only run inline
+	std::vector<Image> levels;
+	GenerateMips(source, mips, nullptr, levels);
+
+	// Level count, then each level's size and texels
+	std::vector<uint8_t>& output = context.GetOutput();
+	uint32_t count = (uint32_t)levels.size();
+	output.insert(output.end(), (uint8_t*)&count, (uint8_t*)&count + 4);
+
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		uint32_t size[2] = { levels[i].width, levels[i].height };
+		output.insert(output.end(), (uint8_t*)size, (uint8_t*)size + 8);
+		output.insert(output.end(), levels[i].texels.begin(), levels[i].texels.end());
+	}
+
+	return true;
+}
+
+static bool ReadMips(const std::vector<uint8_t>& data, std::vector<Image>& levels)
+{
+	size_t position = 0;
+	uint32_t count;
+
+	if (data.size() < 4)
+		return false;
+
+	memcpy(&count, data.data(), 4);
+	position = 4;
+	levels.resize(count);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t size[2];
+
+		if (position + 8 > data.size())
+			return false;
+
+		memcpy(size, &data[position], 8);
+		position += 8;
+
+		size_t bytes = (size_t)size[0] * size[1] * 4;
+
+		if (position + bytes > data.size())
+			return false;
+
+		levels[i].width = size[0];
+		levels[i].height = size[1];
+		levels[i].texels.assign(data.begin() + position, data.begin() + position + bytes);
+		position += bytes;
+	}
+
+	return count > 0;
+}
+
+static bool CookDDS(CookContext& context, void*)
+{
+	const std::vector<uint8_t>* pMips = context.GetInput(0);
+	std::vector<Image> levels;
+
+	if (pMips == nullptr || !ReadMips(*pMips, levels))
+		return context.Fail("bad mip chain");
+
+	const std::string& settings = context.GetSettings();
+	std::string formatName;
+	GetSetting(settings, "format", formatName);
+
+	BlockFormat format = BLOCK_BC1;
+
+	if (formatName == "bc3") format = BLOCK_BC3;
+	else if (formatName == "bc5") format = BLOCK_BC5;
+	else if (formatName == "bc7") format = BLOCK_BC7;
+	else if (formatName == "auto")
+	{
+		// BC3 when anything isn't opaque, like texturecooker
+		const Image& top = levels[0];
+
+		for (size_t i = 0; i < (size_t)top.width * top.height; i++)
+		{
+			if (top.texels[i * 4 + 3] != 255)
+			{
+				format = BLOCK_BC3;
+				break;
+			}
+		}
+	}
+
+	uint32_t blockBytes = GetBlockBytes(format);
+	std::vector<uint8_t> blocks;
+
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		size_t offset = blocks.size();
+		blocks.resize(offset + (size_t)((levels[i].width + 3) / 4) * ((levels[i].height + 3) / 4) * blockBytes);
+		CompressImage(levels[i].texels.data(), levels[i].width, levels[i].height, format, nullptr, &blocks[offset]);
+	}
+
+	BuildDDS(levels[0].width, levels[0].height, (uint32_t)levels.size(), GetDXGIFormat(format, GetSettingInt(settings, "srgb") != 0),
+			 blocks.data(), blocks.size(), context.GetOutput());
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Scenes: text -> binary, the same compiler the application falls back to
+//--------------------------------------------------------------------------------------
+static bool CookScene(CookContext& context, void*)
+{
+	const std::vector<uint8_t>* pSource = context.GetInput(0);
+
+	if (pSource == nullptr)
+		return context.Fail("can't read %s", context.GetInputName(0).c_str());
+
+	std::string text(pSource->begin(), pSource->end());
+	char error[256];
+
+	if (!CompileScene(text.c_str(), context.GetOutput(), error, sizeof(error)))
+		return context.Fail("%s", error);
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Shaders: source and includes -> one flattened file -> a blob per entry point and set
+// of defines. Every entry point of a file shares the flattening, and each blob only
+// depends on the flattened text, so editing one include rebuilds only what uses it.
+//--------------------------------------------------------------------------------------
+static bool ParseInclude(const std::string& line, std::string& name)
+{
+	size_t start = line.find_first_not_of(" \t");
+
+	if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+		return false;
+
+	size_t open = line.find('"', start + 8);
+	size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+
+	if (close == std::string::npos)
+		return false;
+
+	name = line.substr(open + 1, close - open - 1);
+	return true;
+}
+
+static std::string ResolveInclude(const std::string& fromPath, const std::string& name)
+{
+	return (fs::path(fromPath).parent_path() / name).lexically_normal().generic_string();
+}
+
+// Every file reachable through #include "...", so they can be inputs of the flattening
+static void FindIncludes(const std::string& path, std::set<std::string>& found)
+{
+	FILE* pFile = fopen(path.c_str(), "rb");
+
+	if (pFile == nullptr)
+		return;
+
+	char buffer[1024];
+	std::vector<std::string> includes;
+
+	while (fgets(buffer, sizeof(buffer), pFile))
+	{
+		std::string name;
+
+		if (ParseInclude(buffer, name))
+			includes.push_back(ResolveInclude(path, name));
+	}
+
+	fclose(pFile);
+
+	for (size_t i = 0; i < includes.size(); i++)
+	{
+		if (found.insert(includes[i]).second)
+			FindIncludes(includes[i], found);
+	}
+}
+
+static bool FlattenFile(CookContext& context, uint32_t input, std::string& output, int depth)
+{
+	const std::vector<uint8_t>* pText = context.GetInput(input);
+
+	if (pText == nullptr || depth > 32)
+		return false;
+
+	const std::string& path = context.GetInputName(input);
+	std::string text(pText->begin(), pText->end());
+	size_t position = 0;
+	int lineNumber = 1;
+
+	output += "#line 1 \"" + path + "\"\n";
+
+	while (position < text.size())
+	{
+		size_t end = text.find('\n', position);
+		end = end == std::string::npos ? text.size() : end + 1;
+		std::string line = text.substr(position, end - position);
+		std::string name;
+
+		if (ParseInclude(line, name))
+		{
+			std::string includePath = ResolveInclude(path, name);
+			uint32_t found = 0;
+
+			while (found < context.GetInputCount() && context.GetInputName(found) != includePath)
+				found++;
+
+			if (found == context.GetInputCount() || !FlattenFile(context, found, output, depth + 1))
+				return false;
+
+			char marker[32];
+			snprintf(marker, sizeof(marker), "#line %d \"", lineNumber + 1);
+			output += marker + path + "\"\n";
+		}
+		else
+		{
+			output += line;
+
+			if (line.empty() || line.back() != '\n')
+				output += '\n';
+		}
+
+		position = end;
+		lineNumber++;
+	}
+
+	return true;
+}
+
+static bool CookFlattenedShader(CookContext& context, void*)
+{
+	std::string text;
+
+	if (!FlattenFile(context, 0, text, 0))
+		return context.Fail("can't resolve the includes of %s", context.GetInputName(0).c_str());
+
+	context.GetOutput().assign(text.begin(), text.end());
+	return true;
+}
+
+static void ReplaceAll(std::string& text, const char* pattern, const std::string& value)
+{
+	size_t length = strlen(pattern);
+
+	for (size_t position = text.find(pattern); position != std::string::npos; position = text.find(pattern, position + value.size()))
+		text.replace(position, length, value);
+}
+
+static bool CookShader(CookContext& context, void*)
+{
+	const std::string& settings = context.GetSettings();
+	size_t compilerStart = settings.find(" compiler=");
+	std::string compiler = compilerStart == std::string::npos ? std::string() : settings.substr(compilerStart + 10);
+
+	if (compiler.empty())
+		return context.Skip("no compiler line in the manifest");
+
+	const std::vector<uint8_t>* pText = context.GetInput(0);
+
+	if (pText == nullptr)
+		return context.Fail("can't read the flattened source");
+
+	// Temporary files named after the output, which is unique within a cook
+	std::string stem = (fs::temp_directory_path() / ("cook_" + std::to_string(HashBytes(context.GetName().data(), context.GetName().size())))).string();
+	std::string inputPath = stem + ".hlsl";
+	std::string outputPath = stem + ".cso";
+
+	FILE* pFile = fopen(inputPath.c_str(), "wb");
+
+	if (pFile == nullptr || fwrite(pText->data(), 1, pText->size(), pFile) != pText->size())
+	{
+		if (pFile)
+			fclose(pFile);
+
+		return context.Fail("can't write %s", inputPath.c_str());
+	}
+
+	fclose(pFile);
+
+	std::string entry, profile, defineList, defines;
+	GetSetting(settings, "entry", entry);
+	GetSetting(settings, "profile", profile);
+	GetSetting(settings, "defines", defineList);
+
+	// NAME=VALUE pairs separated by commas
+	for (size_t start = 0; start < defineList.size();)
+	{
+		size_t end = defineList.find(',', start);
+		end = end == std::string::npos ? defineList.size() : end;
+		defines += " /D " + defineList.substr(start, end - start);
+		start = end + 1;
+	}
+
+	std::string command = compiler;
+	ReplaceAll(command, "{profile}", profile);
+	ReplaceAll(command, "{entry}", entry);
+	ReplaceAll(command, "{defines}", defines);
+	ReplaceAll(command, "{input}", "\"" + inputPath + "\"");
+	ReplaceAll(command, "{output}", "\"" + outputPath + "\"");
+
+	int status = system(command.c_str());
+
+	std::vector<uint8_t>& output = context.GetOutput();
+	pFile = status == 0 ? fopen(outputPath.c_str(), "rb") : nullptr;
+
+	if (pFile)
+	{
+		uint8_t buffer[65536];
+		size_t read;
+
+		while ((read = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+			output.insert(output.end(), buffer, buffer + read);
+
+		fclose(pFile);
+	}
+
+	std::error_code error;
+	fs::remove(inputPath, error);
+	fs::remove(outputPath, error);
+
+	if (status != 0 || output.empty())
+		return context.Fail("compiler exited with %d", status);
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Manifest
+//--------------------------------------------------------------------------------------
+struct Manifest
+{
+	std::string cacheDirectory;
+	std::string compiler;
+	uint32_t    assetCount;
+};
+
+static std::vector<std::string> SplitWords(const std::string& line)
+{
+	std::vector<std::string> words;
+	size_t position = 0;
+
+	while (true)
+	{
+		position = line.find_first_not_of(" \t\r\n", position);
+
+		if (position == std::string::npos)
+			break;
+
+		size_t end = line.find_first_of(" \t\r\n", position);
+		words.push_back(line.substr(position, end == std::string::npos ? std::string::npos : end - position));
+		position = end;
+	}
+
+	return words;
+}
+
+static std::string RestOfLine(const std::string& line, size_t wordIndex)
+{
+	size_t position = 0;
+
+	for (size_t i = 0; i <= wordIndex; i++)
+	{
+		position = line.find_first_not_of(" \t", position);
+		position = i < wordIndex ? line.find_first_of(" \t", position) : position;
+	}
+
+	std::string rest = position == std::string::npos ? std::string() : line.substr(position);
+
+	while (!rest.empty() && (rest.back() == '\n' || rest.back() == '\r' || rest.back() == ' '))
+		rest.pop_back();
+
+	return rest;
+}
+
+static bool AddTexture(CookGraph& graph, const std::vector<std::string>& words, const fs::path& root, int lineNumber)
+{
+	std::string format = "auto";
+	int normal = 0, linear = 0, srgb = 0, box = 0, clamp = 0, levels = 0;
+
+	for (size_t i = 3; i < words.size(); i++)
+	{
+		const std::string& word = words[i];
+
+		if (word == "bc1" || word == "bc3" || word == "bc5" || word == "bc7") format = word;
+		else if (word == "normal") { normal = 1; linear = 1; format = "bc5"; }
+		else if (word == "linear") linear = 1;
+		else if (word == "srgb") srgb = 1;
+		else if (word == "box") box = 1;
+		else if (word == "clamp") clamp = 1;
+		else if (word == "nomips") levels = 1;
+		else
+		{
+			fprintf(stderr, "line %d: unknown texture option %s\n", lineNumber, word.c_str());
+			return false;
+		}
+	}
+
+	std::string sourcePath = (root / words[2]).generic_string();
+	std::string outputPath = (root / words[1]).generic_string();
+
+	char settings[256];
+	snprintf(settings, sizeof(settings), "mips box=%d clamp=%d linear=%d normal=%d levels=%d", box, clamp, linear, normal, levels);
+
+	std::vector<uint32_t> inputs(1, graph.AddSource(sourcePath.c_str()));
+	uint32_t mips = graph.AddStep((sourcePath + " mips").c_str(), COOK_INTERMEDIATE, &CookMips, nullptr, settings, inputs);
+
+	snprintf(settings, sizeof(settings), "dds format=%s srgb=%d", format.c_str(), srgb);
+	inputs.assign(1, mips);
+	graph.AddStep(outputPath.c_str(), COOK_OUTPUT, &CookDDS, nullptr, settings, inputs);
+
+	return true;
+}
+
+static bool AddShader(CookGraph& graph, const std::vector<std::string>& words, const fs::path& root, const std::string& compiler,
+					  int lineNumber)
+{
+	if (words.size() < 5)
+	{
+		fprintf(stderr, "line %d: shader needs an output, a source, an entry point and a profile\n", lineNumber);
+		return false;
+	}
+
+	std::string sourcePath = (root / words[2]).generic_string();
+	std::string outputPath = (root / words[1]).generic_string();
+
+	std::set<std::string> includes;
+	FindIncludes(sourcePath, includes);
+
+	std::vector<uint32_t> inputs(1, graph.AddSource(sourcePath.c_str()));
+
+	for (const std::string& include : includes)
+		inputs.push_back(graph.AddSource(include.c_str()));
+
+	uint32_t flattened = graph.AddStep((sourcePath + " flattened").c_str(), COOK_INTERMEDIATE, &CookFlattenedShader, nullptr,
+									   "flatten", inputs);
+
+	// The compiler goes last, it is the rest of the settings
+	std::string settings = "shader entry=" + words[3] + " profile=" + words[4] + " defines=";
+
+	for (size_t i = 5; i < words.size(); i++)
+		settings += (i > 5 ? "," : "") + words[i];
+
+	settings += " compiler=" + compiler;
+
+	inputs.assign(1, flattened);
+	graph.AddStep(outputPath.c_str(), COOK_OUTPUT, &CookShader, nullptr, settings.c_str(), inputs);
+
+	return true;
+}
+
+static bool LoadManifest(const char* path, CookGraph& graph, Manifest& manifest)
+{
+	FILE* pFile = fopen(path, "rb");
+
+	if (pFile == nullptr)
+	{
+		fprintf(stderr, "%s: can't open\n", path);
+		return false;
+	}
+
+	fs::path root = fs::path(path).parent_path();
+	manifest.cacheDirectory = (root / ".cookcache").generic_string();
+	manifest.compiler.clear();
+	manifest.assetCount = 0;
+
+	char buffer[4096];
+	int lineNumber = 0;
+	bool ok = true;
+
+	while (ok && fgets(buffer, sizeof(buffer), pFile))
+	{
+		lineNumber++;
+
+		std::string line = buffer;
+		size_t comment = line.find('#');
+
+		if (comment != std::string::npos)
+			line.resize(comment);
+
+		std::vector<std::string> words = SplitWords(line);
+
+		if (words.empty())
+			continue;
+
+		if (words[0] == "cache" && words.size() == 2)
+		{
+			manifest.cacheDirectory = (root / words[1]).generic_string();
+		}
+		else if (words[0] == "compiler" && words.size() >= 2)
+		{
+			manifest.compiler = RestOfLine(line, 1);
+		}
+		else if (words[0] == "texture" && words.size() >= 3)
+		{
+			ok = AddTexture(graph, words, root, lineNumber);
+			manifest.assetCount++;
+		}
+		else if (words[0] == "scene" && words.size() == 3)
+		{
+			std::vector<uint32_t> inputs(1, graph.AddSource((root / words[2]).generic_string().c_str()));
+			graph.AddStep((root / words[1]).generic_string().c_str(), COOK_OUTPUT, &CookScene, nullptr, "scene", inputs);
+			manifest.assetCount++;
+		}
+		else if (words[0] == "shader")
+		{
+			ok = AddShader(graph, words, root, manifest.compiler, lineNumber);
+			manifest.assetCount++;
+		}
+		else
+		{
+			fprintf(stderr, "%s(%d): can't parse \"%s\"\n", path, lineNumber, words[0].c_str());
+			ok = false;
+		}
+	}
+
+	fclose(pFile);
+
+	return ok;
+}
+
+static const char* ResultName(CookResult result)
+{
+	switch (result)
+	{
+	case COOK_UP_TO_DATE: return "current";
+	case COOK_CACHED:     return "cached";
+	case COOK_BUILT:      return "built";
+	case COOK_SKIPPED:    return "skipped";
+	case COOK_FAILED:     return "FAILED";
+	default:              return "pending";
+	}
+}
+
+static void PrintReport(const CookGraph& graph, uint32_t threads, bool quiet)
+{
+	if (!quiet)
+	{
+		// Slowest first, that's where the time went
+		std::vector<uint32_t> steps;
+
+		for (uint32_t i = 0; i < graph.GetNodeCount(); i++)
+		{
+			if (graph.GetNode(i).kind != COOK_SOURCE)
+				steps.push_back(i);
+		}
+
+		std::sort(steps.begin(), steps.end(), [&](uint32_t a, uint32_t b) { return graph.GetNode(a).ms > graph.GetNode(b).ms; });
+
+		for (size_t i = 0; i < steps.size(); i++)
+		{
+			const CookNode& node = graph.GetNode(steps[i]);
+			printf("%-8s %9.2f ms  %s%s%s\n", ResultName(node.result), node.ms, node.name.c_str(), node.message.empty() ? "" : ": ",
+				   node.message.c_str());
+		}
+	}
+
+	const CookStats& stats = graph.GetStats();
+	uint32_t considered = stats.upToDate + stats.cached + stats.built;
+
+	printf("%u steps: %u current, %u from cache, %u built, %u skipped, %u failed, %.1f%% cache hits\n", stats.steps, stats.upToDate,
+		   stats.cached, stats.built, stats.skipped, stats.failed, considered ? 100.0 * (stats.upToDate + stats.cached) / considered : 100.0);
+	printf("%u sources re-read (%.1f ms), %.1f ms total on %u threads\n", stats.sourcesHashed, stats.hashMs, stats.totalMs, threads);
+}
+
+static bool Cook(const char* manifestPath, JobSystem* pJobSystem, bool force, bool quiet, CookStats* pStats)
+{
+	CookGraph graph;
+	Manifest manifest;
+
+	if (!LoadManifest(manifestPath, graph, manifest))
+		return false;
+
+	if (!graph.OpenCache(manifest.cacheDirectory.c_str()))
+	{
+		fprintf(stderr, "%s: can't open the cache\n", manifest.cacheDirectory.c_str());
+		return false;
+	}
+
+	bool ok = graph.Run(pJobSystem, force);
+
+	if (!graph.SaveCache())
+		fprintf(stderr, "%s: can't save the file stamps\n", manifest.cacheDirectory.c_str());
+
+	PrintReport(graph, pJobSystem ? pJobSystem->GetThreadCount() : 1, quiet);
+
+	if (pStats)
+		*pStats = graph.GetStats();
+
+	return ok;
+}
+
+//--------------------------------------------------------------------------------------
+// Bench: cold, warm and partial rebuilds of generated textures and a scene
+//--------------------------------------------------------------------------------------
+static bool WriteTGA(const std::string& path, uint32_t size, uint32_t seed, bool alpha)
+{
+	std::vector<uint8_t> file(18 + (size_t)size * size * 4);
+	file[2] = 2;  // uncompressed true colour
+	file[12] = (uint8_t)size;
+	file[13] = (uint8_t)(size >> 8);
+	file[14] = (uint8_t)size;
+	file[15] = (uint8_t)(size >> 8);
+	file[16] = 32;
+	file[17] = 0x28;  // top down, 8 bits of alpha
+
+	// Smooth bands plus a little noise, roughly what photos give the encoder
+	uint32_t random = seed * 2654435761u + 1;
+
+	for (uint32_t y = 0; y < size; y++)
+	{
+		for (uint32_t x = 0; x < size; x++)
+		{
+			random = random * 1664525u + 1013904223u;
+			uint8_t* p = &file[18 + ((size_t)y * size + x) * 4];
+			uint32_t noise = (random >> 24) & 15;
+			p[0] = (uint8_t)((x * 255 / size + seed * 37 + noise) & 255);
+			p[1] = (uint8_t)((y * 255 / size + seed * 11 + noise) & 255);
+			p[2] = (uint8_t)(((x + y) * 127 / size + noise) & 255);
+			p[3] = alpha ? (uint8_t)(x * 255 / size) : 255;
+		}
+	}
+
+	FILE* pFile = fopen(path.c_str(), "wb");
+
+	if (pFile == nullptr)
+		return false;
+
+	bool ok = fwrite(file.data(), 1, file.size(), pFile) == file.size();
+	return fclose(pFile) == 0 && ok;
+}
+
+static bool WriteText(const std::string& path, const std::string& text)
+{
+	FILE* pFile = fopen(path.c_str(), "wb");
+
+	if (pFile == nullptr)
+		return false;
+
+	bool ok = fwrite(text.data(), 1, text.size(), pFile) == text.size();
+	return fclose(pFile) == 0 && ok;
+}
+
+static bool Expect(const char* pass, const CookStats& stats, uint32_t built, uint32_t cached, uint32_t upToDate)
+{
+	if (stats.built == built && stats.cached == cached && stats.upToDate == upToDate && stats.failed == 0)
+		return true;
+
+	printf("FAILED %s: expected %u built, %u cached, %u current\n", pass, built, cached, upToDate);
+	return false;
+}
+
+static int Bench(uint32_t textureCount, JobSystem* pJobSystem)
+{
+	fs::path root = fs::temp_directory_path() / "assetcooker_bench";
+	std::error_code error;
+	fs::remove_all(root, error);
+	fs::create_directories(root / "source", error);
+
+	std::string manifest = "cache cache\n";
+
+	for (uint32_t i = 0; i < textureCount; i++)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "source/texture%03u.tga", i);
+
+		if (!WriteTGA((root / name).string(), 256, i, (i % 4) == 0))
+			return 1;
+
+		char line[128];
+		snprintf(line, sizeof(line), "texture cooked/texture%03u.dds %s%s\n", i, name, (i % 8) == 1 ? " bc7" : "");
+		manifest += line;
+	}
+
+	std::string sceneText = "mesh cube\nmaterial cube diffuse 1 1 1 1\nentity player mesh cube material cube\n";
+	WriteText((root / "source/scene.txt").string(), sceneText);
+	manifest += "scene cooked/scene.bin source/scene.txt\n";
+
+	std::string manifestPath = (root / "assets.txt").string();
+	WriteText(manifestPath, manifest);
+
+	uint32_t steps = textureCount * 2 + 1;
+	uint32_t outputs = textureCount + 1;
+	CookStats stats;
+
+	printf("%u textures of 256x256 and a scene, %u steps, %u threads\n", textureCount, steps, pJobSystem ? pJobSystem->GetThreadCount() : 1);
+
+	// Nothing cached
+	printf("\ncold:\n");
+	if (!Cook(manifestPath.c_str(), pJobSystem, false, true, &stats) || !Expect("cold", stats, steps, 0, 0))
+		return 1;
+
+	double coldMs = stats.totalMs;
+
+	// Nothing changed, every output is current without reading a single source
+	printf("\nwarm:\n");
+	if (!Cook(manifestPath.c_str(), pJobSystem, false, true, &stats) || !Expect("warm", stats, 0, textureCount, outputs) ||
+		stats.sourcesHashed != 0)
+		return 1;
+
+	printf("  %.0fx faster than cold\n", coldMs / stats.totalMs);
+
+	// The textures each pass touches, wrapped so small sets work too
+	uint32_t rewritten = 2 % textureCount;
+	uint32_t edited = 3 % textureCount;
+	uint32_t reformatted = 5 % textureCount;
+	uint32_t deleted = 7 % textureCount;
+	char path[64];
+
+	// Rewritten with the same content: re-read and re-hashed, but still all hits
+	printf("\nsame content rewritten:\n");
+	snprintf(path, sizeof(path), "source/texture%03u.tga", rewritten);
+	WriteTGA((root / path).string(), 256, rewritten, (rewritten % 4) == 0);
+
+	if (!Cook(manifestPath.c_str(), pJobSystem, false, true, &stats) || !Expect("rewrite", stats, 0, textureCount, outputs) ||
+		stats.sourcesHashed != 1)
+		return 1;
+
+	// One texture edited: its mips and DDS are rebuilt, nothing else
+	printf("\none texture edited:\n");
+	snprintf(path, sizeof(path), "source/texture%03u.tga", edited);
+	WriteTGA((root / path).string(), 256, 1000 + edited, (edited % 4) == 0);
+
+	if (!Cook(manifestPath.c_str(), pJobSystem, false, true, &stats) || !Expect("edit", stats, 2, textureCount - 1, outputs - 1))
+		return 1;
+
+	// Back to the old content, found in the cache
+	printf("\nedit reverted:\n");
+	WriteTGA((root / path).string(), 256, edited, (edited % 4) == 0);
+
+	if (!Cook(manifestPath.c_str(), pJobSystem, false, true, &stats) || !Expect("revert", stats, 0, textureCount + 1, outputs - 1))
+		return 1;
+
+	// Format changed: the mip chain is reused, only the encode runs again. Added at the
+	// end of the line so it wins over a bc7 already there.
+	printf("\none format changed:\n");
+	snprintf(path, sizeof(path), "source/texture%03u.tga", reformatted);
+	size_t position = manifest.find('\n', manifest.find(path));
+	manifest.insert(position, " bc3");
+	WriteText(manifestPath, manifest);
+
+	if (!Cook(manifestPath.c_str(), pJobSystem, false, true, &stats) || !Expect("format", stats, 1, textureCount, outputs - 1))
+		return 1;
+
+	// A cooked file deleted is restored from the cache without cooking
+	printf("\ncooked file deleted:\n");
+	snprintf(path, sizeof(path), "cooked/texture%03u.dds", deleted);
+	fs::remove(root / path, error);
+
+	if (!Cook(manifestPath.c_str(), pJobSystem, false, true, &stats) || !Expect("delete", stats, 0, textureCount + 1, outputs - 1))
+		return 1;
+
+	fs::remove_all(root, error);
+
+	return 0;
+}
+
+static void PrintUsage()
+{
+	printf("assetcooker [--manifest assets.txt] [--force] [--threads N] [--quiet]\n"
+		   "assetcooker bench [textures]\n");
+}
+
+int main(int argc, char* argv[])
+{
+	const char* manifestPath = "assets.txt";
+	bool force = false;
+	bool quiet = false;
+	bool bench = false;
+	uint32_t benchTextures = 64;
+	int threads = -1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+
+		if (strcmp(arg, "bench") == 0)
+		{
+			bench = true;
+
+			if (i + 1 < argc)
+				benchTextures = (uint32_t)atoi(argv[++i]);
+		}
+		else if (strcmp(arg, "--manifest") == 0 && i + 1 < argc)
+		{
+			manifestPath = argv[++i];
+		}
+		else if (strcmp(arg, "--force") == 0)
+		{
+			force = true;
+		}
+		else if (strcmp(arg, "--quiet") == 0)
+		{
+			quiet = true;
+		}
+		else if (strcmp(arg, "--threads") == 0 && i + 1 < argc)
+		{
+			threads = atoi(argv[++i]);
+		}
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	// One thread cooks on the caller alone
+	JobSystem jobSystem;
+	JobSystem* pJobSystem = threads == 1 ? nullptr : &jobSystem;
+	jobSystem.Init(threads > 1 ? (uint32_t)(threads - 1) : 0);
+
+	int result;
+
+	if (bench)
+		result = Bench(benchTextures > 0 ? benchTextures : 1, pJobSystem);
+	else
+		result = Cook(manifestPath, pJobSystem, force, quiet, nullptr) ? 0 : 1;
+
+	jobSystem.Shutdown();
+
+	return result;
+}
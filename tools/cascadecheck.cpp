@@ -0,0 +1,315 @@
+//--------------------------------------------------------------------------------------
+// Cascaded shadow map checks. Covers the split distances, the slice bounding spheres
+// against the frustum corners worked out separately from the inverse view, the texel
+// snapping of the cascade projections while the camera drifts by less than a texel, and
+// when Update keeps or redraws the static casters of the cached cascades. Uses the same
+// camera and settings as the framework.
+//
+//   g++ -std=c++17 -O2 cascadecheck.cpp ../shadowcascades.cpp
+//
+//   cascadecheck     exit code 1 if a check fails
+//--------------------------------------------------------------------------------------
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "../shadowcascades.h"
+
+static uint32_t s_random = 12345;
+
+static uint32_t RandomUint()
+{
+	s_random = s_random * 1664525u + 1013904223u;
+	return s_random >> 8;
+}
+
+static float RandomFloat(float low, float high)
+{
+	return low + (high - low) * (RandomUint() / 16777216.0f);
+}
+
+static bool s_failed = false;
+
+static void Check(bool ok, const char* what)
+{
+	printf("  %-4s %s\n", ok ? "ok" : "FAIL", what);
+	s_failed |= !ok;
+}
+
+// Same camera as the framework
+static const float FovY = 3.14159265f * 0.5f;
+static const float Aspect = 1920.0f / 1080.0f;
+static const float NearZ = 0.01f;
+
+static Mat4 CameraView(const Vec3& eye, const Vec3& target)
+{
+	return LookAtLH(eye, target, Vec3(0.0f, 1.0f, 0.0f));
+}
+
+static void CheckSplits()
+{
+	printf("splits\n");
+
+	static const float lambdas[] = { 0.0f, 0.5f, 0.75f, 1.0f };
+	bool monotonic = true;
+	bool endsAtFar = true;
+	bool startsAtNear = true;
+
+	for (float lambda : lambdas)
+	{
+		for (uint32_t count = 1; count <= MaxShadowCascades; count++)
+		{
+			float splits[MaxShadowCascades + 1];
+			CascadedShadowMaps::ComputeSplits(NearZ, 60.0f, count, lambda, splits);
+
+			startsAtNear &= splits[0] == NearZ;
+			endsAtFar &= splits[count] == 60.0f;
+
+			for (uint32_t i = 0; i < count; i++)
+				monotonic &= splits[i + 1] > splits[i];
+		}
+	}
+
+	Check(startsAtNear, "first split is the near plane");
+	Check(endsAtFar, "last split is the shadow distance");
+	Check(monotonic, "splits strictly increase for every lambda and cascade count");
+
+	// The two ends of the blend are the plain schemes
+	float linear[5];
+	float logarithmic[5];
+	CascadedShadowMaps::ComputeSplits(1.0f, 81.0f, 4, 0.0f, linear);
+	CascadedShadowMaps::ComputeSplits(1.0f, 81.0f, 4, 1.0f, logarithmic);
+
+	Check(fabsf(linear[1] - 21.0f) < 1e-4f && fabsf(linear[2] - 41.0f) < 1e-4f && fabsf(linear[3] - 61.0f) < 1e-4f,
+		  "lambda 0 is linear");
+	Check(fabsf(logarithmic[1] - 3.0f) < 1e-4f && fabsf(logarithmic[2] - 9.0f) < 1e-4f && fabsf(logarithmic[3] - 27.0f) < 1e-3f,
+		  "lambda 1 is logarithmic");
+}
+
+static void CheckSliceSpheres()
+{
+	printf("slice spheres\n");
+
+	float tanHalfFovY = tanf(FovY * 0.5f);
+	float worstOutside = -1e30f;
+	bool quantised = true;
+	uint32_t tested = 0;
+
+	for (uint32_t i = 0; i < 200; i++)
+	{
+		Vec3 eye(RandomFloat(-50.0f, 50.0f), RandomFloat(-5.0f, 20.0f), RandomFloat(-50.0f, 50.0f));
+		Vec3 target = eye + Vec3(RandomFloat(-1.0f, 1.0f), RandomFloat(-0.9f, 0.9f), RandomFloat(-1.0f, 1.0f));
+		Mat4 view = CameraView(eye, target);
+		Mat4 world = Inverse(view);
+
+		float splitNear = RandomFloat(NearZ, 40.0f);
+		float splitFar = splitNear + RandomFloat(0.1f, 30.0f);
+
+		Vec3 center;
+		float radius;
+		CascadedShadowMaps::ComputeSliceSphere(view, FovY, Aspect, splitNear, splitFar, center, radius);
+
+		quantised &= radius * 16.0f == floorf(radius * 16.0f);
+
+		// Corners in view space taken back to the world by the inverse view matrix
+		float distances[2] = { splitNear, splitFar };
+
+		for (int d = 0; d < 2; d++)
+		{
+			float halfHeight = distances[d] * tanHalfFovY;
+			float halfWidth = halfHeight * Aspect;
+
+			for (int corner = 0; corner < 4; corner++)
+			{
+				Vec3 viewCorner((corner & 1) ? halfWidth : -halfWidth, (corner & 2) ? halfHeight : -halfHeight, distances[d]);
+				Vec3 worldCorner = TransformPoint(viewCorner, world);
+
+				worstOutside = std::max(worstOutside, (Length(worldCorner - center) - radius) / radius);
+				tested++;
+			}
+		}
+	}
+
+	printf("       %u corners, worst %.2e of the radius %s the sphere\n", tested, fabsf(worstOutside),
+		   worstOutside > 0.0f ? "outside" : "inside");
+
+	Check(worstOutside <= 1e-5f, "every slice corner is inside its sphere");
+	Check(quantised, "radius is a multiple of 1/16");
+}
+
+// Texel coordinates of a world point in a cascade's shadow map
+static void ShadowTexel(const ShadowCascade& cascade, uint32_t resolution, const Vec3& point, float& u, float& v)
+{
+	Vec3 ndc = TransformPoint(point, cascade.viewProjection);
+	u = (ndc.x * 0.5f + 0.5f) * resolution;
+	v = (0.5f - ndc.y * 0.5f) * resolution;
+}
+
+static float FractionDistance(float a, float b)
+{
+	float difference = fabsf((a - floorf(a)) - (b - floorf(b)));
+	return std::min(difference, 1.0f - difference);
+}
+
+static void CheckTexelSnapping()
+{
+	printf("texel snapping\n");
+
+	ShadowSettings settings;
+	settings.firstCachedCascade = settings.cascadeCount;
+
+	CascadedShadowMaps shadows;
+	shadows.Init(settings);
+
+	Vec3 lightDirection = Normalize(Vec3(0.4f, -1.0f, 0.3f));
+	Vec3 eye(3.0f, 2.0f, -8.0f);
+	Vec3 forward = Normalize(Vec3(0.2f, -0.1f, 1.0f));
+
+	shadows.Update(CameraView(eye, eye + forward), FovY, Aspect, NearZ, lightDirection);
+
+	ShadowCascade first[MaxShadowCascades];
+
+	for (uint32_t c = 0; c < settings.cascadeCount; c++)
+		first[c] = shadows.GetCascade(c);
+
+	// World points the shadow maps cover, their texel positions must keep the same
+	// fraction while the camera drifts or the shadow edges crawl
+	Vec3 points[16];
+
+	for (Vec3& point : points)
+		point = eye + forward * RandomFloat(1.0f, 10.0f) + Vec3(RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f));
+
+	float worstFraction = 0.0f;
+	bool sameSize = true;
+	bool moved = false;
+
+	for (uint32_t step = 1; step <= 100; step++)
+	{
+		// A quarter of the finest texel per step, so most steps don't cross one
+		float texelSize = 2.0f * first[0].radius / settings.resolution;
+		Vec3 drift = Vec3(1.0f, 0.3f, -0.6f) * (0.25f * texelSize * step);
+
+		shadows.Update(CameraView(eye + drift, eye + drift + forward), FovY, Aspect, NearZ, lightDirection);
+
+		for (uint32_t c = 0; c < settings.cascadeCount; c++)
+		{
+			const ShadowCascade& cascade = shadows.GetCascade(c);
+
+			sameSize &= cascade.radius == first[c].radius;
+			moved |= Length(cascade.center - first[c].center) > 0.0f;
+
+			for (const Vec3& point : points)
+			{
+				float u0, v0, u1, v1;
+				ShadowTexel(first[c], settings.resolution, point, u0, v0);
+				ShadowTexel(cascade, settings.resolution, point, u1, v1);
+
+				worstFraction = std::max(worstFraction, std::max(FractionDistance(u0, u1), FractionDistance(v0, v1)));
+			}
+		}
+	}
+
+	printf("       worst change in a texel fraction %.4f\n", worstFraction);
+
+	Check(sameSize, "cascade sizes don't change while the camera only moves");
+	Check(moved, "the cascades did follow the camera");
+	Check(worstFraction < 0.01f, "projections only ever move by whole texels");
+}
+
+static void CheckCache()
+{
+	printf("static caster cache\n");
+
+	ShadowSettings settings;
+	CascadedShadowMaps shadows;
+	shadows.Init(settings);
+
+	uint32_t cached = settings.cascadeCount - settings.firstCachedCascade;
+	Vec3 lightDirection = Normalize(Vec3(0.4f, -1.0f, 0.3f));
+	Vec3 eye(0.0f, 2.0f, 0.0f);
+	Vec3 forward(0.0f, 0.0f, 1.0f);
+
+	shadows.Update(CameraView(eye, eye + forward), FovY, Aspect, NearZ, lightDirection);
+	Check(shadows.GetStats().cascadesUpdated == settings.cascadeCount, "first frame draws every cascade");
+
+	shadows.Update(CameraView(eye, eye + forward), FovY, Aspect, NearZ, lightDirection);
+	Check(shadows.GetStats().cascadesUpdated == settings.firstCachedCascade && shadows.GetStats().cascadesReused == cached,
+		  "still camera reuses the cached cascades only");
+
+	for (uint32_t c = 0; c < settings.cascadeCount; c++)
+	{
+		bool cachedCascade = c >= settings.firstCachedCascade;
+
+		if (shadows.GetCascade(c).cached != cachedCascade || shadows.GetCascade(c).staticDirty == cachedCascade)
+			Check(false, "cached and dirty flags follow firstCachedCascade");
+	}
+
+	// The slice radius the cache margin is a fraction of, for the first cached cascade
+	const ShadowCascade& firstCached = shadows.GetCascade(settings.firstCachedCascade);
+	Vec3 sliceCenter;
+	float sliceRadius;
+	CascadedShadowMaps::ComputeSliceSphere(CameraView(eye, eye + forward), FovY, Aspect, firstCached.splitNear,
+										   firstCached.splitFar, sliceCenter, sliceRadius);
+	float margin = sliceRadius * settings.cacheMargin;
+
+	// Sideways so the slice sphere moves by exactly the camera's distance
+	Vec3 inside = eye + Vec3(0.9f * margin, 0.0f, 0.0f);
+	shadows.Update(CameraView(inside, inside + forward), FovY, Aspect, NearZ, lightDirection);
+	Check(!shadows.GetCascade(settings.firstCachedCascade).staticDirty, "moving 90% of the margin keeps the cache");
+
+	Vec3 outside = eye + Vec3(1.1f * margin, 0.0f, 0.0f);
+	shadows.Update(CameraView(outside, outside + forward), FovY, Aspect, NearZ, lightDirection);
+	Check(shadows.GetCascade(settings.firstCachedCascade).staticDirty, "moving 110% of the margin redraws it");
+
+	shadows.Update(CameraView(outside, outside + forward), FovY, Aspect, NearZ, lightDirection);
+	Check(shadows.GetStats().cascadesReused == cached, "refitted cascade is reused again the next frame");
+
+	// Turning the light by less than the threshold keeps everything, more drops it all
+	float below = settings.lightAngleThreshold * 0.5f;
+	Vec3 turned = Normalize(lightDirection + Normalize(Cross(lightDirection, Vec3(0.0f, 1.0f, 0.0f))) * tanf(below));
+	shadows.Update(CameraView(outside, outside + forward), FovY, Aspect, NearZ, turned);
+	Check(shadows.GetStats().cascadesReused == cached, "light turned below the threshold keeps the cache");
+
+	float above = settings.lightAngleThreshold * 1.5f;
+	turned = Normalize(lightDirection + Normalize(Cross(lightDirection, Vec3(0.0f, 1.0f, 0.0f))) * tanf(above));
+	shadows.Update(CameraView(outside, outside + forward), FovY, Aspect, NearZ, turned);
+	Check(shadows.GetStats().cascadesUpdated == settings.cascadeCount, "light turned past the threshold redraws everything");
+
+	shadows.Update(CameraView(outside, outside + forward), FovY, Aspect, NearZ, turned);
+	shadows.Invalidate();
+	shadows.Update(CameraView(outside, outside + forward), FovY, Aspect, NearZ, turned);
+	Check(shadows.GetStats().cascadesUpdated == settings.cascadeCount, "Invalidate redraws everything");
+
+	// Draw stats from the last frame's dirty flags
+	shadows.Update(CameraView(outside, outside + forward), FovY, Aspect, NearZ, turned);
+	shadows.RecordDraws(100, 7);
+	const ShadowStats& stats = shadows.GetStats();
+	Check(stats.staticDrawsIssued == 100 * settings.firstCachedCascade && stats.staticDrawsSaved == 100 * cached &&
+		  stats.dynamicDraws == 7 * settings.cascadeCount, "draw stats");
+
+	// A camera walking steadily forward should mostly be served from the cache
+	uint32_t reused = 0;
+	uint32_t frames = 600;
+
+	for (uint32_t frame = 0; frame < frames; frame++)
+	{
+		Vec3 walk = outside + forward * (0.05f * frame);
+		shadows.Update(CameraView(walk, walk + forward), FovY, Aspect, NearZ, turned);
+		reused += shadows.GetStats().cascadesReused;
+	}
+
+	printf("       walking at 3 m/s: %.1f%% of cached cascade frames reused\n", 100.0 * reused / (frames * cached));
+	Check(reused > frames * cached / 2, "walking camera reuses most cached frames");
+}
+
+int main()
+{
+	CheckSplits();
+	CheckSliceSpheres();
+	CheckTexelSnapping();
+	CheckCache();
+
+	printf("%s\n", s_failed ? "FAILED" : "all passed");
+
+	return s_failed ? 1 : 0;
+}
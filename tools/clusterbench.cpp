@@ -0,0 +1,414 @@
+//--------------------------------------------------------------------------------------
+// Clustered light assignment benchmark. Scatters point and spot lights through the view
+// frustum, runs the SSE assignment on one thread and over the job system, and checks
+// every cluster's light list against a scalar sphere/AABB reference written separately.
+// Reports the time per assignment at each light count next to the scalar reference.
+// Spot light spheres are checked against points on the apex, rim and cap of the lit
+// sector, and each cluster such a point falls in has to list the light.
+//
+//   g++ -std=c++17 -O2 clusterbench.cpp ../clusteredlighting.cpp ../jobsystem.cpp ../allocators.cpp ../memorytracker.cpp -lpthread
+//
+//   clusterbench [iterations]     default 20, exit code 1 if a check fails
+//--------------------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../clusteredlighting.h"
+#include "../jobsystem.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Milliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static uint32_t s_random = 12345;
+
+static uint32_t RandomUint()
+{
+	s_random = s_random * 1664525u + 1013904223u;
+	return s_random >> 8;
+}
+
+static float RandomFloat(float low, float high)
+{
+	return low + (high - low) * (RandomUint() / 16777216.0f);
+}
+
+static bool s_failed = false;
+
+static void Check(bool ok, const char* what)
+{
+	printf("  %-4s %s\n", ok ? "ok" : "FAIL", what);
+	s_failed |= !ok;
+}
+
+// Same camera as the framework
+static const float FovY = 3.14159265f * 0.5f;
+static const float ScreenWidth = 1920.0f;
+static const float ScreenHeight = 1080.0f;
+static const float NearZ = 0.01f;
+static const float FarZ = 100.0f;
+
+// Lights spread through the visible part of the frustum, a quarter of them spots
+static void MakeLights(uint32_t count, std::vector<Light>& lights)
+{
+	float tanHalfFovY = tanf(FovY * 0.5f);
+	float tanHalfFovX = tanHalfFovY * (ScreenWidth / ScreenHeight);
+
+	lights.resize(count);
+
+	for (Light& light : lights)
+	{
+		float z = RandomFloat(1.0f, 60.0f);
+
+		light.type = (RandomUint() & 3) == 0 ? LIGHT_SPOT : LIGHT_POINT;
+		light.position = Vec3(RandomFloat(-1.1f, 1.1f) * z * tanHalfFovX, RandomFloat(-1.1f, 1.1f) * z * tanHalfFovY, z);
+		light.range = RandomFloat(0.5f, 4.0f);
+		light.color = Vec3(1.0f, 1.0f, 1.0f);
+		light.intensity = 1.0f;
+		light.direction = Normalize(Vec3(RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f) + 0.01f));
+		light.cosOuter = RandomFloat(0.3f, 0.95f);
+		light.cosInner = std::min(light.cosOuter + 0.05f, 1.0f);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Scalar reference. Written out from the description of the clustering, not shared with
+// ClusteredLighting: exponential slices, tile row 0 at the top, the tightest sphere around
+// a spot cone, and a point to box squared distance test per light and cluster.
+//--------------------------------------------------------------------------------------
+struct ReferenceClusters
+{
+	std::vector<std::vector<uint32_t>> lists;
+};
+
+static void ReferenceBounds(const Light& light, const Mat4& view, Vec3& center, float& radius)
+{
+	center = light.position;
+	radius = light.range;
+
+	if (light.type == LIGHT_SPOT)
+	{
+		float cosAngle = light.cosOuter;
+
+		// The lit region is a spherical sector: a wide one is bounded by the circle at
+		// its rim, a narrow one by the sphere through the apex and the rim
+		if (cosAngle < 0.70710678f)
+		{
+			center = light.position + light.direction * (cosAngle * light.range);
+			radius = sqrtf(1.0f - cosAngle * cosAngle) * light.range;
+		}
+		else
+		{
+			radius = light.range / (2.0f * cosAngle);
+			center = light.position + light.direction * radius;
+		}
+	}
+
+	center = TransformPoint(center, view);
+}
+
+static void ReferenceAssign(const ClusterConfig& config, const std::vector<Light>& lights, const Mat4& view, ReferenceClusters& result)
+{
+	float tanHalfFovY = tanf(FovY * 0.5f);
+	float tanHalfFovX = tanHalfFovY * (ScreenWidth / ScreenHeight);
+
+	std::vector<Vec3> centers(lights.size());
+	std::vector<float> radii(lights.size());
+
+	for (size_t i = 0; i < lights.size(); i++)
+		ReferenceBounds(lights[i], view, centers[i], radii[i]);
+
+	result.lists.assign(config.tilesX * config.tilesY * config.slices, std::vector<uint32_t>());
+
+	for (uint32_t z = 0; z < config.slices; z++)
+	{
+		float z0 = NearZ * powf(FarZ / NearZ, (float)z / config.slices);
+		float z1 = NearZ * powf(FarZ / NearZ, (float)(z + 1) / config.slices);
+
+		for (uint32_t y = 0; y < config.tilesY; y++)
+		{
+			float top = 1.0f - 2.0f * y / config.tilesY;
+			float bottom = 1.0f - 2.0f * (y + 1) / config.tilesY;
+
+			for (uint32_t x = 0; x < config.tilesX; x++)
+			{
+				float left = -1.0f + 2.0f * x / config.tilesX;
+				float right = -1.0f + 2.0f * (x + 1) / config.tilesX;
+
+				// The box around the four near and four far corners of the cluster
+				float minX = std::min(std::min(left * z0, right * z0), std::min(left * z1, right * z1)) * tanHalfFovX;
+				float maxX = std::max(std::max(left * z0, right * z0), std::max(left * z1, right * z1)) * tanHalfFovX;
+				float minY = std::min(std::min(bottom * z0, top * z0), std::min(bottom * z1, top * z1)) * tanHalfFovY;
+				float maxY = std::max(std::max(bottom * z0, top * z0), std::max(bottom * z1, top * z1)) * tanHalfFovY;
+
+				std::vector<uint32_t>& list = result.lists[x + y * config.tilesX + z * config.tilesX * config.tilesY];
+
+				for (uint32_t i = 0; i < (uint32_t)lights.size(); i++)
+				{
+					const Vec3& c = centers[i];
+
+					// The same depth reject the SSE path does per slice, so the timing
+					// compares the tests rather than the amount of work
+					if (c.z + radii[i] < z0 || c.z - radii[i] > z1)
+						continue;
+
+					float dx = std::max(0.0f, minX - c.x) + std::max(0.0f, c.x - maxX);
+					float dy = std::max(0.0f, minY - c.y) + std::max(0.0f, c.y - maxY);
+					float dz = std::max(0.0f, z0 - c.z) + std::max(0.0f, c.z - z1);
+
+					if (dx * dx + dy * dy + dz * dz <= radii[i] * radii[i])
+						list.push_back(i);
+				}
+			}
+		}
+	}
+}
+
+struct Comparison
+{
+	uint32_t mismatched;   // clusters whose lists differ
+	uint32_t outOfRange;   // indices past the light count
+};
+
+static Comparison Compare(const ClusteredLighting& clustered, const ReferenceClusters& reference)
+{
+	Comparison result = {};
+	const ClusterRange* clusters = clustered.GetClusters();
+	const uint32_t* indices = clustered.GetLightIndices();
+
+	std::vector<uint32_t> got;
+
+	for (uint32_t c = 0; c < clustered.GetClusterCount(); c++)
+	{
+		got.assign(indices + clusters[c].offset, indices + clusters[c].offset + clusters[c].count);
+
+		for (uint32_t index : got)
+			result.outOfRange += index >= clustered.GetLightCount() ? 1 : 0;
+
+		// Lights go in ascending order within a cluster, sorted anyway so the check
+		// doesn't depend on it
+		std::sort(got.begin(), got.end());
+		result.mismatched += got != reference.lists[c] ? 1 : 0;
+	}
+
+	return result;
+}
+
+// Points of the spherical sector a spot light reaches: the apex, the rim circle and the
+// cap, pulled in by scale so points exactly on the boundary don't depend on rounding
+static void SectorPoints(const Light& light, float scale, std::vector<Vec3>& points)
+{
+	Vec3 side = Normalize(Cross(light.direction, fabsf(light.direction.y) < 0.9f ? Vec3(0.0f, 1.0f, 0.0f) : Vec3(1.0f, 0.0f, 0.0f)));
+	Vec3 up = Cross(light.direction, side);
+	float angle = acosf(light.cosOuter) * scale;
+
+	points.assign(1, light.position);
+
+	for (uint32_t ring = 0; ring <= 8; ring++)
+	{
+		float ringAngle = angle * ring / 8.0f;
+
+		for (uint32_t step = 0; step < 32; step++)
+		{
+			float around = 2.0f * 3.14159265f * step / 32.0f;
+			Vec3 direction = light.direction * cosf(ringAngle) + (side * cosf(around) + up * sinf(around)) * sinf(ringAngle);
+
+			points.push_back(light.position + direction * (light.range * scale));
+
+			// Along the rim edge from the apex as well
+			if (ring == 8)
+			{
+				for (uint32_t along = 1; along < 8; along++)
+					points.push_back(light.position + direction * (light.range * scale * along / 8.0f));
+			}
+		}
+	}
+}
+
+static void CheckSpotBounds()
+{
+	printf("\nspot light bounds\n");
+
+	float worstOutside = -1.0f;
+	float loosest = 0.0f;
+
+	// Narrow to wide, through the 45 degree switch between the two bounds
+	for (uint32_t i = 0; i <= 40; i++)
+	{
+		Light light;
+		light.type = LIGHT_SPOT;
+		light.position = Vec3(1.0f, -2.0f, 5.0f);
+		light.direction = Normalize(Vec3(0.3f, 0.2f, 1.0f));
+		light.range = 4.0f;
+		light.cosOuter = 0.99f - 0.69f * i / 40.0f;
+
+		Vec3 center;
+		float radius;
+		ReferenceBounds(light, Mat4::Identity(), center, radius);
+
+		std::vector<Vec3> points;
+		SectorPoints(light, 1.0f, points);
+
+		// The farthest point of the sector should sit on the sphere, or it isn't tight
+		float farthest = 0.0f;
+
+		for (const Vec3& point : points)
+			farthest = std::max(farthest, Length(point - center));
+
+		worstOutside = std::max(worstOutside, (farthest - radius) / radius);
+		loosest = std::max(loosest, (radius - farthest) / radius);
+	}
+
+	printf("       worst %.1e of the radius outside, loosest %.1f%% bigger than the sector needs\n", std::max(worstOutside, 0.0f),
+		   100.0f * loosest);
+
+	Check(worstOutside <= 1e-5f, "sphere holds the apex, rim and cap of every spot");
+	Check(loosest <= 0.01f, "sphere touches the sector");
+
+	// The same lights through the real assignment: every cluster a point of the sector
+	// lands in must have the light in its list
+	ClusterConfig config;
+	ClusteredLighting clustered;
+	clustered.Init(config);
+	clustered.SetProjection(FovY, ScreenWidth, ScreenHeight, NearZ, FarZ);
+
+	float tanHalfFovY = tanf(FovY * 0.5f);
+	float tanHalfFovX = tanHalfFovY * (ScreenWidth / ScreenHeight);
+	float logDepth = logf(FarZ / NearZ);
+	uint32_t tested = 0;
+	uint32_t missed = 0;
+
+	for (uint32_t i = 0; i < 200; i++)
+	{
+		Light light;
+		light.type = LIGHT_SPOT;
+		light.position = Vec3(RandomFloat(-8.0f, 8.0f), RandomFloat(-4.0f, 4.0f), RandomFloat(4.0f, 30.0f));
+		light.direction = Normalize(Vec3(RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f) + 0.01f));
+		light.range = RandomFloat(1.0f, 6.0f);
+		light.cosOuter = RandomFloat(0.3f, 0.99f);
+		light.cosInner = std::min(light.cosOuter + 0.05f, 1.0f);
+		light.color = Vec3(1.0f, 1.0f, 1.0f);
+		light.intensity = 1.0f;
+
+		clustered.ClearLights();
+		clustered.AddLight(light);
+		clustered.Assign(Mat4::Identity(), nullptr);
+
+		std::vector<Vec3> points;
+		SectorPoints(light, 0.999f, points);
+
+		for (const Vec3& point : points)
+		{
+			if (point.z <= NearZ || point.z >= FarZ)
+				continue;
+
+			float ndcX = point.x / (point.z * tanHalfFovX);
+			float ndcY = point.y / (point.z * tanHalfFovY);
+
+			if (fabsf(ndcX) >= 1.0f || fabsf(ndcY) >= 1.0f)
+				continue;
+
+			uint32_t x = std::min((uint32_t)((ndcX * 0.5f + 0.5f) * config.tilesX), config.tilesX - 1);
+			uint32_t y = std::min((uint32_t)((0.5f - ndcY * 0.5f) * config.tilesY), config.tilesY - 1);
+			uint32_t z = std::min((uint32_t)(logf(point.z / NearZ) / logDepth * config.slices), config.slices - 1);
+
+			const ClusterRange& range = clustered.GetClusters()[x + y * config.tilesX + z * config.tilesX * config.tilesY];
+			tested++;
+			missed += range.count == 0 ? 1 : 0;
+		}
+	}
+
+	printf("       %u sector points inside the frustum\n", tested);
+
+	Check(tested > 1000 && missed == 0, "every cluster a spot reaches lists it");
+}
+
+static void Run(uint32_t lightCount, uint32_t iterations, JobSystem& jobs)
+{
+	ClusterConfig config;
+	config.maxLights = lightCount;
+	config.maxLightsPerCluster = lightCount;
+	config.maxLightIndices = 16 * 1024 * 1024;
+
+	ClusteredLighting clustered;
+	clustered.Init(config);
+	clustered.SetProjection(FovY, ScreenWidth, ScreenHeight, NearZ, FarZ);
+
+	s_random = 777 + lightCount;
+
+	std::vector<Light> lights;
+	MakeLights(lightCount, lights);
+
+	for (const Light& light : lights)
+		clustered.AddLight(light);
+
+	printf("\n%u lights, %u clusters\n", lightCount, clustered.GetClusterCount());
+
+	Check(clustered.GetLightCount() == lightCount && clustered.AddLight(lights[0]) == ClusterInvalidLight,
+		  "AddLight stops at maxLights");
+
+	// A camera that slides sideways a little each iteration, so every run does real work
+	double singleMs = 0.0;
+	double parallelMs = 0.0;
+
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		Mat4 view = Mat4::Identity();
+		view.m[3][0] = 0.05f * i;
+
+		Clock::time_point start = Clock::now();
+		clustered.Assign(view, nullptr);
+		singleMs += Milliseconds(start);
+
+		start = Clock::now();
+		clustered.Assign(view, &jobs);
+		parallelMs += Milliseconds(start);
+	}
+
+	Mat4 view = Mat4::Identity();
+	view.m[3][0] = 0.05f * (iterations - 1);
+
+	Clock::time_point start = Clock::now();
+	ReferenceClusters reference;
+	ReferenceAssign(config, lights, view, reference);
+	double referenceMs = Milliseconds(start);
+
+	const ClusterStats& stats = clustered.GetStats();
+	Comparison comparison = Compare(clustered, reference);
+
+	printf("  %-24s %9.3f ms\n", "scalar reference", referenceMs);
+	printf("  %-24s %9.3f ms  (%.1fx)\n", "sse, one thread", singleMs / iterations, referenceMs / std::max(singleMs / iterations, 1e-6));
+	printf("  %-24s %9.3f ms  (%.1fx), %u threads\n", "sse, job system", parallelMs / iterations,
+		   referenceMs / std::max(parallelMs / iterations, 1e-6), jobs.GetThreadCount());
+	printf("       %u indices, %u occupied clusters, at most %u lights in one\n", stats.lightIndexCount, stats.occupiedClusters,
+		   stats.maxLightsInCluster);
+
+	Check(!stats.overflowed, "no cluster or slice overflowed");
+	Check(comparison.outOfRange == 0, "every index is below the light count");
+	Check(comparison.mismatched == 0, "cluster lists match the scalar reference");
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t iterations = argc > 1 ? std::max(atoi(argv[1]), 1) : 20;
+
+	JobSystem jobs;
+	jobs.Init();
+
+	CheckSpotBounds();
+
+	Run(1000, iterations, jobs);
+	Run(10000, iterations, jobs);
+
+	jobs.Shutdown();
+
+	printf("%s\n", s_failed ? "FAILED" : "all passed");
+
+	return s_failed ? 1 : 0;
+}
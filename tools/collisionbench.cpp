@@ -0,0 +1,299 @@
+//--------------------------------------------------------------------------------------
+// Broadphase and swept collision benchmark. Moves a crowd of dynamic boxes around a
+// level with a few static ones, updates the spatial hash incrementally and finds the
+// overlapping pairs on one thread and on every core. A smaller crowd is checked against
+// brute force every frame, and spheres are fired at a floor and a field of cubes to
+// check none of them end up inside anything.
+//
+//   g++ -std=c++17 -O2 collisionbench.cpp ../collision.cpp ../jobsystem.cpp -lpthread
+//
+//   collisionbench [bodies] [frames]
+//--------------------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../collision.h"
+#include "../jobsystem.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Milliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static uint32_t s_random = 12345;
+
+static float RandomFloat(float low, float high)
+{
+	s_random = s_random * 1664525u + 1013904223u;
+	return low + (high - low) * ((s_random >> 8) / 16777216.0f);
+}
+
+struct Crowd
+{
+	std::vector<Vec3>     positions;
+	std::vector<Vec3>     velocities;
+	std::vector<Vec3>     extents;
+	std::vector<uint32_t> bodies;
+	Vec3                  worldSize;
+};
+
+static Aabb CrowdBounds(const Crowd& crowd, size_t i)
+{
+	Aabb box = { crowd.positions[i] - crowd.extents[i], crowd.positions[i] + crowd.extents[i] };
+	return box;
+}
+
+// Boxes of 0.5 to 1.5 across spread so each overlaps a couple of others on average,
+// plus static walls and a floor bigger than the hash handles in cells
+static void BuildCrowd(uint32_t count, SpatialHash& hash, Crowd& crowd)
+{
+	float side = cbrtf(count * 8.0f);
+	crowd.worldSize = Vec3(side, side * 0.25f, side);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		crowd.positions.push_back(Vec3(RandomFloat(0.0f, crowd.worldSize.x), RandomFloat(0.0f, crowd.worldSize.y), RandomFloat(0.0f, crowd.worldSize.z)));
+		crowd.velocities.push_back(Vec3(RandomFloat(-4.0f, 4.0f), RandomFloat(-1.0f, 1.0f), RandomFloat(-4.0f, 4.0f)));
+		crowd.extents.push_back(Vec3(RandomFloat(0.25f, 0.75f), RandomFloat(0.25f, 0.75f), RandomFloat(0.25f, 0.75f)));
+		crowd.bodies.push_back(hash.Add(CrowdBounds(crowd, i), 0));
+	}
+
+	Aabb floor = { Vec3(0.0f, -1.0f, 0.0f), Vec3(crowd.worldSize.x, 0.5f, crowd.worldSize.z) };
+	hash.Add(floor, COLLISION_STATIC);
+
+	for (uint32_t i = 0; i < count / 100 + 1; i++)
+	{
+		Vec3 center(RandomFloat(0.0f, crowd.worldSize.x), RandomFloat(0.0f, crowd.worldSize.y), RandomFloat(0.0f, crowd.worldSize.z));
+		Vec3 extent(RandomFloat(0.5f, 3.0f), RandomFloat(0.5f, 3.0f), RandomFloat(0.5f, 3.0f));
+		Aabb wall = { center - extent, center + extent };
+		hash.Add(wall, COLLISION_STATIC);
+	}
+}
+
+static void MoveCrowd(Crowd& crowd, SpatialHash& hash, float dt)
+{
+	for (size_t i = 0; i < crowd.positions.size(); i++)
+	{
+		Vec3& p = crowd.positions[i];
+		Vec3& v = crowd.velocities[i];
+		p += v * dt;
+
+		if (p.x < 0.0f || p.x > crowd.worldSize.x) v.x = -v.x;
+		if (p.y < 0.0f || p.y > crowd.worldSize.y) v.y = -v.y;
+		if (p.z < 0.0f || p.z > crowd.worldSize.z) v.z = -v.z;
+
+		hash.Update(crowd.bodies[i], CrowdBounds(crowd, i));
+	}
+}
+
+static uint64_t PairKey(uint32_t a, uint32_t b)
+{
+	return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+// Every pair with a dynamic body, found the slow way, against what the hash reported
+static bool ValidatePairs(const SpatialHash& hash, uint32_t bodyCount, const std::vector<CollisionPair>& pairs)
+{
+	std::vector<uint64_t> expected, found;
+
+	for (uint32_t a = 0; a < bodyCount; a++)
+	{
+		for (uint32_t b = a + 1; b < bodyCount; b++)
+		{
+			bool bothStatic = (hash.GetFlags(a) & hash.GetFlags(b) & COLLISION_STATIC) != 0;
+
+			if (!bothStatic && Overlaps(hash.GetBounds(a), hash.GetBounds(b)))
+				expected.push_back(PairKey(a, b));
+		}
+	}
+
+	for (size_t i = 0; i < pairs.size(); i++)
+		found.push_back(PairKey(pairs[i].a, pairs[i].b));
+
+	std::sort(expected.begin(), expected.end());
+	std::sort(found.begin(), found.end());
+
+	if (std::adjacent_find(found.begin(), found.end()) != found.end())
+	{
+		printf("FAIL: a pair was reported twice\n");
+		return false;
+	}
+
+	if (found != expected)
+	{
+		printf("FAIL: %zu pairs found, brute force finds %zu\n", found.size(), expected.size());
+		return false;
+	}
+
+	return true;
+}
+
+static int CheckPairs(JobSystem& jobSystem)
+{
+	SpatialHash hash(2.0f);
+	Crowd crowd;
+	BuildCrowd(3000, hash, crowd);
+
+	// One dynamic body too big to hash, it has to find its own pairs
+	Aabb giant = { Vec3(10.0f, 0.0f, 10.0f), Vec3(30.0f, 5.0f, 30.0f) };
+	uint32_t giantBody = hash.Add(giant, 0);
+	uint32_t bodyCount = giantBody + 1;
+
+	for (int frame = 0; frame < 20; frame++)
+	{
+		MoveCrowd(crowd, hash, 0.1f);
+
+		// Shrink the giant back into the grid halfway through
+		if (frame == 10)
+		{
+			Aabb shrunk = { Vec3(10.0f, 0.0f, 10.0f), Vec3(12.0f, 2.0f, 12.0f) };
+			hash.Update(giantBody, shrunk);
+		}
+
+		// and take a body out and put one back, reusing its slot
+		if (frame == 15)
+		{
+			hash.Remove(crowd.bodies[7]);
+			crowd.bodies[7] = hash.Add(CrowdBounds(crowd, 7), 0);
+		}
+
+		if (!ValidatePairs(hash, bodyCount, hash.FindPairs(frame & 1 ? &jobSystem : nullptr)))
+			return 1;
+	}
+
+	printf("pairs match brute force over 20 frames of %u bodies\n", bodyCount);
+
+	return 0;
+}
+
+static int CheckSweeps()
+{
+	const float positions[] =
+	{
+		-1.0f, 0.0f, -1.0f,  1.0f, 0.0f, -1.0f,  -1.0f, 0.0f, 1.0f,  1.0f, 0.0f, 1.0f,
+	};
+	const uint32_t floorIndices[] = { 0, 1, 2, 2, 1, 3 };
+
+	const float cubePositions[] =
+	{
+		-1, -1, -1,  1, -1, -1,  -1, 1, -1,  1, 1, -1,  -1, -1, 1,  1, -1, 1,  -1, 1, 1,  1, 1, 1,
+	};
+	const uint32_t cubeIndices[] =
+	{
+		0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,  0, 1, 4, 1, 5, 4,  2, 6, 3, 3, 6, 7,  0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5,
+	};
+
+	CollisionMesh floorMesh, cubeMesh;
+	BuildCollisionMesh(positions, sizeof(float) * 3, 4, floorIndices, 6, floorMesh);
+	BuildCollisionMesh(cubePositions, sizeof(float) * 3, 8, cubeIndices, 36, cubeMesh);
+
+	CollisionWorld world(2.0f);
+	Mat4 floorWorld = Mat4::Identity();
+	// Wide enough that nothing slides off the edge, cube edges can turn a fall sideways
+	floorWorld.m[0][0] = floorWorld.m[2][2] = 1000.0f;
+	floorWorld.m[3][1] = -2.0f;
+	world.AddBody(&floorMesh, floorWorld, COLLISION_STATIC);
+
+	std::vector<Vec3> cubeCenters;
+
+	for (int i = 0; i < 64; i++)
+	{
+		Mat4 cubeWorld = Mat4::Identity();
+		cubeWorld.m[3][0] = RandomFloat(-40.0f, 40.0f);
+		cubeWorld.m[3][1] = -1.0f;
+		cubeWorld.m[3][2] = RandomFloat(-40.0f, 40.0f);
+		world.AddBody(&cubeMesh, cubeWorld, COLLISION_STATIC);
+		cubeCenters.push_back(Vec3(cubeWorld.m[3][0], cubeWorld.m[3][1], cubeWorld.m[3][2]));
+	}
+
+	const int sweepCount = 20000;
+	const float radius = 0.5f;
+	int inside = 0;
+
+	auto start = Clock::now();
+
+	for (int i = 0; i < sweepCount; i++)
+	{
+		// Fast enough to cross the floor many times over in one step
+		Vec3 from(RandomFloat(-40.0f, 40.0f), RandomFloat(0.0f, 10.0f), RandomFloat(-40.0f, 40.0f));
+		Vec3 velocity(RandomFloat(-20.0f, 20.0f), RandomFloat(-200.0f, -20.0f), RandomFloat(-20.0f, 20.0f));
+		Vec3 to = world.MoveSphere(from, radius, velocity, CollisionInvalidBody);
+
+		bool bad = to.y < -2.0f + radius - 1.0e-3f;
+
+		for (size_t c = 0; c < cubeCenters.size() && !bad; c++)
+		{
+			Vec3 d = to - cubeCenters[c];
+			Vec3 closest(fmaxf(-1.0f, fminf(1.0f, d.x)), fmaxf(-1.0f, fminf(1.0f, d.y)), fmaxf(-1.0f, fminf(1.0f, d.z)));
+			bad = Length(d - closest) < radius - 1.0e-3f;
+		}
+
+		inside += bad;
+	}
+
+	double sweepMs = Milliseconds(start);
+
+	printf("%d fast spheres moved against a floor and %zu cubes in %.2f ms (%.1f us each), %d ended up inside\n", sweepCount,
+		   cubeCenters.size(), sweepMs, sweepMs * 1000.0 / sweepCount, inside);
+
+	if (inside != 0)
+	{
+		printf("FAIL: spheres tunnelled into the scene\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t bodyCount = argc > 1 ? (uint32_t)atoi(argv[1]) : 100000;
+	int frames = argc > 2 ? atoi(argv[2]) : 30;
+
+	JobSystem jobSystem;
+	jobSystem.Init();
+
+	if (CheckPairs(jobSystem) != 0 || CheckSweeps() != 0)
+		return 1;
+
+	SpatialHash hash(2.0f);
+	Crowd crowd;
+	auto buildStart = Clock::now();
+	BuildCrowd(bodyCount, hash, crowd);
+
+	printf("%u dynamic bodies, built in %.1f ms\n", bodyCount, Milliseconds(buildStart));
+
+	double updateMs = 0.0, serialMs = 0.0, parallelMs = 0.0;
+	uint64_t pairTotal = 0, cellChanges = 0;
+
+	for (int frame = 0; frame < frames; frame++)
+	{
+		auto updateStart = Clock::now();
+		MoveCrowd(crowd, hash, 1.0f / 60.0f);
+		updateMs += Milliseconds(updateStart);
+		cellChanges += hash.GetStats().cellChanges;
+
+		hash.FindPairs(nullptr);
+		serialMs += hash.GetStats().findPairsMs;
+
+		hash.FindPairs(&jobSystem);
+		parallelMs += hash.GetStats().findPairsMs;
+		pairTotal += hash.GetStats().pairs;
+	}
+
+	const BroadphaseStats& stats = hash.GetStats();
+
+	printf("per frame: move + incremental update %.2f ms (%.1f%% of bodies changed cells), %.0f pairs, %u cells\n",
+		   updateMs / frames, 100.0 * cellChanges / ((double)bodyCount * frames), (double)pairTotal / frames, stats.cells);
+	printf("find pairs: 1 thread %.2f ms, %.1fM pairs/s   %u threads %.2f ms, %.1fM pairs/s\n", serialMs / frames,
+		   pairTotal / (serialMs * 1000.0), jobSystem.GetThreadCount(), parallelMs / frames, pairTotal / (parallelMs * 1000.0));
+
+	jobSystem.Shutdown();
+
+	return 0;
+}
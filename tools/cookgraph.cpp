@@ -0,0 +1,785 @@
+#include "cookgraph.h"
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include "../jobsystem.h"
+
+namespace fs = std::filesystem;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Milliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+//--------------------------------------------------------------------------------------
+// Hashing
+//--------------------------------------------------------------------------------------
+static inline uint64_t Mix(uint64_t lane, uint64_t value)
+{
+	lane += value * 0xC2B2AE3D27D4EB4Full;
+	lane = (lane << 31) | (lane >> 33);
+	return lane * 0x9E3779B185EBCA87ull;
+}
+
+static inline uint64_t Finalise(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+uint64_t HashBytes(const void* pData, size_t size, uint64_t seed)
+{
+	const uint8_t* p = static_cast<const uint8_t*>(pData);
+	uint64_t lanes[4] = { seed + 0x9E3779B185EBCA87ull, seed + 0xC2B2AE3D27D4EB4Full, seed, seed - 0x9E3779B185EBCA87ull };
+	size_t remaining = size;
+
+	while (remaining >= 32)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			uint64_t value;
+			memcpy(&value, p + i * 8, 8);
+			lanes[i] = Mix(lanes[i], value);
+		}
+
+		p += 32;
+		remaining -= 32;
+	}
+
+	uint64_t h = size * 0x27D4EB2F165667C5ull;
+
+	for (int i = 0; i < 4; i++)
+		h = Mix(h, lanes[i]);
+
+	while (remaining >= 8)
+	{
+		uint64_t value;
+		memcpy(&value, p, 8);
+		h = Mix(h, value);
+		p += 8;
+		remaining -= 8;
+	}
+
+	if (remaining > 0)
+	{
+		uint64_t value = 0;
+		memcpy(&value, p, remaining);
+		h = Mix(h, value);
+	}
+
+	return Finalise(h);
+}
+
+static uint64_t HashString(const std::string& text, uint64_t seed)
+{
+	return HashBytes(text.data(), text.size(), seed);
+}
+
+//--------------------------------------------------------------------------------------
+// Files
+//--------------------------------------------------------------------------------------
+static bool ReadFileBytes(const std::string& path, std::vector<uint8_t>& data)
+{
+	FILE* pFile = fopen(path.c_str(), "rb");
+
+	if (pFile == nullptr)
+		return false;
+
+	fseek(pFile, 0, SEEK_END);
+	long size = ftell(pFile);
+	fseek(pFile, 0, SEEK_SET);
+
+	data.resize(size > 0 ? (size_t)size : 0);
+	bool ok = size >= 0 && fread(data.data(), 1, data.size(), pFile) == data.size();
+	fclose(pFile);
+
+	return ok;
+}
+
+// Written next to the destination and renamed over it, so a cook that dies half way
+// never leaves a truncated file where a reader or the next run would find it
+static bool WriteFileBytes(const std::string& path, const void* pHeader, size_t headerSize, const std::vector<uint8_t>& data)
+{
+	std::error_code error;
+	fs::path parent = fs::path(path).parent_path();
+
+	if (!parent.empty())
+		fs::create_directories(parent, error);
+
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".tmp%u", JobSystem::GetThreadIndex());
+	std::string temporary = path + suffix;
+
+	FILE* pFile = fopen(temporary.c_str(), "wb");
+
+	if (pFile == nullptr)
+		return false;
+
+	bool ok = (headerSize == 0 || fwrite(pHeader, 1, headerSize, pFile) == headerSize) &&
+		(data.empty() || fwrite(data.data(), 1, data.size(), pFile) == data.size());
+	ok = fclose(pFile) == 0 && ok;
+
+	if (ok)
+		fs::rename(temporary, path, error);
+
+	if (!ok || error)
+	{
+		fs::remove(temporary, error);
+		return false;
+	}
+
+	return true;
+}
+
+static bool StatFile(const std::string& path, uint64_t& size, int64_t& time)
+{
+	std::error_code error;
+	size = (uint64_t)fs::file_size(path, error);
+
+	if (error)
+		return false;
+
+	time = (int64_t)fs::last_write_time(path, error).time_since_epoch().count();
+
+	return !error;
+}
+
+//--------------------------------------------------------------------------------------
+// CookContext
+//--------------------------------------------------------------------------------------
+uint32_t CookContext::GetInputCount() const
+{
+	return (uint32_t)_pGraph->_nodes[_node].inputs.size();
+}
+
+const std::string& CookContext::GetInputName(uint32_t input) const
+{
+	return _pGraph->_nodes[_pGraph->_nodes[_node].inputs[input]].name;
+}
+
+const std::vector<uint8_t>* CookContext::GetInput(uint32_t input)
+{
+	uint32_t node = _pGraph->_nodes[_node].inputs[input];
+
+	if (!_pGraph->LoadNode(node))
+		return nullptr;
+
+	return &_pGraph->_nodes[node].data;
+}
+
+std::vector<uint8_t>& CookContext::GetOutput()
+{
+	return _pGraph->_nodes[_node].data;
+}
+
+const std::string& CookContext::GetName() const
+{
+	return _pGraph->_nodes[_node].name;
+}
+
+const std::string& CookContext::GetSettings() const
+{
+	return _pGraph->_nodes[_node].settings;
+}
+
+bool CookContext::Fail(const char* format, ...)
+{
+	char message[512];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+
+	_pGraph->_nodes[_node].message = message;
+	_pGraph->_nodes[_node].result = COOK_FAILED;
+
+	return false;
+}
+
+bool CookContext::Skip(const char* format, ...)
+{
+	char message[512];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+
+	_pGraph->_nodes[_node].message = message;
+	_pGraph->_nodes[_node].result = COOK_SKIPPED;
+
+	return false;
+}
+
+//--------------------------------------------------------------------------------------
+// CookGraph
+//--------------------------------------------------------------------------------------
+// Bump when an entry's layout or the meaning of a key changes
+static const uint64_t CookCacheVersion = 1;
+static const uint32_t CookEntryMagic = 0x314B4F43;  // "COK1"
+
+struct CookEntryHeader
+{
+	uint32_t magic;
+	uint32_t reserved;
+	uint64_t key;
+	uint64_t hash;
+	uint64_t size;
+};
+
+CookGraph::CookGraph()
+{
+	_force = false;
+	_readyHead = 0;
+	_finishedCount = 0;
+	_stepCount = 0;
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+bool CookGraph::OpenCache(const char* directory)
+{
+	_cacheDirectory = directory;
+	_stamps.clear();
+
+	std::error_code error;
+	fs::create_directories(_cacheDirectory, error);
+
+	if (!fs::is_directory(_cacheDirectory, error))
+		return false;
+
+	// One line per file: size, time, hash, path
+	FILE* pFile = fopen((_cacheDirectory + "/stamps.txt").c_str(), "rb");
+
+	if (pFile == nullptr)
+		return true;
+
+	char line[4096];
+
+	while (fgets(line, sizeof(line), pFile))
+	{
+		unsigned long long size, hash;
+		long long time;
+		int pathStart = 0;
+
+		if (sscanf(line, "%llu %lld %llx %n", &size, &time, &hash, &pathStart) != 3 || pathStart == 0)
+			continue;
+
+		std::string path = line + pathStart;
+
+		while (!path.empty() && (path.back() == '\n' || path.back() == '\r'))
+			path.pop_back();
+
+		FileStamp stamp = { size, time, hash };
+		_stamps[path] = stamp;
+	}
+
+	fclose(pFile);
+
+	return true;
+}
+
+bool CookGraph::SaveCache()
+{
+	std::string text;
+	char line[128];
+
+	for (const auto& entry : _stamps)
+	{
+		snprintf(line, sizeof(line), "%llu %lld %016llx ", (unsigned long long)entry.second.size, (long long)entry.second.time,
+				 (unsigned long long)entry.second.hash);
+		text += line;
+		text += entry.first;
+		text += '\n';
+	}
+
+	std::vector<uint8_t> data(text.begin(), text.end());
+
+	return WriteFileBytes(_cacheDirectory + "/stamps.txt", nullptr, 0, data);
+}
+
+uint32_t CookGraph::AddSource(const char* path)
+{
+	auto found = _sourceNodes.find(path);
+
+	if (found != _sourceNodes.end())
+		return found->second;
+
+	CookNode node;
+	node.name = path;
+	node.kind = COOK_SOURCE;
+	node.func = nullptr;
+	node.pData = nullptr;
+	node.key = 0;
+	node.hash = 0;
+	node.loaded = false;
+	node.result = COOK_PENDING;
+	node.ms = 0.0;
+	node.remaining = 0;
+	node.pendingDependents = 0;
+
+	uint32_t index = (uint32_t)_nodes.size();
+	_nodes.push_back(node);
+	_sourceNodes[path] = index;
+
+	return index;
+}
+
+uint32_t CookGraph::AddStep(const char* name, CookNodeKind kind, CookFunc func, void* pData, const char* settings,
+							const std::vector<uint32_t>& inputs)
+{
+	std::string identity;
+
+	if (kind == COOK_INTERMEDIATE)
+	{
+		char prefix[64];
+		snprintf(prefix, sizeof(prefix), "%p %p ", (void*)func, pData);
+		identity = prefix;
+		identity += settings;
+
+		for (size_t i = 0; i < inputs.size(); i++)
+			identity += " " + std::to_string(inputs[i]);
+
+		auto found = _intermediates.find(identity);
+
+		if (found != _intermediates.end())
+			return found->second;
+	}
+
+	uint32_t index = (uint32_t)_nodes.size();
+
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		if (inputs[i] >= index)
+			return InvalidCookNode;
+	}
+
+	CookNode node;
+	node.name = name;
+	node.kind = kind;
+	node.func = func;
+	node.pData = pData;
+	node.settings = settings;
+	node.inputs = inputs;
+	node.key = 0;
+	node.hash = 0;
+	node.loaded = false;
+	node.result = COOK_PENDING;
+	node.ms = 0.0;
+	node.remaining = 0;
+	node.pendingDependents = 0;
+
+	_nodes.push_back(node);
+
+	for (size_t i = 0; i < inputs.size(); i++)
+		_nodes[inputs[i]].dependents.push_back(index);
+
+	if (kind == COOK_INTERMEDIATE)
+		_intermediates[identity] = index;
+
+	return index;
+}
+
+std::string CookGraph::GetEntryPath(uint64_t key) const
+{
+	// 256 subdirectories keep any one directory small
+	char name[40];
+	snprintf(name, sizeof(name), "/%02x/%016llx", (unsigned)(key >> 56), (unsigned long long)key);
+
+	return _cacheDirectory + name;
+}
+
+bool CookGraph::ReadEntryHeader(uint64_t key, uint64_t& hash, uint64_t& size) const
+{
+	FILE* pFile = fopen(GetEntryPath(key).c_str(), "rb");
+
+	if (pFile == nullptr)
+		return false;
+
+	CookEntryHeader header;
+	bool ok = fread(&header, sizeof(header), 1, pFile) == 1 && header.magic == CookEntryMagic && header.key == key;
+	fclose(pFile);
+
+	hash = header.hash;
+	size = header.size;
+
+	return ok;
+}
+
+bool CookGraph::ReadEntry(uint64_t key, uint64_t hash, std::vector<uint8_t>& data) const
+{
+	std::vector<uint8_t> file;
+
+	if (!ReadFileBytes(GetEntryPath(key), file) || file.size() < sizeof(CookEntryHeader))
+		return false;
+
+	CookEntryHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+
+	if (header.magic != CookEntryMagic || header.key != key || header.hash != hash || header.size != file.size() - sizeof(header))
+		return false;
+
+	data.assign(file.begin() + sizeof(header), file.end());
+
+	// A damaged entry is a miss, not a wrong result
+	return HashBytes(data.data(), data.size()) == hash;
+}
+
+bool CookGraph::WriteEntry(uint64_t key, uint64_t hash, const std::vector<uint8_t>& data) const
+{
+	CookEntryHeader header = { CookEntryMagic, 0, key, hash, data.size() };
+
+	return WriteFileBytes(GetEntryPath(key), &header, sizeof(header), data);
+}
+
+bool CookGraph::LoadNode(uint32_t index)
+{
+	std::lock_guard<std::mutex> lock(_loadLocks[index % 16]);
+	CookNode& node = _nodes[index];
+
+	if (node.loaded)
+		return true;
+
+	std::vector<uint8_t> data;
+
+	if (node.kind == COOK_SOURCE)
+	{
+		// Hashed at the start of the run, a file edited since then would cook something
+		// that doesn't match its key
+		if (!ReadFileBytes(node.name, data) || HashBytes(data.data(), data.size()) != node.hash)
+			return false;
+	}
+	else if (!ReadEntry(node.key, node.hash, data))
+	{
+		return false;
+	}
+
+	node.data.swap(data);
+	node.loaded = true;
+
+	return true;
+}
+
+void CookGraph::HashSource(uint32_t index)
+{
+	CookNode& node = _nodes[index];
+	FileStamp& stamp = _sourceStamps[index];
+
+	if (!StatFile(node.name, stamp.size, stamp.time))
+	{
+		node.result = COOK_FAILED;
+		node.message = "can't open";
+		return;
+	}
+
+	// Same size and time as last run, trust the hash from then
+	auto found = _stamps.find(node.name);
+
+	if (found != _stamps.end() && found->second.size == stamp.size && found->second.time == stamp.time)
+	{
+		stamp.hash = found->second.hash;
+		node.hash = stamp.hash;
+		node.result = COOK_UP_TO_DATE;
+		return;
+	}
+
+	std::vector<uint8_t> data;
+
+	if (!ReadFileBytes(node.name, data))
+	{
+		node.result = COOK_FAILED;
+		node.message = "can't read";
+		return;
+	}
+
+	stamp.hash = HashBytes(data.data(), data.size());
+	node.hash = stamp.hash;
+	node.result = COOK_BUILT;  // counted as hashed
+}
+
+void CookGraph::HashSources(void* pData, uint32_t begin, uint32_t end)
+{
+	CookGraph* pGraph = static_cast<CookGraph*>(pData);
+
+	for (uint32_t i = begin; i < end; i++)
+	{
+		if (pGraph->_nodes[i].kind == COOK_SOURCE)
+			pGraph->HashSource(i);
+	}
+}
+
+void CookGraph::RunStep(uint32_t index)
+{
+	CookNode& node = _nodes[index];
+	auto start = Clock::now();
+
+	// Anything an input couldn't do, this step can't either
+	for (size_t i = 0; i < node.inputs.size(); i++)
+	{
+		const CookNode& input = _nodes[node.inputs[i]];
+
+		if (input.result == COOK_FAILED || input.result == COOK_SKIPPED)
+		{
+			node.result = input.result;
+			node.message = "needs " + input.name;
+			return;
+		}
+	}
+
+	uint64_t key = HashString(node.settings, CookCacheVersion);
+
+	for (size_t i = 0; i < node.inputs.size(); i++)
+		key = HashBytes(&_nodes[node.inputs[i]].hash, sizeof(uint64_t), key);
+
+	node.key = key;
+
+	uint64_t hash, size;
+
+	if (!_force && ReadEntryHeader(key, hash, size))
+	{
+		node.hash = hash;
+		node.result = COOK_CACHED;
+
+		if (node.kind == COOK_OUTPUT)
+		{
+			uint64_t fileSize;
+			int64_t fileTime;
+			bool current = false;
+
+			if (StatFile(node.name, fileSize, fileTime))
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				auto found = _stamps.find(node.name);
+				current = found != _stamps.end() && found->second.size == fileSize && found->second.time == fileTime &&
+					found->second.hash == hash;
+			}
+
+			if (current)
+			{
+				node.result = COOK_UP_TO_DATE;
+			}
+			else if (!LoadNode(index) || !WriteFileBytes(node.name, nullptr, 0, node.data))
+			{
+				node.result = COOK_FAILED;
+				node.message = "can't copy from the cache";
+			}
+			else
+			{
+				StampOutput(node);
+			}
+		}
+
+		node.ms = Milliseconds(start);
+
+		if (node.result != COOK_FAILED)
+			return;
+	}
+
+	// Built from scratch
+	node.result = COOK_PENDING;
+	node.data.clear();
+
+	CookContext context(this, index);
+
+	if (!node.func(context, node.pData))
+	{
+		if (node.result == COOK_PENDING)
+		{
+			node.result = COOK_FAILED;
+			node.message = "failed";
+		}
+
+		node.ms = Milliseconds(start);
+		return;
+	}
+
+	node.hash = HashBytes(node.data.data(), node.data.size());
+	node.loaded = true;
+	node.result = COOK_BUILT;
+
+	if (!WriteEntry(key, node.hash, node.data))
+		node.message = "not cached, can't write the entry";
+
+	if (node.kind == COOK_OUTPUT)
+	{
+		if (WriteFileBytes(node.name, nullptr, 0, node.data))
+		{
+			StampOutput(node);
+		}
+		else
+		{
+			node.result = COOK_FAILED;
+			node.message = "can't write";
+		}
+	}
+
+	node.ms = Milliseconds(start);
+}
+
+void CookGraph::StampOutput(const CookNode& node)
+{
+	FileStamp stamp;
+	stamp.hash = node.hash;
+
+	if (StatFile(node.name, stamp.size, stamp.time))
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stamps[node.name] = stamp;
+	}
+}
+
+void CookGraph::Drain()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	for (;;)
+	{
+		_changed.wait(lock, [&]() { return _finishedCount == _stepCount || _readyHead != _ready.size(); });
+
+		if (_finishedCount == _stepCount)
+			return;
+
+		uint32_t index = _ready[_readyHead++];
+
+		lock.unlock();
+		RunStep(index);
+		lock.lock();
+
+		_finishedCount++;
+
+		CookNode& node = _nodes[index];
+
+		for (size_t i = 0; i < node.dependents.size(); i++)
+		{
+			CookNode& dependent = _nodes[node.dependents[i]];
+
+			if (--dependent.remaining == 0)
+				_ready.push_back(node.dependents[i]);
+		}
+
+		// Inputs nobody else needs any more are dropped, so a big cook only holds what
+		// is still in flight
+		for (size_t i = 0; i < node.inputs.size(); i++)
+		{
+			CookNode& input = _nodes[node.inputs[i]];
+
+			if (--input.pendingDependents == 0)
+			{
+				std::vector<uint8_t>().swap(input.data);
+				input.loaded = false;
+			}
+		}
+
+		if (node.pendingDependents == 0)
+		{
+			std::vector<uint8_t>().swap(node.data);
+			node.loaded = false;
+		}
+
+		_changed.notify_all();
+	}
+}
+
+void CookGraph::DrainWorkers(void* pData, uint32_t, uint32_t)
+{
+	static_cast<CookGraph*>(pData)->Drain();
+}
+
+bool CookGraph::Run(JobSystem* pJobSystem, bool force)
+{
+	auto start = Clock::now();
+
+	_force = force;
+	memset(&_stats, 0, sizeof(_stats));
+
+	// Sources first, every one stat'ed and only the changed ones read
+	_sourceStamps.assign(_nodes.size(), FileStamp());
+
+	if (pJobSystem)
+		pJobSystem->ParallelFor((uint32_t)_nodes.size(), 4, &CookGraph::HashSources, this);
+	else
+		HashSources(this, 0, (uint32_t)_nodes.size());
+
+	_ready.clear();
+	_readyHead = 0;
+	_finishedCount = 0;
+	_stepCount = 0;
+
+	for (uint32_t i = 0; i < _nodes.size(); i++)
+	{
+		CookNode& node = _nodes[i];
+		node.pendingDependents = (uint32_t)node.dependents.size();
+		node.loaded = false;
+		node.data.clear();
+
+		if (node.kind == COOK_SOURCE)
+		{
+			if (node.result == COOK_BUILT)
+				_stats.sourcesHashed++;
+
+			if (node.result != COOK_FAILED)
+				_stamps[node.name] = _sourceStamps[i];
+
+			continue;
+		}
+
+		node.result = COOK_PENDING;
+		node.message.clear();
+		node.remaining = 0;
+
+		for (size_t d = 0; d < node.inputs.size(); d++)
+		{
+			if (_nodes[node.inputs[d]].kind != COOK_SOURCE)
+				node.remaining++;
+		}
+
+		if (node.remaining == 0)
+			_ready.push_back(i);
+
+		_stepCount++;
+	}
+
+	_stats.hashMs = Milliseconds(start);
+
+	// One drain loop per worker, the calling thread runs its own next to them
+	if (pJobSystem && _stepCount > 0)
+	{
+		pJobSystem->Dispatch(pJobSystem->GetWorkerCount(), 1, &CookGraph::DrainWorkers, this);
+		Drain();
+		pJobSystem->Wait();
+	}
+	else
+	{
+		Drain();
+	}
+
+	for (uint32_t i = 0; i < _nodes.size(); i++)
+	{
+		const CookNode& node = _nodes[i];
+
+		if (node.kind == COOK_SOURCE)
+			continue;
+
+		_stats.steps++;
+
+		switch (node.result)
+		{
+		case COOK_UP_TO_DATE: _stats.upToDate++; break;
+		case COOK_CACHED:     _stats.cached++; break;
+		case COOK_BUILT:      _stats.built++; break;
+		case COOK_SKIPPED:    _stats.skipped++; break;
+		default:              _stats.failed++; break;
+		}
+	}
+
+	_stats.totalMs = Milliseconds(start);
+
+	return _stats.failed == 0;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class JobSystem;
+class CookGraph;
+
+// 64 bit content hash, four independent lanes so long inputs hash at memory speed
+uint64_t HashBytes(const void* pData, size_t size, uint64_t seed = 0);
+
+const uint32_t InvalidCookNode = 0xFFFFFFFF;
+
+enum CookNodeKind
+{
+	COOK_SOURCE,        // a file on disk, hashed but never built
+	COOK_INTERMEDIATE,  // built into the cache only, for other steps to read
+	COOK_OUTPUT,        // built into the cache and written to its path
+};
+
+enum CookResult
+{
+	COOK_PENDING,
+	COOK_UP_TO_DATE,  // output on disk already matches the cache entry
+	COOK_CACHED,      // found in the cache, output copied from it if needed
+	COOK_BUILT,
+	COOK_SKIPPED,     // the step, or something it needs, can't run on this machine
+	COOK_FAILED,
+};
+
+//--------------------------------------------------------------------------------------
+// What a step's function sees: its inputs, loaded on first use, and its output.
+//--------------------------------------------------------------------------------------
+class CookContext
+{
+private:
+	CookGraph* _pGraph;
+	uint32_t   _node;
+
+public:
+	CookContext(CookGraph* pGraph, uint32_t node) : _pGraph(pGraph), _node(node) {}
+
+	uint32_t GetInputCount() const;
+	const std::string& GetInputName(uint32_t input) const;
+
+	// Null when the input can't be read or no longer matches the hash it was keyed with
+	const std::vector<uint8_t>* GetInput(uint32_t input);
+
+	std::vector<uint8_t>& GetOutput();
+	const std::string& GetName() const;
+	const std::string& GetSettings() const;
+
+	// For messages in the report, returns false so functions can "return Fail(...)"
+	bool Fail(const char* format, ...);
+	bool Skip(const char* format, ...);
+};
+
+typedef bool (*CookFunc)(CookContext& context, void* pData);
+
+struct CookNode
+{
+	std::string           name;      // path for sources and outputs
+	CookNodeKind          kind;
+	CookFunc              func;
+	void*                 pData;
+	std::string           settings;  // all that changes the result besides the inputs, the step reads it
+	std::vector<uint32_t> inputs;
+	std::vector<uint32_t> dependents;
+
+	uint64_t              key;       // settings and input hashes, names the cache entry
+	uint64_t              hash;      // content of the result
+	std::vector<uint8_t>  data;
+	bool                  loaded;
+	CookResult            result;
+	double                ms;
+	std::string           message;
+
+	uint32_t              remaining;         // inputs still to finish
+	uint32_t              pendingDependents; // data is dropped once this reaches 0
+};
+
+struct CookStats
+{
+	uint32_t steps;
+	uint32_t upToDate;
+	uint32_t cached;
+	uint32_t built;
+	uint32_t skipped;
+	uint32_t failed;
+	uint32_t sourcesHashed;  // sources read because their size or time changed
+	double   hashMs;
+	double   totalMs;
+};
+
+//--------------------------------------------------------------------------------------
+// Incremental build graph: sources feed steps, steps feed other steps. A step's cache
+// key is the hash of its settings and of the content of its inputs, so a step whose
+// inputs were rebuilt to the same bytes is still a cache hit. Sources are only re-read
+// when their size or modification time changed since the last run. Ready steps are
+// pulled by every job system thread; a failed step fails its dependents but the rest
+// of the graph still builds.
+//--------------------------------------------------------------------------------------
+class CookGraph
+{
+private:
+	friend class CookContext;
+
+	struct FileStamp
+	{
+		uint64_t size;
+		int64_t  time;
+		uint64_t hash;
+	};
+
+	std::vector<CookNode>                      _nodes;
+	std::unordered_map<std::string, uint32_t>  _sourceNodes;
+	std::unordered_map<std::string, uint32_t>  _intermediates;  // by function, settings and inputs
+	std::unordered_map<std::string, FileStamp> _stamps;         // by path, sources and outputs
+	std::vector<FileStamp>                     _sourceStamps;   // per node, from this run
+	std::string                                _cacheDirectory;
+	bool                                       _force;
+
+	std::mutex              _mutex;
+	std::condition_variable _changed;
+	std::vector<uint32_t>   _ready;
+	uint32_t                _readyHead;
+	uint32_t                _finishedCount;
+	uint32_t                _stepCount;
+	std::mutex              _loadLocks[16];  // striped by node so loads of one input happen once
+
+	CookStats _stats;
+
+private:
+	std::string GetEntryPath(uint64_t key) const;
+	bool ReadEntryHeader(uint64_t key, uint64_t& hash, uint64_t& size) const;
+	bool ReadEntry(uint64_t key, uint64_t hash, std::vector<uint8_t>& data) const;
+	bool WriteEntry(uint64_t key, uint64_t hash, const std::vector<uint8_t>& data) const;
+	bool LoadNode(uint32_t node);
+	void HashSource(uint32_t node);
+	void RunStep(uint32_t node);
+	void StampOutput(const CookNode& node);
+	void Drain();
+
+	static void HashSources(void* pData, uint32_t begin, uint32_t end);
+	static void DrainWorkers(void* pData, uint32_t begin, uint32_t end);
+
+public:
+	CookGraph();
+
+	CookGraph(const CookGraph&) = delete;
+	CookGraph& operator=(const CookGraph&) = delete;
+
+	// Creates the directory if needed and loads the file stamps of the last run
+	bool OpenCache(const char* directory);
+	bool SaveCache();
+
+	// Same path, same node
+	uint32_t AddSource(const char* path);
+
+	// Inputs are earlier nodes, which keeps the graph acyclic. Intermediates with the same
+	// function, settings and inputs are only added once, the existing node is returned.
+	uint32_t AddStep(const char* name, CookNodeKind kind, CookFunc func, void* pData, const char* settings,
+					 const std::vector<uint32_t>& inputs);
+
+	// force ignores the cache and builds every step
+	bool Run(JobSystem* pJobSystem, bool force);
+
+	uint32_t GetNodeCount() const { return (uint32_t)_nodes.size(); }
+	const CookNode& GetNode(uint32_t node) const { return _nodes[node]; }
+	const CookStats& GetStats() const { return _stats; }
+};
@@ -0,0 +1,470 @@
+//--------------------------------------------------------------------------------------
+// Offline lightmap and AO baker. Unwraps the static entities of a text scene into one
+// atlas, traces bounced light, AO and sky on every core, denoises and writes the unwrap
+// next to a BC7 texture the framework loads at startup. The bench builds a room of
+// cubes, checks the BVH against brute force and reports rays per second.
+//
+//   g++ -std=c++17 -O2 -msse2 lightbaker.cpp texturecompress.cpp textureimage.cpp ../lightmapper.cpp ../raytrace.cpp
+//       ../builtinmeshes.cpp ../collision.cpp ../scene.cpp ../scenecompiler.cpp ../jobsystem.cpp -lpthread
+//
+//   lightbaker bake scene.txt lightmap.bin lightmap.dds [options]
+//     --density N        texels per world unit, default 8
+//     --size N           largest atlas side, default 2048
+//     --rays N           rays per texel per bounce, default 128
+//     --bounces N        default 2, 0 for AO and sky only
+//     --ao N             distance that counts as occluded, default 2
+//     --ambient r g b    sky colour, default the old constant 0.2
+//     --threads N        threads to use, default all cores
+//   lightbaker bench [cubes]
+//--------------------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "texturecompress.h"
+#include "textureimage.h"
+#include "../builtinmeshes.h"
+#include "../jobsystem.h"
+#include "../lightmapper.h"
+#include "../raytrace.h"
+#include "../scenecompiler.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Milliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static uint32_t s_random = 12345;
+
+static float RandomFloat(float low, float high)
+{
+	s_random = s_random * 1664525u + 1013904223u;
+	return low + (high - low) * ((s_random >> 8) / 16777216.0f);
+}
+
+static bool ReadWholeFile(const char* path, std::vector<uint8_t>& data)
+{
+	FILE* file = fopen(path, "rb");
+
+	if (file == nullptr)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	data.resize(size > 0 ? (size_t)size : 0);
+	bool ok = size >= 0 && fread(data.data(), 1, data.size(), file) == data.size();
+	fclose(file);
+
+	return ok;
+}
+
+static bool WriteWholeFile(const char* path, const std::vector<uint8_t>& data)
+{
+	FILE* file = fopen(path, "wb");
+
+	if (file == nullptr)
+		return false;
+
+	bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+
+	return fclose(file) == 0 && ok;
+}
+
+static void AddBuiltinInstance(LightmapBaker& baker, const char* name, const BuiltinMesh& mesh, const Mat4& world, const Vec3& albedo)
+{
+	LightmapInstance instance;
+	instance.nameHash = HashSceneName(name);
+	instance.meshHash = HashSceneName(mesh.name);
+	instance.pPositions = &mesh.pVertices[0].position;
+	instance.pNormals = &mesh.pVertices[0].normal;
+	instance.vertexStride = sizeof(MeshVertex);
+	instance.vertexCount = mesh.vertexCount;
+	instance.pIndices = mesh.pIndices;
+	instance.indexCount = mesh.indexCount;
+	instance.world = world;
+	instance.albedo = albedo;
+
+	baker.AddInstance(instance);
+}
+
+static void PrintStats(const LightmapBaker& baker, const Lightmap& lightmap)
+{
+	const LightmapStats& stats = baker.GetStats();
+
+	printf("  %u triangles in %u charts, %ux%u atlas with %u texels covered\n", stats.triangles, stats.charts,
+		   lightmap.width, lightmap.height, stats.texels);
+	printf("  unwrap %.1f ms, bvh %.1f ms, direct %.1f ms, bounces %.1f ms, denoise %.1f ms, total %.1f ms\n",
+		   stats.unwrapMs, stats.bvhMs, stats.directMs, stats.indirectMs, stats.denoiseMs, stats.totalMs);
+	printf("  %.2f M rays, %.2f M rays/s\n", stats.rays / 1.0e6, stats.raysPerSecond / 1.0e6);
+}
+
+static int Bake(const char* scenePath, const char* mapPath, const char* texturePath, const LightmapSettings& settings, JobSystem* pJobSystem)
+{
+	std::vector<uint8_t> text;
+
+	if (!ReadWholeFile(scenePath, text))
+	{
+		fprintf(stderr, "%s: can't read\n", scenePath);
+		return 1;
+	}
+
+	text.push_back(0);
+
+	SceneDescription description;
+	char error[256];
+
+	if (!ParseSceneText((const char*)text.data(), description, error, sizeof(error)))
+	{
+		fprintf(stderr, "%s: %s\n", scenePath, error);
+		return 1;
+	}
+
+	LightmapBaker baker;
+	uint32_t instanceCount = 0;
+
+	for (const SceneDescEntity& entity : description.entities)
+	{
+		// Anything that can move keeps the dynamic lighting only
+		if ((entity.flags & SCENE_ENTITY_STATIC) == 0 || (entity.flags & SCENE_ENTITY_HIDDEN) != 0)
+			continue;
+
+		const BuiltinMesh* pMesh = FindBuiltinMesh(entity.mesh.c_str());
+
+		if (pMesh == nullptr)
+		{
+			fprintf(stderr, "%s: entity %s uses mesh %s which isn't built in, skipped\n", scenePath, entity.name.c_str(), entity.mesh.c_str());
+			continue;
+		}
+
+		Vec3 albedo(1.0f, 1.0f, 1.0f);
+
+		for (const SceneDescMaterial& material : description.materials)
+		{
+			if (material.name == entity.material)
+				albedo = Vec3(material.data.diffuse[0], material.data.diffuse[1], material.data.diffuse[2]);
+		}
+
+		AddBuiltinInstance(baker, entity.name.c_str(), *pMesh, ComposeSceneTransform(entity.transform), albedo);
+		instanceCount++;
+	}
+
+	for (const SceneDescLight& light : description.lights)
+		baker.AddLight(light.data);
+
+	Lightmap lightmap;
+
+	if (!baker.Bake(settings, pJobSystem, lightmap, error, sizeof(error)))
+	{
+		fprintf(stderr, "%s: %s\n", scenePath, error);
+		return 1;
+	}
+
+	std::vector<uint8_t> pixels;
+	EncodeLightmap(lightmap, pixels);
+
+	auto encodeStart = Clock::now();
+
+	std::vector<uint8_t> blocks((size_t)((lightmap.width + 3) / 4) * ((lightmap.height + 3) / 4) * GetBlockBytes(BLOCK_BC7));
+	CompressImage(pixels.data(), lightmap.width, lightmap.height, BLOCK_BC7, pJobSystem, blocks.data());
+
+	double encodeMs = Milliseconds(encodeStart);
+
+	std::vector<uint8_t> file;
+	WriteLightmap(lightmap, file);
+
+	if (!WriteWholeFile(mapPath, file))
+	{
+		fprintf(stderr, "%s: can't write\n", mapPath);
+		return 1;
+	}
+
+	if (!WriteDDS(texturePath, lightmap.width, lightmap.height, 1, GetDXGIFormat(BLOCK_BC7, false), blocks.data(), blocks.size()))
+	{
+		fprintf(stderr, "%s: can't write\n", texturePath);
+		return 1;
+	}
+
+	printf("%s -> %s, %s: %u static entities, %zu lights\n", scenePath, mapPath, texturePath, instanceCount, description.lights.size());
+	PrintStats(baker, lightmap);
+	printf("  BC7 %.1f ms, %.1f KB\n", encodeMs, blocks.size() / 1024.0);
+
+	return 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Bench
+//--------------------------------------------------------------------------------------
+static bool BruteForceIntersect(const std::vector<Vec3>& positions, const Vec3& origin, const Vec3& direction, float tMax, RayHit& hit)
+{
+	hit.t = tMax;
+	hit.triangle = RayInvalidTriangle;
+
+	for (uint32_t i = 0; i < (uint32_t)positions.size() / 3; i++)
+	{
+		const Vec3& a = positions[i * 3];
+		Vec3 e1 = positions[i * 3 + 1] - a;
+		Vec3 e2 = positions[i * 3 + 2] - a;
+
+		Vec3 p = Cross(direction, e2);
+		float det = Dot(e1, p);
+
+		if (fabsf(det) <= 1.0e-12f)
+			continue;
+
+		float invDet = 1.0f / det;
+		Vec3 s = origin - a;
+		float u = Dot(s, p) * invDet;
+		Vec3 q = Cross(s, e1);
+		float v = Dot(direction, q) * invDet;
+		float t = Dot(e2, q) * invDet;
+
+		if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t <= hit.t)
+		{
+			hit.t = t;
+			hit.u = u;
+			hit.v = v;
+			hit.triangle = i;
+		}
+	}
+
+	return hit.triangle != RayInvalidTriangle;
+}
+
+static Mat4 BoxTransform(const Vec3& position, const Vec3& scale)
+{
+	SceneTransform transform;
+	transform.position = position;
+	transform.rotation[0] = transform.rotation[1] = transform.rotation[2] = 0.0f;
+	transform.rotation[3] = 1.0f;
+	transform.scale = scale;
+
+	return ComposeSceneTransform(transform);
+}
+
+static int Bench(uint32_t cubes, JobSystem& jobSystem)
+{
+	// A floor and four walls around a field of cubes, lit by a sun and a few point lights
+	LightmapBaker baker;
+	std::vector<Vec3> positions;
+	float side = sqrtf((float)cubes) * 3.0f + 4.0f;
+
+	auto add = [&](const char* name, const BuiltinMesh& mesh, const Mat4& world, const Vec3& albedo)
+	{
+		AddBuiltinInstance(baker, name, mesh, world, albedo);
+
+		for (uint32_t i = 0; i < mesh.indexCount; i++)
+			positions.push_back(TransformPoint(mesh.pVertices[mesh.pIndices[i]].position, world));
+	};
+
+	add("floor", BuiltinFloor, BoxTransform(Vec3(0.0f, 2.0f, 0.0f), Vec3(side / 4.0f, 1.0f, side / 4.0f)), Vec3(0.8f, 0.8f, 0.8f));
+	add("wallx0", BuiltinCube, BoxTransform(Vec3(-side * 0.5f, 2.0f, 0.0f), Vec3(0.1f, 2.0f, side * 0.5f)), Vec3(0.8f, 0.2f, 0.2f));
+	add("wallx1", BuiltinCube, BoxTransform(Vec3(side * 0.5f, 2.0f, 0.0f), Vec3(0.1f, 2.0f, side * 0.5f)), Vec3(0.2f, 0.8f, 0.2f));
+	add("wallz0", BuiltinCube, BoxTransform(Vec3(0.0f, 2.0f, -side * 0.5f), Vec3(side * 0.5f, 2.0f, 0.1f)), Vec3(0.8f, 0.8f, 0.8f));
+	add("wallz1", BuiltinCube, BoxTransform(Vec3(0.0f, 2.0f, side * 0.5f), Vec3(side * 0.5f, 2.0f, 0.1f)), Vec3(0.8f, 0.8f, 0.8f));
+
+	for (uint32_t i = 0; i < cubes; i++)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "cube%u", i);
+
+		float size = RandomFloat(0.25f, 0.75f);
+		Vec3 position(RandomFloat(-side * 0.4f, side * 0.4f), size, RandomFloat(-side * 0.4f, side * 0.4f));
+		add(name, BuiltinCube, BoxTransform(position, Vec3(size, size, size)), Vec3(RandomFloat(0.2f, 0.9f), RandomFloat(0.2f, 0.9f), RandomFloat(0.2f, 0.9f)));
+	}
+
+	SceneLight sun = SceneLight();
+	sun.type = SCENE_LIGHT_DIRECTIONAL;
+	sun.direction = Normalize(Vec3(0.3f, -1.0f, 0.2f));
+	sun.color = Vec3(1.0f, 0.95f, 0.9f);
+	sun.intensity = 1.0f;
+	baker.AddLight(sun);
+
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		SceneLight light = SceneLight();
+		light.type = SCENE_LIGHT_POINT;
+		light.position = Vec3(RandomFloat(-side * 0.4f, side * 0.4f), 2.0f, RandomFloat(-side * 0.4f, side * 0.4f));
+		light.color = Vec3(RandomFloat(0.2f, 1.0f), RandomFloat(0.2f, 1.0f), RandomFloat(0.2f, 1.0f));
+		light.intensity = 2.0f;
+		light.range = 6.0f;
+		baker.AddLight(light);
+	}
+
+	uint32_t triangleCount = (uint32_t)positions.size() / 3;
+
+	// Closest hits have to match brute force, any hits have to agree on whether there is one
+	TriangleBvh bvh;
+	bvh.Build(positions.data(), triangleCount);
+
+	const BvhStats& bvhStats = bvh.GetStats();
+	printf("bvh: %u triangles, %u nodes, %u leaves, depth %u, built in %.2f ms\n", bvhStats.triangles, bvhStats.nodes,
+		   bvhStats.leaves, bvhStats.maxDepth, bvhStats.buildMs);
+
+	const uint32_t CheckRays = 20000;
+	uint32_t mismatches = 0;
+	uint32_t hits = 0;
+
+	for (uint32_t i = 0; i < CheckRays; i++)
+	{
+		Vec3 origin(RandomFloat(-side * 0.5f, side * 0.5f), RandomFloat(0.0f, 4.0f), RandomFloat(-side * 0.5f, side * 0.5f));
+		Vec3 direction = Normalize(Vec3(RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f)));
+		float tMax = i % 2 ? 1.0e30f : RandomFloat(0.5f, 4.0f);
+
+		RayHit expected, actual;
+		bool expectedHit = BruteForceIntersect(positions, origin, direction, tMax, expected);
+		bool actualHit = bvh.Intersect(origin, direction, tMax, actual);
+
+		// Ties between triangles sharing an edge may go either way, the distance may not
+		bool same = expectedHit == actualHit && (!expectedHit || fabsf(expected.t - actual.t) <= 1.0e-4f * (1.0f + expected.t));
+
+		if (!same || bvh.Occluded(origin, direction, tMax) != expectedHit)
+		{
+			if (mismatches++ < 5)
+				printf("  mismatch: ray %u, brute force %s t %.5f, bvh %s t %.5f\n", i, expectedHit ? "hit" : "miss", expected.t,
+					   actualHit ? "hit" : "miss", actual.t);
+		}
+
+		hits += expectedHit ? 1 : 0;
+	}
+
+	printf("check: %u rays against brute force, %u hits, %u mismatches\n", CheckRays, hits, mismatches);
+
+	// Raw closest hit throughput on one thread
+	const uint32_t SpeedRays = 1000000;
+	std::vector<Vec3> origins(SpeedRays), directions(SpeedRays);
+
+	for (uint32_t i = 0; i < SpeedRays; i++)
+	{
+		origins[i] = Vec3(RandomFloat(-side * 0.45f, side * 0.45f), RandomFloat(0.1f, 3.9f), RandomFloat(-side * 0.45f, side * 0.45f));
+		directions[i] = Normalize(Vec3(RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f)));
+	}
+
+	auto start = Clock::now();
+	uint32_t speedHits = 0;
+
+	for (uint32_t i = 0; i < SpeedRays; i++)
+	{
+		RayHit hit;
+		speedHits += bvh.Intersect(origins[i], directions[i], 1.0e30f, hit) ? 1 : 0;
+	}
+
+	double singleMs = Milliseconds(start);
+	printf("trace: %u closest hit rays on one thread in %.1f ms, %.2f M rays/s (%u hits)\n", SpeedRays, singleMs,
+		   SpeedRays / (singleMs * 1000.0), speedHits);
+
+	LightmapSettings settings;
+	InitLightmapSettings(settings);
+	settings.texelsPerUnit = 4.0f;
+	settings.raysPerTexel = 64;
+
+	Lightmap lightmap;
+	char error[256];
+
+	if (!baker.Bake(settings, &jobSystem, lightmap, error, sizeof(error)))
+	{
+		fprintf(stderr, "bake failed: %s\n", error);
+		return 1;
+	}
+
+	printf("bake: %u instances on %u threads\n", cubes + 5, jobSystem.GetWorkerCount() + 1);
+	PrintStats(baker, lightmap);
+
+	// The unwrap has to survive the file
+	std::vector<uint8_t> file;
+	WriteLightmap(lightmap, file);
+
+	Lightmap parsed;
+	bool roundTrip = ParseLightmap(file.data(), file.size(), parsed) && parsed.entities.size() == lightmap.entities.size() &&
+					 parsed.width == lightmap.width && parsed.height == lightmap.height;
+
+	for (size_t i = 0; roundTrip && i < parsed.entities.size(); i++)
+	{
+		roundTrip = parsed.entities[i].nameHash == lightmap.entities[i].nameHash &&
+					parsed.entities[i].indices == lightmap.entities[i].indices && parsed.entities[i].uvs == lightmap.entities[i].uvs;
+	}
+
+	printf("file: %.1f KB, round trip %s\n", file.size() / 1024.0, roundTrip ? "ok" : "FAILED");
+
+	return mismatches == 0 && roundTrip ? 0 : 1;
+}
+
+static void PrintUsage()
+{
+	printf("lightbaker bake scene.txt lightmap.bin lightmap.dds [--density N] [--size N] [--rays N] [--bounces N]\n"
+		   "                [--ao N] [--ambient r g b] [--threads N]\n"
+		   "lightbaker bench [cubes]\n");
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc >= 2 && strcmp(argv[1], "bench") == 0)
+	{
+		JobSystem jobSystem;
+		jobSystem.Init();
+
+		int result = Bench(argc >= 3 ? (uint32_t)atoi(argv[2]) : 200, jobSystem);
+
+		jobSystem.Shutdown();
+
+		return result;
+	}
+
+	if (argc < 5 || strcmp(argv[1], "bake") != 0)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	LightmapSettings settings;
+	InitLightmapSettings(settings);
+	int threads = -1;
+
+	for (int i = 5; i < argc; i++)
+	{
+		const char* arg = argv[i];
+
+		if (strcmp(arg, "--density") == 0 && i + 1 < argc)
+			settings.texelsPerUnit = (float)atof(argv[++i]);
+		else if (strcmp(arg, "--size") == 0 && i + 1 < argc)
+			settings.maxSize = (uint32_t)atoi(argv[++i]);
+		else if (strcmp(arg, "--rays") == 0 && i + 1 < argc)
+			settings.raysPerTexel = (uint32_t)atoi(argv[++i]);
+		else if (strcmp(arg, "--bounces") == 0 && i + 1 < argc)
+			settings.bounces = (uint32_t)atoi(argv[++i]);
+		else if (strcmp(arg, "--ao") == 0 && i + 1 < argc)
+			settings.aoDistance = (float)atof(argv[++i]);
+		else if (strcmp(arg, "--ambient") == 0 && i + 3 < argc)
+		{
+			settings.skyColor.x = (float)atof(argv[++i]);
+			settings.skyColor.y = (float)atof(argv[++i]);
+			settings.skyColor.z = (float)atof(argv[++i]);
+		}
+		else if (strcmp(arg, "--threads") == 0 && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	// The calling thread works too, so N threads means N - 1 workers
+	JobSystem jobSystem;
+
+	if (threads != 1)
+		jobSystem.Init(threads > 1 ? (uint32_t)threads - 1 : 0);
+
+	int result = Bake(argv[2], argv[3], argv[4], settings, threads == 1 ? nullptr : &jobSystem);
+
+	jobSystem.Shutdown();
+
+	return result;
+}
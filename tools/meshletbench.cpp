@@ -0,0 +1,219 @@
+//--------------------------------------------------------------------------------------
+// Meshlet build and cull benchmark. Splits a dense sphere into meshlets, culls it from a
+// ring of cameras on one thread and on every core, and reports triangles rejected per
+// millisecond. Every culled meshlet is checked: frustum culled ones must lie wholly
+// outside one clip plane and cone culled ones must only hold back facing triangles.
+// With the cone test off, for materials drawn two sided or front face culled, only the
+// frustum may remove meshlets.
+//
+//   g++ -std=c++17 -O2 -msse2 meshletbench.cpp ../meshlet.cpp ../jobsystem.cpp -lpthread
+//
+//   meshletbench [segments] [iterations]
+//--------------------------------------------------------------------------------------
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "../meshlet.h"
+#include "../jobsystem.h"
+
+// UV sphere with clockwise front faces, seen from outside
+static void BuildSphere(uint32_t segments, std::vector<Vec3>& positions, std::vector<uint32_t>& indices)
+{
+	uint32_t rings = segments / 2;
+	const float pi = 3.14159265f;
+
+	for (uint32_t r = 0; r <= rings; r++)
+	{
+		float phi = pi * r / rings;
+
+		for (uint32_t s = 0; s <= segments; s++)
+		{
+			float theta = 2.0f * pi * s / segments;
+			positions.push_back(Vec3(sinf(phi) * cosf(theta), cosf(phi), sinf(phi) * sinf(theta)));
+		}
+	}
+
+	for (uint32_t r = 0; r < rings; r++)
+	{
+		for (uint32_t s = 0; s < segments; s++)
+		{
+			uint32_t a = r * (segments + 1) + s;
+			uint32_t b = a + segments + 1;
+
+			if (r != 0)
+			{
+				indices.push_back(a);
+				indices.push_back(a + 1);
+				indices.push_back(b);
+			}
+
+			if (r != rings - 1)
+			{
+				indices.push_back(a + 1);
+				indices.push_back(b + 1);
+				indices.push_back(b);
+			}
+		}
+	}
+}
+
+static bool IsBackFacing(const Vec3& p0, const Vec3& p1, const Vec3& p2, const Vec3& eye)
+{
+	return Dot(p0 - eye, Cross(p1 - p0, p2 - p0)) >= 0.0f;
+}
+
+// Counts culled meshlets that contradict their classification
+static uint32_t Validate(const MeshletMesh& mesh, const MeshletCuller& culler, const std::vector<Vec3>& positions,
+						 const Mat4& world, const Mat4& viewProjection, const Vec3& eye, bool coneCull)
+{
+	Mat4 wvp = Multiply(world, viewProjection);
+	Vec3 localEye = TransformPoint(eye, Inverse(world));
+	uint32_t errors = 0;
+
+	for (size_t m = 0; m < mesh.meshlets.size(); m++)
+	{
+		if (culler.IsVisible((uint32_t)m))
+			continue;
+
+		const Meshlet& meshlet = mesh.meshlets[m];
+		const uint32_t* pVertices = &mesh.vertices[meshlet.vertexOffset];
+		const uint8_t* pTriangles = &mesh.triangles[meshlet.triangleOffset];
+
+		// Outside test in clip space, one bit per plane a vertex is beyond
+		uint32_t outsideAll = 0x3F;
+
+		for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+		{
+			const Vec3& p = positions[pVertices[i]];
+			float clip[4];
+
+			for (int c = 0; c < 4; c++)
+				clip[c] = p.x * wvp.m[0][c] + p.y * wvp.m[1][c] + p.z * wvp.m[2][c] + wvp.m[3][c];
+
+			uint32_t outside = (clip[0] < -clip[3]) | (clip[0] > clip[3]) << 1 | (clip[1] < -clip[3]) << 2 |
+							   (clip[1] > clip[3]) << 3 | (clip[2] < 0.0f) << 4 | (clip[2] > clip[3]) << 5;
+			outsideAll &= outside;
+		}
+
+		bool allBackFacing = true;
+
+		for (uint32_t t = 0; t < meshlet.triangleCount && allBackFacing; t++)
+		{
+			allBackFacing = IsBackFacing(positions[pVertices[pTriangles[t * 3 + 0]]], positions[pVertices[pTriangles[t * 3 + 1]]],
+										 positions[pVertices[pTriangles[t * 3 + 2]]], localEye);
+		}
+
+		if (outsideAll == 0 && (!allBackFacing || !coneCull))
+			errors++;
+	}
+
+	return errors;
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t segments = argc > 1 ? (uint32_t)atoi(argv[1]) : 1024;
+	int iterations = argc > 2 ? atoi(argv[2]) : 50;
+
+	std::vector<Vec3> positions;
+	std::vector<uint32_t> indices;
+	BuildSphere(segments < 8 ? 8 : segments, positions, indices);
+
+	auto buildStart = std::chrono::high_resolution_clock::now();
+
+	MeshletMesh mesh;
+	BuildMeshlets(&positions[0].x, sizeof(Vec3), (uint32_t)positions.size(), indices.data(), (uint32_t)indices.size(), mesh);
+
+	double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - buildStart).count();
+
+	uint32_t coneCapable = 0;
+	for (size_t m = 0; m < mesh.meshlets.size(); m++)
+		coneCapable += mesh.meshlets[m].coneCutoff <= 1.0f;
+
+	printf("%zu triangles, %zu vertices -> %zu meshlets (%.1f tris avg, %u with a usable cone) in %.1f ms\n",
+		   indices.size() / 3, positions.size(), mesh.meshlets.size(), indices.size() / 3.0 / mesh.meshlets.size(),
+		   coneCapable, buildMs);
+
+	// The expanded list must hold every source triangle exactly once
+	std::vector<uint32_t> expanded;
+	mesh.ExpandIndices(expanded);
+
+	if (expanded.size() != indices.size())
+	{
+		printf("FAIL: expanded %zu indices, source has %zu\n", expanded.size(), indices.size());
+		return 1;
+	}
+
+	JobSystem jobSystem;
+	jobSystem.Init();
+
+	Mat4 world = Mat4::Identity();
+	Mat4 projection = PerspectiveFovLH(3.14159265f / 4.0f, 16.0f / 9.0f, 0.01f, 100.0f);
+	uint32_t totalErrors = 0;
+
+	const int cameraCount = 6;
+	const float distances[cameraCount] = { 3.0f, 1.6f, 1.2f, 5.0f, 2.0f, 1.05f };
+
+	for (int c = 0; c < cameraCount; c++)
+	{
+		float angle = 6.2831853f * c / cameraCount;
+		Vec3 eye(cosf(angle) * distances[c], 0.3f * (c - 2), sinf(angle) * distances[c]);
+
+		// Odd cameras look past the sphere so part of it leaves the frustum
+		Vec3 target = (c & 1) ? Vec3(-sinf(angle) * 0.8f, 0.0f, cosf(angle) * 0.8f) : Vec3();
+		Mat4 viewProjection = Multiply(LookAtLH(eye, target, Vec3(0.0f, 1.0f, 0.0f)), projection);
+
+		MeshletCuller culler;
+		double serialMs = 1.0e30, parallelMs = 1.0e30;
+
+		for (int i = 0; i < iterations; i++)
+		{
+			culler.Cull(mesh, world, viewProjection, eye, nullptr);
+			serialMs = fmin(serialMs, culler.GetStats().cullMs);
+		}
+
+		for (int i = 0; i < iterations; i++)
+		{
+			culler.Cull(mesh, world, viewProjection, eye, &jobSystem);
+			parallelMs = fmin(parallelMs, culler.GetStats().cullMs);
+		}
+
+		const MeshletCullStats& stats = culler.GetStats();
+		uint32_t errors = Validate(mesh, culler, positions, world, viewProjection, eye, true);
+		totalErrors += errors;
+
+		// Cone test off: what it removed comes back, the frustum still culls the same
+		MeshletCuller twoSided;
+		twoSided.Cull(mesh, world, viewProjection, eye, &jobSystem, false);
+
+		const MeshletCullStats& twoSidedStats = twoSided.GetStats();
+		uint32_t twoSidedErrors = Validate(mesh, twoSided, positions, world, viewProjection, eye, false);
+		totalErrors += twoSidedErrors;
+
+		if (twoSidedStats.coneCulled != 0 || twoSidedStats.frustumCulled != stats.frustumCulled ||
+			twoSidedStats.meshletsVisible != stats.meshletsVisible + stats.coneCulled)
+		{
+			printf("FAIL: camera %d with the cone test off: %u visible, %u frustum, %u cone culled\n", c,
+				   twoSidedStats.meshletsVisible, twoSidedStats.frustumCulled, twoSidedStats.coneCulled);
+			totalErrors++;
+		}
+
+		printf("camera %d: %u/%u meshlets visible (%u frustum, %u cone), %u/%u tris rejected, %u draws\n", c,
+			   stats.meshletsVisible, stats.meshletsTested, stats.frustumCulled, stats.coneCulled, stats.trianglesRejected,
+			   stats.trianglesTested, stats.drawCount);
+		printf("          1 thread %.3f ms, %.0f tris/ms   %u threads %.3f ms, %.0f tris/ms   %u bad\n", serialMs,
+			   stats.trianglesRejected / serialMs, jobSystem.GetWorkerCount() + 1, parallelMs,
+			   stats.trianglesRejected / parallelMs, errors + twoSidedErrors);
+	}
+
+	jobSystem.Shutdown();
+
+	if (totalErrors != 0)
+	{
+		printf("FAIL: %u meshlets culled that should be drawn\n", totalErrors);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,524 @@
+//--------------------------------------------------------------------------------------
+// Overdraw without a GPU. A small software rasterizer draws a text scene from the
+// framework's starting camera the way the main pass does, with D3D's fill rule, and
+// counts the fragments that pass the depth test, which is what the pixel shader runs
+// for. Each scene is measured with nothing culled as before, with the materials' cull
+// modes, and with the depth pre-pass on top, then checked: with the pre-pass every
+// covered pixel has to be shaded exactly once, plus once more for each fragment that
+// ties the nearest depth, which LESS_EQUAL lets through as well.
+//
+//   g++ -std=c++17 -O2 overdrawbench.cpp ../builtinmeshes.cpp ../scene.cpp ../scenecompiler.cpp
+//
+//   overdrawbench [scene.txt] [width height]   defaults to ../scene.txt at 1920x1080,
+//                                              exit code 1 on a failed check
+//
+// The skinned tentacles aren't part of the scene file and aren't counted, the meshlet
+// culler is left out since the built in cube is a single meshlet.
+//--------------------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../builtinmeshes.h"
+#include "../scene.h"
+#include "../scenecompiler.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Milliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static bool ReadWholeFile(const char* path, std::vector<uint8_t>& data)
+{
+	FILE* file = fopen(path, "rb");
+
+	if (file == nullptr)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	data.resize(size > 0 ? (size_t)size : 0);
+	bool ok = size >= 0 && fread(data.data(), 1, data.size(), file) == data.size();
+	fclose(file);
+
+	return ok;
+}
+
+struct DrawItem
+{
+	const BuiltinMesh* pMesh;
+	Mat4               worldViewProjection;
+	uint32_t           cullMode;   // SceneCullMode
+	bool               alphaTest;  // left out of the pre-pass like the framework does
+};
+
+struct ClipVertex
+{
+	float x, y, z, w;
+};
+
+struct ScreenVertex
+{
+	float x, y, z;
+};
+
+struct OverdrawResult
+{
+	uint64_t shaded;   // fragments that passed the depth test in the main pass
+	uint64_t covered;  // pixels with something in front of the far plane
+	uint64_t ties;     // fragments shaded on a pixel already shaded at the same depth
+	uint64_t pixels;
+	double   ms;
+};
+
+class SoftwareRasterizer
+{
+private:
+	uint32_t             _width;
+	uint32_t             _height;
+	std::vector<float>   _depth;
+	std::vector<uint8_t> _shaded;  // pixels shaded by an equal depth test since Clear
+	uint64_t             _ties;
+
+	static ClipVertex Transform(const Vec3& p, const Mat4& m)
+	{
+		ClipVertex v;
+		v.x = p.x * m.m[0][0] + p.y * m.m[1][0] + p.z * m.m[2][0] + m.m[3][0];
+		v.y = p.x * m.m[0][1] + p.y * m.m[1][1] + p.z * m.m[2][1] + m.m[3][1];
+		v.z = p.x * m.m[0][2] + p.y * m.m[1][2] + p.z * m.m[2][2] + m.m[3][2];
+		v.w = p.x * m.m[0][3] + p.y * m.m[1][3] + p.z * m.m[2][3] + m.m[3][3];
+		return v;
+	}
+
+	// D3D's top left rule for clockwise triangles with y down: a flat edge going right
+	// or an edge going up owns the pixels exactly on it
+	static bool IsTopLeft(const ScreenVertex& a, const ScreenVertex& b)
+	{
+		return (a.y == b.y && b.x > a.x) || b.y < a.y;
+	}
+
+	static float Edge(const ScreenVertex& a, const ScreenVertex& b, float x, float y)
+	{
+		return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+	}
+
+	// Returns the fragments that passed the test
+	uint64_t Triangle(ScreenVertex a, ScreenVertex b, ScreenVertex c, uint32_t cullMode, bool lessEqual, bool writeDepth)
+	{
+		float area = Edge(a, b, c.x, c.y);
+
+		// Positive area is clockwise on screen, a front face
+		if (area == 0.0f || (cullMode == SCENE_CULL_BACK && area < 0.0f) || (cullMode == SCENE_CULL_FRONT && area > 0.0f))
+			return 0;
+
+		if (area < 0.0f)
+		{
+			std::swap(b, c);
+			area = -area;
+		}
+
+		int minX = std::max(0, (int)floorf(std::min(a.x, std::min(b.x, c.x))));
+		int minY = std::max(0, (int)floorf(std::min(a.y, std::min(b.y, c.y))));
+		int maxX = std::min((int)_width - 1, (int)ceilf(std::max(a.x, std::max(b.x, c.x))));
+		int maxY = std::min((int)_height - 1, (int)ceilf(std::max(a.y, std::max(b.y, c.y))));
+
+		bool topLeftA = IsTopLeft(b, c);
+		bool topLeftB = IsTopLeft(c, a);
+		bool topLeftC = IsTopLeft(a, b);
+		float invArea = 1.0f / area;
+		uint64_t passed = 0;
+
+		for (int y = minY; y <= maxY; y++)
+		{
+			float py = y + 0.5f;
+
+			for (int x = minX; x <= maxX; x++)
+			{
+				float px = x + 0.5f;
+
+				// Each weight belongs to the vertex opposite its edge
+				float wa = Edge(b, c, px, py);
+				float wb = Edge(c, a, px, py);
+				float wc = Edge(a, b, px, py);
+
+				if (wa < 0.0f || wb < 0.0f || wc < 0.0f ||
+					(wa == 0.0f && !topLeftA) || (wb == 0.0f && !topLeftB) || (wc == 0.0f && !topLeftC))
+					continue;
+
+				// The framework's rasterizer has depth clip off, depth is clamped instead
+				float z = std::min(std::max((wa * a.z + wb * b.z + wc * c.z) * invArea, 0.0f), 1.0f);
+				float& stored = _depth[(size_t)y * _width + x];
+
+				if (lessEqual ? z > stored : z >= stored)
+					continue;
+
+				if (writeDepth)
+					stored = z;
+
+				// Behind a pre-pass only the nearest depth passes, so a second fragment
+				// on the same pixel is another face at exactly that depth
+				if (lessEqual)
+				{
+					uint8_t& shaded = _shaded[(size_t)y * _width + x];
+					_ties += shaded;
+					shaded = 1;
+				}
+
+				passed++;
+			}
+		}
+
+		return passed;
+	}
+
+	ScreenVertex Project(const ClipVertex& v) const
+	{
+		ScreenVertex s;
+		s.x = (v.x / v.w * 0.5f + 0.5f) * _width;
+		s.y = (0.5f - v.y / v.w * 0.5f) * _height;
+		s.z = v.z / v.w;
+		return s;
+	}
+
+public:
+	void Init(uint32_t width, uint32_t height)
+	{
+		_width = width;
+		_height = height;
+		_depth.assign((size_t)width * height, 1.0f);
+		_shaded.assign((size_t)width * height, 0);
+		_ties = 0;
+	}
+
+	void Clear()
+	{
+		std::fill(_depth.begin(), _depth.end(), 1.0f);
+		std::fill(_shaded.begin(), _shaded.end(), 0);
+		_ties = 0;
+	}
+
+	uint64_t GetTies() const { return _ties; }
+
+	// Clipped against the near plane only, everything else is left to the pixel bounds
+	uint64_t Draw(const DrawItem& item, uint32_t cullMode, bool lessEqual, bool writeDepth)
+	{
+		const BuiltinMesh& mesh = *item.pMesh;
+		uint64_t passed = 0;
+
+		for (uint32_t t = 0; t + 2 < mesh.indexCount; t += 3)
+		{
+			ClipVertex in[3];
+			ClipVertex out[4];
+			uint32_t count = 0;
+
+			for (uint32_t i = 0; i < 3; i++)
+				in[i] = Transform(mesh.pVertices[mesh.pIndices[t + i]].position, item.worldViewProjection);
+
+			for (uint32_t i = 0; i < 3; i++)
+			{
+				const ClipVertex& p = in[i];
+				const ClipVertex& q = in[(i + 1) % 3];
+
+				if (p.z >= 0.0f)
+					out[count++] = p;
+
+				if ((p.z >= 0.0f) != (q.z >= 0.0f))
+				{
+					float f = p.z / (p.z - q.z);
+					ClipVertex v = { p.x + (q.x - p.x) * f, p.y + (q.y - p.y) * f, 0.0f, p.w + (q.w - p.w) * f };
+					out[count++] = v;
+				}
+			}
+
+			// A fan keeps the winding of the original triangle
+			for (uint32_t i = 1; i + 1 < count; i++)
+				passed += Triangle(Project(out[0]), Project(out[i]), Project(out[i + 1]), cullMode, lessEqual, writeDepth);
+		}
+
+		return passed;
+	}
+
+	uint64_t CountCovered() const
+	{
+		uint64_t covered = 0;
+
+		for (float depth : _depth)
+			covered += depth < 1.0f ? 1 : 0;
+
+		return covered;
+	}
+};
+
+// culling off draws everything two sided, the way the framework did before materials
+// had cull modes
+static OverdrawResult Measure(SoftwareRasterizer& rasterizer, const std::vector<DrawItem>& items, uint32_t width, uint32_t height,
+							  bool culling, bool prepass)
+{
+	auto start = Clock::now();
+
+	OverdrawResult result;
+	result.shaded = 0;
+	result.pixels = (uint64_t)width * height;
+
+	rasterizer.Clear();
+
+	if (prepass)
+	{
+		for (const DrawItem& item : items)
+		{
+			if (!item.alphaTest)
+				rasterizer.Draw(item, culling ? item.cullMode : SCENE_CULL_NONE, false, true);
+		}
+	}
+
+	for (const DrawItem& item : items)
+	{
+		bool tested = prepass && !item.alphaTest;
+		result.shaded += rasterizer.Draw(item, culling ? item.cullMode : SCENE_CULL_NONE, tested, !tested);
+	}
+
+	result.covered = rasterizer.CountCovered();
+	result.ties = rasterizer.GetTies();
+	result.ms = Milliseconds(start);
+
+	return result;
+}
+
+static bool Check(bool ok, const char* name, const char* format, ...)
+{
+	char detail[256];
+
+	va_list args;
+	va_start(args, format);
+	vsnprintf(detail, sizeof(detail), format, args);
+	va_end(args);
+
+	printf("  %-4s %-40s %s\n", ok ? "ok" : "FAIL", name, detail);
+
+	return ok;
+}
+
+static void PrintResult(const char* mode, const OverdrawResult& result)
+{
+	printf("  %-22s %12llu shaded  %5.2f per pixel  %5.2f per covered pixel  %7.1f ms\n", mode,
+		   (unsigned long long)result.shaded, (double)result.shaded / result.pixels,
+		   result.covered > 0 ? (double)result.shaded / result.covered : 0.0, result.ms);
+}
+
+// The three modes side by side, true when the pre-pass shades every covered pixel once
+// and neither culling nor the pre-pass adds work
+static bool MeasureScene(const char* name, const std::vector<DrawItem>& items, uint32_t width, uint32_t height)
+{
+	SoftwareRasterizer rasterizer;
+	rasterizer.Init(width, height);
+
+	OverdrawResult none = Measure(rasterizer, items, width, height, false, false);
+	OverdrawResult culled = Measure(rasterizer, items, width, height, true, false);
+	OverdrawResult prepass = Measure(rasterizer, items, width, height, true, true);
+
+	printf("%s at %ux%u, %zu draws, %llu of %llu pixels covered\n", name, width, height, items.size(),
+		   (unsigned long long)prepass.covered, (unsigned long long)prepass.pixels);
+	PrintResult("nothing culled", none);
+	PrintResult("material cull modes", culled);
+	PrintResult("cull modes + pre-pass", prepass);
+
+	bool alphaTested = false;
+
+	for (const DrawItem& item : items)
+		alphaTested |= item.alphaTest;
+
+	bool ok = true;
+	ok &= Check(culled.shaded <= none.shaded, "culling never shades more", "%llu <= %llu",
+				(unsigned long long)culled.shaded, (unsigned long long)none.shaded);
+	// Ties pass LESS_EQUAL behind the pre-pass where LESS without it only takes the first
+	ok &= Check(prepass.shaded <= culled.shaded + prepass.ties, "the pre-pass never shades more", "%llu <= %llu + %llu ties",
+				(unsigned long long)prepass.shaded, (unsigned long long)culled.shaded, (unsigned long long)prepass.ties);
+	ok &= Check(none.covered == culled.covered && culled.covered == prepass.covered, "same pixels covered in every mode", "%llu",
+				(unsigned long long)prepass.covered);
+
+	// Alpha tested draws are shaded in the main pass whether or not they end up in front
+	if (!alphaTested)
+		ok &= Check(prepass.shaded == prepass.covered + prepass.ties, "pre-pass shades each covered pixel once",
+					"%llu shaded, %llu covered, %llu depth ties", (unsigned long long)prepass.shaded,
+					(unsigned long long)prepass.covered, (unsigned long long)prepass.ties);
+
+	printf("\n");
+
+	return ok;
+}
+
+// Same camera as the framework starts with
+static Mat4 FrameworkViewProjection(uint32_t width, uint32_t height)
+{
+	Mat4 view = LookAtLH(Vec3(0.0f, 0.0f, -10.0f), Vec3(0.0f, 0.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f));
+	Mat4 projection = PerspectiveFovLH(3.14159265f * 0.5f, width / (float)height, 0.01f, 100.0f);
+
+	return Multiply(view, projection);
+}
+
+static bool LoadScene(const char* path, const Mat4& viewProjection, std::vector<DrawItem>& items)
+{
+	std::vector<uint8_t> text;
+
+	if (!ReadWholeFile(path, text))
+	{
+		fprintf(stderr, "%s: can't read\n", path);
+		return false;
+	}
+
+	text.push_back(0);
+
+	SceneDescription description;
+	char error[256];
+
+	if (!ParseSceneText((const char*)text.data(), description, error, sizeof(error)))
+	{
+		fprintf(stderr, "%s: %s\n", path, error);
+		return false;
+	}
+
+	// In file order, which is the order the main pass draws them in
+	for (const SceneDescEntity& entity : description.entities)
+	{
+		if (entity.flags & SCENE_ENTITY_HIDDEN)
+			continue;
+
+		const BuiltinMesh* pMesh = FindBuiltinMesh(entity.mesh.c_str());
+
+		if (pMesh == nullptr)
+		{
+			fprintf(stderr, "%s: entity %s uses mesh %s which isn't built in, skipped\n", path, entity.name.c_str(), entity.mesh.c_str());
+			continue;
+		}
+
+		DrawItem item;
+		item.pMesh = pMesh;
+		item.worldViewProjection = Multiply(ComposeSceneTransform(entity.transform), viewProjection);
+		item.cullMode = SCENE_CULL_BACK;
+		item.alphaTest = false;
+
+		for (const SceneDescMaterial& material : description.materials)
+		{
+			if (material.name == entity.material)
+			{
+				item.cullMode = material.data.cullMode;
+				item.alphaTest = (material.data.features & SCENE_MATERIAL_ALPHATEST) != 0;
+			}
+		}
+
+		items.push_back(item);
+	}
+
+	return true;
+}
+
+// A row of cubes going away from the camera over the floor, drawn in the given order
+static void BuildCubeRow(const Mat4& viewProjection, uint32_t count, bool backToFront, std::vector<DrawItem>& items)
+{
+	DrawItem floor;
+	floor.pMesh = &BuiltinFloor;
+	floor.cullMode = SCENE_CULL_BACK;
+	floor.alphaTest = false;
+
+	Mat4 floorWorld = Mat4::Identity();
+	floorWorld.m[0][0] = 10.0f;
+	floorWorld.m[2][2] = 10.0f;
+	floor.worldViewProjection = Multiply(floorWorld, viewProjection);
+
+	items.push_back(floor);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t index = backToFront ? count - 1 - i : i;
+
+		Mat4 world = Mat4::Identity();
+		world.m[3][0] = (index % 3) * 0.75f - 0.75f;
+		world.m[3][2] = -4.0f + index * 2.5f;
+
+		DrawItem cube;
+		cube.pMesh = &BuiltinCube;
+		cube.cullMode = SCENE_CULL_BACK;
+		cube.alphaTest = false;
+		cube.worldViewProjection = Multiply(world, viewProjection);
+
+		items.push_back(cube);
+	}
+}
+
+static const MeshVertex ScreenQuadVertices[4] =
+{
+	{ Vec3(-1.0f, 1.0f, 0.5f), Vec3(0.0f, 0.0f, -1.0f), { 0.0f, 0.0f } },
+	{ Vec3(1.0f, 1.0f, 0.5f), Vec3(0.0f, 0.0f, -1.0f), { 1.0f, 0.0f } },
+	{ Vec3(-1.0f, -1.0f, 0.5f), Vec3(0.0f, 0.0f, -1.0f), { 0.0f, 1.0f } },
+	{ Vec3(1.0f, -1.0f, 0.5f), Vec3(0.0f, 0.0f, -1.0f), { 1.0f, 1.0f } },
+};
+
+static const uint32_t ScreenQuadIndices[6] = { 0, 1, 2, 2, 1, 3 };
+
+static const BuiltinMesh ScreenQuad = { "screenquad", ScreenQuadVertices, 4, ScreenQuadIndices, 6 };
+
+int main(int argc, char* argv[])
+{
+	const char* scenePath = argc > 1 ? argv[1] : "../scene.txt";
+	uint32_t width = argc > 3 ? (uint32_t)atoi(argv[2]) : 1920;
+	uint32_t height = argc > 3 ? (uint32_t)atoi(argv[3]) : 1080;
+
+	if (width == 0 || height == 0)
+	{
+		fprintf(stderr, "width and height have to be at least 1\n");
+		return 1;
+	}
+
+	Mat4 viewProjection = FrameworkViewProjection(width, height);
+	bool ok = true;
+
+	// Two triangles over the whole screen share an edge, the fill rule has to give each
+	// pixel on it to exactly one of them
+	{
+		DrawItem quad;
+		quad.pMesh = &ScreenQuad;
+		quad.worldViewProjection = Mat4::Identity();
+		quad.cullMode = SCENE_CULL_BACK;
+		quad.alphaTest = false;
+
+		SoftwareRasterizer rasterizer;
+		rasterizer.Init(width, height);
+
+		uint64_t front = rasterizer.Draw(quad, SCENE_CULL_BACK, false, true);
+		rasterizer.Clear();
+		uint64_t back = rasterizer.Draw(quad, SCENE_CULL_FRONT, false, true);
+
+		printf("rasterizer\n");
+		ok &= Check(front == (uint64_t)width * height, "full screen quad covers each pixel once", "%llu of %llu",
+					(unsigned long long)front, (unsigned long long)width * height);
+		ok &= Check(back == 0, "clockwise quad is culled as a front face", "%llu", (unsigned long long)back);
+		printf("\n");
+	}
+
+	std::vector<DrawItem> items;
+
+	if (!LoadScene(scenePath, viewProjection, items))
+		return 1;
+
+	ok &= MeasureScene(scenePath, items, width, height);
+
+	items.clear();
+	BuildCubeRow(viewProjection, 24, true, items);
+	ok &= MeasureScene("24 cubes back to front", items, width, height);
+
+	items.clear();
+	BuildCubeRow(viewProjection, 24, false, items);
+	ok &= MeasureScene("24 cubes front to back", items, width, height);
+
+	printf("%s\n", ok ? "all passed" : "FAILED");
+
+	return ok ? 0 : 1;
+}
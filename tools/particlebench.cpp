@@ -0,0 +1,227 @@
+//--------------------------------------------------------------------------------------
+// Particle simulation benchmark. Runs a fountain at steady state with a few hundred
+// thousand particles, timing the SIMD update on one thread and on every core, then the
+// back to front sort and the instance write. A smaller system is checked against a
+// scalar copy of the update every frame, including the order the dead are removed in.
+//
+//   g++ -std=c++17 -O2 particlebench.cpp ../particles.cpp ../jobsystem.cpp -lpthread
+//
+//   particlebench [particles] [frames]
+//--------------------------------------------------------------------------------------
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../jobsystem.h"
+#include "../particles.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Milliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static ParticleEmitterDesc FountainDesc(uint32_t capacity)
+{
+	ParticleEmitterDesc desc;
+	desc.position = Vec3(0.0f, 0.0f, 0.0f);
+	desc.positionJitter = Vec3(2.0f, 0.0f, 2.0f);
+	desc.velocity = Vec3(0.0f, 8.0f, 0.0f);
+	desc.velocityJitter = Vec3(3.0f, 2.0f, 3.0f);
+	desc.acceleration = Vec3(0.0f, -9.8f, 0.0f);
+	desc.drag = 0.2f;
+	desc.lifeMin = 1.0f;
+	desc.lifeMax = 3.0f;
+	desc.sizeStart = 0.1f;
+	desc.sizeEnd = 0.4f;
+	desc.colorStart[3] = 1.0f;
+	desc.colorEnd[3] = 0.0f;
+	desc.rate = capacity / 2.0f;  // the average lifetime, so the system fills and stays full
+	desc.groundHeight = -1.0f;
+	desc.restitution = 0.5f;
+	desc.sorted = true;
+	return desc;
+}
+
+struct ReferenceParticles
+{
+	std::vector<float> values[8];  // position, velocity, age, inverse lifetime
+	uint32_t           count;
+};
+
+static void Snapshot(const ParticleSystem& system, ReferenceParticles& reference)
+{
+	const float* arrays[8] = { system.GetPositionsX(), system.GetPositionsY(), system.GetPositionsZ(), system.GetVelocitiesX(),
+		system.GetVelocitiesY(), system.GetVelocitiesZ(), system.GetAges(), system.GetInverseLifetimes() };
+
+	reference.count = system.GetCount();
+	for (int a = 0; a < 8; a++)
+		reference.values[a].assign(arrays[a], arrays[a] + reference.count);
+}
+
+// The same update one particle at a time, killing by swapping with the last particle
+// from the highest index down
+static void ReferenceUpdate(ReferenceParticles& p, const ParticleEmitterDesc& desc, float dt)
+{
+	float damping = fmaxf(1.0f - desc.drag * dt, 0.0f);
+	std::vector<uint32_t> dead;
+
+	for (uint32_t i = 0; i < p.count; i++)
+	{
+		float* v[3] = { &p.values[3][i], &p.values[4][i], &p.values[5][i] };
+		float* x[3] = { &p.values[0][i], &p.values[1][i], &p.values[2][i] };
+		float accel[3] = { desc.acceleration.x, desc.acceleration.y, desc.acceleration.z };
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			*v[axis] = *v[axis] * damping + accel[axis] * dt;
+			*x[axis] = *x[axis] + *v[axis] * dt;
+		}
+
+		if (*x[1] < desc.groundHeight)
+		{
+			*x[1] = desc.groundHeight;
+			*v[1] = *v[1] * -desc.restitution;
+		}
+
+		p.values[6][i] += dt;
+		if (p.values[6][i] * p.values[7][i] >= 1.0f)
+			dead.push_back(i);
+	}
+
+	for (size_t d = dead.size(); d-- > 0;)
+	{
+		uint32_t last = --p.count;
+		for (int a = 0; a < 8; a++)
+			p.values[a][dead[d]] = p.values[a][last];
+	}
+
+	for (int a = 0; a < 8; a++)
+		p.values[a].resize(p.count);
+}
+
+static int CheckUpdate(JobSystem& jobSystem)
+{
+	const uint32_t capacity = 20000;
+	const float dt = 1.0f / 60.0f;
+
+	ParticleSystem system;
+	system.Init(FountainDesc(capacity), capacity, 7);
+
+	// Fill with the emitter running, then check the integration and kills without it
+	for (int frame = 0; frame < 120; frame++)
+		system.Update(dt, &jobSystem);
+	system.GetDesc().rate = 0.0f;
+
+	ReferenceParticles reference;
+	uint32_t checked = 0;
+
+	for (int frame = 0; frame < 240; frame++)
+	{
+		Snapshot(system, reference);
+		ReferenceUpdate(reference, system.GetDesc(), dt);
+		system.Update(dt, &jobSystem);
+		checked += reference.count;
+
+		if (system.GetCount() != reference.count)
+		{
+			printf("FAILED frame %d: %u particles, reference has %u\n", frame, system.GetCount(), reference.count);
+			return 1;
+		}
+
+		ReferenceParticles actual;
+		Snapshot(system, actual);
+
+		for (int a = 0; a < 8; a++)
+		{
+			for (uint32_t i = 0; i < reference.count; i++)
+			{
+				if (fabsf(actual.values[a][i] - reference.values[a][i]) > 1e-4f * (1.0f + fabsf(reference.values[a][i])))
+				{
+					printf("FAILED frame %d: particle %u array %d is %f, reference %f\n", frame, i, a, actual.values[a][i], reference.values[a][i]);
+					return 1;
+				}
+			}
+		}
+	}
+
+	printf("update matches the scalar reference over 240 frames (%u particle updates)\n", checked);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t capacity = argc > 1 ? (uint32_t)atoi(argv[1]) : 500000;
+	int frames = argc > 2 ? atoi(argv[2]) : 60;
+	const float dt = 1.0f / 60.0f;
+
+	JobSystem jobSystem;
+	jobSystem.Init();
+
+	if (CheckUpdate(jobSystem) != 0)
+		return 1;
+
+	ParticleSystem system;
+	system.Init(FountainDesc(capacity), capacity);
+
+	// Three seconds covers the longest lifetime, after that emission and deaths balance
+	auto warmStart = Clock::now();
+	for (int frame = 0; frame < 180; frame++)
+		system.Update(dt, &jobSystem);
+
+	printf("%u capacity, %u alive after warm up (%.1f ms)\n", capacity, system.GetCount(), Milliseconds(warmStart));
+
+	Mat4 view = LookAtLH(Vec3(0.0f, 5.0f, -30.0f), Vec3(0.0f, 3.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f));
+	std::vector<ParticleInstance> instances(capacity);
+
+	double serialMs = 0.0, parallelMs = 0.0, sortMs = 0.0, writeMs = 0.0;
+	uint64_t serialParticles = 0, parallelParticles = 0;
+	uint64_t emitted = 0, killed = 0;
+
+	for (int frame = 0; frame < frames; frame++)
+	{
+		// Alternate so both see the same particle counts on average
+		bool parallel = (frame & 1) != 0;
+		system.Update(dt, parallel ? &jobSystem : nullptr);
+
+		const ParticleStats& stats = system.GetStats();
+		(parallel ? parallelMs : serialMs) += stats.updateMs;
+		(parallel ? parallelParticles : serialParticles) += stats.alive;
+		emitted += stats.emitted;
+		killed += stats.killed;
+
+		system.Sort(view);
+		sortMs += system.GetStats().sortMs;
+
+		system.WriteInstances(instances.data(), &jobSystem);
+		writeMs += system.GetStats().writeMs;
+	}
+
+	// Sorted instances must run back to front, to the precision of the sort key
+	for (uint32_t i = 1; i < system.GetCount(); i++)
+	{
+		const float* a = instances[i - 1].position;
+		const float* b = instances[i].position;
+		float depthA = TransformPoint(Vec3(a[0], a[1], a[2]), view).z;
+		float depthB = TransformPoint(Vec3(b[0], b[1], b[2]), view).z;
+
+		if (depthA < depthB - fabsf(depthB) / 4096.0f)
+		{
+			printf("FAILED sort: instance %u at depth %f is nearer than instance %u at %f\n", i - 1, depthA, i, depthB);
+			return 1;
+		}
+	}
+
+	int half = frames / 2;
+	printf("per frame: %.0f emitted, %.0f killed\n", (double)emitted / frames, (double)killed / frames);
+	printf("update: 1 thread %.2f ms, %.0f particles/ms   %u threads %.2f ms, %.0f particles/ms per core\n",
+		   serialMs / (frames - half), serialParticles / serialMs, jobSystem.GetThreadCount(), parallelMs / half,
+		   parallelParticles / parallelMs / jobSystem.GetThreadCount());
+	printf("sort %.2f ms, instance write %.2f ms\n", sortMs / frames, writeMs / frames);
+
+	jobSystem.Shutdown();
+
+	return 0;
+}
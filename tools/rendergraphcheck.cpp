@@ -0,0 +1,596 @@
+//--------------------------------------------------------------------------------------
+// Render graph compiler check, headless. Builds small graphs and checks what Compile
+// makes of them: pass order from the declared reads and writes, cycles, culling of
+// passes whose output nobody reads (including a writer that is only partly unused),
+// transient aliasing by lifetime and description, the barriers the backend sees before
+// each pass and at the end of the frame, and a backend that fails to create a texture.
+// Ends with the app's frame graph timed.
+//
+//   g++ -std=c++17 -O2 rendergraphcheck.cpp ../rendergraph.cpp
+//
+//   rendergraphcheck
+//--------------------------------------------------------------------------------------
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../rendergraph.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Milliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static int s_failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		printf("FAILED %s\n", what);
+		s_failures++;
+	}
+}
+
+static const char* StateName(RenderGraphState state)
+{
+	switch (state)
+	{
+	case RG_STATE_UNDEFINED: return "undefined";
+	case RG_STATE_RENDER_TARGET: return "rt";
+	case RG_STATE_DEPTH_WRITE: return "depthwrite";
+	case RG_STATE_DEPTH_READ: return "depthread";
+	case RG_STATE_SHADER_READ: return "read";
+	case RG_STATE_PRESENT: return "present";
+	default: return "?";
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Headless backend that writes everything that happens during Execute into one log:
+// "Pass" for a pass running, "[resource:before>after]" for each barrier it receives
+//--------------------------------------------------------------------------------------
+class LoggingBackend : public HeadlessRenderGraphBackend
+{
+public:
+	std::string               log;
+	std::vector<const char*>* pNames;
+
+	LoggingBackend() : pNames(nullptr) {}
+
+	void ApplyBarriers(const RenderGraphBarrier* pBarriers, uint32_t count) override
+	{
+		HeadlessRenderGraphBackend::ApplyBarriers(pBarriers, count);
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			char entry[96];
+			snprintf(entry, sizeof(entry), "[%s:%s>%s] ", (*pNames)[pBarriers[i].resource], StateName(pBarriers[i].before),
+					 StateName(pBarriers[i].after));
+			log += entry;
+		}
+	}
+};
+
+struct PassLog
+{
+	LoggingBackend* pBackend;
+	const char*     name;
+};
+
+static void LogPass(const RenderGraphPassContext& context, void* pData)
+{
+	(void)context;
+
+	PassLog* pLog = static_cast<PassLog*>(pData);
+	pLog->pBackend->log += pLog->name;
+	pLog->pBackend->log += " ";
+}
+
+// Declares passes and resources by name so the checks read like the graphs they build
+class TestGraph
+{
+public:
+	RenderGraph              graph;
+	LoggingBackend           backend;
+	std::vector<const char*> resourceNames;
+	std::vector<PassLog>     passLogs;
+	int                      importedHandle;
+
+	TestGraph()
+	{
+		backend.pNames = &resourceNames;
+		passLogs.reserve(64);
+	}
+
+	void Reset()
+	{
+		graph.Reset();
+		resourceNames.clear();
+		passLogs.clear();
+		backend.log.clear();
+	}
+
+	RenderGraphResource Texture(const char* name, uint32_t width = 256, uint32_t height = 256)
+	{
+		RenderGraphTextureDesc desc = { width, height, 0, 4, RG_BIND_RENDER_TARGET | RG_BIND_SHADER_RESOURCE };
+		resourceNames.push_back(name);
+		return graph.CreateTexture(name, desc);
+	}
+
+	RenderGraphResource Import(const char* name, RenderGraphState initialState, RenderGraphState finalState)
+	{
+		RenderGraphTextureDesc desc = { 256, 256, 0, 4, RG_BIND_RENDER_TARGET };
+		resourceNames.push_back(name);
+		return graph.ImportTexture(name, desc, &importedHandle, initialState, finalState);
+	}
+
+	uint32_t Pass(const char* name)
+	{
+		PassLog log = { &backend, name };
+		passLogs.push_back(log);
+		return graph.AddPass(name, &LogPass, &passLogs.back());
+	}
+
+	// The surviving passes by name, in execution order
+	std::string Order() const
+	{
+		std::string order;
+
+		for (uint32_t pass : graph.GetPassOrder())
+		{
+			order += order.empty() ? "" : " ";
+			order += passLogs[pass].name;
+		}
+
+		return order;
+	}
+
+	std::string Run()
+	{
+		backend.log.clear();
+		graph.Execute(&backend);
+
+		if (!backend.log.empty())
+			backend.log.pop_back();
+
+		return backend.log;
+	}
+};
+
+static void CheckOrdering()
+{
+	TestGraph t;
+
+	// Declared consumer first: the reader still has to run after the writer
+	RenderGraphResource color = t.Texture("Color");
+	RenderGraphResource back = t.Import("Back", RG_STATE_UNDEFINED, RG_STATE_PRESENT);
+
+	uint32_t post = t.Pass("Post");
+	t.graph.Read(post, color);
+	t.graph.Write(post, back);
+
+	uint32_t main = t.Pass("Main");
+	t.graph.Write(main, color);
+
+	Check(t.graph.Compile(), "reader declared before its writer compiles");
+	Check(t.Order() == "Main Post", "writer ordered before a reader declared earlier");
+
+	// Write after read: the second writer waits for the reader of the first write
+	t.Reset();
+	color = t.Texture("Color");
+	back = t.Import("Back", RG_STATE_UNDEFINED, RG_STATE_PRESENT);
+	RenderGraphResource copy = t.Texture("Copy");
+
+	uint32_t first = t.Pass("First");
+	t.graph.Write(first, color);
+
+	uint32_t reader = t.Pass("Reader");
+	t.graph.Read(reader, color);
+	t.graph.Write(reader, copy);
+
+	uint32_t second = t.Pass("Second");
+	t.graph.Write(second, color);
+
+	uint32_t final = t.Pass("Final");
+	t.graph.Read(final, color);
+	t.graph.Read(final, copy);
+	t.graph.Write(final, back);
+
+	Check(t.graph.Compile() && t.Order() == "First Reader Second Final", "write after read keeps the reader in between");
+
+	// Independent passes keep their declaration order
+	t.Reset();
+	RenderGraphResource a = t.Texture("A");
+	RenderGraphResource b = t.Texture("B");
+	back = t.Import("Back", RG_STATE_UNDEFINED, RG_STATE_PRESENT);
+
+	uint32_t passA = t.Pass("A");
+	t.graph.Write(passA, a);
+	uint32_t passB = t.Pass("B");
+	t.graph.Write(passB, b);
+	uint32_t combine = t.Pass("Combine");
+	t.graph.Read(combine, a);
+	t.graph.Read(combine, b);
+	t.graph.Write(combine, back);
+
+	Check(t.graph.Compile() && t.Order() == "A B Combine", "independent passes keep declaration order");
+
+	// Two passes that each need the other's output can't be ordered
+	t.Reset();
+	a = t.Texture("A");
+	b = t.Texture("B");
+
+	passA = t.Pass("A");
+	t.graph.Read(passA, b);
+	t.graph.Write(passA, a);
+	passB = t.Pass("B");
+	t.graph.Write(passB, b);
+	t.graph.Read(passB, a);
+	t.graph.Write(passB, t.Import("Back", RG_STATE_UNDEFINED, RG_STATE_PRESENT));
+
+	uint32_t passC = t.Pass("C");
+	t.graph.Write(passC, b);
+
+	Check(!t.graph.Compile(), "cycle is reported");
+}
+
+static void CheckCulling()
+{
+	TestGraph t;
+
+	// A chain that ends in nothing is culled back to front
+	RenderGraphResource unused = t.Texture("Unused");
+	RenderGraphResource blurred = t.Texture("Blurred");
+	RenderGraphResource color = t.Texture("Color");
+	RenderGraphResource back = t.Import("Back", RG_STATE_UNDEFINED, RG_STATE_PRESENT);
+
+	uint32_t main = t.Pass("Main");
+	t.graph.Write(main, color);
+
+	uint32_t debug = t.Pass("Debug");
+	t.graph.Write(debug, unused);
+
+	uint32_t blur = t.Pass("Blur");
+	t.graph.Read(blur, unused);
+	t.graph.Write(blur, blurred);
+
+	uint32_t post = t.Pass("Post");
+	t.graph.Read(post, color);
+	t.graph.Write(post, back);
+
+	Check(t.graph.Compile() && t.Order() == "Main Post", "unused chain culled");
+	Check(t.graph.IsPassCulled(debug) && t.graph.IsPassCulled(blur), "both passes of the chain marked culled");
+	Check(t.graph.GetStats().culledPassCount == 2, "culled count");
+
+	// Side effects keep a pass whose outputs nobody reads
+	t.Reset();
+	unused = t.Texture("Unused");
+	back = t.Import("Back", RG_STATE_UNDEFINED, RG_STATE_PRESENT);
+
+	uint32_t query = t.Pass("Query");
+	t.graph.Write(query, unused);
+	t.graph.SetSideEffect(query);
+
+	uint32_t reads = t.Pass("ReadsNothing");
+	(void)reads;
+
+	Check(t.graph.Compile() && t.Order() == "Query", "side effect pass kept, pass with no outputs culled");
+
+	// A writes t1, t2 and t3. B only reads t1 and writes nothing, so it goes, and so do
+	// t1 and t2, but C still reads t3: A has to stay. Queueing t1 twice once culled A.
+	t.Reset();
+	RenderGraphResource t1 = t.Texture("t1");
+	RenderGraphResource t2 = t.Texture("t2");
+	RenderGraphResource t3 = t.Texture("t3");
+	back = t.Import("Back", RG_STATE_UNDEFINED, RG_STATE_PRESENT);
+
+	uint32_t passA = t.Pass("A");
+	t.graph.Write(passA, t1);
+	t.graph.Write(passA, t2);
+	t.graph.Write(passA, t3);
+
+	uint32_t passB = t.Pass("B");
+	t.graph.Read(passB, t1);
+
+	uint32_t passC = t.Pass("C");
+	t.graph.Read(passC, t3);
+	t.graph.Write(passC, back);
+
+	Check(t.graph.Compile(), "partly used writer compiles");
+	Check(!t.graph.IsPassCulled(passA) && t.graph.IsPassCulled(passB) && !t.graph.IsPassCulled(passC),
+		  "writer kept while one of its outputs is read");
+	Check(t.Order() == "A C", "partly used writer runs before its reader");
+
+	// Same again with a second dead reader of t1, so t1 drops to zero during the pass loop
+	t.Reset();
+	t1 = t.Texture("t1");
+	t3 = t.Texture("t3");
+	back = t.Import("Back", RG_STATE_UNDEFINED, RG_STATE_PRESENT);
+
+	passA = t.Pass("A");
+	t.graph.Write(passA, t1);
+	t.graph.Write(passA, t3);
+
+	passB = t.Pass("B");
+	t.graph.Read(passB, t1);
+	uint32_t passB2 = t.Pass("B2");
+	t.graph.Read(passB2, t1);
+
+	passC = t.Pass("C");
+	t.graph.Read(passC, t3);
+	t.graph.Write(passC, back);
+
+	Check(t.graph.Compile() && t.Order() == "A C", "several dead readers of one output");
+	(void)passB2;
+
+	// Once nothing reads t3 either, A goes too
+	t.Reset();
+	t1 = t.Texture("t1");
+	t3 = t.Texture("t3");
+	back = t.Import("Back", RG_STATE_UNDEFINED, RG_STATE_PRESENT);
+
+	passA = t.Pass("A");
+	t.graph.Write(passA, t1);
+	t.graph.Write(passA, t3);
+
+	passB = t.Pass("B");
+	t.graph.Read(passB, t1);
+	t.graph.Read(passB, t3);
+
+	passC = t.Pass("C");
+	t.graph.Write(passC, back);
+
+	Check(t.graph.Compile() && t.Order() == "C" && t.graph.IsPassCulled(passA), "writer culled once all outputs are dead");
+}
+
+static void CheckAliasing()
+{
+	TestGraph t;
+
+	// Chain of four same sized targets, each read by the next pass only: lifetimes
+	// [0,1] [1,2] [2,3] [3,4], so 0 and 2 share, and 1 and 3 share
+	RenderGraphResource targets[4] = { t.Texture("T0"), t.Texture("T1"), t.Texture("T2"), t.Texture("T3") };
+	RenderGraphResource odd = t.Texture("Odd", 512, 512);
+	RenderGraphResource back = t.Import("Back", RG_STATE_UNDEFINED, RG_STATE_PRESENT);
+
+	uint32_t pass = t.Pass("P0");
+	t.graph.Write(pass, targets[0]);
+
+	static const char* names[] = { "P1", "P2", "P3" };
+
+	for (uint32_t i = 1; i < 4; i++)
+	{
+		pass = t.Pass(names[i - 1]);
+		t.graph.Read(pass, targets[i - 1]);
+		t.graph.Write(pass, targets[i]);
+	}
+
+	// Different size, runs after the chain so only T3 is live alongside it
+	uint32_t oddPass = t.Pass("Odd");
+	t.graph.Write(oddPass, odd);
+
+	uint32_t final = t.Pass("Final");
+	t.graph.Read(final, targets[3]);
+	t.graph.Read(final, odd);
+	t.graph.Write(final, back);
+
+	Check(t.graph.Compile(), "aliasing graph compiles");
+	Check(t.graph.GetAliasSlot(targets[0]) == t.graph.GetAliasSlot(targets[2]), "T0 and T2 share a slot");
+	Check(t.graph.GetAliasSlot(targets[1]) == t.graph.GetAliasSlot(targets[3]), "T1 and T3 share a slot");
+	Check(t.graph.GetAliasSlot(targets[0]) != t.graph.GetAliasSlot(targets[1]), "overlapping lifetimes never share");
+	Check(t.graph.GetAliasSlot(odd) != t.graph.GetAliasSlot(targets[0]) && t.graph.GetAliasSlot(odd) != t.graph.GetAliasSlot(targets[1]),
+		  "different descriptions never share");
+
+	const RenderGraphStats& stats = t.graph.GetStats();
+	uint64_t small = 256ull * 256 * 4;
+	uint64_t large = 512ull * 512 * 4;
+
+	Check(stats.transientCount == 5 && stats.physicalCount == 3, "five transients on three textures");
+	Check(stats.unaliasedBytes == 4 * small + large && stats.aliasedBytes == 2 * small + large, "aliased and unaliased bytes");
+	Check(stats.peakLiveBytes == small + large, "peak is the last chain target and the odd one");
+
+	// The physical textures behind shared slots are the same, and stay cached
+	t.Run();
+	Check(t.graph.GetPhysical(targets[0]) == t.graph.GetPhysical(targets[2]) && t.graph.GetPhysical(targets[0]) != nullptr,
+		  "shared slot, shared texture");
+
+	uint32_t created = t.backend.GetCreatedTextures();
+	t.Run();
+	t.Run();
+	Check(created == 3 && t.backend.GetCreatedTextures() == created && t.backend.GetLiveTextures() == 3, "cached across frames");
+
+	t.graph.ReleasePhysical(&t.backend);
+	Check(t.backend.GetLiveTextures() == 0, "released");
+}
+
+static void CheckBarriers()
+{
+	TestGraph t;
+
+	RenderGraphResource shadow = t.Texture("Shadow");
+	RenderGraphResource color = t.Texture("Color");
+	RenderGraphResource back = t.Import("Back", RG_STATE_PRESENT, RG_STATE_PRESENT);
+
+	uint32_t shadowPass = t.Pass("Shadow");
+	t.graph.Write(shadowPass, shadow, RG_STATE_DEPTH_WRITE);
+
+	uint32_t main = t.Pass("Main");
+	t.graph.Read(main, shadow, RG_STATE_SHADER_READ);
+	t.graph.Write(main, color, RG_STATE_RENDER_TARGET);
+
+	// Writes the same target in the same state, nothing to transition
+	uint32_t particles = t.Pass("Particles");
+	t.graph.Write(particles, color, RG_STATE_RENDER_TARGET);
+
+	uint32_t post = t.Pass("Post");
+	t.graph.Read(post, color, RG_STATE_SHADER_READ);
+	t.graph.Write(post, back, RG_STATE_RENDER_TARGET);
+
+	Check(t.graph.Compile(), "barrier graph compiles");
+
+	std::string log = t.Run();
+	const char* expected = "[Shadow:undefined>depthwrite] Shadow "
+						   "[Shadow:depthwrite>read] [Color:undefined>rt] Main "
+						   "Particles "
+						   "[Color:rt>read] [Back:present>rt] Post "
+						   "[Back:rt>present]";
+
+	Check(log == expected, "barriers placed before the pass that needs them, final state restored");
+
+	if (log != expected)
+		printf("  got      %s\n  expected %s\n", log.c_str(), expected);
+
+	Check(t.graph.GetStats().barrierCount == 6, "barrier count");
+
+	// An imported resource already in its final state needs nothing at the end
+	t.Reset();
+	back = t.Import("Back", RG_STATE_RENDER_TARGET, RG_STATE_RENDER_TARGET);
+
+	uint32_t only = t.Pass("Only");
+	t.graph.Write(only, back, RG_STATE_RENDER_TARGET);
+
+	Check(t.graph.Compile() && t.Run() == "Only", "no barriers when nothing changes state");
+
+	t.graph.ReleasePhysical(&t.backend);
+}
+
+// Backend that runs out of memory after a number of textures, like a device would
+class FailingBackend : public LoggingBackend
+{
+public:
+	uint32_t remaining;
+
+	FailingBackend() : remaining(0) {}
+
+	void* CreateTexture(const RenderGraphTextureDesc& desc, const char* name) override
+	{
+		if (remaining == 0)
+			return nullptr;
+
+		remaining--;
+		return LoggingBackend::CreateTexture(desc, name);
+	}
+};
+
+static void CheckFailedCreate()
+{
+	TestGraph t;
+	FailingBackend failing;
+	failing.pNames = &t.resourceNames;
+
+	RenderGraphResource shadow = t.Texture("Shadow", 512, 512);
+	RenderGraphResource color = t.Texture("Color");
+	RenderGraphResource back = t.Import("Back", RG_STATE_PRESENT, RG_STATE_PRESENT);
+
+	uint32_t shadowPass = t.Pass("Shadow");
+	t.graph.Write(shadowPass, shadow, RG_STATE_DEPTH_WRITE);
+
+	uint32_t main = t.Pass("Main");
+	t.graph.Read(main, shadow, RG_STATE_SHADER_READ);
+	t.graph.Write(main, color, RG_STATE_RENDER_TARGET);
+
+	uint32_t post = t.Pass("Post");
+	t.graph.Read(post, color, RG_STATE_SHADER_READ);
+	t.graph.Write(post, back, RG_STATE_RENDER_TARGET);
+
+	Check(t.graph.Compile(), "failing graph compiles");
+
+	// The passes log into the graph's own backend, point them at this one
+	for (PassLog& log : t.passLogs)
+		log.pBackend = &failing;
+
+	// Room for one of the two textures: nothing runs and the missing one isn't cached
+	failing.remaining = 1;
+	bool executed = t.graph.Execute(&failing);
+
+	Check(!executed && failing.log.empty(), "no pass runs when a texture can't be created");
+	Check(t.graph.GetPhysical(color) == nullptr || t.graph.GetPhysical(shadow) == nullptr, "the failed texture has no physical");
+	Check(failing.GetLiveTextures() == 1, "only the created texture is kept");
+
+	// Once memory is back the same frame goes through, reusing what was created
+	failing.remaining = 1;
+	executed = t.graph.Execute(&failing);
+
+	size_t mainAt = failing.log.find("] Main");
+	Check(executed && mainAt != std::string::npos && failing.log.find("] Post", mainAt) != std::string::npos,
+		  "next frame runs once both exist");
+	Check(failing.GetCreatedTextures() == 2 && failing.GetLiveTextures() == 2, "created texture reused, missing one retried");
+	Check(t.graph.GetPhysical(color) != nullptr && t.graph.GetPhysical(shadow) != nullptr, "both have physicals");
+
+	t.graph.ReleasePhysical(&failing);
+	Check(failing.GetLiveTextures() == 0, "failed graph released");
+}
+
+// The app's frame with the pre-pass and the overlay, compiled many times over
+static void MeasureFrame()
+{
+	TestGraph t;
+	const uint32_t frames = 20000;
+
+	Clock::time_point start = Clock::now();
+
+	for (uint32_t frame = 0; frame < frames; frame++)
+	{
+		t.Reset();
+
+		RenderGraphResource back = t.Import("BackBuffer", RG_STATE_PRESENT, RG_STATE_PRESENT);
+		RenderGraphResource color = t.Texture("SceneColor", 1920, 1080);
+		RenderGraphResource depth = t.Texture("SceneDepth", 1920, 1080);
+		RenderGraphResource shadow = t.Import("ShadowMap", RG_STATE_SHADER_READ, RG_STATE_SHADER_READ);
+
+		uint32_t shadowPass = t.Pass("Shadows");
+		t.graph.Write(shadowPass, shadow, RG_STATE_DEPTH_WRITE);
+
+		uint32_t prepass = t.Pass("DepthPrepass");
+		t.graph.Write(prepass, depth, RG_STATE_DEPTH_WRITE);
+
+		uint32_t main = t.Pass("Main");
+		t.graph.Read(main, shadow, RG_STATE_SHADER_READ);
+		t.graph.Write(main, color, RG_STATE_RENDER_TARGET);
+		t.graph.Write(main, depth, RG_STATE_DEPTH_WRITE);
+
+		uint32_t particles = t.Pass("Particles");
+		t.graph.Read(particles, depth, RG_STATE_DEPTH_READ);
+		t.graph.Write(particles, color, RG_STATE_RENDER_TARGET);
+
+		uint32_t upscale = t.Pass("Upscale");
+		t.graph.Read(upscale, color, RG_STATE_SHADER_READ);
+		t.graph.Write(upscale, back, RG_STATE_RENDER_TARGET);
+
+		uint32_t debug = t.Pass("DebugOverlay");
+		t.graph.Write(debug, back, RG_STATE_RENDER_TARGET);
+
+		t.graph.Compile();
+	}
+
+	double ms = Milliseconds(start);
+
+	Check(t.Order() == "Shadows DepthPrepass Main Particles Upscale DebugOverlay", "frame graph order");
+
+	printf("frame graph, %u passes: %.2f us per build and compile\n", (uint32_t)t.graph.GetPassOrder().size(), ms * 1000.0 / frames);
+}
+
+int main()
+{
+	CheckOrdering();
+	CheckCulling();
+	CheckAliasing();
+	CheckBarriers();
+	CheckFailedCreate();
+
+	if (s_failures != 0)
+	{
+		printf("%d checks failed\n", s_failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+
+	MeasureFrame();
+
+	return s_failures != 0 ? 1 : 0;
+}
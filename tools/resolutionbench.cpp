@@ -0,0 +1,326 @@
+//--------------------------------------------------------------------------------------
+// Dynamic resolution controller checks. Replays frame time traces through the
+// controller with a simple cost model, a fixed part plus a part that follows the pixel
+// count, so the scale it picks feeds back into the next frame. The built in scenarios
+// check it settles, reacts to load changes, ignores hitches and doesn't hunt on noise.
+//
+//   g++ -std=c++17 -O2 resolutionbench.cpp ../dynamicresolution.cpp
+//
+//   resolutionbench                          run the scenarios, exit code 1 on a failure
+//   resolutionbench trace.txt [options]      replay a trace recorded with -dynrestrace
+//     --target ms      frame budget, default 16.67
+//     --fixed ms       part of the frame that doesn't scale, default 2
+//     --csv out.csv    frame, cost, frame ms and scale per line
+//
+// Traces hold one frame per line, the frame time and optionally the scale it was drawn
+// at. The full resolution cost is recovered from both with the same model.
+//--------------------------------------------------------------------------------------
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../dynamicresolution.h"
+
+static uint32_t s_random = 12345;
+
+static float RandomFloat(float low, float high)
+{
+	s_random = s_random * 1664525u + 1013904223u;
+	return low + (high - low) * ((s_random >> 8) / 16777216.0f);
+}
+
+struct Replay
+{
+	std::vector<float> frameMs;
+	std::vector<float> scales;
+	float              averageMs;
+	float              p95Ms;
+	float              averageScale;
+	float              minScale;
+	uint32_t           overBudget;
+	uint32_t           changes;
+};
+
+// costs are full resolution GPU times, the fixed part is added on top unscaled
+static void Run(const std::vector<float>& costs, float fixedMs, const DynamicResolutionSettings& settings, Replay& replay)
+{
+	DynamicResolutionController controller;
+	controller.Init(settings);
+
+	replay.frameMs.clear();
+	replay.scales.clear();
+
+	float scale = controller.GetScale();
+
+	for (float cost : costs)
+	{
+		float frameMs = fixedMs + cost * scale * scale;
+		replay.frameMs.push_back(frameMs);
+		replay.scales.push_back(scale);
+		scale = controller.Update(frameMs);
+	}
+
+	std::vector<float> sorted = replay.frameMs;
+	std::sort(sorted.begin(), sorted.end());
+
+	replay.averageMs = 0.0f;
+	replay.averageScale = 0.0f;
+	replay.minScale = settings.maxScale;
+	replay.overBudget = 0;
+	replay.changes = controller.GetStats().changes;
+
+	for (size_t i = 0; i < replay.frameMs.size(); i++)
+	{
+		replay.averageMs += replay.frameMs[i];
+		replay.averageScale += replay.scales[i];
+		replay.minScale = std::min(replay.minScale, replay.scales[i]);
+		replay.overBudget += replay.frameMs[i] > settings.targetMs ? 1 : 0;
+	}
+
+	size_t count = std::max<size_t>(replay.frameMs.size(), 1);
+	replay.averageMs /= count;
+	replay.averageScale /= count;
+	replay.p95Ms = sorted.empty() ? 0.0f : sorted[(size_t)(sorted.size() * 0.95f)];
+}
+
+static uint32_t CountChanges(const Replay& replay, size_t begin, size_t end)
+{
+	uint32_t changes = 0;
+
+	for (size_t i = std::max<size_t>(begin, 1); i < end && i < replay.scales.size(); i++)
+		changes += replay.scales[i] != replay.scales[i - 1] ? 1 : 0;
+
+	return changes;
+}
+
+static float AverageMs(const Replay& replay, size_t begin, size_t end)
+{
+	float sum = 0.0f;
+
+	for (size_t i = begin; i < end; i++)
+		sum += replay.frameMs[i];
+
+	return end > begin ? sum / (end - begin) : 0.0f;
+}
+
+// First frame at or after begin whose scale satisfies the test, or the trace length
+template<typename F>
+static size_t FirstFrame(const Replay& replay, size_t begin, F test)
+{
+	for (size_t i = begin; i < replay.scales.size(); i++)
+	{
+		if (test(replay.scales[i]))
+			return i;
+	}
+
+	return replay.scales.size();
+}
+
+static void AddLoad(std::vector<float>& costs, uint32_t frames, float cost, float noise)
+{
+	for (uint32_t i = 0; i < frames; i++)
+		costs.push_back(cost * (1.0f + RandomFloat(-noise, noise)));
+}
+
+static bool Check(bool ok, const char* name, const char* format, ...)
+{
+	char detail[256];
+
+	va_list args;
+	va_start(args, format);
+	vsnprintf(detail, sizeof(detail), format, args);
+	va_end(args);
+
+	printf("  %-4s %-32s %s\n", ok ? "ok" : "FAIL", name, detail);
+
+	return ok;
+}
+
+static void PrintReplay(const char* name, const Replay& replay)
+{
+	printf("%s: %zu frames, avg %.2f ms, p95 %.2f ms, %u over budget, scale avg %.3f min %.3f, %u changes\n", name,
+		   replay.frameMs.size(), replay.averageMs, replay.p95Ms, replay.overBudget, replay.averageScale, replay.minScale, replay.changes);
+}
+
+static int RunScenarios()
+{
+	DynamicResolutionSettings settings;
+	InitDynamicResolutionSettings(settings);
+
+	const float fixedMs = 2.0f;
+	const float target = settings.targetMs;
+	bool ok = true;
+	Replay replay;
+
+	// Well inside the budget the scale never leaves the top
+	{
+		std::vector<float> costs;
+		AddLoad(costs, 1000, 8.0f, 0.05f);
+		Run(costs, fixedMs, settings, replay);
+		PrintReplay("light", replay);
+		ok &= Check(replay.changes == 0, "stays at full resolution", "%u changes", replay.changes);
+	}
+
+	// Twice the budget at full size, has to find a scale that fits and stay on it
+	{
+		std::vector<float> costs;
+		AddLoad(costs, 1000, 2.0f * target, 0.05f);
+		Run(costs, fixedMs, settings, replay);
+		PrintReplay("heavy", replay);
+
+		float settledMs = AverageMs(replay, 200, 1000);
+		uint32_t settledChanges = CountChanges(replay, 200, 1000);
+		ok &= Check(settledMs <= target && settledMs >= target * 0.75f, "settles under budget", "%.2f ms after frame 200", settledMs);
+		ok &= Check(settledChanges <= 2, "holds the scale once settled", "%u changes after frame 200", settledChanges);
+	}
+
+	// Load steps up and back down
+	{
+		std::vector<float> costs;
+		AddLoad(costs, 300, 8.0f, 0.05f);
+		AddLoad(costs, 400, 2.5f * target, 0.05f);
+		AddLoad(costs, 600, 8.0f, 0.05f);
+		Run(costs, fixedMs, settings, replay);
+		PrintReplay("step", replay);
+
+		size_t dropped = FirstFrame(replay, 300, [&](float scale) { return scale < settings.maxScale; });
+		float recoveredMs = AverageMs(replay, 340, 700);
+		size_t restored = FirstFrame(replay, 700, [&](float scale) { return scale >= settings.maxScale; });
+		ok &= Check(dropped - 300 <= 5, "drops within 5 frames", "%zu frames", dropped - 300);
+		ok &= Check(recoveredMs <= target, "under budget 40 frames later", "%.2f ms", recoveredMs);
+		ok &= Check(restored - 700 <= 400, "back to full within 400 frames", "%zu frames", restored - 700);
+	}
+
+	// A hitch every two seconds is not a reason to drop the resolution
+	{
+		std::vector<float> costs;
+
+		for (uint32_t i = 0; i < 10; i++)
+		{
+			AddLoad(costs, 119, 10.0f, 0.05f);
+			costs.push_back(100.0f);
+		}
+
+		Run(costs, fixedMs, settings, replay);
+		PrintReplay("hitches", replay);
+		ok &= Check(replay.minScale >= 0.8f, "hitches cost little resolution", "min scale %.3f", replay.minScale);
+		ok &= Check(replay.scales.back() >= settings.maxScale, "recovers between hitches", "final scale %.3f", replay.scales.back());
+	}
+
+	// Close to the edge with a lot of noise, the deadband and snapping stop it hunting
+	{
+		std::vector<float> costs;
+		AddLoad(costs, 2000, 1.3f * target, 0.1f);
+		Run(costs, fixedMs, settings, replay);
+		PrintReplay("noisy", replay);
+
+		uint32_t settledChanges = CountChanges(replay, 200, 2000);
+		ok &= Check(settledChanges <= 10, "doesn't hunt on noise", "%u changes in 1800 frames", settledChanges);
+		ok &= Check(replay.p95Ms <= target * 1.25f, "p95 near the budget", "%.2f ms", replay.p95Ms);
+	}
+
+	// Far over budget it pins at the minimum, and comes back without integral windup
+	{
+		std::vector<float> costs;
+		AddLoad(costs, 600, 10.0f * target, 0.05f);
+		AddLoad(costs, 600, 5.0f, 0.05f);
+		Run(costs, fixedMs, settings, replay);
+		PrintReplay("overload", replay);
+
+		size_t restored = FirstFrame(replay, 600, [&](float scale) { return scale >= settings.maxScale; });
+		ok &= Check(replay.scales[599] <= settings.minScale, "pins at the minimum", "scale %.3f", replay.scales[599]);
+		ok &= Check(restored - 600 <= 400, "recovers after the overload", "%zu frames", restored - 600);
+	}
+
+	printf("%s\n", ok ? "all passed" : "FAILED");
+
+	return ok ? 0 : 1;
+}
+
+static int ReplayTrace(const char* path, float fixedMs, const DynamicResolutionSettings& settings, const char* csvPath)
+{
+	FILE* file = fopen(path, "r");
+
+	if (file == nullptr)
+	{
+		fprintf(stderr, "%s: can't read\n", path);
+		return 1;
+	}
+
+	// Back to the full resolution cost with the same model the replay uses
+	std::vector<float> costs;
+	char line[256];
+
+	while (fgets(line, sizeof(line), file))
+	{
+		float frameMs = 0.0f, scale = 1.0f;
+
+		if (line[0] == '#' || sscanf(line, "%f %f", &frameMs, &scale) < 1 || scale <= 0.0f)
+			continue;
+
+		costs.push_back(std::max(frameMs - fixedMs, 0.0f) / (scale * scale));
+	}
+
+	fclose(file);
+
+	Replay fixed, dynamic;
+	DynamicResolutionSettings fullSettings = settings;
+	fullSettings.minScale = fullSettings.maxScale;
+
+	Run(costs, fixedMs, fullSettings, fixed);
+	Run(costs, fixedMs, settings, dynamic);
+
+	PrintReplay("full resolution", fixed);
+	PrintReplay("dynamic", dynamic);
+
+	if (csvPath != nullptr)
+	{
+		FILE* csv = fopen(csvPath, "w");
+
+		if (csv == nullptr)
+		{
+			fprintf(stderr, "%s: can't write\n", csvPath);
+			return 1;
+		}
+
+		fprintf(csv, "frame,cost,ms,scale\n");
+
+		for (size_t i = 0; i < costs.size(); i++)
+			fprintf(csv, "%zu,%.3f,%.3f,%.4f\n", i, costs[i], dynamic.frameMs[i], dynamic.scales[i]);
+
+		fclose(csv);
+	}
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+		return RunScenarios();
+
+	DynamicResolutionSettings settings;
+	InitDynamicResolutionSettings(settings);
+	float fixedMs = 2.0f;
+	const char* csvPath = nullptr;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--target") == 0 && i + 1 < argc)
+			settings.targetMs = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--fixed") == 0 && i + 1 < argc)
+			fixedMs = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+			csvPath = argv[++i];
+		else
+		{
+			printf("resolutionbench [trace.txt [--target ms] [--fixed ms] [--csv out.csv]]\n");
+			return 1;
+		}
+	}
+
+	return ReplayTrace(argv[1], fixedMs, settings, csvPath);
+}
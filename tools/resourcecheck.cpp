@@ -0,0 +1,362 @@
+//--------------------------------------------------------------------------------------
+// GPU resource accounting check. Drives the tracker directly and through the render
+// graph with the headless backend: live counts and bytes, budget alerts, hard budgets,
+// handles the API hands out again, state objects shared between owners, the leak report
+// and many threads creating and releasing at once. Ends with the cost of a register and unregister pair.
+//
+//   g++ -std=c++17 -O2 resourcecheck.cpp ../gpuresources.cpp ../rendergraph.cpp -lpthread
+//
+//   resourcecheck
+//--------------------------------------------------------------------------------------
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../gpuresources.h"
+#include "../rendergraph.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Milliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static int s_failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		printf("FAILED %s\n", what);
+		s_failures++;
+	}
+}
+
+struct AlertLog
+{
+	uint32_t            count;
+	GpuResourceCategory category;
+	uint64_t            liveBytes;
+};
+
+static void OnAlert(GpuResourceCategory category, uint64_t liveBytes, uint64_t budget, void* pData)
+{
+	(void)budget;
+
+	AlertLog* pLog = static_cast<AlertLog*>(pData);
+	pLog->count++;
+	pLog->category = category;
+	pLog->liveBytes = liveBytes;
+}
+
+// Any distinct addresses will do as handles
+static int s_objects[16];
+
+static void CheckAccounting()
+{
+	GpuResourceTracker tracker;
+
+	tracker.Register(&s_objects[0], GPU_RESOURCE(GPURES_GEOMETRY, "Vertices"), 1000);
+	tracker.Register(&s_objects[1], GPU_RESOURCE(GPURES_GEOMETRY, "Indices"), 200);
+	tracker.Register(&s_objects[2], GPU_RESOURCE(GPURES_STATE, "Sampler"), 0);
+	tracker.Register(nullptr, GPU_RESOURCE(GPURES_STATE, "Failed"), 0);
+
+	GpuResourceCategoryStats geometry = tracker.GetStats(GPURES_GEOMETRY);
+	Check(geometry.liveCount == 2 && geometry.liveBytes == 1200, "live geometry after creation");
+	Check(tracker.GetLiveCount() == 3 && tracker.GetLiveBytes() == 1200, "live totals after creation");
+
+	Check(tracker.Unregister(&s_objects[0]), "unregister a live object");
+	Check(!tracker.Unregister(&s_objects[0]), "unregister twice");
+	Check(!tracker.Unregister(&s_objects[9]), "unregister an unknown handle");
+
+	geometry = tracker.GetStats(GPURES_GEOMETRY);
+	Check(geometry.liveCount == 1 && geometry.liveBytes == 200, "live geometry after release");
+	Check(geometry.createdCount == 2 && geometry.peakBytes == 1200, "created count and peak");
+
+	// The API reuses addresses, a stale record has to be replaced rather than counted twice
+	tracker.Register(&s_objects[1], GPU_RESOURCE(GPURES_TEXTURE, "Reused"), 64);
+	Check(tracker.GetStats(GPURES_GEOMETRY).liveCount == 0, "reused handle leaves its old category");
+	Check(tracker.GetStats(GPURES_TEXTURE).liveBytes == 64, "reused handle moves to its new category");
+	Check(tracker.GetLiveCount() == 2, "reused handle counted once");
+
+	tracker.Unregister(&s_objects[1]);
+	tracker.Unregister(&s_objects[2]);
+	Check(tracker.GetLiveCount() == 0 && tracker.GetLiveBytes() == 0, "nothing live at the end");
+}
+
+// Identical state descriptions give back the same object, each owner releases it once
+static void CheckSharedStates()
+{
+	GpuResourceTracker tracker;
+
+	tracker.Register(&s_objects[0], GPU_RESOURCE(GPURES_STATE, "LinearSampler"), 0);
+	tracker.Register(&s_objects[0], GPU_RESOURCE(GPURES_STATE, "DebugSampler"), 0);
+
+	Check(tracker.GetLiveCount() == 1 && tracker.GetStats(GPURES_STATE).liveCount == 1, "shared state counted once");
+
+	Check(tracker.Unregister(&s_objects[0]), "first owner releases a shared state");
+	Check(tracker.GetStats(GPURES_STATE).liveCount == 1, "shared state live while an owner is left");
+
+	std::string report;
+	Check(tracker.BuildLeakReport(report) == 1 && report.find("LinearSampler") != std::string::npos,
+		  "shared state reported under its first site");
+
+	Check(tracker.Unregister(&s_objects[0]), "second owner releases a shared state");
+	Check(!tracker.Unregister(&s_objects[0]), "third release is a double release");
+	Check(tracker.GetLiveCount() == 0 && tracker.GetStats(GPURES_STATE).liveCount == 0, "shared state gone after both");
+
+	// Only states are shared, anything else under a live handle is still a stale record
+	tracker.Register(&s_objects[1], GPU_RESOURCE(GPURES_STATE, "Blend"), 0);
+	tracker.Register(&s_objects[1], GPU_RESOURCE(GPURES_TEXTURE, "Reused"), 64);
+	Check(tracker.GetStats(GPURES_STATE).liveCount == 0 && tracker.GetStats(GPURES_TEXTURE).liveCount == 1,
+		  "state handle reused by another category replaces it");
+	Check(tracker.Unregister(&s_objects[1]) && tracker.GetLiveCount() == 0, "replaced handle released once");
+}
+
+static void CheckBudgets()
+{
+	GpuResourceTracker tracker;
+	AlertLog log = {};
+
+	tracker.SetAlertCallback(&OnAlert, &log);
+	tracker.SetBudget(GPURES_TEXTURE, 1000);
+
+	tracker.Register(&s_objects[0], GPU_RESOURCE(GPURES_TEXTURE, "A"), 600);
+	Check(log.count == 0, "no alert under budget");
+
+	tracker.Register(&s_objects[1], GPU_RESOURCE(GPURES_TEXTURE, "B"), 600);
+	Check(log.count == 1 && log.category == GPURES_TEXTURE && log.liveBytes == 1200, "alert when going over budget");
+	Check(tracker.GetStats(GPURES_TEXTURE).overBudget, "category flagged over budget");
+
+	tracker.Register(&s_objects[2], GPU_RESOURCE(GPURES_TEXTURE, "C"), 100);
+	Check(log.count == 1, "one alert while over budget");
+
+	// Soft budgets never stop creation
+	Check(tracker.CanCreate(GPURES_TEXTURE, 1 << 20), "soft budget allows creation");
+
+	tracker.Unregister(&s_objects[1]);
+	Check(!tracker.GetStats(GPURES_TEXTURE).overBudget, "flag clears under budget");
+
+	tracker.Register(&s_objects[3], GPU_RESOURCE(GPURES_TEXTURE, "D"), 600);
+	Check(log.count == 2, "alert again after dropping under budget");
+
+	tracker.SetBudget(GPURES_GEOMETRY, 1000, true);
+	Check(tracker.CanCreate(GPURES_GEOMETRY, 1000), "hard budget allows up to the budget");
+	Check(!tracker.CanCreate(GPURES_GEOMETRY, 1001), "hard budget refuses past the budget");
+	Check(tracker.CanCreate(GPURES_CONSTANTS, 1ull << 40), "no budget allows anything");
+
+	tracker.Unregister(&s_objects[0]);
+	tracker.Unregister(&s_objects[2]);
+	tracker.Unregister(&s_objects[3]);
+}
+
+static void CheckLeakReport()
+{
+	GpuResourceTracker tracker;
+	std::string report;
+
+	Check(tracker.BuildLeakReport(report) == 0 && report.empty(), "empty report without leaks");
+
+	tracker.Register(&s_objects[4], GPU_RESOURCE(GPURES_CONSTANTS, "FirstLeak"), 256);
+	tracker.Register(&s_objects[5], GPU_RESOURCE(GPURES_VIEW, "Released"), 0);
+	int leakLine = __LINE__ + 1;
+	tracker.Register(&s_objects[6], GPU_RESOURCE(GPURES_STATE, "SecondLeak"), 0);
+	tracker.Unregister(&s_objects[5]);
+
+	Check(tracker.BuildLeakReport(report) == 2, "report counts the leaks");
+
+	char site[64];
+	snprintf(site, sizeof(site), "resourcecheck.cpp(%d): State 'SecondLeak'", leakLine);
+
+	size_t first = report.find("FirstLeak");
+	size_t second = report.find("SecondLeak");
+
+	Check(report.find(site) != std::string::npos, "report names the creation site");
+	Check(first != std::string::npos && second != std::string::npos && first < second, "report in creation order");
+	Check(report.find("Released") == std::string::npos, "report skips released objects");
+
+	printf("%s", report.c_str());
+
+	tracker.Unregister(&s_objects[4]);
+	tracker.Unregister(&s_objects[6]);
+}
+
+static void EmptyPass(const RenderGraphPassContext& context, void* pData)
+{
+	(void)context;
+	(void)pData;
+}
+
+// Shadow map, depth and a post target like the app's graph, on the headless backend
+static void BuildFrame(RenderGraph& graph, uint32_t width, uint32_t height)
+{
+	graph.Reset();
+
+	RenderGraphTextureDesc shadowDesc = { 2048, 2048, 0, 4, RG_BIND_DEPTH_STENCIL | RG_BIND_SHADER_RESOURCE };
+	RenderGraphTextureDesc depthDesc = { width, height, 0, 4, RG_BIND_DEPTH_STENCIL };
+	RenderGraphTextureDesc colorDesc = { width, height, 0, 8, RG_BIND_RENDER_TARGET | RG_BIND_SHADER_RESOURCE };
+	RenderGraphTextureDesc backDesc = { width, height, 0, 4, RG_BIND_RENDER_TARGET };
+
+	RenderGraphResource shadow = graph.CreateTexture("Shadow", shadowDesc);
+	RenderGraphResource depth = graph.CreateTexture("Depth", depthDesc);
+	RenderGraphResource color = graph.CreateTexture("Color", colorDesc);
+	RenderGraphResource back = graph.ImportTexture("Back", backDesc, &s_objects[15], RG_STATE_UNDEFINED, RG_STATE_PRESENT);
+
+	uint32_t shadowPass = graph.AddPass("Shadow", &EmptyPass, nullptr);
+	graph.Write(shadowPass, shadow, RG_STATE_DEPTH_WRITE);
+
+	uint32_t mainPass = graph.AddPass("Main", &EmptyPass, nullptr);
+	graph.Read(mainPass, shadow);
+	graph.Write(mainPass, depth, RG_STATE_DEPTH_WRITE);
+	graph.Write(mainPass, color);
+
+	uint32_t postPass = graph.AddPass("Post", &EmptyPass, nullptr);
+	graph.Read(postPass, color);
+	graph.Write(postPass, back);
+
+	graph.Compile();
+}
+
+static void CheckRenderGraph()
+{
+	GpuResourceTracker tracker;
+	HeadlessRenderGraphBackend headless;
+	TrackedRenderGraphBackend backend;
+	backend.Init(&headless, &tracker);
+
+	RenderGraph graph;
+
+	BuildFrame(graph, 1280, 720);
+	graph.Execute(&backend);
+
+	uint32_t live = tracker.GetStats(GPURES_RENDER_TARGET).liveCount;
+	uint64_t bytes = tracker.GetStats(GPURES_RENDER_TARGET).liveBytes;
+
+	Check(live == headless.GetLiveTextures(), "tracker agrees with the backend");
+	Check(live > 0 && bytes >= 2048ull * 2048 * 4, "graph textures on the books");
+
+	// Steady state frames reuse the cached textures
+	for (int frame = 0; frame < 10; frame++)
+	{
+		BuildFrame(graph, 1280, 720);
+		graph.Execute(&backend);
+	}
+
+	Check(tracker.GetStats(GPURES_RENDER_TARGET).createdCount == live, "nothing created in steady state");
+
+	// A resize replaces the screen sized targets, the old ones age out of the cache
+	for (int frame = 0; frame < 10; frame++)
+	{
+		BuildFrame(graph, 1920, 1080);
+		graph.Execute(&backend);
+	}
+
+	Check(tracker.GetStats(GPURES_RENDER_TARGET).liveCount == headless.GetLiveTextures(), "tracker agrees after a resize");
+
+	graph.ReleasePhysical(&backend);
+
+	std::string report;
+	Check(headless.GetLiveTextures() == 0, "backend has nothing live after release");
+	Check(tracker.BuildLeakReport(report) == 0, "no leaks after release");
+}
+
+struct StressData
+{
+	GpuResourceTracker* pTracker;
+	uint32_t            thread;
+	uint32_t            count;
+};
+
+static void StressThread(StressData* pData)
+{
+	// Unique fake handles per thread, never dereferenced
+	uintptr_t base = ((uintptr_t)pData->thread + 1) << 32;
+
+	for (uint32_t i = 0; i < pData->count; i++)
+	{
+		const void* handle = reinterpret_cast<const void*>(base + (i & 63) * 16 + 16);
+		pData->pTracker->Register(handle, GPU_RESOURCE(GPURES_CONSTANTS, "Stress"), 16);
+
+		if (i & 1)
+			pData->pTracker->Unregister(handle);
+	}
+
+	for (uint32_t i = 0; i < 64; i++)
+		pData->pTracker->Unregister(reinterpret_cast<const void*>(base + i * 16 + 16));
+}
+
+static void CheckThreads()
+{
+	GpuResourceTracker tracker;
+
+	const uint32_t threadCount = 8;
+	StressData data[threadCount];
+	std::vector<std::thread> threads;
+
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		data[i].pTracker = &tracker;
+		data[i].thread = i;
+		data[i].count = 20000;
+		threads.push_back(std::thread(&StressThread, &data[i]));
+	}
+
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	Check(tracker.GetLiveCount() == 0 && tracker.GetLiveBytes() == 0, "threads leave nothing live");
+	Check(tracker.GetStats(GPURES_CONSTANTS).createdCount == threadCount * 20000, "threads counted every creation");
+}
+
+static void MeasureCost()
+{
+	GpuResourceTracker tracker;
+
+	// Startup creates around a hundred objects with a few hundred live, time that shape
+	const uint32_t liveCount = 500;
+	const uint32_t iterations = 200000;
+	std::vector<int> objects(liveCount + 1);
+
+	for (uint32_t i = 0; i < liveCount; i++)
+		tracker.Register(&objects[i], GPU_RESOURCE(GPURES_GEOMETRY, "Live"), 1024);
+
+	auto start = Clock::now();
+
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		tracker.Register(&objects[liveCount], GPU_RESOURCE(GPURES_GEOMETRY, "Churn"), 1024);
+		tracker.Unregister(&objects[liveCount]);
+	}
+
+	double ms = Milliseconds(start);
+
+	printf("register and unregister with %u live: %.0f ns per pair\n", liveCount, ms * 1e6 / iterations);
+
+	for (uint32_t i = 0; i < liveCount; i++)
+		tracker.Unregister(&objects[i]);
+}
+
+int main()
+{
+	CheckAccounting();
+	CheckSharedStates();
+	CheckBudgets();
+	CheckLeakReport();
+	CheckRenderGraph();
+	CheckThreads();
+
+	if (s_failures != 0)
+	{
+		printf("%d checks failed\n", s_failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+
+	MeasureCost();
+
+	return 0;
+}
@@ -0,0 +1,341 @@
+//--------------------------------------------------------------------------------------
+// Scene compiler and load benchmark.
+//
+//   g++ -std=c++17 -O2 scenetool.cpp ../scene.cpp ../scenecompiler.cpp
+//
+//   scenetool compile input.txt output.scene   text scene to binary
+//   scenetool patch input.txt output.patch     text patch to binary
+//   scenetool bench [entities]                 generate, write, load and patch a large
+//                                              scene, 1M entities by default
+//--------------------------------------------------------------------------------------
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../scene.h"
+#include "../scenecompiler.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Milliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static bool ReadWholeFile(const char* path, std::vector<uint8_t>& data)
+{
+	FILE* file = fopen(path, "rb");
+
+	if (file == nullptr)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	data.resize(size > 0 ? (size_t)size : 0);
+	bool ok = size >= 0 && fread(data.data(), 1, data.size(), file) == data.size();
+	fclose(file);
+
+	return ok;
+}
+
+static bool WriteWholeFile(const char* path, const std::vector<uint8_t>& data)
+{
+	FILE* file = fopen(path, "wb");
+
+	if (file == nullptr)
+		return false;
+
+	bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+
+	return fclose(file) == 0 && ok;
+}
+
+static int Compile(const char* inputPath, const char* outputPath, bool patch)
+{
+	std::vector<uint8_t> text;
+
+	if (!ReadWholeFile(inputPath, text))
+	{
+		fprintf(stderr, "%s: can't read\n", inputPath);
+		return 1;
+	}
+
+	text.push_back(0);
+
+	std::vector<uint8_t> output;
+	char error[512];
+	bool ok = patch ? CompileScenePatch((const char*)text.data(), output, error, sizeof(error)) :
+					  CompileScene((const char*)text.data(), output, error, sizeof(error));
+
+	if (!ok)
+	{
+		fprintf(stderr, "%s: %s\n", inputPath, error);
+		return 1;
+	}
+
+	if (!WriteWholeFile(outputPath, output))
+	{
+		fprintf(stderr, "%s: can't write\n", outputPath);
+		return 1;
+	}
+
+	printf("%s -> %s, %zu bytes\n", inputPath, outputPath, output.size());
+
+	return 0;
+}
+
+static int Bench(uint32_t entityCount)
+{
+	const char* scenePath = "scenebench.scene";
+	const char* materialNames[] = { "stone", "metal", "wood", "glass" };
+
+	// Text form first, to time the authoring path as well
+	std::string text = "reserve entities 1024 lights 64\nmesh cube\nmesh floor\n";
+
+	for (int i = 0; i < 4; i++)
+		text += std::string("material ") + materialNames[i] + " diffuse 0.5 0.5 0.5 1 specular 0.2 0.2 0.2 1 power 8\n";
+
+	char line[256];
+
+	for (uint32_t i = 0; i < entityCount; i++)
+	{
+		snprintf(line, sizeof(line), "entity e%u mesh %s material %s position %.2f %.2f %.2f rotation 0 %u 0%s\n", i,
+				 (i & 7) ? "cube" : "floor", materialNames[i & 3], (i % 1000) * 2.0f, (i / 1000000) * 2.0f, ((i / 1000) % 1000) * 2.0f,
+				 i % 360, (i & 1) ? " static" : "");
+		text += line;
+	}
+
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		snprintf(line, sizeof(line), "light l%u point position %u 1 %u color 1 1 1 range 4\n", i, i % 16 * 4, i / 16 * 4);
+		text += line;
+	}
+
+	printf("%u entities, %.1f MB of text\n", entityCount, text.size() / 1.0e6);
+
+	char error[512];
+	SceneDescription description;
+
+	auto parseStart = Clock::now();
+
+	if (!ParseSceneText(text.c_str(), description, error, sizeof(error)))
+	{
+		printf("FAIL: %s\n", error);
+		return 1;
+	}
+
+	double parseMs = Milliseconds(parseStart);
+
+	std::vector<uint8_t> binary;
+	auto writeStart = Clock::now();
+
+	if (!WriteScene(description, binary, error, sizeof(error)))
+	{
+		printf("FAIL: %s\n", error);
+		return 1;
+	}
+
+	double writeMs = Milliseconds(writeStart);
+
+	printf("compile: parse %.1f ms, write %.1f ms, %.1f MB binary\n", parseMs, writeMs, binary.size() / 1.0e6);
+
+	if (!WriteWholeFile(scenePath, binary))
+	{
+		printf("FAIL: can't write %s\n", scenePath);
+		return 1;
+	}
+
+	// Warm page cache, best of several loads
+	Scene scene;
+	double mapMs = 1.0e30;
+
+	for (int i = 0; i < 10; i++)
+	{
+		auto start = Clock::now();
+
+		if (!scene.Load(scenePath))
+		{
+			printf("FAIL: can't load %s\n", scenePath);
+			return 1;
+		}
+
+		double ms = Milliseconds(start);
+		mapMs = ms < mapMs ? ms : mapMs;
+	}
+
+	// Touching every world matrix pulls the pages in, the cost a renderer pays on first use
+	auto touchStart = Clock::now();
+	float checksum = 0.0f;
+
+	for (uint32_t i = 0; i < scene.GetEntityCount(); i++)
+		checksum += scene.GetWorldMatrices()[i].m[3][0];
+
+	double touchMs = Milliseconds(touchStart);
+
+	double readMs = 1.0e30;
+	Scene copied;
+
+	for (int i = 0; i < 3; i++)
+	{
+		auto start = Clock::now();
+		std::vector<uint8_t> data;
+
+		if (!ReadWholeFile(scenePath, data) || !copied.LoadFromMemory(data.data(), data.size()))
+		{
+			printf("FAIL: can't read %s\n", scenePath);
+			return 1;
+		}
+
+		double ms = Milliseconds(start);
+		readMs = ms < readMs ? ms : readMs;
+	}
+
+	printf("load: mmap + fix-ups %.3f ms, first touch of every world matrix %.1f ms, read + fix-ups %.1f ms (checksum %.0f)\n",
+		   mapMs, touchMs, readMs, checksum);
+
+	// Out of range indices in the data have to fail the load, one field at a time
+	const SceneHeader* pHeader = reinterpret_cast<const SceneHeader*>(binary.data());
+	uint64_t lastEntity = pHeader->entities.offset + (uint64_t)(pHeader->entityCount - 1) * sizeof(SceneEntity);
+	uint64_t lastName = pHeader->entityNames.offset + (uint64_t)(pHeader->entityCount - 1) * sizeof(SceneNameEntry);
+
+	struct Corruption
+	{
+		const char* what;
+		uint64_t    offset;
+		uint32_t    value;
+	};
+
+	Corruption corruptions[] =
+	{
+		{ "entity mesh", lastEntity + offsetof(SceneEntity, mesh), pHeader->meshCount },
+		{ "entity material", lastEntity + offsetof(SceneEntity, material), pHeader->materialCount },
+		{ "name index", lastName + offsetof(SceneNameEntry, index), pHeader->entityCount },
+		{ "diffuse texture", pHeader->materials.offset + offsetof(SceneMaterial, diffuseTexture), pHeader->textureCount },
+	};
+
+	for (const Corruption& corruption : corruptions)
+	{
+		std::vector<uint8_t> damaged = binary;
+		memcpy(damaged.data() + corruption.offset, &corruption.value, sizeof(uint32_t));
+
+		if (copied.LoadFromMemory(damaged.data(), damaged.size()))
+		{
+			printf("FAIL: loaded a scene with an out of range %s\n", corruption.what);
+			return 1;
+		}
+	}
+
+	// Every entity has to be found by name again
+	auto findStart = Clock::now();
+	uint32_t found = 0;
+
+	for (uint32_t i = 0; i < entityCount; i++)
+	{
+		snprintf(line, sizeof(line), "e%u", i);
+		found += scene.FindEntity(HashSceneName(line)) != SceneInvalidIndex;
+	}
+
+	double findMs = Milliseconds(findStart);
+
+	if (found != entityCount)
+	{
+		printf("FAIL: found %u of %u entities by name\n", found, entityCount);
+		return 1;
+	}
+
+	// Move a thousand entities, add a few, hide one and retint a material
+	std::string patchText;
+
+	for (uint32_t i = 0; i < 1000; i++)
+	{
+		snprintf(line, sizeof(line), "entity e%u position %u 5 0\n", (uint32_t)(((uint64_t)i * 7919) % entityCount), i);
+		patchText += line;
+	}
+
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		snprintf(line, sizeof(line), "entity added%u mesh cube material metal position %u 10 0 scale 0.5\n", i, i);
+		patchText += line;
+	}
+
+	patchText += "remove e0\nmaterial wood diffuse 0.8 0.6 0.3 1\nlight l3 spot position 0 4 0 direction 0 -1 0\n";
+
+	std::vector<uint8_t> patch;
+
+	if (!CompileScenePatch(patchText.c_str(), patch, error, sizeof(error)))
+	{
+		printf("FAIL: %s\n", error);
+		return 1;
+	}
+
+	uint32_t patchOps = reinterpret_cast<const ScenePatchHeader*>(patch.data())->opCount;
+
+	ScenePatchResult result;
+	auto patchStart = Clock::now();
+	bool applied = scene.ApplyPatch(patch.data(), patch.size(), result);
+	double patchMs = Milliseconds(patchStart);
+
+	uint32_t moved = scene.FindEntity(HashSceneName("e7919"));
+	uint32_t added = scene.FindEntity(HashSceneName("added15"));
+
+	if (!applied || result.entitiesAdded != 16 || added == SceneInvalidIndex || scene.GetWorldMatrices()[added].m[3][1] != 10.0f ||
+		(entityCount > 7919 && scene.GetTransforms()[moved].position.y != 5.0f) ||
+		!(scene.GetEntities()[scene.FindEntity(HashSceneName("e0"))].flags & SCENE_ENTITY_HIDDEN))
+	{
+		printf("FAIL: patch wasn't applied as written\n");
+		return 1;
+	}
+
+	// Adding more entities than were reserved has to leave the scene untouched
+	std::string overflowText;
+
+	for (uint32_t i = 0; i < 2000; i++)
+	{
+		snprintf(line, sizeof(line), "entity overflow%u mesh cube material metal\n", i);
+		overflowText += line;
+	}
+
+	CompileScenePatch(overflowText.c_str(), patch, error, sizeof(error));
+	uint32_t countBefore = scene.GetEntityCount();
+
+	if (scene.ApplyPatch(patch.data(), patch.size(), result) || !result.needsReload || scene.GetEntityCount() != countBefore)
+	{
+		printf("FAIL: an oversized patch was applied\n");
+		return 1;
+	}
+
+	printf("lookup: %.1f ns per name, patch of %u ops applied in %.3f ms\n", findMs * 1.0e6 / entityCount, patchOps, patchMs);
+
+	scene.Unload();
+	remove(scenePath);
+
+	return 0;
+}
+
+static void PrintUsage()
+{
+	printf("scenetool compile input.txt output.scene\n"
+		   "scenetool patch input.txt output.patch\n"
+		   "scenetool bench [entities]\n");
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc >= 4 && strcmp(argv[1], "compile") == 0)
+		return Compile(argv[2], argv[3], false);
+
+	if (argc >= 4 && strcmp(argv[1], "patch") == 0)
+		return Compile(argv[2], argv[3], true);
+
+	if (argc >= 2 && strcmp(argv[1], "bench") == 0)
+		return Bench(argc >= 3 ? (uint32_t)atoi(argv[2]) : 1000000);
+
+	PrintUsage();
+
+	return 1;
+}
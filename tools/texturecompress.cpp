@@ -0,0 +1,838 @@
+#include "texturecompress.h"
+
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+#include "../jobsystem.h"
+
+namespace
+{
+	// Block texels split into channels so four texels can be tested at once
+	struct BlockSoA
+	{
+		alignas(16) float c[4][16];
+	};
+
+	// Palette in the same layout, entry k of channel n is p[n][k]
+	struct Palette
+	{
+		alignas(16) float p[4][16];
+		int count;
+	};
+
+	const int BC7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	inline float Clamp255(float v)
+	{
+		return v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v);
+	}
+
+	void ToSoA(const ColorBlock& block, BlockSoA& soa)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			for (int n = 0; n < 4; n++)
+				soa.c[n][i] = block.texels[i][n];
+		}
+	}
+
+	// Nearest palette entry for every texel, returns the summed squared error. The palette
+	// count has to be a multiple of 4 except for the 4 entry BC1 case, which is one group.
+	float FindIndices(const BlockSoA& block, int channels, const Palette& palette, uint8_t indices[16])
+	{
+		float totalError = 0.0f;
+
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 best = _mm_set1_ps(3.0e38f);
+			__m128i bestIndex = _mm_setzero_si128();
+
+			for (int k = 0; k < palette.count; k++)
+			{
+				__m128 error = _mm_setzero_ps();
+
+				for (int n = 0; n < channels; n++)
+				{
+					__m128 d = _mm_sub_ps(_mm_load_ps(block.c[n] + i), _mm_set1_ps(palette.p[n][k]));
+					error = _mm_add_ps(error, _mm_mul_ps(d, d));
+				}
+
+				__m128i less = _mm_castps_si128(_mm_cmplt_ps(error, best));
+				best = _mm_min_ps(error, best);
+				bestIndex = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi32(k)), _mm_andnot_si128(less, bestIndex));
+			}
+
+			alignas(16) int32_t lanes[4];
+			alignas(16) float errors[4];
+			_mm_store_si128((__m128i*)lanes, bestIndex);
+			_mm_store_ps(errors, best);
+
+			for (int j = 0; j < 4; j++)
+			{
+				indices[i + j] = (uint8_t)lanes[j];
+				totalError += errors[j];
+			}
+		}
+
+		return totalError;
+	}
+
+	// Endpoints along the principal axis of the texels, power iteration on the covariance
+	void PrincipalEndpoints(const BlockSoA& block, int channels, float e0[4], float e1[4])
+	{
+		float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+		for (int n = 0; n < channels; n++)
+		{
+			for (int i = 0; i < 16; i++)
+				mean[n] += block.c[n][i];
+
+			mean[n] /= 16.0f;
+		}
+
+		float cov[4][4];
+		memset(cov, 0, sizeof(cov));
+
+		for (int i = 0; i < 16; i++)
+		{
+			for (int a = 0; a < channels; a++)
+			{
+				for (int b = a; b < channels; b++)
+					cov[a][b] += (block.c[a][i] - mean[a]) * (block.c[b][i] - mean[b]);
+			}
+		}
+
+		for (int a = 0; a < channels; a++)
+		{
+			for (int b = 0; b < a; b++)
+				cov[a][b] = cov[b][a];
+		}
+
+		float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			float length = 0.0f;
+
+			for (int a = 0; a < channels; a++)
+			{
+				for (int b = 0; b < channels; b++)
+					next[a] += cov[a][b] * axis[b];
+
+				length += next[a] * next[a];
+			}
+
+			if (length < 1.0e-12f)
+				break;
+
+			length = 1.0f / sqrtf(length);
+
+			for (int a = 0; a < channels; a++)
+				axis[a] = next[a] * length;
+		}
+
+		float minT = 0.0f;
+		float maxT = 0.0f;
+
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0.0f;
+
+			for (int n = 0; n < channels; n++)
+				t += (block.c[n][i] - mean[n]) * axis[n];
+
+			minT = fminf(minT, t);
+			maxT = fmaxf(maxT, t);
+		}
+
+		for (int n = 0; n < channels; n++)
+		{
+			e0[n] = Clamp255(mean[n] + axis[n] * minT);
+			e1[n] = Clamp255(mean[n] + axis[n] * maxT);
+		}
+	}
+
+	// Least squares endpoints for fixed indices, weights[k] is how far entry k is towards e1
+	bool RefineEndpoints(const BlockSoA& block, int channels, const uint8_t indices[16], const float* weights, float e0[4], float e1[4])
+	{
+		float a = 0.0f, b = 0.0f, c = 0.0f;
+		float x[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		float y[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+		for (int i = 0; i < 16; i++)
+		{
+			float w = weights[indices[i]];
+			float iw = 1.0f - w;
+
+			a += iw * iw;
+			b += iw * w;
+			c += w * w;
+
+			for (int n = 0; n < channels; n++)
+			{
+				x[n] += iw * block.c[n][i];
+				y[n] += w * block.c[n][i];
+			}
+		}
+
+		float det = a * c - b * b;
+
+		if (fabsf(det) < 1.0e-6f)
+			return false;
+
+		float invDet = 1.0f / det;
+
+		for (int n = 0; n < channels; n++)
+		{
+			e0[n] = Clamp255((c * x[n] - b * y[n]) * invDet);
+			e1[n] = Clamp255((a * y[n] - b * x[n]) * invDet);
+		}
+
+		return true;
+	}
+
+	//----------------------------------------------------------------------------------
+	// BC1
+	//----------------------------------------------------------------------------------
+	uint16_t PackRGB565(const float c[4])
+	{
+		uint32_t r = (uint32_t)(c[0] * 31.0f / 255.0f + 0.5f);
+		uint32_t g = (uint32_t)(c[1] * 63.0f / 255.0f + 0.5f);
+		uint32_t b = (uint32_t)(c[2] * 31.0f / 255.0f + 0.5f);
+
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	void UnpackRGB565(uint16_t v, float c[4])
+	{
+		uint32_t r = (v >> 11) & 31;
+		uint32_t g = (v >> 5) & 63;
+		uint32_t b = v & 31;
+
+		c[0] = (float)((r << 3) | (r >> 2));
+		c[1] = (float)((g << 2) | (g >> 4));
+		c[2] = (float)((b << 3) | (b >> 2));
+		c[3] = 255.0f;
+	}
+
+	const float BC1Weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+	float EvaluateBC1(const BlockSoA& block, uint16_t c0, uint16_t c1, uint8_t indices[16])
+	{
+		float e0[4], e1[4];
+		UnpackRGB565(c0, e0);
+		UnpackRGB565(c1, e1);
+
+		Palette palette;
+		palette.count = 4;
+
+		for (int n = 0; n < 3; n++)
+		{
+			for (int k = 0; k < 4; k++)
+				palette.p[n][k] = e0[n] + (e1[n] - e0[n]) * BC1Weights[k];
+		}
+
+		return FindIndices(block, 3, palette, indices);
+	}
+
+	void EncodeColorBlock(const ColorBlock& block, uint8_t* pOutput)
+	{
+		BlockSoA soa;
+		ToSoA(block, soa);
+
+		float e0[4], e1[4];
+		PrincipalEndpoints(soa, 3, e0, e1);
+
+		uint16_t c0 = PackRGB565(e1);
+		uint16_t c1 = PackRGB565(e0);
+		uint8_t indices[16];
+		float error = EvaluateBC1(soa, c0, c1, indices);
+
+		for (int iteration = 0; iteration < 2; iteration++)
+		{
+			float r0[4], r1[4];
+
+			if (!RefineEndpoints(soa, 3, indices, BC1Weights, r0, r1))
+				break;
+
+			uint16_t n0 = PackRGB565(r0);
+			uint16_t n1 = PackRGB565(r1);
+			uint8_t candidate[16];
+			float candidateError = EvaluateBC1(soa, n0, n1, candidate);
+
+			if (candidateError >= error)
+				break;
+
+			c0 = n0;
+			c1 = n1;
+			error = candidateError;
+			memcpy(indices, candidate, sizeof(indices));
+		}
+
+		// Four colour mode needs c0 > c1, equal endpoints mean a solid block
+		if (c0 < c1)
+		{
+			uint16_t t = c0;
+			c0 = c1;
+			c1 = t;
+
+			static const uint8_t swapped[4] = { 1, 0, 3, 2 };
+
+			for (int i = 0; i < 16; i++)
+				indices[i] = swapped[indices[i]];
+		}
+		else if (c0 == c1)
+		{
+			memset(indices, 0, sizeof(indices));
+		}
+
+		uint32_t bits = 0;
+
+		for (int i = 0; i < 16; i++)
+			bits |= (uint32_t)indices[i] << (i * 2);
+
+		pOutput[0] = (uint8_t)c0;
+		pOutput[1] = (uint8_t)(c0 >> 8);
+		pOutput[2] = (uint8_t)c1;
+		pOutput[3] = (uint8_t)(c1 >> 8);
+		memcpy(pOutput + 4, &bits, 4);
+	}
+
+	//----------------------------------------------------------------------------------
+	// BC4
+	//----------------------------------------------------------------------------------
+	void BuildBC4Palette(int a0, int a1, Palette& palette)
+	{
+		palette.count = 8;
+		palette.p[0][0] = (float)a0;
+		palette.p[0][1] = (float)a1;
+
+		if (a0 > a1)
+		{
+			for (int k = 2; k < 8; k++)
+				palette.p[0][k] = floorf(((8 - k) * a0 + (k - 1) * a1) / 7.0f + 0.5f);
+		}
+		else
+		{
+			for (int k = 2; k < 6; k++)
+				palette.p[0][k] = floorf(((6 - k) * a0 + (k - 1) * a1) / 5.0f + 0.5f);
+
+			palette.p[0][6] = 0.0f;
+			palette.p[0][7] = 255.0f;
+		}
+	}
+
+	//----------------------------------------------------------------------------------
+	// BC7
+	//----------------------------------------------------------------------------------
+
+	// 7 bit endpoint plus a shared p-bit, picks the p-bit that lands closest
+	void QuantizeBC7Endpoint(const float e[4], uint8_t q[4], uint8_t& pbit, float decoded[4])
+	{
+		float bestError = 3.0e38f;
+
+		for (int p = 0; p < 2; p++)
+		{
+			uint8_t candidate[4];
+			float error = 0.0f;
+
+			for (int n = 0; n < 4; n++)
+			{
+				int v = (int)floorf((e[n] - p) * 0.5f + 0.5f);
+				v = v < 0 ? 0 : (v > 127 ? 127 : v);
+				candidate[n] = (uint8_t)v;
+
+				float d = (float)(v * 2 + p) - e[n];
+				error += d * d;
+			}
+
+			if (error < bestError)
+			{
+				bestError = error;
+				pbit = (uint8_t)p;
+				memcpy(q, candidate, 4);
+			}
+		}
+
+		for (int n = 0; n < 4; n++)
+			decoded[n] = (float)(q[n] * 2 + pbit);
+	}
+
+	float EvaluateBC7(const BlockSoA& block, const float d0[4], const float d1[4], uint8_t indices[16])
+	{
+		Palette palette;
+		palette.count = 16;
+
+		for (int n = 0; n < 4; n++)
+		{
+			for (int k = 0; k < 16; k++)
+				palette.p[n][k] = (float)(((64 - BC7Weights[k]) * (int)d0[n] + BC7Weights[k] * (int)d1[n] + 32) >> 6);
+		}
+
+		return FindIndices(block, 4, palette, indices);
+	}
+
+	class BitWriter
+	{
+	private:
+		uint8_t* _pData;
+		uint32_t _position;
+
+	public:
+		BitWriter(uint8_t* pData) : _pData(pData), _position(0) { memset(pData, 0, 16); }
+
+		void Write(uint32_t value, uint32_t bits)
+		{
+			for (uint32_t i = 0; i < bits; i++, _position++)
+			{
+				if (value & (1u << i))
+					_pData[_position >> 3] |= (uint8_t)(1u << (_position & 7));
+			}
+		}
+	};
+
+	class BitReader
+	{
+	private:
+		const uint8_t* _pData;
+		uint32_t       _position;
+
+	public:
+		BitReader(const uint8_t* pData) : _pData(pData), _position(0) {}
+
+		uint32_t Read(uint32_t bits)
+		{
+			uint32_t value = 0;
+
+			for (uint32_t i = 0; i < bits; i++, _position++)
+			{
+				if (_pData[_position >> 3] & (1u << (_position & 7)))
+					value |= 1u << i;
+			}
+
+			return value;
+		}
+	};
+
+	void LoadBlock(const uint8_t* pRGBA, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, ColorBlock& block)
+	{
+		// Edge blocks repeat the last row and column
+		for (uint32_t y = 0; y < 4; y++)
+		{
+			uint32_t sy = by * 4 + y < height ? by * 4 + y : height - 1;
+
+			for (uint32_t x = 0; x < 4; x++)
+			{
+				uint32_t sx = bx * 4 + x < width ? bx * 4 + x : width - 1;
+				memcpy(block.texels[y * 4 + x], pRGBA + ((size_t)sy * width + sx) * 4, 4);
+			}
+		}
+	}
+
+	struct CompressJob
+	{
+		const uint8_t* pRGBA;
+		uint32_t       width;
+		uint32_t       height;
+		uint32_t       blocksX;
+		BlockFormat    format;
+		uint8_t*       pOutput;
+	};
+
+	void CompressRows(void* pData, uint32_t begin, uint32_t end)
+	{
+		const CompressJob& job = *static_cast<CompressJob*>(pData);
+		uint32_t blockBytes = GetBlockBytes(job.format);
+
+		for (uint32_t by = begin; by < end; by++)
+		{
+			for (uint32_t bx = 0; bx < job.blocksX; bx++)
+			{
+				ColorBlock block;
+				LoadBlock(job.pRGBA, job.width, job.height, bx, by, block);
+
+				uint8_t* pBlock = job.pOutput + ((size_t)by * job.blocksX + bx) * blockBytes;
+
+				switch (job.format)
+				{
+				case BLOCK_BC1: EncodeBC1(block, pBlock); break;
+				case BLOCK_BC3: EncodeBC3(block, pBlock); break;
+				case BLOCK_BC5: EncodeBC5(block, pBlock); break;
+				case BLOCK_BC7: EncodeBC7(block, pBlock); break;
+				}
+			}
+		}
+	}
+}
+
+uint32_t GetBlockBytes(BlockFormat format)
+{
+	return format == BLOCK_BC1 ? 8 : 16;
+}
+
+void EncodeBC1(const ColorBlock& block, uint8_t* pOutput)
+{
+	EncodeColorBlock(block, pOutput);
+}
+
+void EncodeBC4(const uint8_t values[16], uint8_t* pOutput)
+{
+	BlockSoA soa;
+	int minValue = 255, maxValue = 0;
+	int innerMin = 255, innerMax = 0;
+
+	for (int i = 0; i < 16; i++)
+	{
+		soa.c[0][i] = values[i];
+		minValue = values[i] < minValue ? values[i] : minValue;
+		maxValue = values[i] > maxValue ? values[i] : maxValue;
+
+		// Range without the two values the six value mode has for free
+		if (values[i] != 0 && values[i] != 255)
+		{
+			innerMin = values[i] < innerMin ? values[i] : innerMin;
+			innerMax = values[i] > innerMax ? values[i] : innerMax;
+		}
+	}
+
+	int bestA0 = maxValue;
+	int bestA1 = minValue;
+	uint8_t bestIndices[16];
+	float bestError = 3.0e38f;
+
+	if (minValue == maxValue)
+	{
+		memset(bestIndices, 0, sizeof(bestIndices));
+	}
+	else
+	{
+		// Eight value mode with the range pulled in a little at either end
+		for (int inset0 = 0; inset0 < 4; inset0++)
+		{
+			for (int inset1 = 0; inset1 < 4; inset1++)
+			{
+				int a0 = maxValue - inset0 * (maxValue - minValue) / 28;
+				int a1 = minValue + inset1 * (maxValue - minValue) / 28;
+
+				if (a0 <= a1)
+					continue;
+
+				Palette palette;
+				BuildBC4Palette(a0, a1, palette);
+
+				uint8_t indices[16];
+				float error = FindIndices(soa, 1, palette, indices);
+
+				if (error < bestError)
+				{
+					bestError = error;
+					bestA0 = a0;
+					bestA1 = a1;
+					memcpy(bestIndices, indices, sizeof(indices));
+				}
+			}
+		}
+
+		// Six value mode, wins when the block touches 0 or 255
+		if (innerMin <= innerMax)
+		{
+			Palette palette;
+			BuildBC4Palette(innerMin, innerMax, palette);
+
+			uint8_t indices[16];
+			float error = FindIndices(soa, 1, palette, indices);
+
+			if (error < bestError)
+			{
+				bestError = error;
+				bestA0 = innerMin;
+				bestA1 = innerMax;
+				memcpy(bestIndices, indices, sizeof(indices));
+			}
+		}
+	}
+
+	pOutput[0] = (uint8_t)bestA0;
+	pOutput[1] = (uint8_t)bestA1;
+
+	uint64_t bits = 0;
+
+	for (int i = 0; i < 16; i++)
+		bits |= (uint64_t)bestIndices[i] << (i * 3);
+
+	for (int i = 0; i < 6; i++)
+		pOutput[2 + i] = (uint8_t)(bits >> (i * 8));
+}
+
+void EncodeBC3(const ColorBlock& block, uint8_t* pOutput)
+{
+	uint8_t alpha[16];
+
+	for (int i = 0; i < 16; i++)
+		alpha[i] = block.texels[i][3];
+
+	EncodeBC4(alpha, pOutput);
+	EncodeColorBlock(block, pOutput + 8);
+}
+
+void EncodeBC5(const ColorBlock& block, uint8_t* pOutput)
+{
+	uint8_t red[16], green[16];
+
+	for (int i = 0; i < 16; i++)
+	{
+		red[i] = block.texels[i][0];
+		green[i] = block.texels[i][1];
+	}
+
+	EncodeBC4(red, pOutput);
+	EncodeBC4(green, pOutput + 8);
+}
+
+void EncodeBC7(const ColorBlock& block, uint8_t* pOutput)
+{
+	BlockSoA soa;
+	ToSoA(block, soa);
+
+	float e0[4], e1[4];
+	PrincipalEndpoints(soa, 4, e0, e1);
+
+	uint8_t q0[4], q1[4], p0, p1;
+	float d0[4], d1[4];
+	QuantizeBC7Endpoint(e0, q0, p0, d0);
+	QuantizeBC7Endpoint(e1, q1, p1, d1);
+
+	uint8_t indices[16];
+	float error = EvaluateBC7(soa, d0, d1, indices);
+
+	float weights[16];
+
+	for (int k = 0; k < 16; k++)
+		weights[k] = BC7Weights[k] / 64.0f;
+
+	for (int iteration = 0; iteration < 2; iteration++)
+	{
+		float r0[4], r1[4];
+
+		if (!RefineEndpoints(soa, 4, indices, weights, r0, r1))
+			break;
+
+		uint8_t n0[4], n1[4], np0, np1;
+		float nd0[4], nd1[4];
+		QuantizeBC7Endpoint(r0, n0, np0, nd0);
+		QuantizeBC7Endpoint(r1, n1, np1, nd1);
+
+		uint8_t candidate[16];
+		float candidateError = EvaluateBC7(soa, nd0, nd1, candidate);
+
+		if (candidateError >= error)
+			break;
+
+		memcpy(q0, n0, 4);
+		memcpy(q1, n1, 4);
+		p0 = np0;
+		p1 = np1;
+		error = candidateError;
+		memcpy(indices, candidate, sizeof(indices));
+	}
+
+	// The anchor texel only stores 3 bits, so its index must have the top bit clear
+	if (indices[0] & 8)
+	{
+		uint8_t t[4];
+		memcpy(t, q0, 4);
+		memcpy(q0, q1, 4);
+		memcpy(q1, t, 4);
+
+		uint8_t tp = p0;
+		p0 = p1;
+		p1 = tp;
+
+		for (int i = 0; i < 16; i++)
+			indices[i] = (uint8_t)(15 - indices[i]);
+	}
+
+	BitWriter writer(pOutput);
+	writer.Write(1 << 6, 7);
+
+	for (int n = 0; n < 4; n++)
+	{
+		writer.Write(q0[n], 7);
+		writer.Write(q1[n], 7);
+	}
+
+	writer.Write(p0, 1);
+	writer.Write(p1, 1);
+	writer.Write(indices[0], 3);
+
+	for (int i = 1; i < 16; i++)
+		writer.Write(indices[i], 4);
+}
+
+void DecodeBC1(const uint8_t* pInput, ColorBlock& block, bool alwaysFourColor)
+{
+	uint16_t c0 = (uint16_t)(pInput[0] | (pInput[1] << 8));
+	uint16_t c1 = (uint16_t)(pInput[2] | (pInput[3] << 8));
+	uint32_t bits;
+	memcpy(&bits, pInput + 4, 4);
+
+	float e0[4], e1[4];
+	UnpackRGB565(c0, e0);
+	UnpackRGB565(c1, e1);
+
+	uint8_t palette[4][4];
+
+	for (int n = 0; n < 3; n++)
+	{
+		palette[0][n] = (uint8_t)e0[n];
+		palette[1][n] = (uint8_t)e1[n];
+
+		if (c0 > c1 || alwaysFourColor)
+		{
+			palette[2][n] = (uint8_t)((2.0f * e0[n] + e1[n]) / 3.0f + 0.5f);
+			palette[3][n] = (uint8_t)((e0[n] + 2.0f * e1[n]) / 3.0f + 0.5f);
+		}
+		else
+		{
+			palette[2][n] = (uint8_t)((e0[n] + e1[n]) * 0.5f + 0.5f);
+			palette[3][n] = 0;
+		}
+	}
+
+	palette[0][3] = palette[1][3] = palette[2][3] = 255;
+	palette[3][3] = (c0 > c1 || alwaysFourColor) ? 255 : 0;
+
+	for (int i = 0; i < 16; i++)
+		memcpy(block.texels[i], palette[(bits >> (i * 2)) & 3], 4);
+}
+
+void DecodeBC4(const uint8_t* pInput, uint8_t values[16])
+{
+	Palette palette;
+	BuildBC4Palette(pInput[0], pInput[1], palette);
+
+	uint64_t bits = 0;
+
+	for (int i = 0; i < 6; i++)
+		bits |= (uint64_t)pInput[2 + i] << (i * 8);
+
+	for (int i = 0; i < 16; i++)
+		values[i] = (uint8_t)palette.p[0][(bits >> (i * 3)) & 7];
+}
+
+void DecodeBC7(const uint8_t* pInput, ColorBlock& block)
+{
+	BitReader reader(pInput);
+
+	// Only mode 6 is produced by the encoder, anything else decodes to black
+	if (reader.Read(7) != (1 << 6))
+	{
+		memset(&block, 0, sizeof(block));
+		return;
+	}
+
+	uint32_t q0[4], q1[4];
+
+	for (int n = 0; n < 4; n++)
+	{
+		q0[n] = reader.Read(7);
+		q1[n] = reader.Read(7);
+	}
+
+	uint32_t p0 = reader.Read(1);
+	uint32_t p1 = reader.Read(1);
+
+	for (int i = 0; i < 16; i++)
+	{
+		uint32_t index = reader.Read(i == 0 ? 3 : 4);
+		int w = BC7Weights[index];
+
+		for (int n = 0; n < 4; n++)
+		{
+			int a = (int)(q0[n] * 2 + p0);
+			int b = (int)(q1[n] * 2 + p1);
+			block.texels[i][n] = (uint8_t)(((64 - w) * a + w * b + 32) >> 6);
+		}
+	}
+}
+
+void CompressImage(const uint8_t* pRGBA, uint32_t width, uint32_t height, BlockFormat format, JobSystem* pJobSystem, uint8_t* pOutput)
+{
+	CompressJob job;
+	job.pRGBA = pRGBA;
+	job.width = width;
+	job.height = height;
+	job.blocksX = (width + 3) / 4;
+	job.format = format;
+	job.pOutput = pOutput;
+
+	uint32_t blocksY = (height + 3) / 4;
+
+	if (pJobSystem)
+		pJobSystem->ParallelFor(blocksY, 1, &CompressRows, &job);
+	else
+		CompressRows(&job, 0, blocksY);
+}
+
+void DecompressImage(const uint8_t* pBlocks, uint32_t width, uint32_t height, BlockFormat format, uint8_t* pRGBA)
+{
+	uint32_t blocksX = (width + 3) / 4;
+	uint32_t blocksY = (height + 3) / 4;
+	uint32_t blockBytes = GetBlockBytes(format);
+
+	for (uint32_t by = 0; by < blocksY; by++)
+	{
+		for (uint32_t bx = 0; bx < blocksX; bx++)
+		{
+			const uint8_t* pBlock = pBlocks + ((size_t)by * blocksX + bx) * blockBytes;
+			ColorBlock block;
+
+			switch (format)
+			{
+			case BLOCK_BC1:
+				DecodeBC1(pBlock, block, false);
+				break;
+
+			case BLOCK_BC3:
+			{
+				uint8_t alpha[16];
+				DecodeBC4(pBlock, alpha);
+				DecodeBC1(pBlock + 8, block, true);
+
+				for (int i = 0; i < 16; i++)
+					block.texels[i][3] = alpha[i];
+
+				break;
+			}
+
+			case BLOCK_BC5:
+			{
+				uint8_t red[16], green[16];
+				DecodeBC4(pBlock, red);
+				DecodeBC4(pBlock + 8, green);
+
+				for (int i = 0; i < 16; i++)
+				{
+					block.texels[i][0] = red[i];
+					block.texels[i][1] = green[i];
+					block.texels[i][2] = 0;
+					block.texels[i][3] = 255;
+				}
+
+				break;
+			}
+
+			case BLOCK_BC7:
+				DecodeBC7(pBlock, block);
+				break;
+			}
+
+			for (uint32_t y = 0; y < 4 && by * 4 + y < height; y++)
+			{
+				for (uint32_t x = 0; x < 4 && bx * 4 + x < width; x++)
+					memcpy(pRGBA + ((size_t)(by * 4 + y) * width + bx * 4 + x) * 4, block.texels[y * 4 + x], 4);
+			}
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+class JobSystem;
+
+enum BlockFormat
+{
+	BLOCK_BC1,  // RGB, 1 bit alpha unused
+	BLOCK_BC3,  // RGB + interpolated alpha
+	BLOCK_BC5,  // two channel, red and green, for tangent space normals
+	BLOCK_BC7,  // RGBA, mode 6 only
+};
+
+// One 4x4 block of RGBA8 texels, row major
+struct ColorBlock
+{
+	uint8_t texels[16][4];
+};
+
+uint32_t GetBlockBytes(BlockFormat format);
+
+//--------------------------------------------------------------------------------------
+// Single block encoders. Endpoints come from the principal axis of the block and are then
+// refined with a least squares fit to the chosen indices, the index search is SSE.
+//--------------------------------------------------------------------------------------
+void EncodeBC1(const ColorBlock& block, uint8_t* pOutput);
+void EncodeBC3(const ColorBlock& block, uint8_t* pOutput);
+void EncodeBC4(const uint8_t values[16], uint8_t* pOutput);
+void EncodeBC5(const ColorBlock& block, uint8_t* pOutput);
+void EncodeBC7(const ColorBlock& block, uint8_t* pOutput);
+
+void DecodeBC1(const uint8_t* pInput, ColorBlock& block, bool alwaysFourColor);
+void DecodeBC4(const uint8_t* pInput, uint8_t values[16]);
+void DecodeBC7(const uint8_t* pInput, ColorBlock& block);
+
+// Whole image helpers, width and height don't have to be multiples of 4. Block rows are
+// spread over the job system when one is given.
+void CompressImage(const uint8_t* pRGBA, uint32_t width, uint32_t height, BlockFormat format, JobSystem* pJobSystem, uint8_t* pOutput);
+void DecompressImage(const uint8_t* pBlocks, uint32_t width, uint32_t height, BlockFormat format, uint8_t* pRGBA);
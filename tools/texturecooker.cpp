@@ -0,0 +1,228 @@
+//--------------------------------------------------------------------------------------
+// Offline texture cooker. Builds a gamma correct mip chain, compresses every level to
+// BC1/BC3/BC5/BC7 across all cores and writes a DDS that DDSTextureLoader loads as is.
+//
+//   g++ -std=c++17 -O2 -msse2 texturecooker.cpp texturecompress.cpp textureimage.cpp ../jobsystem.cpp -lpthread
+//
+//   texturecooker [options] input output.dds [input output.dds ...]
+//     --format bc1|bc3|bc5|bc7   default bc1, or bc3 when the source has alpha
+//     --normal                   tangent space normal map, implies bc5 and linear data
+//     --linear                   data isn't colour, filter without gamma
+//     --srgb                     tag the output as _SRGB for sRGB-aware renderers
+//     --filter box|kaiser        mip filter, default kaiser
+//     --clamp                    clamp at the edges instead of wrapping
+//     --nomips                   top level only
+//     --threads N                threads to use, default all cores
+//--------------------------------------------------------------------------------------
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "textureimage.h"
+#include "../jobsystem.h"
+
+struct CookSettings
+{
+	bool        formatGiven;
+	BlockFormat format;
+	bool        srgbView;
+	MipSettings mips;
+
+	CookSettings() : formatGiven(false), format(BLOCK_BC1), srgbView(false) {}
+};
+
+static double Seconds(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// PSNR of the decoded top level over the channels the format stores
+static double ComputePSNR(const Image& source, const uint8_t* pBlocks, BlockFormat format)
+{
+	std::vector<uint8_t> decoded((size_t)source.width * source.height * 4);
+	DecompressImage(pBlocks, source.width, source.height, format, decoded.data());
+
+	int channels = format == BLOCK_BC5 ? 2 : (format == BLOCK_BC1 ? 3 : 4);
+	double squaredError = 0.0;
+
+	for (size_t i = 0; i < (size_t)source.width * source.height; i++)
+	{
+		for (int n = 0; n < channels; n++)
+		{
+			double d = (double)source.texels[i * 4 + n] - decoded[i * 4 + n];
+			squaredError += d * d;
+		}
+	}
+
+	double mse = squaredError / ((double)source.width * source.height * channels);
+
+	return mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+static bool Cook(const char* inputPath, const char* outputPath, const CookSettings& settings, JobSystem* pJobSystem)
+{
+	Image source;
+
+	if (!LoadImage(inputPath, source))
+	{
+		fprintf(stderr, "%s: can't read, only TGA and uncompressed 32 bit DDS are supported\n", inputPath);
+		return false;
+	}
+
+	BlockFormat format = settings.format;
+
+	if (!settings.formatGiven)
+	{
+		format = BLOCK_BC1;
+
+		for (size_t i = 0; i < (size_t)source.width * source.height; i++)
+		{
+			if (source.texels[i * 4 + 3] != 255)
+			{
+				format = BLOCK_BC3;
+				break;
+			}
+		}
+	}
+
+	auto mipStart = std::chrono::high_resolution_clock::now();
+
+	std::vector<Image> levels;
+	GenerateMips(source, settings.mips, pJobSystem, levels);
+
+	double mipSeconds = Seconds(mipStart);
+
+	// Every level's blocks back to back, largest first
+	uint32_t blockBytes = GetBlockBytes(format);
+	std::vector<size_t> offsets(levels.size());
+	size_t totalBytes = 0;
+	double totalPixels = 0.0;
+
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		offsets[i] = totalBytes;
+		totalBytes += (size_t)((levels[i].width + 3) / 4) * ((levels[i].height + 3) / 4) * blockBytes;
+		totalPixels += (double)levels[i].width * levels[i].height;
+	}
+
+	std::vector<uint8_t> blocks(totalBytes);
+
+	auto encodeStart = std::chrono::high_resolution_clock::now();
+
+	for (size_t i = 0; i < levels.size(); i++)
+		CompressImage(levels[i].texels.data(), levels[i].width, levels[i].height, format, pJobSystem, &blocks[offsets[i]]);
+
+	double encodeSeconds = Seconds(encodeStart);
+
+	if (!WriteDDS(outputPath, source.width, source.height, (uint32_t)levels.size(), GetDXGIFormat(format, settings.srgbView),
+				  blocks.data(), blocks.size()))
+	{
+		fprintf(stderr, "%s: can't write\n", outputPath);
+		return false;
+	}
+
+	static const char* formatNames[] = { "BC1", "BC3", "BC5", "BC7" };
+
+	printf("%s -> %s: %ux%u %s, %zu mips, %.1f KB\n", inputPath, outputPath, source.width, source.height,
+		   formatNames[format], levels.size(), totalBytes / 1024.0);
+	printf("  mips %.1f ms, encode %.1f ms, %.2f MPix/s, PSNR %.2f dB\n", mipSeconds * 1000.0, encodeSeconds * 1000.0,
+		   totalPixels / 1.0e6 / (encodeSeconds > 0.0 ? encodeSeconds : 1.0e-9), ComputePSNR(source, blocks.data(), format));
+
+	return true;
+}
+
+static void PrintUsage()
+{
+	printf("texturecooker [--format bc1|bc3|bc5|bc7] [--normal] [--linear] [--srgb] [--filter box|kaiser]\n"
+		   "              [--clamp] [--nomips] [--threads N] input output.dds [input output.dds ...]\n");
+}
+
+int main(int argc, char* argv[])
+{
+	CookSettings settings;
+	int threads = -1;
+	std::vector<const char*> paths;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+
+		if (strcmp(arg, "--format") == 0 && i + 1 < argc)
+		{
+			const char* name = argv[++i];
+			settings.formatGiven = true;
+
+			if (strcmp(name, "bc1") == 0) settings.format = BLOCK_BC1;
+			else if (strcmp(name, "bc3") == 0) settings.format = BLOCK_BC3;
+			else if (strcmp(name, "bc5") == 0) settings.format = BLOCK_BC5;
+			else if (strcmp(name, "bc7") == 0) settings.format = BLOCK_BC7;
+			else
+			{
+				PrintUsage();
+				return 1;
+			}
+		}
+		else if (strcmp(arg, "--normal") == 0)
+		{
+			settings.mips.normalMap = true;
+			settings.mips.srgb = false;
+			settings.formatGiven = true;
+			settings.format = BLOCK_BC5;
+		}
+		else if (strcmp(arg, "--linear") == 0)
+		{
+			settings.mips.srgb = false;
+		}
+		else if (strcmp(arg, "--srgb") == 0)
+		{
+			settings.srgbView = true;
+		}
+		else if (strcmp(arg, "--filter") == 0 && i + 1 < argc)
+		{
+			settings.mips.filter = strcmp(argv[++i], "box") == 0 ? MIPFILTER_BOX : MIPFILTER_KAISER;
+		}
+		else if (strcmp(arg, "--clamp") == 0)
+		{
+			settings.mips.wrap = false;
+		}
+		else if (strcmp(arg, "--nomips") == 0)
+		{
+			settings.mips.maxLevels = 1;
+		}
+		else if (strcmp(arg, "--threads") == 0 && i + 1 < argc)
+		{
+			threads = atoi(argv[++i]);
+		}
+		else if (arg[0] == '-')
+		{
+			PrintUsage();
+			return 1;
+		}
+		else
+		{
+			paths.push_back(arg);
+		}
+	}
+
+	if (paths.empty() || paths.size() % 2 != 0)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// The calling thread works too, so N threads means N - 1 workers
+	JobSystem jobSystem;
+
+	if (threads != 1)
+		jobSystem.Init(threads > 1 ? (uint32_t)threads - 1 : 0);
+
+	bool ok = true;
+
+	for (size_t i = 0; i < paths.size(); i += 2)
+		ok = Cook(paths[i], paths[i + 1], settings, threads == 1 ? nullptr : &jobSystem) && ok;
+
+	jobSystem.Shutdown();
+
+	return ok ? 0 : 1;
+}
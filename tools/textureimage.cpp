@@ -0,0 +1,587 @@
+#include "textureimage.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "../jobsystem.h"
+
+namespace
+{
+	struct FloatImage
+	{
+		uint32_t           width;
+		uint32_t           height;
+		std::vector<float> texels;   // RGBA, linear
+	};
+
+	struct FilterTap
+	{
+		uint32_t source;
+		float    weight;
+	};
+
+	// Taps for every destination texel along one axis, offsets[i]..offsets[i + 1]
+	struct FilterTable
+	{
+		std::vector<FilterTap> taps;
+		std::vector<uint32_t>  offsets;
+	};
+
+	const uint32_t FourCCDX10 = 'D' | ('X' << 8) | ('1' << 16) | ('0' << 24);
+
+	float SRGBToLinear(float c)
+	{
+		return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	float LinearToSRGB(float c)
+	{
+		return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+	}
+
+	uint8_t ToByte(float v)
+	{
+		v = v * 255.0f + 0.5f;
+		return (uint8_t)(v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v));
+	}
+
+	// Zeroth order modified Bessel function, enough terms for the window's range
+	float BesselI0(float x)
+	{
+		float sum = 1.0f;
+		float term = 1.0f;
+		float halfX = x * 0.5f;
+
+		for (int k = 1; k < 32; k++)
+		{
+			term *= (halfX / k) * (halfX / k);
+			sum += term;
+
+			if (term < sum * 1.0e-8f)
+				break;
+		}
+
+		return sum;
+	}
+
+	float KaiserSinc(float x, float radius)
+	{
+		const float alpha = 4.0f;
+		const float pi = 3.14159265f;
+
+		if (fabsf(x) >= radius)
+			return 0.0f;
+
+		float sinc = fabsf(x) < 1.0e-5f ? 1.0f : sinf(pi * x) / (pi * x);
+		float t = x / radius;
+
+		return sinc * BesselI0(alpha * sqrtf(1.0f - t * t)) / BesselI0(alpha);
+	}
+
+	void BuildFilterTable(uint32_t sourceSize, uint32_t destSize, MipFilter filter, bool wrap, FilterTable& table)
+	{
+		// Kernels are defined in destination texels and stretched over the source
+		float ratio = (float)sourceSize / destSize;
+		float support = filter == MIPFILTER_BOX ? 0.5f : 2.0f;
+
+		table.taps.clear();
+		table.offsets.resize(destSize + 1);
+
+		for (uint32_t i = 0; i < destSize; i++)
+		{
+			table.offsets[i] = (uint32_t)table.taps.size();
+
+			float center = (i + 0.5f) * ratio;
+			int first = (int)floorf(center - support * ratio);
+			int last = (int)ceilf(center + support * ratio);
+			float total = 0.0f;
+
+			for (int s = first; s <= last; s++)
+			{
+				float x = (s + 0.5f - center) / ratio;
+				float weight = filter == MIPFILTER_BOX ? (fabsf(x) <= 0.5f ? 1.0f : 0.0f) : KaiserSinc(x, support);
+
+				if (weight == 0.0f)
+					continue;
+
+				int source = s;
+
+				if (wrap)
+					source = ((s % (int)sourceSize) + (int)sourceSize) % (int)sourceSize;
+				else
+					source = s < 0 ? 0 : (s >= (int)sourceSize ? (int)sourceSize - 1 : s);
+
+				FilterTap tap = { (uint32_t)source, weight };
+				table.taps.push_back(tap);
+				total += weight;
+			}
+
+			for (uint32_t t = table.offsets[i]; t < table.taps.size(); t++)
+				table.taps[t].weight /= total;
+		}
+
+		table.offsets[destSize] = (uint32_t)table.taps.size();
+	}
+
+	template<typename F>
+	void ForEachRow(JobSystem* pJobSystem, uint32_t rows, F& func)
+	{
+		if (pJobSystem)
+			pJobSystem->ParallelFor(rows, 4, func);
+		else
+			func(0, rows);
+	}
+
+	void Downsample(const FloatImage& source, FloatImage& dest, const MipSettings& settings, JobSystem* pJobSystem)
+	{
+		FilterTable horizontal, vertical;
+		BuildFilterTable(source.width, dest.width, settings.filter, settings.wrap, horizontal);
+		BuildFilterTable(source.height, dest.height, settings.filter, settings.wrap, vertical);
+
+		// Separable, rows first into an intermediate that is dest.width wide
+		std::vector<float> temp((size_t)dest.width * source.height * 4);
+
+		auto filterRows = [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t y = begin; y < end; y++)
+			{
+				const float* pRow = &source.texels[(size_t)y * source.width * 4];
+				float* pOut = &temp[(size_t)y * dest.width * 4];
+
+				for (uint32_t x = 0; x < dest.width; x++)
+				{
+					float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+					for (uint32_t t = horizontal.offsets[x]; t < horizontal.offsets[x + 1]; t++)
+					{
+						const float* pTexel = pRow + horizontal.taps[t].source * 4;
+						float w = horizontal.taps[t].weight;
+
+						for (int n = 0; n < 4; n++)
+							sum[n] += pTexel[n] * w;
+					}
+
+					memcpy(pOut + x * 4, sum, sizeof(sum));
+				}
+			}
+		};
+
+		ForEachRow(pJobSystem, source.height, filterRows);
+
+		auto filterColumns = [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t y = begin; y < end; y++)
+			{
+				float* pOut = &dest.texels[(size_t)y * dest.width * 4];
+				memset(pOut, 0, sizeof(float) * dest.width * 4);
+
+				for (uint32_t t = vertical.offsets[y]; t < vertical.offsets[y + 1]; t++)
+				{
+					const float* pRow = &temp[(size_t)vertical.taps[t].source * dest.width * 4];
+					float w = vertical.taps[t].weight;
+
+					for (uint32_t i = 0; i < dest.width * 4; i++)
+						pOut[i] += pRow[i] * w;
+				}
+
+				// Negative lobes can push values out of range
+				for (uint32_t x = 0; x < dest.width; x++)
+				{
+					float* pTexel = pOut + x * 4;
+
+					if (settings.normalMap)
+					{
+						float length = sqrtf(pTexel[0] * pTexel[0] + pTexel[1] * pTexel[1] + pTexel[2] * pTexel[2]);
+
+						if (length > 1.0e-6f)
+						{
+							pTexel[0] /= length;
+							pTexel[1] /= length;
+							pTexel[2] /= length;
+						}
+						else
+						{
+							pTexel[0] = 0.0f;
+							pTexel[1] = 0.0f;
+							pTexel[2] = 1.0f;
+						}
+					}
+					else
+					{
+						for (int n = 0; n < 3; n++)
+							pTexel[n] = pTexel[n] < 0.0f ? 0.0f : (pTexel[n] > 1.0f ? 1.0f : pTexel[n]);
+					}
+
+					pTexel[3] = pTexel[3] < 0.0f ? 0.0f : (pTexel[3] > 1.0f ? 1.0f : pTexel[3]);
+				}
+			}
+		};
+
+		ForEachRow(pJobSystem, dest.height, filterColumns);
+	}
+
+	void ToFloat(const Image& image, const MipSettings& settings, FloatImage& result)
+	{
+		float toLinear[256];
+
+		for (int i = 0; i < 256; i++)
+			toLinear[i] = settings.srgb ? SRGBToLinear(i / 255.0f) : i / 255.0f;
+
+		result.width = image.width;
+		result.height = image.height;
+		result.texels.resize((size_t)image.width * image.height * 4);
+
+		for (size_t i = 0; i < (size_t)image.width * image.height; i++)
+		{
+			const uint8_t* pIn = &image.texels[i * 4];
+			float* pOut = &result.texels[i * 4];
+
+			for (int n = 0; n < 3; n++)
+				pOut[n] = settings.normalMap ? pIn[n] / 127.5f - 1.0f : toLinear[pIn[n]];
+
+			pOut[3] = pIn[3] / 255.0f;
+		}
+	}
+
+	void ToBytes(const FloatImage& image, const MipSettings& settings, Image& result)
+	{
+		result.width = image.width;
+		result.height = image.height;
+		result.texels.resize((size_t)image.width * image.height * 4);
+
+		for (size_t i = 0; i < (size_t)image.width * image.height; i++)
+		{
+			const float* pIn = &image.texels[i * 4];
+			uint8_t* pOut = &result.texels[i * 4];
+
+			for (int n = 0; n < 3; n++)
+			{
+				if (settings.normalMap)
+					pOut[n] = ToByte(pIn[n] * 0.5f + 0.5f);
+				else
+					pOut[n] = ToByte(settings.srgb ? LinearToSRGB(pIn[n]) : pIn[n]);
+			}
+
+			pOut[3] = ToByte(pIn[3]);
+		}
+	}
+
+	bool ReadWholeFile(const char* path, std::vector<uint8_t>& data)
+	{
+		FILE* pFile = fopen(path, "rb");
+
+		if (pFile == nullptr)
+			return false;
+
+		fseek(pFile, 0, SEEK_END);
+		long size = ftell(pFile);
+		fseek(pFile, 0, SEEK_SET);
+
+		data.resize(size > 0 ? (size_t)size : 0);
+		bool ok = size > 0 && fread(data.data(), 1, data.size(), pFile) == data.size();
+		fclose(pFile);
+
+		return ok;
+	}
+
+	uint32_t ReadU32(const uint8_t* p)
+	{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	bool LoadTGA(const std::vector<uint8_t>& data, Image& image)
+	{
+		if (data.size() < 18)
+			return false;
+
+		const uint8_t* pHeader = data.data();
+		uint32_t idLength = pHeader[0];
+		uint32_t type = pHeader[2];
+		uint32_t width = pHeader[12] | (pHeader[13] << 8);
+		uint32_t height = pHeader[14] | (pHeader[15] << 8);
+		uint32_t bpp = pHeader[16];
+		bool topDown = (pHeader[17] & 0x20) != 0;
+
+		bool rle = type == 10 || type == 11;
+		bool grey = type == 3 || type == 11;
+
+		if ((type != 2 && type != 3 && type != 10 && type != 11) || pHeader[1] != 0 || width == 0 || height == 0)
+			return false;
+
+		if ((grey && bpp != 8) || (!grey && bpp != 24 && bpp != 32))
+			return false;
+
+		uint32_t bytesPerPixel = bpp / 8;
+		size_t position = 18 + idLength;
+		size_t pixelCount = (size_t)width * height;
+
+		std::vector<uint8_t> pixels(pixelCount * bytesPerPixel);
+
+		if (rle)
+		{
+			size_t written = 0;
+
+			while (written < pixelCount)
+			{
+				if (position >= data.size())
+					return false;
+
+				uint8_t packet = data[position++];
+				size_t count = (packet & 0x7F) + 1;
+
+				if (written + count > pixelCount)
+					return false;
+
+				if (packet & 0x80)
+				{
+					if (position + bytesPerPixel > data.size())
+						return false;
+
+					for (size_t i = 0; i < count; i++)
+						memcpy(&pixels[(written + i) * bytesPerPixel], &data[position], bytesPerPixel);
+
+					position += bytesPerPixel;
+				}
+				else
+				{
+					if (position + count * bytesPerPixel > data.size())
+						return false;
+
+					memcpy(&pixels[written * bytesPerPixel], &data[position], count * bytesPerPixel);
+					position += count * bytesPerPixel;
+				}
+
+				written += count;
+			}
+		}
+		else
+		{
+			if (position + pixels.size() > data.size())
+				return false;
+
+			memcpy(pixels.data(), &data[position], pixels.size());
+		}
+
+		image.width = width;
+		image.height = height;
+		image.texels.resize(pixelCount * 4);
+
+		for (uint32_t y = 0; y < height; y++)
+		{
+			uint32_t sourceRow = topDown ? y : height - 1 - y;
+
+			for (uint32_t x = 0; x < width; x++)
+			{
+				const uint8_t* pIn = &pixels[((size_t)sourceRow * width + x) * bytesPerPixel];
+				uint8_t* pOut = &image.texels[((size_t)y * width + x) * 4];
+
+				if (grey)
+				{
+					pOut[0] = pOut[1] = pOut[2] = pIn[0];
+					pOut[3] = 255;
+				}
+				else
+				{
+					pOut[0] = pIn[2];
+					pOut[1] = pIn[1];
+					pOut[2] = pIn[0];
+					pOut[3] = bytesPerPixel == 4 ? pIn[3] : 255;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	uint32_t MaskShift(uint32_t mask)
+	{
+		uint32_t shift = 0;
+
+		while (mask && !(mask & 1))
+		{
+			mask >>= 1;
+			shift++;
+		}
+
+		return shift;
+	}
+
+	bool LoadDDS(const std::vector<uint8_t>& data, Image& image)
+	{
+		if (data.size() < 128 || ReadU32(data.data()) != ('D' | ('D' << 8) | ('S' << 16) | (' ' << 24)))
+			return false;
+
+		const uint8_t* pHeader = data.data() + 4;
+		uint32_t height = ReadU32(pHeader + 8);
+		uint32_t width = ReadU32(pHeader + 12);
+		uint32_t pfFlags = ReadU32(pHeader + 76);
+		uint32_t fourCC = ReadU32(pHeader + 80);
+		uint32_t bitCount = ReadU32(pHeader + 84);
+		uint32_t masks[4] = { ReadU32(pHeader + 88), ReadU32(pHeader + 92), ReadU32(pHeader + 96), ReadU32(pHeader + 100) };
+		size_t position = 128;
+
+		if ((pfFlags & 0x4) && fourCC == FourCCDX10)
+		{
+			if (data.size() < 148)
+				return false;
+
+			// R8G8B8A8 and B8G8R8A8, plain or sRGB
+			uint32_t format = ReadU32(data.data() + 128);
+			position = 148;
+
+			if (format == 28 || format == 29)
+			{
+				masks[0] = 0x000000FF; masks[1] = 0x0000FF00; masks[2] = 0x00FF0000; masks[3] = 0xFF000000;
+			}
+			else if (format == 87 || format == 91)
+			{
+				masks[0] = 0x00FF0000; masks[1] = 0x0000FF00; masks[2] = 0x000000FF; masks[3] = 0xFF000000;
+			}
+			else
+			{
+				return false;
+			}
+
+			bitCount = 32;
+		}
+		else if (!(pfFlags & 0x40) || bitCount != 32)
+		{
+			// Only uncompressed 32 bit RGB(A) is accepted as a source
+			return false;
+		}
+
+		if (!(pfFlags & 0x1) && !(pfFlags & 0x4))
+			masks[3] = 0;
+
+		size_t pixelCount = (size_t)width * height;
+
+		if (width == 0 || height == 0 || position + pixelCount * 4 > data.size())
+			return false;
+
+		image.width = width;
+		image.height = height;
+		image.texels.resize(pixelCount * 4);
+
+		for (size_t i = 0; i < pixelCount; i++)
+		{
+			uint32_t texel = ReadU32(&data[position + i * 4]);
+
+			for (int n = 0; n < 4; n++)
+				image.texels[i * 4 + n] = masks[n] ? (uint8_t)((texel & masks[n]) >> MaskShift(masks[n])) : 255;
+		}
+
+		return true;
+	}
+
+	void WriteU32(uint8_t* p, uint32_t value)
+	{
+		p[0] = (uint8_t)value;
+		p[1] = (uint8_t)(value >> 8);
+		p[2] = (uint8_t)(value >> 16);
+		p[3] = (uint8_t)(value >> 24);
+	}
+}
+
+bool LoadImage(const char* path, Image& image)
+{
+	std::vector<uint8_t> data;
+
+	if (!ReadWholeFile(path, data))
+		return false;
+
+	return LoadImageFromMemory(data, image);
+}
+
+bool LoadImageFromMemory(const std::vector<uint8_t>& data, Image& image)
+{
+	if (data.size() >= 4 && memcmp(data.data(), "DDS ", 4) == 0)
+		return LoadDDS(data, image);
+
+	return LoadTGA(data, image);
+}
+
+void GenerateMips(const Image& source, const MipSettings& settings, JobSystem* pJobSystem, std::vector<Image>& levels)
+{
+	levels.clear();
+	levels.push_back(source);
+
+	FloatImage current;
+	ToFloat(source, settings, current);
+
+	while ((current.width > 1 || current.height > 1) && (settings.maxLevels == 0 || levels.size() < settings.maxLevels))
+	{
+		FloatImage next;
+		next.width = current.width > 1 ? current.width / 2 : 1;
+		next.height = current.height > 1 ? current.height / 2 : 1;
+		next.texels.resize((size_t)next.width * next.height * 4);
+
+		Downsample(current, next, settings, pJobSystem);
+
+		levels.push_back(Image());
+		ToBytes(next, settings, levels.back());
+
+		current.width = next.width;
+		current.height = next.height;
+		current.texels.swap(next.texels);
+	}
+}
+
+uint32_t GetDXGIFormat(BlockFormat format, bool srgbView)
+{
+	switch (format)
+	{
+	case BLOCK_BC1: return srgbView ? 72 : 71;
+	case BLOCK_BC3: return srgbView ? 78 : 77;
+	case BLOCK_BC5: return 83;
+	case BLOCK_BC7: return srgbView ? 99 : 98;
+	}
+
+	return 0;
+}
+
+void BuildDDS(uint32_t width, uint32_t height, uint32_t mipCount, uint32_t dxgiFormat, const uint8_t* pData, size_t dataSize,
+			  std::vector<uint8_t>& output)
+{
+	uint8_t header[4 + 124 + 20];
+	memset(header, 0, sizeof(header));
+
+	uint32_t blocksX = (width + 3) / 4;
+	uint32_t blockBytes = (dxgiFormat == 71 || dxgiFormat == 72) ? 8 : 16;
+
+	uint8_t* pHeader = header + 4;
+	memcpy(header, "DDS ", 4);
+	WriteU32(pHeader + 0, 124);
+	WriteU32(pHeader + 4, 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000);   // caps, height, width, pixel format, mip count, linear size
+	WriteU32(pHeader + 8, height);
+	WriteU32(pHeader + 12, width);
+	WriteU32(pHeader + 16, blocksX * ((height + 3) / 4) * blockBytes);
+	WriteU32(pHeader + 24, mipCount);
+	WriteU32(pHeader + 72, 32);
+	WriteU32(pHeader + 76, 0x4);
+	WriteU32(pHeader + 80, FourCCDX10);
+	WriteU32(pHeader + 104, 0x1000 | (mipCount > 1 ? 0x8 | 0x400000 : 0));   // texture, complex, mipmap
+
+	uint8_t* pDX10 = header + 128;
+	WriteU32(pDX10 + 0, dxgiFormat);
+	WriteU32(pDX10 + 4, 3);   // TEXTURE2D
+	WriteU32(pDX10 + 12, 1);  // array size
+
+	output.assign(header, header + sizeof(header));
+	output.insert(output.end(), pData, pData + dataSize);
+}
+
+bool WriteDDS(const char* path, uint32_t width, uint32_t height, uint32_t mipCount, uint32_t dxgiFormat,
+			  const uint8_t* pData, size_t dataSize)
+{
+	std::vector<uint8_t> file;
+	BuildDDS(width, height, mipCount, dxgiFormat, pData, dataSize, file);
+
+	FILE* pFile = fopen(path, "wb");
+
+	if (pFile == nullptr)
+		return false;
+
+	bool ok = fwrite(file.data(), 1, file.size(), pFile) == file.size();
+
+	return fclose(pFile) == 0 && ok;
+}
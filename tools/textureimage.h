@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "texturecompress.h"
+
+class JobSystem;
+
+// RGBA8 image, rows top to bottom
+struct Image
+{
+	uint32_t             width;
+	uint32_t             height;
+	std::vector<uint8_t> texels;
+
+	Image() : width(0), height(0) {}
+};
+
+enum MipFilter
+{
+	MIPFILTER_BOX,
+	MIPFILTER_KAISER,
+};
+
+struct MipSettings
+{
+	MipFilter filter;
+	bool      wrap;       // tiling textures filter across the edges, others clamp
+	bool      srgb;       // colour is stored gamma encoded and is filtered in linear space
+	bool      normalMap;  // RGB is a unit vector, renormalised after every level
+	uint32_t  maxLevels;  // 0 for a full chain
+
+	MipSettings() : filter(MIPFILTER_KAISER), wrap(true), srgb(true), normalMap(false), maxLevels(0) {}
+};
+
+// Uncompressed 24/32 bit TGA (plain or RLE) and uncompressed 32 bit DDS
+bool LoadImage(const char* path, Image& image);
+bool LoadImageFromMemory(const std::vector<uint8_t>& data, Image& image);
+
+// Builds the whole chain from the top level down, levels[0] is a copy of the source
+void GenerateMips(const Image& source, const MipSettings& settings, JobSystem* pJobSystem, std::vector<Image>& levels);
+
+// DXGI format of the cooked texture, _SRGB variants when srgbView is set
+uint32_t GetDXGIFormat(BlockFormat format, bool srgbView);
+
+// Writes a DDS with a DX10 header that DDSTextureLoader reads directly. pData holds every
+// level's blocks back to back, largest first.
+void BuildDDS(uint32_t width, uint32_t height, uint32_t mipCount, uint32_t dxgiFormat, const uint8_t* pData, size_t dataSize,
+			  std::vector<uint8_t>& output);
+bool WriteDDS(const char* path, uint32_t width, uint32_t height, uint32_t mipCount, uint32_t dxgiFormat,
+			  const uint8_t* pData, size_t dataSize);
@@ -0,0 +1,467 @@
+//--------------------------------------------------------------------------------------
+// TlsfAllocator checks and fragmentation benchmark. The checks cover splitting, merging,
+// growing and defragmenting, then run a long random alloc/free sequence against a plain
+// list of live ranges. The benchmark churns mesh sized blocks through a pool that stays
+// mostly full, next to a first fit free list, and reports failures, fragmentation, time
+// per call and what Defragment has to move to get the free space back into one piece.
+//
+//   g++ -std=c++17 -O2 tlsfbench.cpp ../tlsf.cpp
+//
+//   tlsfbench [operations]     default 200000, exit code 1 if a check fails
+//--------------------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../tlsf.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double Milliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static uint32_t s_random = 12345;
+
+static uint32_t RandomUint()
+{
+	s_random = s_random * 1664525u + 1013904223u;
+	return s_random >> 8;
+}
+
+static float RandomFloat(float low, float high)
+{
+	return low + (high - low) * (RandomUint() / 16777216.0f);
+}
+
+// Mesh sizes spread evenly over the powers of two between low and high
+static uint32_t RandomSize(uint32_t low, uint32_t high)
+{
+	float bits = RandomFloat(log2f((float)low), log2f((float)high));
+	return std::max(low, (uint32_t)exp2f(bits));
+}
+
+static bool s_failed = false;
+
+static void Check(bool ok, const char* what)
+{
+	printf("  %-4s %s\n", ok ? "ok" : "FAIL", what);
+	s_failed |= !ok;
+}
+
+struct Live
+{
+	uint32_t block;
+	uint32_t size;
+};
+
+// Live blocks don't overlap and stay inside the capacity
+static bool CheckRanges(const TlsfAllocator& allocator, const std::vector<Live>& live)
+{
+	std::vector<std::pair<uint32_t, uint32_t>> ranges;
+
+	for (const Live& entry : live)
+	{
+		if (allocator.GetSize(entry.block) != entry.size)
+			return false;
+
+		ranges.push_back(std::make_pair(allocator.GetOffset(entry.block), entry.size));
+	}
+
+	std::sort(ranges.begin(), ranges.end());
+
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		if (ranges[i].first + ranges[i].second > allocator.GetCapacity())
+			return false;
+
+		if (i > 0 && ranges[i - 1].first + ranges[i - 1].second > ranges[i].first)
+			return false;
+	}
+
+	return true;
+}
+
+static void RunChecks(uint32_t operations)
+{
+	printf("checks\n");
+
+	// Splits from the front and merges back into one block
+	{
+		TlsfAllocator allocator;
+		allocator.Init(1000);
+
+		uint32_t a = allocator.Alloc(100);
+		uint32_t b = allocator.Alloc(200);
+		uint32_t c = allocator.Alloc(300);
+		Check(allocator.GetOffset(a) == 0 && allocator.GetOffset(b) == 100 && allocator.GetOffset(c) == 300, "splits in order");
+
+		allocator.Free(b);
+		uint32_t d = allocator.Alloc(200);
+		Check(allocator.GetOffset(d) == 100, "reuses a freed block of the same class");
+
+		allocator.Free(a);
+		allocator.Free(c);
+		allocator.Free(d);
+		TlsfStats stats = allocator.GetStats();
+		Check(stats.freeBlocks == 1 && stats.largestFree == 1000 && stats.used == 0 && allocator.Validate(), "merges back into one block");
+
+		Check(allocator.Alloc(0) == TlsfInvalidBlock && allocator.Alloc(1001) == TlsfInvalidBlock, "rejects empty and oversized requests");
+		uint32_t all = allocator.Alloc(1000);
+		Check(all != TlsfInvalidBlock && allocator.Alloc(1) == TlsfInvalidBlock, "fills exactly, then reports full");
+		allocator.Free(all);
+	}
+
+	// Growing extends the free tail or adds one after a used block
+	{
+		TlsfAllocator allocator;
+		allocator.Init(100);
+
+		uint32_t a = allocator.Alloc(60);
+		allocator.Grow(200);
+		Check(allocator.GetStats().freeBlocks == 1 && allocator.GetStats().largestFree == 140 && allocator.Validate(), "grows the free tail");
+
+		uint32_t b = allocator.Alloc(140);
+		allocator.Grow(300);
+		uint32_t c = allocator.Alloc(100);
+		Check(b != TlsfInvalidBlock && c != TlsfInvalidBlock && allocator.GetOffset(c) == 200 && allocator.GetOffset(a) == 0 &&
+			  allocator.Validate(), "grows past a used block");
+	}
+
+	// Defragment slides blocks down and keeps their handles and contents
+	{
+		TlsfAllocator allocator;
+		allocator.Init(4096);
+
+		std::vector<uint32_t> contents(4096, 0);
+		std::vector<Live> live;
+
+		for (uint32_t i = 0; i < 64; i++)
+		{
+			uint32_t size = RandomSize(4, 64);
+			uint32_t block = allocator.Alloc(size);
+
+			if (block == TlsfInvalidBlock)
+				continue;
+
+			std::fill(contents.begin() + allocator.GetOffset(block), contents.begin() + allocator.GetOffset(block) + size, block + 1);
+			live.push_back({ block, size });
+		}
+
+		std::vector<Live> kept;
+
+		for (size_t i = 0; i < live.size(); i++)
+		{
+			if (i % 2 == 0)
+				allocator.Free(live[i].block);
+			else
+				kept.push_back(live[i]);
+		}
+
+		live.swap(kept);
+
+		float before = allocator.GetStats().fragmentation;
+		std::vector<TlsfMove> moves;
+		uint32_t passes = 0;
+		uint32_t moved = 0;
+
+		// A few at a time, the way a frame would spread it out
+		while (allocator.Defragment(4, moves) > 0)
+		{
+			for (const TlsfMove& move : moves)
+				memmove(&contents[move.to], &contents[move.from], sizeof(uint32_t) * move.size);
+
+			moved += (uint32_t)moves.size();
+			passes++;
+		}
+
+		bool intact = true;
+
+		for (const Live& entry : live)
+		{
+			uint32_t offset = allocator.GetOffset(entry.block);
+
+			for (uint32_t i = 0; i < entry.size; i++)
+				intact &= contents[offset + i] == entry.block + 1;
+		}
+
+		TlsfStats stats = allocator.GetStats();
+		printf("       %u moves in %u passes, fragmentation %.2f -> %.2f\n", moved, passes, before, stats.fragmentation);
+		Check(stats.freeBlocks == 1 && stats.fragmentation == 0.0f && allocator.Validate(), "defragments into one free range");
+		Check(stats.largestFree == 4096 - stats.used, "free space ends up at the end");
+		Check(intact && CheckRanges(allocator, live), "moved blocks keep their handles and contents");
+	}
+
+	// Random sequence against the list of live ranges
+	{
+		TlsfAllocator allocator;
+		allocator.Init(1 << 16);
+
+		std::vector<Live> live;
+		std::vector<TlsfMove> moves;
+		bool valid = true;
+		uint32_t failures = 0;
+
+		for (uint32_t i = 0; i < operations && valid; i++)
+		{
+			uint32_t action = RandomUint() % 100;
+
+			if (action < 55 || live.empty())
+			{
+				uint32_t size = RandomSize(1, 2048);
+				uint32_t block = allocator.Alloc(size);
+
+				if (block != TlsfInvalidBlock)
+					live.push_back({ block, size });
+				else
+					failures++;
+			}
+			else if (action < 99)
+			{
+				size_t index = RandomUint() % live.size();
+				allocator.Free(live[index].block);
+				live[index] = live.back();
+				live.pop_back();
+			}
+			else
+			{
+				allocator.Defragment(8, moves);
+			}
+
+			if (i % 1000 == 0)
+				valid = allocator.Validate() && CheckRanges(allocator, live);
+		}
+
+		valid = valid && allocator.Validate() && CheckRanges(allocator, live);
+
+		for (const Live& entry : live)
+			allocator.Free(entry.block);
+
+		printf("       %u operations, %u requests didn't fit\n", operations, failures);
+		Check(valid, "random alloc, free and defragment keep the lists consistent");
+		Check(allocator.GetStats().freeBlocks == 1 && allocator.GetUsed() == 0, "everything merges back after the random run");
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// First fit over a sorted list of free ranges, what a simple pool would do
+//--------------------------------------------------------------------------------------
+class FirstFitAllocator
+{
+private:
+	struct Range
+	{
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	std::vector<Range> _free;
+
+public:
+	void Init(uint32_t capacity)
+	{
+		_free.clear();
+		_free.push_back({ 0, capacity });
+	}
+
+	uint32_t Alloc(uint32_t size)
+	{
+		for (size_t i = 0; i < _free.size(); i++)
+		{
+			if (_free[i].size < size)
+				continue;
+
+			uint32_t offset = _free[i].offset;
+			_free[i].offset += size;
+			_free[i].size -= size;
+
+			if (_free[i].size == 0)
+				_free.erase(_free.begin() + i);
+
+			return offset;
+		}
+
+		return TlsfInvalidBlock;
+	}
+
+	void Free(uint32_t offset, uint32_t size)
+	{
+		auto it = std::lower_bound(_free.begin(), _free.end(), offset, [](const Range& range, uint32_t value) { return range.offset < value; });
+		it = _free.insert(it, { offset, size });
+
+		size_t index = it - _free.begin();
+
+		if (index + 1 < _free.size() && _free[index].offset + _free[index].size == _free[index + 1].offset)
+		{
+			_free[index].size += _free[index + 1].size;
+			_free.erase(_free.begin() + index + 1);
+		}
+
+		if (index > 0 && _free[index - 1].offset + _free[index - 1].size == _free[index].offset)
+		{
+			_free[index - 1].size += _free[index].size;
+			_free.erase(_free.begin() + index);
+		}
+	}
+
+	float Fragmentation() const
+	{
+		uint64_t total = 0;
+		uint32_t largest = 0;
+
+		for (const Range& range : _free)
+		{
+			total += range.size;
+			largest = std::max(largest, range.size);
+		}
+
+		return total > 0 ? 1.0f - (float)largest / total : 0.0f;
+	}
+};
+
+struct ChurnResult
+{
+	double   msPerMillion;
+	uint32_t failures;
+	float    averageFragmentation;
+};
+
+// Keeps the pool between 60 and 85 percent full with mesh sized blocks
+template<typename AllocFn, typename FreeFn, typename FragmentationFn>
+static ChurnResult Churn(uint32_t capacity, uint32_t operations, AllocFn alloc, FreeFn release, FragmentationFn fragmentation)
+{
+	struct Entry
+	{
+		uint32_t handle;
+		uint32_t size;
+	};
+
+	std::vector<Entry> live;
+	uint64_t used = 0;
+	ChurnResult result = {};
+	double fragmentationSum = 0.0;
+	uint32_t samples = 0;
+
+	s_random = 777;
+	Clock::time_point start = Clock::now();
+
+	for (uint32_t i = 0; i < operations; i++)
+	{
+		bool grow = used < capacity * 0.6 || (used < capacity * 0.85 && (RandomUint() & 1));
+
+		if (grow || live.empty())
+		{
+			uint32_t size = RandomSize(24, 4096);
+			uint32_t handle = alloc(size);
+
+			if (handle != TlsfInvalidBlock)
+			{
+				live.push_back({ handle, size });
+				used += size;
+			}
+			else
+			{
+				result.failures++;
+			}
+		}
+		else
+		{
+			size_t index = RandomUint() % live.size();
+			release(live[index].handle, live[index].size);
+			used -= live[index].size;
+			live[index] = live.back();
+			live.pop_back();
+		}
+
+		if (i % 4096 == 0)
+		{
+			fragmentationSum += fragmentation();
+			samples++;
+		}
+	}
+
+	result.msPerMillion = Milliseconds(start) * 1e6 / operations;
+	result.averageFragmentation = samples > 0 ? (float)(fragmentationSum / samples) : 0.0f;
+
+	for (const Entry& entry : live)
+		release(entry.handle, entry.size);
+
+	return result;
+}
+
+static void RunBenchmark(uint32_t operations)
+{
+	const uint32_t capacity = 1 << 22;
+
+	printf("\nchurn, %u operations over %u units, blocks 24 to 4096\n", operations, capacity);
+
+	TlsfAllocator tlsf;
+	tlsf.Init(capacity);
+
+	ChurnResult tlsfResult = Churn(capacity, operations,
+		[&](uint32_t size) { return tlsf.Alloc(size); },
+		[&](uint32_t block, uint32_t) { tlsf.Free(block); },
+		[&]() { return tlsf.GetStats().fragmentation; });
+
+	FirstFitAllocator firstFit;
+	firstFit.Init(capacity);
+
+	ChurnResult firstFitResult = Churn(capacity, operations,
+		[&](uint32_t size) { return firstFit.Alloc(size); },
+		[&](uint32_t offset, uint32_t size) { firstFit.Free(offset, size); },
+		[&]() { return firstFit.Fragmentation(); });
+
+	printf("  %-10s %8.1f ns/op  %6u failed  fragmentation %.3f\n", "tlsf", tlsfResult.msPerMillion, tlsfResult.failures,
+		   tlsfResult.averageFragmentation);
+	printf("  %-10s %8.1f ns/op  %6u failed  fragmentation %.3f\n", "first fit", firstFitResult.msPerMillion, firstFitResult.failures,
+		   firstFitResult.averageFragmentation);
+
+	// Fragment it on purpose and see what compaction costs
+	std::vector<uint32_t> blocks;
+	uint32_t block;
+
+	while ((block = tlsf.Alloc(RandomSize(24, 4096))) != TlsfInvalidBlock)
+		blocks.push_back(block);
+
+	for (size_t i = 0; i < blocks.size(); i += 2)
+		tlsf.Free(blocks[i]);
+
+	TlsfStats before = tlsf.GetStats();
+	std::vector<TlsfMove> moves;
+	uint64_t unitsMoved = 0;
+	uint32_t blocksMoved = 0;
+
+	Clock::time_point start = Clock::now();
+
+	while (tlsf.Defragment(256, moves) > 0)
+	{
+		blocksMoved += (uint32_t)moves.size();
+
+		for (const TlsfMove& move : moves)
+			unitsMoved += move.size;
+	}
+
+	double defragmentMs = Milliseconds(start);
+	TlsfStats after = tlsf.GetStats();
+
+	printf("  defragment %u blocks, %llu units moved in %.2f ms, free blocks %u -> %u, fragmentation %.3f -> %.3f\n", blocksMoved,
+		   (unsigned long long)unitsMoved, defragmentMs, before.freeBlocks, after.freeBlocks, before.fragmentation, after.fragmentation);
+
+	Check(after.freeBlocks == 1 && tlsf.Validate(), "defragment after the churn leaves one free range");
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t operations = argc > 1 ? (uint32_t)atoi(argv[1]) : 200000;
+
+	RunChecks(operations);
+	RunBenchmark(operations * 5);
+
+	printf("%s\n", s_failed ? "FAILED" : "all passed");
+
+	return s_failed ? 1 : 0;
+}